@@ -15,6 +15,9 @@
 #include <inline/exec.h>
 #include <inline/dos.h>
 
+#include <devices/timer.h>
+#include <inline/timer.h>
+
 #include <clib/debug_protos.h>
 #include "printf.h"
 
@@ -56,6 +59,9 @@ const char SmashRomID[]   = "smashrom "VERSION" ("BUILD_DATE")\r\n";
 typedef unsigned int uint;
 uint8_t flag_output;
 
+#include "pci_access.h"
+#include "pci_alloc.h"
+
 void
 dputs(const char *str)
 {
@@ -82,9 +88,30 @@ dputx(uint x)
     dputs(ptr);
 }
 
-#if 0
-uint8_t *copy_to_ram_ptr;
-static void
+void
+dputd(uint x)
+{
+    char buf[12];
+    char *ptr = buf + sizeof (buf) - 1;
+    *ptr = '\0';
+    do {
+        *(--ptr) = '0' + x % 10;
+        x /= 10;
+    } while (x != 0);
+    dputs(ptr);
+}
+
+static uint8_t *copy_to_ram_ptr;
+static uint     copy_to_ram_len;
+
+/*
+ * rom_copy_to_ram
+ * ---------------
+ * Copies the .text_to_ram section (the PCI allocator core) from ROM to
+ * fast RAM, and returns the address of the RAM copy of pci_alloc_scan().
+ * If no fast RAM is available, the ROM copy is used in place.
+ */
+static pci_alloc_scan_t
 rom_copy_to_ram(void)
 {
     uint copy_to_ram_start;
@@ -92,18 +119,90 @@ rom_copy_to_ram(void)
     __asm("lea _copy_to_ram_start,%0" : "=a" (copy_to_ram_start) ::);
     __asm("lea _copy_to_ram_end,%0" : "=a" (copy_to_ram_end) ::);
 
-    uint len = copy_to_ram_end - copy_to_ram_start;
-    printf("len=%x s=%x e=%x\n", len, copy_to_ram_start, copy_to_ram_end);
-    copy_to_ram_ptr = AllocMem(len, MEMF_PUBLIC);
-    if (copy_to_ram_ptr == NULL) {
-        dputs("AllocMem fail 1\n");
-        return;
+    copy_to_ram_len = copy_to_ram_end - copy_to_ram_start;
+    copy_to_ram_ptr = AllocMem(copy_to_ram_len, MEMF_FAST);
+    if (copy_to_ram_ptr == NULL)
+        return (pci_alloc_scan);
+
+    memcpy(copy_to_ram_ptr, (void *) copy_to_ram_start, copy_to_ram_len);
+    CacheClearU();
+    return ((pci_alloc_scan_t) (copy_to_ram_ptr +
+                                (uintptr_t) pci_alloc_scan -
+                                copy_to_ram_start));
+}
+
+/*
+ * rom_eclock_usec
+ * ---------------
+ * Converts the E-clock interval between two samples to microseconds.
+ */
+static uint
+rom_eclock_usec(struct EClockVal *start, struct EClockVal *end, uint freq)
+{
+    uint ticks = end->ev_lo - start->ev_lo;
+
+    return ((ticks / freq) * 1000000 +
+            (ticks % freq) * 1000 / (freq / 1000));
+}
+
+/*
+ * rom_pci_boot
+ * ------------
+ * Boot-time PCI bus reset, enumeration, and resource allocation. This
+ * runs without the C library stdio and memory allocator, and reports
+ * the time taken by each step on the serial debug output.
+ */
+static void
+rom_pci_boot(void)
+{
+    struct timerequest tr;
+    struct Device     *TimerBase = NULL;
+    struct EClockVal   ev_start;
+    struct EClockVal   ev_reset;
+    struct EClockVal   ev_end;
+    pci_alloc_scan_t   scan;
+    uint               freq = 0;
+    uint               count;
+
+    memset(&tr, 0, sizeof (tr));
+    if (OpenDevice((CONST_STRPTR) TIMERNAME, UNIT_ECLOCK,
+                   (struct IORequest *) &tr, 0) == 0) {
+        TimerBase = tr.tr_node.io_Device;
+        freq = ReadEClock(&ev_start);
     }
-    memcpy(copy_to_ram_ptr, (void *) copy_to_ram_start, len);
-    esend_cmd_core = (void *) (copy_to_ram_ptr +
-                               (uintptr_t) send_cmd_core - copy_to_ram_start);
+
+    if (pci_bridge_is_present() == 0) {
+        dputs("No PCI bridge\n");
+        goto rom_pci_boot_end;
+    }
+    pci_bridge_control(0, -1, -1, -1, FLAG_BRIDGE_RESET);
+    if (TimerBase != NULL)
+        ReadEClock(&ev_reset);
+
+    /* Run the allocator core from fast RAM */
+    scan = rom_copy_to_ram();
+    count = scan(bridge_type != BRIDGE_TYPE_AMIGAPCI);
+    if (copy_to_ram_ptr != NULL) {
+        FreeMem(copy_to_ram_ptr, copy_to_ram_len);
+        copy_to_ram_ptr = NULL;
+    }
+
+    dputs("PCI funcs=");
+    dputd(count);
+    if (TimerBase != NULL) {
+        ReadEClock(&ev_end);
+        dputs(" reset=");
+        dputd(rom_eclock_usec(&ev_start, &ev_reset, freq));
+        dputs("us scan=");
+        dputd(rom_eclock_usec(&ev_reset, &ev_end, freq));
+        dputs("us");
+    }
+    dputs((scan == pci_alloc_scan) ? " from ROM\n" : " from RAM\n");
+
+rom_pci_boot_end:
+    if (TimerBase != NULL)
+        CloseDevice((struct IORequest *) &tr);
 }
-#endif
 
 int
 call_main(void)
@@ -132,56 +231,12 @@ call_main(void)
     extern uint8_t flag_output;
     flag_output = 2;
 
-    if (SysBase == NULL) {
-        dputs("NULL SysBase\n");
-    }
-#if 0
-    __asm("move.l a0,-(sp)");
-    __asm("move.l a4,0x7770014");
-    __asm("move.l %0,a0" :: "r" (&DOSBase));
-    __asm("move.l a0,0x7770018");
-    __asm("move.l (sp)+,a0");
-#endif
-
-    if (DOSBase == NULL) {
-        dputs("NULL DOSBase 3\n");
-        return (1);
-    }
+    /* DOSBase remains open for the Delay() during PCI bridge reset */
+    rom_pci_boot();
 
-    if (DOSBase != NULL) {
-        CloseLibrary((struct Library *)DOSBase);
-        DOSBase = NULL;
-    }
-
-#if 0
-    /* Move some ROM code to RAM */
-    rom_copy_to_ram();
-#endif
-
-    /* malloc/free() library Constructors / Destructors */
-    void __ctor_stdlib_memory_init(void *);
-    void __dtor_stdlib_memory_exit(void *);
-    __ctor_stdlib_memory_init(SysBase);
-
-    dputs(" call main\n");
-    extern int main(int argc, char *argv[]);
-    char *args[] = { NULL, "-dd" };
-
-    /* Execute command line main() */
-    int rc = main(ARRAY_SIZE(args), args);
-
-    __dtor_stdlib_memory_exit(SysBase);
-//  FreeVec(copy_to_ram_ptr);
-    return (rc);
-#if 0
-    if (DOSBase != NULL) {
-        DOSBase = (struct DosLibrary *) OpenLibrary(DOSNAME, 34);
-        Close(fh_i);
-        Close(fh_o);
-        Close(fh_e);
-        CloseLibrary((struct Library *)DOSBase);
-    }
-#endif
+    CloseLibrary((struct Library *)DOSBase);
+    DOSBase = NULL;
+    return (0);
 }
 
 int __regargs
@@ -33,6 +33,7 @@ const char *version = "\0$VER: bec "VERSION" ("BUILD_DATE") \xA9 Chris Hooper";
 #include "amiga_kbd_codes.h"
 #include "../fw/bec_cmd.h"
 #include "becmsg.h"
+#include "becdecode.h"
 #include "crc32.h"
 
 #ifndef ADDR8
@@ -86,16 +87,23 @@ extern struct ExecBase *SysBase;
 #define MEM_LOOPS         1000000
 #define ROM_WINDOW_SIZE   (512 << 10)  // 512 KB
 #define MAX_CHUNK         (16 << 10)   // 16 KB
+#define FW_SLOT_BASE      0x08020000   // Must match fw/fwslot.h
+#define FW_SLOT_SIZE      (128 << 10)  // 128 KB
+#define FW_BLOCK_SIZE     1024         // Image bytes per message
 
 static const char cmd_options[] =
     "usage: bec <options>\n"
     "   debug        show debug output (-d)\n"
+    "   history      dump BEC sensor history as CSV (-H)\n"
     "   identify     identify Board Environment Controller (BEC)\n"
     "   loop <num>   repeat the command a specified number of times (-l)\n"
     "   quiet        minimize test output\n"
+    "   rtctrace     decode BEC trace of RTC bus accesses (-R)\n"
     "   set <n> <v>  set BEC value <n>=\"name\" and <v> is string (-s)\n"
+    "   snoop        show last BEC GPIO bus sampler capture (-S)\n"
     "   term         open BEC firmware terminal [-T]\n"
-    "   test[0123]   do interface test (-t)\n";
+    "   test[0123]   do interface test (-t)\n"
+    "   update <f>   write BEC firmware file <f> to other slot, or status (-u)\n";
 
 typedef struct {
     const char *const short_name;
@@ -103,14 +111,18 @@ typedef struct {
 } long_to_short_t;
 long_to_short_t long_to_short_main[] = {
     { "-d", "debug" },
+    { "-H", "history" },
     { "-i", "inquiry" },
     { "-i", "identify" },
     { "-i", "id" },
     { "-l", "loop" },
     { "-q", "quiet" },
+    { "-R", "rtctrace" },
     { "-s", "set" },
+    { "-S", "snoop" },
     { "-t", "test" },
     { "-T", "term" },
+    { "-u", "update" },
     { "-z", "z" },
 };
 
@@ -878,6 +890,471 @@ cmd_set_usage:
     return (0);
 }
 
+/*
+ * hist_print_row
+ * --------------
+ * Displays a single sensor history sample as a CSV row.
+ */
+static void
+hist_print_row(uint32_t msec, const int32_t *value, uint count)
+{
+    uint cur;
+
+    printf("%u.%03u", (uint) (msec / 1000), (uint) (msec % 1000));
+    for (cur = 0; cur < count; cur++) {
+        int v = value[cur];
+        printf(",%s%d.%03u", (v < 0) ? "-" : "", abs(v) / 1000, abs(v) % 1000);
+    }
+    printf("\n");
+}
+
+/*
+ * cmd_hist
+ * --------
+ * Dumps all sensor history held by the BEC as CSV. The first column is
+ * seconds since BEC boot. Each reply carries several history blocks,
+ * each of which holds many delta-encoded samples.
+ */
+static int
+cmd_hist(void)
+{
+    static uint8_t     buf[BEC_MSG_MAX_PAYLOAD];
+    bec_sensor_hist_t  req;
+    bec_sensor_hist_t *reply = (void *) buf;
+    const uint8_t     *ptr;
+    uint32_t           seq = 0;
+    uint               sensors;
+    uint               rlen;
+    uint               rc;
+    uint               cur;
+    uint               blk;
+
+    memset(&req, 0, sizeof (req));
+    req.bsh_flags = BSH_FLAG_NAMES;
+    req.bsh_count = BEC_HIST_MAX_SENSORS;
+    rc = send_cmd_retry(BEC_CMD_SENSOR_HIST, &req, sizeof (req),
+                        buf, sizeof (buf), &rlen);
+    if (rc != 0) {
+        printf("Sensor names failed: (%s)\n", bec_err(rc));
+        return (rc);
+    }
+    sensors = reply->bsh_count;
+    ptr = (const uint8_t *) (reply + 1);
+    printf("Time");
+    for (cur = 0; cur < sensors * 2; cur++) {
+        printf((cur & 1) ? " (%s)" : ",%s", ptr);
+        ptr += strlen((const char *) ptr) + 1;
+    }
+    printf("\n");
+
+    req.bsh_flags = 0;
+    while (1) {
+        req.bsh_seq   = seq;
+        req.bsh_count = 0xff;
+        rc = send_cmd_retry(BEC_CMD_SENSOR_HIST, &req, sizeof (req),
+                            buf, sizeof (buf), &rlen);
+        if (rc == BEC_STATUS_NODATA)
+            break;
+        if (rc != 0) {
+            printf("Sensor history failed: (%s)\n", bec_err(rc));
+            return (rc);
+        }
+        if (flag_debug)
+            printf("seq %u count %u last %u\n", (uint) reply->bsh_seq,
+                   reply->bsh_count, (uint) reply->bsh_last);
+
+        blk = bec_hist_decode((const uint8_t *) (reply + 1),
+                              rlen - sizeof (*reply), reply->bsh_count,
+                              sensors, hist_print_row);
+        if (blk != reply->bsh_count)
+            goto truncated;
+        seq = reply->bsh_seq + reply->bsh_count;
+        if ((reply->bsh_count == 0) || (seq > reply->bsh_last))
+            break;
+        if (is_user_abort())
+            return (1);
+    }
+    return (0);
+
+truncated:
+    printf("Sensor history block %u corrupt\n",
+           (uint) (reply->bsh_seq + blk));
+    return (1);
+}
+
+/* Names of RP5C01 registers in banks 0 and 1 (banks 2 and 3 are RAM) */
+static const char * const rp5c01_reg_names[2][16] = {
+    { "1-sec", "10-sec", "1-min", "10-min", "1-hour", "10-hour",
+      "day-of-week", "1-day", "10-day", "1-month", "10-month",
+      "1-year", "10-year", "MODE", "TEST", "RESET" },
+    { "msg-hi", "msg-lo", "alarm-1-min", "alarm-10-min", "alarm-1-hour",
+      "alarm-10-hour", "alarm-dow", "alarm-1-day", "alarm-10-day", "-",
+      "12/24", "leap-year", "-", "MODE", "TEST", "RESET" },
+};
+
+/*
+ * rtctrace_msg
+ * ------------
+ * Reports a mailbox message assembled from the RTC bus trace, and its
+ * transfer rate.
+ */
+static void
+rtctrace_msg(const bec_trace_msg_t *msg, uint is_reply, uint32_t usec)
+{
+    uint32_t elapsed = usec - msg->btm_start;
+
+    printf("%10u %s %02x len %u: %u bytes in %u us",
+           (uint) msg->btm_start, is_reply ? "reply status" : "send cmd",
+           msg->btm_hdr[2], msg->btm_expected - BEC_MSG_HDR_LEN -
+           BEC_MSG_CRC_LEN, msg->btm_count, (uint) elapsed);
+    if (elapsed != 0)
+        printf(" (%u bytes/sec)",
+               (uint) (msg->btm_count * 1000000 / elapsed));
+    printf("\n");
+}
+
+/*
+ * rtctrace_ent
+ * ------------
+ * Reports a single RP5C01 register access from the RTC bus trace.
+ * Mailbox nibble accesses are only shown in debug mode.
+ */
+static void
+rtctrace_ent(uint32_t usec, uint32_t ent, uint is_mailbox)
+{
+    uint bank = BRT_BANK(ent);
+    uint addr = BRT_ADDR(ent);
+
+    if (BRT_DELTA(ent) == BRT_DELTA_MAX)
+        printf("---- gap ----\n");
+    if (is_mailbox && (flag_debug == 0))
+        return;
+    printf("%10u %c %u:%x = %x  %s\n", (uint) usec,
+           (ent & BRT_READ) ? 'R' : 'W', bank, addr, (uint) BRT_DATA(ent),
+           (bank < 2) ? rp5c01_reg_names[bank][addr] : "RAM");
+}
+
+/*
+ * cmd_rtctrace
+ * ------------
+ * Fetches the RP5C01 bus access trace from the BEC and decodes it into
+ * register accesses and mailbox messages. Capture is frozen while the
+ * trace is read (since reading it generates more RTC accesses), and is
+ * cleared and restarted when done. Individual mailbox nibble accesses
+ * are shown in debug mode.
+ */
+static int
+cmd_rtctrace(void)
+{
+    static uint8_t    buf[BEC_MSG_MAX_PAYLOAD];
+    bec_rtc_trace_t   req;
+    bec_rtc_trace_t  *reply = (void *) buf;
+    bec_trace_state_t state;
+    uint32_t          seq = 0;
+    uint              rlen;
+    uint              rc;
+
+    memset(&state, 0, sizeof (state));
+    memset(&req, 0, sizeof (req));
+    req.brt_flags = BRT_FLAG_FREEZE;
+    while (1) {
+        req.brt_seq   = seq;
+        req.brt_count = 0xffff;
+        rc = send_cmd_retry(BEC_CMD_RTC_TRACE, &req, sizeof (req),
+                            buf, sizeof (buf), &rlen);
+        if (rc != 0) {
+            printf("RTC trace failed: (%s)\n", bec_err(rc));
+            break;
+        }
+        req.brt_flags = 0;
+        if (rlen < sizeof (*reply) + reply->brt_count * sizeof (uint32_t)) {
+            printf("RTC trace reply truncated\n");
+            rc = 1;
+            break;
+        }
+        if (flag_debug)
+            printf("seq %u count %u next %u\n", (uint) reply->brt_seq,
+                   reply->brt_count, (uint) reply->brt_next);
+        if (reply->brt_flags & BRT_FLAG_LOST)
+            printf("---- trace entries lost ----\n");
+
+        bec_trace_decode(&state, (const uint8_t *) (reply + 1),
+                         reply->brt_count, reply->brt_tick_hz,
+                         reply->brt_shift, rtctrace_ent, rtctrace_msg);
+        seq = reply->brt_seq + reply->brt_count;
+        if ((reply->brt_count == 0) || (seq >= reply->brt_next))
+            break;
+        if (is_user_abort()) {
+            rc = 1;
+            break;
+        }
+    }
+
+    /* Clear trace and restart capture */
+    req.brt_seq   = 0;
+    req.brt_count = 0;
+    req.brt_flags = BRT_FLAG_RESUME;
+    (void) send_cmd_retry(BEC_CMD_RTC_TRACE, &req, sizeof (req),
+                          buf, sizeof (buf), &rlen);
+    return (rc);
+}
+
+static uint8_t snoop_port;  // GPIO port of capture being shown
+
+/*
+ * snoop_run
+ * ---------
+ * Displays one run of identical samples from a BEC GPIO bus sampler
+ * capture. Captures of GPIOB are also decoded as RTC bus signals
+ * (_RTCEN PB0, R/_W PB1, D16-D19 PB4-PB7, A2-A5 PB10-PB13).
+ */
+static void
+snoop_run(uint pos, int64_t nsec, uint16_t value, uint count, uint is_trigger)
+{
+    printf("%c%5u %9d ns %04x x%-5u", is_trigger ? '*' : ' ', pos,
+           (int) nsec, value, count);
+    if (snoop_port == 'B') {
+        printf(" %s %c A=%x D=%x",
+               (value & BIT(0)) ? "     " : "RTCEN",
+               (value & BIT(1)) ? 'R' : 'W',
+               (value >> 10) & 0xf, (value >> 4) & 0xf);
+    }
+    printf("\n");
+}
+
+/*
+ * cmd_snoop
+ * ---------
+ * Fetches the most recent BEC GPIO bus sampler capture and replays it,
+ * one line per run of identical samples, with time relative to the
+ * trigger.
+ */
+static int
+cmd_snoop(void)
+{
+    static uint8_t buf[BEC_MSG_MAX_PAYLOAD];
+    bec_snoop_t    req;
+    bec_snoop_t   *reply = (void *) buf;
+    uint           pos = 0;
+    uint           rlen;
+    uint           rc;
+
+    memset(&req, 0, sizeof (req));
+    while (1) {
+        req.bsn_pos   = pos;
+        req.bsn_count = 0xffff;
+        rc = send_cmd_retry(BEC_CMD_SNOOP, &req, sizeof (req),
+                            buf, sizeof (buf), &rlen);
+        if (rc == BEC_STATUS_NODATA) {
+            printf("No capture\n");
+            return (rc);
+        }
+        if (rc != 0) {
+            printf("Snoop failed: (%s)\n", bec_err(rc));
+            return (rc);
+        }
+        if (rlen < sizeof (*reply) +
+                   reply->bsn_count * sizeof (bec_snoop_run_t)) {
+            printf("Snoop reply truncated\n");
+            return (1);
+        }
+        if (pos == 0) {
+            printf("GPIO%c %u Hz, %u samples, trigger at %u%s\n",
+                   reply->bsn_port, (uint) reply->bsn_rate,
+                   reply->bsn_samples, reply->bsn_trigger,
+                   (reply->bsn_flags & BSN_FLAG_TRIGGERED) ? "" : " (none)");
+        }
+        if (reply->bsn_rate == 0)
+            return (1);
+
+        snoop_port = reply->bsn_port;
+        pos = bec_snoop_decode((const uint8_t *) (reply + 1),
+                               reply->bsn_count, pos, reply->bsn_trigger,
+                               reply->bsn_rate, snoop_run);
+        if ((reply->bsn_count == 0) || (pos >= reply->bsn_samples))
+            break;
+        if (is_user_abort())
+            return (1);
+    }
+    return (0);
+}
+
+/*
+ * fwupdate_send
+ * -------------
+ * Sends a BEC_CMD_FW_UPDATE request and gets the update progress reply.
+ */
+static uint
+fwupdate_send(bec_fw_update_t *req, uint len, bec_fw_update_t *reply)
+{
+    uint rlen;
+    uint rc;
+
+    rc = send_cmd_retry(BEC_CMD_FW_UPDATE, req, len,
+                        reply, sizeof (*reply), &rlen);
+    if ((rc == 0) && (rlen < sizeof (*reply)))
+        rc = BEC_STATUS_REPLYLEN;
+    return (rc);
+}
+
+/*
+ * cmd_fwupdate
+ * ------------
+ * Writes a firmware image to the BEC firmware slot which is not running,
+ * and then restarts BEC to try it. BEC reverts to the current firmware if
+ * the new image does not start. The image must be the one linked for the
+ * target slot (fw_slot0.bin or fw_slot1.bin). Upload throughput is shown
+ * when done.
+ */
+static int
+cmd_fwupdate(int argc, char *argv[])
+{
+    static uint8_t   sendbuf[sizeof (bec_fw_update_t) + FW_BLOCK_SIZE];
+    bec_fw_update_t *req = (void *) sendbuf;
+    bec_fw_update_t  reply;
+    FILE            *fp;
+    uint8_t         *image = NULL;
+    uint32_t         entry;
+    uint32_t         slot_base;
+    uint64_t         time_start;
+    uint64_t         diff;
+    long             len;
+    uint             pos;
+    uint             chunk;
+    uint             tries;
+    uint             rc;
+
+    if (argc < 2) {
+        printf("update requires a firmware image filename or status\n");
+        return (1);
+    }
+
+    memset(req, 0, sizeof (*req));
+    req->bfu_op = BFU_OP_STATUS;
+    rc = fwupdate_send(req, sizeof (*req), &reply);
+    if (rc != 0) {
+        printf("BEC update status failed: %s\n", bec_err(rc));
+        return (1);
+    }
+    if (reply.bfu_running == BFU_SLOT_NONE) {
+        printf("BEC is not running from a firmware slot; "
+               "install boot loader with \"make dfu-slots\"\n");
+        return (1);
+    }
+    if (strcmp(argv[1], "status") == 0) {
+        printf("BEC running slot %u (%s), update goes to slot %u\n",
+               reply.bfu_running,
+               (reply.bfu_state == BFU_STATE_TRIAL) ? "trial" : "good",
+               reply.bfu_slot);
+        return (0);
+    }
+
+    fp = fopen(argv[1], "r");
+    if (fp == NULL) {
+        printf("Could not open %s\n", argv[1]);
+        return (1);
+    }
+    fseek(fp, 0, SEEK_END);
+    len = ftell(fp);
+    fseek(fp, 0, SEEK_SET);
+    if ((len < 8) || (len > FW_SLOT_SIZE)) {
+        printf("%s is not a BEC firmware image\n", argv[1]);
+        fclose(fp);
+        return (1);
+    }
+    image = AllocMem(len, MEMF_PUBLIC);
+    if (image == NULL) {
+        printf("Memory allocation failure\n");
+        fclose(fp);
+        return (1);
+    }
+    if (fread(image, 1, len, fp) != (size_t) len) {
+        printf("Failed to read %s\n", argv[1]);
+        fclose(fp);
+        rc = 1;
+        goto cleanup;
+    }
+    fclose(fp);
+
+    /* Reset vector is little endian, and must be within the target slot */
+    entry = image[4] | (image[5] << 8) | (image[6] << 16) | (image[7] << 24);
+    slot_base = FW_SLOT_BASE + reply.bfu_slot * FW_SLOT_SIZE;
+    if ((entry < slot_base) || (entry >= slot_base + FW_SLOT_SIZE)) {
+        printf("%s is not linked for slot %u; use fw_slot%u.bin\n",
+               argv[1], reply.bfu_slot, reply.bfu_slot);
+        rc = 1;
+        goto cleanup;
+    }
+
+    req->bfu_op     = BFU_OP_START;
+    req->bfu_offset = len;
+    req->bfu_crc    = crc32(0, image, len);
+    rc = fwupdate_send(req, sizeof (*req), &reply);
+    if (rc != 0) {
+        printf("BEC update start failed: %s\n", bec_err(rc));
+        goto cleanup;
+    }
+
+    /* BEC does not respond while it erases the slot */
+    printf("Erasing slot %u\n", reply.bfu_slot);
+    req->bfu_op = BFU_OP_STATUS;
+    for (tries = 0; tries < 10; tries++) {
+        rc = fwupdate_send(req, sizeof (*req), &reply);
+        if ((rc == 0) && (reply.bfu_phase != BFU_PHASE_ERASE))
+            break;
+    }
+    if ((rc == 0) && (reply.bfu_phase != BFU_PHASE_WRITE))
+        rc = BEC_STATUS_FAIL;
+    if (rc != 0) {
+        printf("BEC slot erase failed: %s\n", bec_err(rc));
+        goto cleanup;
+    }
+
+    time_start = bec_time();
+    req->bfu_op = BFU_OP_DATA;
+    for (pos = 0; pos < (uint) len; pos += chunk) {
+        chunk = len - pos;
+        if (chunk > FW_BLOCK_SIZE)
+            chunk = FW_BLOCK_SIZE;
+        req->bfu_offset = pos;
+        req->bfu_crc    = crc32(0, image + pos, chunk);
+        memcpy(req + 1, image + pos, chunk);
+        rc = fwupdate_send(req, sizeof (*req) + chunk, &reply);
+        if (rc != 0) {
+            printf("\nBEC write at %x failed: %s\n", pos, bec_err(rc));
+            goto cleanup;
+        }
+        if ((flag_quiet == 0) && ((pos & 0x3fff) == 0)) {
+            printf("\rWriting %u / %ld", pos + chunk, len);
+            fflush(stdout);
+        }
+        if (is_user_abort()) {
+            rc = 1;
+            goto cleanup;
+        }
+    }
+    diff = bec_time() - time_start;
+    if (diff == 0)
+        diff = 1;
+    printf("\rWrote %ld bytes in %u.%03u sec (%u bytes/sec)\n", len,
+           (uint) (diff / 1000000), (uint) (diff / 1000 % 1000),
+           (uint) (len * 1000000ULL / diff));
+
+    req->bfu_op    = BFU_OP_COMMIT;
+    req->bfu_flags = BFU_FLAG_REBOOT;
+    rc = fwupdate_send(req, sizeof (*req), &reply);
+    if (rc != 0) {
+        printf("BEC update commit failed: %s\n", bec_err(rc));
+        goto cleanup;
+    }
+    printf("BEC restarting with slot %u; it reverts to slot %u if the new "
+           "firmware fails\n", reply.bfu_slot, reply.bfu_running);
+
+cleanup:
+    FreeMem(image, len);
+    return (rc);
+}
+
 /*
  * update_qualifier
  * ----------------
@@ -1004,6 +1481,95 @@ poll_bec_for_amiga_scancodes(void)
     return (0);
 }
 
+/*
+ * poll_bec_input_snap
+ * -------------------
+ * Requests captured Amiga scancodes and, if cmax is not zero, BEC console
+ * output in a single BEC_CMD_INPUT_SNAP message. Captured scancodes are
+ * injected into the Amiga input stream. Console output is copied to cbuf.
+ */
+static uint
+poll_bec_input_snap(uint8_t *cbuf, uint cmax, uint *clen)
+{
+    uint             rc;
+    uint             rlen;
+    uint             pos;
+    uint             cur;
+    uint             len;
+    uint8_t         *data;
+    uint8_t          replybuf[400];
+    bec_input_snap_t req;
+
+    memset(&req, 0, sizeof (req));
+    req.bis_what    = BIS_WHAT_KEYS | ((cmax != 0) ? BIS_WHAT_CONSOLE : 0);
+    req.bis_source  = BKM_SOURCE_AMIGA_SCANCODE;
+    req.bis_timeout = 500;  // msec timeout if not polling again
+    req.bis_keys    = 16;
+    req.bis_cons    = (cmax > 255) ? 255 : cmax;
+
+    *clen = 0;
+    rc = send_cmd_retry(BEC_CMD_INPUT_SNAP, &req, sizeof (req),
+                        replybuf, sizeof (replybuf), &rlen);
+    if (rc != 0)
+        return (rc);
+
+    for (pos = 0; pos + 2 <= rlen; pos += 2 + len) {
+        len  = replybuf[pos + 1];
+        data = &replybuf[pos + 2];
+        if (pos + 2 + len > rlen)
+            break;  // Truncated record
+        switch (replybuf[pos]) {
+            case BIS_TLV_KEYS:
+                for (cur = 0; cur + 1 < len; cur += 2)
+                    inject_key_scancode(data[cur]);
+                break;
+            case BIS_TLV_CONSOLE:
+                cur = (len > cmax) ? cmax : len;
+                memcpy(cbuf, data, cur);
+                *clen = cur;
+                break;
+        }
+    }
+    return (0);
+}
+
+/*
+ * poll_bec_cons_lz
+ * ----------------
+ * Requests up to cmax bytes of BEC console output using the compressed
+ * BEC_CMD_CONS_LZ message, and expands it into cbuf. The number of
+ * message bytes which crossed the wire is returned in wlen.
+ */
+static uint
+poll_bec_cons_lz(uint8_t *cbuf, uint cmax, uint *clen, uint *wlen)
+{
+    static uint8_t replybuf[BEC_MSG_MAX_PAYLOAD];
+    bec_cons_lz_t *reply = (bec_cons_lz_t *) replybuf;
+    bec_cons_lz_t  req;
+    uint           rc;
+    uint           rlen;
+    uint           len;
+
+    *clen = 0;
+    *wlen = 0;
+    req.bcl_len = (cmax > BCL_MAX_LEN) ? BCL_MAX_LEN : cmax;
+    rc = send_cmd_retry(BEC_CMD_CONS_LZ, &req, sizeof (req),
+                        replybuf, sizeof (replybuf), &rlen);
+    if (rc != 0)
+        return (rc);
+    if ((rlen < sizeof (*reply)) || (reply->bcl_len > cmax))
+        return (BEC_STATUS_REPLYLEN);
+
+    len = lzss_decompress(replybuf + sizeof (*reply), rlen - sizeof (*reply),
+                          cbuf, reply->bcl_len);
+    if (len != reply->bcl_len)
+        return (BEC_STATUS_REPLYCRC);  // Stream did not expand correctly
+
+    *clen = len;
+    *wlen = rlen + BEC_MSG_HDR_LEN + BEC_MSG_CRC_LEN;
+    return (0);
+}
+
 /*
  * cmd_term
  * --------
@@ -1028,6 +1594,13 @@ cmd_term(int argc, char *argv[])
     uint tick_last = 0;
     uint tick_count = 0;
     uint tick_now;
+    uint use_snap = 1;
+    uint use_lz = 1;
+    uint wlen;
+    uint cons_bytes = 0;
+    uint wire_bytes = 0;
+    uint8_t *out;
+    static uint8_t lzout[BCL_MAX_LEN];
 
     if (argc > 1) {
         interactive = 0;
@@ -1080,26 +1653,56 @@ cmd_term(int argc, char *argv[])
             }
         }
 
-        /* Poll BEC for raw keystroke input */
-        if (poll_bec_for_amiga_scancodes())
-            break;
-
         tick_now = cia_ticks();  // CIA counts downward
         tick_count += (uint16_t) (tick_last - tick_now);
         tick_last = tick_now;
-        if ((count++ & 0x7) != 0)
-            continue;  // Poll infrequently for BEC output
 
-        if (poll_count < poll_delay) {
-            poll_count++;
-            continue;
-        }
-        poll_count = 0;
-
-        /* Poll for BEC Controler output */
+        /* Poll infrequently for BEC output */
         maxlen = sizeof (buf) - 2;
-        rc = send_cmd_retry(BEC_CMD_CONS_OUTPUT, &maxlen, sizeof (maxlen),
-                            buf, sizeof (buf), &rlen);
+        if (((count++ & 0x7) != 0) || (poll_count++ < poll_delay))
+            maxlen = 0;
+        else
+            poll_count = 0;
+
+        out = buf;
+        wlen = 0;
+        if (use_snap) {
+            /*
+             * Raw keystroke input and BEC output in a single message.
+             * If compressed output is available, fetch only keystrokes
+             * here.
+             */
+            rc = poll_bec_input_snap(buf, use_lz ? 0 : maxlen, &rlen);
+            if (rc == BEC_STATUS_UNKCMD) {
+                use_snap = 0;  // Older BEC firmware
+                continue;
+            }
+            if ((rc == 0) && (maxlen == 0))
+                continue;
+            wlen = rlen + BEC_MSG_HDR_LEN + BEC_MSG_CRC_LEN;
+        } else {
+            /* Poll BEC for raw keystroke input */
+            if (poll_bec_for_amiga_scancodes())
+                break;
+            if (maxlen == 0)
+                continue;
+            rc = 0;
+        }
+        if ((rc == 0) && use_lz) {
+            /* Compressed BEC output, in much larger chunks */
+            rc = poll_bec_cons_lz(lzout, sizeof (lzout), &rlen, &wlen);
+            if (rc == BEC_STATUS_UNKCMD) {
+                use_lz = 0;  // Older BEC firmware
+                rc = 0;
+                continue;
+            }
+            out = lzout;
+        } else if ((rc == 0) && !use_snap) {
+            /* Poll for BEC Controler output */
+            rc = send_cmd_retry(BEC_CMD_CONS_OUTPUT, &maxlen, sizeof (maxlen),
+                                buf, sizeof (buf), &rlen);
+            wlen = rlen + BEC_MSG_HDR_LEN + BEC_MSG_CRC_LEN;
+        }
 #if 0
         if (rc == MSG_STATUS_BAD_CRC) {
             uint pos;
@@ -1121,7 +1724,9 @@ cmd_term(int argc, char *argv[])
             count = 0;  // Got output -- poll again right away
             poll_delay = 0;
             tick_count = 0;
-            if (Write(Output(), buf, rlen) == 0) {
+            cons_bytes += rlen;
+            wire_bytes += wlen;
+            if (Write(Output(), out, rlen) == 0) {
                 setvbuf(stdout, NULL, _IOLBF, 0);  // Line output mode
                 printf("\nWrite fail\n");
                 break;
@@ -1141,6 +1746,11 @@ cmd_term(int argc, char *argv[])
     SetMode(Output(), 0);
     setvbuf(stdout, NULL, _IOLBF, 0);  // Line output mode
 
+    if (flag_debug && (cons_bytes != 0)) {
+        printf("\nConsole %u bytes, %u bytes on wire (%u%%)%s\n",
+               cons_bytes, wire_bytes, wire_bytes * 100 / cons_bytes,
+               use_lz ? " LZSS" : "");
+    }
     if (rc != 0) {
         printf("\n%s Fail (%s)\n", is_poll ? "Poll" : "Send", bec_err(rc));
         return (EXIT_FAILURE);
@@ -1285,6 +1895,9 @@ main(int argc, char *argv[])
                     case 'd':  // debug
                         flag_debug++;
                         break;
+                    case 'H':  // sensor history
+                        exit(cmd_hist());
+                        break;
                     case 'i':  // inquiry
                         flag_inquiry++;
                         break;
@@ -1301,9 +1914,15 @@ main(int argc, char *argv[])
                     case 'q':  // quiet
                         flag_quiet++;
                         break;
+                    case 'R':  // RTC bus trace
+                        exit(cmd_rtctrace());
+                        break;
                     case 's':  // set
                         exit(cmd_set(argc - arg, argv + arg));
                         break;
+                    case 'S':  // GPIO bus sampler capture
+                        exit(cmd_snoop());
+                        break;
                     case '0':  // pattern test
                     case '1':  // loopback test
                     case '2':  // loopback perf test
@@ -1317,6 +1936,9 @@ main(int argc, char *argv[])
                     case 'T':  // BEC Controler firmware terminal
                         exit(cmd_term(argc - 1, argv + 1));
                         break;
+                    case 'u':  // BEC firmware update
+                        exit(cmd_fwupdate(argc - arg, argv + arg));
+                        break;
                     case 'z':  // z cmd
                         flag_z++;
                         break;
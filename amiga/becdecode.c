@@ -0,0 +1,261 @@
+/*
+ * becdecode
+ * ---------
+ * Decoders for the bulk streams which bec fetches from BEC: compressed
+ * console output, sensor history, RTC bus traces, and snoop captures.
+ * These are used only by the bec tool, so are kept apart from the
+ * messaging functions which every BEC client links.
+ *
+ * Copyright 2025 Chris Hooper. This program and source may be used
+ * and distributed freely, for any purpose which benefits the Amiga
+ * community. Commercial use of the binary, source, or algorithms requires
+ * prior written approval from Chris Hooper <amiga@cdh.eebugs.com>.
+ * All redistributions must retain this Copyright notice.
+ *
+ * DISCLAIMER: THE SOFTWARE IS PROVIDED "AS-IS", WITHOUT ANY WARRANTY.
+ * THE AUTHOR ASSUMES NO LIABILITY FOR ANY DAMAGE ARISING OUT OF THE USE
+ * OR MISUSE OF THIS UTILITY OR INFORMATION REPORTED BY THIS UTILITY.
+ */
+
+#include <stdint.h>
+#include <exec/types.h>
+#include "../fw/bec_cmd.h"
+#include "becdecode.h"
+
+#ifndef BIT
+#define BIT(x) (1U << (x))
+#endif
+
+/*
+ * lzss_decompress
+ * ---------------
+ * Expands a BEC_CMD_CONS_LZ stream from src into dst. Returns the number
+ * of bytes written to dst. A corrupt stream stops early, so the caller
+ * should compare the result against the expected length.
+ */
+uint
+lzss_decompress(const uint8_t *src, uint srclen, uint8_t *dst, uint dstmax)
+{
+    uint spos = 0;
+    uint dpos = 0;
+    uint bit;
+    uint flags;
+
+    while (spos < srclen) {
+        flags = src[spos++];
+        for (bit = 0; (bit < 8) && (spos < srclen); bit++) {
+            if (flags & BIT(bit)) {
+                uint word;
+                uint dist;
+                uint len;
+
+                if (spos + 2 > srclen)
+                    return (dpos);  // Truncated match
+                word = (src[spos] << 8) | src[spos + 1];
+                spos += 2;
+                dist = (word >> 4) + 1;
+                len  = (word & 0xf) + BCL_MIN_MATCH;
+                if ((dist > dpos) || (dpos + len > dstmax))
+                    return (dpos);  // Corrupt stream
+                for (; len > 0; len--, dpos++)
+                    dst[dpos] = dst[dpos - dist];
+            } else {
+                if (dpos >= dstmax)
+                    return (dpos);
+                dst[dpos++] = src[spos++];
+            }
+        }
+    }
+    return (dpos);
+}
+
+/*
+ * hist_get_varint
+ * ---------------
+ * Extracts a little endian base-128 varint from a sensor history block.
+ * Returns NULL if the varint is truncated.
+ */
+static const uint8_t *
+hist_get_varint(const uint8_t *ptr, const uint8_t *end, uint32_t *value)
+{
+    uint shift = 0;
+
+    *value = 0;
+    while (ptr < end) {
+        *value |= (uint32_t) (*ptr & 0x7f) << shift;
+        if ((*(ptr++) & 0x80) == 0)
+            return (ptr);
+        shift += 7;
+    }
+    return (NULL);
+}
+
+static uint32_t
+hist_get_be32(const uint8_t *ptr)
+{
+    return (((uint32_t) ptr[0] << 24) | ((uint32_t) ptr[1] << 16) |
+            ((uint32_t) ptr[2] << 8) | ptr[3]);
+}
+
+/*
+ * bec_hist_decode
+ * ---------------
+ * Expands count BEC_CMD_SENSOR_HIST blocks from src, calling func with
+ * the time and readings of each sample, in order. Returns the number of
+ * blocks decoded, which is less than count if a block is truncated or
+ * does not hold the expected number of sensors.
+ */
+uint
+bec_hist_decode(const uint8_t *src, uint srclen, uint count, uint sensors,
+                bec_hist_func_t func)
+{
+    const uint8_t *end = src + srclen;
+    const uint8_t *bend;
+    int32_t        value[BEC_HIST_MAX_SENSORS];
+    uint32_t       msec;
+    uint32_t       delta;
+    uint           blk;
+    uint           sample;
+    uint           samples;
+    uint           cur;
+
+    if (sensors > BEC_HIST_MAX_SENSORS)
+        return (0);
+    for (blk = 0; blk < count; blk++) {
+        if (src + sizeof (bec_hist_blk_t) > end)
+            return (blk);
+        msec    = hist_get_be32(src + 4);
+        bend    = src + sizeof (bec_hist_blk_t) + ((src[8] << 8) | src[9]);
+        samples = src[10];
+        if ((bend > end) || (src[11] != sensors))
+            return (blk);
+        src += sizeof (bec_hist_blk_t);
+        if (src + sensors * sizeof (int32_t) > bend)
+            return (blk);
+
+        /* Keyframe */
+        for (cur = 0; cur < sensors; cur++, src += sizeof (int32_t))
+            value[cur] = (int32_t) hist_get_be32(src);
+        func(msec, value, sensors);
+
+        for (sample = 1; sample < samples; sample++) {
+            src = hist_get_varint(src, bend, &delta);
+            if (src == NULL)
+                return (blk);
+            msec += delta;
+            for (cur = 0; cur < sensors; cur++) {
+                src = hist_get_varint(src, bend, &delta);
+                if (src == NULL)
+                    return (blk);
+                value[cur] += (int32_t) ((delta >> 1) ^ -(delta & 1));
+            }
+            func(msec, value, sensors);
+        }
+        src = bend;
+    }
+    return (blk);
+}
+
+/*
+ * trace_msg_byte
+ * --------------
+ * Assembles a mailbox byte seen in an RTC bus trace into a BEC message,
+ * calling func when the message is complete.
+ */
+static void
+trace_msg_byte(bec_trace_msg_t *msg, uint is_reply, uint8_t byte,
+               uint32_t usec, bec_trace_msg_func_t func)
+{
+    static const uint8_t magic[] = { 0xcd, 0x68 };
+
+    if ((msg->btm_count < sizeof (magic)) &&
+        (byte != magic[msg->btm_count])) {
+        /* Not a message; this byte may start the next one */
+        msg->btm_count = 0;
+        if (byte != magic[0])
+            return;
+    }
+    if (msg->btm_count == 0)
+        msg->btm_start = usec;
+    if (msg->btm_count < BEC_MSG_HDR_LEN)
+        msg->btm_hdr[msg->btm_count] = byte;
+    if (++msg->btm_count == BEC_MSG_HDR_LEN) {
+        msg->btm_expected = BEC_MSG_HDR_LEN + BEC_MSG_CRC_LEN +
+                            ((msg->btm_hdr[3] << 8) | msg->btm_hdr[4]);
+    }
+    if ((msg->btm_count < BEC_MSG_HDR_LEN) ||
+        (msg->btm_count < msg->btm_expected))
+        return;
+
+    func(msg, is_reply, usec);
+    msg->btm_count = 0;
+}
+
+/*
+ * bec_trace_decode
+ * ----------------
+ * Walks count big endian BEC_CMD_RTC_TRACE entries from src, calling
+ * ent_func with the time of each access and msg_func with each mailbox
+ * message assembled from the accesses. The state carries time and
+ * partial messages from one reply to the next, and must be zeroed
+ * before the first.
+ */
+void
+bec_trace_decode(bec_trace_state_t *state, const uint8_t *src, uint count,
+                 uint32_t tick_hz, uint shift, bec_trace_ent_func_t ent_func,
+                 bec_trace_msg_func_t msg_func)
+{
+    uint32_t tpu = tick_hz / 1000000;
+    uint     cur;
+
+    if (tpu == 0)
+        tpu = 1;
+    for (cur = 0; cur < count; cur++, src += sizeof (uint32_t)) {
+        uint32_t ent  = hist_get_be32(src);
+        uint     data = BRT_DATA(ent);
+        uint     rd   = (ent & BRT_READ) ? 1 : 0;
+        uint     mbox = (BRT_BANK(ent) == 1) && (BRT_ADDR(ent) <= 1);
+
+        state->bts_ticks += BRT_DELTA(ent) << shift;
+        state->bts_usec  += state->bts_ticks / tpu;
+        state->bts_ticks %= tpu;
+
+        ent_func(state->bts_usec, ent, mbox);
+        if (mbox) {
+            bec_trace_msg_t *msg = rd ? &state->bts_rx : &state->bts_tx;
+            if (BRT_ADDR(ent) == 0)
+                msg->btm_hi = data;
+            else
+                trace_msg_byte(msg, rd, (msg->btm_hi << 4) | data,
+                               state->bts_usec, msg_func);
+        }
+    }
+}
+
+/*
+ * bec_snoop_decode
+ * ----------------
+ * Walks count big endian BEC_CMD_SNOOP runs from src, which start at
+ * sample pos of the capture, calling func with each run and its time
+ * in nanoseconds relative to the trigger sample. is_trigger is set for
+ * the run which holds the trigger sample. Returns the sample number
+ * following the last run.
+ */
+uint
+bec_snoop_decode(const uint8_t *src, uint count, uint pos, uint trigger,
+                 uint32_t rate, bec_snoop_func_t func)
+{
+    uint cur;
+
+    for (cur = 0; cur < count; cur++, src += sizeof (bec_snoop_run_t)) {
+        uint32_t run   = hist_get_be32(src);
+        uint16_t value = run >> 16;
+        uint     len   = run & 0xffff;
+        int64_t  nsec  = ((int64_t) pos - trigger) * 1000000000 / rate;
+
+        func(pos, nsec, value, len,
+             (pos <= trigger) && (pos + len > trigger));
+        pos += len;
+    }
+    return (pos);
+}
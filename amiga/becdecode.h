@@ -0,0 +1,57 @@
+/*
+ * This is free and unencumbered software released into the public domain.
+ * See the LICENSE file for additional details.
+ *
+ * Designed by Chris Hooper in 2025.
+ *
+ * ---------------------------------------------------------------------
+ *
+ * Decoders for BEC console, sensor history, RTC trace, and snoop streams.
+ */
+
+#ifndef _BECDECODE_H
+#define _BECDECODE_H
+
+uint lzss_decompress(const uint8_t *src, uint srclen, uint8_t *dst,
+                     uint dstmax);
+
+#define BEC_HIST_MAX_SENSORS 32  // Most sensors bec_hist_decode() handles
+typedef void (*bec_hist_func_t)(uint32_t msec, const int32_t *value,
+                                uint sensors);
+uint bec_hist_decode(const uint8_t *src, uint srclen, uint count,
+                     uint sensors, bec_hist_func_t func);
+
+/*
+ * BEC_CMD_RTC_TRACE decode state. Mailbox nibbles found in the trace
+ * are assembled into messages in each direction.
+ */
+typedef struct {
+    uint32_t btm_start;                 // usec of first byte of message
+    uint     btm_count;                 // Bytes of message seen so far
+    uint     btm_expected;              // Total message length (from header)
+    uint8_t  btm_hdr[5];                // Magic, command/status, length
+    uint8_t  btm_hi;                    // Pending high nibble
+} bec_trace_msg_t;
+
+typedef struct {
+    uint32_t        bts_usec;   // Time of most recent entry
+    uint32_t        bts_ticks;  // Capture ticks not yet counted in bts_usec
+    bec_trace_msg_t bts_tx;     // Amiga to BEC
+    bec_trace_msg_t bts_rx;     // BEC to Amiga
+} bec_trace_state_t;
+
+typedef void (*bec_trace_ent_func_t)(uint32_t usec, uint32_t ent,
+                                     uint is_mailbox);
+typedef void (*bec_trace_msg_func_t)(const bec_trace_msg_t *msg,
+                                     uint is_reply, uint32_t usec);
+void bec_trace_decode(bec_trace_state_t *state, const uint8_t *src,
+                      uint count, uint32_t tick_hz, uint shift,
+                      bec_trace_ent_func_t ent_func,
+                      bec_trace_msg_func_t msg_func);
+
+typedef void (*bec_snoop_func_t)(uint pos, int64_t nsec, uint16_t value,
+                                 uint count, uint is_trigger);
+uint bec_snoop_decode(const uint8_t *src, uint count, uint pos,
+                      uint trigger, uint32_t rate, bec_snoop_func_t func);
+
+#endif  /* _BECDECODE_H */
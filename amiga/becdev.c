@@ -0,0 +1,652 @@
+/*
+ * bec.device
+ * ----------
+ * AmigaOS block device driver for USB Mass Storage devices attached to
+ * the AmigaPCI BEC (board management STM32). Blocks are transferred
+ * through the BEC message interface using the BEC_CMD_BLK_* commands.
+ * The BEC keeps a read-ahead cache, so sequential reads of small block
+ * counts are satisfied without waiting for USB.
+ *
+ * Each BEC unit is one logical unit of a USB Mass Storage device, in
+ * order of discovery by the BEC. Requests are processed synchronously
+ * in the context of the caller.
+ *
+ * Unit BECDEV_UNIT_MSG (see becdev.h) instead passes arbitrary BEC
+ * messages. Those requests are queued to a device task and completed
+ * asynchronously, so that any number of tasks may share the BEC without
+ * each one blocking while it waits for the BEC reply.
+ *
+ * Copyright 2025 Chris Hooper. This program and source may be used
+ * and distributed freely, for any purpose which benefits the Amiga
+ * community. Commercial use of the binary, source, or algorithms requires
+ * prior written approval from Chris Hooper <amiga@cdh.eebugs.com>.
+ * All redistributions must retain this Copyright notice.
+ *
+ * DISCLAIMER: THE SOFTWARE IS PROVIDED "AS-IS", WITHOUT ANY WARRANTY.
+ * THE AUTHOR ASSUMES NO LIABILITY FOR ANY DAMAGE ARISING OUT OF THE USE
+ * OR MISUSE OF THIS UTILITY OR INFORMATION REPORTED BY THIS UTILITY.
+ */
+
+#include <stdint.h>
+#include <string.h>
+#include <exec/types.h>
+#include <exec/devices.h>
+#include <exec/errors.h>
+#include <exec/execbase.h>
+#include <exec/initializers.h>
+#include <exec/io.h>
+#include <exec/memory.h>
+#include <exec/resident.h>
+#include <exec/semaphores.h>
+#include <exec/tasks.h>
+#include <devices/trackdisk.h>
+#include <dos/dos.h>
+#include <clib/alib_protos.h>
+#include <inline/exec.h>
+
+typedef unsigned int uint;
+
+#include "../fw/bec_cmd.h"
+#include "becmsg.h"
+#include "becdev.h"
+
+#define DEVICE_NAME      "bec.device"
+#define DEVICE_VERSION   1
+#define DEVICE_REVISION  0
+#define DEVICE_PRI       0
+#define BECDEV_MAX_UNITS 8   // Maximum BEC block units
+#define BECDEV_RETRIES   50  // Attempts while BEC reports USB is busy
+#define BECDEV_TASK_NAME "bec.device msg"
+#define BECDEV_TASK_PRI  1     // Message task priority
+#define BECDEV_TASK_STK  4096  // Message task stack size
+
+#define BIT(x)        (1U << (x))
+#define ARRAY_SIZE(x) ((sizeof (x) / sizeof ((x)[0])))
+#define CIA_USEC(x)   (x * 715909 / 1000000)
+#define SWAP16(x) (x)  // Amiga is big endian, as is the BEC message format
+#define SWAP32(x) (x)
+
+typedef struct {
+    struct Unit bu_unit;
+    ULONG       bu_blocks;         // Total blocks
+    ULONG       bu_changenum;      // Incremented when unit changes
+} becunit_t;
+
+typedef struct {
+    bec_blk_t req;
+    uint8_t   data[BBK_MAX_BLOCKS * BBK_BLOCK_SIZE];
+} becblkmsg_t;
+
+typedef struct {
+    struct Library         bd_lib;
+    BPTR                   bd_seglist;
+    struct SignalSemaphore bd_lock;  // Serializes BEC message access
+    becunit_t              bd_unit[BECDEV_MAX_UNITS];
+    struct Unit            bd_msgunit;  // Message unit; its port is the queue
+    struct Task           *bd_msgtask;  // Task servicing the message unit
+    struct Task           *bd_closer;   // Task waiting for message task exit
+    becblkmsg_t            bd_msg;   // BEC request (kept intact for retry)
+    becblkmsg_t            bd_reply; // BEC reply
+} becdev_t;
+
+struct ExecBase *SysBase;
+uint flag_debug;
+unsigned int irq_disabled;
+
+static becdev_t *becdev;  // For the message task
+
+static const char device_name[] = DEVICE_NAME;
+static const char device_id[]   = "bec.device "VERSION" ("BUILD_DATE")\r\n";
+
+/*
+ * dev_noexec
+ * ----------
+ * The device is not a program. This must be the first code in the file
+ * so that an attempt to run it from the shell returns immediately.
+ */
+int
+dev_noexec(void)
+{
+    return (-1);
+}
+
+/*
+ * printf
+ * ------
+ * Debug output from the shared BEC message code is discarded, as there
+ * is no console associated with the device.
+ */
+int
+printf(const char *fmt, ...)
+{
+    (void) fmt;
+    return (0);
+}
+
+/*
+ * bec_blk_cmd
+ * -----------
+ * Sends a single block command to the BEC, retrying while the BEC
+ * reports that the USB port is busy with another device. The caller
+ * must hold the device lock. A successful reply must be exactly the
+ * expected length.
+ */
+static uint
+bec_blk_cmd(becdev_t *dev, uint8_t cmd, uint arglen, uint replylen_expect)
+{
+    uint rc;
+    uint replylen;
+    uint tries = BECDEV_RETRIES;
+
+    do {
+        rc = send_cmd_retry(cmd, &dev->bd_msg, arglen, &dev->bd_reply,
+                            replylen_expect, &replylen);
+        if (rc != BEC_STATUS_LOCKED)
+            break;
+        cia_spin(CIA_USEC(1000));
+    } while (--tries > 0);
+
+    if ((rc == BEC_STATUS_OK) && (replylen != replylen_expect))
+        rc = BEC_STATUS_BADLEN;
+    return (rc);
+}
+
+/*
+ * bec_blk_info
+ * ------------
+ * Gets the block count of the specified unit from the BEC.
+ */
+static uint
+bec_blk_info(becdev_t *dev, uint unit, ULONG *blocks)
+{
+    uint rc;
+
+    ObtainSemaphore(&dev->bd_lock);
+    memset(&dev->bd_msg.req, 0, sizeof (dev->bd_msg.req));
+    dev->bd_msg.req.bbk_unit = unit;
+    rc = bec_blk_cmd(dev, BEC_CMD_BLK_INFO, sizeof (dev->bd_msg.req),
+                     sizeof (dev->bd_reply.req));
+    if ((rc == BEC_STATUS_OK) &&
+        (SWAP16(dev->bd_reply.req.bbk_blksize) != BBK_BLOCK_SIZE))
+        rc = BEC_STATUS_BADLEN;
+    *blocks = SWAP32(dev->bd_reply.req.bbk_lba);
+    ReleaseSemaphore(&dev->bd_lock);
+    return (rc);
+}
+
+/*
+ * bec_status_to_ioerr
+ * -------------------
+ * Converts BEC_STATUS_* to an Exec / trackdisk I/O error code.
+ */
+static BYTE
+bec_status_to_ioerr(uint rc)
+{
+    switch (rc) {
+        case BEC_STATUS_OK:
+            return (0);
+        case BEC_STATUS_BADARG:
+            return (IOERR_BADADDRESS);
+        case BEC_STATUS_BADLEN:
+            return (IOERR_BADLENGTH);
+        case BEC_STATUS_NODATA:
+            return (TDERR_DiskChanged);
+        case BEC_STATUS_UNKCMD:
+            return (IOERR_NOCMD);
+        default:
+            return (TDERR_NotSpecified);
+    }
+}
+
+/*
+ * dev_rw
+ * ------
+ * Performs a read or write request, transferring up to BBK_MAX_BLOCKS
+ * blocks per BEC message.
+ */
+static void
+dev_rw(becdev_t *dev, struct IOStdReq *ior, uint is_write, uint64_t offset)
+{
+    uint      unit = (becunit_t *) ior->io_Unit - dev->bd_unit;
+    uint8_t  *buf  = ior->io_Data;
+    ULONG     len  = ior->io_Length;
+    uint64_t  lba  = offset / BBK_BLOCK_SIZE;
+    uint      count;
+    uint      xferlen;
+    uint      rc = BEC_STATUS_OK;
+
+    ior->io_Actual = 0;
+    if ((offset % BBK_BLOCK_SIZE) || (len % BBK_BLOCK_SIZE)) {
+        ior->io_Error = IOERR_BADLENGTH;
+        return;
+    }
+    if ((lba >> 32) != 0) {
+        ior->io_Error = IOERR_BADADDRESS;
+        return;
+    }
+
+    ObtainSemaphore(&dev->bd_lock);
+    while (len > 0) {
+        count = len / BBK_BLOCK_SIZE;
+        if (count > BBK_MAX_BLOCKS)
+            count = BBK_MAX_BLOCKS;
+        xferlen = count * BBK_BLOCK_SIZE;
+
+        dev->bd_msg.req.bbk_unit    = unit;
+        dev->bd_msg.req.bbk_count   = count;
+        dev->bd_msg.req.bbk_blksize = SWAP16(BBK_BLOCK_SIZE);
+        dev->bd_msg.req.bbk_lba     = SWAP32((ULONG) lba);
+        if (is_write) {
+            memcpy(dev->bd_msg.data, buf, xferlen);
+            rc = bec_blk_cmd(dev, BEC_CMD_BLK_WRITE,
+                             sizeof (dev->bd_msg.req) + xferlen,
+                             sizeof (dev->bd_reply.req));
+        } else {
+            rc = bec_blk_cmd(dev, BEC_CMD_BLK_READ, sizeof (dev->bd_msg.req),
+                             sizeof (dev->bd_reply.req) + xferlen);
+            if (rc == BEC_STATUS_OK)
+                memcpy(buf, dev->bd_reply.data, xferlen);
+        }
+        if (rc != BEC_STATUS_OK)
+            break;
+        buf += xferlen;
+        len -= xferlen;
+        lba += count;
+        ior->io_Actual += xferlen;
+    }
+    ReleaseSemaphore(&dev->bd_lock);
+    ior->io_Error = bec_status_to_ioerr(rc);
+}
+
+/*
+ * dev_geometry
+ * ------------
+ * Reports unit geometry. Each block is presented as its own cylinder,
+ * which allows any partition alignment.
+ */
+static void
+dev_geometry(becdev_t *dev, struct IOStdReq *ior)
+{
+    becunit_t           *bu = (becunit_t *) ior->io_Unit;
+    struct DriveGeometry *dg = ior->io_Data;
+    ULONG                blocks;
+    uint                 rc;
+
+    if (ior->io_Length < sizeof (*dg)) {
+        ior->io_Error = IOERR_BADLENGTH;
+        return;
+    }
+    rc = bec_blk_info(dev, bu - dev->bd_unit, &blocks);
+    if (rc != BEC_STATUS_OK) {
+        ior->io_Error = bec_status_to_ioerr(rc);
+        return;
+    }
+    if (blocks != bu->bu_blocks) {
+        bu->bu_blocks = blocks;
+        bu->bu_changenum++;
+    }
+    memset(dg, 0, sizeof (*dg));
+    dg->dg_SectorSize   = BBK_BLOCK_SIZE;
+    dg->dg_TotalSectors = blocks;
+    dg->dg_Cylinders    = blocks;
+    dg->dg_CylSectors   = 1;
+    dg->dg_Heads        = 1;
+    dg->dg_TrackSectors = 1;
+    dg->dg_BufMemType   = MEMF_PUBLIC;
+    dg->dg_DeviceType   = DG_DIRECT_ACCESS;
+    dg->dg_Flags        = DGF_REMOVABLE;
+    ior->io_Actual      = sizeof (*dg);
+}
+
+/*
+ * dev_msg
+ * -------
+ * Sends the BEC message described by a BECCMD_MSG request and waits for
+ * the reply. Other programs are kept off the BEC mailbox by the shared
+ * semaphore in send_cmd().
+ */
+static void
+dev_msg(struct IOStdReq *ior)
+{
+    becdev_msg_t *bm = ior->io_Data;
+    uint          replylen = 0;
+    uint          rc;
+
+    ior->io_Actual = 0;
+    if ((bm == NULL) || (ior->io_Length < sizeof (*bm))) {
+        ior->io_Error = IOERR_BADLENGTH;
+        return;
+    }
+    rc = send_cmd_retry(bm->bdm_cmd, bm->bdm_arg, bm->bdm_arglen,
+                        bm->bdm_reply, bm->bdm_replymax, &replylen);
+    bm->bdm_status   = rc;
+    bm->bdm_replylen = replylen;
+    ior->io_Actual   = replylen;
+    ior->io_Error    = bec_status_to_ioerr(rc);
+}
+
+/*
+ * dev_msg_task
+ * ------------
+ * Services the message unit. Requests are taken from the unit port in
+ * the order they were queued, and each is replied to its sender as soon
+ * as it completes. The task exits when signaled with CTRL-C by the last
+ * close of the message unit.
+ */
+static void
+dev_msg_task(void)
+{
+    becdev_t        *dev  = becdev;
+    struct MsgPort  *port = &dev->bd_msgunit.unit_MsgPort;
+    struct IOStdReq *ior;
+    BYTE             sigbit = AllocSignal(-1);  // New task: always available
+    ULONG            sigs = 0;
+
+    /* Requests queued before this point are picked up below */
+    port->mp_SigBit  = sigbit;
+    port->mp_SigTask = FindTask(NULL);
+    port->mp_Flags   = PA_SIGNAL;
+
+    while ((sigs & SIGBREAKF_CTRL_C) == 0) {
+        while ((ior = (struct IOStdReq *) GetMsg(port)) != NULL) {
+            dev_msg(ior);
+            ReplyMsg(&ior->io_Message);
+        }
+        sigs = Wait(BIT(sigbit) | SIGBREAKF_CTRL_C);
+    }
+
+    /* The task is removed on return, before the closer can run again */
+    Forbid();
+    port->mp_Flags   = PA_IGNORE;
+    port->mp_SigTask = NULL;
+    dev->bd_msgtask  = NULL;
+    Signal(dev->bd_closer, SIGF_SINGLE);
+}
+
+/*
+ * dev_msg_beginio
+ * ---------------
+ * Queues a request for the message unit. BECCMD_MSG requests are always
+ * completed asynchronously by the message task, even if sent by DoIO().
+ */
+static void
+dev_msg_beginio(becdev_t *dev, struct IOStdReq *ior)
+{
+    if (ior->io_Command == BECCMD_MSG) {
+        ior->io_Flags &= ~IOF_QUICK;
+        PutMsg(&dev->bd_msgunit.unit_MsgPort, &ior->io_Message);
+        return;
+    }
+    ior->io_Error = IOERR_NOCMD;
+    if ((ior->io_Flags & IOF_QUICK) == 0)
+        ReplyMsg(&ior->io_Message);
+}
+
+/*
+ * dev_beginio
+ * -----------
+ * Processes an I/O request. All block unit requests complete before
+ * return.
+ */
+static void
+dev_beginio(struct IOStdReq *ior asm("a1"), becdev_t *dev asm("a6"))
+{
+    becunit_t *bu = (becunit_t *) ior->io_Unit;
+
+    ior->io_Message.mn_Node.ln_Type = NT_MESSAGE;
+    ior->io_Error = 0;
+
+    if (ior->io_Unit == &dev->bd_msgunit) {
+        dev_msg_beginio(dev, ior);
+        return;
+    }
+
+    switch (ior->io_Command) {
+        case CMD_READ:
+            dev_rw(dev, ior, 0, ior->io_Offset);
+            break;
+        case CMD_WRITE:
+        case TD_FORMAT:
+            dev_rw(dev, ior, 1, ior->io_Offset);
+            break;
+        case TD_READ64:
+            dev_rw(dev, ior, 0, ((uint64_t) ior->io_Actual << 32) |
+                                ior->io_Offset);
+            break;
+        case TD_WRITE64:
+        case TD_FORMAT64:
+            dev_rw(dev, ior, 1, ((uint64_t) ior->io_Actual << 32) |
+                                ior->io_Offset);
+            break;
+        case TD_GETGEOMETRY:
+            dev_geometry(dev, ior);
+            break;
+        case TD_CHANGENUM:
+            ior->io_Actual = bu->bu_changenum;
+            break;
+        case TD_CHANGESTATE:
+        case TD_PROTSTATUS:
+            ior->io_Actual = 0;  // Unit present, not write protected
+            break;
+        case TD_GETDRIVETYPE:
+            ior->io_Actual = DG_DIRECT_ACCESS;
+            break;
+        case CMD_UPDATE:
+        case CMD_CLEAR:
+        case TD_MOTOR:
+        case TD_SEEK:
+        case TD_REMOVE:
+            ior->io_Actual = 0;
+            break;
+        default:
+            ior->io_Error = IOERR_NOCMD;
+            break;
+    }
+
+    if ((ior->io_Flags & IOF_QUICK) == 0)
+        ReplyMsg(&ior->io_Message);
+}
+
+/*
+ * dev_abortio
+ * -----------
+ * Aborts a message unit request which the message task has not yet
+ * started. A request already being sent to the BEC runs to completion.
+ * Block unit requests are never queued, so there is nothing to abort.
+ */
+static LONG
+dev_abortio(struct IORequest *ior asm("a1"), becdev_t *dev asm("a6"))
+{
+    struct List *list = &dev->bd_msgunit.unit_MsgPort.mp_MsgList;
+    struct Node *node;
+    LONG         rc = IOERR_NOCMD;
+
+    if (ior->io_Unit != &dev->bd_msgunit)
+        return (rc);
+
+    Forbid();
+    for (node = list->lh_Head; node->ln_Succ != NULL; node = node->ln_Succ) {
+        if (node == &ior->io_Message.mn_Node) {
+            Remove(node);
+            ior->io_Error = IOERR_ABORTED;
+            ReplyMsg(&ior->io_Message);
+            rc = 0;
+            break;
+        }
+    }
+    Permit();
+    return (rc);
+}
+
+/*
+ * dev_msg_open
+ * ------------
+ * Opens the message unit, starting the message task on first open.
+ * Returns non-zero if the task could not be started.
+ */
+static uint
+dev_msg_open(becdev_t *dev)
+{
+    if (dev->bd_msgunit.unit_OpenCnt == 0) {
+        dev->bd_msgtask = CreateTask(BECDEV_TASK_NAME, BECDEV_TASK_PRI,
+                                     (APTR) dev_msg_task, BECDEV_TASK_STK);
+        if (dev->bd_msgtask == NULL)
+            return (1);
+    }
+    dev->bd_msgunit.unit_OpenCnt++;
+    return (0);
+}
+
+/*
+ * dev_msg_close
+ * -------------
+ * Closes the message unit, stopping the message task on last close. The
+ * caller is responsible for having completed all of its requests.
+ */
+static void
+dev_msg_close(becdev_t *dev)
+{
+    if (--dev->bd_msgunit.unit_OpenCnt != 0)
+        return;
+
+    dev->bd_closer = FindTask(NULL);
+    SetSignal(0, SIGF_SINGLE);
+    Signal(dev->bd_msgtask, SIGBREAKF_CTRL_C);
+    while (dev->bd_msgtask != NULL)
+        Wait(SIGF_SINGLE);
+}
+
+static BPTR
+dev_expunge(becdev_t *dev asm("a6"))
+{
+    BPTR seglist;
+
+    if (dev->bd_lib.lib_OpenCnt != 0) {
+        dev->bd_lib.lib_Flags |= LIBF_DELEXP;
+        return (0);
+    }
+    seglist = dev->bd_seglist;
+    Remove(&dev->bd_lib.lib_Node);
+    FreeMem((uint8_t *) dev - dev->bd_lib.lib_NegSize,
+            dev->bd_lib.lib_NegSize + dev->bd_lib.lib_PosSize);
+    return (seglist);
+}
+
+static void
+dev_open(struct IORequest *ior asm("a1"), ULONG unit asm("d0"),
+         ULONG flags asm("d1"), becdev_t *dev asm("a6"))
+{
+    becunit_t *bu;
+    ULONG      blocks;
+    uint       rc;
+
+    (void) flags;
+    ior->io_Error = IOERR_OPENFAIL;
+    ior->io_Message.mn_Node.ln_Type = NT_REPLYMSG;
+
+    /* Prevent expunge while the unit is probed */
+    dev->bd_lib.lib_OpenCnt++;
+    if (unit == BECDEV_UNIT_MSG) {
+        if (dev_msg_open(dev))
+            goto open_fail;
+        ior->io_Unit = &dev->bd_msgunit;
+        goto open_done;
+    }
+    if (unit >= BECDEV_MAX_UNITS)
+        goto open_fail;
+
+    rc = bec_blk_info(dev, unit, &blocks);
+    if (rc != BEC_STATUS_OK)
+        goto open_fail;
+
+    bu = &dev->bd_unit[unit];
+    if (bu->bu_unit.unit_OpenCnt++ == 0)
+        bu->bu_blocks = blocks;
+    ior->io_Unit   = &bu->bu_unit;
+open_done:
+    ior->io_Device = (struct Device *) dev;
+    ior->io_Error  = 0;
+    dev->bd_lib.lib_Flags &= ~LIBF_DELEXP;
+    return;
+
+open_fail:
+    dev->bd_lib.lib_OpenCnt--;
+}
+
+static BPTR
+dev_close(struct IORequest *ior asm("a1"), becdev_t *dev asm("a6"))
+{
+    becunit_t *bu = (becunit_t *) ior->io_Unit;
+
+    if (ior->io_Unit == &dev->bd_msgunit)
+        dev_msg_close(dev);
+    else
+        bu->bu_unit.unit_OpenCnt--;
+    ior->io_Unit   = (struct Unit *) -1;
+    ior->io_Device = (struct Device *) -1;
+
+    if ((--dev->bd_lib.lib_OpenCnt == 0) &&
+        (dev->bd_lib.lib_Flags & LIBF_DELEXP))
+        return (dev_expunge(dev));
+    return (0);
+}
+
+static ULONG
+dev_null(void)
+{
+    return (0);
+}
+
+static struct Library *
+dev_init(becdev_t *dev asm("d0"), BPTR seglist asm("a0"),
+         struct ExecBase *sysbase asm("a6"))
+{
+    SysBase = sysbase;
+
+    dev->bd_lib.lib_Node.ln_Type = NT_DEVICE;
+    dev->bd_lib.lib_Node.ln_Pri  = DEVICE_PRI;
+    dev->bd_lib.lib_Node.ln_Name = (char *) device_name;
+    dev->bd_lib.lib_Flags        = LIBF_SUMUSED | LIBF_CHANGED;
+    dev->bd_lib.lib_Version      = DEVICE_VERSION;
+    dev->bd_lib.lib_Revision     = DEVICE_REVISION;
+    dev->bd_lib.lib_IdString     = (APTR) device_id;
+    dev->bd_seglist              = seglist;
+    InitSemaphore(&dev->bd_lock);
+
+    /* Requests queue on the message unit port until its task starts */
+    dev->bd_msgunit.unit_MsgPort.mp_Node.ln_Type = NT_MSGPORT;
+    dev->bd_msgunit.unit_MsgPort.mp_Flags        = PA_IGNORE;
+    NewList(&dev->bd_msgunit.unit_MsgPort.mp_MsgList);
+    becdev = dev;
+    return (&dev->bd_lib);
+}
+
+static const APTR dev_functions[] = {
+    (APTR) dev_open,
+    (APTR) dev_close,
+    (APTR) dev_expunge,
+    (APTR) dev_null,
+    (APTR) dev_beginio,
+    (APTR) dev_abortio,
+    (APTR) -1
+};
+
+static const ULONG dev_inittab[] = {
+    sizeof (becdev_t),
+    (ULONG) dev_functions,
+    0,                     // Device structure is filled by dev_init()
+    (ULONG) dev_init
+};
+
+const struct Resident dev_resident = {
+    RTC_MATCHWORD,             // rt_MatchWord - word to match on (ILLEGAL)
+    (void *) &dev_resident,    // rt_MatchTag - pointer to the above
+    (void *) (&dev_resident + 1),  // rt_EndSkip - address to continue scan
+    RTF_AUTOINIT,              // rt_Flags - various tag flags
+    DEVICE_VERSION,            // rt_Version - release version number
+    NT_DEVICE,                 // rt_Type - type of module
+    DEVICE_PRI,                // rt_Pri - initialization priority
+    (char *) device_name,      // rt_Name - pointer to node name
+    (char *) device_id,        // rt_IdString - pointer to identification string
+    (APTR) dev_inittab         // rt_Init - pointer to init table
+};
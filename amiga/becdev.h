@@ -0,0 +1,42 @@
+/*
+ * This is free and unencumbered software released into the public domain.
+ * See the LICENSE file for additional details.
+ *
+ * Designed by Chris Hooper in 2025.
+ *
+ * ---------------------------------------------------------------------
+ *
+ * bec.device interface for programs which send BEC messages through
+ * the device rather than accessing the BEC mailbox directly.
+ */
+
+#ifndef _BECDEV_H
+#define _BECDEV_H
+
+/*
+ * Opening this unit number gives access to the BEC message interface
+ * rather than a USB Mass Storage unit. Requests to this unit are queued
+ * and processed asynchronously (in order of arrival) by the device task,
+ * so SendIO() returns immediately and the request is replied to the
+ * caller's port when the BEC reply has been received.
+ */
+#define BECDEV_UNIT_MSG 0xff
+
+#define BECCMD_MSG      (CMD_NONSTD + 0x40)  // Send BEC message (becdev_msg_t)
+
+/*
+ * BECCMD_MSG request, pointed to by io_Data (io_Length = sizeof). On
+ * completion, io_Error is 0 if the BEC reported BEC_STATUS_OK and
+ * io_Actual holds the reply length.
+ */
+typedef struct {
+    UBYTE  bdm_cmd;       // BEC_CMD_* to send
+    UBYTE  bdm_status;    // BEC_STATUS_* of reply
+    UWORD  bdm_arglen;    // Length of message payload
+    APTR   bdm_arg;       // Message payload
+    APTR   bdm_reply;     // Reply payload buffer
+    ULONG  bdm_replymax;  // Size of reply buffer
+    ULONG  bdm_replylen;  // Length of reply payload received
+} becdev_msg_t;
+
+#endif /* _BECDEV_H */
@@ -42,6 +42,7 @@ const char *version = "\0$VER: becky "VERSION" ("BUILD_DATE") \xA9 Chris Hooper"
 #include "hid_kbd_codes.h"
 #include "becmsg.h"
 #include "bec_cmd.h"
+#include "keymapfile.h"
 
 /*
  * Define compile-time assert. This macro relies on gcc's built-in
@@ -978,6 +979,7 @@ static const char cmd_options[] =
     "   justlive     Just live keys (not mapped keys) (-j)\n"
     "   load <arg>   load key mappings from bec, default, or a filename\n"
     "   save <arg>   save key mappings to bec, or a filename\n"
+    "                (.bkm filename suffix saves compiled binary keymap)\n"
     "   mapamiga     Amiga key mapping mode (-M)\n"
     "   maphid       HID key mapping mode (-m)\n"
     "   iso          present ISO style keyboard (-i)\n"
@@ -1019,27 +1021,6 @@ long_to_short(const char *ptr, const long_to_short_t *ltos, uint ltos_count)
     return (ptr);
 }
 
-static char *
-strcasestr(const char *haystack, const char *needle)
-{
-    char ch;
-    char sc;
-    size_t len;
-
-    if ((ch = *needle++) != 0) {
-        ch = tolower((unsigned char) ch);
-        len = strlen(needle);
-        do {
-            do {
-                if ((sc = *haystack++) == 0)
-                    return (NULL);
-            } while ((char)tolower((unsigned char) sc) != ch);
-        } while (strncasecmp(haystack, needle, len) != 0);
-        haystack--;
-    }
-    return ((char *) haystack);
-}
-
 static void __attribute__((format(__printf__, 1, 2)))
 err_printf(const char *fmt, ...)
 {
@@ -4392,6 +4373,63 @@ save_keymap_to_bec(uint which)
     return (0);
 }
 
+/*
+ * save_keymap_image_to_bec
+ * ------------------------
+ * Sends both the keymap and buttonmap to BEC as a single binary image.
+ * BEC verifies the complete image before applying it, and then updates
+ * its flash config area only once. If BEC firmware is too old to support
+ * image upload, the maps are instead sent in pieces with BEC_CMD_SET_MAP.
+ */
+static uint
+save_keymap_image_to_bec(void)
+{
+    static uint8_t     image[KEYMAP_IMAGE_SIZE];
+    uint8_t            sendbuf[sizeof (bec_keymap_bulk_t) + 240];
+    bec_keymap_bulk_t *req = (void *) sendbuf;
+    uint               maxchunk = sizeof (sendbuf) - sizeof (*req);
+    uint               chunk;
+    uint               len;
+    uint               pos;
+    uint               rlen;
+    uint               rc;
+
+    len = keymap_image_encode(image, hid_scancode_to_amiga,
+                              hid_button_scancode_to_amiga);
+    req->bkb_op     = BKB_OP_START;
+    req->bkb_unused = 0;
+    req->bkb_offset = len;
+    rc = send_cmd_retry(BEC_CMD_SET_MAP_BULK, req, sizeof (*req),
+                        NULL, 0, &rlen);
+    if (rc == BEC_STATUS_UNKCMD) {
+        /* Older BEC firmware */
+        return (save_keymap_to_bec(0) || save_keymap_to_bec(1));
+    }
+
+    req->bkb_op = BKB_OP_DATA;
+    for (pos = 0; (rc == 0) && (pos < len); pos += chunk) {
+        chunk = len - pos;
+        if (chunk > maxchunk)
+            chunk = maxchunk;
+        req->bkb_offset = pos;
+        memcpy(req + 1, image + pos, chunk);
+        rc = send_cmd_retry(BEC_CMD_SET_MAP_BULK, sendbuf,
+                            sizeof (*req) + chunk, NULL, 0, &rlen);
+    }
+    if (rc == 0) {
+        req->bkb_op     = BKB_OP_COMMIT;
+        req->bkb_offset = 0;
+        rc = send_cmd_retry(BEC_CMD_SET_MAP_BULK, req, sizeof (*req),
+                            NULL, 0, &rlen);
+    }
+    if (rc != 0) {
+        gui_printf("BEC keymap upload fail: %s", bec_err(rc));
+        return (1);
+    }
+    gui_printf("Done saving keymap and buttonmap to BEC");
+    return (0);
+}
+
 static void
 about_program(void)
 {
@@ -4408,20 +4446,101 @@ about_program(void)
     EasyRequest(NULL, &about, NULL);
 }
 
-#define MAP_TYPE_UNKNOWN 0
-#define MAP_TYPE_KEY     1
-#define MAP_TYPE_BUTTON  2
+/*
+ * mark_keymap_entry
+ * -----------------
+ * Updates key and button mapped state (and keycaps) for a mapping entry
+ * which was just loaded from a file.
+ */
+static void
+mark_keymap_entry(uint map_type, uint hid_code)
+{
+    uint8_t *map_ptr;
+    uint     count;
+    uint     map;
+    uint     acap;
+    uint     hcap;
+
+    map_ptr = (map_type == MAP_TYPE_KEY) ?
+                        hid_scancode_to_amiga[hid_code] :
+                        hid_button_scancode_to_amiga[hid_code];
+    count = keymap_entry_len(map_ptr);
+    for (map = 0; map < count; map++) {
+        acap = amiga_scancode_to_capnum[map_ptr[map]];
+        if (acap != 0xff) {
+            if ((amiga_key_mapped[acap]++ == 0) && gui_initialized)
+                draw_amiga_key(acap, 0);
+        }
+    }
+    if (count == 0)
+        return;
+
+    if (map_type == MAP_TYPE_KEY) {
+        /* HID scancode */
+        hcap = hid_scancode_to_capnum[hid_code];
+        if (hcap != 0xff) {
+            if ((hid_key_mapped[hcap]++ == 0) && gui_initialized)
+                draw_hid_key(hcap, 0);
+        }
+    } else if (map_type == MAP_TYPE_BUTTON) {
+        /* HID button scancode */
+        if (hid_button_mapped[hid_code]++ == 0) {
+            hcap = hid_button_scancode_to_capnum(hid_code);
+            if ((hcap != 0xff) && gui_initialized)
+                draw_hid_button(hcap, 0);
+        }
+    }
+}
+
+/*
+ * load_keymap_image_from_file
+ * ---------------------------
+ * Loads a compiled binary keymap image (see keymapconv).
+ */
+static uint
+load_keymap_image_from_file(const char *filename)
+{
+    static uint8_t image[KEYMAP_IMAGE_SIZE];
+    FILE *fp;
+    uint  len;
+    uint  rc;
+    uint  cur;
+
+    fp = fopen(filename, "r");
+    if (fp == NULL) {
+        gui_printf("Failed to open %s", filename);
+        return (1);
+    }
+    len = fread(image, 1, sizeof (image), fp);
+    fclose(fp);
+
+    rc = keymap_image_decode(image, len, hid_scancode_to_amiga,
+                             hid_button_scancode_to_amiga);
+    if (rc != BEC_STATUS_OK) {
+        gui_printf("Invalid keymap image %s: %s", filename, bec_err(rc));
+        return (1);
+    }
+    unmap_all_keycaps();
+    for (cur = 0; cur < KEYMAP_NUM_KEYS; cur++)
+        mark_keymap_entry(MAP_TYPE_KEY, cur);
+    for (cur = 0; cur < KEYMAP_NUM_BUTTONS; cur++)
+        mark_keymap_entry(MAP_TYPE_BUTTON, cur);
+
+    gui_printf("Done loading keymap image from %s", filename);
+    return (0);
+}
 
 static uint
 load_keymap_from_file(const char *filename)
 {
-    char                 *kptr;
-    char                 *ptr;
     FILE                 *fp;
     struct FileRequester *req;
     char   linebuf[300];
     char   full_path[300];
     uint   line;
+    uint   len;
+    uint   hid_code;
+    int    map_type;
     uint   err_count = 0;
 
     if (filename != NULL) {
@@ -4451,128 +4570,32 @@ load_keymap_from_file(const char *filename)
         gui_printf("Failed to open %s", full_path);
         return (1);
     }
+
+    /* A compiled keymap image is loaded directly, without parsing */
+    len = fread(linebuf, 1, sizeof (bec_keymap_image_t), fp);
+    if (keymap_is_image((uint8_t *) linebuf, len)) {
+        fclose(fp);
+        return (load_keymap_image_from_file(full_path));
+    }
+    rewind(fp);
     unmap_all_keycaps();
 
     line = 0;
     while (fgets(linebuf, sizeof (linebuf) - 1, fp) != NULL) {
         linebuf[sizeof (linebuf) - 1] = '\0';
         line++;
-        if ((ptr = strchr(linebuf, '#')) != NULL)
-            *ptr = '\0';
-        if ((ptr = strchr(linebuf, '\n')) != NULL)
-            *ptr = '\0';
-        if ((ptr = strcasestr(linebuf, "MAP")) != NULL) {
-            uint map_type = MAP_TYPE_UNKNOWN;
-            if ((kptr = strcasestr(ptr + 3, "KEY")) != NULL) {
-                kptr += 3;
-                map_type = MAP_TYPE_KEY;
-            } else if ((kptr = strcasestr(ptr + 3, "BUTTON")) != NULL) {
-                kptr += 6;
-                map_type = MAP_TYPE_BUTTON;
-            }
-            if (map_type != MAP_TYPE_UNKNOWN) {
-                int      pos = 0;
-                uint     hid_code;
-                uint     amiga_code;
-                uint     sc_count = 0;
-                uint     hcap;
-                uint     acap;
-                uint8_t *map_ptr;
-
-                if ((sscanf(kptr, "%x%n", &hid_code, &pos) != 1) ||
-                    ((kptr[pos] != ' ') && (kptr[pos] != '\0')) ||
-                    (hid_code > 0xff)) {
-invalid_hid_code:
-                    err_printf("%u: Invalid HID %sscancode \"%.*s\":\n%s\n",
-                               (map_type == MAP_TYPE_KEY) ? "" : "button ",
-                               line, pos, kptr, linebuf);
-load_parse_error:
-                    if (err_count++ > 8) {
-                        err_printf("Too many errors; giving up\n");
-                        break;
-                    }
-                    continue;
-                }
-                if ((map_type == MAP_TYPE_BUTTON) && (hid_code >= 0x40))
-                    goto invalid_hid_code;
-                map_ptr = (map_type == MAP_TYPE_KEY) ?
-                                    hid_scancode_to_amiga[hid_code] :
-                                    hid_button_scancode_to_amiga[hid_code];
-
-                ptr = strcasestr(kptr + pos, " TO ");
-                if (ptr == NULL) {
-                    err_printf("%u: missing \"TO\" in MAP %s command:\n:%s\n",
-                               (map_type == MAP_TYPE_KEY) ? "KEY" : "BUTTON",
-                               line, linebuf);
-                    goto load_parse_error;
-                }
-                kptr = ptr + 4;
-                amiga_code = 0xff;
-                while (sc_count < 5) {
-                    /* Skip whitespace and comma separators */
-                    while ((*kptr == ' ') || (*kptr == '\t') || (*kptr == ','))
-                        kptr++;
-
-                    if ((sscanf(kptr, "%x%n", &amiga_code, &pos) != 1) ||
-                        ((kptr[pos] != ' ') && (kptr[pos] != '\t') &&
-                         (kptr[pos] != ',') && (kptr[pos] != '\0')) ||
-                        (amiga_code > 0xff)) {
-                        ptr = kptr;
-                        while (*ptr == ' ')
-                            ptr++;
-                        if (*ptr == '\0')
-                            break;  // End of line
-
-                        err_printf("%u: Invalid Amiga scancode \"%.*s\":\n%s\n",
-                                   line, pos, kptr, linebuf);
-                        goto load_parse_error;
-                    }
-                    if (sc_count == 4) {
-                        err_printf("%u: too many Amiga scancodes at %x:\n%s\n",
-                                   line, amiga_code, linebuf);
-                        goto load_parse_error;
-                    }
-                    map_ptr[sc_count] = amiga_code;
-                    acap = amiga_scancode_to_capnum[amiga_code];
-                    if (acap != 0xff) {
-                        if (amiga_key_mapped[acap]++ == 0)
-                            draw_amiga_key(acap, 0);
-                    }
-                    sc_count++;
-                    kptr += pos;
-                }
-
-                /* Handle special cases */
-                if (sc_count == 0) {
-                    /* No mapping provided: terminate this mapping */
-                    map_ptr[sc_count++] = 0xff;
-                } else if ((sc_count <= 3) && (map_ptr[sc_count] == 0x00)) {
-                    /*
-                     * Last mapping provided was Amiga backtick scancode:
-                     * terminate mapping by adding 0xff.
-                     */
-                    map_ptr[sc_count++] = 0xff;
-                }
-                while (sc_count < 4)
-                    map_ptr[sc_count++] = 00;
-
-                if (map_type == MAP_TYPE_KEY) {
-                    /* HID scancode */
-                    hcap = hid_scancode_to_capnum[hid_code];
-                    if (hcap != 0xff) {
-                        if (hid_key_mapped[hcap]++ == 0)
-                            draw_hid_key(hcap, 0);
-                    }
-                } else if (map_type == MAP_TYPE_BUTTON) {
-                    /* HID button scancode */
-                    if (hid_button_mapped[hid_code]++ == 0) {
-                        hcap = hid_button_scancode_to_capnum(hid_code);
-                        if (hcap != 0xff)
-                            draw_hid_button(hcap, 0);
-                    }
-                }
+        map_type = keymap_parse_line(linebuf, line, hid_scancode_to_amiga,
+                                     hid_button_scancode_to_amiga,
+                                     &hid_code, err_printf);
+        if (map_type < 0) {
+            if (err_count++ > 8) {
+                err_printf("Too many errors; giving up\n");
+                break;
             }
+            continue;
         }
+        if (map_type != MAP_TYPE_UNKNOWN)
+            mark_keymap_entry(map_type, hid_code);
     }
     fclose(fp);
     gui_printf("Done loading keymap from %s", full_path);
@@ -4583,57 +4606,64 @@ static void
 save_single_keymap(FILE *fp, uint map_type, uint8_t scancode,
                    uint8_t *amiga_scancodes)
 {
-    uint  map;
-    uint  printed = 0;
-    char  amiga_buf[128];
-    char *amiga_buf_ptr = amiga_buf;
+    uint map;
+    uint count = keymap_entry_len(amiga_scancodes);
 
-    for (map = 0; map < 4; map++) {
-        uint8_t amiga_scancode = amiga_scancodes[map];
-        if (amiga_scancode == 0xff)
-            break;  // End of list
-        if (amiga_scancode == 0x00) {
-            /* Special case for Amiga backtick */
-            uint pos = map + 1;
-            for (; pos < 4; pos++)
-                if (amiga_scancodes[pos] != 0x00)
-                    break;
-            if (pos == 4)
-                break;  // End of list
-        }
-        if (printed++ == 0)
-            fprintf(fp, "MAP %s %02x TO",
-                    (map_type == 1) ? "KEY" : "BUTTON", scancode);
-        fprintf(fp, " %02x", amiga_scancode);
-
-        if (amiga_scancode != 0xff) {
-            sprintf(amiga_buf_ptr, " \"%s\"",
-                    amiga_scancode_to_long_name[amiga_scancode]);
-            amiga_buf_ptr += strlen(amiga_buf_ptr);
-        }
-    }
+    if (count == 0)
+        return;  // Not mapped
 
-    if (printed) {
-        fprintf(fp, "  #");
-        if (map_type == MAP_TYPE_KEY) {
-            /* HID scancode */
-            fprintf(fp, " %s", hid_scancode_to_long_name[scancode]);
+    keymap_write_entry(fp, map_type, scancode, amiga_scancodes);
+    fprintf(fp, "  #");
+    if (map_type == MAP_TYPE_KEY) {
+        /* HID scancode */
+        fprintf(fp, " %s", hid_scancode_to_long_name[scancode]);
+    } else {
+        /* HID button scancode */
+        if (scancode < 0x1c) {
+            fprintf(fp, " Button %u", scancode + 1);
+        } else if (scancode < 0x20) {
+            fprintf(fp, " Joystick %s",
+                    (scancode == 0x1c) ? "Up" :
+                    (scancode == 0x1d) ? "Down" :
+                    (scancode == 0x1e) ? "Left" : "Right");
         } else {
-            /* HID button scancode */
-            if (scancode < 0x1c) {
-                fprintf(fp, " Button %u", scancode + 1);
-            } else if (scancode < 0x20) {
-                fprintf(fp, " Joystick %s",
-                        (scancode == 0x1c) ? "Up" :
-                        (scancode == 0x1d) ? "Down" :
-                        (scancode == 0x1e) ? "Left" : "Right");
-            } else {
-                fprintf(fp, " Joystick Button %u", scancode + 1 - 0x20);
-            }
+            fprintf(fp, " Joystick Button %u", scancode + 1 - 0x20);
         }
-        *amiga_buf_ptr = '\0';
-        fprintf(fp, " ->%s\n", amiga_buf);
     }
+    fprintf(fp, " ->");
+    for (map = 0; map < count; map++)
+        fprintf(fp, " \"%s\"",
+                amiga_scancode_to_long_name[amiga_scancodes[map]]);
+    fprintf(fp, "\n");
+}
+
+/*
+ * save_keymap_image_to_file
+ * -------------------------
+ * Writes the current keymap and buttonmap as a compiled binary image.
+ */
+static uint
+save_keymap_image_to_file(const char *filename)
+{
+    static uint8_t image[KEYMAP_IMAGE_SIZE];
+    FILE *fp;
+    uint  len;
+
+    len = keymap_image_encode(image, hid_scancode_to_amiga,
+                              hid_button_scancode_to_amiga);
+    fp = fopen(filename, "w");
+    if (fp == NULL) {
+        gui_printf("Failed to open %s", filename);
+        return (1);
+    }
+    if (fwrite(image, 1, len, fp) != len) {
+        fclose(fp);
+        gui_printf("Failed to write %s", filename);
+        return (1);
+    }
+    fclose(fp);
+    gui_printf("Done saving keymap image to %s", filename);
+    return (0);
 }
 
 static uint
@@ -4645,6 +4675,7 @@ save_keymap_to_file(const char *filename)
     time_t now;
     char   full_path[300];
     uint   cur;
+    uint   len;
 
     if (filename != NULL) {
         strcpy(full_path, filename);
@@ -4669,6 +4700,14 @@ save_keymap_to_file(const char *filename)
         FreeAslRequest(req);
     }
 
+    /* Files with the image suffix are saved in compiled binary format */
+    len = strlen(full_path);
+    if ((len > strlen(KEYMAP_IMAGE_SUFFIX)) &&
+        (strcasecmp(full_path + len - strlen(KEYMAP_IMAGE_SUFFIX),
+                    KEYMAP_IMAGE_SUFFIX) == 0)) {
+        return (save_keymap_image_to_file(full_path));
+    }
+
     /* Open file for Save... */
     fp = fopen(full_path, "w");
     if (fp == NULL) {
@@ -4726,8 +4765,7 @@ save_keymap_to_file_or_bec(const char *filename)
 {
     uint rc;
     if ((filename == NULL) || (strcasecmp(filename, "BEC") == 0)) {
-        rc = save_keymap_to_bec(0) ||
-             save_keymap_to_bec(1);
+        rc = save_keymap_image_to_bec();
     } else {
         rc = save_keymap_to_file(filename);
     }
@@ -4759,18 +4797,77 @@ stop_poll_for_hid_scancodes(void)
     }
 }
 
+/*
+ * handle_hid_capture() processes captured (scancode, flags) pairs.
+ */
+static void
+handle_hid_capture(const uint8_t *data, uint count)
+{
+    uint pos;
+
+    for (pos = 0; pos < count * 2; pos += 2) {
+        if (data[pos + 1] & KEYCAP_BUTTON) {
+            hid_rawbutton(data[pos], data[pos + 1]);
+        } else {
+            hid_rawkey(data[pos], data[pos + 1]);
+            if (((data[pos + 1] & KEYCAP_UP) == 0) &&
+                ((data[pos] == HS_MEDIA_S_UP) ||
+                 (data[pos] == HS_MEDIA_S_DOWN) ||
+                 (data[pos] == HS_MEDIA_BACK) ||
+                 (data[pos] == HS_MEDIA_FWD))) {
+                /* Mouse wheel scancodes don't issue "key up" */
+                hid_rawkey(data[pos], KEYCAP_UP);
+            }
+        }
+    }
+}
+
+/*
+ * poll_input_snap() gets captured HID scancodes using the combined
+ *                   BEC input snapshot command.
+ */
+static uint
+poll_input_snap(void)
+{
+    uint             rc;
+    uint             rlen;
+    uint             pos;
+    uint             len;
+    uint8_t          replybuf[160];
+    bec_input_snap_t req;
+
+    memset(&req, 0, sizeof (req));
+    req.bis_what    = BIS_WHAT_KEYS;
+    req.bis_source  = BKM_SOURCE_HID_SCANCODE;
+    req.bis_timeout = 700;  // msec timeout if not polling_for_scancodes again
+    req.bis_keys    = 64;
+
+    rc = send_cmd(BEC_CMD_INPUT_SNAP, &req, sizeof (req),
+                  replybuf, sizeof (replybuf), &rlen);
+    if (rc != 0)
+        return (rc);
+
+    for (pos = 0; pos + 2 <= rlen; pos += 2 + len) {
+        len = replybuf[pos + 1];
+        if (pos + 2 + len > rlen)
+            break;  // Truncated record
+        if (replybuf[pos] == BIS_TLV_KEYS)
+            handle_hid_capture(&replybuf[pos + 2], len / 2);
+    }
+    return (0);
+}
+
 static void
 poll_for_hid_scancodes(void)
 {
     uint            rc;
     uint            rlen;
     uint8_t         replybuf[48];
-    uint            pos;
     bec_poll_t      req;
     bec_poll_t     *rep = (bec_poll_t *)replybuf;
-    uint8_t        *data;
     static uint8_t  err_timeout;
     static uint8_t  err_count;
+    static uint8_t  no_input_snap;
 
     if (edit_key_mapping_mode) {
         /* Flush previous poll */
@@ -4783,6 +4880,14 @@ poll_for_hid_scancodes(void)
         err_timeout--;
         return;
     }
+    if (no_input_snap == 0) {
+        rc = poll_input_snap();
+        if (rc == BEC_STATUS_UNKCMD)
+            no_input_snap = 1;  // Older BEC firmware
+        else
+            goto poll_done;
+    }
+
     req.bkm_source  = BKM_SOURCE_HID_SCANCODE;
     req.bkm_count   = 16;
     req.bkm_timeout = 700;  // msec timeout if not polling_for_scancodes again
@@ -4790,31 +4895,15 @@ poll_for_hid_scancodes(void)
     rep->bkm_count = 0;
     rc = send_cmd(BEC_CMD_POLL_INPUT, &req, sizeof (req),
                   replybuf, sizeof (replybuf), &rlen);
+    if (rc == 0)
+        handle_hid_capture((uint8_t *) (rep + 1), rep->bkm_count);
+
+poll_done:
     if (rc != 0) {
         if (err_count < 7)
             err_count++;
         err_timeout = (1 << err_count);  // Exponential backoff
         gui_printf("BEC poll fail rc=%d", rc);
-        return;
-    }
-    if (rep->bkm_count == 0)
-        return;
-
-    data = (uint8_t *) (rep + 1);
-    for (pos = 0; pos < rep->bkm_count * 2; pos += 2) {
-        if (data[pos + 1] & KEYCAP_BUTTON) {
-            hid_rawbutton(data[pos], data[pos + 1]);
-        } else {
-            hid_rawkey(data[pos], data[pos + 1]);
-            if (((data[pos + 1] & KEYCAP_UP) == 0) &&
-                ((data[pos] == HS_MEDIA_S_UP) ||
-                 (data[pos] == HS_MEDIA_S_DOWN) ||
-                 (data[pos] == HS_MEDIA_BACK) ||
-                 (data[pos] == HS_MEDIA_FWD))) {
-                /* Mouse wheel scancodes don't issue "key up" */
-                hid_rawkey(data[pos], KEYCAP_UP);
-            }
-        }
     }
 }
 
@@ -4929,8 +5018,7 @@ handle_win(void)
                                         break;
                                     case MENU_BEC_SAVE:
                                         gui_printf("Saving to BEC");
-                                        save_keymap_to_bec(0);
-                                        save_keymap_to_bec(1);
+                                        save_keymap_image_to_bec();
                                         break;
                                     case MENU_BEC_DEFAULTS:
                                         gui_printf("Loading defaults");
@@ -25,6 +25,8 @@
 #include <inline/exec.h>
 #include <inline/dos.h>
 #include <exec/execbase.h>
+#include <exec/memory.h>
+#include <exec/semaphores.h>
 #include "../fw/bec_cmd.h"
 #include "crc32.h"
 #include "becmsg.h"
@@ -110,7 +112,9 @@ uint8_t bec_msg_interface = BEC_MSG_INTERFACE_UNKNOWN;
 #define RP_RESET_16HZ_OFF  BIT(2) /* Turn off 16Hz clock pulse */
 #define RP_RESET_1HZ_OFF   BIT(3) /* Turn off 1Hz clock pulse */
 
+#ifndef RTC_REG
 #define RTC_REG(x) (*((volatile uint8_t *) 0xdc0000 + x))
+#endif
 
 static const uint8_t bec_magic[] = { 0xc, 0xd, 0x6, 0x8 };
 
@@ -288,8 +292,10 @@ send_rtc_cmd(uint8_t cmd, void *arg, uint16_t arglen,
             break;
     }
 
-    if (timeout == 0)
+    if (timeout == 0) {
+        Permit();
         return (BEC_STATUS_TIMEOUT);
+    }
 
     got_magic[1] = get_nibble_lo();
     got_magic[2] = get_nibble_hi();
@@ -301,6 +307,7 @@ send_rtc_cmd(uint8_t cmd, void *arg, uint16_t arglen,
 
     if (bad_magic) {
         cmd_flush(1);
+        Permit();
         if (flag_debug) {
             printf("BEC bad magic:");
             for (pos = 0; pos < ARRAY_SIZE(got_magic); pos++)
@@ -323,8 +330,10 @@ send_rtc_cmd(uint8_t cmd, void *arg, uint16_t arglen,
 
     *replyalen = msglen;
 
-    if (msglen > replymax)
+    if (msglen > replymax) {
+        Permit();
         return (BEC_STATUS_REPLYLEN); // Too long; truncated
+    }
 
     /* Get CRC */
     got_crc  = (get_byte() << 24);
@@ -500,7 +509,7 @@ drop_reply:
         goto kbd_receive_fail;
     msglen = (data0 << 8) | data1;
     *replyalen = msglen;
-    if (msglen > 0x110) {
+    if (msglen > BEC_MSG_MAX_PAYLOAD) {
         printf("Bad msglen %02x\n", msglen);
         status = BEC_STATUS_REPLYLEN;
         goto drop_reply;
@@ -564,9 +573,43 @@ determine_msg_interface(void)
     return (BEC_MSG_INTERFACE_UNKNOWN);
 }
 
-uint
-send_cmd(uint8_t cmd, void *arg, uint16_t arglen,
-         void *reply, uint replymax, uint *replyalen)
+/*
+ * bec_mailbox_lock
+ * ----------------
+ * Returns the system-wide semaphore which arbitrates the BEC mailbox
+ * between all programs (bec, becky, bec.device, ...). Each message
+ * exchange is a multi-byte sequence through the same RTC or keyboard
+ * registers, so two tasks sending at once would corrupt both messages.
+ * The first user creates and publishes the semaphore; it is never freed,
+ * as other programs may hold a reference to it at any time.
+ */
+static struct SignalSemaphore *
+bec_mailbox_lock(void)
+{
+    static struct SignalSemaphore *sem;
+
+    if (sem != NULL)
+        return (sem);
+
+    Forbid();
+    sem = FindSemaphore(BEC_MAILBOX_SEM_NAME);
+    if (sem == NULL) {
+        sem = AllocMem(sizeof (*sem) + sizeof (BEC_MAILBOX_SEM_NAME),
+                       MEMF_PUBLIC | MEMF_CLEAR);
+        if (sem != NULL) {
+            char *name = (char *) (sem + 1);
+            strcpy(name, BEC_MAILBOX_SEM_NAME);
+            sem->ss_Link.ln_Name = name;
+            AddSemaphore(sem);  // Also initializes the semaphore
+        }
+    }
+    Permit();
+    return (sem);
+}
+
+static uint
+send_cmd_locked(uint8_t cmd, void *arg, uint16_t arglen,
+                void *reply, uint replymax, uint *replyalen)
 {
     if (bec_msg_interface == BEC_MSG_INTERFACE_UNKNOWN)
         bec_msg_interface = determine_msg_interface();
@@ -581,6 +624,21 @@ send_cmd(uint8_t cmd, void *arg, uint16_t arglen,
     }
 }
 
+uint
+send_cmd(uint8_t cmd, void *arg, uint16_t arglen,
+         void *reply, uint replymax, uint *replyalen)
+{
+    struct SignalSemaphore *sem = bec_mailbox_lock();
+    uint rc;
+
+    if (sem != NULL)
+        ObtainSemaphore(sem);
+    rc = send_cmd_locked(cmd, arg, arglen, reply, replymax, replyalen);
+    if (sem != NULL)
+        ReleaseSemaphore(sem);
+    return (rc);
+}
+
 uint
 send_cmd_retry(uint8_t cmd, void *arg, uint16_t arglen,
                void *reply, uint replymax, uint *replyalen)
@@ -12,6 +12,12 @@
 #ifndef _BECMSG_H
 #define _BECMSG_H
 
+/*
+ * Public semaphore held by all programs for the duration of each BEC
+ * message exchange.
+ */
+#define BEC_MAILBOX_SEM_NAME "bec.mailbox"
+
 uint send_cmd(uint8_t cmd, void *arg, uint16_t arglen,
               void *reply, uint replymax, uint *replyalen);
 
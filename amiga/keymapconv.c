@@ -0,0 +1,159 @@
+/*
+ * keymapconv
+ * ----------
+ * Utility to convert BEC keymap files between the text format written
+ * by Becky and the compiled binary image format. The binary format may
+ * be loaded by Becky without parsing and is uploaded to BEC as a single
+ * atomic update. This utility builds both for AmigaOS and for the host.
+ *
+ * Copyright 2025 Chris Hooper. This program and source may be used
+ * and distributed freely, for any purpose which benefits the Amiga
+ * community. Commercial use of the binary, source, or algorithms requires
+ * prior written approval from Chris Hooper <amiga@cdh.eebugs.com>.
+ * All redistributions must retain this Copyright notice.
+ *
+ * DISCLAIMER: THE SOFTWARE IS PROVIDED "AS-IS", WITHOUT ANY WARRANTY.
+ * THE AUTHOR ASSUMES NO LIABILITY FOR ANY DAMAGE ARISING OUT OF THE USE
+ * OR MISUSE OF THIS UTILITY OR INFORMATION REPORTED BY THIS UTILITY.
+ */
+const char *version = "\0$VER: keymapconv "VERSION" ("BUILD_DATE") \xA9 Chris Hooper";
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/types.h>
+#include "bec_cmd.h"
+#include "keymapfile.h"
+
+static uint8_t keymap[KEYMAP_NUM_KEYS][KEYMAP_ESIZE];
+static uint8_t buttonmap[KEYMAP_NUM_BUTTONS][KEYMAP_ESIZE];
+static uint8_t image[KEYMAP_IMAGE_SIZE];
+
+static void
+usage(void)
+{
+    printf("%s\n\n"
+           "usage: keymapconv <infile> <outfile>\n"
+           "    Converts a text keymap to a binary keymap image, or a binary\n"
+           "    keymap image to text. The input format is detected from the\n"
+           "    file contents.\n", version + 7);
+}
+
+static void __attribute__((format(__printf__, 1, 2)))
+err_printf(const char *fmt, ...)
+{
+    va_list args;
+    va_start(args, fmt);
+    vfprintf(stderr, fmt, args);
+    va_end(args);
+}
+
+static uint
+load_text(FILE *fp)
+{
+    char linebuf[300];
+    uint line = 0;
+    uint err_count = 0;
+    uint hid_code;
+
+    /* Entries not listed in the file are left unmapped */
+    memset(keymap, 0, sizeof (keymap));
+    memset(buttonmap, 0, sizeof (buttonmap));
+
+    while (fgets(linebuf, sizeof (linebuf) - 1, fp) != NULL) {
+        linebuf[sizeof (linebuf) - 1] = '\0';
+        line++;
+        if (keymap_parse_line(linebuf, line, keymap, buttonmap,
+                              &hid_code, err_printf) < 0) {
+            if (err_count++ > 8) {
+                err_printf("Too many errors; giving up\n");
+                break;
+            }
+        }
+    }
+    return (err_count);
+}
+
+static void
+save_text(FILE *fp)
+{
+    uint cur;
+
+    fprintf(fp, "#\n"
+                "# BEC HID keymap converted by keymapconv %s\n"
+                "#\n"
+                "\n", VERSION);
+    for (cur = 0; cur < KEYMAP_NUM_KEYS; cur++) {
+        if (keymap_entry_len(keymap[cur]) == 0)
+            continue;
+        keymap_write_entry(fp, MAP_TYPE_KEY, cur, keymap[cur]);
+        fprintf(fp, "\n");
+    }
+    for (cur = 0; cur < KEYMAP_NUM_BUTTONS; cur++) {
+        if (keymap_entry_len(buttonmap[cur]) == 0)
+            continue;
+        keymap_write_entry(fp, MAP_TYPE_BUTTON, cur, buttonmap[cur]);
+        fprintf(fp, "\n");
+    }
+}
+
+int
+main(int argc, char *argv[])
+{
+    FILE *ifp;
+    FILE *ofp;
+    uint  len;
+    uint  rc;
+    uint  to_text;
+
+    if (argc != 3) {
+        usage();
+        exit(EXIT_FAILURE);
+    }
+
+    ifp = fopen(argv[1], "rb");
+    if (ifp == NULL) {
+        err_printf("Failed to open %s\n", argv[1]);
+        exit(EXIT_FAILURE);
+    }
+    len = fread(image, 1, sizeof (image), ifp);
+    to_text = keymap_is_image(image, len);
+    if (to_text) {
+        rc = keymap_image_decode(image, len, keymap, buttonmap);
+        if (rc != BEC_STATUS_OK) {
+            err_printf("%s: invalid keymap image (%s)\n", argv[1],
+                       (rc == BEC_STATUS_CRC) ? "bad CRC" :
+                       (rc == BEC_STATUS_BADLEN) ? "truncated" :
+                                                   "unsupported format");
+            fclose(ifp);
+            exit(EXIT_FAILURE);
+        }
+    } else {
+        rewind(ifp);
+        if (load_text(ifp) != 0) {
+            fclose(ifp);
+            exit(EXIT_FAILURE);
+        }
+    }
+    fclose(ifp);
+
+    ofp = fopen(argv[2], to_text ? "w" : "wb");
+    if (ofp == NULL) {
+        err_printf("Failed to open %s\n", argv[2]);
+        exit(EXIT_FAILURE);
+    }
+    if (to_text) {
+        save_text(ofp);
+    } else {
+        len = keymap_image_encode(image, keymap, buttonmap);
+        if (fwrite(image, 1, len, ofp) != len) {
+            err_printf("Failed to write %s\n", argv[2]);
+            fclose(ofp);
+            exit(EXIT_FAILURE);
+        }
+    }
+    fclose(ofp);
+    exit(EXIT_SUCCESS);
+}
@@ -0,0 +1,327 @@
+/*
+ * keymapfile
+ * ----------
+ * Functions to parse, generate, and convert BEC keymap files. Keymaps
+ * may be stored either as human-editable text ("MAP KEY xx TO yy") or as
+ * a compact binary image which may be loaded without parsing and sent
+ * directly to BEC with BEC_CMD_SET_MAP_BULK.
+ *
+ * This file is shared by Amiga tools and may also be built on the host.
+ *
+ * Copyright 2025 Chris Hooper. This program and source may be used
+ * and distributed freely, for any purpose which benefits the Amiga
+ * community. Commercial use of the binary, source, or algorithms requires
+ * prior written approval from Chris Hooper <amiga@cdh.eebugs.com>.
+ * All redistributions must retain this Copyright notice.
+ *
+ * DISCLAIMER: THE SOFTWARE IS PROVIDED "AS-IS", WITHOUT ANY WARRANTY.
+ * THE AUTHOR ASSUMES NO LIABILITY FOR ANY DAMAGE ARISING OUT OF THE USE
+ * OR MISUSE OF THIS UTILITY OR INFORMATION REPORTED BY THIS UTILITY.
+ */
+
+#include <stdio.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include <strings.h>
+#include <ctype.h>
+#include <sys/types.h>
+#include "bec_cmd.h"
+#include "crc32.h"
+#include "keymapfile.h"
+
+static char *
+strcasestr(const char *haystack, const char *needle)
+{
+    char ch;
+    char sc;
+    size_t len;
+
+    if ((ch = *needle++) != 0) {
+        ch = tolower((unsigned char) ch);
+        len = strlen(needle);
+        do {
+            do {
+                if ((sc = *haystack++) == 0)
+                    return (NULL);
+            } while ((char)tolower((unsigned char) sc) != ch);
+        } while (strncasecmp(haystack, needle, len) != 0);
+        haystack--;
+    }
+    return ((char *) haystack);
+}
+
+/*
+ * keymap_parse_line
+ * -----------------
+ * Parses a single line of a text keymap file, updating the matching
+ * keymap or buttonmap entry. Comments are stripped from linebuf.
+ *
+ * Returns MAP_TYPE_KEY or MAP_TYPE_BUTTON with *hid_code set to the
+ * updated entry, MAP_TYPE_UNKNOWN if the line has no mapping, or -1
+ * if the line could not be parsed.
+ */
+int
+keymap_parse_line(char *linebuf, uint line,
+                  uint8_t keymap[][KEYMAP_ESIZE],
+                  uint8_t buttonmap[][KEYMAP_ESIZE],
+                  uint *hid_code, keymap_err_t err_printf)
+{
+    char    *ptr;
+    char    *kptr;
+    int      pos = 0;
+    uint     map_type = MAP_TYPE_UNKNOWN;
+    uint     amiga_code;
+    uint     sc_count = 0;
+    uint8_t *map_ptr;
+
+    if ((ptr = strchr(linebuf, '#')) != NULL)
+        *ptr = '\0';
+    if ((ptr = strchr(linebuf, '\n')) != NULL)
+        *ptr = '\0';
+    if ((ptr = strcasestr(linebuf, "MAP")) == NULL)
+        return (MAP_TYPE_UNKNOWN);
+
+    if ((kptr = strcasestr(ptr + 3, "KEY")) != NULL) {
+        kptr += 3;
+        map_type = MAP_TYPE_KEY;
+    } else if ((kptr = strcasestr(ptr + 3, "BUTTON")) != NULL) {
+        kptr += 6;
+        map_type = MAP_TYPE_BUTTON;
+    } else {
+        return (MAP_TYPE_UNKNOWN);
+    }
+
+    if ((sscanf(kptr, "%x%n", hid_code, &pos) != 1) ||
+        ((kptr[pos] != ' ') && (kptr[pos] != '\0')) ||
+        (*hid_code >= ((map_type == MAP_TYPE_KEY) ? KEYMAP_NUM_KEYS :
+                                                    KEYMAP_NUM_BUTTONS))) {
+        err_printf("%u: Invalid HID %sscancode \"%.*s\":\n%s\n", line,
+                   (map_type == MAP_TYPE_KEY) ? "" : "button ",
+                   pos, kptr, linebuf);
+        return (-1);
+    }
+    map_ptr = (map_type == MAP_TYPE_KEY) ? keymap[*hid_code] :
+                                           buttonmap[*hid_code];
+
+    ptr = strcasestr(kptr + pos, " TO ");
+    if (ptr == NULL) {
+        err_printf("%u: missing \"TO\" in MAP %s command:\n:%s\n", line,
+                   (map_type == MAP_TYPE_KEY) ? "KEY" : "BUTTON", linebuf);
+        return (-1);
+    }
+    kptr = ptr + 4;
+    while (sc_count < KEYMAP_ESIZE + 1) {
+        /* Skip whitespace and comma separators */
+        while ((*kptr == ' ') || (*kptr == '\t') || (*kptr == ','))
+            kptr++;
+
+        if ((sscanf(kptr, "%x%n", &amiga_code, &pos) != 1) ||
+            ((kptr[pos] != ' ') && (kptr[pos] != '\t') &&
+             (kptr[pos] != ',') && (kptr[pos] != '\0')) ||
+            (amiga_code > 0xff)) {
+            ptr = kptr;
+            while (*ptr == ' ')
+                ptr++;
+            if (*ptr == '\0')
+                break;  // End of line
+
+            err_printf("%u: Invalid Amiga scancode \"%.*s\":\n%s\n",
+                       line, pos, kptr, linebuf);
+            return (-1);
+        }
+        if (sc_count == KEYMAP_ESIZE) {
+            err_printf("%u: too many Amiga scancodes at %x:\n%s\n",
+                       line, amiga_code, linebuf);
+            return (-1);
+        }
+        map_ptr[sc_count++] = amiga_code;
+        kptr += pos;
+    }
+
+    /* Handle special cases */
+    if (sc_count == 0) {
+        /* No mapping provided: terminate this mapping */
+        map_ptr[sc_count++] = 0xff;
+    } else if ((sc_count < KEYMAP_ESIZE) && (map_ptr[sc_count - 1] == 0x00)) {
+        /*
+         * Last mapping provided was Amiga backtick scancode:
+         * terminate mapping by adding 0xff.
+         */
+        map_ptr[sc_count++] = 0xff;
+    }
+    while (sc_count < KEYMAP_ESIZE)
+        map_ptr[sc_count++] = 0x00;
+
+    return (map_type);
+}
+
+/*
+ * keymap_entry_len
+ * ----------------
+ * Returns the number of Amiga scancodes which are active in the specified
+ * mapping entry. Scancode 0xff terminates the list. Scancode 0x00 (Amiga
+ * backtick) is only a key if it is followed by a non-zero value.
+ */
+uint
+keymap_entry_len(const uint8_t *amiga_scancodes)
+{
+    uint map;
+    uint pos;
+
+    for (map = 0; map < KEYMAP_ESIZE; map++) {
+        if (amiga_scancodes[map] == 0xff)
+            break;  // End of list
+        if (amiga_scancodes[map] == 0x00) {
+            for (pos = map + 1; pos < KEYMAP_ESIZE; pos++)
+                if (amiga_scancodes[pos] != 0x00)
+                    break;
+            if (pos == KEYMAP_ESIZE)
+                break;  // End of list
+        }
+    }
+    return (map);
+}
+
+/*
+ * keymap_write_entry
+ * ------------------
+ * Writes a single text keymap line (without trailing comment or newline)
+ * for the specified mapping, if that mapping is active.
+ */
+void
+keymap_write_entry(FILE *fp, uint map_type, uint8_t scancode,
+                   const uint8_t *amiga_scancodes)
+{
+    uint map;
+    uint count = keymap_entry_len(amiga_scancodes);
+
+    if (count == 0)
+        return;
+
+    fprintf(fp, "MAP %s %02x TO",
+            (map_type == MAP_TYPE_KEY) ? "KEY" : "BUTTON", scancode);
+    for (map = 0; map < count; map++)
+        fprintf(fp, " %02x", amiga_scancodes[map]);
+}
+
+static void
+put_be16(uint8_t *buf, uint16_t value)
+{
+    buf[0] = value >> 8;
+    buf[1] = value;
+}
+
+static void
+put_be32(uint8_t *buf, uint32_t value)
+{
+    put_be16(buf, value >> 16);
+    put_be16(buf + 2, value);
+}
+
+static uint16_t
+get_be16(const uint8_t *buf)
+{
+    return ((buf[0] << 8) | buf[1]);
+}
+
+static uint32_t
+get_be32(const uint8_t *buf)
+{
+    return (((uint32_t) get_be16(buf) << 16) | get_be16(buf + 2));
+}
+
+/*
+ * keymap_image_encode
+ * -------------------
+ * Generates a binary keymap image from the specified keymap and
+ * buttonmap. The buffer must be at least KEYMAP_IMAGE_SIZE bytes.
+ * Returns the size of the generated image.
+ */
+uint
+keymap_image_encode(uint8_t *buf,
+                    uint8_t keymap[][KEYMAP_ESIZE],
+                    uint8_t buttonmap[][KEYMAP_ESIZE])
+{
+    uint8_t *data    = buf + sizeof (bec_keymap_image_t);
+    uint     datalen = (KEYMAP_NUM_KEYS + KEYMAP_NUM_BUTTONS) * KEYMAP_ESIZE;
+
+    memcpy(data, keymap, KEYMAP_NUM_KEYS * KEYMAP_ESIZE);
+    memcpy(data + KEYMAP_NUM_KEYS * KEYMAP_ESIZE, buttonmap,
+           KEYMAP_NUM_BUTTONS * KEYMAP_ESIZE);
+
+    put_be32(buf + offsetof(bec_keymap_image_t, bki_magic), BKI_MAGIC);
+    buf[offsetof(bec_keymap_image_t, bki_version)] = BKI_VERSION;
+    buf[offsetof(bec_keymap_image_t, bki_esize)]   = KEYMAP_ESIZE;
+    put_be16(buf + offsetof(bec_keymap_image_t, bki_keys), KEYMAP_NUM_KEYS);
+    put_be16(buf + offsetof(bec_keymap_image_t, bki_buttons),
+             KEYMAP_NUM_BUTTONS);
+    put_be16(buf + offsetof(bec_keymap_image_t, bki_unused), 0);
+    put_be32(buf + offsetof(bec_keymap_image_t, bki_crc),
+             crc32(0, data, datalen));
+
+    return (sizeof (bec_keymap_image_t) + datalen);
+}
+
+/*
+ * keymap_is_image
+ * ---------------
+ * Returns non-zero if the buffer begins with a binary keymap image header.
+ */
+uint
+keymap_is_image(const uint8_t *buf, uint len)
+{
+    return ((len >= sizeof (bec_keymap_image_t)) &&
+            (get_be32(buf + offsetof(bec_keymap_image_t, bki_magic)) ==
+             BKI_MAGIC));
+}
+
+/*
+ * keymap_image_decode
+ * -------------------
+ * Validates a binary keymap image and extracts its contents to the
+ * specified keymap and buttonmap. Entries not present in the image are
+ * cleared. Neither map is modified if the image is invalid.
+ *
+ * Returns BEC_STATUS_OK on success, or another BEC_STATUS_* on failure.
+ */
+uint
+keymap_image_decode(const uint8_t *buf, uint len,
+                    uint8_t keymap[][KEYMAP_ESIZE],
+                    uint8_t buttonmap[][KEYMAP_ESIZE])
+{
+    const uint8_t *data = buf + sizeof (bec_keymap_image_t);
+    uint esize;
+    uint keys;
+    uint buttons;
+    uint datalen;
+    uint cur;
+
+    if (keymap_is_image(buf, len) == 0)
+        return (BEC_STATUS_BADMAGIC);
+
+    esize   = buf[offsetof(bec_keymap_image_t, bki_esize)];
+    keys    = get_be16(buf + offsetof(bec_keymap_image_t, bki_keys));
+    buttons = get_be16(buf + offsetof(bec_keymap_image_t, bki_buttons));
+    if ((buf[offsetof(bec_keymap_image_t, bki_version)] != BKI_VERSION) ||
+        (esize == 0) || (keys > KEYMAP_NUM_KEYS) ||
+        (buttons > KEYMAP_NUM_BUTTONS))
+        return (BEC_STATUS_BADARG);
+
+    datalen = (keys + buttons) * esize;
+    if (sizeof (bec_keymap_image_t) + datalen > len)
+        return (BEC_STATUS_BADLEN);
+    if (crc32(0, data, datalen) !=
+        get_be32(buf + offsetof(bec_keymap_image_t, bki_crc)))
+        return (BEC_STATUS_CRC);
+
+    memset(keymap, 0, KEYMAP_NUM_KEYS * KEYMAP_ESIZE);
+    memset(buttonmap, 0, KEYMAP_NUM_BUTTONS * KEYMAP_ESIZE);
+    for (cur = 0; cur < keys; cur++, data += esize)
+        memcpy(keymap[cur], data, (esize < KEYMAP_ESIZE) ? esize :
+                                                          KEYMAP_ESIZE);
+    for (cur = 0; cur < buttons; cur++, data += esize)
+        memcpy(buttonmap[cur], data, (esize < KEYMAP_ESIZE) ? esize :
+                                                             KEYMAP_ESIZE);
+    return (BEC_STATUS_OK);
+}
@@ -0,0 +1,46 @@
+/*
+ * This is free and unencumbered software released into the public domain.
+ * See the LICENSE file for additional details.
+ *
+ * Designed by Chris Hooper in 2025.
+ *
+ * ---------------------------------------------------------------------
+ *
+ * BEC keymap file text and binary image formats.
+ */
+
+#ifndef _KEYMAPFILE_H
+#define _KEYMAPFILE_H
+
+#define KEYMAP_NUM_KEYS    256  // HID key scancodes
+#define KEYMAP_NUM_BUTTONS 64   // HID mouse and joystick button scancodes
+#define KEYMAP_ESIZE       4    // Amiga scancodes per mapping
+
+/* Size of complete binary keymap image, including header */
+#define KEYMAP_IMAGE_SIZE  (sizeof (bec_keymap_image_t) + \
+                            (KEYMAP_NUM_KEYS + KEYMAP_NUM_BUTTONS) * \
+                            KEYMAP_ESIZE)
+#define KEYMAP_IMAGE_SUFFIX ".bkm"
+
+#define MAP_TYPE_UNKNOWN 0
+#define MAP_TYPE_KEY     1
+#define MAP_TYPE_BUTTON  2
+
+typedef void (*keymap_err_t)(const char *fmt, ...);
+
+int  keymap_parse_line(char *linebuf, uint line,
+                       uint8_t keymap[][KEYMAP_ESIZE],
+                       uint8_t buttonmap[][KEYMAP_ESIZE],
+                       uint *hid_code, keymap_err_t err_printf);
+uint keymap_entry_len(const uint8_t *amiga_scancodes);
+void keymap_write_entry(FILE *fp, uint map_type, uint8_t scancode,
+                        const uint8_t *amiga_scancodes);
+uint keymap_image_encode(uint8_t *buf,
+                         uint8_t keymap[][KEYMAP_ESIZE],
+                         uint8_t buttonmap[][KEYMAP_ESIZE]);
+uint keymap_image_decode(const uint8_t *buf, uint len,
+                         uint8_t keymap[][KEYMAP_ESIZE],
+                         uint8_t buttonmap[][KEYMAP_ESIZE]);
+uint keymap_is_image(const uint8_t *buf, uint len);
+
+#endif /* _KEYMAPFILE_H */
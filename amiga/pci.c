@@ -23,6 +23,7 @@ const char *version = "\0$VER: PCI "VERSION" ("BUILD_DATE") � Chris Hooper";
 #include <string.h>
 #include <clib/expansion_protos.h>
 #include "pci_access.h"
+#include "pci_ids.h"
 #include "cpu_control.h"
 #include "strtox.h"
 
@@ -170,83 +171,6 @@ zorro_show_mfgprod(void)
     }
 }
 
-static const struct {
-    uint16_t          pv_vendor;
-    const char *const pv_name;
-} pci_vendors[] = {
-    { 0x1025, "Acer"          },
-    { 0x9004, "Adaptec"       },
-    { 0x9005, "Adaptec"       },
-    { 0x1317, "ADMtek"        },
-    { 0x12ae, "Alteon"        },
-    { 0x1172, "Altera"        },
-    { 0x1022, "AMD"           },
-    { 0x1b21, "ASMedia"       },
-    { 0x1a03, "ASPEED"        },
-    { 0x1002, "ATI"           },
-    { 0x168c, "Atheros"       },
-    { 0x1969, "Attansic"      },
-    { 0x14e4, "Broadcom"      },
-    { 0x1166, "Broadcom"      },
-    { 0x1013, "Cirrus"        },
-    { 0x1011, "DEC"           },
-    { 0x1028, "Dell"          },
-    { 0x1092, "Diamond"       },
-    { 0x10b7, "3Com"          },
-    { 0x0e11, "Compaq"        },
-    { 0x102c, "Chips&Tech"    },
-    { 0x121a, "3Dfx"          },
-    { 0x3d3d, "3DLabs"        },
-    { 0x10df, "Emulex"        },
-    { 0x1274, "Ensoniq"       },
-    { 0x13a8, "Exar"          },
-    { 0x103c, "HP"            },
-    { 0x1014, "IBM"           },
-    { 0x111d, "IDT"           },
-    { 0x1283, "IntegratedTech" },
-    { 0x8086, "Intel"         },
-    { 0x197b, "JMicron"       },
-    { 0x1000, "LSI"           },
-    { 0x102a, "LSI"           },
-    { 0x11ab, "Marvell"       },
-    { 0x1b4b, "Marvell"       },
-    { 0x102b, "Matrox"        },
-    { 0x1033, "NEC"           },
-    { 0x10de, "NVIDIA"        },
-    { 0x1415, "Oxford"        },
-    { 0x12d8, "Pericom"       },
-    { 0x10b5, "PLX"           },
-    { 0x11f8, "PMC-Sierra"    },
-    { 0x104a, "Promise"       },
-    { 0x1045, "OPTi"          },
-    { 0x1077, "QLogic"        },
-    { 0x10ec, "Realtek"       },
-    { 0x1912, "Renesas"       },
-    { 0x17d5, "S2IO"          },
-    { 0x5333, "S3"            },
-    { 0x144d, "Samsung"       },
-    { 0x1095, "SiliconImage"  },
-    { 0x1039, "SiS"           },
-    { 0x104c, "TI"            },
-    { 0x1023, "Trident"       },
-    { 0x1106, "VIA"           },
-    { 0x10ee, "Xilinx"        },
-};
-
-static const struct {
-    uint16_t          pv_vendor;
-    uint16_t          pv_device;
-    const char *const pv_name;
-} pci_devices[] = {
-    { 0x121a, 0x0003, "Banshee 16MB" },
-    { 0x121a, 0x0005, "Voodoo3" },
-    { 0x121a, 0x0036, "Voodoo3 2000" },
-    { 0x121a, 0x0057, "Voodoo3 3000" },
-    { 0x121a, 0x0009, "Voodoo4/5" },
-    { 0x5333, 0x5631, "Virge DX 86C375" },
-    { 0x5333, 0x8a01, "Virge 86C325" },
-};
-
 static const struct {
     uint32_t          pc_class_value;
     const char *const pc_name;
@@ -406,36 +330,28 @@ static const struct {
 const char *
 pci_vendor(uint16_t vendor)
 {
-    uint pos;
-    for (pos = 0; pos < ARRAY_SIZE(pci_vendors); pos++) {
-        if (pci_vendors[pos].pv_vendor == vendor) {
-            return (pci_vendors[pos].pv_name);
-        }
-    }
-    return ("Unknown");
+    const char *name = pci_vendor_name(vendor);
+
+    if (name == NULL)
+        return ("Unknown");
+    return (name);
 }
 
 static void
 pci_show_vendordevice(uint16_t vendor, uint16_t device)
 {
-    uint pos;
-    for (pos = 0; pos < ARRAY_SIZE(pci_vendors); pos++)
-        if (pci_vendors[pos].pv_vendor == vendor)
-            break;
+    const char *name = pci_vendor_name(vendor);
 
-    if (pos >= ARRAY_SIZE(pci_vendors))
+    if (name == NULL)
         return;
 
-    printf(" %s", pci_vendors[pos].pv_name);
+    printf(" %s", name);
 
-    for (pos = 0; pos < ARRAY_SIZE(pci_devices); pos++)
-        if ((pci_devices[pos].pv_vendor == vendor) &&
-            (pci_devices[pos].pv_device == device)) {
-            printf(" %s", pci_devices[pos].pv_name);
-            return;
-        }
-
-    printf(" %04x", device);
+    name = pci_device_name(vendor, device);
+    if (name != NULL)
+        printf(" %s", name);
+    else
+        printf(" %04x", device);
 }
 
 static void
@@ -1471,46 +1387,374 @@ show_bits(const char *name, uint64_t value, uint mode, bits_t bits[])
     print_bits(value, mode, bits);
 }
 
+/*
+ * Snapshot of the configuration space of the function being displayed.
+ * When a function is decoded in full (verbose, dump, or capability
+ * display), the header and capability views are decoded from a snapshot
+ * of its configuration space instead of individually reading each
+ * register across the bridge. Dwords are fetched in blocks when first
+ * needed, so that each is read at most once, and the raw dump fetches
+ * its whole range as one block. Registers which are volatile (status)
+ * or which are written (BAR sizing, VPD) are still accessed directly.
+ */
+#define PCI_SNAP_BDF(bus, dev, func) (((bus) << 16) | ((dev) << 8) | (func))
+#define PCI_SNAP_SIZE 256
+
+static uint32_t pci_snap[PCI_SNAP_SIZE / 4];
+static uint32_t pci_snap_have[PCI_SNAP_SIZE / 4 / 32];  // Dwords fetched
+static uint     pci_snap_bdf = PCI_ANY_ID;
+
+static void
+pci_snap_start(uint bus, uint dev, uint func)
+{
+    pci_snap_bdf = PCI_SNAP_BDF(bus, dev, func);
+    memset(pci_snap_have, 0, sizeof (pci_snap_have));
+}
+
+static uint
+pci_snap_dword_valid(uint dword)
+{
+    return (pci_snap_have[dword / 32] & BIT(dword % 32));
+}
+
+/*
+ * pci_snap_valid
+ * --------------
+ * Returns non-zero if the range of configuration space is available from
+ * the snapshot, first fetching dwords of the range which are not yet
+ * present. A failed fetch ends the snapshot, so that the function is
+ * then read register by register.
+ */
+static uint
+pci_snap_valid(uint bus, uint dev, uint func, uint off, uint len)
+{
+    uint dword;
+    uint last;
+
+    if ((pci_snap_bdf != PCI_SNAP_BDF(bus, dev, func)) ||
+        (off + len > PCI_SNAP_SIZE) || (len == 0)) {
+        return (0);
+    }
+    last = (off + len - 1) / 4;
+    for (dword = off / 4; dword <= last; dword++) {
+        uint count;
+
+        if (pci_snap_dword_valid(dword))
+            continue;
+        for (count = 1; dword + count <= last; count++)
+            if (pci_snap_dword_valid(dword + count))
+                break;
+        if (pci_read_block(bus, dev, func, dword * 4, count,
+                           &pci_snap[dword]) != RC_SUCCESS) {
+            pci_snap_bdf = PCI_ANY_ID;
+            return (0);
+        }
+        for (; count > 0; count--, dword++)
+            pci_snap_have[dword / 32] |= BIT(dword % 32);
+        dword--;
+    }
+    return (1);
+}
+
+static uint32_t
+cfg_read32(uint bus, uint dev, uint func, uint off)
+{
+    if (pci_snap_valid(bus, dev, func, off, 4))
+        return (pci_snap[off / 4]);
+    return (pci_read32(bus, dev, func, off));
+}
+
+static uint16_t
+cfg_read16(uint bus, uint dev, uint func, uint off)
+{
+    if (pci_snap_valid(bus, dev, func, off, 2))
+        return (pci_snap[off / 4] >> ((off & 2) * 8));
+    return (pci_read16(bus, dev, func, off));
+}
+
+static uint8_t
+cfg_read8(uint bus, uint dev, uint func, uint off)
+{
+    if (pci_snap_valid(bus, dev, func, off, 1))
+        return (pci_snap[off / 4] >> ((off & 3) * 8));
+    return (pci_read8(bus, dev, func, off));
+}
+
+static rc_t
+cfg_read_dwords(uint bus, uint dev, uint func, uint off, uint count,
+                uint32_t *buf)
+{
+    if (pci_snap_valid(bus, dev, func, off, count * 4)) {
+        memcpy(buf, &pci_snap[off / 4], count * 4);
+        return (RC_SUCCESS);
+    }
+    return (pci_read_buf(bus, dev, func, off, count * 4, buf));
+}
+
+/*
+ * Vital Product Data is read through a window in the VPD capability. Each
+ * 32-bit read is started by writing the VPD address, and the device sets
+ * PCI_VPD_ADDR_F when the data is available, which may take from a few
+ * microseconds to milliseconds. Rather than hammering the flag across the
+ * bridge, the reader first waits about as long as the previous read took,
+ * then backs off using the CIA timer, and finally yields to other tasks.
+ */
+#define VPD_SPIN_MIN      CIA_USEC(10)            // First backoff step
+#define VPD_SPIN_MAX      CIA_USEC(1000)          // Longest backoff step
+#define VPD_YIELD_TICKS   (CIA_USEC(1000) * 5)    // Then Delay() between polls
+#define VPD_DELAY_TICKS   (CIA_USEC(1000) * 20)   // Length of Delay(1)
+#define VPD_TIMEOUT_TICKS (CIA_USEC(1000) * 250)  // Give up after 250 ms
+
+/* VPD resource tags (small tags have the length in the low 3 bits) */
+#define VPD_TAG_LARGE     0x80      // Large resource (16-bit length)
+#define VPD_TAG_ID        0x82      // Identifier string
+#define VPD_TAG_RO        0x90      // Read-only keyword list (VPD-R)
+#define VPD_TAG_RW        0x91      // Read-write keyword list (VPD-W)
+#define VPD_TAG_END       0x78      // End tag
+#define VPD_MAX_TAGS      16        // Defend against garbage VPD
+
+static uint vpd_latency;  // CIA ticks the last VPD read was expected to take
+
 static rc_t
 pci_vpd_fetch(uint bus, uint dev, uint func, uint offset, uint pos,
               uint32_t *buf)
 {
-    uint     vpd_control = offset + PCI_VPD_ADDR;
-    uint     vpd_data    = offset + PCI_VPD_DATA;
-    uint     timeout     = 1000000;
+    uint vpd_control = offset + PCI_VPD_ADDR;
+    uint vpd_data    = offset + PCI_VPD_DATA;
+    uint spin        = vpd_latency;
+    uint waited      = 0;
+    uint polls       = 0;
+    uint slow        = (vpd_latency >= VPD_YIELD_TICKS);
 
     if (pos > PCI_VPD_ADDR_MASK)
         return (RC_FAILURE);
+    if (spin > VPD_SPIN_MAX)
+        spin = VPD_SPIN_MAX;
 
-    /* Request VPD byte */
+    /* Request VPD dword */
     pci_write16(bus, dev, func, vpd_control, pos);
 
-    /* Wait until data has been retrieved */
-    while ((pci_read16(bus, dev, func, vpd_control) & PCI_VPD_ADDR_F) == 0) {
-        if (timeout-- == 0) {
+    /*
+     * Wait until data has been retrieved. A device which took longer
+     * than the spin limit last time is checked after one spin, and then
+     * waited for with Delay() rather than by spinning the CPU.
+     */
+    while (1) {
+        if ((slow && (polls != 0)) || (waited >= VPD_YIELD_TICKS)) {
+            Delay(1);
+            spin = VPD_DELAY_TICKS;
+        } else if (spin != 0) {
+            cia_spin(spin);
+        }
+        waited += spin;
+        polls++;
+        if (pci_read16(bus, dev, func, vpd_control) & PCI_VPD_ADDR_F)
+            break;
+        if (waited >= VPD_TIMEOUT_TICKS) {
             printf("Timeout reading VPD from %x.%x.%x.%x\n",
                    bus, dev, func, vpd_control);
             return (RC_TIMEOUT);
         }
+        spin = (waited == 0) ? VPD_SPIN_MIN : waited;  // Double total wait
+        if (spin > VPD_SPIN_MAX)
+            spin = VPD_SPIN_MAX;
     }
 
+    /*
+     * Adapt the initial wait: if the data was already there, probe a
+     * little shorter next time, or start over from the shortest spin if
+     * a Delay() was expected; otherwise it arrived during the last
+     * backoff step, so assume the middle of that step. The estimate is
+     * bounded by the length of Delay(1).
+     */
+    if (polls == 1)
+        vpd_latency = slow ? VPD_SPIN_MIN : waited - waited / 8;
+    else
+        vpd_latency = waited - spin / 2;
+    if (vpd_latency > VPD_DELAY_TICKS)
+        vpd_latency = VPD_DELAY_TICKS;
+
     /* Read retrieved data value */
     *buf = pci_read32(bus, dev, func, vpd_data);
 
     return (RC_SUCCESS);
 }
 
+/*
+ * Parsed VPD of a device. The identifier string and VPD-R keyword list
+ * are kept for each device which has been read, so that VPD is only
+ * fetched from the device once.
+ */
+typedef struct pci_vpd {
+    struct pci_vpd *pv_next;
+    uint            pv_bdf;
+    rc_t            pv_rc;     // Result of fetch (partial VPD on failure)
+    char           *pv_id;     // Identifier string
+    uint8_t        *pv_ro;     // VPD-R keyword list
+    uint            pv_rolen;  // Length of VPD-R keyword list
+    uint8_t         pv_rosum;  // Sum of all VPD bytes preceding VPD-R list
+} pci_vpd_t;
+
+static pci_vpd_t *pci_vpd_list;
+
+typedef struct {
+    uint     vr_bus;
+    uint     vr_dev;
+    uint     vr_func;
+    uint     vr_cap;
+    uint     vr_pos;        // Next VPD byte address
+    uint     vr_dword_pos;  // VPD address of vr_dword
+    uint32_t vr_dword;      // Last dword fetched
+    uint8_t  vr_sum;        // Sum of bytes read (for checksum)
+} vpd_reader_t;
+
+/*
+ * pci_vpd_read_bytes
+ * ------------------
+ * Reads bytes from VPD, fetching each dword from the device only once.
+ * VPD is little endian.
+ */
+static rc_t
+pci_vpd_read_bytes(vpd_reader_t *vr, void *bufp, uint len)
+{
+    uint8_t *buf = bufp;
+    rc_t     rc;
+
+    while (len-- > 0) {
+        uint addr = vr->vr_pos & ~3;
+        if (addr > PCI_VPD_ADDR_MASK)
+            return (RC_FAILURE);
+        if (addr != vr->vr_dword_pos) {
+            rc = pci_vpd_fetch(vr->vr_bus, vr->vr_dev, vr->vr_func,
+                               vr->vr_cap, addr, &vr->vr_dword);
+            if (rc != RC_SUCCESS)
+                return (rc);
+            vr->vr_dword_pos = addr;
+        }
+        *buf = vr->vr_dword >> ((vr->vr_pos & 3) * 8);
+        vr->vr_sum += *(buf++);
+        vr->vr_pos++;
+    }
+    return (RC_SUCCESS);
+}
+
+/*
+ * pci_vpd_read
+ * ------------
+ * Walks the VPD resource tags of a device, fetching only the identifier
+ * string and VPD-R keyword list. Other resources (such as the VPD-W area,
+ * which is often large and empty) are skipped without being read.
+ */
+static pci_vpd_t *
+pci_vpd_read(uint bus, uint dev, uint func, uint cap_pos)
+{
+    vpd_reader_t vr;
+    pci_vpd_t   *pv;
+    uint8_t      hdr[2];
+    uint8_t      tag;
+    uint         len;
+    uint         count;
+    rc_t         rc = RC_SUCCESS;
+
+    for (pv = pci_vpd_list; pv != NULL; pv = pv->pv_next)
+        if (pv->pv_bdf == PCI_SNAP_BDF(bus, dev, func))
+            return (pv);
+
+    pv = calloc(1, sizeof (*pv));
+    if (pv == NULL)
+        return (NULL);
+    pv->pv_bdf   = PCI_SNAP_BDF(bus, dev, func);
+    pv->pv_next  = pci_vpd_list;
+    pci_vpd_list = pv;
+
+    memset(&vr, 0, sizeof (vr));
+    vr.vr_bus       = bus;
+    vr.vr_dev       = dev;
+    vr.vr_func      = func;
+    vr.vr_cap       = cap_pos;
+    vr.vr_dword_pos = PCI_ANY_ID;
+
+    for (count = 0; count < VPD_MAX_TAGS; count++) {
+        rc = pci_vpd_read_bytes(&vr, &tag, 1);
+        if (rc != RC_SUCCESS)
+            break;
+        if (tag & VPD_TAG_LARGE) {
+            rc = pci_vpd_read_bytes(&vr, hdr, sizeof (hdr));
+            if (rc != RC_SUCCESS)
+                break;
+            len = hdr[0] | (hdr[1] << 8);
+        } else {
+            len = tag & 0x7;
+            tag &= ~0x7;
+        }
+        if (tag == VPD_TAG_END)
+            break;
+
+        if ((tag == VPD_TAG_ID) && (pv->pv_id == NULL)) {
+            pv->pv_id = malloc(len + 1);
+            if (pv->pv_id == NULL)
+                break;
+            rc = pci_vpd_read_bytes(&vr, pv->pv_id, len);
+            pv->pv_id[len] = '\0';
+        } else if ((tag == VPD_TAG_RO) && (pv->pv_ro == NULL)) {
+            pv->pv_rosum = vr.vr_sum;
+            pv->pv_ro = malloc(len);
+            if (pv->pv_ro == NULL)
+                break;
+            rc = pci_vpd_read_bytes(&vr, pv->pv_ro, len);
+            pv->pv_rolen = len;
+        } else {
+            vr.vr_pos += len;  // Skip resource without reading it
+        }
+        if (rc != RC_SUCCESS)
+            break;
+    }
+    pv->pv_rc = rc;
+    return (pv);
+}
+
+/*
+ * pci_vpd_show
+ * ------------
+ * Displays the VPD identifier string and read-only keywords, verifying
+ * the VPD checksum if the RV keyword is present.
+ */
 static void
-pci_vpd_dump(uint bus, uint dev, uint func, uint offset)
+pci_vpd_show(uint bus, uint dev, uint func, uint cap_pos)
 {
-    uint32_t value;
-    uint     pos;
+    pci_vpd_t *pv = pci_vpd_read(bus, dev, func, cap_pos);
+    uint       pos;
+    uint       cur;
+    uint       len;
+    uint8_t    sum;
 
-    for (pos = 0; pos < 8; pos++) {
-        if (pci_vpd_fetch(bus, dev, func, offset, pos, &value) != RC_SUCCESS)
-            return;
-        printf("    VPD %02x = %08x\n", pos, value);
+    if (pv == NULL)
+        return;
+    if (pv->pv_id != NULL)
+        printf("    VPD ID  %s\n", pv->pv_id);
+
+    for (pos = 0; pos + 3 <= pv->pv_rolen; pos += 3 + len) {
+        const uint8_t *kw = pv->pv_ro + pos;
+        len = kw[2];
+        if (pos + 3 + len > pv->pv_rolen)
+            break;  // Truncated keyword
+        if ((kw[0] == 'R') && (kw[1] == 'V') && (len > 0)) {
+            /* Checksum byte makes all bytes through it sum to zero */
+            sum = pv->pv_rosum;
+            for (cur = 0; cur <= pos + 3; cur++)
+                sum += pv->pv_ro[cur];
+            printf("    VPD RV  checksum %s\n", (sum == 0) ? "ok" : "BAD");
+            continue;
+        }
+        printf("    VPD %c%c  ", kw[0], kw[1]);
+        for (cur = 0; cur < len; cur++) {
+            char ch = kw[3 + cur];
+            printf("%c", ((ch >= ' ') && (ch <= '~')) ? ch : '.');
+        }
+        printf("\n");
     }
+    if (pv->pv_rc != RC_SUCCESS)
+        printf("    VPD incomplete\n");
 }
 
 static uint32_t
@@ -1540,10 +1784,16 @@ pci_show_cap(uint bus, uint dev, uint func, uint32_t cap_pos, uint32_t value)
     }
 
     dword[0] = value;
+    if (cap == PCI_CAP_ID_MSI) {
+        /* Length depends on 64-bit address and per-vector masking */
+        uint control = value >> 16;
+        num_dwords = 3 + ((control & PCI_MSI_FLAGS_64BIT) ? 1 : 0) +
+                     ((control & PCI_MSI_FLAGS_MASKBIT) ? 2 : 0);
+    }
     if (num_dwords > MAX_DWORDS)
         num_dwords = MAX_DWORDS;
-    if (pci_read_buf(bus, dev, func, cap_pos + 4, (num_dwords - 1) * 4,
-                     dword + 1) != RC_SUCCESS) {
+    if (cfg_read_dwords(bus, dev, func, cap_pos + 4, num_dwords - 1,
+                        dword + 1) != RC_SUCCESS) {
         return;
     }
 
@@ -1566,7 +1816,7 @@ pci_show_cap(uint bus, uint dev, uint func, uint32_t cap_pos, uint32_t value)
         case PCI_CAP_ID_AGP:    // 0x02 Accelerated Graphics Port
             break;
         case PCI_CAP_ID_VPD:    // 0x03 Vital Product Data
-            pci_vpd_dump(bus, dev, func, cap_pos);
+            pci_vpd_show(bus, dev, func, cap_pos);
             break;
         case PCI_CAP_ID_SLOTID: // 0x04 Slot Identification
             break;
@@ -1577,9 +1827,10 @@ pci_show_cap(uint bus, uint dev, uint func, uint32_t cap_pos, uint32_t value)
             uint     per_vec_masking = control & PCI_MSI_FLAGS_MASKBIT;
             uint     a_addr;
             uint     a_data;
+            uint     mask = cap_64 ? 4 : 3;
             uint64_t addr;
             uint32_t data;
-            if (cap_64 || per_vec_masking) {
+            if (cap_64) {
                 addr = ((uint64_t) dword[2] << 32) | dword[1];
                 data = dword[3];
                 a_addr = 0x8;
@@ -1602,8 +1853,8 @@ pci_show_cap(uint bus, uint dev, uint func, uint32_t cap_pos, uint32_t value)
                 printf("Disabled\n");
             if (per_vec_masking) {
                 printspaces();
-                printf("0c: Mask Bits=%08x  10: Pending Bits=%08x\n",
-                       dword[3], dword[4]);
+                printf("%02x: Mask Bits=%08x  %02x: Pending Bits=%08x\n",
+                       mask * 4, dword[mask], mask * 4 + 4, dword[mask + 1]);
             }
             break;
         }
@@ -1687,7 +1938,7 @@ pci_show_cap(uint bus, uint dev, uint func, uint32_t cap_pos, uint32_t value)
                 printf("invalid] ");
             } else {
                 uint     bar_offset = PCI_OFF_BAR0 + bir * 4;
-                uint32_t addr = pci_read32(bus, dev, func, bar_offset);
+                uint32_t addr = cfg_read32(bus, dev, func, bar_offset);
 
                 addr = translate_mem_address(addr & ~0xf);
                 printf("%08x] ", addr);
@@ -1717,16 +1968,16 @@ pci_show_caps(uint bus, uint dev, uint func, uint p_cap)
 {
     uint8_t cap_pos;
     uint32_t value;
-    uint16_t status = pci_read16(bus, dev, func, PCI_OFF_STATUS);
+    uint16_t status = cfg_read16(bus, dev, func, PCI_OFF_STATUS);
 
     if ((status & PCI_STATUS_HAS_CAPS) == 0)
         return;
 
-    for (cap_pos = pci_read8(bus, dev, func, PCI_OFF_CAP_LIST);
+    for (cap_pos = cfg_read8(bus, dev, func, PCI_OFF_CAP_LIST);
          (cap_pos > PCI_OFF_CAP_LIST) && (cap_pos <= 0xfc);
          cap_pos = (value >> 8) & 0xfc) {
 
-        value = pci_read32(bus, dev, func, cap_pos);
+        value = cfg_read32(bus, dev, func, cap_pos);
         if (p_cap != PCI_ANY_ID) {
             uint8_t cap = value & 0xff;
             if (cap != p_cap)
@@ -2452,7 +2703,7 @@ pci_check_reg(uint p_bus, uint p_dev, uint p_func,
 
     if ((mask == 0) ||
         ((flags & (FLAG_PCI_STATUS_ALL | FLAG_VERBOSE)))) {
-        mask = ~0UL;
+        mask = 0xffffffff;
     }
 
     value = pci_read(p_bus, p_dev, p_func, offset, mode);
@@ -2574,6 +2825,8 @@ lspci(uint p_bus, uint p_dev, uint p_func, uint p_vendor, uint p_device,
     uint    maxbus = PCI_MAX_BUS;
     uint    found = 0;
     char   *bustype = "Zorro";
+    uint32_t buses = BIT(0);
+    uint    pruned = (p_dev == PCI_ANY_ID) && (p_func == PCI_ANY_ID);
 
     if (bridge_type == BRIDGE_TYPE_AMIGAPCI)
         bustype = "MB";
@@ -2586,7 +2839,7 @@ lspci(uint p_bus, uint p_dev, uint p_func, uint p_vendor, uint p_device,
              (p_vendor == PCI_ANY_ID) && (p_device == PCI_ANY_ID)) {
             printf("%x      %04x.%04x %-5s %12x %12x",
                    0, bridge_zorro_mfg, bridge_zorro_prod, bustype,
-                   (uint32_t) pci_zorro_cdev->cd_BoardAddr,
+                   (uintptr_t) pci_zorro_cdev->cd_BoardAddr,
                    (uint32_t) pci_zorro_cdev->cd_BoardSize);
             zorro_show_mfgprod();
             printf("\n");
@@ -2599,6 +2852,8 @@ lspci(uint p_bus, uint p_dev, uint p_func, uint p_vendor, uint p_device,
             maxdev = PCI_MAX_PHYS_SLOT;  // 5 physical slots
         if ((p_bus != PCI_ANY_ID) && (p_bus != bus))
             continue;
+        if (pruned && (p_bus == PCI_ANY_ID) && ((buses & BIT(bus)) == 0))
+            continue;  // No bridge forwards to this bus
 
         for (dev = 0; dev < maxdev; dev++) {
             uint32_t tbase;
@@ -2626,21 +2881,27 @@ lspci(uint p_bus, uint p_dev, uint p_func, uint p_vendor, uint p_device,
                 if ((p_func != PCI_ANY_ID) && (p_func != func))
                     goto skip_and_check_htype;
 
-                vd = pci_read32v(bus, dev, func, PCI_OFF_VENDOR);
+                vd = pci_probe(bus, dev, func);
                 vendor = (uint16_t) vd;
                 device = vd >> 16;
 
                 /* Check Vendor / Device for device presence */
                 if ((vd == 0xffffffff) || (vd == 0x00000000)) {
                     if (func == 0) {
-                        if ((bus > 0) && (dev == 0) && (maxbus == PCI_MAX_BUS))
+                        if ((bus > 0) && (dev == 0) && !pruned &&
+                            (maxbus == PCI_MAX_BUS)) {
                             maxbus = bus + 1;  // Just probe 1 more bus
+                        }
                         break;
                     }
                     goto skip_and_check_htype;
                 }
-                if (maxbus < bus + 2)
+                if (pruned) {
+                    /* Only probe buses which a bridge forwards to */
+                    buses |= pci_bridge_buses(bus, dev, func);
+                } else if (maxbus < bus + 2) {
                     maxbus = bus + 2;  // Found device -- also try next bus
+                }
 
                 if ((p_vendor != PCI_ANY_ID) && (p_vendor != vendor))
                     continue;
@@ -2652,7 +2913,10 @@ lspci(uint p_bus, uint p_dev, uint p_func, uint p_vendor, uint p_device,
 
                 found++;
 
-                classrev = pci_read32(bus, dev, func, PCI_OFF_REVISION);
+                if (flags & (FLAG_VERBOSE | FLAG_DUMP | FLAG_PCI_CAP))
+                    pci_snap_start(bus, dev, func);
+
+                classrev = cfg_read32(bus, dev, func, PCI_OFF_REVISION);
                 if ((classrev >> 16) == PCI_CLASS_PCI_BRIDGE)
                     maxbar = 2;
 
@@ -2685,7 +2949,7 @@ lspci(uint p_bus, uint p_dev, uint p_func, uint p_vendor, uint p_device,
                         btype = "I/O";
                         base &= ~0x3;
                         if ((flags & FLAG_NO_TRANSLATE) == 0)
-                            base += (uint32_t) bridge_io_base;
+                            base += (uintptr_t) bridge_io_base;
                         bar_active = cmd & BIT(0);  // I/O space enabled
                     } else {
                         /* Memory space */
@@ -2762,13 +3026,13 @@ lspci(uint p_bus, uint p_dev, uint p_func, uint p_vendor, uint p_device,
                     uint32_t base;
                     uint32_t limit;
                     uint32_t size;
-                    temp = pci_read32(bus, dev, func, PCI_OFF_BR_IO_BASE);
+                    temp = cfg_read32(bus, dev, func, PCI_OFF_BR_IO_BASE);
                     base = (temp & 0xf0) << 8;
                     limit = (temp & 0xf000) + 0x1000;
 
                     if (temp & 1) {
                         /* 32-bit IO window */
-                        temp = pci_read32(bus, dev, func, PCI_OFF_BR_IO_BASE_U);
+                        temp = cfg_read32(bus, dev, func, PCI_OFF_BR_IO_BASE_U);
                         base  += ((temp & 0x0000ffff) << 16);
                         limit += (temp & 0xffff0000);
                     }
@@ -2777,7 +3041,7 @@ lspci(uint p_bus, uint p_dev, uint p_func, uint p_vendor, uint p_device,
                     else
                         size = limit - base;
                     if ((flags & FLAG_NO_TRANSLATE) == 0)
-                        base += (uint32_t) bridge_io_base;
+                        base += (uintptr_t) bridge_io_base;
                     if (printed)
                         printf("%16s", "");
                     printf("   WIO ");
@@ -2793,7 +3057,7 @@ lspci(uint p_bus, uint p_dev, uint p_func, uint p_vendor, uint p_device,
                     }
                     printf("\n");
 
-                    temp = pci_read32(bus, dev, func, PCI_OFF_BR_W32_BASE);
+                    temp = cfg_read32(bus, dev, func, PCI_OFF_BR_W32_BASE);
                     base  = (temp & 0x0000fff0) << 16;
                     limit = temp & 0xfff00000;
                     if (limit < base) {
@@ -2809,7 +3073,7 @@ lspci(uint p_bus, uint p_dev, uint p_func, uint p_vendor, uint p_device,
                     else
                         printf("%12x %12x\n", base, size);
 
-                    temp = pci_read32(bus, dev, func, PCI_OFF_BR_W64_BASE);
+                    temp = cfg_read32(bus, dev, func, PCI_OFF_BR_W64_BASE);
                     base  = (temp & 0x0000fff0) << 16;
                     limit = temp & 0xfff00000;
                     if (limit < base) {
@@ -2824,9 +3088,9 @@ lspci(uint p_bus, uint p_dev, uint p_func, uint p_vendor, uint p_device,
                         uint32_t base_u;
                         uint32_t limit_u;
                         uint32_t size_u;
-                        base_u = pci_read32(bus, dev, func,
+                        base_u = cfg_read32(bus, dev, func,
                                             PCI_OFF_BR_W64_BASE_U);
-                        limit_u = pci_read32(bus, dev, func,
+                        limit_u = cfg_read32(bus, dev, func,
                                              PCI_OFF_BR_W64_LIMIT_U);
                         if (base < bridge_map_base) { // wrapped
                             base_u++;
@@ -2858,7 +3122,7 @@ lspci(uint p_bus, uint p_dev, uint p_func, uint p_vendor, uint p_device,
                         }
                     }
                     if ((classrev >> 16) == PCI_CLASS_PCI_BRIDGE) {
-                        uint32_t sub = pci_read32(bus, dev, func,
+                        uint32_t sub = cfg_read32(bus, dev, func,
                                                   PCI_OFF_BR_PRI_BUS);
                         if (flags & FLAG_VERBOSE) {
                             printf("    Bus %02x  SecBus %02x  SubBus %02x\n",
@@ -2880,7 +3144,7 @@ lspci(uint p_bus, uint p_dev, uint p_func, uint p_vendor, uint p_device,
                 if (flags & FLAG_VERBOSE) {
                     uint16_t status;
                     uint32_t subsys;
-                    subsys = pci_read32(bus, dev, func, PCI_OFF_SUBSYSTEM_VID);
+                    subsys = cfg_read32(bus, dev, func, PCI_OFF_SUBSYSTEM_VID);
                     if ((subsys != 0) && (subsys != 0xffffffff)) {
                         printf("    Subsystem %04x.%04x ",
                                (uint16_t) subsys, subsys >> 16);
@@ -2888,13 +3152,13 @@ lspci(uint p_bus, uint p_dev, uint p_func, uint p_vendor, uint p_device,
                         printf("\n");
                     }
                     printf("    CMD       ");
-                    print_bits(pci_read16(bus, dev, func, PCI_OFF_CMD),
+                    print_bits(cfg_read16(bus, dev, func, PCI_OFF_CMD),
                                2, bits_pci_command);
                     printf("    STATUS    ");
                     status = pci_read16(bus, dev, func, PCI_OFF_STATUS);
                     print_bits(status, 2, bits_pci_status_primary);
                     printf("    Interrupt ");
-                    print_bits(pci_read32(bus, dev, func, PCI_OFF_INT_LINE),
+                    print_bits(cfg_read32(bus, dev, func, PCI_OFF_INT_LINE),
                                2, bits_pci_lat_gnt_int);
 
 just_show_caps:
@@ -2906,16 +3170,19 @@ just_show_caps:
                     uint omax = 64;
                     if (flags & FLAG_DDUMP)
                         omax = 256;
+                    /* Fetch the dumped range as one block */
+                    (void) pci_snap_valid(bus, dev, func, 0, omax);
                     for (off = 0; off < omax; off++) {
                         if ((off & 0x0f) == 0)
                             printindentnum(off);
-                        printf(" %02x", pci_read8(bus, dev, func, off));
+                        printf(" %02x", cfg_read8(bus, dev, func, off));
                         if ((off & 0x0f) == 0x0f)
                             printf("\n");
                     }
                 }
 
 skip_and_check_htype:
+                pci_snap_bdf = PCI_ANY_ID;
                 if (func == 0) {
                     if (!is_multifunction_device(bus, dev, func))
                         break;  // Not a multifunction device
@@ -2940,8 +3207,8 @@ lspci_tree_r(uint p_bus, uint p_dev, uint p_func, uint p_vendor, uint p_device,
 {
     uint     dev;
     uint     func;
-    uint     secbus;
-    uint     maxbus;
+    uint     secbus = 0;
+    uint     maxbus = 0;
     uint     is_bridge;
     uint32_t classrev;
     uint16_t vendor;
@@ -2950,7 +3217,7 @@ lspci_tree_r(uint p_bus, uint p_dev, uint p_func, uint p_vendor, uint p_device,
     uint32_t addr_max = 0;
     uint32_t ioaddr_min = 0xffffffff;
     uint32_t ioaddr_max = 0;
-    uint32_t vd = pci_read32v(p_bus, p_dev, p_func, PCI_OFF_VENDOR);
+    uint32_t vd = pci_probe(p_bus, p_dev, p_func);
 
     /* Check Vendor / Device for device presence */
     if ((vd == 0xffffffff) || (vd == 0x00000000))
@@ -3104,8 +3371,8 @@ lspci_tree_r(uint p_bus, uint p_dev, uint p_func, uint p_vendor, uint p_device,
         } else if (((flags & FLAG_VERBOSE_IO) == 0) &&
                  (ioaddr_min < ioaddr_max)) {
             if ((flags & FLAG_NO_TRANSLATE) == 0) {
-                ioaddr_min += (uint32_t) bridge_io_base;
-                ioaddr_max += (uint32_t) bridge_io_base;
+                ioaddr_min += (uintptr_t) bridge_io_base;
+                ioaddr_max += (uintptr_t) bridge_io_base;
             }
             printf(" %08x-%08x", ioaddr_min, ioaddr_max);
         } else {
@@ -3292,6 +3559,7 @@ static const char cmd_options[] =
     "pci ls [opts]     display PCI devices\n"
     "    opts: -a      show config space addresses\n"
     "          -d      show raw config space bytes\n"
+    "          -i file use pci.ids file for names not known to pci\n"
     "          -n      do not translate PCI space addresses to CPU space\n"
     "          -t      display tree view of buses and devices\n"
     "          -v      verbose (decode everything)\n"
@@ -3312,6 +3580,7 @@ static const long_to_short_t long_to_short_main[] = {
     { "-K", "ecap" },
     { "-c", "clear" },
     { "-h", "help" },
+    { "-i", "ids" },
     { "-l", "ls" },
     { "-r", "reset" },
     { "-s", "status" },
@@ -3362,6 +3631,13 @@ main(int argc, char **argv)
                             flags |= FLAG_DDUMP;
                         flags |= FLAG_DUMP;
                         break;
+                    case 'i':
+                        if (++arg >= argc) {
+                            printf("%s requires a file name\n", argv[arg - 1]);
+                            goto usage;
+                        }
+                        pci_ids_filename = argv[arg];
+                        break;
                     case 'k':
                         flags |= FLAG_PCI_CAP;
                         break;
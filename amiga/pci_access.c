@@ -1,4 +1,8 @@
+#ifdef APCIROM
+#include "printf.h"
+#else
 #include <stdio.h>
+#endif
 #include <string.h>
 #include <stdint.h>
 #include <exec/types.h>
@@ -121,19 +125,21 @@ done:
 /*
  * pci_bridge_is_present
  * ---------------------
- * Returns non-zero if a PCI bridge is present in the system.
+ * Returns non-zero if a PCI bridge is present in the system. The result
+ * of the first search is remembered, as this is called for every access
+ * to configuration space.
  */
 int
 pci_bridge_is_present(void)
 {
     static uint8_t did_pci_init = 0;
+    static uint8_t pci_present = 0;
 
     if (did_pci_init == 0) {
-        if (pci_find_root_bridge(0) != NULL)
-            return (1);
+        pci_present = (pci_find_root_bridge(0) != NULL);
         did_pci_init = 1;
     }
-    return (0);
+    return (pci_present);
 }
 
 /*
@@ -208,6 +214,29 @@ pci_read32(uint bus, uint dev, uint func, uint off)
     return (swap32(*ADDR32(addr)));
 }
 
+/*
+ * pci_read_block
+ * --------------
+ * Read consecutive 32-bit values from PCI configuration space. The
+ * configuration space address is only computed once for the whole block.
+ */
+rc_t
+pci_read_block(uint bus, uint dev, uint func, uint off, uint count,
+               uint32_t *buf)
+{
+    uint8_t *addr = pci_cfg_base(bus, dev, func, off);
+
+    if (addr == NULL) {
+        memset(buf, 0xff, count * 4);
+        return (RC_NO_DATA);
+    }
+    while (count-- > 0) {
+        *(buf++) = swap32(*ADDR32(addr));
+        addr += 4;
+    }
+    return (RC_SUCCESS);
+}
+
 /*
  * pci_write8
  * ----------
@@ -522,6 +551,10 @@ pci_bridge_control(int pci_bridge, int bus, int dev, int func, uint flags)
             Delay(15);  // 300 ms
         }
     }
+
+    /* The above search may have left a different bridge selected */
+    if (pci_bridge_is_present())
+        (void) pci_find_root_bridge(0);
 }
 
 static uint
@@ -536,19 +569,86 @@ is_multifunction_device(uint bus, uint dev, uint func)
     return (1);
 }
 
+/*
+ * The config read which follows a master abort (probe of an empty slot)
+ * may return stale data while the bridge still has the aborted cycle
+ * pending. Only that read needs to be verified.
+ */
+static uint pci_probe_aborted = 1;
+
+/*
+ * pci_probe
+ * ---------
+ * Reads the vendor / device ID of a function during enumeration. A
+ * single read is used unless the previous probe hit an empty slot,
+ * in which case the value is verified with pci_read32v().
+ */
+uint32_t
+pci_probe(uint bus, uint dev, uint func)
+{
+    uint32_t vd;
+
+    if (pci_probe_aborted)
+        vd = pci_read32v(bus, dev, func, PCI_OFF_VENDOR);
+    else
+        vd = pci_read32(bus, dev, func, PCI_OFF_VENDOR);
+    pci_probe_aborted = (vd == 0xffffffff);
+    return (vd);
+}
+
+/*
+ * pci_bridge_buses
+ * ----------------
+ * Returns a mask of the buses behind the specified PCI-to-PCI bridge
+ * (its programmed secondary through subordinate bus numbers). Returns
+ * 0 if the function is not a bridge or its bus numbers are not yet
+ * assigned. Buses above PCI_MAX_BUS are not included.
+ */
+uint32_t
+pci_bridge_buses(uint bus, uint dev, uint func)
+{
+    uint32_t val;
+    uint     sec;
+    uint     sub;
+
+    val = pci_read32(bus, dev, func, PCI_OFF_HEADERTYPE & ~3);
+    if ((val == 0xffffffff) || (((val >> 16) & 0x7f) != 1))
+        return (0);  // Not a bridge
+
+    val = pci_read32(bus, dev, func, PCI_OFF_BR_PRI_BUS);
+    sec = (uint8_t) (val >> 8);
+    sub = (uint8_t) (val >> 16);
+    if ((sec <= bus) || (sec > PCI_MAX_BUS) || (sub < sec))
+        return (0);  // Not programmed
+    if (sub > PCI_MAX_BUS)
+        sub = PCI_MAX_BUS;
+
+    return ((uint32_t) (BIT(sub + 1) - 1) & ~(uint32_t) (BIT(sec) - 1));
+}
+
+/*
+ * pci_scan_cb
+ * -----------
+ * Calls the specified callback for each PCI function found. Only bus 0
+ * and the buses behind discovered bridges (by their programmed secondary
+ * and subordinate bus numbers) are probed. If the callback returns
+ * non-zero, the scan is stopped.
+ */
 int
 pci_scan_cb(pci_scan_cb_t callback)
 {
-    uint    bus;
-    uint    dev;
-    uint    func;
-    uint    maxbus = PCI_MAX_BUS;
+    uint     bus;
+    uint     dev;
+    uint     func;
+    uint32_t buses = BIT(0);
 
     if (pci_bridge_is_present() == 0)
         return (1);
 
-    for (bus = 0; bus <= maxbus; bus++) {
+    for (bus = 0; bus <= PCI_MAX_BUS; bus++) {
         uint maxdev = PCI_MAX_DEV;  // PCI supports 32 devs per bus
+        if ((buses & BIT(bus)) == 0)
+            continue;  // No bridge forwards to this bus
         if (bus == 0)
             maxdev = PCI_MAX_PHYS_SLOT;  // 5 physical slots
 
@@ -558,21 +658,17 @@ pci_scan_cb(pci_scan_cb_t callback)
                 uint16_t vendor;
                 uint16_t device;
 
-                vd = pci_read32v(bus, dev, func, PCI_OFF_VENDOR);
+                vd = pci_probe(bus, dev, func);
                 if ((vd == 0xffffffff) || (vd == 0x00000000)) {
-                    if (func == 0) {
-                        if ((bus > 0) && (dev == 0) && (maxbus == PCI_MAX_BUS))
-                            maxbus = bus + 1;  // Just probe 1 more bus
-                        break;
-                    }
-
-                    goto skip_and_check_htype;
+                    if (func == 0)
+                        break;  // Don't probe further if no primary function
+                    continue;
                 }
+                buses |= pci_bridge_buses(bus, dev, func);
                 vendor = (uint16_t) vd;
                 device = vd >> 16;
                 if (callback(bus, dev, func, vendor, device))
                     return (0);
-skip_and_check_htype:
                 if ((func == 0) && !is_multifunction_device(bus, dev, func))
                     break;  // Not a multifunction device
             }
@@ -155,12 +155,15 @@ void     pci_write32(uint bus, uint dev, uint func, uint off, uint32_t value);
 void     pci_write(uint bus, uint dev, uint func, uint offset, uint bytes, uint32_t value);
 uint32_t pci_read32v(uint bus, uint dev, uint func, uint off);
 void     pci_write32v(uint bus, uint dev, uint func, uint off, uint32_t wval);
+rc_t     pci_read_block(uint bus, uint dev, uint func, uint off, uint count, uint32_t *buf);
 rc_t     pci_read_buf(uint bus, uint dev, uint func, uint offset, uint bytes, void *bufp);
 rc_t     pci_write_buf(uint bus, uint dev, uint func, uint offset, uint bytes, void *bufp);
 void    *pci_cfg_base(uint bus, uint dev, uint func, uint off);
 void     pci_bridge_control(int pci_bridge, int bus, int dev, int func, uint flags);
 int      pci_bridge_is_present(void);
 int      pci_scan_cb(pci_scan_cb_t callback);
+uint32_t pci_probe(uint bus, uint dev, uint func);
+uint32_t pci_bridge_buses(uint bus, uint dev, uint func);
 
 extern struct ConfigDev *pci_zorro_cdev;
 extern uint8_t  bridge_type;
@@ -0,0 +1,845 @@
+/*
+ * This is free and unencumbered software released into the public domain.
+ * See the LICENSE file for additional details.
+ *
+ * Designed by Chris Hooper in 2025.
+ *
+ * ---------------------------------------------------------------------
+ *
+ * PCI bus enumeration and resource allocation core.
+ *
+ * Devices are recorded in a fixed table rather than allocated from the
+ * system, so this code may run at boot time from ROM. All hardware access
+ * goes through the pci_read*() / pci_write*() functions of pci_access.c.
+ */
+
+#ifdef APCIROM
+#include "printf.h"
+#else
+#include <stdio.h>
+#endif
+#include <stdint.h>
+#include <exec/types.h>
+#include "pci_access.h"
+#include "pci_alloc.h"
+
+#define BIT(x)         (1U << (x))
+
+#define ALIGN_DOWN(addr, alignment) ((addr) & ~((alignment) - 1))
+#define ALIGN_UP(addr, alignment)   ALIGN_DOWN((addr) + (alignment) - 1, \
+                                               alignment)
+#define SIZE_1MB (1 << 20)
+#define SIZE_4KB (4 << 10)
+
+pci_dev_t         pci_root_dev;
+uint              pci_alloc_dev_count;
+uint8_t           pci_alloc_cache_hit;
+static pci_dev_t  pci_dev_table[PCI_ALLOC_MAX_DEVS];
+static uint8_t    pci_max_bus;
+
+#define PCI_ALLOC_MAX_HOLES 8  // Alignment gaps remembered per window
+
+typedef struct {
+    uint32_t ph_base;
+    uint32_t ph_size;
+} pci_hole_t;
+
+typedef struct {
+    uint32_t   pw_start;       // First address of window
+    uint32_t   pw_base;        // Next free address at end of window
+    uint32_t   pw_max;         // End of window (exclusive)
+    uint32_t   pw_used;        // Bytes assigned to BARs
+    uint       pw_fail;        // BARs which did not fit
+    uint       pw_holes;       // Entries in pw_hole[]
+    uint       pw_hole_floor;  // First hole usable at this bridge level
+    pci_hole_t pw_hole[PCI_ALLOC_MAX_HOLES];
+} pci_window_t;
+
+static pci_window_t  pci_win_mem;       // Memory BARs and bridge windows
+static pci_window_t  pci_win_pre;       // Prefetchable memory BARs
+static pci_window_t  pci_win_io;        // I/O BARs and bridge windows
+static pci_window_t *pci_win_prefetch;  // Where prefetchable BARs go
+
+/*
+ * pci_dev_new
+ * -----------
+ * Takes the next free entry from the device table. The entry is cleared
+ * here with a simple loop, as a memset() call might not be reachable from
+ * the RAM copy of this code.
+ */
+static pci_dev_t * PCI_ALLOC_CODE
+pci_dev_new(void)
+{
+    pci_dev_t *cur;
+    uint8_t   *ptr;
+    uint       pos;
+
+    if (pci_alloc_dev_count >= PCI_ALLOC_MAX_DEVS)
+        return (NULL);
+    cur = &pci_dev_table[pci_alloc_dev_count++];
+    ptr = (uint8_t *) cur;
+    for (pos = 0; pos < sizeof (*cur); pos++)
+        ptr[pos] = 0;
+    return (cur);
+}
+
+/*
+ * pci_discover
+ * ------------
+ * Perform a depth-first search to locate devices, assign bus numbers,
+ * and determine total BAR sizes. Only bus 0 and the secondary buses of
+ * bridges found are probed.
+ */
+static void PCI_ALLOC_CODE
+pci_discover(uint8_t bus, pci_dev_t *parent_dev)
+{
+    uint        dev;
+    uint        func;
+    uint8_t     header;
+    uint16_t    vendor;
+    uint16_t    device;
+    uint32_t    vd;
+    pci_dev_t  *cur;
+    pci_dev_t **parent_next = &parent_dev->pd_child;
+    uint        maxdev = (bus == 0) ? PCI_MAX_PHYS_SLOT : PCI_MAX_DEV;
+
+    for (dev = 0; dev < maxdev; dev++) {
+        for (func = 0; func < PCI_MAX_FUNC; func++) {
+            vd = pci_probe(bus, dev, func);
+
+            /* Check Vendor / Device for device presence */
+            if ((vd == 0xffffffff) || (vd == 0x00000000)) {
+                if (func == 0)
+                    break; // Don't probe further if no primary function
+                continue;
+            }
+            vendor = (uint16_t) vd;
+            device = vd >> 16;
+            printf("%x.%x.%x %04x.%04x\n",
+                   bus, dev, func, vendor, device);
+
+            cur = pci_dev_new();
+            if (cur == NULL)
+                break;
+            cur->pd_vendor = vendor;
+            cur->pd_device = device;
+            cur->pd_bus = bus;
+            cur->pd_dev = dev;
+            cur->pd_func = func;
+            *parent_next = cur;
+            parent_next = &cur->pd_next;
+            header = pci_read8(bus, dev, func, PCI_OFF_HEADERTYPE);
+            cur->pd_htype = header;
+            uint is_bridge = (cur->pd_htype & 0x7F) == 1;
+            uint max_bars = is_bridge ? 3 : 7;  // Bridge has only two BARs
+
+            /*
+             * Set device's PCI latency timer to 0x80 because of
+             * Zorro III design.  XXX: Research if this is optimal.
+             */
+            pci_write8(bus, dev, func, PCI_OFF_LATENCYTIMER, 0x80);
+
+            /* Determine BAR size */
+            uint total_size = 0;
+            uint bar;
+            for (bar = 0; bar < max_bars; bar++) {
+                uint     bar_offset = PCI_OFF_BAR0 + (bar * 4);
+                uint32_t old_val;
+                uint32_t size_mask = 0;
+
+                if (bar == max_bars - 1) {
+                    /* Optional ROM BAR */
+                    bar_offset = is_bridge ? PCI_OFF_BR_ROM_BAR :
+                                             PCI_OFF_ROM_BAR;
+                }
+
+                old_val = pci_read32(bus, dev, func, bar_offset);
+                pci_write32(bus, dev, func, bar_offset, 0xffffffff);
+                size_mask = pci_read32(bus, dev, func, bar_offset);
+                pci_write32(bus, dev, func, bar_offset, old_val);
+
+                if (size_mask != 0) {
+                    uint32_t size = ~(size_mask & 0xFFFFFFF0) + 1;
+                    cur->pd_bar_size[bar] = size;
+                    if (bar == max_bars - 1)
+                        cur->pd_bar_type[bar] = BIT(7);  // Exp ROM BAR
+                    else
+                        cur->pd_bar_type[bar] = size_mask & 0xf;
+                    total_size += size;
+                    printf("  [%u] size %08x type %02x\n", bar, size,
+                           cur->pd_bar_type[bar]);
+                    if ((size_mask & (BIT(0) | BIT(1) | BIT(2))) == BIT(2)) {
+                        /* 64-bit memory BAR */
+                        // XXX: Need to handle 64-bit size here??
+                        bar++;  // Skip upper bits of this BAR
+                    }
+                }
+            }
+
+            /* Bridge Detection & Recursive Scan */
+            if ((header & 0x7F) == 1) {  // Type 1 is a Bridge
+                uint8_t sec_bus = pci_max_bus + 1;
+                uint8_t latency = 0x80;
+                uint32_t bus_value;
+                if (sec_bus == 0)
+                    break;  // No more buses available
+                pci_max_bus = sec_bus;
+
+                bus_value = bus | (sec_bus << 8) | (0xff << 16) |
+                            (latency << 24);
+                pci_write32(bus, dev, func, PCI_OFF_BR_PRI_BUS, bus_value);
+
+                printf("  Child Bus %02x\n", sec_bus);
+                pci_discover(sec_bus, cur);
+
+                bus_value = bus | (sec_bus << 8) | (pci_max_bus << 16) |
+                            (latency << 24);
+                pci_write32(bus, dev, func, PCI_OFF_BR_PRI_BUS, bus_value);
+                cur->pd_sec_bus = sec_bus;
+                cur->pd_sub_bus = pci_max_bus;
+
+                /* Round up to next 1 MB boundary */
+                cur->pd_size = ALIGN_UP(cur->pd_size, SIZE_1MB);
+            }
+            if (parent_dev != NULL) {
+                parent_dev->pd_size += total_size + cur->pd_size;
+            }
+
+            if (!(header & 0x80) && func == 0)
+                break; // Not multi-function
+        }
+    }
+}
+
+/*
+ * Address windows from which BARs are allocated. Each window is a bump
+ * allocator, with the alignment gaps it skips over recorded as holes
+ * which later (smaller) BARs may fill. Because BARs are allocated
+ * largest first, gaps only arise where a bridge window forces 1 MB or
+ * 4 KB alignment. A bridge window must be contiguous, so holes found
+ * within a bridge window are only usable by devices behind that bridge.
+ */
+static void PCI_ALLOC_CODE
+pci_window_init(pci_window_t *win, uint32_t base, uint32_t max)
+{
+    win->pw_start      = base;
+    win->pw_base       = base;
+    win->pw_max        = max;
+    win->pw_used       = 0;
+    win->pw_fail       = 0;
+    win->pw_holes      = 0;
+    win->pw_hole_floor = 0;
+}
+
+static void PCI_ALLOC_CODE
+pci_window_hole(pci_window_t *win, uint32_t base, uint32_t size)
+{
+    if ((size == 0) || (win->pw_holes >= PCI_ALLOC_MAX_HOLES))
+        return;  // Nothing to record, or space is lost
+    win->pw_hole[win->pw_holes].ph_base = base;
+    win->pw_hole[win->pw_holes].ph_size = size;
+    win->pw_holes++;
+}
+
+/*
+ * pci_window_alloc
+ * ----------------
+ * Allocates a naturally aligned range of the specified (power of two)
+ * size from the window. The smallest hole usable at the current bridge
+ * level which can hold the range is used first; otherwise the range is
+ * taken from the end of the window. Returns 0xffffffff if there is no
+ * space left in the window.
+ */
+static uint32_t PCI_ALLOC_CODE
+pci_window_alloc(pci_window_t *win, uint32_t size)
+{
+    pci_hole_t *hole;
+    uint32_t    base;
+    uint32_t    end;
+    uint32_t    hole_end;
+    int         best = -1;
+    uint        cur;
+
+    for (cur = win->pw_hole_floor; cur < win->pw_holes; cur++) {
+        hole = &win->pw_hole[cur];
+        base = ALIGN_UP(hole->ph_base, size);
+        if ((base < hole->ph_base) ||
+            (base - hole->ph_base >= hole->ph_size) ||
+            (size > hole->ph_size - (base - hole->ph_base))) {
+            continue;  // Does not fit
+        }
+        if ((best < 0) || (hole->ph_size < win->pw_hole[best].ph_size))
+            best = cur;
+    }
+    if (best >= 0) {
+        /* Split the hole: the leading gap stays, the trailing gap is new */
+        hole     = &win->pw_hole[best];
+        base     = ALIGN_UP(hole->ph_base, size);
+        end      = base + size;
+        hole_end = hole->ph_base + hole->ph_size;
+        hole->ph_size = base - hole->ph_base;
+        if (hole->ph_size == 0) {
+            hole->ph_base = end;
+            hole->ph_size = hole_end - end;
+        } else {
+            pci_window_hole(win, end, hole_end - end);
+        }
+        win->pw_used += size;
+        return (base);
+    }
+
+    base = ALIGN_UP(win->pw_base, size);
+    if ((base < win->pw_base) || (base >= win->pw_max) ||
+        (size > win->pw_max - base)) {
+        /* Can not allocate this BAR */
+        win->pw_fail++;
+        return (0xffffffff);
+    }
+    pci_window_hole(win, win->pw_base, base - win->pw_base);
+    win->pw_base = base + size;
+    win->pw_used += size;
+    return (base);
+}
+
+/*
+ * pci_window_enter
+ * ----------------
+ * Starts a bridge window at the specified alignment. The skipped space
+ * remains available to devices at the current level. Returns the start
+ * address of the bridge window.
+ */
+static uint32_t PCI_ALLOC_CODE
+pci_window_enter(pci_window_t *win, uint32_t align, uint *floor)
+{
+    uint32_t base = ALIGN_UP(win->pw_base, align);
+
+    if (base < win->pw_base)
+        base = win->pw_max;  // Wrapped: window is full
+    else
+        pci_window_hole(win, win->pw_base, base - win->pw_base);
+    win->pw_base = base;
+    *floor = win->pw_hole_floor;
+    win->pw_hole_floor = win->pw_holes;
+    return (base);
+}
+
+/*
+ * pci_window_leave
+ * ----------------
+ * Ends a bridge window at the specified alignment. Holes within the
+ * bridge window can not be used by devices outside of it, so they are
+ * discarded. Returns the end address (exclusive) of the bridge window.
+ */
+static uint32_t PCI_ALLOC_CODE
+pci_window_leave(pci_window_t *win, uint32_t align, uint floor)
+{
+    uint32_t end = ALIGN_UP(win->pw_base, align);
+
+    if (end < win->pw_base)
+        end = win->pw_max;  // Wrapped: window is full
+    win->pw_base       = end;
+    win->pw_holes      = win->pw_hole_floor;
+    win->pw_hole_floor = floor;
+    return (end);
+}
+
+/*
+ * pci_window_report
+ * -----------------
+ * Shows how much of an address window was used, how much was lost to
+ * alignment, and how many BARs could not be allocated.
+ */
+static void PCI_ALLOC_CODE
+pci_window_report(const char *name, const pci_window_t *win)
+{
+    uint32_t span = win->pw_base - win->pw_start;
+
+    if (win->pw_base > win->pw_max)
+        span = win->pw_max - win->pw_start;
+    printf("%-4s %08x-%08x used=%08x lost=%08x", name,
+           win->pw_start, win->pw_max - 1, win->pw_used,
+           span - win->pw_used);
+    if (win->pw_fail != 0)
+        printf(" FAILED %u BAR%s", win->pw_fail,
+               (win->pw_fail == 1) ? "" : "s");
+    printf("\n");
+}
+
+/*
+ * pci_allocate
+ * ------------
+ * Perform a allocation of the entire PCI tree. Devices or bridges with
+ * their respective subtrees with the largest required size are allocated
+ * first. Prefetchable memory BARs are allocated from the prefetchable
+ * window, where one is available.
+ */
+static void PCI_ALLOC_CODE
+pci_allocate(pci_dev_t *parent_dev)
+{
+    pci_dev_t *cur;
+    pci_dev_t *maxdev;
+
+    while (1) {
+        uint maxsize = 0;
+        int  maxbar = -1;
+        maxdev = NULL;
+
+        /* Select the next largest BAR or sub-bus to allocate */
+        for (cur = parent_dev->pd_child; cur != NULL; cur = cur->pd_next) {
+            uint is_bridge = (cur->pd_htype & 0x7F) == 1;
+            uint max_bars = is_bridge ? 3 : 7;  // Bridge has only two BARs
+            uint bar;
+            for (bar = 0; bar < max_bars; bar++) {
+                if (cur->pd_allocated & BIT(bar))
+                    continue;  // Already allocated
+                if (maxsize < cur->pd_bar_size[bar]) {
+                    maxsize = cur->pd_bar_size[bar];
+                    maxdev  = cur;
+                    maxbar  = bar;
+                }
+            }
+            if (is_bridge && ((cur->pd_allocated & BIT(7)) == 0) &&
+                ((maxsize < cur->pd_size) || (maxdev == NULL))) {
+                /* Subordinate bus has larger demand */
+                maxsize = cur->pd_size;
+                maxdev  = cur;
+                maxbar  = -1;  // Allocate downstream
+            }
+        }
+        if (maxdev == NULL)
+            break;  // No more devices to allocate
+
+        printf("alloc %x.%x.%x ",
+               maxdev->pd_bus, maxdev->pd_dev, maxdev->pd_func);
+#if 0
+        printf("maxsize=%08x ", maxsize);
+#endif
+        if (maxbar == -1) {
+            /* Allocate subordinate bus */
+            uint     floor_mem;
+            uint     floor_pre;
+            uint     floor_io;
+            uint     has_pre = (pci_win_prefetch != &pci_win_mem);
+            uint32_t start_mem;
+            uint32_t start_pre = 0;
+            uint32_t start_io;
+            uint32_t end_mem;
+            uint32_t end_pre = 0;
+            uint32_t end_io;
+            printf("Bridge\n");
+
+            start_mem = pci_window_enter(&pci_win_mem, SIZE_1MB, &floor_mem);
+            start_io  = pci_window_enter(&pci_win_io, SIZE_4KB, &floor_io);
+            if (has_pre)
+                start_pre = pci_window_enter(&pci_win_pre, SIZE_1MB,
+                                             &floor_pre);
+
+            pci_allocate(maxdev);
+
+            /* Align allocators to bridge alignment requirement */
+            end_mem = pci_window_leave(&pci_win_mem, SIZE_1MB, floor_mem);
+            end_io  = pci_window_leave(&pci_win_io, SIZE_4KB, floor_io);
+            if (has_pre)
+                end_pre = pci_window_leave(&pci_win_pre, SIZE_1MB, floor_pre);
+            printf("      %x.%x.%x MEMW=%x-%x  IOW=%x-%x",
+                   maxdev->pd_bus, maxdev->pd_dev, maxdev->pd_func,
+                   start_mem, end_mem, start_io, end_io);
+            if (has_pre)
+                printf("  PREW=%x-%x", start_pre, end_pre);
+            printf("\n");
+
+            if (start_mem == end_mem) {
+                /* No downstream memory space */
+                start_mem = 0xffffffff;
+                end_mem = 0;
+            } else {
+                end_mem -= SIZE_1MB;
+            }
+            if (start_pre == end_pre) {
+                /* No downstream prefetchable memory space */
+                start_pre = 0xffffffff;
+                end_pre = 0;
+            } else {
+                end_pre -= SIZE_1MB;
+            }
+            if (start_io == end_io) {
+                /* No downstream I/O space */
+                start_io = 0xffffffff;
+                end_io = 0;
+            } else {
+                end_io -= SIZE_4KB;
+            }
+            /* Handle I/O window */
+            pci_write8(maxdev->pd_bus, maxdev->pd_dev, maxdev->pd_func,
+                       PCI_OFF_BR_IO_BASE, (start_io >> 8) & 0xf0);
+            pci_write8(maxdev->pd_bus, maxdev->pd_dev, maxdev->pd_func,
+                       PCI_OFF_BR_IO_LIMIT, (end_io >> 8) & 0xf0);
+            pci_write16(maxdev->pd_bus, maxdev->pd_dev, maxdev->pd_func,
+                        PCI_OFF_BR_IO_BASE_U, start_io >> 16);
+            pci_write16(maxdev->pd_bus, maxdev->pd_dev, maxdev->pd_func,
+                        PCI_OFF_BR_IO_LIMIT_U, end_io >> 16);
+
+            /* Handle memory window */
+            pci_write16(maxdev->pd_bus, maxdev->pd_dev, maxdev->pd_func,
+                        PCI_OFF_BR_W32_BASE, start_mem >> 16);
+            pci_write16(maxdev->pd_bus, maxdev->pd_dev, maxdev->pd_func,
+                        PCI_OFF_BR_W32_LIMIT, end_mem >> 16);
+
+            /*
+             * Handle pre-fetchable memory window. It is always placed
+             * below 4 GB, so the upper 32 bits are zero when enabled.
+             */
+            pci_write16(maxdev->pd_bus, maxdev->pd_dev, maxdev->pd_func,
+                        PCI_OFF_BR_W64_BASE, start_pre >> 16);
+            pci_write16(maxdev->pd_bus, maxdev->pd_dev, maxdev->pd_func,
+                        PCI_OFF_BR_W64_LIMIT, end_pre >> 16);
+            pci_write32(maxdev->pd_bus, maxdev->pd_dev, maxdev->pd_func,
+                        PCI_OFF_BR_W64_BASE_U,
+                        (start_pre == 0xffffffff) ? 0xffffffff : 0);
+            pci_write32(maxdev->pd_bus, maxdev->pd_dev, maxdev->pd_func,
+                        PCI_OFF_BR_W64_LIMIT_U, 0x00000000);
+            maxdev->pd_allocated |= BIT(7);
+        } else {
+            /* Allocate BAR on this device */
+            uint8_t  bartype    = maxdev->pd_bar_type[maxbar];
+            uint32_t barsize    = maxdev->pd_bar_size[maxbar];
+            uint     bar_offset = PCI_OFF_BAR0 + 4 * (maxbar);
+            uint32_t base;
+
+            /*
+             * For compatibility with E3B Firestorm, the PCI config
+             * space and I/O mapped range begins at 0x1fc00000, which
+             * is the end of the Firestorm memory window. A BAR which
+             * does not fit in its window is left unassigned.
+             */
+            if (bartype & BIT(7)) {
+                /* ROM BAR */
+                base = pci_window_alloc(&pci_win_mem, barsize);
+                if (base == 0xffffffff)
+                    goto can_not_map_bar;
+                printf("ROM      base=%08x", base);
+                maxdev->pd_bar[maxbar] = base;
+                uint is_bridge = (maxdev->pd_htype & 0x7F) == 1;
+                bar_offset = is_bridge ? PCI_OFF_BR_ROM_BAR : PCI_OFF_ROM_BAR;
+
+                pci_write32v(maxdev->pd_bus, maxdev->pd_dev, maxdev->pd_func,
+                             bar_offset, base | BIT(0));
+            } else if (bartype & BIT(0)) {
+                /* I/O space BAR */
+                base = pci_window_alloc(&pci_win_io, barsize);
+                if (base == 0xffffffff)
+                    goto can_not_map_bar;
+                printf("BAR%u IO  base=%08x", maxbar, base);
+                maxdev->pd_bar[maxbar] = base;
+                pci_write32v(maxdev->pd_bus, maxdev->pd_dev, maxdev->pd_func,
+                             bar_offset, base);
+            } else {
+                /* Memory space BAR */
+                uint prefetch = bartype & BIT(3);
+                base = pci_window_alloc(prefetch ? pci_win_prefetch :
+                                                   &pci_win_mem, barsize);
+                if (base == 0xffffffff)
+                    goto can_not_map_bar;
+                printf("BAR%u %s base=%08x", maxbar,
+                       prefetch ? "PRE" : "MEM", base);
+                maxdev->pd_bar[maxbar] = base;
+                pci_write32v(maxdev->pd_bus, maxdev->pd_dev, maxdev->pd_func,
+                             bar_offset, base);
+                if ((bartype & (BIT(2) | BIT(1))) == BIT(2)) {
+                    /* 64-bit memory BAR */
+                    pci_write32v(maxdev->pd_bus, maxdev->pd_dev,
+                                 maxdev->pd_func, bar_offset + 4, 0x00000000);
+                    maxdev->pd_allocated |= BIT(maxbar + 1);
+                }
+            }
+            printf(" size=%08x\n", barsize);
+            maxdev->pd_allocated |= BIT(maxbar);
+            continue;
+can_not_map_bar:
+            printf("BAR%u no space for size=%08x\n", maxbar, barsize);
+            maxdev->pd_allocated |= BIT(maxbar);
+        }
+    }
+}
+
+static void PCI_ALLOC_CODE
+pci_enable(pci_dev_t *parent_dev)
+{
+    pci_dev_t *cur;
+    for (cur = parent_dev->pd_child; cur != NULL; cur = cur->pd_next) {
+        uint is_bridge = (cur->pd_htype & 0x7F) == 1;
+        if (is_bridge) {
+#if 0
+            /* Disable bridge secondary side error reporting */
+            pci_write16(cur->pd_bus, cur->pd_dev, cur->pd_func,
+                        PCI_OFF_BR_CONTROL, BIT(0));  // Enable parity
+#endif
+
+            pci_enable(cur);
+
+            /* Enable bridge secondary side error reporting */
+            pci_write16(cur->pd_bus, cur->pd_dev, cur->pd_func,
+                        PCI_OFF_BR_CONTROL,
+                        BIT(0) |  // Enable parity
+                        BIT(1) |  // Enable SERR#
+//                      BIT(5) |  // Enable Master Abort reporting
+                        BIT(11) | // Enable SERR# on timer expiration
+                        0);
+            /*
+             * XXX: Master Abort reporting slows down PCI scan for commands
+             *      such as "pci ls"
+             *      I'm not sure whether this should be enabled by default
+             */
+        }
+
+        /* Enable I/O space, Memory space, Bus Mastering, and error reporting */
+        pci_write16(cur->pd_bus, cur->pd_dev, cur->pd_func, PCI_OFF_CMD,
+                    BIT(0) |  // Enable I/O Space
+                    BIT(1) |  // Enable Memory Space
+                    BIT(2) |  // Enable Bus Master
+                    BIT(6) |  // Enable Parity
+                    BIT(8));  // Enable SERR#
+    }
+}
+
+/*
+ * pci_topo_fingerprint
+ * --------------------
+ * Reads the device / vendor ID of the specified function. Empty
+ * functions are reported as PCI_TOPO_EMPTY.
+ */
+static uint32_t PCI_ALLOC_CODE
+pci_topo_fingerprint(uint bus, uint dev, uint func)
+{
+    uint32_t vd = pci_read32v(bus, dev, func, PCI_OFF_VENDOR);
+    if (vd == 0x00000000)
+        vd = PCI_TOPO_EMPTY;
+    return (vd);
+}
+
+/*
+ * pci_topo_restore
+ * ----------------
+ * Rebuilds the device tree from a saved topology, in place of the
+ * discover step. Each saved function is verified against the hardware,
+ * and bus numbers are programmed into bridges as they are reached, so
+ * that devices behind them may be verified. Returns non-zero if the
+ * saved topology matches the installed hardware.
+ *
+ * Devices added behind a bridge at a previously unpopulated device
+ * number are not detected.
+ */
+static uint PCI_ALLOC_CODE
+pci_topo_restore(const void *topo, uint topolen)
+{
+    const pci_topo_hdr_t *hdr = topo;
+    const pci_topo_ent_t *ent = (const pci_topo_ent_t *) (hdr + 1);
+    pci_dev_t            *parent;
+    pci_dev_t            *cur;
+    pci_dev_t           **next;
+    uint                  slot;
+    uint                  idx;
+    uint                  bar;
+
+    if ((topo == NULL) || (topolen < sizeof (*hdr)) ||
+        (hdr->pt_magic != PCI_TOPO_MAGIC) ||
+        (hdr->pt_version != PCI_TOPO_VERSION) ||
+        (hdr->pt_count > PCI_ALLOC_MAX_DEVS) ||
+        (topolen != sizeof (*hdr) + hdr->pt_count * sizeof (*ent))) {
+        return (0);
+    }
+
+    /* Quick check for cards which were added, removed, or swapped */
+    for (slot = 0; slot < PCI_MAX_PHYS_SLOT; slot++)
+        if (pci_topo_fingerprint(0, slot, 0) != hdr->pt_slot_vd[slot])
+            return (0);
+
+    for (idx = 0; idx < hdr->pt_count; idx++, ent++) {
+        if (ent->pte_parent == PCI_TOPO_ROOT)
+            parent = &pci_root_dev;
+        else if (ent->pte_parent < idx)
+            parent = &pci_dev_table[ent->pte_parent];
+        else
+            return (0);  // Corrupt: parent must precede child
+
+        if (pci_topo_fingerprint(ent->pte_bus, ent->pte_dev,
+                                 ent->pte_func) != ent->pte_vd) {
+            return (0);
+        }
+        cur = pci_dev_new();
+        if (cur == NULL)
+            return (0);
+        cur->pd_vendor  = (uint16_t) ent->pte_vd;
+        cur->pd_device  = ent->pte_vd >> 16;
+        cur->pd_size    = ent->pte_size;
+        cur->pd_htype   = ent->pte_htype;
+        cur->pd_bus     = ent->pte_bus;
+        cur->pd_dev     = ent->pte_dev;
+        cur->pd_func    = ent->pte_func;
+        cur->pd_sec_bus = ent->pte_sec_bus;
+        cur->pd_sub_bus = ent->pte_sub_bus;
+        for (bar = 0; bar < 7; bar++) {
+            cur->pd_bar_size[bar] = ent->pte_bar_size[bar];
+            cur->pd_bar_type[bar] = ent->pte_bar_type[bar];
+        }
+        for (next = &parent->pd_child; *next != NULL;
+             next = &(*next)->pd_next)
+            ;
+        *next = cur;
+
+        /* Same configuration as performed by pci_discover() */
+        pci_write8(cur->pd_bus, cur->pd_dev, cur->pd_func,
+                   PCI_OFF_LATENCYTIMER, 0x80);
+        if ((cur->pd_htype & 0x7F) == 1) {
+            pci_write32(cur->pd_bus, cur->pd_dev, cur->pd_func,
+                        PCI_OFF_BR_PRI_BUS,
+                        cur->pd_bus | (cur->pd_sec_bus << 8) |
+                        (cur->pd_sub_bus << 16) | (0x80 << 24));
+        }
+    }
+    pci_max_bus = hdr->pt_max_bus;
+    pci_root_dev.pd_size = hdr->pt_root_size;
+    return (1);
+}
+
+/*
+ * pci_topo_save_tree
+ * ------------------
+ * Records the children of the specified device in saved topology format.
+ * Returns the updated count of entries.
+ */
+static uint
+pci_topo_save_tree(pci_dev_t *parent_dev, uint parent, pci_topo_ent_t *ent,
+                   uint count, uint max)
+{
+    pci_dev_t *cur;
+    uint       bar;
+
+    for (cur = parent_dev->pd_child; cur != NULL; cur = cur->pd_next) {
+        pci_topo_ent_t *e = &ent[count];
+        if (count >= max)
+            break;
+        e->pte_vd      = cur->pd_vendor | (cur->pd_device << 16);
+        e->pte_size    = cur->pd_size;
+        e->pte_htype   = cur->pd_htype;
+        e->pte_bus     = cur->pd_bus;
+        e->pte_dev     = cur->pd_dev;
+        e->pte_func    = cur->pd_func;
+        e->pte_parent  = parent;
+        e->pte_sec_bus = cur->pd_sec_bus;
+        e->pte_sub_bus = cur->pd_sub_bus;
+        e->pte_unused  = 0;
+        for (bar = 0; bar < 7; bar++) {
+            e->pte_bar_size[bar] = cur->pd_bar_size[bar];
+            e->pte_bar_type[bar] = cur->pd_bar_type[bar];
+        }
+        count = pci_topo_save_tree(cur, count, ent, count + 1, max);
+    }
+    return (count);
+}
+
+/*
+ * pci_alloc_topo_save
+ * -------------------
+ * Saves the topology found by the most recent scan to the specified
+ * buffer. Returns the number of bytes written, or 0 if the buffer is
+ * too small.
+ */
+uint
+pci_alloc_topo_save(void *topo, uint topomax)
+{
+    pci_topo_hdr_t *hdr = topo;
+    pci_topo_ent_t *ent = (pci_topo_ent_t *) (hdr + 1);
+    uint            slot;
+    uint            count;
+
+    if (topomax < sizeof (*hdr) + pci_alloc_dev_count * sizeof (*ent))
+        return (0);
+    hdr->pt_magic     = PCI_TOPO_MAGIC;
+    hdr->pt_version   = PCI_TOPO_VERSION;
+    hdr->pt_max_bus   = pci_max_bus;
+    hdr->pt_unused    = 0;
+    hdr->pt_root_size = pci_root_dev.pd_size;
+    for (slot = 0; slot < PCI_MAX_PHYS_SLOT; slot++)
+        hdr->pt_slot_vd[slot] = PCI_TOPO_EMPTY;
+
+    count = pci_topo_save_tree(&pci_root_dev, PCI_TOPO_ROOT, ent, 0,
+                               pci_alloc_dev_count);
+    hdr->pt_count = count;
+
+    /* Slot fingerprints are taken from the discovered function 0 devices */
+    for (; count > 0; count--, ent++) {
+        if ((ent->pte_bus == 0) && (ent->pte_func == 0) &&
+            (ent->pte_dev < PCI_MAX_PHYS_SLOT)) {
+            hdr->pt_slot_vd[ent->pte_dev] = ent->pte_vd;
+        }
+    }
+    return (sizeof (*hdr) + hdr->pt_count * sizeof (*ent));
+}
+
+/*
+ * pci_alloc_scan
+ * --------------
+ * Strategy
+ * 1. Discover: Depth-first search to locate devices, assign bus numbers,
+ *    and determine total BAR sizes.
+ * 2. Allocate: Assign BARs based on buses with largest sizes first,
+ *    with prefetchable BARs in their own window where available.
+ * 3. Enable: Enable I/O and memory space on all devices.
+ *
+ * The caller must have already located and reset the PCI bridge.
+ * Returns the number of PCI functions found.
+ */
+uint PCI_ALLOC_CODE
+pci_alloc_scan(uint firestorm)
+{
+    return (pci_alloc_scan_cached(firestorm, NULL, 0));
+}
+
+/*
+ * pci_alloc_scan_cached
+ * ---------------------
+ * Same as pci_alloc_scan(), but the discover step is skipped if the
+ * specified saved topology matches the installed hardware. On return,
+ * pci_alloc_cache_hit indicates whether the saved topology was used.
+ */
+uint PCI_ALLOC_CODE
+pci_alloc_scan_cached(uint firestorm, const void *topo, uint topolen)
+{
+    if (firestorm) {
+        /* Prometheus / Firestorm: no separate prefetchable window */
+        pci_window_init(&pci_win_mem, 0x00000000, 0x1fc00000);
+        /* config space starts after this point */
+        pci_win_prefetch = &pci_win_mem;
+    } else {
+        /* AmigaPCI */
+        pci_window_init(&pci_win_mem, 0x80000000, 0x9fc00000);
+        pci_window_init(&pci_win_pre, 0xa0000000, 0xff000000);
+        pci_win_prefetch = &pci_win_pre;
+    }
+    /* Firestorm I/O is 0x1fe00000 - 0x20000000 */
+    pci_window_init(&pci_win_io, 0x00000000, 0x00200000);
+
+    pci_max_bus = 0;
+    pci_alloc_dev_count = 0;
+    pci_root_dev.pd_size = 0;
+    pci_root_dev.pd_child = NULL;
+
+    pci_alloc_cache_hit = pci_topo_restore(topo, topolen);
+    if (pci_alloc_cache_hit == 0) {
+        /* Discard anything restored before the mismatch was found */
+        pci_max_bus = 0;
+        pci_alloc_dev_count = 0;
+        pci_root_dev.pd_size = 0;
+        pci_root_dev.pd_child = NULL;
+        pci_discover(0, &pci_root_dev);
+    }
+    pci_allocate(&pci_root_dev);
+    pci_enable(&pci_root_dev);
+
+    pci_window_report("MEM", &pci_win_mem);
+    if (pci_win_prefetch != &pci_win_mem)
+        pci_window_report("PRE", &pci_win_pre);
+    pci_window_report("IO", &pci_win_io);
+    return (pci_alloc_dev_count);
+}
@@ -0,0 +1,99 @@
+/*
+ * This is free and unencumbered software released into the public domain.
+ * See the LICENSE file for additional details.
+ *
+ * Designed by Chris Hooper in 2025.
+ *
+ * ---------------------------------------------------------------------
+ *
+ * PCI bus enumeration and resource allocation core, shared by apciscan
+ * and the AmigaPCI boot ROM.
+ */
+
+#ifndef _PCI_ALLOC_H
+#define _PCI_ALLOC_H
+
+#define PCI_ALLOC_MAX_DEVS  32  // Maximum functions in device table
+
+/*
+ * In the boot ROM, the allocator core is placed in a section which is
+ * copied to fast RAM before it is executed. Code in this section must
+ * not reference constant data or functions outside of the section using
+ * PC-relative addressing.
+ */
+#ifdef APCIROM
+#define PCI_ALLOC_CODE __attribute__((section(".text_to_ram")))
+#else
+#define PCI_ALLOC_CODE
+#endif
+
+typedef struct pci_dev pci_dev_t;
+typedef struct pci_dev {
+    uint16_t   pd_vendor;
+    uint16_t   pd_device;
+    uint32_t   pd_bar[7];
+    uint32_t   pd_bar_size[7];
+    uint32_t   pd_size;         // size of all BARs + bars of children
+    uint8_t    pd_bar_type[7];
+    uint8_t    pd_htype;
+    uint8_t    pd_bus;
+    uint8_t    pd_dev;
+    uint8_t    pd_func;
+    uint8_t    pd_allocated;    // Mask of BARs which have allocated addresses
+    uint8_t    pd_sec_bus;      // Bridge secondary bus number
+    uint8_t    pd_sub_bus;      // Bridge subordinate bus number
+    pci_dev_t *pd_child;
+    pci_dev_t *pd_next;
+} pci_dev_t;
+
+/*
+ * Saved PCI topology. This is the result of the discover step, which may
+ * be used on a later boot in place of probing every bus, device, and
+ * function and sizing every BAR. The fingerprint of each bus 0 slot is
+ * recorded so that a card added to an empty slot invalidates the cache.
+ */
+#define PCI_TOPO_MAGIC      0x50544f50  // "PTOP"
+#define PCI_TOPO_VERSION    1
+#define PCI_TOPO_ROOT       0xff        // pte_parent of bus 0 devices
+#define PCI_TOPO_EMPTY      0xffffffff  // Fingerprint of empty function
+
+typedef struct {
+    uint32_t pt_magic;                      // PCI_TOPO_MAGIC
+    uint8_t  pt_version;                    // PCI_TOPO_VERSION
+    uint8_t  pt_count;                      // Number of entries which follow
+    uint8_t  pt_max_bus;                    // Highest assigned bus number
+    uint8_t  pt_unused;
+    uint32_t pt_root_size;                  // Total size of bus 0 BARs
+    uint32_t pt_slot_vd[PCI_MAX_PHYS_SLOT]; // Bus 0 device/vendor per slot
+} pci_topo_hdr_t;
+
+typedef struct {
+    uint32_t pte_vd;                        // Device/vendor fingerprint
+    uint32_t pte_bar_size[7];
+    uint32_t pte_size;                      // Size of BARs of children
+    uint8_t  pte_bar_type[7];
+    uint8_t  pte_htype;
+    uint8_t  pte_bus;
+    uint8_t  pte_dev;
+    uint8_t  pte_func;
+    uint8_t  pte_parent;                    // Entry number of parent bridge
+    uint8_t  pte_sec_bus;
+    uint8_t  pte_sub_bus;
+    uint16_t pte_unused;
+} pci_topo_ent_t;
+
+#define PCI_TOPO_MAX_SIZE   (sizeof (pci_topo_hdr_t) + \
+                             PCI_ALLOC_MAX_DEVS * sizeof (pci_topo_ent_t))
+
+typedef uint (*pci_alloc_scan_t)(uint firestorm);
+
+uint pci_alloc_scan(uint firestorm) PCI_ALLOC_CODE;
+uint pci_alloc_scan_cached(uint firestorm, const void *topo, uint topolen)
+     PCI_ALLOC_CODE;
+uint pci_alloc_topo_save(void *topo, uint topomax);
+
+extern pci_dev_t pci_root_dev;
+extern uint      pci_alloc_dev_count;
+extern uint8_t   pci_alloc_cache_hit;
+
+#endif /* _PCI_ALLOC_H */
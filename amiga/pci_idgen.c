@@ -0,0 +1,345 @@
+/*
+ * pci_idgen
+ * ---------
+ * Build host utility which compiles a list of PCI vendor and device names
+ * in pci.ids format into the lookup tables built into the pci tool. The
+ * tables are sorted by ID for binary search, and names are stored once in
+ * a shared string pool, where a name which is the tail of another name
+ * is stored within it.
+ *
+ * Copyright 2025 Chris Hooper. This program and source may be used
+ * and distributed freely, for any purpose which benefits the Amiga
+ * community. Commercial use of the binary, source, or algorithms requires
+ * prior written approval from Chris Hooper <amiga@cdh.eebugs.com>.
+ * All redistributions must retain this Copyright notice.
+ *
+ * DISCLAIMER: THE SOFTWARE IS PROVIDED "AS-IS", WITHOUT ANY WARRANTY.
+ * THE AUTHOR ASSUMES NO LIABILITY FOR ANY DAMAGE ARISING OUT OF THE USE
+ * OR MISUSE OF THIS UTILITY OR INFORMATION REPORTED BY THIS UTILITY.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <stdint.h>
+#include <string.h>
+#include <ctype.h>
+
+#define MAX_NAMES   65536
+#define MAX_POOL    65535   // Name offsets are 16 bits
+
+typedef unsigned int uint;
+
+typedef struct {
+    uint32_t  id;           // Vendor, or vendor << 16 | device
+    char     *name;
+    uint      offset;       // Offset of name in string pool
+} id_ent_t;
+
+static id_ent_t vendors[MAX_NAMES];
+static id_ent_t devices[MAX_NAMES];
+static uint     vendor_count;
+static uint     device_count;
+static char     pool[MAX_POOL + 1];
+static uint     pool_len;
+
+static void
+usage(void)
+{
+    printf("usage: pci_idgen <pci.ids file> <output header>\n"
+           "    Generates the pci tool's built-in vendor and device name\n"
+           "    tables from a file in pci.ids format.\n");
+}
+
+static void __attribute__((format(__printf__, 1, 2)))
+err_printf(const char *fmt, ...)
+{
+    va_list args;
+    va_start(args, fmt);
+    vfprintf(stderr, fmt, args);
+    va_end(args);
+}
+
+/*
+ * parse_id
+ * --------
+ * Parses "xxxx  Name" at ptr. Returns the ID and sets name, with the line
+ * terminator removed, or returns -1 if the text is not in that form.
+ */
+static int
+parse_id(char *ptr, char **name)
+{
+    uint id = 0;
+    uint pos;
+
+    for (pos = 0; pos < 4; pos++) {
+        if (!isxdigit((unsigned char) ptr[pos]))
+            return (-1);
+        id = (id << 4) | (isdigit((unsigned char) ptr[pos]) ?
+                          (ptr[pos] - '0') : (tolower(ptr[pos]) - 'a' + 10));
+    }
+    if (ptr[pos] != ' ')
+        return (-1);
+    while (ptr[pos] == ' ')
+        pos++;
+    *name = ptr + pos;
+    ptr[pos + strcspn(ptr + pos, "\r\n")] = '\0';
+    if (**name == '\0')
+        return (-1);
+    return (id);
+}
+
+static uint
+load_ids(FILE *fp, const char *filename)
+{
+    char linebuf[300];
+    char *name;
+    uint line = 0;
+    uint err_count = 0;
+    int  vendor = -1;
+    int  id;
+
+    while (fgets(linebuf, sizeof (linebuf), fp) != NULL) {
+        line++;
+        if ((linebuf[0] == '#') || (linebuf[strspn(linebuf, " \t\r\n")] == 0))
+            continue;
+        if (linebuf[0] == 'C')
+            break;  // Device class section follows vendors
+        if (linebuf[0] != '\t') {
+            vendor = id = parse_id(linebuf, &name);
+            if (id < 0) {
+                err_printf("%s:%u: invalid vendor line\n", filename, line);
+                err_count++;
+                continue;
+            }
+            if (vendor_count >= MAX_NAMES) {
+                err_printf("%s:%u: too many vendors\n", filename, line);
+                return (1);
+            }
+            vendors[vendor_count].id   = id;
+            vendors[vendor_count].name = strdup(name);
+            vendor_count++;
+        } else if (linebuf[1] != '\t') {
+            id = parse_id(linebuf + 1, &name);
+            if ((id < 0) || (vendor < 0)) {
+                err_printf("%s:%u: invalid device line\n", filename, line);
+                err_count++;
+                continue;
+            }
+            if (device_count >= MAX_NAMES) {
+                err_printf("%s:%u: too many devices\n", filename, line);
+                return (1);
+            }
+            devices[device_count].id   = ((uint32_t) vendor << 16) | id;
+            devices[device_count].name = strdup(name);
+            device_count++;
+        }
+        /* Subsystem lines (two tabs) are not built in */
+    }
+    return (err_count);
+}
+
+static int
+id_compare(const void *a, const void *b)
+{
+    const id_ent_t *ea = a;
+    const id_ent_t *eb = b;
+
+    if (ea->id != eb->id)
+        return ((ea->id < eb->id) ? -1 : 1);
+    return (0);
+}
+
+static uint
+sort_ids(id_ent_t *ents, uint count)
+{
+    uint cur;
+    uint err_count = 0;
+
+    qsort(ents, count, sizeof (*ents), id_compare);
+    for (cur = 1; cur < count; cur++) {
+        if (ents[cur].id != ents[cur - 1].id)
+            continue;
+        if (ents == devices)
+            err_printf("Duplicate device %04x.%04x\n",
+                       ents[cur].id >> 16, ents[cur].id & 0xffff);
+        else
+            err_printf("Duplicate vendor %04x\n", ents[cur].id);
+        err_count++;
+    }
+    return (err_count);
+}
+
+/* Longest names first, so that shorter names may be found in their tails */
+static int
+name_compare(const void *a, const void *b)
+{
+    const id_ent_t *ea = *(const id_ent_t * const *) a;
+    const id_ent_t *eb = *(const id_ent_t * const *) b;
+    size_t          la = strlen(ea->name);
+    size_t          lb = strlen(eb->name);
+
+    if (la != lb)
+        return ((la > lb) ? -1 : 1);
+    return (strcmp(ea->name, eb->name));
+}
+
+/*
+ * pool_names
+ * ----------
+ * Assigns each name an offset in the string pool. A name which matches
+ * the tail of a name already in the pool shares its storage.
+ */
+static uint
+pool_names(void)
+{
+    id_ent_t **order;
+    uint       count = vendor_count + device_count;
+    uint       cur;
+
+    order = malloc(count * sizeof (*order));
+    if (order == NULL) {
+        err_printf("Out of memory\n");
+        return (1);
+    }
+    for (cur = 0; cur < vendor_count; cur++)
+        order[cur] = &vendors[cur];
+    for (cur = 0; cur < device_count; cur++)
+        order[vendor_count + cur] = &devices[cur];
+    qsort(order, count, sizeof (*order), name_compare);
+
+    for (cur = 0; cur < count; cur++) {
+        const char *name = order[cur]->name;
+        size_t      len  = strlen(name);
+        uint        pos;
+
+        for (pos = 0; pos < pool_len; pos += strlen(pool + pos) + 1) {
+            size_t plen = strlen(pool + pos);
+            if ((plen >= len) && (strcmp(pool + pos + plen - len, name) == 0))
+                break;
+        }
+        if (pos < pool_len) {
+            order[cur]->offset = pos + strlen(pool + pos) - len;
+            continue;
+        }
+        if (pool_len + len + 1 > MAX_POOL) {
+            err_printf("Names exceed %u bytes\n", MAX_POOL);
+            free(order);
+            return (1);
+        }
+        memcpy(pool + pool_len, name, len + 1);
+        order[cur]->offset = pool_len;
+        pool_len += len + 1;
+    }
+    free(order);
+    return (0);
+}
+
+/* write_names() writes the string pool, one name per line */
+static void
+write_names(FILE *fp)
+{
+    uint pos;
+
+    fprintf(fp, "static const char pci_id_names[] =");
+    for (pos = 0; pos < pool_len; pos++) {
+        uint8_t ch = pool[pos];
+
+        if ((pos == 0) || (pool[pos - 1] == '\0'))
+            fprintf(fp, "\n    \"");
+        if (ch == '\0') {
+            /* The final NUL is the string literal's own */
+            fprintf(fp, (pos + 1 < pool_len) ? "\\0\"" : "\"");
+        } else if ((ch == '"') || (ch == '\\')) {
+            fprintf(fp, "\\%c", ch);
+        } else if ((ch < ' ') || (ch > '~') || (ch == '?')) {
+            /* Three digits, so that a following digit is not taken in */
+            fprintf(fp, "\\%03o", ch);
+        } else {
+            fputc(ch, fp);
+        }
+    }
+    fprintf(fp, ";\n");
+}
+
+static void
+write_table(FILE *fp, const char *type, const char *name,
+            const id_ent_t *ents, uint count, uint offsets)
+{
+    uint cur;
+
+    fprintf(fp, "static const %s %s[] = {", type, name);
+    if (count == 0)
+        fprintf(fp, "\n    0");
+    for (cur = 0; cur < count; cur++) {
+        if ((cur % 6) == 0)
+            fprintf(fp, "\n   ");
+        if (offsets)
+            fprintf(fp, " %5u,", ents[cur].offset);
+        else if (strcmp(type, "uint32_t") == 0)
+            fprintf(fp, " 0x%08x,", ents[cur].id);
+        else
+            fprintf(fp, " 0x%04x,", ents[cur].id);
+    }
+    fprintf(fp, "\n};\n\n");
+}
+
+static uint
+write_header(FILE *fp, const char *src)
+{
+    const char *base = strrchr(src, '/');
+
+    base = (base == NULL) ? src : base + 1;
+    fprintf(fp, "/*\n"
+                " * Built-in PCI ID tables generated by pci_idgen from %s.\n"
+                " * Do not edit. Tables are sorted by ID, and each name is\n"
+                " * at the given offset in pci_id_names[].\n"
+                " */\n\n", base);
+    fprintf(fp, "#define PCI_ID_VENDORS %u\n", vendor_count);
+    fprintf(fp, "#define PCI_ID_DEVICES %u\n\n", device_count);
+    write_table(fp, "uint16_t", "pci_id_vendor", vendors, vendor_count, 0);
+    write_table(fp, "uint16_t", "pci_id_vendor_name", vendors, vendor_count, 1);
+    write_table(fp, "uint32_t", "pci_id_device", devices, device_count, 0);
+    write_table(fp, "uint16_t", "pci_id_device_name", devices, device_count, 1);
+    write_names(fp);
+    return (ferror(fp));
+}
+
+int
+main(int argc, char *argv[])
+{
+    FILE *ifp;
+    FILE *ofp;
+    uint  rc;
+
+    if (argc != 3) {
+        usage();
+        exit(EXIT_FAILURE);
+    }
+
+    ifp = fopen(argv[1], "r");
+    if (ifp == NULL) {
+        err_printf("Failed to open %s\n", argv[1]);
+        exit(EXIT_FAILURE);
+    }
+    rc = load_ids(ifp, argv[1]);
+    fclose(ifp);
+    rc += sort_ids(vendors, vendor_count);
+    rc += sort_ids(devices, device_count);
+    if ((rc != 0) || (pool_names() != 0))
+        exit(EXIT_FAILURE);
+
+    ofp = fopen(argv[2], "w");
+    if (ofp == NULL) {
+        err_printf("Failed to open %s\n", argv[2]);
+        exit(EXIT_FAILURE);
+    }
+    if (write_header(ofp, argv[1]) != 0) {
+        err_printf("Failed to write %s\n", argv[2]);
+        fclose(ofp);
+        remove(argv[2]);
+        exit(EXIT_FAILURE);
+    }
+    fclose(ofp);
+    exit(EXIT_SUCCESS);
+}
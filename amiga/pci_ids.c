@@ -0,0 +1,263 @@
+/*
+ * This is free and unencumbered software released into the public domain.
+ * See the LICENSE file for additional details.
+ *
+ * Designed by Chris Hooper in 2025.
+ *
+ * ---------------------------------------------------------------------
+ *
+ * PCI vendor and device name lookup for the pci tool.
+ *
+ * Built-in names are compiled by pci_idgen from pci_builtin.ids into
+ * tables which are sorted by ID and share a single pool of names. The
+ * tables are binary searched.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include "pci_ids.h"
+#include "pci_idtab.h"
+#include "strtox.h"
+
+#define PCI_ANY_ID 0xffffffff
+
+typedef unsigned int uint;
+
+/*
+ * External PCI ID file (pci.ids format) consulted for IDs which are not
+ * in the built-in tables. The file is opened on the first miss, at which
+ * time an index of the file offset of each vendor is built. A lookup is
+ * then a binary search of the index followed by a scan of only that
+ * vendor's device lines. Names which have been found are cached.
+ */
+typedef struct {
+    uint16_t pi_vendor;
+    long     pi_offset;    // File offset of vendor's first device line
+    char    *pi_name;      // Vendor name, once looked up
+} pci_ids_vendor_t;
+
+typedef struct pci_ids_device {
+    struct pci_ids_device *pd_next;
+    uint16_t               pd_vendor;
+    uint16_t               pd_device;
+    char                  *pd_name;  // NULL if not in file
+} pci_ids_device_t;
+
+const char              *pci_ids_filename;
+static FILE             *pci_ids_fp;
+static pci_ids_vendor_t *pci_ids_index;
+static uint              pci_ids_count;
+static pci_ids_device_t *pci_ids_devices;
+
+/*
+ * pci_ids_parse
+ * -------------
+ * Parses a pci.ids line of the form "xxxx  Name". Returns the ID and
+ * sets name to the start of the name, with the line terminator removed.
+ * Returns -1 if the line is not in that form.
+ */
+static int
+pci_ids_parse(char *line, char **name)
+{
+    uint  id;
+    int   count;
+    char *ptr;
+
+    if ((*line == '\t') || (*line == ' ') || (*line == '#'))
+        return (-1);
+    count = strtox(line, 16, &id);
+    if ((count != 4) || (line[count] != ' '))
+        return (-1);
+    for (ptr = line + count; *ptr == ' '; ptr++)
+        ;
+    *name = ptr;
+    ptr += strcspn(ptr, "\r\n");
+    *ptr = '\0';
+    return (id);
+}
+
+/*
+ * pci_ids_open
+ * ------------
+ * Opens the external PCI ID file and builds its vendor index. Returns
+ * non-zero if there is no usable file.
+ */
+static uint
+pci_ids_open(void)
+{
+    char  line[256];
+    char *name;
+    uint  max = 0;
+    int   id;
+
+    if (pci_ids_fp != NULL)
+        return (0);
+    if (pci_ids_filename == NULL)
+        return (1);
+
+    pci_ids_fp = fopen(pci_ids_filename, "r");
+    if (pci_ids_fp == NULL) {
+        printf("Could not open %s\n", pci_ids_filename);
+        pci_ids_filename = NULL;
+        return (1);
+    }
+    while (fgets(line, sizeof (line), pci_ids_fp) != NULL) {
+        if (line[0] == 'C')
+            break;  // Device class section follows vendors
+        if ((id = pci_ids_parse(line, &name)) < 0)
+            continue;
+        if (pci_ids_count >= max) {
+            pci_ids_vendor_t *nindex;
+            max += 256;
+            nindex = realloc(pci_ids_index, max * sizeof (*nindex));
+            if (nindex == NULL)
+                break;
+            pci_ids_index = nindex;
+        }
+        pci_ids_index[pci_ids_count].pi_vendor = id;
+        pci_ids_index[pci_ids_count].pi_offset = ftell(pci_ids_fp);
+        pci_ids_index[pci_ids_count].pi_name   = NULL;
+        pci_ids_count++;
+    }
+    return (0);
+}
+
+/*
+ * pci_ids_vendor
+ * --------------
+ * Returns the index entry for the specified vendor, or NULL if the vendor
+ * is not in the external PCI ID file. The file is sorted by vendor ID.
+ */
+static pci_ids_vendor_t *
+pci_ids_vendor(uint16_t vendor)
+{
+    uint low = 0;
+    uint high;
+
+    if (pci_ids_open())
+        return (NULL);
+
+    high = pci_ids_count;
+    while (low < high) {
+        uint mid = (low + high) / 2;
+        if (pci_ids_index[mid].pi_vendor < vendor)
+            low = mid + 1;
+        else
+            high = mid;
+    }
+    if ((low < pci_ids_count) && (pci_ids_index[low].pi_vendor == vendor))
+        return (&pci_ids_index[low]);
+    return (NULL);
+}
+
+/*
+ * pci_ids_lookup
+ * --------------
+ * Returns the external PCI ID file name of the specified vendor (device
+ * is PCI_ANY_ID) or vendor and device, or NULL if it is not present.
+ */
+static const char *
+pci_ids_lookup(uint16_t vendor, uint device)
+{
+    pci_ids_vendor_t *pv = pci_ids_vendor(vendor);
+    pci_ids_device_t *pd;
+    char              line[256];
+    char             *name;
+
+    if (pv == NULL)
+        return (NULL);
+
+    if (device == PCI_ANY_ID) {
+        if (pv->pi_name == NULL) {
+            /* Vendor line is found between the previous vendor and this */
+            uint pos    = pv - pci_ids_index;
+            long offset = (pos == 0) ? 0 : pci_ids_index[pos - 1].pi_offset;
+            fseek(pci_ids_fp, offset, SEEK_SET);
+            while (fgets(line, sizeof (line), pci_ids_fp) != NULL) {
+                if (pci_ids_parse(line, &name) == vendor) {
+                    pv->pi_name = strdup(name);
+                    break;
+                }
+            }
+        }
+        return (pv->pi_name);
+    }
+
+    for (pd = pci_ids_devices; pd != NULL; pd = pd->pd_next)
+        if ((pd->pd_vendor == vendor) && (pd->pd_device == device))
+            return (pd->pd_name);
+
+    pd = malloc(sizeof (*pd));
+    if (pd == NULL)
+        return (NULL);
+    pd->pd_vendor   = vendor;
+    pd->pd_device   = device;
+    pd->pd_name     = NULL;
+    pd->pd_next     = pci_ids_devices;
+    pci_ids_devices = pd;
+
+    fseek(pci_ids_fp, pv->pi_offset, SEEK_SET);
+    while (fgets(line, sizeof (line), pci_ids_fp) != NULL) {
+        if (line[0] == '#')
+            continue;
+        if (line[0] != '\t')
+            break;     // Next vendor
+        if (line[1] == '\t')
+            continue;  // Subsystem
+        if (pci_ids_parse(line + 1, &name) == (int) device) {
+            pd->pd_name = strdup(name);
+            break;
+        }
+    }
+    return (pd->pd_name);
+}
+
+/*
+ * pci_vendor_name
+ * ---------------
+ * Returns the name of the specified vendor, or NULL if it is unknown.
+ */
+const char *
+pci_vendor_name(uint16_t vendor)
+{
+    uint low  = 0;
+    uint high = PCI_ID_VENDORS;
+
+    while (low < high) {
+        uint mid = (low + high) / 2;
+        if (pci_id_vendor[mid] < vendor)
+            low = mid + 1;
+        else
+            high = mid;
+    }
+    if ((low < PCI_ID_VENDORS) && (pci_id_vendor[low] == vendor))
+        return (pci_id_names + pci_id_vendor_name[low]);
+    return (pci_ids_lookup(vendor, PCI_ANY_ID));
+}
+
+/*
+ * pci_device_name
+ * ---------------
+ * Returns the name of the specified vendor's device, or NULL if it is
+ * unknown.
+ */
+const char *
+pci_device_name(uint16_t vendor, uint16_t device)
+{
+    uint32_t key  = ((uint32_t) vendor << 16) | device;
+    uint     low  = 0;
+    uint     high = PCI_ID_DEVICES;
+
+    while (low < high) {
+        uint mid = (low + high) / 2;
+        if (pci_id_device[mid] < key)
+            low = mid + 1;
+        else
+            high = mid;
+    }
+    if ((low < PCI_ID_DEVICES) && (pci_id_device[low] == key))
+        return (pci_id_names + pci_id_device_name[low]);
+    return (pci_ids_lookup(vendor, device));
+}
@@ -0,0 +1,23 @@
+/*
+ * This is free and unencumbered software released into the public domain.
+ * See the LICENSE file for additional details.
+ *
+ * Designed by Chris Hooper in 2025.
+ *
+ * ---------------------------------------------------------------------
+ *
+ * PCI vendor and device name lookup for the pci tool.
+ */
+
+#ifndef _PCI_IDS_H
+#define _PCI_IDS_H
+
+#include <stdint.h>
+
+/* External pci.ids file consulted for IDs not built in (NULL for none) */
+extern const char *pci_ids_filename;
+
+const char *pci_vendor_name(uint16_t vendor);
+const char *pci_device_name(uint16_t vendor, uint16_t device);
+
+#endif /* _PCI_IDS_H */
@@ -21,6 +21,8 @@
 #include "gpio.h"
 #include "power.h"
 #include "utils.h"
+#include "irq.h"
+#include <libopencm3/cm3/nvic.h>
 #include <libopencm3/stm32/f2/dma.h>
 #include <libopencm3/stm32/f2/rcc.h>
 #include <libopencm3/stm32/adc.h>
@@ -110,19 +112,53 @@
 
 #define CHANNEL_MAX 12
 
+/*
+ * Oversampling and filtering
+ *
+ * The ADC continuously converts all channels into a circular DMA buffer
+ * which holds ADC_SETS_PER_HALF complete sets of channels in each half.
+ * The DMA half-transfer and transfer-complete interrupts sum the samples
+ * of the just-completed half into per-channel accumulators. After
+ * ADC_DECIMATE halves, the accumulated sum for each channel is averaged
+ * and fed through a first-order IIR low-pass filter, and the result is
+ * published as a new decimated sample. With a 480-cycle sample time, a
+ * new decimated sample is available roughly every 10 msec.
+ *
+ * The IIR state holds ADC_FRAC_BITS bits of fraction, and each new
+ * average is given a weight of 1 / (1 << ADC_IIR_SHIFT). The VBAT
+ * channel is not IIR filtered, as it is only enabled periodically.
+ */
+#define ADC_SETS_PER_HALF  4   // Channel sets per DMA half-buffer
+#define ADC_DECIMATE       4   // DMA half-buffers per decimated sample
+#define ADC_IIR_SHIFT      2   // IIR new sample weight is 1/4
+#define ADC_FRAC_BITS      4   // Fraction bits of IIR filter state
+#define ADC_WINDOW_SAMPLES (ADC_SETS_PER_HALF * ADC_DECIMATE)
+
 /* Buffer for the channel definitions */
 static uint8_t adc_channels[CHANNEL_MAX];
 
 /* Buffer to store the results of the ADC conversion */
-volatile uint16_t adc_buffer[CHANNEL_MAX];
+volatile uint16_t adc_buffer[ADC_SETS_PER_HALF * 2 * CHANNEL_MAX];
 uint16_t adc_snapshot[CHANNEL_MAX];
 static uint8_t channel_count = 0;
 static uint16_t vbat_cache;
 
+static uint32_t adc_accum[CHANNEL_MAX];    // Sum of samples in window
+static uint32_t adc_filter[CHANNEL_MAX];   // IIR state (ADC_FRAC_BITS)
+static uint16_t adc_sample[CHANNEL_MAX];   // Latest decimated sample
+static uint16_t adc_nofilter;              // Channels not to IIR filter
+static uint8_t  adc_accum_halves;          // Halves summed in adc_accum
+static volatile uint32_t adc_sample_seq;   // Count of decimated samples
+static uint16_t adc_window_lo[CHANNEL_MAX];  // Rail window minimum
+static uint16_t adc_window_hi[CHANNEL_MAX];  // Rail window maximum
+static uint16_t adc_window_mask;           // Channels with a rail window
+
 void
 adc_setup_sensor(uint which, uint gpio_pack, uint adc_channel)
 {
     adc_channels[which] = adc_channel;
+    if (adc_channel == ADC_CHANNEL_VBAT)
+        adc_nofilter |= BIT(which);
     if (gpio_pack != 0) {
         uint32_t gpio = gpio_num_to_gpio((gpio_pack >> 4) - 1);
         uint32_t pin = gpio_pack & 0xf;
@@ -189,7 +225,8 @@ adc_init(void)
     dma_set_peripheral_address(dma, stream, (uintptr_t) &ADC_DR(adcbase));
     dma_set_memory_address(dma, stream, (uintptr_t) &adc_buffer[0]);
     dma_set_transfer_mode(dma, stream, DMA_SxCR_DIR_PERIPHERAL_TO_MEM);
-    dma_set_number_of_data(dma, stream, channel_count);
+    dma_set_number_of_data(dma, stream,
+                           channel_count * ADC_SETS_PER_HALF * 2);
     dma_channel_select(dma, stream, channel);
     dma_disable_peripheral_increment_mode(dma, stream);
     dma_enable_memory_increment_mode(dma, stream);
@@ -201,7 +238,11 @@ adc_init(void)
     dma_set_fifo_threshold(dma, stream, DMA_SxFCR_FTH_2_4_FULL);
     dma_set_memory_burst(dma, stream, DMA_SxCR_MBURST_SINGLE);
     dma_set_peripheral_burst(dma, stream, DMA_SxCR_PBURST_SINGLE);
+    dma_enable_half_transfer_interrupt(dma, stream);
+    dma_enable_transfer_complete_interrupt(dma, stream);
     dma_enable_stream(dma, stream);
+    nvic_set_priority(NVIC_DMA2_STREAM4_IRQ, 0x80);
+    nvic_enable_irq(NVIC_DMA2_STREAM4_IRQ);
 
     adc_disable_dma(adcbase);
 
@@ -251,14 +292,19 @@ adc_init(void)
     dma_set_peripheral_address(dma, channel, (uintptr_t)&ADC_DR(adcbase));
     dma_set_memory_address(dma, channel, (uintptr_t)adc_buffer);
     dma_set_read_from_peripheral(dma, channel);
-    dma_set_number_of_data(dma, channel, channel_count);
+    dma_set_number_of_data(dma, channel,
+                           channel_count * ADC_SETS_PER_HALF * 2);
     dma_disable_peripheral_increment_mode(dma, channel);
     dma_enable_memory_increment_mode(dma, channel);
     dma_set_peripheral_size(dma, channel, DMA_CCR_PSIZE_16BIT);
     dma_set_memory_size(dma, channel, DMA_CCR_MSIZE_16BIT);
     dma_enable_circular_mode(dma, channel);
     dma_set_priority(dma, channel, DMA_CCR_PL_MEDIUM);
+    dma_enable_half_transfer_interrupt(dma, channel);
+    dma_enable_transfer_complete_interrupt(dma, channel);
     dma_enable_channel(dma, channel);
+    nvic_set_priority(NVIC_DMA1_CHANNEL1_IRQ, 0x80);
+    nvic_enable_irq(NVIC_DMA1_CHANNEL1_IRQ);
 
     adc_set_dual_mode(ADC_CR1_DUALMOD_IND);  // Independent ADCs
 
@@ -288,11 +334,105 @@ adc_init(void)
 void
 adc_shutdown(void)
 {
+    nvic_disable_irq(NVIC_DMA2_STREAM4_IRQ);
     adc_power_off(ADC1);
     adc_disable_dma(ADC1);
     dma_disable_stream(DMA2, 4);
 }
 
+/*
+ * adc_dma_half
+ * ------------
+ * Accumulates one completed half of the ADC DMA buffer, and produces a
+ * new decimated and filtered sample for each channel once ADC_DECIMATE
+ * halves have been accumulated. This is called from interrupt context.
+ */
+static void
+adc_dma_half(const volatile uint16_t *buf)
+{
+    uint set;
+    uint ch;
+
+    for (set = 0; set < ADC_SETS_PER_HALF; set++)
+        for (ch = 0; ch < channel_count; ch++)
+            adc_accum[ch] += *(buf++);
+
+    if (++adc_accum_halves < ADC_DECIMATE)
+        return;
+    adc_accum_halves = 0;
+
+    for (ch = 0; ch < channel_count; ch++) {
+        /* Average of window, with ADC_FRAC_BITS of fraction */
+        uint32_t avg = (adc_accum[ch] << ADC_FRAC_BITS) / ADC_WINDOW_SAMPLES;
+        adc_accum[ch] = 0;
+
+        if ((adc_sample_seq == 0) || (adc_nofilter & BIT(ch))) {
+            adc_filter[ch] = avg;  // Seed filter with first average
+        } else {
+            adc_filter[ch] += ((int32_t) (avg - adc_filter[ch])) >>
+                              ADC_IIR_SHIFT;
+        }
+        adc_sample[ch] = (adc_filter[ch] + BIT(ADC_FRAC_BITS - 1)) >>
+                         ADC_FRAC_BITS;
+    }
+    adc_sample_seq++;
+
+    /* Report power rails to power management without main loop delay */
+    if (adc_window_mask != 0) {
+        uint bad = 0;
+        for (ch = 0; ch < channel_count; ch++) {
+            if ((adc_window_mask & BIT(ch)) &&
+                ((adc_sample[ch] < adc_window_lo[ch]) ||
+                 (adc_sample[ch] > adc_window_hi[ch])))
+                bad |= BIT(ch);
+        }
+        power_rail_event(adc_window_mask, bad);
+    }
+}
+
+#if defined(STM32F2)
+void dma2_stream4_isr(void);
+void
+dma2_stream4_isr(void)
+{
+    if (dma_get_interrupt_flag(DMA2, DMA_STREAM4, DMA_HTIF)) {
+        dma_clear_interrupt_flags(DMA2, DMA_STREAM4, DMA_HTIF);
+        adc_dma_half(&adc_buffer[0]);
+    }
+    if (dma_get_interrupt_flag(DMA2, DMA_STREAM4, DMA_TCIF)) {
+        dma_clear_interrupt_flags(DMA2, DMA_STREAM4, DMA_TCIF);
+        adc_dma_half(&adc_buffer[channel_count * ADC_SETS_PER_HALF]);
+    }
+}
+#elif defined(STM32F1)
+void dma1_channel1_isr(void);
+void
+dma1_channel1_isr(void)
+{
+    if (dma_get_interrupt_flag(DMA1, DMA_CHANNEL1, DMA_HTIF)) {
+        dma_clear_interrupt_flags(DMA1, DMA_CHANNEL1, DMA_HTIF);
+        adc_dma_half(&adc_buffer[0]);
+    }
+    if (dma_get_interrupt_flag(DMA1, DMA_CHANNEL1, DMA_TCIF)) {
+        dma_clear_interrupt_flags(DMA1, DMA_CHANNEL1, DMA_TCIF);
+        adc_dma_half(&adc_buffer[channel_count * ADC_SETS_PER_HALF]);
+    }
+}
+#endif
+
+/*
+ * adc_get_seq
+ * -----------
+ * Returns the count of decimated samples produced so far. A caller may
+ * compare this against a previous value to determine whether new sensor
+ * readings are available.
+ */
+uint
+adc_get_seq(void)
+{
+    return (adc_sample_seq);
+}
+
 static int adc_scale;  // ADC scale value used to adjust sensor readings
 
 /*
@@ -330,13 +470,55 @@ adc_average_vref(uint16_t vref)
     return (adc_vref);
 }
 
+/*
+ * adc_calc_to_raw
+ * ---------------
+ * Converts a scaled value, as returned by adc_get_reading(), back to
+ * a raw ADC sample value using the current Vrefint scale.
+ */
+static uint
+adc_calc_to_raw(int calc)
+{
+    int raw;
+
+    if ((calc <= 0) || (adc_scale == 0))
+        return (0);
+    raw = calc / 33 * 4096 / adc_scale;
+    if (raw > 0xfff)
+        raw = 0xfff;
+    return (raw);
+}
+
+/*
+ * adc_set_window
+ * --------------
+ * Sets the expected range of a power rail channel, in the same units as
+ * returned by adc_get_reading(). Each new decimated sample of channels
+ * with a window is checked against the window in interrupt context, and
+ * the result is reported to power management.
+ */
+void
+adc_set_window(uint which, int calc_min, int calc_max)
+{
+    uint16_t lo = adc_calc_to_raw(calc_min);
+    uint16_t hi = adc_calc_to_raw(calc_max);
+
+    disable_irq();
+    adc_window_lo[which] = lo;
+    adc_window_hi[which] = hi;
+    adc_window_mask |= BIT(which);
+    enable_irq();
+}
+
 int
 adc_get_reading(uint cur)
 {
     int calc;
     if (cur == 0) {
-        /* Capture ADCs all at once */
-        memcpy(adc_snapshot, (void *)adc_buffer, sizeof (adc_buffer));
+        /* Capture the latest decimated samples all at once */
+        disable_irq();
+        memcpy(adc_snapshot, adc_sample, sizeof (adc_sample));
+        enable_irq();
         adc_update_scale(adc_snapshot[0]);
 #ifdef DEBUG_ADC
         printf("ADC scale=%u\n", adc_scale);
@@ -345,6 +527,7 @@ adc_get_reading(uint cur)
     switch (adc_channels[cur]) {
         case ADC_CHANNEL_VBAT: {
             static uint64_t vbat_refresh_timer;
+            static uint32_t vbat_ready_seq;
             static uint8_t  vbat_mode;
             /*
              * Special handling for battery channel, as it should be read
@@ -357,9 +540,14 @@ adc_get_reading(uint cur)
              *      The timer tells when it's time to read the sensor again.
              *      Once the timer has elapsed, then enable the VBAT sensor,
              *      set vbat_mode to 1, and start a timer-until-ready
+             *
+             * The VBAT sample is averaged over a decimation window, so
+             * the reading is only taken once a complete window has been
+             * converted with the sensor enabled.
              */
             if (vbat_mode == 0) {
-                if (timer_tick_has_elapsed(vbat_refresh_timer)) {
+                if (timer_tick_has_elapsed(vbat_refresh_timer) &&
+                    ((int) (adc_sample_seq - vbat_ready_seq) >= 0)) {
                     vbat_cache = adc_snapshot[cur];
                     adc_disable_vbat_sensor();
                     vbat_mode = 1;
@@ -369,6 +557,7 @@ adc_get_reading(uint cur)
                 adc_enable_vbat_sensor();
                 vbat_mode = 0;
                 vbat_refresh_timer = timer_tick_plus_msec(1);  // until good
+                vbat_ready_seq = adc_sample_seq + 2;
             }
             adc_snapshot[cur] = vbat_cache;
             break;
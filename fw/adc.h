@@ -41,6 +41,8 @@
 void adc_init(void);
 void adc_shutdown(void);
 int  adc_get_reading(uint which);
+uint adc_get_seq(void);
 void adc_setup_sensor(uint which, uint gpio_pack, uint adc_channel);
+void adc_set_window(uint which, int calc_min, int calc_max);
 
 #endif /* _ADC_H */
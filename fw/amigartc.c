@@ -15,8 +15,8 @@
 #include <string.h>
 #include "printf.h"
 #include "main.h"
-#include "amigartc.h"
 #include "bec_cmd.h"
+#include "amigartc.h"
 #include "crc32.h"
 #include "config.h"
 #include "gpio.h"
@@ -53,9 +53,11 @@
 #define RAM_FUNCTION __attribute__((section(".ramtext")))
 
 #ifdef INTERRUPT_CAPTURE_RP5C01
-static uint16_t amigartc_cap[256];
-static uint16_t amigartc_tick[256];
-static uint8_t  amigartc_prod;
+/* RP5C01 access trace, in BEC_CMD_RTC_TRACE entry format */
+static uint32_t          amigartc_trace[AMIGARTC_TRACE_ENTS];
+static volatile uint32_t amigartc_trace_seq;     // Next entry to capture
+static uint32_t          amigartc_trace_last;    // TIM2 at last capture
+static volatile uint8_t  amigartc_trace_frozen;  // Capture stopped
 #endif
 
 volatile uint8_t rtc_data[4][0x10];
@@ -81,8 +83,8 @@ static const uint8_t rtc_mask[4][0x10] = {
 
 static const uint8_t bec_magic[] = { 0xc, 0xd, 0x6, 0x8 };
 
-uint8_t         bec_msg_inbuf[280];
-uint8_t         bec_msg_outbuf[280];
+uint8_t         bec_msg_inbuf[BEC_MSG_MAX_LEN];
+uint8_t         bec_msg_outbuf[BEC_MSG_MAX_LEN];
 uint            bec_msg_out_max;    // Message length in nibbles
 uint            bec_msg_out;        // Current send position in nibbles
 uint            bec_msg_in;         // Current receive position in nibbles
@@ -264,24 +266,80 @@ void
 amigartc_log(void)
 {
 #ifdef INTERRUPT_CAPTURE_RP5C01
-    uint cur = (amigartc_prod + 1) % ARRAY_SIZE(amigartc_cap);
-    while (cur != amigartc_prod) {
-        if ((amigartc_cap[cur] & RTCEN_PIN) == 0) {
-            uint16_t v = amigartc_cap[cur];
-
-            printf("%5u %04x %c %x = %x\n", amigartc_tick[cur], v,
-                   (v & R_WA_PIN) ? 'R' : 'W',
-                   (v >> 10) & 0xf,
-                   (v >> 4) & 0xf);
-        }
-        cur = (cur + 1) % ARRAY_SIZE(amigartc_cap);
+    uint32_t seq = amigartc_trace_seq;
+    uint32_t cur = 0;
+
+    amigartc_trace_frozen = 1;
+    if (amigartc_trace_seq > AMIGARTC_TRACE_ENTS)
+        cur = amigartc_trace_seq - AMIGARTC_TRACE_ENTS;
+    for (; cur != seq; cur++) {
+        uint32_t ent   = amigartc_trace[cur % AMIGARTC_TRACE_ENTS];
+        uint32_t delta = BRT_DELTA(ent) << AMIGARTC_TRACE_SHIFT;
+
+        printf("%c%7lu %c %u:%x = %x\n",
+               (BRT_DELTA(ent) == BRT_DELTA_MAX) ? '>' : '+',
+               (uint32_t) timer_tick_to_usec(delta),
+               (ent & BRT_READ) ? 'R' : 'W',
+               (uint) BRT_BANK(ent), (uint) BRT_ADDR(ent),
+               (uint) BRT_DATA(ent));
     }
-    memset(&amigartc_cap, 0xff, sizeof (amigartc_cap));
+    amigartc_trace_seq = 0;
+    amigartc_trace_frozen = 0;
 #else
     printf("RTC capture not enabled at compile-time\n");
 #endif
 }
 
+/*
+ * amigartc_trace_get
+ * ------------------
+ * Copies up to max trace entries (big endian) starting at the oldest
+ * entry which is at or after *seq. On return, *seq is updated to the
+ * first entry copied and *next is the sequence number of the next entry
+ * to be captured. Returns the number of entries copied. Flags are
+ * BEC_CMD_RTC_TRACE BRT_FLAG_* values.
+ */
+uint
+amigartc_trace_get(uint32_t *seq, uint32_t *next, uint32_t *buf, uint max,
+                   uint *flags)
+{
+#ifdef INTERRUPT_CAPTURE_RP5C01
+    uint32_t cur;
+    uint32_t oldest = 0;
+    uint     count = 0;
+
+    if (*flags & BRT_FLAG_FREEZE)
+        amigartc_trace_frozen = 1;
+
+    *next = amigartc_trace_seq;
+    if (*next > AMIGARTC_TRACE_ENTS)
+        oldest = *next - AMIGARTC_TRACE_ENTS;
+    cur = *seq;
+    if (cur < oldest) {
+        *flags |= BRT_FLAG_LOST;
+        cur = oldest;
+    }
+    *seq = cur;
+    for (; (cur < *next) && (count < max); cur++, count++)
+        buf[count] = __builtin_bswap32(amigartc_trace[cur %
+                                                      AMIGARTC_TRACE_ENTS]);
+    if (amigartc_trace_frozen)
+        *flags |= BRT_FLAG_FROZEN;
+
+    if (*flags & BRT_FLAG_RESUME) {
+        amigartc_trace_seq = 0;
+        amigartc_trace_last = TIM_CNT(TIM2);
+        amigartc_trace_frozen = 0;
+        *flags &= ~BRT_FLAG_FROZEN;
+    }
+    return (count);
+#else
+    *seq = 0;
+    *next = 0;
+    return (0);
+#endif
+}
+
 RAM_FUNCTION
 void
 exti0_isr(void)
@@ -366,7 +424,9 @@ exti0_isr(void)
                         }
                         if (bec_msg_in >= ARRAY_SIZE(bec_msg_inbuf) * 2) {
                             uint expected = BEC_MSG_HDR_LEN +
-                                            BEC_MSG_CRC_LEN + bec_msg_inbuf[3];
+                                            BEC_MSG_CRC_LEN +
+                                            ((bec_msg_inbuf[3] << 8) |
+                                             bec_msg_inbuf[4]);
                             if (bec_msg_in / 2 >= expected)
                                 break;  // Got message
                             bec_msg_in = 0;
@@ -433,9 +493,25 @@ exti0_isr(void)
             DPRINTF(" %x=%x", addr, data);
         }
 #ifdef INTERRUPT_CAPTURE_RP5C01
-        amigartc_cap[amigartc_prod] = gpio_value;
-        amigartc_tick[amigartc_prod] = TIM_CNT(TIM2);
-        amigartc_prod = (amigartc_prod + 1) % ARRAY_SIZE(amigartc_cap);
+        if (likely(amigartc_trace_frozen == 0)) {
+            uint32_t now   = TIM_CNT(TIM2);
+            uint32_t delta = (now - amigartc_trace_last) >>
+                             AMIGARTC_TRACE_SHIFT;
+            if (unlikely(delta > BRT_DELTA_MAX)) {
+                delta = BRT_DELTA_MAX;
+                amigartc_trace_last = now;
+            } else {
+                /* Carry ticks below delta resolution to the next entry */
+                amigartc_trace_last += delta << AMIGARTC_TRACE_SHIFT;
+            }
+            amigartc_trace[amigartc_trace_seq % AMIGARTC_TRACE_ENTS] =
+                    (delta << BRT_DELTA_SHIFT) |
+                    (rtc_cur_bank << 9) |
+                    ((gpio_value & R_WA_PIN) << 7) |    // R_WA -> BRT_READ
+                    ((gpio_value >> 6) & 0xf0) |        // A2-A5
+                    ((gpio_value >> 4) & 0x0f);         // D16-D19
+            amigartc_trace_seq++;
+        }
 #endif
         set_rtc_dx_input();  // Stop driving data pins
         return;
@@ -559,6 +635,9 @@ amigartc_copy_time_rp5c01_to_stm32(void)
     }
 // dprintf(DF_RTC, "%u-%u-%u %u:%u:%u", year, month, day, hour, minute, second);
 
+    if (hour_24)
+        rtc_trim_reference(year + 2000, month, day, hour, minute, second);
+
     rtc_allow_writes(TRUE);
     rtc_set_date(year, month, day, dow);
     rtc_set_time(hour, minute, second, am_pm, hour_24);
@@ -915,6 +994,7 @@ amigartc_init(void)
 
     msg_init();
 #ifdef INTERRUPT_CAPTURE_RP5C01
-    memset(&amigartc_cap, 0xff, sizeof (amigartc_cap));
+    amigartc_trace_seq = 0;
+    amigartc_trace_last = TIM_CNT(TIM2);
 #endif
 }
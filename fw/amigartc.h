@@ -12,16 +12,27 @@
 #ifndef _AMIGARTC_H
 #define _AMIGARTC_H
 
+#include "bec_cmd.h"
+
+/*
+ * RP5C01 access trace ring size. The time delta of each trace entry is
+ * in units of (1 << AMIGARTC_TRACE_SHIFT) TIM2 ticks.
+ */
+#define AMIGARTC_TRACE_ENTS   1024  // Must be a power of 2
+#define AMIGARTC_TRACE_SHIFT  4
+
 void amigartc_snoop(int debug);
 void amigartc_print(void);
 void amigartc_log(void);
+uint amigartc_trace_get(uint32_t *seq, uint32_t *next, uint32_t *buf,
+                        uint max, uint *flags);
 void amigartc_poll(void);
 void amigartc_reply_pending(void);
 void amigartc_reset(void);
 void amigartc_init(void);
 
-extern uint8_t  bec_msg_inbuf[280];
-extern uint8_t  bec_msg_outbuf[280];
+extern uint8_t  bec_msg_inbuf[BEC_MSG_MAX_LEN];
+extern uint8_t  bec_msg_outbuf[BEC_MSG_MAX_LEN];
 extern uint     bec_msg_in;         // Current receive position in nibbles
 extern uint     bec_msg_out;        // Current send position in nibbles
 extern uint     bec_msg_out_max;    // Message length in nibbles
@@ -43,6 +43,16 @@
 #define BEC_CMD_SET_MAP      0x0b  // Set map (keyboard, mouse, etc, macros)
 #define BEC_CMD_GET_MAP      0x0c  // Get map (keyboard, mouse, etc, macros)
 #define BEC_CMD_POLL_INPUT   0x0d  // Capture input (such as keystrokes)
+#define BEC_CMD_SET_MAP_BULK 0x0e  // Upload complete keymap image (atomic)
+#define BEC_CMD_BLK_INFO     0x0f  // Get USB mass storage unit information
+#define BEC_CMD_BLK_READ     0x10  // Read USB mass storage blocks
+#define BEC_CMD_BLK_WRITE    0x11  // Write USB mass storage blocks
+#define BEC_CMD_INPUT_SNAP   0x12  // Get all pending input in one reply
+#define BEC_CMD_SENSOR_HIST  0x13  // Get sensor history blocks
+#define BEC_CMD_RTC_TRACE    0x14  // Get RP5C01 bus access trace
+#define BEC_CMD_SNOOP        0x15  // Get GPIO bus sampler capture
+#define BEC_CMD_CONS_LZ      0x16  // Receive compressed console output
+#define BEC_CMD_FW_UPDATE    0x17  // Dual-slot firmware update
 
 /* Status codes returned by AmigaPCI STM32 */
 #define BEC_STATUS_OK        0x00  // Success
@@ -62,6 +72,11 @@
 #define BEC_MSG_HDR_LEN 5  // Number of bytes in Magic + cmd + length
 #define BEC_MSG_CRC_LEN 4  // Number of bytes in CRC
 
+/* Maximum payload length (block write request with BBK_MAX_BLOCKS) */
+#define BEC_MSG_MAX_PAYLOAD 1040
+#define BEC_MSG_MAX_LEN     (BEC_MSG_HDR_LEN + BEC_MSG_MAX_PAYLOAD + \
+                             BEC_MSG_CRC_LEN)
+
 /*
  * The below structure is a response to the following command:
  *    BEC_CMD_ID
@@ -94,6 +109,49 @@ typedef struct {
 #define BKM_WHICH_DEF_KEYMAP      0x11  // Default scancode mapping table
 #define BKM_WHICH_DEF_BUTTONMAP   0x12  // Default button mapping table
 
+/*
+ * The below structure is used for request of the following command:
+ *    BEC_CMD_SET_MAP_BULK
+ *
+ * A complete keymap image (see bec_keymap_image_t) is staged in BEC RAM
+ * by a BKB_OP_START request followed by one or more BKB_OP_DATA requests,
+ * each carrying the next portion of the image immediately after this
+ * structure. BKB_OP_COMMIT verifies the image CRC and then replaces both
+ * the keymap and button map as a single operation, with a single update
+ * of the BEC flash config area. BKB_OP_START carries the total image size
+ * in bkb_offset. All 16-bit values are big endian.
+ */
+typedef struct {
+    uint8_t  bkb_op;               // Operation (see BKB_OP_*)
+    uint8_t  bkb_unused;           // Unused (must be 0)
+    uint16_t bkb_offset;           // Offset of data in image (START: size)
+} bec_keymap_bulk_t;
+
+#define BKB_OP_START              0x01  // Begin new image upload
+#define BKB_OP_DATA               0x02  // Image data at bkb_offset
+#define BKB_OP_COMMIT             0x03  // Verify and apply the image
+
+/*
+ * Binary keymap image, used both for bulk upload to BEC and as the
+ * compiled keymap file format. The header is immediately followed by
+ * bki_keys keymap entries and then bki_buttons button map entries, each
+ * bki_esize bytes. Entries have the same layout as BKM_WHICH_KEYMAP and
+ * BKM_WHICH_BUTTONMAP entries. All multi-byte values are big endian.
+ * bki_crc is a CRC-32 of all data following the header.
+ */
+typedef struct {
+    uint32_t bki_magic;            // Image magic (BKI_MAGIC)
+    uint8_t  bki_version;          // Image format version (BKI_VERSION)
+    uint8_t  bki_esize;            // Size of single entry in bytes
+    uint16_t bki_keys;             // Count of keymap entries
+    uint16_t bki_buttons;          // Count of button map entries
+    uint16_t bki_unused;           // Unused (must be 0)
+    uint32_t bki_crc;              // CRC-32 of entry data
+} bec_keymap_image_t;
+
+#define BKI_MAGIC                 0x42454b4d  // "BEKM"
+#define BKI_VERSION               0x01
+
 /*
  * The below structure is used for the following command:
  *    BEC_CMD_POLL_INPUT
@@ -112,4 +170,264 @@ typedef struct {
 #define BKM_SOURCE_HID_SCANCODE   0x01  // Lightly processed HID scancodes
 #define BKM_SOURCE_AMIGA_SCANCODE 0x02  // Key scancodes to be sent to Amiga
 
+/*
+ * The below structure is used for request of the following command:
+ *    BEC_CMD_INPUT_SNAP
+ *
+ * Key capture is controlled as with BEC_CMD_POLL_INPUT. The reply is a
+ * sequence of TLV records, one for each item requested in bis_what which
+ * has data to report. Each record is a one byte type (BIS_TLV_*), a one
+ * byte length, and then the value. Records with an unknown type should
+ * be skipped. All multi-byte values are big endian.
+ */
+typedef struct {
+    uint8_t  bis_what;             // Items to report (BIS_WHAT_* bits)
+    uint8_t  bis_source;           // Key capture source (BKM_SOURCE_*)
+    uint16_t bis_timeout;          // Key capture timeout (0 = stop capture)
+    uint8_t  bis_keys;             // Maximum key capture pairs to report
+    uint8_t  bis_cons;             // Maximum console output bytes to report
+    uint16_t bis_unused;           // Unused (must be 0)
+} bec_input_snap_t;
+
+#define BIS_WHAT_KEYS             0x01  // Captured keys
+#define BIS_WHAT_MOUSE            0x02  // Mouse motion since last snapshot
+#define BIS_WHAT_BUTTONS          0x04  // Mouse and joystick buttons
+#define BIS_WHAT_JOYSTICK         0x08  // Joystick directions
+#define BIS_WHAT_CONSOLE          0x10  // BEC console output
+
+#define BIS_TLV_KEYS     0x01  // Capture pairs (scancode, KEYCAP_* >> 8)
+#define BIS_TLV_MOUSE    0x02  // int16_t X, Y, wheel, pan (omitted if none)
+#define BIS_TLV_BUTTONS  0x03  // uint32_t mouse buttons, joystick buttons
+#define BIS_TLV_JOYSTICK 0x04  // uint8_t directions (BIS_JOY_* bits)
+#define BIS_TLV_CONSOLE  0x05  // Console output text
+
+#define BIS_JOY_UP                0x01
+#define BIS_JOY_DOWN              0x02
+#define BIS_JOY_LEFT              0x04
+#define BIS_JOY_RIGHT             0x08
+
+/*
+ * The below structure is used for request / response of the following
+ * commands:
+ *    BEC_CMD_BLK_INFO
+ *    BEC_CMD_BLK_READ
+ *    BEC_CMD_BLK_WRITE
+ *
+ * Units are the logical units of USB Mass Storage devices attached to
+ * the BEC, numbered from 0. BEC_CMD_BLK_INFO returns the number of
+ * available units in bbk_count and the number of blocks of the requested
+ * unit in bbk_lba. BEC_CMD_BLK_READ reply data and BEC_CMD_BLK_WRITE
+ * request data (bbk_count * bbk_blksize bytes) immediately follow the
+ * structure. All multi-byte values are big endian.
+ */
+typedef struct {
+    uint8_t  bbk_unit;             // Unit number
+    uint8_t  bbk_count;            // Count of blocks (INFO reply: units)
+    uint16_t bbk_blksize;          // Size of a single block in bytes
+    uint32_t bbk_lba;              // First block (INFO reply: total blocks)
+} bec_blk_t;
+
+#define BBK_BLOCK_SIZE            512  // Only supported block size
+#define BBK_MAX_BLOCKS            2    // Maximum blocks per message
+
+/*
+ * The below structure is used for request / response of the following
+ * command:
+ *    BEC_CMD_SENSOR_HIST
+ *
+ * The BEC records a sample of all sensors at a fixed interval into a
+ * ring of fixed-size history blocks. Blocks are numbered by a sequence
+ * number which increments for each new block. The request specifies the
+ * first block wanted and the oldest time of interest (msec since BEC
+ * boot). The reply returns as many consecutive blocks as will fit,
+ * starting at the first block still held by the BEC which is at or after
+ * bsh_seq and which contains samples at or after bsh_time. Each block is
+ * a bec_hist_blk_t header, followed by bhb_len bytes of sample data.
+ *
+ * The first sample of each block is a keyframe of absolute readings, as
+ * a 32-bit value per sensor. Each subsequent sample is a varint of msec
+ * elapsed since the previous sample, followed by a zigzag-encoded varint
+ * per sensor of the change in reading since the previous sample. Varints
+ * are 7 bits per byte, least significant first, with bit 7 set in all
+ * but the last byte. Readings are in milli-units.
+ *
+ * If BSH_FLAG_NAMES is specified in the request, the reply instead
+ * contains "name\0unit\0" string pairs for each sensor, in block order.
+ * All multi-byte values are big endian.
+ */
+typedef struct {
+    uint32_t bsh_seq;              // First block (reply: first block sent)
+    uint32_t bsh_time;             // Oldest msec wanted (reply: BEC msec now)
+    uint32_t bsh_last;             // Reply: newest block held by BEC
+    uint8_t  bsh_count;            // Max blocks (reply: blocks sent)
+    uint8_t  bsh_flags;            // Request flags (BSH_FLAG_*)
+    uint8_t  bsh_sensors;          // Reply: count of sensors per sample
+    uint8_t  bsh_unused;           // Unused (must be 0)
+} bec_sensor_hist_t;
+
+#define BSH_FLAG_NAMES            0x01  // Report sensor names and units
+
+typedef struct {
+    uint32_t bhb_seq;              // Block sequence number
+    uint32_t bhb_time;             // Keyframe msec since BEC boot
+    uint16_t bhb_len;              // Bytes of sample data which follow
+    uint8_t  bhb_samples;          // Count of samples in block
+    uint8_t  bhb_sensors;          // Count of sensors per sample
+} bec_hist_blk_t;
+
+#define BSH_BLOCK_SIZE            256  // Maximum size of block + header
+
+/*
+ * The below structure is used for request / response of the following
+ * command:
+ *    BEC_CMD_RTC_TRACE
+ *
+ * The BEC records every Amiga access to the emulated RP5C01 into a ring
+ * of 32-bit trace entries, numbered by a sequence number which increments
+ * for each access. The request specifies the first entry wanted. The
+ * reply returns as many consecutive entries as will fit, starting at the
+ * oldest entry still held by the BEC which is at or after brt_seq.
+ *
+ * Reading the trace through the RTC mailbox generates more RTC accesses,
+ * so the request may freeze capture (BRT_FLAG_FREEZE) before the trace
+ * is read, and then resume capture with an empty ring (BRT_FLAG_RESUME)
+ * when done. A request with neither flag and brt_count of 0 only reports
+ * capture state.
+ *
+ * Each entry holds the access and the time since the previous entry in
+ * units of (1 << brt_shift) ticks of a brt_tick_hz clock. A time delta of
+ * BRT_DELTA_MAX means that at least that much time had elapsed. All
+ * multi-byte values are big endian.
+ */
+typedef struct {
+    uint32_t brt_seq;              // First entry (reply: first entry sent)
+    uint32_t brt_next;             // Reply: sequence of next entry captured
+    uint32_t brt_tick_hz;          // Reply: capture timer frequency
+    uint16_t brt_count;            // Max entries (reply: entries sent)
+    uint8_t  brt_flags;            // Request flags (BRT_FLAG_*)
+    uint8_t  brt_shift;            // Reply: time delta scale
+} bec_rtc_trace_t;
+
+#define BRT_FLAG_FREEZE           0x01  // Stop capture before reply
+#define BRT_FLAG_RESUME           0x02  // Clear and restart capture after
+#define BRT_FLAG_FROZEN           0x04  // Reply: capture is stopped
+#define BRT_FLAG_LOST             0x08  // Reply: requested entries overwritten
+
+#define BRT_DATA(x)       ((x) & 0xf)           // Data nibble (D16-D19)
+#define BRT_ADDR(x)       (((x) >> 4) & 0xf)    // Register (A2-A5)
+#define BRT_READ          0x00000100            // Amiga read (else write)
+#define BRT_BANK(x)       (((x) >> 9) & 0x3)    // RP5C01 bank at access
+#define BRT_DELTA_SHIFT   12
+#define BRT_DELTA_MAX     0xfffff
+#define BRT_DELTA(x)      ((x) >> BRT_DELTA_SHIFT)
+
+/*
+ * The below structure is used for request / response of the following
+ * command:
+ *    BEC_CMD_SNOOP
+ *
+ * The BEC "snoop" command samples a GPIO port at a fixed rate, before and
+ * after a trigger condition. The request specifies the first sample wanted
+ * and the maximum number of runs to return. The reply returns the capture
+ * as bec_snoop_run_t runs of identical consecutive samples, starting at
+ * bsn_pos. All multi-byte values are big endian.
+ */
+typedef struct {
+    uint32_t bsn_rate;             // Reply: sample rate in Hz
+    uint16_t bsn_pos;              // First sample (reply: first sample sent)
+    uint16_t bsn_samples;          // Reply: total samples in capture
+    uint16_t bsn_trigger;          // Reply: sample number of trigger
+    uint16_t bsn_count;            // Max runs (reply: runs sent)
+    uint8_t  bsn_port;             // Reply: GPIO port sampled ('A' - 'E')
+    uint8_t  bsn_flags;            // Reply: BSN_FLAG_*
+    uint16_t bsn_unused;           // Unused (must be 0)
+} bec_snoop_t;
+
+#define BSN_FLAG_TRIGGERED        0x01  // Reply: trigger condition was met
+
+typedef struct {
+    uint16_t bsr_value;            // GPIO input data register value
+    uint16_t bsr_count;            // Number of consecutive samples
+} bec_snoop_run_t;
+
+/*
+ * The below structure is used for request / response of the following
+ * command:
+ *    BEC_CMD_CONS_LZ
+ *
+ * The request specifies the maximum number of console output bytes
+ * wanted. The reply is the number of console output bytes, followed by
+ * those bytes compressed with LZSS. Firmware which does not support this
+ * command replies BEC_STATUS_UNKCMD, and BEC_CMD_CONS_OUTPUT must then
+ * be used.
+ *
+ * The LZSS stream is a sequence of groups, each of which is a flag byte
+ * followed by up to 8 items. Flag bit 0 describes the first item. A clear
+ * bit is a literal byte. A set bit is a big endian 16-bit match, where
+ * bits 4-15 are the distance back in the output minus 1, and bits 0-3
+ * are the match length minus BCL_MIN_MATCH. Matches do not reach back
+ * into the output of a previous reply.
+ */
+typedef struct {
+    uint16_t bcl_len;              // Max bytes (reply: uncompressed length)
+} bec_cons_lz_t;
+
+#define BCL_MIN_MATCH             3     // Shortest match
+#define BCL_MAX_MATCH             18    // Longest match
+#define BCL_WINDOW                4096  // Farthest match distance
+#define BCL_MAX_LEN               1024  // Maximum bytes in one reply
+
+/*
+ * The below structure is used for request / response of the following
+ * command:
+ *    BEC_CMD_FW_UPDATE
+ *
+ * A new firmware image is written to the slot which BEC is not running
+ * from, and then BEC is told to boot that slot on a trial basis. Every
+ * request receives this structure as reply, describing update progress.
+ *
+ * BFU_OP_START begins an update; bfu_offset holds the image size and
+ * bfu_crc the CRC-32 of the complete image. The target slot is erased in
+ * the background, during which BEC may not respond to messages for a few
+ * seconds. BFU_OP_STATUS should be polled until bfu_phase changes to
+ * BFU_PHASE_WRITE. BFU_OP_DATA carries image data at bfu_offset, directly
+ * following this structure, and bfu_crc holds the CRC-32 of that data. BEC
+ * verifies the CRC of what it programmed to flash before replying. Data
+ * must be sent in order, but a block may be resent. BFU_OP_COMMIT verifies
+ * the complete image and records the new slot as the one to boot; with
+ * BFU_FLAG_REBOOT, BEC then restarts. The image must be linked for the
+ * target slot (fw_slot0.bin or fw_slot1.bin). If the new image does not
+ * confirm itself after starting, BEC reverts to the previous slot.
+ * All multi-byte values are big endian.
+ */
+typedef struct {
+    uint8_t  bfu_op;               // Operation (see BFU_OP_*)
+    uint8_t  bfu_flags;            // Flags (see BFU_FLAG_*)
+    uint8_t  bfu_slot;             // Reply: target slot
+    uint8_t  bfu_running;          // Reply: slot BEC is running from
+    uint8_t  bfu_phase;            // Reply: update phase (see BFU_PHASE_*)
+    uint8_t  bfu_state;            // Reply: boot state of running slot
+    uint16_t bfu_unused;           // Unused (must be 0)
+    uint32_t bfu_offset;           // Offset of data (START: image size)
+    uint32_t bfu_crc;              // CRC-32 of data (START: of image)
+} bec_fw_update_t;
+
+#define BFU_OP_STATUS             0x00  // Report update progress
+#define BFU_OP_START              0x01  // Begin new image upload
+#define BFU_OP_DATA               0x02  // Image data at bfu_offset
+#define BFU_OP_COMMIT             0x03  // Verify image and switch slots
+#define BFU_OP_CONFIRM            0x04  // Mark running trial image good
+
+#define BFU_FLAG_REBOOT           0x01  // COMMIT: restart BEC after reply
+
+#define BFU_PHASE_IDLE            0x00  // No update in progress
+#define BFU_PHASE_ERASE           0x01  // Target slot is being erased
+#define BFU_PHASE_WRITE           0x02  // Accepting image data
+#define BFU_PHASE_READY           0x03  // Committed; boots at next reset
+
+#define BFU_STATE_GOOD            0x01  // Running image is confirmed
+#define BFU_STATE_TRIAL           0x02  // Running image is on trial
+
+#define BFU_SLOT_NONE             0xff  // BEC is not running from a slot
+
 #endif  /* _BEC_CMD_H */
@@ -0,0 +1,110 @@
+/*
+ * This is free and unencumbered software released into the public domain.
+ * See the LICENSE file for additional details.
+ *
+ * Designed by Chris Hooper in 2025.
+ *
+ * ---------------------------------------------------------------------
+ *
+ * Dual-slot boot loader. Selects the firmware slot to run from the boot
+ * state records (see fwslot.h) and jumps to it. The boot loader never
+ * writes flash; the firmware records slot changes, confirms a trial
+ * image, and records a rollback once it is running.
+ *
+ * The boot loader must not use initialized or zeroed SRAM variables, as
+ * those would overlap SRAM_PERSIST data of the firmware.
+ */
+
+#include <stdint.h>
+#include <stddef.h>
+#include "main.h"
+#include "fwslot.h"
+#include "utils.h"
+#include <libopencm3/cm3/scb.h>
+#include <libopencm3/stm32/flash.h>
+#include <libopencm3/stm32/iwdg.h>
+#include <libopencm3/stm32/pwr.h>
+#include <libopencm3/stm32/rcc.h>
+#include <libopencm3/stm32/rtc.h>
+
+#define SYSTEM_MEMORY_BASE 0x1fff0000  // STM32F2xx ROM (DFU) boot loader
+
+/*
+ * boot_jump
+ * ---------
+ * Starts the image with the vector table at the specified address.
+ */
+static void __attribute__((noreturn))
+boot_jump(uint32_t addr)
+{
+    uint32_t *base = ADDR32(addr);
+
+    /* Set the vector table pointer */
+    SCB_VTOR = addr;
+    __asm__ volatile("dmb");
+
+    /* Set the stack pointer */
+    __asm__("MSR msp, %0" : : "r" (base[0]));   // SP = base[0]
+    /* Set the program counter (jump) */
+    __asm__("BX %0\n\t" : : "r" (base[1]));     // PC = base[1]
+    while (1)
+        ;
+}
+
+/*
+ * boot_trial_count
+ * ----------------
+ * Counts one more boot attempt of a trial image. Returns non-zero if the
+ * trial image has used all of its attempts and should be abandoned.
+ */
+static uint
+boot_trial_count(void)
+{
+    uint32_t val = RTC_BKPXR(FWSLOT_BKP_TRIES);
+
+    if ((val & 0xffff0000) != FWSLOT_BKP_MAGIC)
+        val = FWSLOT_BKP_MAGIC;
+    if ((val & FWSLOT_BKP_COUNT) >= FWSLOT_TRIAL_BOOTS) {
+        RTC_BKPXR(FWSLOT_BKP_TRIES) = val | FWSLOT_BKP_ROLLBACK;
+        return (1);
+    }
+    RTC_BKPXR(FWSLOT_BKP_TRIES) = val + 1;
+    return (0);
+}
+
+int
+main(void)
+{
+    const fwslot_state_t *state;
+    uint copy;
+    uint next;
+    uint slot = 0;
+    uint other;
+
+    /* Backup registers hold the trial boot count */
+    RCC_APB1ENR |= RCC_APB1ENR_PWREN;
+    PWR_CR |= PWR_CR_DBP;
+
+    state = fwslot_state_find(&copy, &next);
+    if (state != NULL) {
+        slot = state->fbs_active;
+        if (state->fbs_state == FBS_STATE_TRIAL) {
+            if (boot_trial_count()) {
+                slot ^= 1;  // Give up on trial image -- roll back
+            } else {
+                /* A hung trial image will reset and be counted again */
+                iwdg_set_period_ms(FWSLOT_TRIAL_WDOG);
+                iwdg_start();
+            }
+        }
+    }
+
+    other = slot ^ 1;
+    if (fwslot_image_valid(slot, state))
+        boot_jump(FLASH_BASE + FWSLOT_ADDR(slot));
+    if (fwslot_image_valid(other, state))
+        boot_jump(FLASH_BASE + FWSLOT_ADDR(other));
+
+    /* No bootable image -- fall back to ROM DFU for recovery */
+    boot_jump(SYSTEM_MEMORY_BASE);
+}
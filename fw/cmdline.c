@@ -100,8 +100,13 @@ static const cmd_t cmd_list[] = {
 #ifdef EMBEDDED_CMD
     { cmd_set,     "set",     0, cmd_set_help, "", "[bank|led|mode|name]" },
 #endif
-#ifdef HAVE_SPACE_PROM
-    { cmd_snoop,   "snoop",   0, cmd_snoop_help, "", "snoop ROM" },
+#ifdef EMBEDDED_CMD
+    { cmd_slot,    "slot",    0, cmd_slot_help, " [confirm|switch]",
+                        "show or change firmware slot" },
+#endif
+#ifdef EMBEDDED_CMD
+    { cmd_snoop,   "snoop",   0, cmd_snoop_help, " [change|now|trig|show]",
+                        "sample GPIO bus" },
 #endif
     { cmd_time,    "time",    0, cmd_time_help, " cmd|now|watch>",
                         "measure or show time" },
@@ -25,13 +25,14 @@
 CC_ASSERT_SIZE(config_t, 2048);
 
 #define CONFIG_MAGIC     0x19460602
-#define CONFIG_VERSION   0x01
+#define CONFIG_VERSION   0x02
 #define CONFIG_AREA_BASE 0x0060000
 #define CONFIG_AREA_SIZE 0x0020000  // 128 KB
 #define CONFIG_AREA_END  (CONFIG_AREA_BASE + CONFIG_AREA_SIZE)
 
 uint64_t config_timer = 0;
 uint8_t  cold_poweron = 0;
+uint     config_gen = 1;  // Incremented each time config is changed
 
 config_t config;
 
@@ -39,6 +40,7 @@ void
 config_updated(void)
 {
     config_timer = timer_tick_plus_msec(1000);
+    config_gen++;
 }
 
 /*
@@ -117,6 +119,7 @@ config_set_defaults(void)
     config.fan_temp_max = 40;         // Temperature (C) for maximum fan speed
     config.fan_temp_min = 21;         // Temperature (C) for minimum fan speed
     config.fan_rpm_max = 2200;        // Fan maximum RPM
+    config.rtc_trim = RTC_TRIM_UNKNOWN; // Taken from RTC at rtc_init()
 #undef AMIGAPCI
 #ifdef AMIGAPCI
     config.board_rev = 6;             // Current version of AmigaPCI
@@ -157,6 +160,11 @@ config_read(void)
                 if (cfgsize > sizeof (config))
                     cfgsize = sizeof (config);
                 memcpy(&config, (void *) addr, cfgsize);
+                if (ptr->version < 0x02) {
+                    /* Saved before the stick settings and RTC trim existed */
+                    config.stick_deadzone = STICK_DEF_DEADZONE;
+                    config.rtc_trim       = RTC_TRIM_UNKNOWN;
+                }
                 if (config.name[0] != '\0')
                     printf("    %s\n", config.name);
                 config.version = CONFIG_VERSION;
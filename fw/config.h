@@ -46,6 +46,10 @@
 #define CF_HAVE_FAN         0x00000100  // Board has fan attached
 #define CF_KEYBOARD_NOSYNC  0x00000200  // Skip sync for Amiga keyboard
 #define CF_KEYBOARD_SWAPALT 0x00000400  // Swap Alt and Amiga keys
+#define CF_POWER_FAULT_OFF  0x00000800  // Power off on supply rail fault
+
+/* config.rtc_trim of a config saved before the trim was learned */
+#define RTC_TRIM_UNKNOWN    (-0x7fff - 1)
 
 typedef struct {
     uint32_t    magic;          // Structure magic
@@ -79,10 +83,16 @@ typedef struct {
     uint8_t     mouse_mul_y;    // Mouse Y speed scaling factor
     uint16_t    i2c_max_speed;  // I2C maximum speed
     uint16_t    i2c_min_speed;  // I2C minimum speed
-    uint8_t     unused[616];    // Unused
+    int16_t     rtc_trim;       // RTC drift trim (1/16 ppm)
+    uint8_t     joy_autofire[32];  // Joystick button autofire rate (Hz)
+    uint8_t     stick_deadzone; // Gamepad mouse dead zone (% of travel)
+    uint8_t     stick_expo;     // Gamepad mouse curve (0=linear, 100=cubic)
+    uint16_t    stick_speed;    // Gamepad mouse top speed (counts/sec)
+    uint8_t     unused[578];    // Unused
 } config_t;
 
 extern config_t config;
+extern uint     config_gen;
 
 void config_updated(void);
 void config_poll(void);
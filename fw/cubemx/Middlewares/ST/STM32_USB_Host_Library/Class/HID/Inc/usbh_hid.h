@@ -244,6 +244,17 @@ typedef struct
   uint8_t  lock;
 } FIFO_TypeDef;
 
+#define HID_REPORT_MAX  64  // Largest input report which is decoded
+#define HID_REPORT_IDS  3   // Report IDs per interface tracked for changes
+
+/* Last input report received with a given Report ID */
+typedef struct
+{
+  uint32_t data[HID_REPORT_MAX / 4];
+  uint8_t  len;                // Length of report (0 = entry not in use)
+  uint8_t  id;                 // Report ID (first byte of report)
+} HID_LastReportTypeDef;
+
 
 /* Structure for HID handle */
 struct _HID_HandleTypeDef
@@ -264,8 +275,14 @@ struct _HID_HandleTypeDef
   uint32_t             timer;
   uint8_t              DataReady;
   uint8_t              error_count;
+  uint8_t              report_last_next;  // Next report_last[] to replace
   HID_DescTypeDef      HID_Desc;
   HID_RDescTypeDef     HID_RDesc;
+  HID_LastReportTypeDef report_last[HID_REPORT_IDS];
+  int                  accum_x;     // Fractional mouse X movement
+  int                  accum_y;     // Fractional mouse Y movement
+  int16_t              abs_x_last;  // Last absolute pointer X position
+  int16_t              abs_y_last;  // Last absolute pointer Y position
   USBH_StatusTypeDef(* Init)(USBH_HandleTypeDef *phost, HID_HandleTypeDef *HID_Handle);
   USBH_StatusTypeDef(* Vendor)(USBH_HandleTypeDef *phost, HID_HandleTypeDef *HID_Handle);  // Vendor-specific init
   struct _HID_HandleTypeDef *next;
@@ -375,6 +392,8 @@ typedef struct
   int8_t               y;           // Mouse Y movement
   int8_t               wheel;       // Mouse Wheel movement
   int8_t               ac_pan;      // Mouse Left-Right movement
+  int16_t              stick_x;     // Joystick X position (analog)
+  int16_t              stick_y;     // Joystick Y position (analog)
   uint16_t             sysbuttons;  // System buttons (power, sleep, wake)
   uint16_t             mm_key[2];   // Multimedia key(s)
   uint16_t             sysctl;      // System control button(s)
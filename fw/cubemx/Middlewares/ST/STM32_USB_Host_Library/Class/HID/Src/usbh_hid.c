@@ -169,7 +169,7 @@ void USBH_HID_Process_HIDReportDescriptor(USBH_HandleTypeDef *phost, HID_HandleT
     HID_RDescTypeDef *rd = &HID_Handle->HID_RDesc;
     uint16_t usage_array[16];
     uint8_t  usage_count = 0;
-    uint8_t  report_id;
+    uint8_t  report_id = 0;  // Reports have no ID until one is declared
     const uint8_t *desc = (const uint8_t *) phost->device.Data;
 #ifdef DEBUG_HIDREPORT_DESCRIPTOR
     const char *spaces = "                 ";
@@ -1630,6 +1630,30 @@ readbits_joy(void *ptr, uint startbit, uint bits, int offset)
     return (val);
 }
 
+/*
+ * readbits_stick() reads an analog joystick axis, scaled so that full
+ *                  deflection is +/-32767. A zero offset indicates the
+ *                  axis is reported as a signed value.
+ */
+static int
+readbits_stick(void *ptr, uint startbit, uint bits, int offset)
+{
+    int val;
+
+    if ((bits == 0) || (bits > 16))
+        return (0);
+    if (offset == 0)
+        val = readbits(ptr, startbit, bits, 1);
+    else
+        val = readbits(ptr, startbit, bits, 0) + offset;
+    val = val * 32767 / (int) BIT(bits - 1);
+    if (val > 32767)
+        val = 32767;
+    else if (val < -32767)
+        val = -32767;
+    return (val);
+}
+
 static uint8_t
 readbits_jpad(void *ptr, uint16_t *startbits)
 {
@@ -1660,9 +1684,57 @@ readbits_buttons(void *ptr, HID_RDescTypeDef *rd)
     return (buttons);
 }
 
+/*
+ * hid_report_changed() compares an input report with the previous one
+ * this interface sent with the same Report ID, and then remembers it.
+ * Reports of devices which do not use Report IDs are all compared
+ * against the immediately preceding report.
+ *
+ * Returns non-zero if the report differs from the previous one.
+ */
+static uint
+hid_report_changed(HID_HandleTypeDef *HID_Handle, const uint32_t *report,
+                   uint len)
+{
+    HID_RDescTypeDef      *rd = &HID_Handle->HID_RDesc;
+    HID_LastReportTypeDef *last;
+    uint8_t                id = 0;
+    uint                   cur;
+
+    if ((rd->id_mouse != 0) || (rd->id_consumer != 0) ||
+        (rd->id_sysctl != 0) ||
+        ((rd->num_mmbuttons != 0) && (rd->id_mmbutton[0] != 0))) {
+        id = *(const uint8_t *) report;
+    }
+
+    for (cur = 0; cur < HID_REPORT_IDS; cur++) {
+        last = &HID_Handle->report_last[cur];
+        if ((last->len != 0) && (last->id == id))
+            break;
+    }
+    if (cur == HID_REPORT_IDS) {
+        /* Not seen yet -- replace the oldest entry */
+        last = &HID_Handle->report_last[HID_Handle->report_last_next];
+        if (++HID_Handle->report_last_next >= HID_REPORT_IDS)
+            HID_Handle->report_last_next = 0;
+        last->id  = id;
+        last->len = 0;
+    }
+
+    if ((last->len == len) && (memcmp(last->data, report, len) == 0))
+        return (0);
+
+    memcpy(last->data, report, len);
+    last->len = len;
+    return (1);
+}
+
 /**
   * @brief  USBH_HID_DecodeReport
   *         The function gets and decodes mouse and generic data.
+  *         Joystick, gamepad, and other state reports which are identical
+  *         to the previous report from the same interface and Report ID
+  *         are not decoded; USBH_BUSY is returned for those.
   * @param  phost: Host handle
   * @retval USBH Status
   */
@@ -1670,11 +1742,11 @@ USBH_StatusTypeDef
 USBH_HID_DecodeReport(USBH_HandleTypeDef *phost, HID_HandleTypeDef *HID_Handle, HID_TypeTypeDef devtype, HID_MISC_Info_TypeDef *report_info)
 {
     HID_RDescTypeDef *rd = &HID_Handle->HID_RDesc;
-    uint32_t          report_data[4];
-    static uint32_t   report_last[ARRAY_SIZE(report_data)];
-    uint16_t          len = sizeof (report_data);
+    uint32_t          report_data[HID_REPORT_MAX / 4 + 1];  // +1 readbits()
+    uint16_t          len = HID_REPORT_MAX;
     uint button;
     uint rlen;
+    uint changed;
 
     if (HID_Handle == NULL)
         return USBH_FAIL;
@@ -1692,6 +1764,15 @@ USBH_HID_DecodeReport(USBH_HandleTypeDef *phost, HID_HandleTypeDef *HID_Handle,
     if (rlen > 0) {
         uint cur;
         uint8_t id = report_data[0];
+
+        if (rd->pos_jpad[0] &&
+            (phost->device.DevDesc.idVendor == 0x057e) &&
+            (phost->device.DevDesc.idProduct == 0x2009)) {
+            /* EasySMX PC USB controller adds timestamp to report */
+            report_data[0] &= ~0x00ff00;  // Clobber timestamp
+        }
+        changed = hid_report_changed(HID_Handle, report_data, rlen);
+
         memset(report_info, 0, sizeof (*report_info));
         report_info->usage = rd->usage;
 
@@ -1699,13 +1780,16 @@ USBH_HID_DecodeReport(USBH_HandleTypeDef *phost, HID_HandleTypeDef *HID_Handle,
             ((rd->id_mouse == 0) && (devtype == HID_MOUSE))) {
             int16_t x;
             int16_t y;
-            int     mul_x = config.mouse_mul_x;
-            int     div_x = config.mouse_div_x;
-            int     mul_y = config.mouse_mul_y;
-            int     div_y = config.mouse_div_y;
-            static  int accum_x;
-            static  int accum_y;
+            int     mul_x;
+            int     div_x;
+            int     mul_y;
+            int     div_y;
 is_mouse:
+            /* Set after the label, as a pointer device may jump here */
+            mul_x = config.mouse_mul_x;
+            div_x = config.mouse_div_x;
+            mul_y = config.mouse_mul_y;
+            div_y = config.mouse_div_y;
             dprintf(DF_USB_DECODE_MOUSE, "\n%08lx %08lx ",
                     report_data[0], report_data[1]);
 
@@ -1713,16 +1797,14 @@ is_mouse:
             x = readbits(report_data, rd->pos_x, rd->bits_x, 1);
             y = readbits(report_data, rd->pos_y, rd->bits_y, 1);
             if (rd->dev_flag & DEV_FLAG_ABSOLUTE) {
-                static int16_t x_last;
-                static int16_t y_last;
-                int16_t        temp;
+                int16_t temp;
                 temp = x;
-                x -= x_last;
-                x_last = temp;
+                x -= HID_Handle->abs_x_last;
+                HID_Handle->abs_x_last = temp;
 
                 temp = y;
-                y -= y_last;
-                y_last = temp;
+                y -= HID_Handle->abs_y_last;
+                HID_Handle->abs_y_last = temp;
 
                 x /= 4;  // Assume screen has higher X resolution
                 y /= 8;
@@ -1746,13 +1828,13 @@ is_mouse:
              * The below code handles fractional mouse movements by
              * remembering the remainder from previous mouse input.
              */
-            accum_x       += x * mul_x;
-            report_info->x = accum_x / div_x;
-            accum_x       -= (report_info->x * div_x);
+            HID_Handle->accum_x += x * mul_x;
+            report_info->x       = HID_Handle->accum_x / div_x;
+            HID_Handle->accum_x -= (report_info->x * div_x);
 
-            accum_y       += y * mul_y;
-            report_info->y = accum_y / div_y;
-            accum_y       -= (report_info->y * div_y);
+            HID_Handle->accum_y += y * mul_y;
+            report_info->y       = HID_Handle->accum_y / div_y;
+            HID_Handle->accum_y -= (report_info->y * div_y);
 
             if (rd->bits_wheel != 0) {
                 report_info->wheel = readbits(report_data, rd->pos_wheel,
@@ -1779,11 +1861,25 @@ is_mouse:
             goto is_mouse;
         } else if ((rd->usage == HID_USAGE_JOYSTICK) ||
                    (rd->usage == HID_USAGE_GAMEPAD)) {
+            /*
+             * Gamepads typically stream identical reports at the poll
+             * rate. Everything decoded from them is a level, except for
+             * wheel and pan which repeat while held in gamepad mouse mode.
+             */
+            if (!changed &&
+                (((config.flags & CF_GAMEPAD_MOUSE) == 0) ||
+                 ((rd->bits_wheel == 0) && (rd->bits_ac_pan == 0)))) {
+                return (USBH_BUSY);
+            }
             report_info->buttons = readbits_buttons(report_data, rd);
             report_info->x = readbits_joy(report_data, rd->pos_x,
                                           rd->bits_x, rd->offset_xy);
             report_info->y = readbits_joy(report_data, rd->pos_y,
                                           rd->bits_y, rd->offset_xy);
+            report_info->stick_x = readbits_stick(report_data, rd->pos_x,
+                                                  rd->bits_x, rd->offset_xy);
+            report_info->stick_y = readbits_stick(report_data, rd->pos_y,
+                                                  rd->bits_y, rd->offset_xy);
             if (rd->pos_jpad[0] != 0) {
                 report_info->flags |= MI_FLAG_HAS_JPAD;  // Has joypad
                 report_info->jpad = readbits_jpad(report_data,
@@ -1801,28 +1897,17 @@ is_mouse:
                                                   rd->bits_wheel,
                                                   rd->offset_xy);
             }
-            if (config.debug_flag & DF_USB_DECODE_JOY) {
-                if (rd->pos_jpad[0] &&
-                    (phost->device.DevDesc.idVendor == 0x057e) &&
-                    (phost->device.DevDesc.idProduct == 0x2009)) {
-                    /* EasySMX PC USB controller adds timestamp to report */
-                    report_data[0] &= ~0x00ff00;  // Clobber timestamp
-                }
-                if (memcmp(report_data, report_last, 12) != 0) {
-                    memcpy(report_last, report_data, sizeof (report_last));
-                    printf("\n%08lx %08lx %08lx",
-                           report_data[0], report_data[1], report_data[2]);
-                    printf(" [%d %d %d %d] ", report_info->x, report_info->y,
-                           report_info->ac_pan, report_info->wheel);
-                }
+            if ((config.debug_flag & DF_USB_DECODE_JOY) && changed) {
+                printf("\n%08lx %08lx %08lx",
+                       report_data[0], report_data[1], report_data[2]);
+                printf(" [%d %d %d %d] ", report_info->x, report_info->y,
+                       report_info->ac_pan, report_info->wheel);
             }
         } else {
-            if ((config.debug_flag & DF_USB_DECODE_JOY) &&
-                (memcmp(report_data, report_last, sizeof (report_data)) != 0)) {
+            if ((config.debug_flag & DF_USB_DECODE_JOY) && changed) {
                 printf("\n%08lx %08lx %08lx %08lx",
                        report_data[0], report_data[1], report_data[2],
                        report_data[3]);
-                memcpy(report_last, report_data, sizeof (report_last));
             }
 //          dprintf(DF_USB_DECODE_MISC, "Misc ID %x", id);
         }
@@ -32,6 +32,8 @@
 #define BIT(x)      (1U << (x))
 #endif
 
+#define HUB_ENUM_TIMEOUT    3000  // msec for a new device to be addressed
+
 //#include "usbh_msc.h"
 // #include "stm32f4xx_hal.h"
 // #include "stm32f4xx_hal_hcd.h"
@@ -52,7 +54,8 @@ static uint8_t get_port_changed(uint port);
 static uint8_t port_changed(uint port, uint8_t *b);
 static void detach(USBH_HandleTypeDef *phost, uint16_t idx);
 static void attach(USBH_HandleTypeDef *phost, uint16_t idx, uint8_t lowspeed);
-static uint8_t attach_is_complete(USBH_HandleTypeDef *phost, uint16_t idx);
+static uint8_t attach_is_addressed(USBH_HandleTypeDef *phost, uint16_t idx);
+static void hub_wait(HUB_HandleTypeDef *HUB_Handle, uint32_t msec, HUB_StateTypeDef next);
 static void debug_port(uint port, uint8_t *buff, __IO USB_HUB_PORT_STATUS *info);
 
 static USBH_StatusTypeDef USBH_HUB_InterfaceInit  (USBH_HandleTypeDef *phost);
@@ -187,16 +190,17 @@ static USBH_StatusTypeDef USBH_HUB_ClassRequest(USBH_HandleTypeDef *phost)
                 if(set_hub_port_power(phost, hub_port) == USBH_OK)
                 {
                         // Reach last port
-                        if(HUB_NumPorts[port] == hub_port)
+                        if(HUB_NumPorts[port] == hub_port) {
                                 HUB_Handle->ctl_state = HUB_WAIT_PWRGOOD;
-                        else
+                                HUB_Handle->wait_start = USBH_GetMsec();
+                        } else
                                 hub_port++;
                 }
                 break;
 
         case HUB_WAIT_PWRGOOD:
-                USBH_Delay(HUB_PwrGood[port]);
-                HUB_Handle->ctl_state = HUB_REQ_DONE;
+                if (USBH_GetMsec() - HUB_Handle->wait_start >= HUB_PwrGood[port])
+                        HUB_Handle->ctl_state = HUB_REQ_DONE;
                 break;
 
         case HUB_REQ_DONE:
@@ -363,10 +367,8 @@ USBH_HUB_Process(USBH_HandleTypeDef *phost)
             break;
 
         case HUB_RESET_DEVICE:
-            if (set_port_feature(phost, HUB_FEAT_SEL_PORT_RESET, HUB_CurPort[port]) == USBH_OK) {
-                USBH_Delay(150);
-                HUB_Handle->state = HUB_PORT_CHANGED;
-            }
+            if (set_port_feature(phost, HUB_FEAT_SEL_PORT_RESET, HUB_CurPort[port]) == USBH_OK)
+                hub_wait(HUB_Handle, 150, HUB_PORT_CHANGED);
             break;
 
         case HUB_DEV_ATTACHED:
@@ -374,6 +376,7 @@ USBH_HUB_Process(USBH_HandleTypeDef *phost)
                         port, HUB_CurPort[port], HUB_ChangeInfo[port]->wPortStatus.PORT_LOW_SPEED ? "lowspeed" : "highspeed");
 
             HUB_Handle->state = HUB_LOOP_PORT_ENUM;
+            HUB_Handle->wait_start = USBH_GetMsec();
             /*
              * XXX: Before initiating an attach of a low speed device,
              *      it might be necessary to call HAL_HCD_HC_SetHubInfo()
@@ -394,16 +397,29 @@ USBH_HUB_Process(USBH_HandleTypeDef *phost)
 
         case HUB_LOOP_PORT_ENUM:
             /*
-             * Wait for HUB port to complete enumeration before moving
-             * on to other ports.
+             * Only one device may answer at the default address, so wait
+             * for the new device to be assigned its address before
+             * resetting the next port. The rest of its enumeration
+             * (descriptors, class setup) proceeds interleaved with the
+             * other ports.
              */
-            if (attach_is_complete(phost, HUB_CurPort[port]))
+            if (attach_is_addressed(phost, HUB_CurPort[port])) {
                 HUB_Handle->state = HUB_LOOP_PORT_WAIT;
+            } else if (USBH_GetMsec() - HUB_Handle->wait_start >=
+                       HUB_ENUM_TIMEOUT) {
+                printf("USB%u.%u not addressed after %u ms\n",
+                       port, HUB_CurPort[port], HUB_ENUM_TIMEOUT);
+                HUB_Handle->state = HUB_LOOP_PORT_WAIT;
+            }
             break;
 
         case HUB_LOOP_PORT_WAIT:
-            USBH_Delay(10);
-            HUB_Handle->state = HUB_LOOP_PORT_CHANGED;
+            hub_wait(HUB_Handle, 10, HUB_LOOP_PORT_CHANGED);
+            break;
+
+        case HUB_WAIT:
+            if (USBH_GetMsec() - HUB_Handle->wait_start >= HUB_Handle->wait_msec)
+                HUB_Handle->state = HUB_Handle->wait_next;
             break;
 
         case HUB_ERROR:
@@ -590,6 +606,7 @@ detach(USBH_HandleTypeDef *_phost, uint16_t idx)
 
         pphost->address     = 0;
         pphost->busy        = 0;
+        pphost->enum_hold   = 0;
         pphost->ClassNumber = 0;
         pphost->valid       = 0;
 
@@ -660,21 +677,43 @@ attach(USBH_HandleTypeDef *phost, uint16_t idx, uint8_t lowspeed)
         pphost->USBH_ClassTypeDef_pData[i] = NULL;
 
     pphost->interfaces = 0;
-    pphost->busy  = 1;
+    pphost->busy  = 1;  // Released by core once the device is addressed
+    pphost->enum_hold = 1;
     pphost->valid = 3;
 }
 
+/*
+ * attach_is_addressed() reports whether the device attached at the
+ * specified hub port has moved off the default address (or has given
+ * up enumerating), so that another port may be reset.
+ */
 static uint8_t
-attach_is_complete(USBH_HandleTypeDef *phost, uint16_t idx)
+attach_is_addressed(USBH_HandleTypeDef *phost, uint16_t idx)
 {
     uint port = get_port(phost);
     USBH_HandleTypeDef *pphost = &usb_handle[port][idx];
 
-    if (pphost->EnumState == ENUM_DONE)
+    if ((pphost->valid == 0) ||
+        (pphost->device.address != USBH_ADDRESS_DEFAULT) ||
+        (pphost->EnumState == ENUM_DONE) ||
+        (pphost->gState == HOST_ABORT_STATE))
         return (1);
     return (0);
 }
 
+/*
+ * hub_wait() moves the hub state machine to the next state after the
+ * specified delay, without blocking other devices on the port.
+ */
+static void
+hub_wait(HUB_HandleTypeDef *HUB_Handle, uint32_t msec, HUB_StateTypeDef next)
+{
+    HUB_Handle->wait_start = USBH_GetMsec();
+    HUB_Handle->wait_msec  = msec;
+    HUB_Handle->wait_next  = next;
+    HUB_Handle->state      = HUB_WAIT;
+}
+
 static void
 debug_port(uint port, uint8_t *buff, __IO USB_HUB_PORT_STATUS *info)
 {
@@ -74,6 +74,7 @@ typedef enum
 	HUB_LOOP_PORT_CHANGED,
 	HUB_LOOP_PORT_ENUM,
 	HUB_LOOP_PORT_WAIT,
+	HUB_WAIT,
 	HUB_PORT_CHANGED,
 	HUB_C_PORT_CONNECTION,
 	HUB_C_PORT_RESET,
@@ -109,6 +110,9 @@ typedef struct _HUB_Process
   uint16_t             poll;
   uint32_t             timer;
   uint8_t              DataReady;
+  HUB_StateTypeDef     wait_next;   // State after HUB_WAIT completes
+  uint32_t             wait_start;  // USBH_GetMsec() at start of wait
+  uint32_t             wait_msec;   // Length of wait
 
 } HUB_HandleTypeDef;
 
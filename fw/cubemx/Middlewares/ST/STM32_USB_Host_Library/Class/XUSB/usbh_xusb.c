@@ -640,6 +640,8 @@ USBH_XUSB_DecodeReport(USBH_HandleTypeDef *phost, XUSB_Handle_t *XUSB_Handle,
     report_info->mouse_x = val / 32;
     val = readbits(report_data, 104, 8, 1);  // Right joystick U-D
     report_info->mouse_y = val / 32;
+    report_info->stick_x = readbits(report_data, 80, 16, 1);
+    report_info->stick_y = readbits(report_data, 96, 16, 1);
     report_info->joypad = readbits(report_data, 16, 4, 0);
 
     /*
@@ -162,6 +162,8 @@ typedef struct
     int16_t   mouse_y;     // Mouse Y movement
     int16_t   wheel_x;     // Mouse Left-Right movement
     int16_t   wheel_y;     // Mouse Wheel movement
+    int16_t   stick_x;     // Right joystick L-R position (analog)
+    int16_t   stick_y;     // Right joystick U-D position (analog)
     uint8_t   joypad;      // Bits: left, right, up, down
 }
 XUSB_MISC_Info_t;
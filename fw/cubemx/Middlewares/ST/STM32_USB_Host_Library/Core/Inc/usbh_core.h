@@ -172,6 +172,7 @@ void USBH_LL_SetTimer(USBH_HandleTypeDef *phost, uint32_t time);
 void USBH_LL_IncTimer(USBH_HandleTypeDef *phost);
 
 void USBH_Delay(uint32_t Delay);
+uint32_t USBH_GetMsec(void);
 
 uint get_port(USBH_HandleTypeDef *phost);
 uint get_portdev(USBH_HandleTypeDef *phost, uint *portdev);
@@ -498,6 +498,7 @@ typedef struct _USBH_HandleTypeDef
   uint8_t               id;         // Physical Port ID
   __IO uint8_t valid;               // 0 = Device is no longer attached
   __IO uint8_t busy;                // Do not poll other devices on this port
+  uint8_t enum_hold;                // busy is held for device enumeration
 
   uint8_t hub;                      // Device is a Hub
   uint8_t address;                  // Logical device address to assign
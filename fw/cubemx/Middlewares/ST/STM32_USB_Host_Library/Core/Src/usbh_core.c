@@ -76,6 +76,7 @@ osThreadAttr_t USBH_Thread_Atrr;
 static USBH_StatusTypeDef USBH_HandleEnum(USBH_HandleTypeDef *phost);
 static void USBH_HandleSof(USBH_HandleTypeDef *phost);
 static USBH_StatusTypeDef DeInitStateMachine(USBH_HandleTypeDef *phost);
+static void USBH_ReleaseEnumHold(USBH_HandleTypeDef *phost);
 
 #if (USBH_USE_OS == 1U)
 #if (osCMSIS < 0x20000U)
@@ -266,6 +267,24 @@ USBH_StatusTypeDef USBH_RegisterClass(USBH_HandleTypeDef *phost, USBH_ClassTypeD
 }
 
 
+/**
+  * @brief  USBH_ReleaseEnumHold
+  *         Drop the busy hold taken when the device was attached, which
+  *         keeps other devices on this port from being polled while the
+  *         device enumerates. Safe to call more than once.
+  * @param  phost: Host Handle
+  * @retval None
+  */
+static void USBH_ReleaseEnumHold(USBH_HandleTypeDef *phost)
+{
+  if (phost->enum_hold)
+  {
+    phost->enum_hold = 0U;
+    phost->busy--;  // Paired with = 1 in HOST_DEV_ATTACHED
+  }
+}
+
+
 static int getInterfaceIdxFromNum(USBH_HandleTypeDef *phost, uint8_t num)
 {
     int i = 0;
@@ -556,7 +575,8 @@ USBH_StatusTypeDef  USBH_Process(USBH_HandleTypeDef *phost)
 
       phost->Control.pipe_out = USBH_AllocPipe(phost, 0x00U);
       phost->Control.pipe_in  = USBH_AllocPipe(phost, 0x80U);
-      phost->busy = 1;  // Paired with -- in HOST_CLASS_REQUEST
+      phost->busy = 1;  // Paired with USBH_ReleaseEnumHold()
+      phost->enum_hold = 1;
 
       if (phost->device.speed == USBH_SPEED_LOW)
         phost->Control.pipe_size = USBH_MPS_LOWSPEED;
@@ -705,7 +725,7 @@ USBH_StatusTypeDef  USBH_Process(USBH_HandleTypeDef *phost)
           {
             phost->gState = HOST_ABORT_STATE;
             USBH_UsrLog("USB%u.%u Device not supporting %s class.", get_port(phost), phost->address, phost->pActiveClass->Name);
-            phost->busy--;  // Paired with = 1 in HOST_DEV_ATTACHED
+            USBH_ReleaseEnumHold(phost);
           }
           else
           {
@@ -718,7 +738,7 @@ USBH_StatusTypeDef  USBH_Process(USBH_HandleTypeDef *phost)
           USBH_UsrLog("USB%u.%u No registered class (%x) for this device.",
                       get_port(phost), phost->address,
                       phost->device.CfgDesc.Itf_Desc[0].bInterfaceClass);
-          phost->busy--;  // Paired with = 1 in HOST_DEV_ATTACHED
+          USBH_ReleaseEnumHold(phost);
         }
       }
 
@@ -741,14 +761,14 @@ USBH_StatusTypeDef  USBH_Process(USBH_HandleTypeDef *phost)
         if (status != USBH_BUSY)
         {
           phost->gState = HOST_CLASS;
-          phost->busy--;  // Paired with = 1 in HOST_DEV_ATTACHED
+          USBH_ReleaseEnumHold(phost);
         }
       }
       else
       {
         phost->gState = HOST_ABORT_STATE;
         USBH_ErrLog("Invalid Class Driver.");
-        phost->busy--;  // Paired with = 1 in HOST_DEV_ATTACHED
+        USBH_ReleaseEnumHold(phost);
 
 #if (USBH_USE_OS == 1U)
         phost->os_msg = (uint32_t)USBH_STATE_CHANGED_EVENT;
@@ -943,6 +963,15 @@ static USBH_StatusTypeDef USBH_HandleEnum(USBH_HandleTypeDef *phost)
 
         /* modify control channels to update device address */
         USBH_OpenControlPipes(phost);
+
+        /*
+         * A device behind a hub no longer answers at the default
+         * address, so the hub may reset its next port. Let the hub and
+         * other devices run between the remaining control transfers
+         * of this enumeration (each transfer still holds busy).
+         */
+        if (phost != USBH_get_root_device(phost))
+          USBH_ReleaseEnumHold(phost);
       }
       break;
 
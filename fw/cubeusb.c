@@ -21,6 +21,7 @@
 #include "joystick.h"
 #include "keyboard.h"
 #include "mouse.h"
+#include "msc.h"
 #include "cubeusb.h"
 #include "usb.h"
 #include <usbh_cdc.h>  // CDC
@@ -268,9 +269,11 @@ USBH_UserProcess(USBH_HandleTypeDef *phost, uint8_t id)
             usb_keyboard_count -= usbdev[port][devnum].keyboard_count;
             usb_mouse_count    -= usbdev[port][devnum].mouse_count;
             usb_joystick_count -= usbdev[port][devnum].joystick_count;
+            mouse_stick(0, 0);  // Don't leave the pointer moving
 
             memset(&usbdev[port][devnum], 0, sizeof (usbdev[port][devnum]));
             usbdev[port][devnum].appstate = APPLICATION_DISCONNECT;
+            msc_invalidate();
             break;
         case HOST_USER_UNRECOVERED_ERROR:
             break;
@@ -756,8 +759,6 @@ USBH_XUSB_EventCallback(USBH_HandleTypeDef *phost, XUSB_Handle_t *XUSB_Handle)
     static uint8_t last_was_joypad;
     static uint32_t buttons;
     static uint8_t joypad;
-    static int16_t mouse_x;
-    static int16_t mouse_y;
     static int16_t wheel_x;
     static int16_t wheel_y;
     static uint64_t throttle_timer;
@@ -788,8 +789,9 @@ USBH_XUSB_EventCallback(USBH_HandleTypeDef *phost, XUSB_Handle_t *XUSB_Handle)
                 twheel_x = 0;
                 twheel_y = 0;
             }
-            if (mouse_x | mouse_y | wheel_x | wheel_y | buttons) {
-                mouse_action(mouse_x, mouse_y, twheel_y, twheel_x);
+            if (wheel_x | wheel_y | buttons) {
+                /* Pointer motion is integrated by mouse_poll() */
+                mouse_action(0, 0, twheel_y, twheel_x);
                 mouse_action_button(buttons);
             }
         }
@@ -811,14 +813,13 @@ USBH_XUSB_EventCallback(USBH_HandleTypeDef *phost, XUSB_Handle_t *XUSB_Handle)
          (info.wheel_x == 0) && (info.wheel_y == 0))) {
         joypad = info.joypad;
         buttons = info.buttons;
+        mouse_stick(0, 0);
         joystick_action(joypad & BIT(0), joypad & BIT(1),
                         joypad & BIT(2), joypad & BIT(3), buttons);
         last_was_joypad = 1;
     } else {
         int16_t twheel_x;
         int16_t twheel_y;
-        mouse_x = info.mouse_x;
-        mouse_y = info.mouse_y;
         wheel_x = info.wheel_x;
         wheel_y = info.wheel_y;
         buttons = info.buttons;
@@ -836,8 +837,9 @@ USBH_XUSB_EventCallback(USBH_HandleTypeDef *phost, XUSB_Handle_t *XUSB_Handle)
             twheel_y = 0;
         }
         dprintf(DF_USB_DECODE_MISC, "%d %d %d %d ",
-                mouse_x, mouse_y, twheel_x, twheel_y);
-        mouse_action(mouse_x, mouse_y, twheel_y, twheel_x);
+                info.stick_x, info.stick_y, twheel_x, twheel_y);
+        mouse_stick(info.stick_x, info.stick_y);
+        mouse_action(0, 0, twheel_y, twheel_x);
         mouse_action_button(buttons);
         last_was_joypad = 0;
     }
@@ -872,7 +874,8 @@ USBH_HID_EventCallback(USBH_HandleTypeDef *phost, HID_HandleTypeDef *HID_Handle)
             uint8_t left  = info.jpad & BIT(2);
             uint8_t right = info.jpad & BIT(3);
             if (config.flags & CF_GAMEPAD_MOUSE) {
-                mouse_action(info.x, info.y, -info.wheel, info.ac_pan);
+                mouse_stick(info.stick_x, info.stick_y);
+                mouse_action(0, 0, -info.wheel, info.ac_pan);
                 mouse_action_button(info.buttons);
             } else {
                 up    |= (info.y < 0);
@@ -975,6 +978,7 @@ USBH_reset_state_machine(int port)
     usb_handle[port][0].gState = HOST_IDLE;
     usb_handle[port][0].EnumState = ENUM_IDLE;
     usb_handle[port][0].busy = 0;
+    usb_handle[port][0].enum_hold = 0;
     usb_handle[port][0].RequestState = CMD_SEND;
     usb_handle[port][0].Timer = 0U;
     usb_handle[port][0].Control.state = CTRL_SETUP;
@@ -1630,6 +1634,18 @@ USBH_Delay(uint32_t Delay)
     timer_delay_msec(Delay);
 }
 
+/*
+ * USBH_GetMsec() returns a free-running millisecond count, for class
+ * drivers which wait without blocking other devices. It is independent
+ * of phost->Timer, which only advances while that handle is the one
+ * attached to the host controller.
+ */
+uint32_t
+USBH_GetMsec(void)
+{
+    return ((uint32_t) (timer_tick_to_usec(timer_tick_get()) / 1000));
+}
+
 /*
  * Use the following call to send data to the HID device. Can be used
  * for setting LEDs, etc. Need to research the data format.
@@ -1668,7 +1684,7 @@ cubeusb_init_port(uint port)
         return;
     }
     if (USBH_register_class(handle, USBH_CDC_CLASS, sizeof (*USBH_CDC_CLASS)) ||
-//      USBH_register_class(handle, USBH_MSC_CLASS, sizeof (*USBH_MSC_CLASS)) ||
+        USBH_register_class(handle, USBH_MSC_CLASS, sizeof (*USBH_MSC_CLASS)) ||
         USBH_register_class(handle, USBH_HID_CLASS, sizeof (*USBH_HID_CLASS)) ||
         USBH_register_class(handle, USBH_HUB_CLASS, sizeof (*USBH_HUB_CLASS)) ||
 //      USBH_register_class(handle, USBH_MTP_CLASS, sizeof (*USBH_MTP_CLASS)) ||
@@ -30,6 +30,19 @@ static uint32_t timer_clocks_per_rpm;
 
 #define FAN_HYSTERESIS_PERCENT     5  // Minimum percent for auto fan change
 
+/*
+ * RPM control loop. The output and integral are percent in fixed point
+ * with FAN_CTRL_SHIFT fraction bits. The error is converted to percent
+ * of fan_rpm_max, so the same gains work for fans of different speeds.
+ */
+#define FAN_CTRL_INTERVAL  100   // Milliseconds between control loop steps
+#define FAN_CTRL_SHIFT     8     // Fraction bits of control loop values
+#define FAN_CTRL_KP_DIV    2     // Proportional gain divisor (Kp = 0.5)
+#define FAN_CTRL_KI_DIV    8     // Integral gain divisor (Ki = 1.25 / sec)
+#define FAN_CTRL_I_MAX     (50 << FAN_CTRL_SHIFT)  // Integral limit
+#define FAN_STALL_MSEC     2000  // Time at zero RPM before stall is declared
+#define FAN_KICK_MSEC      1000  // Time at full power to restart stalled fan
+
 uint fan_percent;
 uint fan_percent_last;
 uint fan_auto;
@@ -37,6 +50,12 @@ uint fan_percent_min;   // Minimum expected fan percent
 
 uint64_t timer_fan_limit_change;
 
+static uint     fan_pwm_percent;    // Current PWM output percent
+static int      fan_ctrl_integral;  // Control loop integral term
+static uint64_t fan_ctrl_next;      // Tick of next control loop step
+static uint64_t fan_stall_time;     // Tick when stall will be declared
+static uint64_t fan_kick_end;       // Tick when stall kick ends (0 = none)
+
 /*
  * Fan management
  * --------------
@@ -280,6 +299,103 @@ fan_init(void)
     timer_fan_limit_change = timer_tick_plus_msec(1000);
 }
 
+/*
+ * fan_ctrl_step
+ * -------------
+ * Runs one step of the RPM control loop, returning the PWM percent which
+ * should be driven for the specified target percent of fan_rpm_max. The
+ * target percent is used as a feed-forward term, and a PI controller
+ * corrects for the difference between target and measured RPM. The
+ * integral is not accumulated while the output is saturated in the
+ * direction of the error (anti-windup).
+ */
+static uint
+fan_ctrl_step(uint percent, uint rpm)
+{
+    int target = percent * config.fan_rpm_max / 100;
+    int min    = config.fan_speed_min << FAN_CTRL_SHIFT;
+    int max    = 100 << FAN_CTRL_SHIFT;
+    int err;
+    int out;
+
+    if (percent == 0) {
+        fan_ctrl_integral = 0;
+        return (0);
+    }
+    err = (target - (int) rpm) * (100 << FAN_CTRL_SHIFT) /
+          (int) config.fan_rpm_max;
+    out = (percent << FAN_CTRL_SHIFT) + err / FAN_CTRL_KP_DIV +
+          fan_ctrl_integral;
+    if (((out < max) || (err < 0)) && ((out > min) || (err > 0))) {
+        fan_ctrl_integral += err / FAN_CTRL_KI_DIV;
+        if (fan_ctrl_integral > FAN_CTRL_I_MAX)
+            fan_ctrl_integral = FAN_CTRL_I_MAX;
+        else if (fan_ctrl_integral < -FAN_CTRL_I_MAX)
+            fan_ctrl_integral = -FAN_CTRL_I_MAX;
+        out = (percent << FAN_CTRL_SHIFT) + err / FAN_CTRL_KP_DIV +
+              fan_ctrl_integral;
+    }
+    if (out > max)
+        out = max;
+    else if (out < min)
+        out = min;
+    return ((out + (1 << (FAN_CTRL_SHIFT - 1))) >> FAN_CTRL_SHIFT);
+}
+
+/*
+ * fan_drive
+ * ---------
+ * Sets the PWM output according to the desired fan percent. With a
+ * fan attached and the power supply on, the fan is run closed-loop
+ * to an RPM target, and a stalled fan is restarted by driving it at
+ * full power for a short time.
+ */
+static void
+fan_drive(void)
+{
+    uint pwm = fan_percent;
+    uint rpm;
+
+    if (((config.flags & CF_HAVE_FAN) == 0) || (config.fan_rpm_max == 0) ||
+        (power_state != POWER_STATE_ON) || (fan_percent == 0)) {
+        /* Open loop */
+        fan_ctrl_integral = 0;
+        fan_stall_time = 0;
+        fan_kick_end = 0;
+        goto set_pwm;
+    }
+
+    if (fan_kick_end != 0) {
+        if (!timer_tick_has_elapsed(fan_kick_end))
+            return;  // Still kicking
+        fan_kick_end = 0;
+        fan_stall_time = 0;
+        fan_ctrl_integral = 0;
+    }
+    if (!timer_tick_has_elapsed(fan_ctrl_next))
+        return;
+    fan_ctrl_next = timer_tick_plus_msec(FAN_CTRL_INTERVAL);
+
+    rpm = fan_get_rpm();
+    if (rpm != 0) {
+        fan_stall_time = 0;
+    } else if (fan_stall_time == 0) {
+        fan_stall_time = timer_tick_plus_msec(FAN_STALL_MSEC);
+    } else if (timer_tick_has_elapsed(fan_stall_time)) {
+        dprintf(DF_FAN, "Fan stall: kick\n");
+        fan_kick_end = timer_tick_plus_msec(FAN_KICK_MSEC);
+        pwm = 100;
+        goto set_pwm;
+    }
+    pwm = fan_ctrl_step(fan_percent, rpm);
+
+set_pwm:
+    if (fan_pwm_percent != pwm) {
+        fan_pwm_set(pwm);
+        fan_pwm_percent = pwm;
+    }
+}
+
 void
 fan_poll(void)
 {
@@ -318,15 +434,14 @@ fan_poll(void)
         }
     }
     if (fan_percent_last != fan_percent) {
-        /* Need to adjust the PWM */
 // printf("[%u] change %u %u", percent, fan_percent_last, fan_percent);
-        fan_pwm_set(fan_percent);
         fan_percent_last = fan_percent;
         if (fan_percent_min > fan_percent)
             fan_percent_min = fan_percent;
         else
             timer_fan_limit_change = timer_tick_plus_msec(1000);
     }
+    fan_drive();
     if (power_state == POWER_STATE_ON) {
         if (fan_percent_min != fan_percent) {
             if (timer_tick_has_elapsed(timer_fan_limit_change)) {
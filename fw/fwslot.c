@@ -0,0 +1,104 @@
+/*
+ * This is free and unencumbered software released into the public domain.
+ * See the LICENSE file for additional details.
+ *
+ * Designed by Chris Hooper in 2025.
+ *
+ * ---------------------------------------------------------------------
+ *
+ * Dual-slot firmware boot state and image checks. This file is linked
+ * into both the boot loader and the firmware, so it must not depend on
+ * anything other than flash being readable.
+ */
+
+#include <stdint.h>
+#include <stddef.h>
+#include "main.h"
+#include "crc32.h"
+#include "fwslot.h"
+#include "utils.h"
+#include <libopencm3/stm32/flash.h>
+
+/*
+ * fwslot_state_crc
+ * ----------------
+ * Returns the CRC of a boot state record, which covers all fields up to
+ * but not including the record CRC.
+ */
+uint32_t
+fwslot_state_crc(const fwslot_state_t *state)
+{
+    return (crc32(0, state, offsetof(fwslot_state_t, fbs_rcrc)));
+}
+
+/*
+ * fwslot_state_find
+ * -----------------
+ * Locates the current boot state record. The state sector holding that
+ * record is returned in copy, and the index of the first unwritten record
+ * in that sector is returned in next (FWSLOT_STATE_PER_COPY if the sector
+ * is full). Returns NULL if no valid record exists.
+ */
+const fwslot_state_t *
+fwslot_state_find(uint *copy, uint *next)
+{
+    const fwslot_state_t *best = NULL;
+    uint free_pos[2];
+    uint cur;
+    uint pos;
+
+    *copy = 0;
+    for (cur = 0; cur < 2; cur++) {
+        const fwslot_state_t *rec = (const fwslot_state_t *)
+                                    (FLASH_BASE + FWSLOT_STATE_ADDR(cur));
+
+        free_pos[cur] = FWSLOT_STATE_PER_COPY;
+        for (pos = 0; pos < FWSLOT_STATE_PER_COPY; pos++, rec++) {
+            if (rec->fbs_magic == 0xffffffff) {
+                /* Records are appended, so the remainder is unwritten */
+                free_pos[cur] = pos;
+                break;
+            }
+            if ((rec->fbs_magic != FWSLOT_STATE_MAGIC) ||
+                (rec->fbs_active >= FWSLOT_COUNT) ||
+                (rec->fbs_rcrc != fwslot_state_crc(rec))) {
+                continue;  // Torn or foreign record
+            }
+            if ((best == NULL) || (rec->fbs_seq > best->fbs_seq)) {
+                best  = rec;
+                *copy = cur;
+            }
+        }
+    }
+    *next = free_pos[*copy];
+    return (best);
+}
+
+/*
+ * fwslot_image_valid
+ * ------------------
+ * Returns non-zero if the specified slot holds an image which appears
+ * bootable: the initial stack pointer is in SRAM, the reset vector is
+ * within the slot, and, if the boot state records the image size, the
+ * image CRC matches.
+ */
+uint
+fwslot_image_valid(uint slot, const fwslot_state_t *state)
+{
+    uint32_t base = FLASH_BASE + FWSLOT_ADDR(slot);
+    uint32_t sp   = ADDR32(base)[0];
+    uint32_t pc   = ADDR32(base)[1];
+
+    if ((sp & 0xfff00000) != 0x20000000)
+        return (0);
+    if ((pc < base) || (pc >= base + FWSLOT_SLOT_SIZE))
+        return (0);
+    if ((state != NULL) && (state->fbs_size[slot] != 0)) {
+        if ((state->fbs_size[slot] > FWSLOT_SLOT_SIZE) ||
+            (crc32(0, ADDR8(base), state->fbs_size[slot]) !=
+             state->fbs_crc[slot])) {
+            return (0);
+        }
+    }
+    return (1);
+}
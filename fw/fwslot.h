@@ -0,0 +1,96 @@
+/*
+ * This is free and unencumbered software released into the public domain.
+ * See the LICENSE file for additional details.
+ *
+ * Designed by Chris Hooper in 2025.
+ *
+ * ---------------------------------------------------------------------
+ *
+ * Dual-slot (A/B) firmware flash layout and boot state, shared by the
+ * boot loader and the firmware.
+ */
+
+#ifndef _FWSLOT_H
+#define _FWSLOT_H
+
+/*
+ * STM32F205 flash layout when the boot loader is installed. All offsets
+ * are relative to the start of flash (0x08000000).
+ *
+ *   Sector 0    0x00000 - 0x03fff  16 KB   Boot loader (boot.c)
+ *   Sector 1    0x04000 - 0x07fff  16 KB   Boot state records (copy 0)
+ *   Sector 2    0x08000 - 0x0bfff  16 KB   Boot state records (copy 1)
+ *   Sector 3-4  0x0c000 - 0x1ffff  80 KB   Unused
+ *   Sector 5    0x20000 - 0x3ffff  128 KB  Firmware slot 0
+ *   Sector 6    0x40000 - 0x5ffff  128 KB  Firmware slot 1
+ *   Sector 7    0x60000 - 0x7ffff  128 KB  Config area (config.c)
+ *
+ * Each slot image is linked to execute in place at its slot address
+ * (fw_slot0.ld and fw_slot1.ld), so a slot switch never copies flash.
+ */
+#define FWSLOT_BOOT_BASE    0x00000000
+#define FWSLOT_BOOT_SIZE    0x00004000  // 16 KB
+#define FWSLOT_STATE_BASE   0x00004000  // Two sectors, used alternately
+#define FWSLOT_STATE_SIZE   0x00004000  // 16 KB each
+#define FWSLOT_SLOT_BASE    0x00020000
+#define FWSLOT_SLOT_SIZE    0x00020000  // 128 KB
+#define FWSLOT_COUNT        2
+#define FWSLOT_NONE         0xff        // Not running from a slot
+
+#define FWSLOT_ADDR(slot)   (FWSLOT_SLOT_BASE + (slot) * FWSLOT_SLOT_SIZE)
+#define FWSLOT_STATE_ADDR(copy) (FWSLOT_STATE_BASE + (copy) * FWSLOT_STATE_SIZE)
+
+/*
+ * Boot state record. Records are only ever appended, each with a higher
+ * sequence number than the last. The record with the highest sequence
+ * number and a good CRC is current, so a record torn by power loss is
+ * simply ignored and the previous one remains in effect. When one state
+ * sector fills, the other is erased and used from its start.
+ *
+ * A newly written image is first booted in the TRIAL state. The boot
+ * loader counts trial boots in an RTC backup register and starts the
+ * independent watchdog; if the firmware does not confirm itself (GOOD)
+ * within FWSLOT_TRIAL_BOOTS attempts, the previous slot is booted instead.
+ * The watchdog can not be stopped, so it keeps running after confirmation
+ * until the next reset. It is fed by fwupdate_poll() from the main loop
+ * and by input_break_pending() in console loops which run until ^C. Any
+ * other code which keeps the CPU for longer than FWSLOT_TRIAL_WDOG must
+ * call iwdg_reset() itself.
+ * A slot size of 0 means the slot CRC is unknown and is not checked.
+ */
+typedef struct {
+    uint32_t fbs_magic;       // FWSLOT_STATE_MAGIC
+    uint32_t fbs_seq;         // Sequence number of record
+    uint8_t  fbs_active;      // Slot to boot
+    uint8_t  fbs_state;       // FBS_STATE_*
+    uint8_t  fbs_unused[2];   // Unused (0)
+    uint32_t fbs_size[FWSLOT_COUNT];  // Image size in each slot
+    uint32_t fbs_crc[FWSLOT_COUNT];   // Image CRC-32 of each slot
+    uint32_t fbs_rcrc;        // CRC-32 of all prior fields of this record
+} fwslot_state_t;
+
+#define FWSLOT_STATE_MAGIC  0x46575354  // "FWST"
+#define FBS_STATE_GOOD      0x01        // Active slot is confirmed
+#define FBS_STATE_TRIAL     0x02        // Active slot is being tried
+
+#define FWSLOT_STATE_PER_COPY (FWSLOT_STATE_SIZE / sizeof (fwslot_state_t))
+
+#define FWSLOT_TRIAL_BOOTS  3           // Boot attempts before rollback
+#define FWSLOT_TRIAL_WDOG   16000       // Trial watchdog timeout (msec)
+
+/*
+ * RTC backup register holding the trial boot count. The upper 16 bits
+ * hold a magic value so that a backup domain reset reads as no attempts.
+ * FWSLOT_BKP_ROLLBACK is set by the boot loader when it gave up on the
+ * trial slot.
+ */
+#define FWSLOT_BKP_TRIES    9
+#define FWSLOT_BKP_MAGIC    0xb0070000
+#define FWSLOT_BKP_ROLLBACK 0x00008000
+#define FWSLOT_BKP_COUNT    0x000000ff
+
+const fwslot_state_t *fwslot_state_find(uint *copy, uint *next);
+uint fwslot_image_valid(uint slot, const fwslot_state_t *state);
+uint32_t fwslot_state_crc(const fwslot_state_t *state);
+
+#endif /* _FWSLOT_H */
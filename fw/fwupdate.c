@@ -0,0 +1,416 @@
+/*
+ * This is free and unencumbered software released into the public domain.
+ * See the LICENSE file for additional details.
+ *
+ * Designed by Chris Hooper in 2025.
+ *
+ * ---------------------------------------------------------------------
+ *
+ * Dual-slot firmware update over the BEC message interface. A new image
+ * is written to the slot not currently running, verified, and recorded
+ * in the boot state as a trial. The boot loader (boot.c) starts the
+ * trial image, and this code confirms it once it has run for a while.
+ */
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include "printf.h"
+#include "main.h"
+#include "bec_cmd.h"
+#include "cmdline.h"
+#include "crc32.h"
+#include "fwslot.h"
+#include "fwupdate.h"
+#include "stm32flash.h"
+#include "timer.h"
+#include "utils.h"
+#include <libopencm3/cm3/vector.h>
+#include <libopencm3/stm32/flash.h>
+#include <libopencm3/stm32/iwdg.h>
+#include <libopencm3/stm32/rtc.h>
+
+static uint8_t  fwupdate_running = FWSLOT_NONE;  // Slot running from
+static uint8_t  fwupdate_slot;     // Slot being written
+static uint8_t  fwupdate_phase;    // Update phase (BFU_PHASE_*)
+static uint8_t  fwupdate_reboot;   // Restart when fwupdate_timer expires
+static uint32_t fwupdate_size;     // Size of image being written
+static uint32_t fwupdate_crc;      // CRC-32 of image being written
+static uint32_t fwupdate_got;      // Bytes of image written so far
+static uint64_t fwupdate_timer;    // Trial confirm or reboot time
+
+/* Image data is staged here so that flash is programmed 32 bits at a time */
+static uint32_t fwupdate_buf[BEC_MSG_MAX_PAYLOAD / sizeof (uint32_t)];
+
+/*
+ * fwupdate_state_write
+ * --------------------
+ * Appends a new boot state record. The sequence number and CRC are
+ * filled in here. When the current state sector is full, the other is
+ * erased and the record is written at its start, so the previous record
+ * remains valid until the new one is completely written.
+ */
+static rc_t
+fwupdate_state_write(fwslot_state_t *rec)
+{
+    const fwslot_state_t *cur;
+    uint32_t              addr;
+    uint                  copy;
+    uint                  next;
+
+    cur = fwslot_state_find(&copy, &next);
+    rec->fbs_magic = FWSLOT_STATE_MAGIC;
+    rec->fbs_seq   = (cur == NULL) ? 1 : cur->fbs_seq + 1;
+    memset(rec->fbs_unused, 0, sizeof (rec->fbs_unused));
+    rec->fbs_rcrc  = fwslot_state_crc(rec);
+
+    if ((cur == NULL) || (next >= FWSLOT_STATE_PER_COPY)) {
+        copy = (cur == NULL) ? 0 : (copy ^ 1);
+        next = 0;
+        if (stm32flash_erase(FWSLOT_STATE_ADDR(copy), FWSLOT_STATE_SIZE) != 0)
+            return (RC_FAILURE);
+    }
+    addr = FWSLOT_STATE_ADDR(copy) + next * sizeof (*rec);
+    if ((stm32flash_write(addr, sizeof (*rec), rec, 0) != 0) ||
+        (memcmp((void *) (FLASH_BASE + addr), rec, sizeof (*rec)) != 0)) {
+        printf("Boot state write failed at %lx\n", addr);
+        return (RC_FAILURE);
+    }
+    return (RC_SUCCESS);
+}
+
+/*
+ * fwupdate_state_get
+ * ------------------
+ * Copies the current boot state record to rec. If there is none, rec
+ * describes the running slot as good with no recorded image CRC.
+ */
+static void
+fwupdate_state_get(fwslot_state_t *rec)
+{
+    const fwslot_state_t *cur;
+    uint copy;
+    uint next;
+
+    cur = fwslot_state_find(&copy, &next);
+    if (cur != NULL) {
+        *rec = *cur;
+    } else {
+        memset(rec, 0, sizeof (*rec));
+        rec->fbs_active = fwupdate_running;
+        rec->fbs_state  = FBS_STATE_GOOD;
+    }
+}
+
+static void
+fwupdate_trial_reset(void)
+{
+    RTC_BKPXR(FWSLOT_BKP_TRIES) = FWSLOT_BKP_MAGIC;
+}
+
+/*
+ * fwupdate_confirm
+ * ----------------
+ * Marks the running trial image as good, so the boot loader no longer
+ * counts boot attempts or falls back to the other slot.
+ */
+rc_t
+fwupdate_confirm(void)
+{
+    fwslot_state_t rec;
+    rc_t           rc;
+
+    if (fwupdate_running == FWSLOT_NONE)
+        return (RC_FAILURE);
+    fwupdate_state_get(&rec);
+    if ((rec.fbs_active == fwupdate_running) &&
+        (rec.fbs_state == FBS_STATE_GOOD)) {
+        return (RC_SUCCESS);
+    }
+    rec.fbs_active = fwupdate_running;
+    rec.fbs_state  = FBS_STATE_GOOD;
+    rc = fwupdate_state_write(&rec);
+    if (rc == RC_SUCCESS) {
+        fwupdate_trial_reset();
+        if (fwupdate_reboot == 0)
+            fwupdate_timer = 0;
+        printf("Firmware slot %u confirmed\n", fwupdate_running);
+    }
+    return (rc);
+}
+
+/*
+ * fwupdate_switch
+ * ---------------
+ * Records the other slot to be booted on trial at the next reset, if it
+ * holds a bootable image.
+ */
+rc_t
+fwupdate_switch(void)
+{
+    fwslot_state_t rec;
+    uint           slot;
+
+    if (fwupdate_running == FWSLOT_NONE)
+        return (RC_FAILURE);
+    slot = fwupdate_running ^ 1;
+    fwupdate_state_get(&rec);
+    if (!fwslot_image_valid(slot, &rec)) {
+        printf("Slot %u does not hold a valid image\n", slot);
+        return (RC_FAILURE);
+    }
+    rec.fbs_active = slot;
+    rec.fbs_state  = FBS_STATE_TRIAL;
+    fwupdate_trial_reset();
+    return (fwupdate_state_write(&rec));
+}
+
+void
+fwupdate_status(bec_fw_update_t *reply)
+{
+    fwslot_state_t rec;
+
+    fwupdate_state_get(&rec);
+    reply->bfu_slot    = (fwupdate_running == FWSLOT_NONE) ?
+                         BFU_SLOT_NONE : (fwupdate_running ^ 1);
+    reply->bfu_running = fwupdate_running;
+    reply->bfu_phase   = fwupdate_phase;
+    reply->bfu_state   = ((rec.fbs_active == fwupdate_running) &&
+                          (rec.fbs_state == FBS_STATE_TRIAL)) ?
+                         BFU_STATE_TRIAL : BFU_STATE_GOOD;
+    reply->bfu_offset  = fwupdate_got;
+    reply->bfu_crc     = fwupdate_crc;
+}
+
+/*
+ * fwupdate_start
+ * --------------
+ * Begins upload of an image to the slot not currently running. The slot
+ * is erased later from fwupdate_poll() so that the reply is not held up.
+ * The running image must be confirmed first, as the other slot is what
+ * a trial image falls back to.
+ */
+uint
+fwupdate_start(uint32_t size, uint32_t crc)
+{
+    fwslot_state_t rec;
+
+    if (fwupdate_running == FWSLOT_NONE)
+        return (BEC_STATUS_FAIL);
+    if ((size < 8) || (size > FWSLOT_SLOT_SIZE))
+        return (BEC_STATUS_BADLEN);
+    fwupdate_state_get(&rec);
+    if ((rec.fbs_active == fwupdate_running) &&
+        (rec.fbs_state == FBS_STATE_TRIAL)) {
+        return (BEC_STATUS_LOCKED);
+    }
+    fwupdate_slot  = fwupdate_running ^ 1;
+    fwupdate_size  = size;
+    fwupdate_crc   = crc;
+    fwupdate_got   = 0;
+    fwupdate_phase = BFU_PHASE_ERASE;
+    return (BEC_STATUS_OK);
+}
+
+/*
+ * fwupdate_data
+ * -------------
+ * Programs the next block of the image. The block CRC is checked both
+ * as received and as read back from flash. A block which was already
+ * programmed is accepted again if it matches, which permits the sender
+ * to retry after a lost reply.
+ */
+uint
+fwupdate_data(uint32_t offset, const void *data, uint len, uint32_t crc)
+{
+    uint32_t addr = FWSLOT_ADDR(fwupdate_slot) + offset;
+
+    if (fwupdate_phase == BFU_PHASE_ERASE)
+        return (BEC_STATUS_LOCKED);
+    if (fwupdate_phase != BFU_PHASE_WRITE)
+        return (BEC_STATUS_FAIL);
+    if ((len > sizeof (fwupdate_buf)) || (offset + len > fwupdate_size))
+        return (BEC_STATUS_BADLEN);
+    if (crc32(0, data, len) != crc)
+        return (BEC_STATUS_CRC);
+
+    if (offset + len <= fwupdate_got) {
+        /* Resend of a block which was already programmed */
+        if (crc32(0, (void *) (FLASH_BASE + addr), len) != crc)
+            return (BEC_STATUS_BADARG);
+        return (BEC_STATUS_OK);
+    }
+    if (offset != fwupdate_got)
+        return (BEC_STATUS_BADARG);
+
+    if ((offset == 0) && (len >= 8)) {
+        /* Reject an image which was linked for the other slot */
+        uint32_t pc;
+        memcpy(&pc, (const uint8_t *) data + 4, sizeof (pc));
+        if ((pc < FLASH_BASE + FWSLOT_ADDR(fwupdate_slot)) ||
+            (pc >= FLASH_BASE + FWSLOT_ADDR(fwupdate_slot) +
+                   FWSLOT_SLOT_SIZE)) {
+            return (BEC_STATUS_BADARG);
+        }
+    }
+
+    memcpy(fwupdate_buf, data, len);
+    if ((stm32flash_write(addr, len, fwupdate_buf, 0) != 0) ||
+        (crc32(0, (void *) (FLASH_BASE + addr), len) != crc)) {
+        fwupdate_phase = BFU_PHASE_IDLE;  // Slot must be erased again
+        return (BEC_STATUS_FAIL);
+    }
+    fwupdate_got = offset + len;
+    return (BEC_STATUS_OK);
+}
+
+/*
+ * fwupdate_commit
+ * ---------------
+ * Verifies the complete image in flash and records its slot to be booted
+ * on trial at the next reset.
+ */
+uint
+fwupdate_commit(uint reboot)
+{
+    fwslot_state_t rec;
+    uint           slot = fwupdate_slot;
+
+    if (fwupdate_phase == BFU_PHASE_READY)
+        goto committed;  // Resend of commit
+    if ((fwupdate_phase != BFU_PHASE_WRITE) || (fwupdate_got != fwupdate_size))
+        return (BEC_STATUS_FAIL);
+    if (crc32(0, (void *) (FLASH_BASE + FWSLOT_ADDR(slot)), fwupdate_size) !=
+        fwupdate_crc) {
+        fwupdate_phase = BFU_PHASE_IDLE;
+        return (BEC_STATUS_CRC);
+    }
+
+    fwupdate_state_get(&rec);
+    rec.fbs_active     = slot;
+    rec.fbs_state      = FBS_STATE_TRIAL;
+    rec.fbs_size[slot] = fwupdate_size;
+    rec.fbs_crc[slot]  = fwupdate_crc;
+    if (!fwslot_image_valid(slot, &rec))
+        return (BEC_STATUS_BADARG);
+    fwupdate_trial_reset();
+    if (fwupdate_state_write(&rec) != RC_SUCCESS)
+        return (BEC_STATUS_FAIL);
+    fwupdate_phase = BFU_PHASE_READY;
+    printf("Firmware slot %u updated; %lu bytes, CRC %08lx\n",
+           slot, fwupdate_size, fwupdate_crc);
+
+committed:
+    if (reboot) {
+        /* Allow time for the reply to reach the Amiga */
+        fwupdate_reboot = 1;
+        fwupdate_timer  = timer_tick_plus_msec(250);
+    }
+    return (BEC_STATUS_OK);
+}
+
+/*
+ * fwupdate_poll
+ * -------------
+ * Keeps the trial watchdog fed, erases the target slot of a started
+ * update, confirms a trial image which has run long enough, and restarts
+ * BEC after a committed update when requested.
+ */
+void
+fwupdate_poll(void)
+{
+    iwdg_reset();
+
+    if (fwupdate_phase == BFU_PHASE_ERASE) {
+        if (stm32flash_erase(FWSLOT_ADDR(fwupdate_slot),
+                             FWSLOT_SLOT_SIZE) != 0) {
+            fwupdate_phase = BFU_PHASE_IDLE;
+        } else {
+            fwupdate_phase = BFU_PHASE_WRITE;
+        }
+    }
+    if ((fwupdate_timer != 0) && timer_tick_has_elapsed(fwupdate_timer)) {
+        fwupdate_timer = 0;
+        if (fwupdate_reboot) {
+            printf("Restarting to boot firmware slot %u\n", fwupdate_slot);
+            reset_cpu();
+        }
+        (void) fwupdate_confirm();
+    }
+}
+
+/*
+ * fwupdate_init
+ * -------------
+ * Determines which slot the firmware is running from and brings the boot
+ * state up to date: records the first boot from a slot, records a
+ * rollback performed by the boot loader, and schedules confirmation of a
+ * trial image.
+ */
+void
+fwupdate_init(void)
+{
+    fwslot_state_t rec;
+    uint32_t       base = (uintptr_t) &vector_table - FLASH_BASE;
+    uint           slot;
+    uint           copy;
+    uint           next;
+
+    for (slot = 0; slot < FWSLOT_COUNT; slot++)
+        if (base == FWSLOT_ADDR(slot))
+            fwupdate_running = slot;
+    if (fwupdate_running == FWSLOT_NONE)
+        return;  // Boot loader is not in use
+
+    if (fwslot_state_find(&copy, &next) == NULL) {
+        /* First boot from a slot (installed by DFU or ST-Link) */
+        fwupdate_state_get(&rec);
+        (void) fwupdate_state_write(&rec);
+        return;
+    }
+    fwupdate_state_get(&rec);
+    if (rec.fbs_active != fwupdate_running) {
+        printf("Firmware slot %u failed to start; reverted to slot %u\n",
+               rec.fbs_active, fwupdate_running);
+        rec.fbs_active = fwupdate_running;
+        rec.fbs_state  = FBS_STATE_GOOD;
+        fwupdate_trial_reset();
+        (void) fwupdate_state_write(&rec);
+    } else if (rec.fbs_state == FBS_STATE_TRIAL) {
+        printf("Firmware slot %u on trial\n", fwupdate_running);
+        fwupdate_timer = timer_tick_plus_msec(FWUPDATE_CONFIRM_MSEC);
+    }
+}
+
+void
+fwupdate_show(void)
+{
+    fwslot_state_t rec;
+    uint           slot;
+
+    if (fwupdate_running == FWSLOT_NONE) {
+        printf("Not running from a firmware slot\n");
+        return;
+    }
+    fwupdate_state_get(&rec);
+    for (slot = 0; slot < FWSLOT_COUNT; slot++) {
+        printf("Slot %u %08lx %s%s%s", slot,
+               (uint32_t) (FLASH_BASE + FWSLOT_ADDR(slot)),
+               fwslot_image_valid(slot, &rec) ? "valid" : "invalid",
+               (slot == fwupdate_running) ? " running" : "",
+               (slot == rec.fbs_active) ?
+               ((rec.fbs_state == FBS_STATE_TRIAL) ? " trial" : " active") :
+               "");
+        if (rec.fbs_size[slot] != 0) {
+            printf(" size=%lu crc=%08lx",
+                   rec.fbs_size[slot], rec.fbs_crc[slot]);
+        }
+        printf("\n");
+    }
+    printf("Boot state seq %lu", rec.fbs_seq);
+    if (fwupdate_phase != BFU_PHASE_IDLE) {
+        printf(", update of slot %u at %lu of %lu", fwupdate_slot,
+               fwupdate_got, fwupdate_size);
+    }
+    printf("\n");
+}
@@ -0,0 +1,27 @@
+/*
+ * This is free and unencumbered software released into the public domain.
+ * See the LICENSE file for additional details.
+ *
+ * Designed by Chris Hooper in 2025.
+ *
+ * ---------------------------------------------------------------------
+ *
+ * Dual-slot firmware update over the BEC message interface.
+ */
+
+#ifndef _FWUPDATE_H
+#define _FWUPDATE_H
+
+#define FWUPDATE_CONFIRM_MSEC 10000  // Trial image runs this long to confirm
+
+void fwupdate_init(void);
+void fwupdate_poll(void);
+void fwupdate_status(bec_fw_update_t *reply);
+uint fwupdate_start(uint32_t size, uint32_t crc);
+uint fwupdate_data(uint32_t offset, const void *data, uint len, uint32_t crc);
+uint fwupdate_commit(uint reboot);
+rc_t fwupdate_confirm(void);
+rc_t fwupdate_switch(void);
+void fwupdate_show(void);
+
+#endif /* _FWUPDATE_H */
@@ -449,7 +449,10 @@ void exti1_isr(void) __attribute__((alias("unknown_handler")));
 void exti2_isr(void) __attribute__((alias("unknown_handler")));
 void exti3_isr(void) __attribute__((alias("unknown_handler")));
 void exti4_isr(void) __attribute__((alias("unknown_handler")));
+#ifndef STM32F1
+/* On STM32F1, adc.c handles ADC DMA completion on DMA1 channel 1 */
 void dma1_channel1_isr(void) __attribute__((alias("unknown_handler")));
+#endif
 void dma1_channel2_isr(void) __attribute__((alias("unknown_handler")));
 void dma1_channel3_isr(void) __attribute__((alias("unknown_handler")));
 void dma1_channel4_isr(void) __attribute__((alias("unknown_handler")));
@@ -478,7 +481,6 @@ void spi2_isr(void) __attribute__((alias("unknown_handler")));
 void usart1_isr(void) __attribute__((alias("unknown_handler")));
 void usart2_isr(void) __attribute__((alias("unknown_handler")));
 // void usart3_isr(void) __attribute__((alias("unknown_handler")));
-void exti15_10_isr(void) __attribute__((alias("unknown_handler")));
 void rtc_alarm_isr(void) __attribute__((alias("unknown_handler")));
 // void rtc_wkup_isr(void) __attribute__((alias("unknown_handler")));
 void usb_wakeup_isr(void) __attribute__((alias("unknown_handler")));
@@ -10,24 +10,242 @@
  */
 
 #include <stdint.h>
+#include <string.h>
 #include "main.h"
+#include "bec_cmd.h"
 #include "config.h"
 #include "joystick.h"
 #include "keyboard.h"
 #include "mouse.h"
 #include "gpio.h"
 #include "hiden.h"
+#include "irq.h"
 #include "printf.h"
+#include "timer.h"
 #include "utils.h"
 #include "amiga_kbd_codes.h"
 
 uint8_t joystick_asserted;
 
+/* State reported to Amiga software by BEC message */
+static uint8_t  joystick_report_dirs;     // BIS_JOY_* bits
+static uint32_t joystick_report_buttons;
+
 #define BUTTON_CODE_UP    (0x1c | KEYCAP_BUTTON)
 #define BUTTON_CODE_DOWN  (0x1d | KEYCAP_BUTTON)
 #define BUTTON_CODE_LEFT  (0x1e | KEYCAP_BUTTON)
 #define BUTTON_CODE_RIGHT (0x1f | KEYCAP_BUTTON)
 
+/*
+ * Amiga software typically samples the joystick port once per video
+ * frame, so a button press shorter than a frame may not be seen at all.
+ * Port line outputs are held asserted at least this long, with further
+ * changes during that time coalesced into the final state.
+ */
+#define JOYSTICK_HOLD_USEC    20000  // One PAL frame
+#define JOYSTICK_AUTOFIRE_MAX 25     // Maximum autofire rate (Hz)
+
+/*
+ * Button to Amiga action lookup, built from config.buttonmap[32-63] and
+ * config.joy_autofire[] whenever the config changes.
+ */
+typedef struct {
+    uint32_t jm_macro;      // Amiga action (see mouse_put_macro())
+    uint32_t jm_half;       // Autofire half period in ticks (0 = none)
+    uint8_t  jm_lines;      // Macro only drives Amiga port lines
+} joystick_map_t;
+
+static joystick_map_t joystick_map[32];
+static uint           joystick_map_gen;   // config_gen of joystick_map[]
+
+/*
+ * Buttons which drive only port lines are owned by the joystick timer
+ * alarm while autofire or a held release is in progress, so that their
+ * output timing does not depend on when USB reports arrive. These are
+ * modified from interrupt context.
+ */
+static uint32_t joystick_held;      // Line buttons pressed on USB device
+static uint32_t joystick_out;       // Line buttons asserted at port
+static uint32_t joystick_timed;     // Line buttons with a pending event
+static uint64_t joystick_since[32]; // Time line was last asserted
+static uint64_t joystick_next[32];  // Time of next pending event
+
+/*
+ * joystick_map_update
+ * -------------------
+ * Rebuilds the button to Amiga action lookup from the config.
+ */
+static void
+joystick_map_update(void)
+{
+    joystick_map_t map[ARRAY_SIZE(joystick_map)];
+    uint32_t       macro;
+    uint32_t       code;
+    uint           rate;
+    uint           bit;
+
+    for (bit = 0; bit < ARRAY_SIZE(map); bit++) {
+        macro = config.buttonmap[bit + 32];
+        if (macro == 0)
+            macro = 0x80 + bit;  // Not reassigned: default to self
+        else if (macro <= 4)
+            macro--;
+        map[bit].jm_macro = macro;
+
+        /* Fire buttons and joystick directions only */
+        map[bit].jm_lines = (macro != 0);
+        for (code = macro; code != 0; code >>= 8) {
+            switch ((uint8_t) code) {
+                case ASE_BUTTON_0:
+                case ASE_BUTTON_1:
+                case ASE_BUTTON_2:
+                case ASE_JOYSTICK_UP:
+                case ASE_JOYSTICK_DOWN:
+                case ASE_JOYSTICK_LEFT:
+                case ASE_JOYSTICK_RIGHT:
+                    break;
+                default:
+                    map[bit].jm_lines = 0;
+                    break;
+            }
+        }
+
+        rate = config.joy_autofire[bit];
+        if (rate > JOYSTICK_AUTOFIRE_MAX)
+            rate = JOYSTICK_AUTOFIRE_MAX;
+        if ((rate == 0) || (map[bit].jm_lines == 0))
+            map[bit].jm_half = 0;
+        else
+            map[bit].jm_half = timer_usec_to_tick(500000 / rate);
+    }
+
+    disable_irq();
+    memcpy(joystick_map, map, sizeof (joystick_map));
+    enable_irq();
+    joystick_map_gen = config_gen;
+}
+
+/*
+ * joystick_line_set
+ * -----------------
+ * Asserts or releases the port lines of the specified button.
+ * Called with interrupts disabled.
+ */
+static void
+joystick_line_set(uint bit, uint is_pressed, uint64_t now)
+{
+    if (is_pressed) {
+        joystick_out |= BIT(bit);
+        joystick_since[bit] = now;
+    } else {
+        joystick_out &= ~BIT(bit);
+    }
+    mouse_put_macro(joystick_map[bit].jm_macro, is_pressed, !is_pressed);
+}
+
+/*
+ * joystick_alarm_set
+ * ------------------
+ * Arms the joystick alarm for the earliest pending line event.
+ * Called with interrupts disabled.
+ */
+static void joystick_alarm(void);
+
+static void
+joystick_alarm_set(void)
+{
+    uint32_t timed = joystick_timed;
+    uint64_t when = 0;
+    uint     bit;
+
+    for (; timed != 0; timed &= timed - 1) {
+        bit = __builtin_ctz(timed);
+        if ((when == 0) || (joystick_next[bit] < when))
+            when = joystick_next[bit];
+    }
+    if (when == 0)
+        timer_alarm_cancel(TIMER_ALARM_JOYSTICK);
+    else
+        timer_alarm_set(TIMER_ALARM_JOYSTICK, when, joystick_alarm);
+}
+
+/*
+ * joystick_alarm
+ * --------------
+ * Timer alarm handler which toggles autofire buttons and releases the
+ * lines of buttons whose minimum hold time has expired. Each autofire
+ * edge is scheduled from the previous one rather than from when the
+ * interrupt was serviced, so interrupt latency does not accumulate.
+ */
+static void
+joystick_alarm(void)
+{
+    uint64_t now = timer_tick_get();
+    uint32_t timed = joystick_timed;
+    uint     bit;
+
+    for (; timed != 0; timed &= timed - 1) {
+        bit = __builtin_ctz(timed);
+        if (now < joystick_next[bit])
+            continue;
+        if ((joystick_held & BIT(bit)) && (joystick_map[bit].jm_half != 0)) {
+            /* Autofire */
+            joystick_line_set(bit, !(joystick_out & BIT(bit)), now);
+            joystick_next[bit] += joystick_map[bit].jm_half;
+            if (joystick_next[bit] <= now)
+                joystick_next[bit] = now + joystick_map[bit].jm_half;
+        } else {
+            /* Hold time expired for released button */
+            if (joystick_out & BIT(bit))
+                joystick_line_set(bit, 0, now);
+            joystick_timed &= ~BIT(bit);
+        }
+    }
+    joystick_alarm_set();
+}
+
+/*
+ * joystick_line_action
+ * --------------------
+ * Handles a press or release of a button which drives only port lines.
+ * The press is applied immediately. A release is deferred until the
+ * line has been asserted for JOYSTICK_HOLD_USEC, and is cancelled if
+ * the button is pressed again before then.
+ */
+static void
+joystick_line_action(uint bit, uint is_pressed)
+{
+    uint64_t now = timer_tick_get();
+    uint64_t hold_end;
+
+    disable_irq();
+    if (is_pressed) {
+        joystick_held |= BIT(bit);
+        if ((joystick_out & BIT(bit)) == 0)
+            joystick_line_set(bit, 1, now);
+        if (joystick_map[bit].jm_half != 0) {
+            joystick_timed |= BIT(bit);
+            joystick_next[bit] = now + joystick_map[bit].jm_half;
+        } else {
+            joystick_timed &= ~BIT(bit);
+        }
+    } else {
+        joystick_held &= ~BIT(bit);
+        hold_end = joystick_since[bit] +
+                   timer_usec_to_tick(JOYSTICK_HOLD_USEC);
+        if ((joystick_out & BIT(bit)) && (now < hold_end)) {
+            joystick_timed |= BIT(bit);
+            joystick_next[bit] = hold_end;
+        } else {
+            if (joystick_out & BIT(bit))
+                joystick_line_set(bit, 0, now);
+            joystick_timed &= ~BIT(bit);
+        }
+    }
+    joystick_alarm_set();
+    enable_irq();
+}
+
 void
 joystick_action(uint up, uint down, uint left, uint right, uint32_t buttons)
 {
@@ -36,7 +254,6 @@ joystick_action(uint up, uint down, uint left, uint right, uint32_t buttons)
     static uint8_t  last_left;
     static uint8_t  last_right;
     static uint32_t last_buttons;
-    uint32_t        macro;
     uint            change = 0;
 
     joystick_asserted = up | down | left | right || !!buttons;
@@ -70,34 +287,44 @@ joystick_action(uint up, uint down, uint left, uint right, uint32_t buttons)
         dprintf(DF_AMIGA_JOYSTICK, "%sJ%c", right ? "" : "-", 'R');
     }
 
+    joystick_report_dirs = (up ? BIS_JOY_UP : 0) |
+                           (down ? BIS_JOY_DOWN : 0) |
+                           (left ? BIS_JOY_LEFT : 0) |
+                           (right ? BIS_JOY_RIGHT : 0);
+
     buttons |= mouse_buttons_add;
+    joystick_report_buttons = buttons;
 
     if (buttons != last_buttons) {
-        uint bit;
-        for (bit = 0; bit < 32; bit++) {
-            uint     is_pressed  = (buttons & BIT(bit)) ? 1 : 0;
-            uint     was_pressed = (last_buttons & BIT(bit)) ? 1 : 0;
-            macro = config.buttonmap[bit + 32];
-            if (macro == 0)
-                macro = 0x80 + bit;  // Not reassigned: default to self
-            else if (macro <= 4)
-                macro--;
-            if (is_pressed != was_pressed) {
-                if (config.debug_flag & DF_AMIGA_JOYSTICK) {
-                    uint bnum = bit;
-                    if (!is_pressed)
-                        putchar('-');
-                    putchar('B');
-                    if (bnum >= 10) {
-                        putchar('0' + bnum / 10);
-                        bnum %= 10;
-                    }
-                    putchar('0' + bnum);
+        uint32_t changed = buttons ^ last_buttons;
+        uint     bit;
+
+        if (joystick_map_gen != config_gen)
+            joystick_map_update();
+
+        /* Visit only the buttons which changed */
+        for (; changed != 0; changed &= changed - 1) {
+            uint is_pressed;
+            bit = __builtin_ctz(changed);
+            is_pressed = (buttons & BIT(bit)) ? 1 : 0;
+            if (config.debug_flag & DF_AMIGA_JOYSTICK) {
+                uint bnum = bit;
+                if (!is_pressed)
+                    putchar('-');
+                putchar('B');
+                if (bnum >= 10) {
+                    putchar('0' + bnum / 10);
+                    bnum %= 10;
                 }
-                capture_scancode((bit + 0x20) | KEYCAP_BUTTON |
-                                 (is_pressed ? KEYCAP_DOWN : KEYCAP_UP));
-                mouse_put_macro(macro, is_pressed, was_pressed);
+                putchar('0' + bnum);
             }
+            capture_scancode((bit + 0x20) | KEYCAP_BUTTON |
+                             (is_pressed ? KEYCAP_DOWN : KEYCAP_UP));
+            if (joystick_map[bit].jm_lines)
+                joystick_line_action(bit, is_pressed);
+            else
+                mouse_put_macro(joystick_map[bit].jm_macro, is_pressed,
+                                !is_pressed);
         }
         last_buttons = buttons;
         change = 1;
@@ -105,3 +332,16 @@ joystick_action(uint up, uint down, uint left, uint right, uint32_t buttons)
     if (change)
         hiden_set(1);
 }
+
+/*
+ * joystick_get_report() provides the current joystick state.
+ *
+ * @param [out] dirs    - Directions (BIS_JOY_* bits)
+ * @param [out] buttons - Bits representing button state (1 = pressed)
+ */
+void
+joystick_get_report(uint8_t *dirs, uint32_t *buttons)
+{
+    *dirs    = joystick_report_dirs;
+    *buttons = joystick_report_buttons;
+}
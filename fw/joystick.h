@@ -13,6 +13,7 @@
 
 void joystick_action(uint up, uint down, uint left, uint right,
                      uint32_t buttons);
+void joystick_get_report(uint8_t *dirs, uint32_t *buttons);
 
 extern uint8_t joystick_asserted;
 
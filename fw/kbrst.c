@@ -18,6 +18,7 @@
 #include "timer.h"
 #include "kbrst.h"
 #include "power.h"
+#include "bec_cmd.h"
 #include "amigartc.h"
 
 uint8_t         amiga_in_reset         = 0xff;  // Not initialized
@@ -0,0 +1,94 @@
+/*
+ * This is free and unencumbered software released into the public domain.
+ * See the LICENSE file for additional details.
+ *
+ * Designed by Chris Hooper in 2025.
+ *
+ * ---------------------------------------------------------------------
+ *
+ * LZSS compression of console output sent to the Amiga. The format is
+ * described with BEC_CMD_CONS_LZ in bec_cmd.h. Matches are found using
+ * a single-entry hash table of recent positions, which is fast and small
+ * rather than giving the best possible compression.
+ */
+
+#include <stdint.h>
+#include <string.h>
+#include "main.h"
+#include "bec_cmd.h"
+#include "lzss.h"
+#include "utils.h"
+
+#define LZSS_HASH_SIZE  256  // Must be a power of 2
+
+static uint16_t lzss_head[LZSS_HASH_SIZE];  // Last position + 1 of hash
+
+static uint
+lzss_hash(const uint8_t *ptr)
+{
+    return (((ptr[0] << 5) ^ (ptr[1] << 2) ^ ptr[2]) & (LZSS_HASH_SIZE - 1));
+}
+
+/*
+ * lzss_compress
+ * -------------
+ * Compresses as much of src as will fit in dst. The number of bytes of
+ * src which were compressed is returned in srcused. Returns the number of
+ * bytes written to dst.
+ */
+uint
+lzss_compress(const uint8_t *src, uint srclen, uint8_t *dst, uint dstmax,
+              uint *srcused)
+{
+    uint spos = 0;
+    uint dpos = 0;
+    uint fpos = 0;
+    uint bit = 8;
+
+    memset(lzss_head, 0, sizeof (lzss_head));
+    while (spos < srclen) {
+        uint len = 0;
+        uint dist = 0;
+
+        if (bit == 8) {
+            /* Start a new group only if a whole group will fit */
+            if (dpos + 1 + 8 * 2 > dstmax)
+                break;
+            fpos = dpos++;
+            dst[fpos] = 0;
+            bit = 0;
+        }
+        if (spos + BCL_MIN_MATCH <= srclen) {
+            uint h    = lzss_hash(src + spos);
+            uint cand = lzss_head[h];
+            uint max  = srclen - spos;
+
+            lzss_head[h] = spos + 1;
+            if (max > BCL_MAX_MATCH)
+                max = BCL_MAX_MATCH;
+            if ((cand != 0) && (spos - (cand - 1) <= BCL_WINDOW)) {
+                cand--;
+                while ((len < max) && (src[cand + len] == src[spos + len]))
+                    len++;
+                dist = spos - cand;
+            }
+        }
+        if (len >= BCL_MIN_MATCH) {
+            uint word = ((dist - 1) << 4) | (len - BCL_MIN_MATCH);
+            uint cur;
+
+            dst[fpos] |= BIT(bit);
+            dst[dpos++] = word >> 8;
+            dst[dpos++] = word;
+            for (cur = spos + 1; cur < spos + len; cur++)
+                if (cur + BCL_MIN_MATCH <= srclen)
+                    lzss_head[lzss_hash(src + cur)] = cur + 1;
+            spos += len;
+        } else {
+            dst[dpos++] = src[spos++];
+        }
+        bit++;
+    }
+    *srcused = spos;
+    return (dpos);
+}
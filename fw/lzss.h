@@ -0,0 +1,18 @@
+/*
+ * This is free and unencumbered software released into the public domain.
+ * See the LICENSE file for additional details.
+ *
+ * Designed by Chris Hooper in 2025.
+ *
+ * ---------------------------------------------------------------------
+ *
+ * LZSS compression of console output sent to the Amiga.
+ */
+
+#ifndef _LZSS_H
+#define _LZSS_H
+
+uint lzss_compress(const uint8_t *src, uint srclen, uint8_t *dst, uint dstmax,
+                   uint *srcused);
+
+#endif /* _LZSS_H */
@@ -17,12 +17,14 @@
 #include "rtc.h"
 #include "timer.h"
 #include "uart.h"
+#include "bec_cmd.h"
 #include "amigartc.h"
 #include "button.h"
 #include "cmdline.h"
 #include "clock.h"
 #include "config.h"
 #include "fan.h"
+#include "fwupdate.h"
 #include "i2c.h"
 #include "kbrst.h"
 #include "keyboard.h"
@@ -66,6 +68,7 @@ main_poll(void)
     amigartc_poll();
     hiden_poll();
     button_poll();
+    fwupdate_poll();
 }
 
 int
@@ -90,6 +93,7 @@ main(void)
     gpio_init();            // Needs UART for debug
     sensor_init();          // also starts adc_init()
     rtc_init();
+    fwupdate_init();        // Needs RTC backup register access
     amigartc_init();
     keyboard_init();
     mouse_init();
@@ -57,6 +57,10 @@ static volatile int mouse_y;
 uint32_t mouse_buttons_add;
 uint8_t mouse_asserted;
 
+/* Motion and button state reported to Amiga software by BEC message */
+static int16_t  mouse_report[4];     // X, Y, wheel, pan since last report
+static uint32_t mouse_report_buttons;
+
 /*
  * mouse_put_macro() sets a mouse button or joystick direction or sends
  *                   a keyboard macro sequence.
@@ -130,6 +134,44 @@ mouse_put_scancode(uint8_t code, uint is_pressed, uint was_pressed)
     mouse_put_macro(config.keymap[code], is_pressed, was_pressed);
 }
 
+/*
+ * mouse_report_add() accumulates motion to be reported to Amiga software.
+ *                    Each value saturates rather than wrapping.
+ */
+static void
+mouse_report_add(int off_x, int off_y, int off_wheel, int off_pan)
+{
+    int  off[4] = { off_x, off_y, off_wheel, off_pan };
+    uint cur;
+
+    for (cur = 0; cur < ARRAY_SIZE(mouse_report); cur++) {
+        int value = mouse_report[cur] + off[cur];
+        if (value > INT16_MAX)
+            value = INT16_MAX;
+        else if (value < INT16_MIN)
+            value = INT16_MIN;
+        mouse_report[cur] = value;
+    }
+}
+
+/*
+ * mouse_get_report() provides motion accumulated since the previous call
+ *                    and the current button state.
+ *
+ * @param [out] motion  - X, Y, wheel, and pan motion (NULL to leave
+ *                        motion accumulated for a later call)
+ * @param [out] buttons - Bits representing button state (1 = pressed)
+ */
+void
+mouse_get_report(int16_t motion[4], uint32_t *buttons)
+{
+    if (motion != NULL) {
+        memcpy(motion, mouse_report, sizeof (mouse_report));
+        memset(mouse_report, 0, sizeof (mouse_report));
+    }
+    *buttons = mouse_report_buttons;
+}
+
 /*
  * mouse_action() converts USB Mouse input to Amiga mouse or keyboard input.
  *
@@ -177,6 +219,7 @@ mouse_action(int off_x, int off_y, int off_wheel, int off_pan)
 
     mouse_x += off_x;
     mouse_y += off_y;
+    mouse_report_add(off_x, off_y, off_wheel, off_pan);
 
     /* Limit how far behind the mouse can get */
     if (mouse_x > 20)
@@ -279,6 +322,7 @@ mouse_action_button(uint32_t buttons)
             }
         }
         last_buttons = buttons;
+        mouse_report_buttons = buttons;
         mouse_asserted = !!buttons;
         change = 1;
     }
@@ -316,6 +360,10 @@ mouse_set_defaults(void)
     config.mouse_div_y = 0;
     for (cur = 0; cur < ARRAY_SIZE(config.buttonmap); cur++)
         config.buttonmap[cur] = default_button_to_amiga[cur];
+    memset(config.joy_autofire, 0, sizeof (config.joy_autofire));
+    config.stick_deadzone = STICK_DEF_DEADZONE;
+    config.stick_expo = 0;
+    config.stick_speed = 0;
 }
 
 /*
@@ -352,10 +400,167 @@ move_y(int dir)
     *QY1_GPIO = quad1[yquad];
 }
 
+/*
+ * Analog stick to pointer motion (gamepad as mouse). The stick position
+ * is shaped by a radial dead zone and a speed curve, then integrated at
+ * a fixed rate from mouse_poll(), independent of how often the USB
+ * device reports. Motion below one count is carried to the next period.
+ */
+#define STICK_TICK_USEC   4000   // Integration period
+#define STICK_MAX         32767  // Full deflection
+#define STICK_SEGS        16     // Speed curve segments
+#define STICK_SPEED_MAX   4000   // Quadrature output limit (counts/sec)
+#define STICK_DEF_SPEED   800    // Default top speed (counts/sec)
+
+static int16_t  stick_x;
+static int16_t  stick_y;
+static int32_t  stick_accum_x;              // 1/256 counts
+static int32_t  stick_accum_y;              // 1/256 counts
+static uint16_t stick_curve[STICK_SEGS + 1]; // Speed (counts/sec)
+static uint16_t stick_deadzone;             // Dead zone radius
+static uint     stick_gen;                  // config_gen of stick_curve[]
+
+/*
+ * stick_curve_update() builds the speed curve from the config. The
+ *                      curve blends linear and cubic response by
+ *                      config.stick_expo percent.
+ */
+static void
+stick_curve_update(void)
+{
+    uint dz    = config.stick_deadzone;
+    uint speed = config.stick_speed;
+    uint expo  = config.stick_expo;
+    uint pos;
+
+    if (dz > 90)
+        dz = 90;
+    if (speed == 0)
+        speed = STICK_DEF_SPEED;
+    else if (speed > STICK_SPEED_MAX)
+        speed = STICK_SPEED_MAX;
+    if (expo > 100)
+        expo = 100;
+
+    for (pos = 0; pos <= STICK_SEGS; pos++) {
+        uint t  = pos * 4096 / STICK_SEGS;          // 0 - 4096
+        uint t3 = (t * t / 4096) * t / 4096;
+        uint s  = ((100 - expo) * t + expo * t3) / 100;
+        stick_curve[pos] = speed * s / 4096;
+    }
+    stick_deadzone = STICK_MAX * dz / 100;
+    stick_gen = config_gen;
+}
+
+/*
+ * isqrt() returns the integer square root of the specified value.
+ */
+static uint
+isqrt(uint32_t value)
+{
+    uint32_t root = 0;
+    uint32_t bit  = BIT(30);
+
+    while (bit > value)
+        bit >>= 2;
+    while (bit != 0) {
+        if (value >= root + bit) {
+            value -= root + bit;
+            root = (root >> 1) + bit;
+        } else {
+            root >>= 1;
+        }
+        bit >>= 2;
+    }
+    return (root);
+}
+
+/*
+ * mouse_stick() sets the analog stick position which drives the pointer.
+ *
+ * @param [in]  x - Stick X position (-32767 to 32767, < 0 is left)
+ * @param [in]  y - Stick Y position (-32767 to 32767, < 0 is up)
+ */
+void
+mouse_stick(int x, int y)
+{
+    if (x < -STICK_MAX)
+        x = -STICK_MAX;
+    if (y < -STICK_MAX)
+        y = -STICK_MAX;
+    stick_x = x;
+    stick_y = y;
+}
+
+/*
+ * stick_step() converts one integration period of stick deflection to
+ *              pointer motion.
+ */
+static void
+stick_step(void)
+{
+    int  x = stick_x;
+    int  y = stick_y;
+    uint mag;
+    uint pos;
+    uint seg;
+    uint speed;
+    int  step;
+    int  mx;
+    int  my;
+
+    if (stick_gen != config_gen)
+        stick_curve_update();
+
+    mag = isqrt((uint32_t) (x * x) + (uint32_t) (y * y));
+    if (mag <= stick_deadzone) {
+        stick_accum_x = 0;
+        stick_accum_y = 0;
+        return;
+    }
+
+    /* Position along the curve beyond the dead zone, 8.8 segments */
+    pos = mag;
+    if (pos > STICK_MAX)
+        pos = STICK_MAX;  // Diagonal of a square stick gate
+    pos = (pos - stick_deadzone) * (STICK_SEGS << 8) /
+          (STICK_MAX - stick_deadzone);
+    seg = pos >> 8;
+    if (seg >= STICK_SEGS) {
+        speed = stick_curve[STICK_SEGS];
+    } else {
+        speed = stick_curve[seg] +
+                (((int) stick_curve[seg + 1] - stick_curve[seg]) *
+                 (int) (pos & 0xff)) / 256;
+    }
+
+    /* Motion this period in 1/256 counts, split along the stick vector */
+    step = speed * 256 / (1000000 / STICK_TICK_USEC);
+    stick_accum_x += step * x / (int) mag;
+    stick_accum_y += step * y / (int) mag;
+    mx = stick_accum_x / 256;
+    my = stick_accum_y / 256;
+    stick_accum_x -= mx * 256;
+    stick_accum_y -= my * 256;
+    if ((mx != 0) || (my != 0))
+        mouse_action(mx, my, 0, 0);
+}
+
 void
 mouse_poll(void)
 {
     static uint64_t mouse_timer;
+    static uint64_t stick_timer;
+
+    if (((stick_x != 0) || (stick_y != 0)) &&
+        timer_tick_has_elapsed(stick_timer)) {
+        /* Fixed rate; restart the schedule if it fell well behind */
+        uint64_t period = timer_usec_to_tick(STICK_TICK_USEC);
+        if (timer_tick_has_elapsed(stick_timer + period * 4))
+            stick_timer = timer_tick_get();
+        stick_timer += period;
+        stick_step();
+    }
 
     if (!timer_tick_has_elapsed(mouse_timer))
         return;
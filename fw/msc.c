@@ -0,0 +1,339 @@
+/*
+ * This is free and unencumbered software released into the public domain.
+ * See the LICENSE file for additional details.
+ *
+ * Designed by Chris Hooper in 2025.
+ *
+ * ---------------------------------------------------------------------
+ *
+ * USB Mass Storage block access for the BEC block device bridge.
+ *
+ * Each logical unit of each attached USB Mass Storage device is assigned
+ * a unit number, in order of USB port, hub port, and LUN. Reads are
+ * satisfied from a small read-ahead cache, which is filled with a single
+ * multi-block SCSI read. Writes go directly to the device and update any
+ * cached copy of the written blocks.
+ *
+ * USBH_MSC_Read() and USBH_MSC_Write() block until the transfer is done,
+ * so the main loop, including keyboard and mouse forwarding, stalls for
+ * the device's response to each message. That is bounded by the transfer
+ * size: at most MSC_CACHE_BLOCKS blocks for a cache fill and
+ * BBK_MAX_BLOCKS blocks for a write. A slow device can still take tens
+ * of milliseconds per command, during which HID reports are not read.
+ */
+
+#include <stdint.h>
+#include <string.h>
+#include "main.h"
+#include "bec_cmd.h"
+#include "config.h"
+#include "printf.h"
+#include "utils.h"
+#include "msc.h"
+#include <usbh_core.h>
+#include <usbh_msc.h>
+#include <usbh_hub.h>
+
+extern USBH_HandleTypeDef usb_handle[2][MAX_HUB_PORTS + 1];
+
+static uint8_t msc_cache_buf[MSC_CACHE_BLOCKS * MSC_BLOCK_SIZE]
+                                        __attribute__((aligned(4)));
+static struct {
+    USBH_HandleTypeDef *phost;     // Device which owns cache contents
+    uint8_t             lun;       // Logical unit which owns cache contents
+    uint8_t             count;     // Number of valid blocks (0 = empty)
+    uint32_t            lba;       // First block in cache
+    uint32_t            hits;      // Reads satisfied from cache
+    uint32_t            misses;    // Reads which required device access
+} msc_cache;
+
+/*
+ * msc_is_ready
+ * ------------
+ * Returns non-zero if the specified USB device handle is an enumerated
+ * Mass Storage device.
+ */
+static uint
+msc_is_ready(USBH_HandleTypeDef *phost)
+{
+    return ((phost->valid == 1) &&
+            (phost->device.is_connected != 0) &&
+            (phost->pActiveClass != NULL) &&
+            (phost->pActiveClass->ClassCode == USB_MSC_CLASS) &&
+            (phost->pActiveClass->pData != NULL) &&
+            (phost->gState == HOST_CLASS));
+}
+
+/*
+ * msc_find_unit
+ * -------------
+ * Locates the USB device handle and LUN of the specified unit number.
+ * If unit is past the last unit, the count of units is returned in
+ * unit_count (if not NULL).
+ */
+static USBH_HandleTypeDef *
+msc_find_unit(uint unit, uint8_t *lun, uint *unit_count)
+{
+    uint port;
+    uint dev;
+    uint cur = 0;
+
+    for (port = 0; port < ARRAY_SIZE(usb_handle); port++) {
+        for (dev = 0; dev < ARRAY_SIZE(usb_handle[0]); dev++) {
+            USBH_HandleTypeDef *phost = &usb_handle[port][dev];
+            MSC_HandleTypeDef  *msc;
+            uint                luns;
+
+            if (!msc_is_ready(phost))
+                continue;
+            msc = phost->pActiveClass->pData;
+            luns = msc->max_lun;
+            if (luns > MAX_SUPPORTED_LUN)
+                luns = MAX_SUPPORTED_LUN;
+            if (unit < cur + luns) {
+                *lun = unit - cur;
+                return (phost);
+            }
+            cur += luns;
+        }
+    }
+    if (unit_count != NULL)
+        *unit_count = cur;
+    return (NULL);
+}
+
+/*
+ * msc_port_busy
+ * -------------
+ * Returns non-zero if a device on the same USB port as phost is in the
+ * middle of a transaction. Switching the host channels to another device
+ * at this point would corrupt that transaction.
+ */
+static uint
+msc_port_busy(USBH_HandleTypeDef *phost)
+{
+    uint port;
+    uint dev;
+
+    for (port = 0; port < ARRAY_SIZE(usb_handle); port++) {
+        if ((phost < &usb_handle[port][0]) ||
+            (phost > &usb_handle[port][ARRAY_SIZE(usb_handle[0]) - 1]))
+            continue;
+        for (dev = 0; dev < ARRAY_SIZE(usb_handle[0]); dev++) {
+            USBH_HandleTypeDef *other = &usb_handle[port][dev];
+            if ((other != phost) && (other->valid == 1) && other->busy)
+                return (1);
+        }
+    }
+    return (0);
+}
+
+/*
+ * msc_get_unit
+ * ------------
+ * Looks up the specified unit and verifies that it may be accessed now.
+ * Returns BEC_STATUS_OK on success.
+ */
+static uint
+msc_get_unit(uint unit, USBH_HandleTypeDef **phostp, uint8_t *lun)
+{
+    USBH_HandleTypeDef *phost = msc_find_unit(unit, lun, NULL);
+
+    if (phost == NULL)
+        return (BEC_STATUS_BADARG);
+    if (!USBH_MSC_IsReady(phost) || msc_port_busy(phost))
+        return (BEC_STATUS_LOCKED);
+    if (!USBH_MSC_UnitIsReady(phost, *lun))
+        return (BEC_STATUS_NODATA);
+    *phostp = phost;
+    return (BEC_STATUS_OK);
+}
+
+/*
+ * msc_unit_count
+ * --------------
+ * Returns the number of Mass Storage units currently available.
+ */
+uint
+msc_unit_count(void)
+{
+    uint8_t lun;
+    uint    count = 0;
+
+    (void) msc_find_unit(~0U, &lun, &count);
+    return (count);
+}
+
+/*
+ * msc_info
+ * --------
+ * Reports the number of blocks of the specified unit.
+ */
+uint
+msc_info(uint unit, uint32_t *blocks)
+{
+    USBH_HandleTypeDef *phost;
+    MSC_LUNTypeDef      info;
+    uint8_t             lun;
+    uint                rc;
+
+    rc = msc_get_unit(unit, &phost, &lun);
+    if (rc != BEC_STATUS_OK)
+        return (rc);
+    if (USBH_MSC_GetLUNInfo(phost, lun, &info) != USBH_OK)
+        return (BEC_STATUS_FAIL);
+    if (info.capacity.block_size != MSC_BLOCK_SIZE)
+        return (BEC_STATUS_BADLEN);
+    *blocks = info.capacity.block_nbr;
+    return (BEC_STATUS_OK);
+}
+
+/*
+ * msc_invalidate
+ * --------------
+ * Discards read-ahead cache contents. This is called when a USB device
+ * is disconnected.
+ */
+void
+msc_invalidate(void)
+{
+    msc_cache.count = 0;
+    msc_cache.phost = NULL;
+}
+
+/*
+ * msc_read
+ * --------
+ * Reads count blocks starting at lba from the specified unit. If the
+ * blocks are not already in the read-ahead cache, the cache is refilled
+ * starting at lba.
+ */
+uint
+msc_read(uint unit, uint32_t lba, uint count, void *buf)
+{
+    USBH_HandleTypeDef *phost;
+    MSC_LUNTypeDef      info;
+    uint32_t            fill;
+    uint8_t             lun;
+    uint                rc;
+
+    if ((count == 0) || (count > MSC_CACHE_BLOCKS))
+        return (BEC_STATUS_BADLEN);
+    rc = msc_get_unit(unit, &phost, &lun);
+    if (rc != BEC_STATUS_OK)
+        return (rc);
+
+    if ((msc_cache.phost == phost) && (msc_cache.lun == lun) &&
+        (lba >= msc_cache.lba) &&
+        (lba + count <= msc_cache.lba + msc_cache.count)) {
+        msc_cache.hits++;
+        goto read_from_cache;
+    }
+    msc_cache.misses++;
+
+    if (USBH_MSC_GetLUNInfo(phost, lun, &info) != USBH_OK)
+        return (BEC_STATUS_FAIL);
+    if (info.capacity.block_size != MSC_BLOCK_SIZE)
+        return (BEC_STATUS_BADLEN);
+    if ((lba >= info.capacity.block_nbr) ||
+        (count > info.capacity.block_nbr - lba))
+        return (BEC_STATUS_BADARG);
+
+    /* Read ahead, but not past the end of the unit */
+    fill = info.capacity.block_nbr - lba;
+    if (fill > MSC_CACHE_BLOCKS)
+        fill = MSC_CACHE_BLOCKS;
+
+    msc_invalidate();
+    USBH_switch_to_dev(phost);
+    if (USBH_MSC_Read(phost, lun, lba, msc_cache_buf, fill) != USBH_OK) {
+        dprintf(DF_USB_CONN, "MSC%u read %lx fail\n", unit, lba);
+        return (BEC_STATUS_FAIL);
+    }
+    msc_cache.phost = phost;
+    msc_cache.lun   = lun;
+    msc_cache.lba   = lba;
+    msc_cache.count = fill;
+
+read_from_cache:
+    memcpy(buf, msc_cache_buf + (lba - msc_cache.lba) * MSC_BLOCK_SIZE,
+           count * MSC_BLOCK_SIZE);
+    return (BEC_STATUS_OK);
+}
+
+/*
+ * msc_write
+ * ---------
+ * Writes count blocks starting at lba to the specified unit. Any of
+ * the written blocks which are present in the read-ahead cache are
+ * updated in the cache as well.
+ */
+uint
+msc_write(uint unit, uint32_t lba, uint count, const void *buf)
+{
+    USBH_HandleTypeDef *phost;
+    MSC_LUNTypeDef      info;
+    uint8_t             lun;
+    uint                rc;
+    uint                cur;
+
+    if (count == 0)
+        return (BEC_STATUS_BADLEN);
+    rc = msc_get_unit(unit, &phost, &lun);
+    if (rc != BEC_STATUS_OK)
+        return (rc);
+    if (USBH_MSC_GetLUNInfo(phost, lun, &info) != USBH_OK)
+        return (BEC_STATUS_FAIL);
+    if (info.capacity.block_size != MSC_BLOCK_SIZE)
+        return (BEC_STATUS_BADLEN);
+    if ((lba >= info.capacity.block_nbr) ||
+        (count > info.capacity.block_nbr - lba))
+        return (BEC_STATUS_BADARG);
+
+    USBH_switch_to_dev(phost);
+    if (USBH_MSC_Write(phost, lun, lba, (uint8_t *) buf, count) != USBH_OK) {
+        dprintf(DF_USB_CONN, "MSC%u write %lx fail\n", unit, lba);
+        msc_invalidate();
+        return (BEC_STATUS_FAIL);
+    }
+
+    if ((msc_cache.phost == phost) && (msc_cache.lun == lun)) {
+        for (cur = 0; cur < count; cur++) {
+            if ((lba + cur >= msc_cache.lba) &&
+                (lba + cur < msc_cache.lba + msc_cache.count)) {
+                memcpy(msc_cache_buf +
+                       (lba + cur - msc_cache.lba) * MSC_BLOCK_SIZE,
+                       (const uint8_t *) buf + cur * MSC_BLOCK_SIZE,
+                       MSC_BLOCK_SIZE);
+            }
+        }
+    }
+    return (BEC_STATUS_OK);
+}
+
+/*
+ * msc_show
+ * --------
+ * Displays available Mass Storage units and cache statistics.
+ */
+void
+msc_show(void)
+{
+    uint     count = msc_unit_count();
+    uint     unit;
+    uint32_t blocks;
+    uint     rc;
+
+    for (unit = 0; unit < count; unit++) {
+        rc = msc_info(unit, &blocks);
+        if (rc == BEC_STATUS_OK) {
+            printf("MSC%u %lu blocks (%lu MB)\n", unit, blocks,
+                   blocks / (1024 * 1024 / MSC_BLOCK_SIZE));
+        } else {
+            printf("MSC%u unavailable (%u)\n", unit, rc);
+        }
+    }
+    if (count == 0)
+        printf("No USB Mass Storage units\n");
+    printf("Cache hits=%lu misses=%lu\n", msc_cache.hits, msc_cache.misses);
+}
@@ -0,0 +1,25 @@
+/*
+ * This is free and unencumbered software released into the public domain.
+ * See the LICENSE file for additional details.
+ *
+ * Designed by Chris Hooper in 2025.
+ *
+ * ---------------------------------------------------------------------
+ *
+ * USB Mass Storage block access for the BEC block device bridge.
+ */
+
+#ifndef _MSC_H
+#define _MSC_H
+
+#define MSC_BLOCK_SIZE    512  // Only 512-byte block devices are supported
+#define MSC_CACHE_BLOCKS  8    // Read-ahead cache size in blocks
+
+uint msc_unit_count(void);
+uint msc_info(uint unit, uint32_t *blocks);
+uint msc_read(uint unit, uint32_t lba, uint count, void *buf);
+uint msc_write(uint unit, uint32_t lba, uint count, const void *buf);
+void msc_invalidate(void);
+void msc_show(void);
+
+#endif /* _MSC_H */
@@ -1,12 +1,20 @@
 #include <stdint.h>
 #include <stdbool.h>
 #include <string.h>
+#include <libopencm3/stm32/rcc.h>
 #include "bec_cmd.h"
+#include "cmdline.h"
 #include "main.h"
 #include "msg.h"
 #include "amigartc.h"
+#include "fwupdate.h"
+#include "joystick.h"
 #include "keyboard.h"
+#include "lzss.h"
 #include "mouse.h"
+#include "msc.h"
+#include "sensor.h"
+#include "snoop.h"
 #include "config.h"
 #include "crc32.h"
 #include "keyboard.h"
@@ -31,6 +39,13 @@ static const uint8_t testpatt_reply[] = {
 
 uint8_t msg_source;  // 0 = RTC, 1 = Keyboard
 
+/* Staging area for keymap image received by BEC_CMD_SET_MAP_BULK */
+#define KEYMAP_IMAGE_MAX (sizeof (bec_keymap_image_t) + \
+                          sizeof (config.keymap) + sizeof (config.buttonmap))
+static uint8_t  keymap_image[KEYMAP_IMAGE_MAX] __attribute__((aligned(4)));
+static uint16_t keymap_image_len;  // Expected image size (0 = not active)
+static uint16_t keymap_image_got;  // Bytes of image received so far
+
 static void
 msg_reply(uint rstatus, uint rlen1, const void *data1,
                         uint rlen2, const void *data2)
@@ -51,8 +66,8 @@ msg_reply(uint rstatus, uint rlen1, const void *data1,
     bec_msg_outbuf[4] = (uint8_t) rlen;
     if (rlen1 > 0)
         memcpy(&bec_msg_outbuf[5], data1, rlen1);
-    if (rlen2 > 0)
-        memcpy(&bec_msg_outbuf[5] + rlen1, data2, rlen2);
+    if ((rlen2 > 0) && (data2 != &bec_msg_outbuf[5] + rlen1))
+        memcpy(&bec_msg_outbuf[5] + rlen1, data2, rlen2);  // Not in place
 
     /* CRC includes cmd + length + data */
     crc = crc32(0, bec_msg_outbuf + 2, rlen + BEC_MSG_HDR_LEN - 2);
@@ -176,6 +191,530 @@ msg_set_map_reply(bec_keymap_t *req, void *buf, uint maxcount, uint esize)
     msg_reply(BEC_STATUS_OK, 0, NULL, 0, NULL);
 }
 
+/*
+ * keymap_image_copy
+ * -----------------
+ * Copies entries from a keymap image to a config map, adjusting for any
+ * difference in entry size. Entries not provided by the image are cleared.
+ */
+static const uint8_t *
+keymap_image_copy(void *map, uint maxcount, uint esize,
+                  const uint8_t *data, uint count, uint dsize)
+{
+    uint8_t *bufptr = (uint8_t *) map;
+    uint     cur;
+    uint     key;
+
+    for (cur = 0; cur < count; cur++) {
+        for (key = 0; (key < dsize) && (key < esize); key++)
+            *(bufptr++) = data[key];
+        for (; key < esize; key++)
+            *(bufptr++) = 0;
+        data += dsize;
+    }
+    memset(bufptr, 0, (maxcount - count) * esize);
+    return (data);
+}
+
+/*
+ * keymap_image_apply
+ * ------------------
+ * Verifies the staged keymap image and, only if it is entirely valid,
+ * replaces the current keymap and button map with its contents.
+ */
+static uint
+keymap_image_apply(void)
+{
+    bec_keymap_image_t *hdr  = (void *) keymap_image;
+    const uint8_t      *data = (const uint8_t *) (hdr + 1);
+    uint                esize;
+    uint                keys;
+    uint                buttons;
+    uint                datalen;
+
+    if ((keymap_image_len < sizeof (*hdr)) ||
+        (keymap_image_got != keymap_image_len))
+        return (BEC_STATUS_BADLEN);
+
+    esize   = hdr->bki_esize;
+    keys    = SWAP16(hdr->bki_keys);
+    buttons = SWAP16(hdr->bki_buttons);
+    if ((SWAP32(hdr->bki_magic) != BKI_MAGIC) ||
+        (hdr->bki_version != BKI_VERSION) || (esize == 0) ||
+        (keys > ARRAY_SIZE(config.keymap)) ||
+        (buttons > ARRAY_SIZE(config.buttonmap)))
+        return (BEC_STATUS_BADARG);
+
+    datalen = (keys + buttons) * esize;
+    if (sizeof (*hdr) + datalen != keymap_image_len)
+        return (BEC_STATUS_BADLEN);
+    if (crc32(0, data, datalen) != SWAP32(hdr->bki_crc))
+        return (BEC_STATUS_CRC);
+
+    data = keymap_image_copy(config.keymap, ARRAY_SIZE(config.keymap),
+                             sizeof (config.keymap[0]), data, keys, esize);
+    (void) keymap_image_copy(config.buttonmap, ARRAY_SIZE(config.buttonmap),
+                             sizeof (config.buttonmap[0]), data, buttons,
+                             esize);
+    config_updated();
+    return (BEC_STATUS_OK);
+}
+
+static void
+msg_set_map_bulk(uint msglen)
+{
+    bec_keymap_bulk_t *req  = (void *) &bec_msg_inbuf[BEC_MSG_HDR_LEN];
+    uint8_t           *data = (void *) (req + 1);
+    uint               offset;
+    uint               rc   = BEC_STATUS_OK;
+
+    if (msglen < sizeof (*req)) {
+        msg_reply(BEC_STATUS_BADLEN, 0, NULL, 0, NULL);
+        return;
+    }
+    msglen -= sizeof (*req);
+    offset  = SWAP16(req->bkb_offset);
+
+    switch (req->bkb_op) {
+        case BKB_OP_START:
+            if ((offset < sizeof (bec_keymap_image_t)) ||
+                (offset > sizeof (keymap_image))) {
+                rc = BEC_STATUS_BADLEN;
+                break;
+            }
+            keymap_image_len = offset;
+            keymap_image_got = 0;
+            break;
+        case BKB_OP_DATA:
+            /* Data must arrive in order, but a resend is allowed */
+            if (keymap_image_len == 0) {
+                rc = BEC_STATUS_FAIL;
+            } else if ((offset > keymap_image_got) ||
+                       (offset + msglen > keymap_image_len)) {
+                rc = BEC_STATUS_BADLEN;
+            } else {
+                memcpy(keymap_image + offset, data, msglen);
+                if (keymap_image_got < offset + msglen)
+                    keymap_image_got = offset + msglen;
+            }
+            break;
+        case BKB_OP_COMMIT:
+            if (keymap_image_len == 0) {
+                rc = BEC_STATUS_FAIL;
+                break;
+            }
+            rc = keymap_image_apply();
+            keymap_image_len = 0;
+            break;
+        default:
+            rc = BEC_STATUS_BADARG;
+            break;
+    }
+    msg_reply(rc, 0, NULL, 0, NULL);
+}
+
+#ifdef USE_STMCUBEUSB
+/*
+ * msg_blk
+ * -------
+ * Handles USB Mass Storage block device requests. Read data is placed
+ * directly in the reply buffer to avoid an extra copy.
+ */
+static void
+msg_blk(uint cmd, uint msglen)
+{
+    bec_blk_t *req   = (void *) &bec_msg_inbuf[BEC_MSG_HDR_LEN];
+    uint8_t   *rdata = &bec_msg_outbuf[BEC_MSG_HDR_LEN + sizeof (*req)];
+    uint32_t   lba;
+    uint       count;
+    uint       rc;
+
+    if (msglen < sizeof (*req)) {
+        msg_reply(BEC_STATUS_BADLEN, 0, NULL, 0, NULL);
+        return;
+    }
+    lba   = SWAP32(req->bbk_lba);
+    count = req->bbk_count;
+
+    switch (cmd) {
+        case BEC_CMD_BLK_INFO:
+            rc = msc_info(req->bbk_unit, &lba);
+            req->bbk_count   = msc_unit_count();
+            req->bbk_blksize = SWAP16(BBK_BLOCK_SIZE);
+            req->bbk_lba     = SWAP32((rc == BEC_STATUS_OK) ? lba : 0);
+            msg_reply(rc, sizeof (*req), req, 0, NULL);
+            return;
+        case BEC_CMD_BLK_READ:
+            if ((count > BBK_MAX_BLOCKS) ||
+                (SWAP16(req->bbk_blksize) != BBK_BLOCK_SIZE)) {
+                rc = BEC_STATUS_BADLEN;
+                break;
+            }
+            rc = msc_read(req->bbk_unit, lba, count, rdata);
+            if (rc != BEC_STATUS_OK)
+                break;
+            msg_reply(rc, sizeof (*req), req, count * BBK_BLOCK_SIZE, rdata);
+            return;
+        case BEC_CMD_BLK_WRITE:
+            if ((count > BBK_MAX_BLOCKS) ||
+                (SWAP16(req->bbk_blksize) != BBK_BLOCK_SIZE) ||
+                (msglen != sizeof (*req) + count * BBK_BLOCK_SIZE)) {
+                rc = BEC_STATUS_BADLEN;
+                break;
+            }
+            rc = msc_write(req->bbk_unit, lba, count, req + 1);
+            break;
+        default:
+            rc = BEC_STATUS_UNKCMD;
+            break;
+    }
+    msg_reply(rc, sizeof (*req), req, 0, NULL);
+}
+#endif
+
+/*
+ * msg_capture_setup
+ * -----------------
+ * Starts, extends, or stops key capture for BEC_CMD_POLL_INPUT and
+ * BEC_CMD_INPUT_SNAP. The timeout is big endian, in milliseconds.
+ */
+static void
+msg_capture_setup(uint source, uint16_t timeout)
+{
+    if (timeout) {
+        keyboard_cap_timeout = timer_tick_plus_msec(SWAP16(timeout));
+        keyboard_cap_src_req = source;
+    } else {
+        keyboard_cap_timeout = 0;
+        keyboard_cap_src_req = 0;
+    }
+}
+
+/*
+ * msg_tlv_put
+ * -----------
+ * Appends a TLV record header to an input snapshot reply, returning
+ * a pointer to where the value should be placed.
+ */
+static uint8_t *
+msg_tlv_put(uint8_t *ptr, uint type, uint len)
+{
+    ptr[0] = type;
+    ptr[1] = len;
+    return (ptr + 2);
+}
+
+/*
+ * msg_input_snap
+ * --------------
+ * Gathers key captures, mouse motion, button and joystick state, and
+ * console output into a single reply of TLV records. The reply is built
+ * in place in the outgoing message buffer.
+ */
+static void
+msg_input_snap(uint msglen)
+{
+    bec_input_snap_t *req  = (void *) &bec_msg_inbuf[BEC_MSG_HDR_LEN];
+    uint8_t          *rbuf = &bec_msg_outbuf[BEC_MSG_HDR_LEN];
+    uint8_t          *ptr  = rbuf;
+    uint              what;
+    uint              count;
+    uint              pos;
+
+    if (msglen < sizeof (*req)) {
+        msg_reply(BEC_STATUS_BADLEN, 0, NULL, 0, NULL);
+        return;
+    }
+    what = req->bis_what;
+    switch (req->bis_source) {
+        case BKM_SOURCE_NONE:
+        case BKM_SOURCE_HID_SCANCODE:
+        case BKM_SOURCE_AMIGA_SCANCODE:
+            break;
+        default:
+            msg_reply(BEC_STATUS_BADARG, 0, NULL, 0, NULL);
+            return;
+    }
+    msg_capture_setup(req->bis_source, req->bis_timeout);
+
+    if ((what & BIS_WHAT_KEYS) && (req->bis_keys > 0)) {
+        uint16_t keys[64];
+        uint     max = req->bis_keys;
+        if (max > ARRAY_SIZE(keys))
+            max = ARRAY_SIZE(keys);
+
+        /* Second call gets entries which wrapped in the capture ring */
+        count = keyboard_get_capture(max, keys);
+        if (count < max)
+            count += keyboard_get_capture(max - count, keys + count);
+        if (count > 0) {
+            ptr = msg_tlv_put(ptr, BIS_TLV_KEYS, count * 2);
+            for (pos = 0; pos < count; pos++) {
+                *(ptr++) = (uint8_t) keys[pos];
+                *(ptr++) = keys[pos] >> 8;
+            }
+        }
+    }
+    if (what & (BIS_WHAT_MOUSE | BIS_WHAT_BUTTONS)) {
+        int16_t  motion[4];
+        uint32_t buttons[2];
+        uint8_t  dirs;
+
+        mouse_get_report((what & BIS_WHAT_MOUSE) ? motion : NULL,
+                         &buttons[0]);
+        if ((what & BIS_WHAT_MOUSE) &&
+            (motion[0] | motion[1] | motion[2] | motion[3])) {
+            ptr = msg_tlv_put(ptr, BIS_TLV_MOUSE, sizeof (motion));
+            for (pos = 0; pos < ARRAY_SIZE(motion); pos++) {
+                uint16_t value = SWAP16((uint16_t) motion[pos]);
+                memcpy(ptr, &value, sizeof (value));
+                ptr += sizeof (value);
+            }
+        }
+        if (what & BIS_WHAT_BUTTONS) {
+            joystick_get_report(&dirs, &buttons[1]);
+            buttons[0] = SWAP32(buttons[0]);
+            buttons[1] = SWAP32(buttons[1]);
+            ptr = msg_tlv_put(ptr, BIS_TLV_BUTTONS, sizeof (buttons));
+            memcpy(ptr, buttons, sizeof (buttons));
+            ptr += sizeof (buttons);
+        }
+    }
+    if (what & BIS_WHAT_JOYSTICK) {
+        uint32_t buttons;
+        uint8_t  dirs;
+
+        joystick_get_report(&dirs, &buttons);
+        ptr = msg_tlv_put(ptr, BIS_TLV_JOYSTICK, sizeof (dirs));
+        *(ptr++) = dirs;
+    }
+    if ((what & BIS_WHAT_CONSOLE) && (req->bis_cons > 0)) {
+        uint8_t *buf;
+        uint     max = req->bis_cons;
+        uint8_t *tlv = ptr;
+
+        ptr += 2;
+        for (count = 0; count < max; count += pos) {
+            /* Second pass gets data which wrapped in the output ring */
+            pos = ami_get_output(&buf, max - count);
+            if (pos == 0)
+                break;
+            memcpy(ptr, buf, pos);
+            ptr += pos;
+        }
+        if (count > 0)
+            (void) msg_tlv_put(tlv, BIS_TLV_CONSOLE, count);
+        else
+            ptr = tlv;
+    }
+    msg_reply(BEC_STATUS_OK, 0, NULL, ptr - rbuf, rbuf);
+}
+
+/*
+ * msg_sensor_hist
+ * ---------------
+ * Returns as many sensor history blocks as will fit in a single reply,
+ * or the sensor names and units if BSH_FLAG_NAMES is specified. The
+ * reply is built in place in the outgoing message buffer.
+ */
+static void
+msg_sensor_hist(uint msglen)
+{
+    bec_sensor_hist_t *req   = (void *) &bec_msg_inbuf[BEC_MSG_HDR_LEN];
+    bec_sensor_hist_t *reply = (void *) &bec_msg_outbuf[BEC_MSG_HDR_LEN];
+    uint8_t           *rdata = (uint8_t *) (reply + 1);
+    uint               rlen;
+    uint               count;
+    uint32_t           seq;
+    uint32_t           last;
+
+    if (msglen < sizeof (*req)) {
+        msg_reply(BEC_STATUS_BADLEN, 0, NULL, 0, NULL);
+        return;
+    }
+    seq = SWAP32(req->bsh_seq);
+    count = req->bsh_count;
+    if (req->bsh_flags & BSH_FLAG_NAMES) {
+        rlen = sensor_hist_names(rdata, BEC_MSG_MAX_PAYLOAD - sizeof (*reply),
+                                 &count);
+        last = 0;
+    } else {
+        rlen = sensor_hist_get(&seq, &last, SWAP32(req->bsh_time), rdata,
+                               BEC_MSG_MAX_PAYLOAD - sizeof (*reply), &count);
+        if (count == 0) {
+            msg_reply(BEC_STATUS_NODATA, 0, NULL, 0, NULL);
+            return;
+        }
+    }
+    memset(reply, 0, sizeof (*reply));
+    reply->bsh_seq     = SWAP32(seq);
+    reply->bsh_time    = SWAP32(timer_tick_to_usec(timer_tick_get()) / 1000);
+    reply->bsh_last    = SWAP32(last);
+    reply->bsh_count   = count;
+    reply->bsh_sensors = (req->bsh_flags & BSH_FLAG_NAMES) ? count : 0;
+    msg_reply(BEC_STATUS_OK, 0, NULL, sizeof (*reply) + rlen, reply);
+}
+
+/*
+ * msg_rtc_trace
+ * -------------
+ * Returns as many RP5C01 bus trace entries as will fit in a single reply,
+ * optionally freezing or resuming capture. The reply is built in place
+ * in the outgoing message buffer.
+ */
+static void
+msg_rtc_trace(uint msglen)
+{
+    bec_rtc_trace_t *req   = (void *) &bec_msg_inbuf[BEC_MSG_HDR_LEN];
+    bec_rtc_trace_t *reply = (void *) &bec_msg_outbuf[BEC_MSG_HDR_LEN];
+    uint32_t        *rdata = (uint32_t *) (reply + 1);
+    uint             max;
+    uint             count;
+    uint             flags;
+    uint32_t         seq;
+    uint32_t         next;
+
+    if (msglen < sizeof (*req)) {
+        msg_reply(BEC_STATUS_BADLEN, 0, NULL, 0, NULL);
+        return;
+    }
+    seq   = SWAP32(req->brt_seq);
+    flags = req->brt_flags & (BRT_FLAG_FREEZE | BRT_FLAG_RESUME);
+    max   = SWAP16(req->brt_count);
+    if (max > (BEC_MSG_MAX_PAYLOAD - sizeof (*reply)) / sizeof (*rdata))
+        max = (BEC_MSG_MAX_PAYLOAD - sizeof (*reply)) / sizeof (*rdata);
+
+    count = amigartc_trace_get(&seq, &next, rdata, max, &flags);
+
+    memset(reply, 0, sizeof (*reply));
+    reply->brt_seq     = SWAP32(seq);
+    reply->brt_next    = SWAP32(next);
+    reply->brt_tick_hz = SWAP32(rcc_apb2_frequency);
+    reply->brt_count   = SWAP16(count);
+    reply->brt_flags   = flags;
+    reply->brt_shift   = AMIGARTC_TRACE_SHIFT;
+    msg_reply(BEC_STATUS_OK, 0, NULL,
+              sizeof (*reply) + count * sizeof (*rdata), reply);
+}
+
+/*
+ * msg_snoop
+ * ---------
+ * Returns the most recent GPIO bus sampler capture as runs of identical
+ * samples, as many as will fit in a single reply. The reply is built in
+ * place in the outgoing message buffer.
+ */
+static void
+msg_snoop(uint msglen)
+{
+    bec_snoop_t     *req   = (void *) &bec_msg_inbuf[BEC_MSG_HDR_LEN];
+    bec_snoop_t     *reply = (void *) &bec_msg_outbuf[BEC_MSG_HDR_LEN];
+    bec_snoop_run_t *runs  = (bec_snoop_run_t *) (reply + 1);
+    uint             max;
+    uint             pos;
+    uint             count;
+
+    if (msglen < sizeof (*req)) {
+        msg_reply(BEC_STATUS_BADLEN, 0, NULL, 0, NULL);
+        return;
+    }
+    pos = SWAP16(req->bsn_pos);
+    max = SWAP16(req->bsn_count);
+    if (max > (BEC_MSG_MAX_PAYLOAD - sizeof (*reply)) / sizeof (*runs))
+        max = (BEC_MSG_MAX_PAYLOAD - sizeof (*reply)) / sizeof (*runs);
+
+    memset(reply, 0, sizeof (*reply));
+    if (snoop_get_info(reply) == 0) {
+        msg_reply(BEC_STATUS_NODATA, 0, NULL, 0, NULL);
+        return;
+    }
+    reply->bsn_pos   = SWAP16(pos);
+    count            = snoop_get_runs(&pos, runs, max);
+    reply->bsn_count = SWAP16(count);
+    msg_reply(BEC_STATUS_OK, 0, NULL,
+              sizeof (*reply) + count * sizeof (*runs), reply);
+}
+
+/*
+ * msg_cons_lz
+ * -----------
+ * Returns pending console output, compressed. Only as much output as
+ * compresses to fit in a single reply is consumed. The reply is built in
+ * place in the outgoing message buffer.
+ */
+static void
+msg_cons_lz(uint msglen)
+{
+    static uint8_t raw[BCL_MAX_LEN];
+    bec_cons_lz_t *req   = (void *) &bec_msg_inbuf[BEC_MSG_HDR_LEN];
+    bec_cons_lz_t *reply = (void *) &bec_msg_outbuf[BEC_MSG_HDR_LEN];
+    uint           max;
+    uint           len;
+    uint           used;
+
+    if (msglen < sizeof (*req)) {
+        msg_reply(BEC_STATUS_BADLEN, 0, NULL, 0, NULL);
+        return;
+    }
+    max = SWAP16(req->bcl_len);
+    if (max > sizeof (raw))
+        max = sizeof (raw);
+    len = ami_peek_output(raw, max);
+    len = lzss_compress(raw, len, (uint8_t *) (reply + 1),
+                        BEC_MSG_MAX_PAYLOAD - sizeof (*reply), &used);
+    ami_skip_output(used);
+    reply->bcl_len = SWAP16(used);
+    msg_reply(BEC_STATUS_OK, 0, NULL, sizeof (*reply) + len, reply);
+}
+
+/*
+ * msg_fw_update
+ * -------------
+ * Handles dual-slot firmware update requests. Every request is answered
+ * with the current update progress.
+ */
+static void
+msg_fw_update(uint msglen)
+{
+    bec_fw_update_t *req  = (void *) &bec_msg_inbuf[BEC_MSG_HDR_LEN];
+    uint8_t         *data = (void *) (req + 1);
+    bec_fw_update_t  reply;
+    uint             rc;
+
+    if (msglen < sizeof (*req)) {
+        msg_reply(BEC_STATUS_BADLEN, 0, NULL, 0, NULL);
+        return;
+    }
+    switch (req->bfu_op) {
+        case BFU_OP_STATUS:
+            rc = BEC_STATUS_OK;
+            break;
+        case BFU_OP_START:
+            rc = fwupdate_start(SWAP32(req->bfu_offset), SWAP32(req->bfu_crc));
+            break;
+        case BFU_OP_DATA:
+            rc = fwupdate_data(SWAP32(req->bfu_offset), data,
+                               msglen - sizeof (*req), SWAP32(req->bfu_crc));
+            break;
+        case BFU_OP_COMMIT:
+            rc = fwupdate_commit(req->bfu_flags & BFU_FLAG_REBOOT);
+            break;
+        case BFU_OP_CONFIRM:
+            rc = (fwupdate_confirm() == RC_SUCCESS) ? BEC_STATUS_OK :
+                                                       BEC_STATUS_FAIL;
+            break;
+        default:
+            rc = BEC_STATUS_BADARG;
+            break;
+    }
+    memset(&reply, 0, sizeof (reply));
+    reply.bfu_op = req->bfu_op;
+    fwupdate_status(&reply);
+    reply.bfu_offset = SWAP32(reply.bfu_offset);
+    reply.bfu_crc    = SWAP32(reply.bfu_crc);
+    msg_reply(rc, sizeof (reply), &reply, 0, NULL);
+}
+
 void
 msg_process_slow(void)
 {
@@ -299,6 +838,16 @@ bad_arg:
             }
             break;
         }
+        case BEC_CMD_SET_MAP_BULK:
+            msg_set_map_bulk(msglen);
+            break;
+#ifdef USE_STMCUBEUSB
+        case BEC_CMD_BLK_INFO:
+        case BEC_CMD_BLK_READ:
+        case BEC_CMD_BLK_WRITE:
+            msg_blk(cmd, msglen);
+            break;
+#endif
         case BEC_CMD_POLL_INPUT: {
             bec_poll_t *req = (void *) &bec_msg_inbuf[BEC_MSG_HDR_LEN];
             uint16_t repbuf[32];
@@ -311,15 +860,9 @@ bad_arg:
                 default:
                     goto bad_arg;
             }
-            if (req->bkm_timeout) {
-                uint16_t timeout = SWAP16(req->bkm_timeout);
-                keyboard_cap_timeout = timer_tick_plus_msec(timeout);
-                keyboard_cap_src_req = req->bkm_source;
-            } else {
-                keyboard_cap_timeout = 0;
-                keyboard_cap_src_req = 0;
+            msg_capture_setup(req->bkm_source, req->bkm_timeout);
+            if (req->bkm_timeout == 0)
                 req->bkm_count = 0;
-            }
             count = req->bkm_count;
             if (count > ARRAY_SIZE(repbuf))
                 count = ARRAY_SIZE(repbuf);
@@ -328,6 +871,24 @@ bad_arg:
             msg_reply(BEC_STATUS_OK, sizeof (*req), req, count * 2, repbuf);
             break;
         }
+        case BEC_CMD_INPUT_SNAP:
+            msg_input_snap(msglen);
+            break;
+        case BEC_CMD_SENSOR_HIST:
+            msg_sensor_hist(msglen);
+            break;
+        case BEC_CMD_RTC_TRACE:
+            msg_rtc_trace(msglen);
+            break;
+        case BEC_CMD_SNOOP:
+            msg_snoop(msglen);
+            break;
+        case BEC_CMD_CONS_LZ:
+            msg_cons_lz(msglen);
+            break;
+        case BEC_CMD_FW_UPDATE:
+            msg_fw_update(msglen);
+            break;
         default:
             msg_reply(BEC_STATUS_UNKCMD, 0, NULL, 0, NULL);
             break;
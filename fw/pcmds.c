@@ -21,14 +21,17 @@
 #include "uart.h"
 #include "cmds.h"
 #include "gpio.h"
+#include "bec_cmd.h"
 #include "amigartc.h"
 #include "pcmds.h"
 #include "adc.h"
 #include "utils.h"
 #include "usb.h"
+#include "msc.h"
 #include "irq.h"
 #include "config.h"
 #include "fan.h"
+#include "fwupdate.h"
 #include "hiden.h"
 #include "kbrst.h"
 #include "keyboard.h"
@@ -37,6 +40,7 @@
 #include "power.h"
 #include "rtc.h"
 #include "sensor.h"
+#include "snoop.h"
 
 #include <libopencm3/cm3/scb.h>
 #include <libopencm3/stm32/gpio.h>
@@ -84,6 +88,7 @@ const char cmd_reset_help[] =
 "reset usb          - reset and restart USB interface";
 
 const char cmd_set_help[] =
+"set autofire <btn> <hz>  - Joystick button autofire rate (0=off)\n"
 "set cpu_temp_bias <num>  - Bias (+/-) for CPU temperature\n"
 "set debug <flags> [save] - Debug flags\n"
 "set defaults [key|mouse] - Force settings to default values\n"
@@ -99,6 +104,9 @@ const char cmd_set_help[] =
 "set mouse_mul_y <num>    - Mouse Y speed multiplier\n"
 "set name <name>          - Board name\n"
 "set pson <num>           - Power on mode (1=On at AC restore)\n"
+"set stick_deadzone <num> - Gamepad mouse dead zone percent\n"
+"set stick_expo <num>     - Gamepad mouse curve (0=linear 100=cubic)\n"
+"set stick_speed <num>    - Gamepad mouse top speed (counts/sec)\n"
 "set time <y/m/d>|<h:m:s> - RTC time and/or date";
 
 const char cmd_power_help[] =
@@ -107,17 +115,26 @@ const char cmd_power_help[] =
 "power off   - turn off power supply\n"
 "power show  - display current power status";
 
+const char cmd_slot_help[] =
+"slot         - show firmware slots\n"
+"slot confirm - mark running trial firmware as good\n"
+"slot switch  - boot the other firmware slot (on trial) at next reset";
+
 const char cmd_snoop_help[] =
-"snoop        - capture and report ROM transactions\n"
-"snoop addr   - hardware capture A0-A19\n"
-"snoop lo     - hardware capture A0-A15 D0-D15\n"
-"snoop hi     - hardware capture A0-A15 D16-D31";
+"snoop [<opts>]              - capture GPIOB until RTC bus access\n"
+"snoop change <mask> [<opts>] - capture until masked bits change\n"
+"snoop dump                  - show last capture in hex for export\n"
+"snoop now [<opts>]          - capture immediately\n"
+"snoop show                  - show last capture\n"
+"snoop trig <mask> <value> [<opts>] - capture until port&mask == value\n"
+"  <opts> are port <A-E>, pre <percent>, rate <Hz>";
 
 const char cmd_usb_help[] =
    "usb debug <mask> - set debug mask\n"
    "usb disable      - reset and disable USB\n"
    "usb kbd [on|off] - take input from USB keyboard\n"
    "usb ls [v] [c]   - list USB devices present\n"
+   "usb msc          - show USB mass storage units\n"
    "usb off          - power off USB ports\n"
    "usb on           - power on USB ports\n"
    "usb regs         - display USB device registers\n"
@@ -302,6 +319,7 @@ cmd_time_set(int argc, char * const *argv)
             return (RC_BAD_PARAM);
         }
     }
+    rtc_trim_forget();
     rtc_print(1, 1);
 
     return (RC_SUCCESS);
@@ -344,6 +362,7 @@ cmd_time(int argc, char * const *argv)
         rtc_print(1, 1);
         printf("RP5C01 ");
         amigartc_print();
+        rtc_trim_show();
         rc = RC_SUCCESS;
     } else if (strcmp(argv[1], "set") == 0) {
         rc = cmd_time_set(argc - 1, argv + 1);
@@ -612,6 +631,10 @@ cmd_usb(int argc, char * const *argv)
             argv++;
         }
         usb_ls(verbose);
+#ifdef USE_STMCUBEUSB
+    } else if (strcmp(argv[0], "msc") == 0) {
+        msc_show();
+#endif
     } else if (strcmp(argv[0], "off") == 0) {
         usb_set_power(0);
     } else if (strcmp(argv[0], "on") == 0) {
@@ -733,7 +756,7 @@ static const char *const debug_flag_bits[] = {
 static const char *const config_flag_bits[] = {
     "InvertX", "InvertY", "InvertW", "InvertP",
         "SwapXY", "SwapWP", "KeyupWP", "GamepadMouse",
-    "HaveFan", "KeyboardNoSync", "KeyboardSwapAlt", "",
+    "HaveFan", "KeyboardNoSync", "KeyboardSwapAlt", "PowerFaultOff",
         "", "", "", "",
     "", "", "", "",
         "", "", "", "",
@@ -851,6 +874,12 @@ static const config_set_t config_set[] = {
       CFOFF(name), MODE_STRING },
     { "pson",          "Power on at AC restored",
       CFOFF(ps_on_mode), MODE_DEC },
+    { "stick_deadzone", "Gamepad mouse dead zone percent",
+      CFOFF(stick_deadzone), MODE_DEC },
+    { "stick_expo",     "Gamepad mouse curve (0=linear 100=cubic)",
+      CFOFF(stick_expo), MODE_DEC },
+    { "stick_speed",    "Gamepad mouse top speed (counts/sec)",
+      CFOFF(stick_speed), MODE_DEC },
 };
 
 rc_t
@@ -903,11 +932,39 @@ cmd_set(int argc, char * const *argv)
             }
             printf("\n");
         }
+        for (pos = 0; pos < ARRAY_SIZE(config.joy_autofire); pos++) {
+            char buf[32];
+            if (config.joy_autofire[pos] == 0)
+                continue;
+            sprintf(buf, "autofire %u %u", pos, config.joy_autofire[pos]);
+            printf("%s%*s%s\n", buf, 24 - strlen(buf), "",
+                   "Joystick button autofire rate (Hz)");
+        }
         return (RC_SUCCESS);
     }
     if ((strcmp(argv[1], "help") == 0) ||
                (strcmp(argv[1], "?") == 0)) {
         return (RC_USER_HELP);
+    } else if (strcmp(argv[1], "autofire") == 0) {
+        int pos = 0;
+        int button;
+        int rate;
+        if (argc != 4) {
+            printf("Joystick button (0-31) and rate (Hz) required\n");
+            return (RC_BAD_PARAM);
+        }
+        if ((sscanf(argv[2], "%d%n", &button, &pos) != 1) ||
+            (argv[2][pos] != '\0') || (button < 0) || (button > 31)) {
+            printf("Invalid joystick button %s\n", argv[2]);
+            return (RC_USER_HELP);
+        }
+        if ((sscanf(argv[3], "%d%n", &rate, &pos) != 1) ||
+            (argv[3][pos] != '\0') || (rate < 0) || (rate > 25)) {
+            printf("Invalid autofire rate %s (0-25 Hz)\n", argv[3]);
+            return (RC_USER_HELP);
+        }
+        config.joy_autofire[button] = rate;
+        config_updated();
     } else if (strcmp(argv[1], "cpu_temp_bias") == 0) {
         int pos = 0;
         int bias;
@@ -1230,6 +1287,7 @@ invalid_value:
                         *(uint32_t *)ptr = value;
                         break;
                 }
+                config_gen++;  // Take effect now, even if not saved
                 if (do_save)
                     config_updated();
                 return (RC_SUCCESS);
@@ -1242,28 +1300,100 @@ invalid_value:
     return (RC_SUCCESS);
 }
 
+rc_t
+cmd_slot(int argc, char * const *argv)
+{
+    if ((argc < 2) || (strcmp(argv[1], "show") == 0)) {
+        fwupdate_show();
+        return (RC_SUCCESS);
+    }
+    if (strcmp(argv[1], "confirm") == 0)
+        return (fwupdate_confirm());
+    if (strcmp(argv[1], "switch") == 0)
+        return (fwupdate_switch());
+
+    printf("Unknown argument %s\n", argv[1]);
+    return (RC_USER_HELP);
+}
 
 rc_t
 cmd_snoop(int argc, char * const *argv)
 {
-    printf("Snoop not implemented\n");
-    return (RC_USER_HELP);
-#if 0
-    uint mode = CAPTURE_SW;
+    uint     port    = 'B';
+    uint32_t rate    = SNOOP_RATE_DEFAULT;
+    uint     pre     = 25;
+    uint     mask    = RTCEN_PIN;
+    uint     value   = 0;
+    uint     flags   = 0;
+    uint     arg     = 1;
+    uint     val;
+    int      pos;
+    rc_t     rc;
+
     if (argc > 1) {
-        if (strcmp(argv[1], "addr") == 0) {
-            mode = CAPTURE_ADDR;
-        } else if (strncmp(argv[1], "low", 2) == 0) {
-            mode = CAPTURE_DATA_LO;
-        } else if (strncmp(argv[1], "high", 2) == 0) {
-            mode = CAPTURE_DATA_HI;
+        if (strcmp(argv[1], "show") == 0) {
+            snoop_show(0);
+            return (RC_SUCCESS);
+        } else if (strcmp(argv[1], "dump") == 0) {
+            snoop_show(1);
+            return (RC_SUCCESS);
+        } else if (strcmp(argv[1], "now") == 0) {
+            mask = 0;
+            arg = 2;
+        } else if (strcmp(argv[1], "change") == 0) {
+            if ((argc < 3) || (sscanf(argv[2], "%x%n", &mask, &pos) != 1) ||
+                (argv[2][pos] != '\0') || (mask == 0) || (mask > 0xffff)) {
+                printf("snoop change requires a mask\n");
+                return (RC_USER_HELP);
+            }
+            flags = SNOOP_TRIG_CHANGE;
+            arg = 3;
+        } else if (strcmp(argv[1], "trig") == 0) {
+            if ((argc < 4) ||
+                (sscanf(argv[2], "%x%n", &mask, &pos) != 1) ||
+                (argv[2][pos] != '\0') || (mask > 0xffff) ||
+                (sscanf(argv[3], "%x%n", &value, &pos) != 1) ||
+                (argv[3][pos] != '\0') || ((value & ~mask) != 0)) {
+                printf("snoop trig requires a mask and value\n");
+                return (RC_USER_HELP);
+            }
+            arg = 4;
+        }
+    }
+    for (; arg < (uint) argc; arg += 2) {
+        if (arg + 1 >= (uint) argc) {
+            printf("snoop \"%s\" requires an argument\n", argv[arg]);
+            return (RC_USER_HELP);
+        }
+        if (strcmp(argv[arg], "port") == 0) {
+            port = toupper((uint8_t) argv[arg + 1][0]);
+            if ((port < 'A') || (port > 'E') || (argv[arg + 1][1] != '\0')) {
+                printf("Invalid port %s\n", argv[arg + 1]);
+                return (RC_USER_HELP);
+            }
+            continue;
+        }
+        if ((sscanf(argv[arg + 1], "%u%n", &val, &pos) != 1) ||
+            (argv[arg + 1][pos] != '\0')) {
+            printf("Invalid %s value %s\n", argv[arg], argv[arg + 1]);
+            return (RC_USER_HELP);
+        }
+        if ((strcmp(argv[arg], "pre") == 0) && (val <= 100)) {
+            pre = val;
+        } else if ((strcmp(argv[arg], "rate") == 0) && (val >= 1000) &&
+                   (val <= SNOOP_RATE_MAX)) {
+            rate = val;
         } else {
-            printf("snoop \"%s\" unknown argument\n", argv[1]);
+            printf("snoop \"%s %s\" invalid\n", argv[arg], argv[arg + 1]);
             return (RC_USER_HELP);
         }
     }
-    bus_snoop(mode);
 
-    return (RC_SUCCESS);
-#endif
+    if (mask != 0)
+        printf("Waiting for trigger. Press ^C to end.\n");
+    rc = snoop_capture(port, rate, mask, value, flags, pre);
+    if (rc == RC_USR_ABORT)
+        return (rc);
+    snoop_show(0);
+    return (rc);
 }
@@ -22,6 +22,7 @@ rc_t cmd_map(int argc, char * const *argv);
 rc_t cmd_power(int argc, char * const *argv);
 rc_t cmd_reset(int argc, char * const *argv);
 rc_t cmd_set(int argc, char * const *argv);
+rc_t cmd_slot(int argc, char * const *argv);
 rc_t cmd_snoop(int argc, char * const *argv);
 rc_t cmd_usb(int argc, char * const *argv);
 
@@ -32,6 +33,7 @@ extern const char cmd_gpio_help[];
 extern const char cmd_power_help[];
 extern const char cmd_reset_help[];
 extern const char cmd_set_help[];
+extern const char cmd_slot_help[];
 extern const char cmd_snoop_help[];
 extern const char cmd_usb_help[];
 
@@ -18,16 +18,37 @@
 #include "timer.h"
 #include "utils.h"
 
+#include <libopencm3/cm3/nvic.h>
+#include <libopencm3/stm32/exti.h>
+
 #define POWER_ADC_STABLE         10 // msec for ADCs to initialize
 #define POWER_BUTTON_DEGLITCH   100 // msec min to deglitch user power button
 #define POWER_CYCLE_OFF_PERIOD 1000 // msec to hold power off during cycle
 #define POWER_ON_STABLE        2000 // msec max until power supply rails stable
 #define POWER_OFF_STABLE       2000 // msec max time until rails drain to "off"
+#define POWER_FAULT_SAMPLES       3 // Consecutive bad rail samples for fault
+
+/*
+ * Power state transitions are made only by power_event(), which runs
+ * from the EXTI interrupt handler of the user power button. Other event
+ * sources (the power state deadline alarm, ADC rail samples, and power
+ * requests from the main loop) pend that interrupt by software. This
+ * serializes all transitions without masking interrupts, and means
+ * that a slow main loop iteration does not delay power sequencing or
+ * the response to a rail fault.
+ */
+#define PWRSW_EXTI   EXTI12  // Must match PWRSW_PIN
 
 uint8_t power_state_desired;
 uint8_t power_state;
 
 static uint64_t power_timer;
+static uint64_t power_alarm;                // Next event deadline (0 = none)
+static volatile uint8_t power_rail_state;   // Rail state from ADC windows
+static volatile uint8_t power_rail_faults;  // Consecutive bad rail samples
+static volatile uint64_t power_rail_fault_tick;  // Time of first bad sample
+static uint32_t power_fault_usec;           // Last rail fault response time
+static uint8_t  power_sysctl_pending;       // Keyboard power button pressed
 
 #define PSON_SET_ON  1  // Turn power supply on
 #define PSON_SET_OFF 0  // Turn power supply off
@@ -44,6 +65,19 @@ pson_set(unsigned int enable)
 
 static uint64_t power_button_timer = 0;
 static uint8_t  power_button_armed = 0;
+static uint8_t  power_button_last = 0;
+static uint8_t  power_button_deglitch = 0;
+
+/*
+ * power_event_pend
+ * ----------------
+ * Requests that power_event() be run from interrupt context.
+ */
+static void
+power_event_pend(void)
+{
+    EXTI_SWIER = PWRSW_EXTI;
+}
 
 /*
  * power_state_toggle
@@ -96,16 +130,14 @@ power_state_toggle(void)
 }
 
 /*
- * power_button_poll
- * -----------------
+ * power_button_check
+ * ------------------
  * Manage user power button presses
  */
 static void
-power_button_poll(void)
+power_button_check(void)
 {
-    static uint8_t  power_button_last = 0;
-    static uint8_t  power_button_deglitch = 0;
-    uint8_t         power_button;
+    uint8_t power_button;
 
     if ((config.board_type != BOARD_TYPE_AMIGAPCI) &&
         (config.board_type != BOARD_TYPE_APCIDEV)) {
@@ -151,20 +183,46 @@ power_button_poll(void)
 }
 
 /*
- * power_poll
- * ----------
- * Manage power supply state machine and user power button
+ * power_alarm_update
+ * ------------------
+ * Arms the alarm for the next power state or power button deadline.
  */
-void
-power_poll(void)
+static void
+power_alarm_update(void)
 {
-    uint new_state;
-
-    if (config.board_type == BOARD_TYPE_KEYJAM)
-        return;
+    uint64_t when = 0;
 
-    power_button_poll();
+    switch (power_state) {
+        case POWER_STATE_POWERING_ON:
+        case POWER_STATE_POWERING_OFF:
+        case POWER_STATE_CYCLE:
+            when = power_timer;
+            break;
+    }
+    if (power_button_deglitch) {
+        if ((when == 0) || (power_button_timer < when))
+            when = power_button_timer;
+    } else if (power_button_last && power_button_armed) {
+        /* Button held: recheck for long enough press to power off */
+        uint64_t recheck = timer_tick_plus_msec(POWER_BUTTON_DEGLITCH);
+        if ((when == 0) || (recheck < when))
+            when = recheck;
+    }
+    power_alarm = when;
+    if (when != 0)
+        timer_alarm_set(TIMER_ALARM_POWER, when, power_event_pend);
+    else
+        timer_alarm_cancel(TIMER_ALARM_POWER);
+}
 
+/*
+ * power_state_advance
+ * -------------------
+ * Advance power supply state machine toward the desired state
+ */
+static void
+power_state_advance(void)
+{
     if (power_state == power_state_desired)
         return;
 
@@ -172,8 +230,7 @@ power_poll(void)
         case POWER_STATE_INITIAL:
             break;  // Waiting for power supply to initialize
         case POWER_STATE_POWERING_ON:
-            new_state = sensor_get_power_state();
-            if (new_state == POWER_STATE_ON) {
+            if (power_rail_state == POWER_STATE_ON) {
                 power_state = POWER_STATE_ON;
                 printf("Power: on\n");
             } else if (timer_tick_has_elapsed(power_timer)) {
@@ -184,8 +241,7 @@ power_poll(void)
             }
             break;
         case POWER_STATE_POWERING_OFF:
-            new_state = sensor_get_power_state();
-            if (new_state == POWER_STATE_OFF) {
+            if (power_rail_state == POWER_STATE_OFF) {
                 power_state = POWER_STATE_OFF;
                 printf("Power: off\n");
             } else if (timer_tick_has_elapsed(power_timer)) {
@@ -252,6 +308,111 @@ power_cycle:
     }
 }
 
+/*
+ * power_event
+ * -----------
+ * Manage power supply state machine and user power button. This is
+ * called only from interrupt context.
+ */
+static void
+power_event(void)
+{
+    power_button_check();
+    if (power_sysctl_pending) {
+        power_sysctl_pending = 0;
+        power_state_toggle();
+    }
+
+    if ((power_state == POWER_STATE_ON) &&
+        (power_rail_faults >= POWER_FAULT_SAMPLES)) {
+        /* Rail has been out of limits while power supply is on */
+        if (config.flags & CF_POWER_FAULT_OFF) {
+            pson_set(PSON_SET_OFF);
+            power_state = POWER_STATE_FAULT;
+            power_state_desired = POWER_STATE_FAULT;
+            power_fault_usec = timer_tick_to_usec(timer_tick_get() -
+                                                  power_rail_fault_tick);
+            printf("Power: rail fault, power supply off in %lu usec\n",
+                   power_fault_usec);
+        }
+    }
+
+    power_state_advance();
+    power_alarm_update();
+}
+
+void exti15_10_isr(void);
+void
+exti15_10_isr(void)
+{
+    EXTI_PR = PWRSW_EXTI;
+    power_event();
+}
+
+/*
+ * power_rail_classify
+ * -------------------
+ * Returns the power supply state suggested by a count of rails which are
+ * within (good) and outside of (bad) their limits. The supply is on when
+ * every rail is good and probably off when most of them are bad; anything
+ * in between is a fault. Shared by the ADC window path and the sensor
+ * poll so both agree on the state for the same readings.
+ */
+uint
+power_rail_classify(uint good, uint bad)
+{
+    if ((bad == 0) && (good > 2))
+        return (POWER_STATE_ON);     // All on
+
+    if (bad > good)
+        return (POWER_STATE_OFF);    // Probably off
+
+    return (POWER_STATE_FAULT);
+}
+
+/*
+ * power_rail_event
+ * ----------------
+ * Receives the state of the power supply rails for each new ADC sample.
+ * Bit n of mask is set for each ADC channel which is a power supply
+ * rail, and the corresponding bit in bad is set if that rail is outside
+ * of its limits. This is called from ADC DMA interrupt context.
+ */
+void
+power_rail_event(uint mask, uint bad)
+{
+    uint state = power_rail_classify(__builtin_popcount(mask & ~bad),
+                                     __builtin_popcount(mask & bad));
+
+    if (state == POWER_STATE_ON) {
+        power_rail_faults = 0;
+    } else if (power_rail_faults < 0xff) {
+        if (power_rail_faults++ == 0)
+            power_rail_fault_tick = timer_tick_get();
+    }
+    if ((state != power_rail_state) ||
+        (power_rail_faults == POWER_FAULT_SAMPLES)) {
+        power_rail_state = state;
+        power_event_pend();
+    }
+}
+
+/*
+ * power_poll
+ * ----------
+ * Backstop for the power event alarm, which is not available on all
+ * STM32 parts.
+ */
+void
+power_poll(void)
+{
+    if (config.board_type == BOARD_TYPE_KEYJAM)
+        return;
+
+    if ((power_alarm != 0) && timer_tick_has_elapsed(power_alarm))
+        power_event_pend();
+}
+
 /*
  * power_set
  * ---------
@@ -261,6 +422,7 @@ void
 power_set(uint state)
 {
     power_state_desired = state;
+    power_event_pend();
 }
 
 /*
@@ -276,7 +438,8 @@ power_sysctl(uint code)
         sysctl_last = code;
         if (code != 0) {
             printf("Keyboard power button\n");
-            power_state_toggle();
+            power_sysctl_pending = 1;
+            power_event_pend();
         }
     }
 }
@@ -323,6 +486,8 @@ power_show(void)
             break;
     }
     printf("Power state     %s\n", state);
+    if (power_fault_usec != 0)
+        printf("Fault response  %lu usec\n", power_fault_usec);
 }
 
 /*
@@ -376,4 +541,13 @@ power_init(void)
 #endif
         power_state_desired = power_state;
     }
+
+    /* Power button edges and software requests run power_event() */
+    exti_select_source(PWRSW_EXTI, PWRSW_PORT);
+    exti_set_trigger(PWRSW_EXTI, EXTI_TRIGGER_BOTH);
+    exti_enable_request(PWRSW_EXTI);
+    exti_reset_request(PWRSW_EXTI);
+    nvic_set_priority(NVIC_EXTI15_10_IRQ, 0x60);
+    nvic_enable_irq(NVIC_EXTI15_10_IRQ);
+    power_event_pend();
 }
@@ -17,6 +17,8 @@ void power_poll(void);
 void power_set(uint state);  // POWER_STATE_ ON, OFF, or CYCLE
 void power_show(void);
 void power_sysctl(uint code);
+void power_rail_event(uint mask, uint bad);
+uint power_rail_classify(uint good, uint bad);
 
 /* Transitional states (will end in another state) */
 #define POWER_STATE_INITIAL      0  // Power supply state is initiallizing
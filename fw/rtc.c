@@ -37,6 +37,32 @@
 
 #define DAYS_2024            19722       // Number of days between 1970 and 2024
 
+/*
+ * RTC drift trim. Each time the Amiga sets the clock, the difference
+ * between the STM32 RTC and the new time is accumulated against a
+ * baseline kept in the backup registers (which survive power loss with
+ * the RTC). The Amiga sets whole seconds at an arbitrary point within
+ * the second, and setting the RTC restarts its prescaler, so each set
+ * leaves the RTC half a second slow on average. That half second is
+ * credited back with each measurement, which is why the accumulated
+ * error is kept in half seconds. Once the accumulated error is large
+ * enough for the whole-second resolution to be insignificant (or the
+ * measurement has run for long enough), the measured drift is folded
+ * into config.rtc_trim and applied to the RTC coarse calibration
+ * register. The measurement is then restarted.
+ */
+#define RTC_TRIM_FRAC        16          // config.rtc_trim units per ppm
+#define RTC_TRIM_MIN_SECS    (12 * 3600) // Minimum measurement interval
+#define RTC_TRIM_MAX_SECS    (14 * 86400) // Measure no longer than this
+#define RTC_TRIM_MIN_ACC     (4 * 2)     // Half seconds to trust drift
+#define RTC_TRIM_MAX_ERR     120         // Larger error is a user change
+#define RTC_TRIM_MIN         (-62 * RTC_TRIM_FRAC)
+#define RTC_TRIM_MAX         (126 * RTC_TRIM_FRAC)
+#define RTC_TRIM_BKP_BASE    6           // Baseline UTC seconds
+#define RTC_TRIM_BKP_ACC     7           // Half seconds corrected
+#define RTC_TRIM_BKP_MAGIC   8           // Baseline valid
+#define RTC_TRIM_MAGIC       0x54524d32  // "TRM2"
+
 /*
  * libopencm3 does not yet define these for STM32F2
  *
@@ -183,21 +209,67 @@ rtc_set_calibrate(uint enable)
         gpio_setmode(STMRSTA_PORT, STMRSTA_PIN, GPIO_SETMODE_INPUT_PU);
 }
 
-static void
-rtc_set_calibrate_offset(int offset)
+/*
+ * rtc_calibr_get_ppm() returns the frequency correction in ppm which is
+ *                      currently programmed in the RTC coarse calibration
+ *                      register.
+ */
+static int
+rtc_calibr_get_ppm(void)
 {
     uint32_t calibr = RTC_CALIBR;
-    uint32_t calibr_new;
-    int      val;
-    int      val_new;
 
     if (calibr & RTC_CALIBR_DCS) {
         /* Negative frequency calibration */
-        val = (calibr & RTC_CALIBR_DC_MASK) * -2;
+        return ((calibr & RTC_CALIBR_DC_MASK) * -2);
+    } else {
+        /* Positive frequency calibration */
+        return ((calibr & RTC_CALIBR_DC_MASK) * 4);
+    }
+}
+
+/*
+ * rtc_calibr_set_ppm() programs the RTC coarse calibration register with
+ *                      the closest available correction to the specified
+ *                      value in ppm. Negative corrections are in steps
+ *                      of 2 ppm and positive corrections in steps of 4 ppm.
+ *                      The value actually programmed is returned.
+ */
+static int
+rtc_calibr_set_ppm(int ppm)
+{
+    uint32_t calibr_new;
+
+    if (ppm < 0) {
+        /* Negative frequency calibration */
+        if (ppm < -62)
+            ppm = -62;
+        calibr_new = ((0 - ppm) / 2) | RTC_CALIBR_DCS;
+        ppm = -2 * (int) (calibr_new & RTC_CALIBR_DC_MASK);
     } else {
         /* Positive frequency calibration */
-        val = (calibr & RTC_CALIBR_DC_MASK) * 4;
+        if (ppm > 126)
+            ppm = 126;
+        calibr_new = (ppm / 4);
+        ppm = 4 * calibr_new;
+    }
+
+    if (RTC_CALIBR != calibr_new) {
+        rtc_allow_writes(1);
+        rtc_init_mode(TRUE);
+        RTC_CALIBR = calibr_new;
+        rtc_init_mode(FALSE);
+        rtc_allow_writes(0);
     }
+    return (ppm);
+}
+
+static void
+rtc_set_calibrate_offset(int offset)
+{
+    uint32_t calibr = RTC_CALIBR;
+    int      val = rtc_calibr_get_ppm();
+    int      val_new;
 
     if ((val < 0) || (val + offset < 0))  {
         /* Adjusting calibration which is currently negative */
@@ -219,25 +291,9 @@ rtc_set_calibrate_offset(int offset)
         val_new = val + offset;
     }
 
-    if (val_new < 0) {
-        /* Negative frequency calibration */
-        if (val_new < -62)
-            val_new = -62;
-        calibr_new = ((0 - val_new) / 2) | RTC_CALIBR_DCS;
-    } else {
-        /* Positive frequency calibration */
-        if (val_new > 126)
-            val_new = 126;
-        calibr_new = (val_new / 4);
-    }
-
-    rtc_allow_writes(1);
-    rtc_init_mode(TRUE);
-    RTC_CALIBR = calibr_new;
-    rtc_init_mode(FALSE);
-    rtc_allow_writes(0);
+    val_new = rtc_calibr_set_ppm(val_new);
     printf("\nval=%d -> %d  cal=%04lx -> %04lx\n",
-           val, val_new, calibr, calibr_new);
+           val, val_new, calibr, RTC_CALIBR);
 }
 
 static rc_t
@@ -976,6 +1032,135 @@ rtc_write_nvram(uint reg, uint32_t value)
     RTC_BKPXR(reg) = value;
 }
 
+/*
+ * rtc_trim_apply() programs the RTC coarse calibration register from the
+ *                  learned drift trim in config.rtc_trim. A config which
+ *                  has no trim yet takes it from the register instead, so
+ *                  that a calibration set by "time calibrate" is kept.
+ */
+void
+rtc_trim_apply(void)
+{
+    int trim = config.rtc_trim;
+    int ppm;
+
+    if (trim == RTC_TRIM_UNKNOWN) {
+        config.rtc_trim = rtc_calibr_get_ppm() * RTC_TRIM_FRAC;
+        config_updated();
+        return;
+    }
+
+    /* Round to the nearest calibration step (-2 or +4 ppm) */
+    if (trim < 0)
+        ppm = (trim - RTC_TRIM_FRAC) / (2 * RTC_TRIM_FRAC) * 2;
+    else
+        ppm = (trim + 2 * RTC_TRIM_FRAC) / (4 * RTC_TRIM_FRAC) * 4;
+    (void) rtc_calibr_set_ppm(ppm);
+}
+
+/*
+ * rtc_trim_forget() discards the drift measurement baseline. This is
+ *                   called when the clock is set by hand, as that time
+ *                   can not be trusted as a reference.
+ */
+void
+rtc_trim_forget(void)
+{
+    RTC_BKPXR(RTC_TRIM_BKP_MAGIC) = 0;
+}
+
+/*
+ * rtc_trim_reference() is called with a trusted time just before the RTC
+ *                      is set to that time. The error of the RTC is
+ *                      accumulated against the measurement baseline,
+ *                      and when the baseline is old enough, the drift
+ *                      trim is updated from the total error.
+ *
+ * @param [in]  year - Four digit year.
+ */
+void
+rtc_trim_reference(uint year, uint mon, uint day, uint hour, uint min,
+                   uint sec)
+{
+    uint32_t ref = rtc_to_utc(year, mon, day, hour, min, sec);
+    int32_t  err = (int32_t) (time_get_utc(NULL) - ref);  // + is RTC fast
+    int32_t  acc;
+    uint32_t aacc;
+    int32_t  elapsed;
+    int      trim;
+    int      adj;
+
+    if (config.rtc_trim == RTC_TRIM_UNKNOWN)
+        rtc_trim_apply();  // Config was reset since boot
+
+    if ((RTC_BKPXR(RTC_TRIM_BKP_MAGIC) != RTC_TRIM_MAGIC) ||
+        (err > RTC_TRIM_MAX_ERR) || (err < -RTC_TRIM_MAX_ERR))
+        goto new_baseline;
+
+    /* Credit the half second lost on average when the RTC was last set */
+    acc = (int32_t) RTC_BKPXR(RTC_TRIM_BKP_ACC) + err * 2 + 1;
+    elapsed = (int32_t) (ref - RTC_BKPXR(RTC_TRIM_BKP_BASE));
+    if (elapsed < 0)
+        goto new_baseline;
+    if ((elapsed < RTC_TRIM_MIN_SECS) ||
+        ((acc < RTC_TRIM_MIN_ACC) && (acc > -RTC_TRIM_MIN_ACC) &&
+         (elapsed < RTC_TRIM_MAX_SECS))) {
+        /* Too soon to measure; remember the correction and keep going */
+        RTC_BKPXR(RTC_TRIM_BKP_ACC) = acc;
+        return;
+    }
+
+    /* Drift in 1/RTC_TRIM_FRAC ppm */
+    adj = (int64_t) acc * 1000000 * RTC_TRIM_FRAC / 2 / elapsed;
+    trim = config.rtc_trim - adj;
+    if (trim < RTC_TRIM_MIN)
+        trim = RTC_TRIM_MIN;
+    else if (trim > RTC_TRIM_MAX)
+        trim = RTC_TRIM_MAX;
+    aacc = (acc < 0) ? -acc : acc;
+    dprintf(DF_RTC, "RTC drift %s%lu.%u sec in %ld sec: trim %d -> %d\n",
+            (acc < 0) ? "-" : "", aacc / 2, (aacc & 1) * 5, elapsed,
+            config.rtc_trim, trim);
+    if (trim != config.rtc_trim) {
+        config.rtc_trim = trim;
+        config_updated();
+        rtc_trim_apply();
+    }
+
+new_baseline:
+    RTC_BKPXR(RTC_TRIM_BKP_BASE) = ref;
+    RTC_BKPXR(RTC_TRIM_BKP_ACC) = 0;
+    RTC_BKPXR(RTC_TRIM_BKP_MAGIC) = RTC_TRIM_MAGIC;
+}
+
+/*
+ * rtc_trim_show() displays the learned RTC drift trim and the state of
+ *                 the current drift measurement.
+ */
+void
+rtc_trim_show(void)
+{
+    int  trim;
+    uint atrim;
+
+    if (config.rtc_trim == RTC_TRIM_UNKNOWN)
+        rtc_trim_apply();  // Config was reset since boot
+    trim  = config.rtc_trim;
+    atrim = (trim < 0) ? -trim : trim;
+    printf("trim   %s%u.%02u ppm (CALIBR %d ppm)",
+           (trim < 0) ? "-" : "", atrim / RTC_TRIM_FRAC,
+           (atrim % RTC_TRIM_FRAC) * 100 / RTC_TRIM_FRAC,
+           rtc_calibr_get_ppm());
+    if (RTC_BKPXR(RTC_TRIM_BKP_MAGIC) == RTC_TRIM_MAGIC) {
+        int32_t  acc  = (int32_t) RTC_BKPXR(RTC_TRIM_BKP_ACC);
+        uint32_t aacc = (acc < 0) ? -acc : acc;
+        printf(" measuring %lu sec, %s%lu.%u sec corrected",
+               time_get_utc(NULL) - RTC_BKPXR(RTC_TRIM_BKP_BASE),
+               (acc < 0) ? "-" : "", aacc / 2, (aacc & 1) * 5);
+    }
+    printf("\n");
+}
+
 /**
  * time_calc_summary() returns a human-readable idea of time drift.
  *
@@ -1035,6 +1220,7 @@ rtc_calibrate(void)
     uint     secs = 0;
     char     summary[64];
     uint     enable_calibrate = gpio_get(GPIOC, GPIO13);
+    int      ppm_start = rtc_calibr_get_ppm();
     int      ch;
 
     if (enable_calibrate) {
@@ -1103,6 +1289,13 @@ check_abort:
     }
     if (enable_calibrate)
         rtc_set_calibrate(0);
+
+    /* Keep a manual calibration as the starting point for the drift trim */
+    if (rtc_calibr_get_ppm() != ppm_start) {
+        config.rtc_trim = rtc_calibr_get_ppm() * RTC_TRIM_FRAC;
+        config_updated();
+        rtc_trim_forget();
+    }
 }
 
 /*
@@ -1230,6 +1423,9 @@ rtc_init(void)
     /* Enable write protection for RTC registers */
     rtc_allow_writes(FALSE);
 
+    /* Apply learned drift trim */
+    rtc_trim_apply();
+
     /* Setup the RTC interrupts */
     nvic_set_priority(NVIC_RTC_WKUP_IRQ, 0x30);
     nvic_enable_irq(NVIC_RTC_WKUP_IRQ);
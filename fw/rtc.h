@@ -27,6 +27,11 @@ void rtc_print(uint which, uint newline);
 uint32_t rtc_read_nvram(uint reg);
 void rtc_write_nvram(uint reg, uint32_t value);
 void rtc_calibrate(void);
+void rtc_trim_apply(void);
+void rtc_trim_forget(void);
+void rtc_trim_reference(uint year, uint mon, uint day, uint hour, uint min,
+                        uint sec);
+void rtc_trim_show(void);
 uint8_t rtc_binary_to_bcd(uint value);
 uint8_t rtc_bcd_to_binary(uint8_t value);
 
@@ -21,6 +21,10 @@
 #include "fan.h"
 #include "timer.h"
 #include "config.h"
+#include "bec_cmd.h"
+
+#define SWAP16(x)   __builtin_bswap16(x)
+#define SWAP32(x)   __builtin_bswap32(x)
 
 #define CHANNEL_FAN_TACH 0x20
 #define CHANNEL_FAN_PWM  0x21
@@ -89,6 +93,21 @@ sensor_state_t sensor_states[SENSOR_COUNT_MAX];
 
 uint64_t adc_startup_time;
 
+/*
+ * Sensor history ring. Each block holds a keyframe of absolute readings
+ * followed by delta-encoded samples (see BEC_CMD_SENSOR_HIST). Blocks are
+ * kept in their big endian wire format so they may be exported as-is.
+ */
+#define HIST_BLOCKS    16    // Blocks in history ring (4 KB)
+#define HIST_INTERVAL  1000  // Milliseconds between history samples
+
+static uint8_t  hist_buf[HIST_BLOCKS][BSH_BLOCK_SIZE]
+                                        __attribute__((aligned(4)));
+static uint32_t hist_blocks;             // Total blocks started
+static uint32_t hist_time;               // Time of previous sample (msec)
+static int32_t  hist_prev[SENSOR_COUNT_MAX];  // Previous sample readings
+static uint64_t hist_next;               // Tick of next sample
+
 static int
 average_cpu_temp(int reading)
 {
@@ -172,6 +191,145 @@ print_reading(int value, const char *suffix)
     printf("%10s", buf);
 }
 
+/*
+ * hist_put_varint
+ * ---------------
+ * Stores value as a little endian base-128 varint.
+ */
+static uint8_t *
+hist_put_varint(uint8_t *ptr, uint32_t value)
+{
+    while (value >= 0x80) {
+        *(ptr++) = (uint8_t) value | 0x80;
+        value >>= 7;
+    }
+    *(ptr++) = (uint8_t) value;
+    return (ptr);
+}
+
+/*
+ * sensor_hist_record
+ * ------------------
+ * Appends the current sensor readings to the history ring, if the sample
+ * interval has elapsed. When the current block is full, the next block
+ * (replacing the oldest) is started with a keyframe.
+ */
+static void
+sensor_hist_record(void)
+{
+    bec_hist_blk_t *hdr;
+    uint8_t         sample[(SENSOR_COUNT_MAX + 1) * 5];
+    uint8_t        *ptr = sample;
+    int32_t         value[SENSOR_COUNT_MAX];
+    uint32_t        now;
+    uint            len;
+    uint            cur;
+
+    if ((adc_startup_time != 0) || !timer_tick_has_elapsed(hist_next))
+        return;
+    hist_next = timer_tick_plus_msec(HIST_INTERVAL);
+    now = timer_tick_to_usec(timer_tick_get()) / 1000;
+
+    for (cur = 0; cur < sensor_count; cur++)
+        value[cur] = sensor_states[cur].ss_reading / 100;
+
+    if (hist_blocks != 0) {
+        hdr = (void *) hist_buf[(hist_blocks - 1) % HIST_BLOCKS];
+        ptr = hist_put_varint(ptr, now - hist_time);
+        for (cur = 0; cur < sensor_count; cur++) {
+            uint32_t delta = (uint32_t) value[cur] - (uint32_t) hist_prev[cur];
+            ptr = hist_put_varint(ptr, (delta << 1) ^
+                                       (uint32_t) ((int32_t) delta >> 31));
+        }
+        len = SWAP16(hdr->bhb_len);
+        if ((sizeof (*hdr) + len + (ptr - sample) <= BSH_BLOCK_SIZE) &&
+            (hdr->bhb_samples < 0xff)) {
+            memcpy((uint8_t *) (hdr + 1) + len, sample, ptr - sample);
+            hdr->bhb_len = SWAP16(len + (ptr - sample));
+            hdr->bhb_samples++;
+            goto recorded;
+        }
+    }
+
+    /* Start new block with a keyframe */
+    hdr = (void *) hist_buf[hist_blocks % HIST_BLOCKS];
+    hdr->bhb_seq     = SWAP32(hist_blocks);
+    hdr->bhb_time    = SWAP32(now);
+    hdr->bhb_len     = SWAP16(sensor_count * sizeof (int32_t));
+    hdr->bhb_samples = 1;
+    hdr->bhb_sensors = sensor_count;
+    ptr = (uint8_t *) (hdr + 1);
+    for (cur = 0; cur < sensor_count; cur++) {
+        uint32_t bval = SWAP32((uint32_t) value[cur]);
+        memcpy(ptr, &bval, sizeof (bval));
+        ptr += sizeof (bval);
+    }
+    hist_blocks++;
+
+recorded:
+    hist_time = now;
+    memcpy(hist_prev, value, sensor_count * sizeof (value[0]));
+}
+
+/*
+ * sensor_hist_get
+ * ---------------
+ * Copies up to maxcount consecutive history blocks to buf, starting at
+ * the first block at or after *seq which holds samples at or after the
+ * specified time (msec). On return, *seq is the first block copied,
+ * *last is the newest block held, and *count is the number of blocks
+ * copied. Returns the number of bytes copied.
+ */
+uint
+sensor_hist_get(uint32_t *seq, uint32_t *last, uint32_t time,
+                void *buf, uint buflen, uint *count)
+{
+    uint8_t *ptr = buf;
+    uint32_t cur = *seq;
+    uint     maxcount = *count;
+    uint     len;
+
+    *count = 0;
+    *last = hist_blocks - 1;
+    if (hist_blocks == 0)
+        return (0);
+    if ((hist_blocks > HIST_BLOCKS) && (cur < hist_blocks - HIST_BLOCKS))
+        cur = hist_blocks - HIST_BLOCKS;
+
+    /* Skip blocks which end before the requested time */
+    for (; cur + 1 < hist_blocks; cur++) {
+        bec_hist_blk_t *next = (void *) hist_buf[(cur + 1) % HIST_BLOCKS];
+        if ((int32_t) (SWAP32(next->bhb_time) - time) > 0)
+            break;
+    }
+    *seq = cur;
+
+    for (; (cur < hist_blocks) && (*count < maxcount); cur++) {
+        bec_hist_blk_t *hdr = (void *) hist_buf[cur % HIST_BLOCKS];
+        len = sizeof (*hdr) + SWAP16(hdr->bhb_len);
+        if (len > buflen)
+            break;
+        memcpy(ptr, hdr, len);
+        ptr += len;
+        buflen -= len;
+        (*count)++;
+    }
+    return (ptr - (uint8_t *) buf);
+}
+
+/*
+ * sensor_limit_to_calc
+ * --------------------
+ * Converts a sensor limit in milli-units to the ADC reading value
+ * (before sensor scaling) which corresponds to that limit.
+ */
+static int
+sensor_limit_to_calc(uint cur, int limit)
+{
+    return ((limit * 100 - sensors[cur].s_add) * sensors[cur].s_div /
+            sensors[cur].s_mul);
+}
+
 void
 sensor_check_readings(void)
 {
@@ -191,8 +349,15 @@ sensor_check_readings(void)
                 reading = fan_get_percent() * 100000;
                 break;
             default:
-                reading = adc_get_reading(adc_which++) * sensors[cur].s_mul /
+                reading = adc_get_reading(adc_which) * sensors[cur].s_mul /
                           sensors[cur].s_div + sensors[cur].s_add;
+                if (sensors[cur].s_power_domain == 1) {
+                    /* Let ADC interrupt check power supply rails directly */
+                    adc_set_window(adc_which,
+                                   sensor_limit_to_calc(cur, limit_min),
+                                   sensor_limit_to_calc(cur, limit_max));
+                }
+                adc_which++;
                 break;
         }
         if (sensors[cur].s_adc_channel == ADC_CHANNEL_TEMP)
@@ -232,6 +397,7 @@ sensor_check_readings(void)
             sensor_states[cur].ss_flags |= SS_FLAG_IGNORED;
         }
     }
+    sensor_hist_record();
 }
 
 uint
@@ -261,13 +427,7 @@ sensor_get_power_state(void)
         }
     }
 
-    if ((count_bad == 0) && (count_good > 2))
-        return (POWER_STATE_ON);   // All on
-
-    if (count_bad > 3)
-        return (POWER_STATE_OFF);  // Probably off
-
-    return (POWER_STATE_FAULT);
+    return (power_rail_classify(count_good, count_bad));
 }
 
 static const char *
@@ -299,6 +459,34 @@ sensor_get(const char *name, uint *value, const char **type)
     return (1);
 }
 
+/*
+ * sensor_hist_names
+ * -----------------
+ * Copies "name\0unit\0" string pairs for each sensor to buf, in the
+ * order they are recorded in history blocks. Returns the number of
+ * bytes copied.
+ */
+uint
+sensor_hist_names(void *buf, uint buflen, uint *count)
+{
+    char *ptr = buf;
+    uint  cur;
+
+    for (cur = 0; cur < sensor_count; cur++) {
+        const char *unit = sensor_suffix(cur);
+        uint        nlen = strlen(sensors[cur].s_name) + 1;
+        uint        ulen = strlen(unit) + 1;
+        if (nlen + ulen > buflen)
+            break;
+        memcpy(ptr, sensors[cur].s_name, nlen);
+        memcpy(ptr + nlen, unit, ulen);
+        ptr += nlen + ulen;
+        buflen -= nlen + ulen;
+    }
+    *count = cur;
+    return (ptr - (char *) buf);
+}
+
 static void
 sensor_show_state(uint pos, uint with_limits)
 {
@@ -351,7 +539,15 @@ sensor_show(void)
 void
 sensor_poll(void)
 {
-    uint cur;
+    static uint adc_seq;
+    uint        seq;
+    uint        cur;
+
+    /* Readings only change when the ADC produces a new decimated sample */
+    seq = adc_get_seq();
+    if (seq == adc_seq)
+        return;
+    adc_seq = seq;
 
     /* Wait for ADCs to stabilize */
     if (adc_startup_time != 0) {
@@ -18,5 +18,8 @@ void sensor_show(void);
 uint sensor_get_power_state(void);
 void sensor_check_readings(void);
 uint sensor_get(const char *name, uint *value, const char **type);
+uint sensor_hist_get(uint32_t *seq, uint32_t *last, uint32_t time,
+                     void *buf, uint buflen, uint *count);
+uint sensor_hist_names(void *buf, uint buflen, uint *count);
 
 #endif /* _SENSOR_H */
@@ -0,0 +1,357 @@
+/*
+ * This is free and unencumbered software released into the public domain.
+ * See the LICENSE file for additional details.
+ *
+ * Designed by Chris Hooper in 2025.
+ *
+ * ---------------------------------------------------------------------
+ *
+ * GPIO bus sampler.
+ *
+ * TIM1 update events trigger DMA2 transfers from a GPIO port input data
+ * register into a circular RAM buffer at a fixed sample rate, without
+ * CPU involvement. Capture runs until the trigger condition is seen, and
+ * then continues until the post-trigger part of the buffer is filled, so
+ * that samples leading up to the trigger are kept. Captures are reported
+ * and exported as runs of identical consecutive samples.
+ */
+
+#include <stdint.h>
+#include <string.h>
+#include "main.h"
+#include "bec_cmd.h"
+#include "clock.h"
+#include "cmdline.h"
+#include "gpio.h"
+#include "printf.h"
+#include "snoop.h"
+#include "timer.h"
+#include "uart.h"
+#include "utils.h"
+
+#include <libopencm3/stm32/dma.h>
+#include <libopencm3/stm32/gpio.h>
+#include <libopencm3/stm32/rcc.h>
+#include <libopencm3/stm32/timer.h>
+
+/*
+ * DMA2 Stream 5 Channel 6 is TIM1_UP (see adc.c for request mapping).
+ * Only DMA2 has access to the AHB1 GPIO registers.
+ */
+#define SNOOP_DMA          DMA2
+#define SNOOP_DMA_STREAM   5
+#define SNOOP_DMA_CHANNEL  DMA_SxCR_CHSEL_6
+
+static uint16_t snoop_buf[SNOOP_SAMPLES];
+static struct {
+    uint32_t rate;       // Actual sample rate (Hz)
+    uint16_t samples;    // Number of valid samples (0 = no capture)
+    uint16_t trigger;    // Sample number of trigger
+    uint8_t  port;       // Port letter sampled
+    uint8_t  triggered;  // Trigger condition was met
+} snoop_cap;
+
+static const uint32_t snoop_ports[] = {
+    GPIOA, GPIOB, GPIOC, GPIOD, GPIOE
+};
+
+/*
+ * snoop_reverse
+ * -------------
+ * Reverses the order of samples in the specified range of the buffer.
+ */
+static void
+snoop_reverse(uint start, uint end)
+{
+    while (start + 1 < end) {
+        uint16_t temp = snoop_buf[start];
+        snoop_buf[start++] = snoop_buf[--end];
+        snoop_buf[end] = temp;
+    }
+}
+
+/*
+ * snoop_stop
+ * ----------
+ * Stops the sample timer and DMA. Returns the buffer position of the
+ * next sample which would have been written (which is the oldest).
+ */
+static uint
+snoop_stop(void)
+{
+    uint pos;
+
+    timer_disable_counter(TIM1);
+    TIM_DIER(TIM1) &= ~TIM_DIER_UDE;
+    pos = SNOOP_SAMPLES - DMA_SNDTR(SNOOP_DMA, SNOOP_DMA_STREAM);
+    dma_disable_stream(SNOOP_DMA, SNOOP_DMA_STREAM);
+    while (DMA_SCR(SNOOP_DMA, SNOOP_DMA_STREAM) & DMA_SxCR_EN)
+        ;
+    return (pos % SNOOP_SAMPLES);
+}
+
+/*
+ * snoop_start
+ * -----------
+ * Configures DMA from the specified GPIO port input data register into
+ * the circular sample buffer, and starts the sample timer. Returns the
+ * actual sample rate, which is the closest the timer can do.
+ */
+static uint32_t
+snoop_start(uint32_t port, uint32_t rate)
+{
+    uint32_t timclk = clock_get_apb2() * 2;  // APB2 timers run at 2x PCLK2
+    uint32_t period = timclk / rate;
+
+    if (period < 1)
+        period = 1;
+    if (period > 0x10000)
+        period = 0x10000;
+
+    rcc_periph_clock_enable(RCC_DMA2);
+    dma_disable_stream(SNOOP_DMA, SNOOP_DMA_STREAM);
+    while (DMA_SCR(SNOOP_DMA, SNOOP_DMA_STREAM) & DMA_SxCR_EN)
+        ;
+    dma_clear_interrupt_flags(SNOOP_DMA, SNOOP_DMA_STREAM,
+                              DMA_TCIF | DMA_HTIF | DMA_TEIF | DMA_DMEIF |
+                              DMA_FEIF);
+    dma_set_peripheral_address(SNOOP_DMA, SNOOP_DMA_STREAM,
+                               (uintptr_t) &GPIO_IDR(port));
+    dma_set_memory_address(SNOOP_DMA, SNOOP_DMA_STREAM,
+                           (uintptr_t) &snoop_buf[0]);
+    dma_set_transfer_mode(SNOOP_DMA, SNOOP_DMA_STREAM,
+                          DMA_SxCR_DIR_PERIPHERAL_TO_MEM);
+    dma_set_number_of_data(SNOOP_DMA, SNOOP_DMA_STREAM, SNOOP_SAMPLES);
+    dma_channel_select(SNOOP_DMA, SNOOP_DMA_STREAM, SNOOP_DMA_CHANNEL);
+    dma_disable_peripheral_increment_mode(SNOOP_DMA, SNOOP_DMA_STREAM);
+    dma_enable_memory_increment_mode(SNOOP_DMA, SNOOP_DMA_STREAM);
+    dma_set_peripheral_size(SNOOP_DMA, SNOOP_DMA_STREAM,
+                            DMA_SxCR_PSIZE_16BIT);
+    dma_set_memory_size(SNOOP_DMA, SNOOP_DMA_STREAM, DMA_SxCR_MSIZE_16BIT);
+    dma_enable_circular_mode(SNOOP_DMA, SNOOP_DMA_STREAM);
+    dma_set_priority(SNOOP_DMA, SNOOP_DMA_STREAM, DMA_SxCR_PL_VERY_HIGH);
+    dma_enable_direct_mode(SNOOP_DMA, SNOOP_DMA_STREAM);
+    dma_enable_stream(SNOOP_DMA, SNOOP_DMA_STREAM);
+
+    /* Enable and reset TIM1 */
+    RCC_APB2ENR  |=  RCC_APB2ENR_TIM1EN;
+    RCC_APB2RSTR |=  RCC_APB2RSTR_TIM1RST;
+    RCC_APB2RSTR &= ~RCC_APB2RSTR_TIM1RST;
+
+    timer_set_prescaler(TIM1, 0);
+    timer_set_period(TIM1, period - 1);
+    timer_continuous_mode(TIM1);
+    TIM_DIER(TIM1) |= TIM_DIER_UDE;  // DMA request on update
+    timer_enable_counter(TIM1);
+
+    return (timclk / period);
+}
+
+/*
+ * snoop_trig_met
+ * --------------
+ * Returns non-zero if the sample meets the trigger condition. For
+ * SNOOP_TRIG_CHANGE, value is the masked port value when capture began.
+ */
+static uint
+snoop_trig_met(uint16_t sample, uint16_t mask, uint16_t value, uint flags)
+{
+    sample &= mask;
+    return ((flags & SNOOP_TRIG_CHANGE) ? (sample != value) :
+                                          (sample == value));
+}
+
+/*
+ * snoop_capture
+ * -------------
+ * Captures samples of a GPIO port until (port & mask) == value, or until
+ * (port & mask) changes if SNOOP_TRIG_CHANGE is specified. A mask of 0
+ * triggers immediately. The percent of the buffer before the trigger is
+ * specified by pre_pct.
+ */
+rc_t
+snoop_capture(uint port, uint32_t rate, uint16_t mask, uint16_t value,
+              uint flags, uint pre_pct)
+{
+    uint32_t gpio;
+    uint     post;
+    uint     first;
+    uint     pos;
+    uint     cur;
+    uint     end;
+    uint     oldest;
+    uint     count = 0;
+    rc_t     rc = RC_SUCCESS;
+
+    if ((port < 'A') || (port >= 'A' + ARRAY_SIZE(snoop_ports)) ||
+        (rate == 0) || (pre_pct > 100))
+        return (RC_BAD_PARAM);
+    gpio = snoop_ports[port - 'A'];
+    post = SNOOP_SAMPLES - SNOOP_SAMPLES * pre_pct / 100;
+    if (post > SNOOP_SAMPLES - 16)
+        post = SNOOP_SAMPLES - 16;  // Margin for trigger detection latency
+    if (post < 16)
+        post = 16;
+
+    memset(&snoop_cap, 0, sizeof (snoop_cap));
+    snoop_cap.port = port;
+    snoop_cap.rate = snoop_start(gpio, rate);
+
+    /* Fill the buffer once so all pre-trigger samples are valid */
+    timer_delay_usec(SNOOP_SAMPLES * 1000000ULL / snoop_cap.rate + 1);
+
+    if (flags & SNOOP_TRIG_CHANGE)
+        value = GPIO_IDR(gpio) & mask;
+    first = SNOOP_SAMPLES - DMA_SNDTR(SNOOP_DMA, SNOOP_DMA_STREAM);
+    while (mask != 0) {
+        if (snoop_trig_met(GPIO_IDR(gpio), mask, value, flags))
+            break;
+        if ((++count & 0xffff) == 0) {
+            if (input_break_pending()) {
+                printf("^C\n");
+                rc = RC_USR_ABORT;
+                break;
+            }
+        }
+    }
+    pos = SNOOP_SAMPLES - DMA_SNDTR(SNOOP_DMA, SNOOP_DMA_STREAM);
+
+    /* Wait for post-trigger samples */
+    do {
+        cur = SNOOP_SAMPLES - DMA_SNDTR(SNOOP_DMA, SNOOP_DMA_STREAM);
+    } while (((cur - pos) % SNOOP_SAMPLES) < post);
+    oldest = snoop_stop();
+
+    /* Rotate the buffer so that the oldest sample is first */
+    snoop_reverse(0, oldest);
+    snoop_reverse(oldest, SNOOP_SAMPLES);
+    snoop_reverse(0, SNOOP_SAMPLES);
+    snoop_cap.samples = SNOOP_SAMPLES;
+    snoop_cap.trigger = (pos + SNOOP_SAMPLES - oldest) % SNOOP_SAMPLES;
+
+    if ((mask != 0) && (rc == RC_SUCCESS)) {
+        /*
+         * The CPU sees the trigger some time after the DMA sampled it,
+         * may miss a short pulse entirely while it is interrupted, or
+         * may see the condition just before it is sampled. Report the
+         * first sample since polling began which meets the condition,
+         * walking back if it was already met before then.
+         */
+        cur = (first + SNOOP_SAMPLES - oldest) % SNOOP_SAMPLES;
+        end = snoop_cap.trigger + 16;
+        if (cur > snoop_cap.trigger)
+            cur = 0;  // Polling ran longer than the buffer holds
+        if (end > SNOOP_SAMPLES)
+            end = SNOOP_SAMPLES;
+        while ((cur < end) &&
+               !snoop_trig_met(snoop_buf[cur], mask, value, flags))
+            cur++;
+        if (cur < end) {
+            while ((cur > 0) &&
+                   snoop_trig_met(snoop_buf[cur - 1], mask, value, flags))
+                cur--;
+            snoop_cap.trigger = cur;
+        }
+        snoop_cap.triggered = 1;
+    }
+    return (rc);
+}
+
+/*
+ * snoop_get_runs
+ * --------------
+ * Run-length encodes captured samples starting at *pos into at most max
+ * runs (big endian). On return, *pos is the next sample to encode.
+ * Returns the number of runs.
+ */
+uint
+snoop_get_runs(uint *pos, bec_snoop_run_t *runs, uint max)
+{
+    uint cur = *pos;
+    uint count = 0;
+
+    while ((cur < snoop_cap.samples) && (count < max)) {
+        uint16_t value = snoop_buf[cur];
+        uint     start = cur;
+
+        while ((++cur < snoop_cap.samples) && (snoop_buf[cur] == value) &&
+               (cur - start < 0xffff))
+            ;
+        runs[count].bsr_value = __builtin_bswap16(value);
+        runs[count].bsr_count = __builtin_bswap16(cur - start);
+        count++;
+    }
+    *pos = cur;
+    return (count);
+}
+
+/*
+ * snoop_get_info
+ * --------------
+ * Reports parameters of the most recent capture in BEC_CMD_SNOOP format
+ * (big endian). Returns the number of samples captured.
+ */
+uint
+snoop_get_info(bec_snoop_t *info)
+{
+    info->bsn_rate    = __builtin_bswap32(snoop_cap.rate);
+    info->bsn_samples = __builtin_bswap16(snoop_cap.samples);
+    info->bsn_trigger = __builtin_bswap16(snoop_cap.trigger);
+    info->bsn_port    = snoop_cap.port;
+    info->bsn_flags   = snoop_cap.triggered ? BSN_FLAG_TRIGGERED : 0;
+    return (snoop_cap.samples);
+}
+
+/*
+ * snoop_show
+ * ----------
+ * Displays the most recent capture, one line per run of identical
+ * samples, with time relative to the trigger. Captures of GPIOB are
+ * also decoded as RTC bus signals. If dump is set, the runs are instead
+ * output in hex for transfer to a host.
+ */
+void
+snoop_show(uint dump)
+{
+    bec_snoop_run_t run;
+    uint            pos = 0;
+    uint            count = 0;
+
+    if (snoop_cap.samples == 0) {
+        printf("No capture\n");
+        return;
+    }
+    printf("GPIO%c %lu Hz, %u samples, trigger at %u%s\n",
+           snoop_cap.port, snoop_cap.rate, snoop_cap.samples,
+           snoop_cap.trigger, snoop_cap.triggered ? "" : " (none)");
+
+    while (snoop_get_runs(&pos, &run, 1) != 0) {
+        uint16_t value = __builtin_bswap16(run.bsr_value);
+        uint     len   = __builtin_bswap16(run.bsr_count);
+        uint     start = pos - len;
+        int64_t  nsec;
+
+        if (dump) {
+            printf("%04x%04x%c", value, len, (++count % 8) ? ' ' : '\n');
+            continue;
+        }
+        nsec = ((int64_t) start - snoop_cap.trigger) * 1000000000 /
+               snoop_cap.rate;
+        printf("%c%5u %9lld ns %04x x%-5u",
+               ((start <= snoop_cap.trigger) && (pos > snoop_cap.trigger)) ?
+               '*' : ' ', start, (long long) nsec, value, len);
+        if (snoop_cap.port == 'B') {
+            printf(" %s %c A=%x D=%x",
+                   (value & RTCEN_PIN) ? "     " : "RTCEN",
+                   (value & R_WA_PIN) ? 'R' : 'W',
+                   (value >> 10) & 0xf, (value >> 4) & 0xf);
+        }
+        printf("\n");
+        if (input_break_pending()) {
+            printf("^C\n");
+            return;
+        }
+    }
+    if (dump && (count % 8))
+        printf("\n");
+}
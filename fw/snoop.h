@@ -0,0 +1,27 @@
+/*
+ * This is free and unencumbered software released into the public domain.
+ * See the LICENSE file for additional details.
+ *
+ * Designed by Chris Hooper in 2025.
+ *
+ * ---------------------------------------------------------------------
+ *
+ * GPIO bus sampler.
+ */
+
+#ifndef _SNOOP_H
+#define _SNOOP_H
+
+#define SNOOP_SAMPLES       4096     // Capture buffer size (power of 2)
+#define SNOOP_RATE_DEFAULT  4000000  // Default sample rate (Hz)
+#define SNOOP_RATE_MAX      15000000 // DMA can not keep up beyond this
+
+#define SNOOP_TRIG_CHANGE   0x01     // Trigger on change of masked bits
+
+rc_t snoop_capture(uint port, uint32_t rate, uint16_t mask, uint16_t value,
+                   uint flags, uint pre_pct);
+uint snoop_get_runs(uint *pos, bec_snoop_run_t *runs, uint max);
+uint snoop_get_info(bec_snoop_t *info);
+void snoop_show(uint dump);
+
+#endif /* _SNOOP_H */
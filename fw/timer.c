@@ -201,23 +201,95 @@ timer_delay_ticks(uint32_t ticks)
     }
 }
 
+/* STM32F1 has no spare compare channel; alarm users must also poll */
+void
+timer_alarm_set(uint alarm, uint64_t when, void (*func)(void))
+{
+    (void) alarm;
+    (void) when;
+    (void) func;
+}
+
+void
+timer_alarm_cancel(uint alarm)
+{
+    (void) alarm;
+}
+
 #else  /* STM32F205 / STM32F407 */
+static void   (*timer_alarm_func[TIMER_ALARM_COUNT])(void);
+static uint64_t timer_alarm_tick[TIMER_ALARM_COUNT];
+
+/* Alarm n uses TIM2 compare channel n + 1 */
+#define TIMER_ALARM_CCIF(alarm) (TIM_SR_CC1IF << (alarm))
+#define TIMER_ALARM_CCIE(alarm) (TIM_DIER_CC1IE << (alarm))
+#define TIMER_ALARM_CCG(alarm)  (TIM_EGR_CC1G << (alarm))
+#define TIMER_ALARM_CCR(alarm)  (*(&TIM_CCR1(TIM2) + (alarm)))
+
 void
 tim2_isr(void)
 {
     uint32_t flags = TIM_SR(TIM2) & TIM_DIER(TIM2);
+    uint     alarm;
 
     TIM_SR(TIM2) = ~flags;  // Clear observed flags
 
     if (flags & TIM_SR_UIF)
         timer_high++;  // Increment upper bits of 64-bit timer value
 
+    for (alarm = 0; alarm < TIMER_ALARM_COUNT; alarm++) {
+        if ((flags & TIMER_ALARM_CCIF(alarm)) == 0)
+            continue;
+        /* Alarm compare matches only the low 32 bits of the tick */
+        flags &= ~TIMER_ALARM_CCIF(alarm);
+        if (timer_tick_has_elapsed(timer_alarm_tick[alarm])) {
+            TIM_DIER(TIM2) &= ~TIMER_ALARM_CCIE(alarm);
+            if (timer_alarm_func[alarm] != NULL)
+                timer_alarm_func[alarm]();
+        }
+    }
+
     if (flags & ~TIM_SR_UIF) {
         TIM_DIER(TIM2) &= ~(flags & ~TIM_SR_UIF);
         printf("Unexpected TIM2 IRQ: %04lx\n", flags & ~TIM_SR_UIF);
     }
 }
 
+/*
+ * timer_alarm_set
+ * ---------------
+ * Arranges for func to be called from the TIM2 interrupt handler once
+ * the tick timer reaches the specified value. Each alarm (TIMER_ALARM_*)
+ * is independent; setting an alarm replaces any previous time for it.
+ * The alarm time must be less than 2^32 ticks in the future.
+ */
+void
+timer_alarm_set(uint alarm, uint64_t when, void (*func)(void))
+{
+    TIM_DIER(TIM2) &= ~TIMER_ALARM_CCIE(alarm);
+    timer_alarm_func[alarm] = func;
+    timer_alarm_tick[alarm] = when;
+    TIMER_ALARM_CCR(alarm) = (uint32_t) when;
+    TIM_SR(TIM2) = ~TIMER_ALARM_CCIF(alarm);
+    TIM_DIER(TIM2) |= TIMER_ALARM_CCIE(alarm);
+
+    /* Compare will not match if the time has already passed */
+    if (timer_tick_has_elapsed(when))
+        TIM_EGR(TIM2) = TIMER_ALARM_CCG(alarm);
+}
+
+/*
+ * timer_alarm_cancel
+ * ------------------
+ * Cancels the specified alarm, if pending.
+ */
+void
+timer_alarm_cancel(uint alarm)
+{
+    TIM_DIER(TIM2) &= ~TIMER_ALARM_CCIE(alarm);
+    timer_alarm_func[alarm] = NULL;
+}
+
 /* STM32F205 / STM32F407 */
 uint64_t
 timer_tick_get(void)
@@ -25,5 +25,11 @@ uint64_t timer_tick_plus_usec(uint usec);
 uint64_t timer_tick_to_usec(uint64_t value);
 uint64_t timer_usec_to_tick(uint usec);
 uint32_t timer_nsec_to_tick(uint nsec);
+void     timer_alarm_set(uint alarm, uint64_t when, void (*func)(void));
+void     timer_alarm_cancel(uint alarm);
+
+#define TIMER_ALARM_POWER     0  // Power sequencing and power button
+#define TIMER_ALARM_JOYSTICK  1  // Joystick autofire and held releases
+#define TIMER_ALARM_COUNT     2
 
 #endif /* _TIMER_H */
@@ -22,6 +22,7 @@
 #include <libopencm3/stm32/f2/nvic.h>
 #include <libopencm3/cm3/scb.h>
 #include <libopencm3/stm32/usart.h>
+#include <libopencm3/stm32/iwdg.h>
 #include <libopencm3/stm32/rcc.h>
 #include <libopencm3/stm32/gpio.h>
 typedef uint32_t USART_TypeDef_P;
@@ -209,6 +210,8 @@ cons_rb_space(void)
 
 /*
  * input_break_pending() returns true if a ^C is pending in the input buffer.
+ * Console loops which run until ^C call this instead of main_poll(), so
+ * it also feeds the trial boot watchdog (see fwslot.h).
  *
  * This function requires no arguments.
  *
@@ -221,6 +224,7 @@ input_break_pending(void)
     uint cur;
     uint next;
 
+    iwdg_reset();
     for (cur = cons_in_rb_consumer; cur != cons_in_rb_producer; cur = next) {
         next = (cur + 1) % sizeof (cons_in_rb);
         if (cons_in_rb[cur] == 0x03) {  /* ^C is abort key */
@@ -370,6 +374,35 @@ ami_get_output(uint8_t **buf, uint maxlen)
     return (0);
 }
 
+/*
+ * ami_peek_output() copies up to maxlen bytes of pending Amiga console
+ *                   output to buf, without consuming it. The number of
+ *                   bytes copied is returned.
+ */
+uint
+ami_peek_output(uint8_t *buf, uint maxlen)
+{
+    uint cons = ami_out_cons;
+    uint count = 0;
+
+    ami_console_active = true;
+    while ((cons != ami_out_prod) && (count < maxlen)) {
+        buf[count++] = ami_out_buf[cons];
+        cons = (cons + 1) % sizeof (ami_out_buf);
+    }
+    return (count);
+}
+
+/*
+ * ami_skip_output() consumes count bytes of pending Amiga console output,
+ *                   which was previously read by ami_peek_output().
+ */
+void
+ami_skip_output(uint count)
+{
+    ami_out_cons = (ami_out_cons + count) % sizeof (ami_out_buf);
+}
+
 static void
 ami_putchar_wait(int ch)
 {
@@ -33,6 +33,8 @@ void uart_init(void);
 void usb_rb_put(uint ch);
 void ami_rb_put(uint ch);
 uint ami_get_output(uint8_t **buf, uint maxlen);
+uint ami_peek_output(uint8_t *buf, uint maxlen);
+void ami_skip_output(uint count);
 
 /*
  * input_break_pending() returns true if a ^C is pending in the input buffer.
@@ -16,8 +16,10 @@
 #include <libopencm3/usb/dfu.h>
 #include <libopencm3/stm32/usart.h>
 #include "clock.h"
+#include "crc32.h"
 
 #define ADDR8(x)    ((uint8_t *)  ((uintptr_t)(x)))
+#define ARRAY_SIZE(x) (sizeof (x) / sizeof ((x)[0]))
 #define STM32_UDID_LEN                  12    // 96 bits
 #define STM32_UDID_BASE                 DESIG_UNIQUE_ID_BASE
 
@@ -142,17 +144,52 @@ set_powerled(int state)
 #define CMD_SETADDR 0x21
 #define CMD_ERASE   0x41
 
+#define DFU_XFER_SIZE    4096  // wTransferSize (two flash pages)
+#define DFU_PROG_SLICE   256   // Bytes programmed per pass of main loop
+#define DFU_ERASE_MSEC   20    // Page erase time, for bwPollTimeout
+#define DFU_PROG_KB_MSEC 27    // Time to program 1 KB (52.5 us half-word)
+#define DFU_CRC_KB_USEC  125   // Time to CRC 1 KB of flash
+
 /* We need a special large control buffer for this device: */
-static uint8_t usbd_control_buffer[2048];
+static uint8_t usbd_control_buffer[DFU_XFER_SIZE];
 
-static enum dfu_state usbdfu_state = STATE_DFU_IDLE;
+static enum dfu_state  usbdfu_state  = STATE_DFU_IDLE;
+static enum dfu_status usbdfu_status = DFU_STATUS_OK;
 
+/*
+ * Download requests are queued in two buffers and carried out from the
+ * main loop, so the host sends the next block (or the data following an
+ * erase) while the previous request is still erasing or programming.
+ * The host is only held off (dfuDNBUSY) when both buffers are in use.
+ */
+#define JOB_ERASE   1
+#define JOB_PROGRAM 2
+
+typedef struct {
+    uint8_t  buf[DFU_XFER_SIZE];
+    uint32_t addr;      // Flash address
+    uint16_t len;       // Length of data to program
+    uint16_t pos;       // Bytes programmed so far
+    uint8_t  type;      // JOB_ERASE or JOB_PROGRAM
+} dfu_job_t;
+
+static dfu_job_t    dfu_job[2];
+static unsigned int dfu_job_head;   // Job being carried out
+static unsigned int dfu_job_count;  // Jobs queued
+static uint32_t     prog_addr;      // Set by CMD_SETADDR
+static uint8_t      manifest_ready; // Queue finished and last span verified
+
+/*
+ * Programmed data is verified by a single CRC of each contiguous span
+ * of flash written, compared against the CRC of the data received.
+ * A span is checked when programming moves elsewhere, before a page is
+ * erased, and at manifest.
+ */
 static struct {
-    uint8_t buf[sizeof (usbd_control_buffer)];
-    uint16_t len;
-    uint32_t addr;
-    uint16_t blocknum;
-} prog;
+    uint32_t start;     // Flash address of span start
+    uint32_t end;       // Flash address of span end
+    uint32_t crc;       // CRC of data received for span
+} verify;
 
 const struct usb_device_descriptor dev = {
     .bLength = USB_DT_DEVICE_SIZE,
@@ -176,7 +213,7 @@ const struct usb_dfu_descriptor dfu_function = {
     .bDescriptorType = DFU_FUNCTIONAL,
     .bmAttributes = USB_DFU_CAN_DOWNLOAD | USB_DFU_WILL_DETACH,
     .wDetachTimeout = 255,
-    .wTransferSize = 2048,
+    .wTransferSize = DFU_XFER_SIZE,
     .bcdDFUVersion = 0x011A,
 };
 
@@ -231,6 +268,8 @@ static const char *usb_strings[] = {
 /*
  * Real STM32F107 in DFU mode
  * -----------------------------------------------
+ * Descriptors of the ST ROM loader, for reference.
+ *
  * idVendor           0x0483 STMicroelectronics
  * idProduct          0xdf11 STM Device in DFU Mode
  * bcdDevice           22.00
@@ -266,7 +305,7 @@ static const char *usb_strings[] = {
  *      Upload Supported
  *      Download Supported
  *    wDetachTimeout                    255 milliseconds
- *    wTransferSize                    2048 bytes
+ *    wTransferSize                    2048 bytes (here DFU_XFER_SIZE, 4096)
  *    bcdDFUVersion                   1.1a
  */
 
@@ -312,88 +351,238 @@ usbd_usr_serial(uint8_t *buf)
     return (buf);
 }
 
+/*
+ * usbdfu_verify() compares the CRC of the span of flash just programmed
+ * against the CRC of the data which was received for it, and then starts
+ * a new (empty) span at the specified address.
+ *
+ * Returns non-zero if the flash contents do not match.
+ */
+static unsigned int
+usbdfu_verify(uint32_t next_addr)
+{
+    unsigned int rc = 0;
+
+    if ((verify.end != verify.start) &&
+        (crc32(0, ADDR8(verify.start), verify.end - verify.start) !=
+         verify.crc)) {
+        uart_puts("\nVerify failed at ");
+        uart_puthex(verify.start);
+        rc = 1;
+    }
+    verify.start = next_addr;
+    verify.end   = next_addr;
+    verify.crc   = 0;
+    return (rc);
+}
+
+static void
+usbdfu_fail(enum dfu_status status)
+{
+    usbdfu_state  = STATE_DFU_ERROR;
+    usbdfu_status = status;
+    dfu_job_count = 0;
+    uart_puts("\nDFU ERROR ");
+    uart_puthex(status);
+    uart_puts("\n");
+}
+
+/*
+ * usbdfu_job_run() carries out part of the oldest queued download request.
+ * An erase is done in one pass, but programming is split into slices so
+ * that USB continues to be serviced. Once the queue is empty at manifest,
+ * the last span is verified.
+ */
+static void
+usbdfu_job_run(void)
+{
+    static uint8_t lstate;
+    dfu_job_t     *job;
+    uint32_t       flags;
+    unsigned int   len;
+    unsigned int   i;
+
+    if (dfu_job_count == 0) {
+        if (((usbdfu_state == STATE_DFU_MANIFEST_SYNC) ||
+             (usbdfu_state == STATE_DFU_MANIFEST)) && !manifest_ready) {
+            /* All requests are done; check the last span */
+            if (usbdfu_verify(0))
+                usbdfu_fail(DFU_STATUS_ERR_VERIFY);
+            else
+                manifest_ready = 1;
+        }
+        return;
+    }
+
+    job = &dfu_job[dfu_job_head];
+    if (job->pos == 0) {
+        /* Check the span so far before it is erased or left */
+        if (((job->type == JOB_ERASE) || (job->addr != verify.end)) &&
+            usbdfu_verify((job->type == JOB_ERASE) ? verify.end : job->addr)) {
+            usbdfu_fail(DFU_STATUS_ERR_VERIFY);
+            return;
+        }
+    }
+    set_powerled(0);
+    set_flashled(1);
+    flash_unlock();
+    if (job->type == JOB_ERASE) {
+        if (lstate != 1)
+            uart_puts("\nErase   ");
+        else
+            uart_putc('.');
+        lstate = 1;
+        flash_erase_page(job->addr);
+    } else {
+        if (job->pos == 0) {
+            if (lstate != 2)
+                uart_puts("\nProgram ");
+            else
+                uart_putc('.');
+            lstate = 2;
+            verify.crc = crc32(verify.crc, job->buf, job->len);
+            verify.end += job->len;
+        }
+        len = job->len - job->pos;
+        if (len > DFU_PROG_SLICE)
+            len = DFU_PROG_SLICE;
+        for (i = 0; i < len; i += 2) {
+            uint16_t *dat = (uint16_t *)(job->buf + job->pos + i);
+            flash_program_half_word(job->addr + job->pos + i, *dat);
+        }
+        job->pos += len;
+    }
+    flags = flash_get_status_flags();
+    flash_lock();
+    set_flashled(0);
+
+    if (flags & (FLASH_SR_PGERR | FLASH_SR_WRPRTERR)) {
+        flash_clear_status_flags();
+        usbdfu_fail((job->type == JOB_ERASE) ? DFU_STATUS_ERR_ERASE :
+                                               DFU_STATUS_ERR_PROG);
+        return;
+    }
+
+    if ((job->type == JOB_ERASE) || (job->pos >= job->len)) {
+        dfu_job_head = (dfu_job_head + 1) % ARRAY_SIZE(dfu_job);
+        dfu_job_count--;
+    }
+}
+
+/*
+ * usbdfu_queue() accepts a download request from the host. The ST DfuSe
+ * Set Address command is handled immediately; erase and program requests
+ * are queued for usbdfu_job_run().
+ *
+ * Returns non-zero if the request could not be accepted.
+ */
+static unsigned int
+usbdfu_queue(uint16_t blocknum, const uint8_t *buf, uint16_t len)
+{
+    dfu_job_t *job;
+    uint32_t   addr = 0;
+
+    if (blocknum == 0) {
+        if ((len < 5) || ((buf[0] != CMD_SETADDR) && (buf[0] != CMD_ERASE)))
+            return (0);
+        memcpy(&addr, buf + 1, sizeof (addr));
+        if (buf[0] == CMD_SETADDR) {
+            prog_addr = addr;
+            return (0);
+        }
+    }
+    if (dfu_job_count == ARRAY_SIZE(dfu_job))
+        return (1);  // Host did not wait for dfuDNLOAD-IDLE
+
+    job = &dfu_job[(dfu_job_head + dfu_job_count) % ARRAY_SIZE(dfu_job)];
+    if (blocknum == 0) {
+        job->type = JOB_ERASE;
+        job->addr = addr;
+    } else {
+        job->type = JOB_PROGRAM;
+        job->addr = prog_addr + (blocknum - 2) * DFU_XFER_SIZE;
+        memcpy(job->buf, buf, len);
+    }
+    job->len = len;
+    job->pos = 0;
+    dfu_job_count++;
+    return (0);
+}
+
+/*
+ * usbdfu_busy_msec() estimates how long the oldest queued jobs will take
+ * to finish, so that bwPollTimeout tells the host when to ask again.
+ */
+static uint32_t
+usbdfu_busy_msec(unsigned int jobs)
+{
+    uint32_t     msec = 0;
+    unsigned int cur;
+
+    for (cur = 0; cur < jobs; cur++) {
+        dfu_job_t *job = &dfu_job[(dfu_job_head + cur) % ARRAY_SIZE(dfu_job)];
+        if (job->type == JOB_ERASE)
+            msec += DFU_ERASE_MSEC;
+        else
+            msec += (job->len - job->pos) * DFU_PROG_KB_MSEC / 1024 + 1;
+    }
+    return (msec);
+}
+
+/*
+ * usbdfu_getstatus() reports progress to the host. Flash work is never
+ * done here; while the main loop is busy, the host is told to wait in
+ * dfuDNBUSY or dfuMANIFEST for about as long as the work will take.
+ */
 static uint8_t
 usbdfu_getstatus(uint32_t *bwPollTimeout)
 {
     switch (usbdfu_state) {
         case STATE_DFU_DNLOAD_SYNC:
-            usbdfu_state = STATE_DFU_DNBUSY;
-            *bwPollTimeout = 100;
-            return (DFU_STATUS_OK);
+        case STATE_DFU_DNBUSY:
+            if (dfu_job_count < ARRAY_SIZE(dfu_job)) {
+                /* Room for the next block */
+                usbdfu_state = STATE_DFU_DNLOAD_IDLE;
+            } else {
+                usbdfu_state = STATE_DFU_DNBUSY;
+                *bwPollTimeout = usbdfu_busy_msec(1);
+            }
+            return (usbdfu_status);
         case STATE_DFU_MANIFEST_SYNC:
+        case STATE_DFU_MANIFEST:
+            if (!manifest_ready) {
+                usbdfu_state = STATE_DFU_MANIFEST;
+                *bwPollTimeout = usbdfu_busy_msec(dfu_job_count) + 1 +
+                                 (verify.end - verify.start) / 1024 *
+                                 DFU_CRC_KB_USEC / 1000;
+                return (usbdfu_status);
+            }
             /* Device will reset when read is complete. */
-            usbdfu_state = STATE_DFU_MANIFEST;
+            usbdfu_state = STATE_DFU_MANIFEST_WAIT_RESET;
             return (DFU_STATUS_OK);
         default:
-            return (DFU_STATUS_OK);
+            return (usbdfu_status);
     }
 }
 
 static void
 usbdfu_getstatus_complete(usbd_device *usbd_dev, struct usb_setup_data *req)
 {
-    static uint8_t lstate;
-    int i;
     (void) req;
     (void) usbd_dev;
 
     switch (usbdfu_state) {
-        case STATE_DFU_DNBUSY:
-            flash_unlock();
-            if (prog.blocknum == 0) {
-                switch (prog.buf[0]) {
-                    case CMD_ERASE: {
-                        uint32_t *dat = (uint32_t *)(prog.buf + 1);
-                        set_powerled(0);
-                        set_flashled(1);
-                        if (lstate != 1)
-                            uart_puts("\nErase   ");
-                        else
-                            uart_putc('.');
-                        lstate = 1;
-                        flash_erase_page(*dat);
-                        set_flashled(0);
-                        break;
-                    }
-                    case CMD_SETADDR: {
-                        uint32_t *dat = (uint32_t *)(prog.buf + 1);
-                        prog.addr = *dat;
-                        break;
-                    }
-                }
-            } else {
-                uint32_t baseaddr = prog.addr + ((prog.blocknum - 2) *
-                                                dfu_function.wTransferSize);
-                set_powerled(0);
-                set_flashled(1);
-                if (lstate != 2)
-                    uart_puts("\nProgram ");
-                else
-                    uart_putc('.');
-                lstate = 2;
-                for (i = 0; i < prog.len; i += 2) {
-                    uint16_t *dat = (uint16_t *)(prog.buf + i);
-                    flash_program_half_word(baseaddr + i, *dat);
-                }
-                set_flashled(0);
-            }
-            flash_lock();
-
-            /* Jump straight to dfuDNLOAD-IDLE, skipping dfuDNLOAD-SYNC. */
-            usbdfu_state = STATE_DFU_DNLOAD_IDLE;
-            break;
-        case STATE_DFU_MANIFEST:
+        case STATE_DFU_MANIFEST_WAIT_RESET:
             /* USB device must detach, we just reset... */
             uart_puts("\nReset\n");
             uart_wait_done(USART1);
             scb_reset_system();
             break; /* Will never return. */
         case STATE_DFU_IDLE:
-            break;
         case STATE_DFU_DNLOAD_IDLE:
-            break;
+        case STATE_DFU_DNBUSY:
+        case STATE_DFU_MANIFEST:
         case STATE_DFU_ERROR:
-            uart_puts("\nDFU ERROR\n");
             break;
         default:
             uart_puts("Unknown ");
@@ -416,26 +605,48 @@ usbdfu_control_request(usbd_device *usbd_dev, struct usb_setup_data *req,
 
     switch (req->bRequest) {
         case DFU_DNLOAD:
+            if (usbdfu_state == STATE_DFU_ERROR)
+                return (USBD_REQ_NOTSUPP);  // Host must clear status first
             if ((len == NULL) || (*len == 0)) {
-                usbdfu_state = STATE_DFU_MANIFEST_SYNC;
+                usbdfu_state   = STATE_DFU_MANIFEST_SYNC;
+                manifest_ready = 0;
             } else {
-                /* Copy download data for use on GET_STATUS. */
-                prog.blocknum = req->wValue;
-                prog.len = *len;
-                memcpy(prog.buf, *buf, *len);
+                if ((*len > DFU_XFER_SIZE) ||
+                    usbdfu_queue(req->wValue, *buf, *len)) {
+                    usbdfu_fail(DFU_STATUS_ERR_STALLEDPKT);
+                    return (USBD_REQ_NOTSUPP);
+                }
                 usbdfu_state = STATE_DFU_DNLOAD_SYNC;
             }
             return (USBD_REQ_HANDLED);
         case DFU_CLRSTATUS:
             uart_puts("CLRSTATUS\n");
             /* Clear error and return to dfuIDLE. */
-            if (usbdfu_state == STATE_DFU_ERROR)
-                usbdfu_state = STATE_DFU_IDLE;
+            if (usbdfu_state == STATE_DFU_ERROR) {
+                usbdfu_state  = STATE_DFU_IDLE;
+                usbdfu_status = DFU_STATUS_OK;
+
+                /* Drop the span; its last request was not finished */
+                verify.start = 0;
+                verify.end   = 0;
+                verify.crc   = 0;
+            }
             return (USBD_REQ_HANDLED);
         case DFU_ABORT:
-            /* Abort returns to dfuIDLE state. */
+            /*
+             * Abort returns to dfuIDLE state. Requests which the host was
+             * already told were done are still finished by the main loop,
+             * so that flash is not left partially programmed. The host may
+             * only abort from dfuIDLE or dfuDNLOAD-IDLE, so a buffer is free
+             * for its next request. The span being verified stays open, as
+             * its data will all be programmed.
+             */
+            if ((usbdfu_state != STATE_DFU_IDLE) &&
+                (usbdfu_state != STATE_DFU_DNLOAD_IDLE))
+                return (USBD_REQ_NOTSUPP);
             uart_puts("\nDone");
-            usbdfu_state = STATE_DFU_IDLE;
+            usbdfu_state  = STATE_DFU_IDLE;
+            usbdfu_status = DFU_STATUS_OK;
             return (USBD_REQ_HANDLED);
         case DFU_UPLOAD:
             /* Upload not supported for now. */
@@ -517,5 +728,6 @@ main(void)
     while (1) {
         set_powerled(((led_state++) & 0x000000ff) ? 0 : 1);  // flicker
         usbd_poll(usbd_dev);
+        usbdfu_job_run();
     }
 }
@@ -18,6 +18,7 @@
 #include "clock.h"
 
 #include <libopencm3/cm3/scb.h>
+#include <libopencm3/cm3/vector.h>
 #include <libopencm3/stm32/rcc.h>
 #include <libopencm3/cm3/scb.h>
 #include <libopencm3/stm32/dbgmcu.h>
@@ -157,8 +158,10 @@ reset_check(void)
         /*
          * STM32F107/STM32F407 ROM DFU does not correctly re-initialize
          * VTOR following exit from DFU mode, it must be done here.
+         * The vector table is not at the start of flash when this image
+         * runs from a dual-slot firmware slot.
          */
-        SCB_VTOR = FLASH_BASE;  // Set the vector table pointer
+        SCB_VTOR = (uintptr_t) &vector_table;  // Set vector table pointer
         dmb();
 
         /* Continue normal HAL SystemInit() */
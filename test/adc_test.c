@@ -0,0 +1,322 @@
+/*
+ * This is free and unencumbered software released into the public domain.
+ * See the LICENSE file for additional details.
+ *
+ * Designed by Chris Hooper in 2025.
+ *
+ * ---------------------------------------------------------------------
+ *
+ * Host test of the ADC oversampling, decimation, and IIR filter stage
+ * (fw/adc.c). Synthetic DMA half-buffers, carrying Gaussian noise and
+ * occasional load spikes, are pushed through adc_dma_half() as the DMA
+ * interrupts would. The test checks the noise reduction against single
+ * raw conversions, false limit trips, step response, unfiltered VBAT,
+ * and rail window reports. It then compares the main loop cost of
+ * rescaling every pass with rescaling only on a new decimated sample.
+ */
+
+#include "../fw/adc.c"
+#include <math.h>
+#include <time.h>
+#include "test.h"
+
+#define CH_VREF   0
+#define CH_TEMP   1
+#define CH_V5     2
+#define CH_VBAT   3
+#define CHANNELS  4
+
+#define NOISE_LSB     8.0    // Conversion noise standard deviation
+#define SPIKE_LSB     150    // Load transient on a single conversion
+#define SPIKE_RATE    50     // One conversion in this many is a spike
+#define LIMIT_LSB     60     // Sensor limit distance from true value
+
+volatile uint32_t ocm3_regs[256];
+
+static double   level[CHANNELS];  // True input of each channel
+static uint32_t rand_state = 1;
+static uint     rail_reports;
+static uint     rail_bad;
+
+void
+fw_dprintf(uint32_t mask, const char *fmt, ...)
+{
+    (void) mask;
+    (void) fmt;
+}
+
+uint32_t
+gpio_num_to_gpio(uint num)
+{
+    return (num);
+}
+
+void
+gpio_setmode(uint32_t GPIOx, uint16_t GPIO_Pins, uint value)
+{
+    (void) GPIOx;
+    (void) GPIO_Pins;
+    (void) value;
+}
+
+bool
+timer_tick_has_elapsed(uint64_t value)
+{
+    (void) value;
+    return (true);
+}
+
+uint64_t
+timer_tick_plus_msec(uint msec)
+{
+    return (msec);
+}
+
+void
+power_rail_event(uint mask, uint bad)
+{
+    (void) mask;
+    rail_reports++;
+    rail_bad = bad;
+}
+
+static double
+rand_uniform(void)
+{
+    rand_state = rand_state * 1103515245 + 12345;
+    return (((rand_state >> 8) + 0.5) / (double) (1 << 24));
+}
+
+static double
+rand_gauss(void)
+{
+    return (sqrt(-2.0 * log(rand_uniform())) *
+            cos(2.0 * M_PI * rand_uniform()));
+}
+
+static uint16_t
+convert(uint ch)
+{
+    double v = level[ch] + NOISE_LSB * rand_gauss();
+
+    if ((ch != CH_VREF) && (rand_uniform() * SPIKE_RATE < 1.0))
+        v -= SPIKE_LSB;
+    if (v < 0)
+        v = 0;
+    if (v > 4095)
+        v = 4095;
+    return ((uint16_t) lround(v));
+}
+
+/*
+ * dma_half() fills one half of the circular DMA buffer with a set of
+ * conversions of each channel, then runs the interrupt processing.
+ * The last raw conversion of CH_V5 is returned, which is what the main
+ * loop used to see.
+ */
+static uint16_t
+dma_half(uint half)
+{
+    volatile uint16_t *buf = &adc_buffer[half * channel_count *
+                                         ADC_SETS_PER_HALF];
+    uint16_t raw = 0;
+    uint     set;
+    uint     ch;
+
+    for (set = 0; set < ADC_SETS_PER_HALF; set++) {
+        for (ch = 0; ch < channel_count; ch++) {
+            uint16_t val = convert(ch);
+            *(buf++) = val;
+            if (ch == CH_V5)
+                raw = val;
+        }
+    }
+    adc_dma_half(&adc_buffer[half * channel_count * ADC_SETS_PER_HALF]);
+    return (raw);
+}
+
+static void
+setup(void)
+{
+    adc_setup_sensor(CH_VREF, 0, ADC_CHANNEL_VREF);
+    adc_setup_sensor(CH_TEMP, 0, ADC_CHANNEL_TEMP);
+    adc_setup_sensor(CH_V5, GPP((PA + 1), 4), 4);
+    adc_setup_sensor(CH_VBAT, 0, ADC_CHANNEL_VBAT);
+    CHECK(channel_count == CHANNELS);
+    CHECK(adc_nofilter == BIT(CH_VBAT));
+
+    level[CH_VREF] = 1502;  // 1.21V with 3.3V reference
+    level[CH_TEMP] = 1180;
+    level[CH_V5]   = 3103;  // 5V through 2:1 divider
+    level[CH_VBAT] = 1862;  // 3.0V / 2
+}
+
+static void
+test_noise(void)
+{
+    double   raw_sq = 0;
+    double   out_sq = 0;
+    uint     raw_trips = 0;
+    uint     out_trips = 0;
+    uint     samples = 0;
+    uint     seq = adc_get_seq();
+    uint     half;
+    uint     cur;
+
+    /* Settle the filter */
+    for (half = 0; half < 64; half++)
+        dma_half(half & 1);
+
+    for (cur = 0; cur < 2000; cur++) {
+        for (half = 0; half < ADC_DECIMATE; half++) {
+            uint16_t raw = dma_half(half & 1);
+            double   err = raw - level[CH_V5];
+            raw_sq += err * err;
+            if (fabs(err) > LIMIT_LSB)
+                raw_trips++;
+        }
+        CHECK(adc_get_seq() == seq + 16 + cur + 1);
+        {
+            double err = adc_sample[CH_V5] - level[CH_V5];
+            out_sq += err * err;
+            if (fabs(err) > LIMIT_LSB)
+                out_trips++;
+            samples++;
+        }
+    }
+
+    double raw_rms = sqrt(raw_sq / (samples * ADC_DECIMATE));
+    double out_rms = sqrt(out_sq / samples);
+    printf("  V5 error rms: raw %.1f LSB, filtered %.1f LSB (%.1fx)\n",
+           raw_rms, out_rms, raw_rms / out_rms);
+    printf("  limit trips at +/-%u LSB: raw %u of %u, filtered %u of %u\n",
+           LIMIT_LSB, raw_trips, samples * ADC_DECIMATE, out_trips, samples);
+    CHECK(raw_rms / out_rms > 4.0);
+    CHECK(raw_trips > 0);
+    CHECK(out_trips == 0);
+}
+
+static void
+test_step(void)
+{
+    uint samples = 0;
+    uint half;
+
+    /* 5V rail sags by 10% */
+    level[CH_V5] *= 0.9;
+    while (fabs(adc_sample[CH_V5] - level[CH_V5]) > 0.1 * level[CH_V5] / 9) {
+        for (half = 0; half < ADC_DECIMATE; half++)
+            dma_half(half & 1);
+        if (++samples > 50)
+            break;
+    }
+    printf("  10%% step settles to 90%% in %u samples (~%u msec)\n",
+           samples, samples * 10);
+    CHECK(samples <= 10);
+
+    /*
+     * VBAT is only averaged, so a step appears in one sample, offset only
+     * by noise and the average of load spikes.
+     */
+    level[CH_VBAT] = 1500;
+    for (half = 0; half < ADC_DECIMATE; half++)
+        dma_half(half & 1);
+    CHECK(fabs(adc_sample[CH_VBAT] - 1500.0) < 2 * NOISE_LSB);
+}
+
+static void
+test_window(void)
+{
+    uint half;
+    int  v5;
+
+    adc_get_reading(0);  // Establish scale from VREF
+    v5 = adc_get_reading(CH_V5);
+    adc_set_window(CH_V5, v5 * 95 / 100, v5 * 105 / 100);
+    CHECK(adc_window_mask == BIT(CH_V5));
+
+    rail_reports = 0;
+    for (half = 0; half < ADC_DECIMATE; half++)
+        dma_half(half & 1);
+    CHECK(rail_reports == 1);
+    CHECK(rail_bad == 0);
+
+    level[CH_V5] *= 0.8;
+    for (half = 0; half < ADC_DECIMATE * 8; half++)
+        dma_half(half & 1);
+    CHECK(rail_reports == 9);
+    CHECK(rail_bad == BIT(CH_V5));
+}
+
+static double
+nsec_now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (ts.tv_sec * 1e9 + ts.tv_nsec);
+}
+
+/*
+ * bench_loop() compares main loop work per 10 msec decimated sample
+ * period. Before, every pass rescaled all channels. Now a pass only
+ * checks the sample sequence, and rescaling happens once per sample,
+ * while the interrupts accumulate the DMA buffer.
+ */
+static void
+bench_loop(void)
+{
+    static const uint rates[] = { 1000, 10000, 100000 };
+    const uint iters = 200000;
+    volatile int sink = 0;
+    volatile uint seq = 0;
+    double   t_scale;
+    double   t_seq;
+    double   t_isr;
+    double   start;
+    uint     iter;
+    uint     ch;
+    uint     cur;
+
+    start = nsec_now();
+    for (iter = 0; iter < iters; iter++)
+        for (ch = 0; ch < channel_count; ch++)
+            sink += adc_get_reading(ch);
+    t_scale = (nsec_now() - start) / iters;
+
+    start = nsec_now();
+    for (iter = 0; iter < iters; iter++)
+        if (adc_get_seq() != seq)
+            seq++;
+    t_seq = (nsec_now() - start) / iters;
+
+    start = nsec_now();
+    for (iter = 0; iter < iters; iter++)
+        adc_dma_half(&adc_buffer[(iter & 1) * channel_count *
+                                 ADC_SETS_PER_HALF]);
+    t_isr = (nsec_now() - start) / iters * ADC_DECIMATE;
+
+    printf("  host cost: rescale %.0f ns, seq check %.1f ns, "
+           "interrupts %.0f ns per sample\n", t_scale, t_seq, t_isr);
+    for (cur = 0; cur < ARRAY_SIZE(rates); cur++) {
+        double passes = rates[cur] / 100.0;  // Passes per 10 msec
+        double old = passes * t_scale;
+        double new = passes * t_seq + t_scale + t_isr;
+        printf("  %6u passes/sec: old %8.0f ns, new %6.0f ns per sample "
+               "period (%.1fx less)\n", rates[cur], old, new, old / new);
+        if (rates[cur] >= 10000)
+            CHECK(new < old);
+    }
+    (void) sink;
+}
+
+int
+main(void)
+{
+    printf("adc:\n");
+    setup();
+    test_noise();
+    test_step();
+    test_window();
+    bench_loop();
+    return (test_result("adc"));
+}
@@ -0,0 +1,31 @@
+/*
+ * This is free and unencumbered software released into the public domain.
+ * See the LICENSE file for additional details.
+ *
+ * Designed by Chris Hooper in 2025.
+ *
+ * ---------------------------------------------------------------------
+ *
+ * Host build of the Amiga BEC messaging code (amiga/becmsg.c), for tests
+ * of its mailbox protocol. The Amiga tools direct stdio through the clib2
+ * __iob table, which is pointed here at the host streams.
+ */
+
+#include <stdio.h>
+#include <exec/types.h>
+
+static struct iob *host_iob[3];
+struct iob       **__iob = host_iob;
+uint               flag_debug;
+unsigned int       irq_disabled;
+
+static void __attribute__((constructor))
+host_iob_init(void)
+{
+    host_iob[0] = (struct iob *) stdin;
+    host_iob[1] = (struct iob *) stdout;
+    host_iob[2] = (struct iob *) stderr;
+}
+
+#include "../amiga/becmsg.c"
+#include "../fw/crc32.c"
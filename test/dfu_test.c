@@ -0,0 +1,592 @@
+/*
+ * This is free and unencumbered software released into the public domain.
+ * See the LICENSE file for additional details.
+ *
+ * Designed by Chris Hooper in 2025.
+ *
+ * ---------------------------------------------------------------------
+ *
+ * Host simulation of the stand-alone USB DFU programmer (fw/usbdfu.c),
+ * built with fw/crc32.c as the firmware is. Flash is an STM32F107 model
+ * mapped at FLASH_BASE, with page erase and half-word program times. The
+ * USB control pipe delivers requests from usbd_poll() in the main loop,
+ * so data arriving while flash work runs is held off once the receive
+ * FIFO is full. The host downloads images as dfu-util does to a DfuSe
+ * device, waiting for bwPollTimeout after each status read.
+ *
+ * Total update time is reported for whole images, and for updates which
+ * are interrupted by DFU_ABORT or by a device reset and then started
+ * over. A stuck flash bit must be reported as a verify error, and the
+ * device must only reset into an image which verified. The previous
+ * programmer, which did each 2048-byte transfer's flash work inside a
+ * status request after a fixed 100 ms bwPollTimeout, is modeled for
+ * comparison.
+ */
+
+#include <setjmp.h>
+#include <stdlib.h>
+#include <sys/mman.h>
+#include "../fw/crc32.c"
+
+static uint32_t dfu_crc32(uint32_t oldcrc, const void *data, size_t len);
+
+#define crc32 dfu_crc32
+#define main  usbdfu_main
+void main(void);
+#include "../fw/usbdfu.c"
+#undef crc32
+#undef main
+
+#include "test.h"
+
+#define FLASH_SIZE     (256 << 10)  // STM32F107VC
+#define PAGE_SIZE      2048
+#define ERASE_USEC     20000        // Page erase, typical
+#define PROGRAM_USEC   52.5         // Half-word program, typical
+#define CRC_KB_USEC    125          // crc32() of 1 KB at 72 MHz
+#define LOOP_USEC      2            // Main loop pass without flash work
+#define PKT_USEC       53           // 64-byte control packet, 19 per frame
+#define FIFO_PKTS      20           // OTG FS receive FIFO (1.25 KB)
+#define HOST_USEC      1000         // Host turnaround per control transfer
+#define RESET_USEC     1500000      // Re-enumeration and dfu-util restart
+#define OLD_XFER_SIZE  2048
+#define OLD_POLL_USEC  100000
+
+/* Control pipe states */
+#define PIPE_IDLE      0
+#define PIPE_DATA      1            // Setup and OUT data arriving
+#define PIPE_STATUS    2            // Handled; status stage at next poll
+#define PIPE_DONE      3
+
+/* How a download is interrupted; see sim_update() */
+#define STOP_ABORT     1
+#define STOP_RESET     2
+
+struct _usbd_driver {
+    int unused;
+};
+
+struct _usbd_device {
+    uint8_t                  *ctrl_buf;    // Given to usbd_init()
+    usbd_set_config_callback  set_config;
+    usbd_control_callback     control;
+};
+
+const usbd_driver       stm32f107_usb_driver;
+volatile uint32_t       ocm3_regs[256];
+uint8_t                 ocm3_unique_id[12] = {
+    0x34, 0xff, 0xd8, 0x05, 0x42, 0x4b, 0x30, 0x38, 0x21, 0x65, 0x13, 0x43
+};
+
+static usbd_device sim_usbd;
+static double      sim_usec;
+static uint8_t    *flash;
+static uint32_t    flash_sr;       // Error flags of the last operation
+static uint32_t    stuck_addr;     // Half-word with a bit stuck at 0
+static uint16_t    stuck_mask;
+static double      flash_usec;     // Time spent erasing and programming
+static double      req_max_usec;   // Longest time in a request callback
+static uint        resets;         // scb_reset_system() calls
+static uint        booting;        // usbd_poll() returns to sim_boot()
+static jmp_buf     boot_jmp;
+static uint32_t    rand_state = 1;
+
+/* The control transfer in progress */
+static struct {
+    struct usb_setup_data          req;
+    const uint8_t                 *data;      // OUT data stage
+    uint8_t                       *in;        // IN data stage
+    uint                           pkts;      // OUT data packets
+    uint                           rx;        // OUT data packets received
+    double                         next_pkt;  // When the next may arrive
+    uint                           state;     // PIPE_*
+    int                            rc;        // -1 if stalled
+    double                         done;      // When the host sees it end
+    usbd_control_complete_callback complete;
+} pipe;
+
+static uint
+rand32(void)
+{
+    rand_state = rand_state * 1103515245 + 12345;
+    return (rand_state >> 8);
+}
+
+static uint32_t
+dfu_crc32(uint32_t oldcrc, const void *data, size_t len)
+{
+    sim_usec += (double) len * CRC_KB_USEC / 1024;
+    return (crc32(oldcrc, data, len));
+}
+
+void
+clock_init(void)
+{
+}
+
+void
+scb_reset_system(void)
+{
+    resets++;
+}
+
+void
+flash_erase_page(uint32_t page_address)
+{
+    uint32_t off = (page_address - FLASH_BASE) & ~(PAGE_SIZE - 1);
+
+    if (off >= FLASH_SIZE) {
+        flash_sr |= FLASH_SR_WRPRTERR;
+        return;
+    }
+    memset(flash + off, 0xff, PAGE_SIZE);
+    sim_usec   += ERASE_USEC;
+    flash_usec += ERASE_USEC;
+}
+
+/*
+ * flash_program_half_word() writes a half-word which must be erased,
+ * unless the new value is zero, as the F1 flash controller requires.
+ */
+void
+flash_program_half_word(uint32_t address, uint16_t data)
+{
+    uint32_t  off = address - FLASH_BASE;
+    uint16_t *ptr = (uint16_t *) (flash + off);
+
+    if ((off >= FLASH_SIZE) || (off & 1)) {
+        flash_sr |= FLASH_SR_WRPRTERR;
+        return;
+    }
+    if ((*ptr != 0xffff) && (data != 0)) {
+        flash_sr |= FLASH_SR_PGERR;
+        return;
+    }
+    if (address == stuck_addr)
+        data &= ~stuck_mask;
+    *ptr = data;
+    sim_usec   += PROGRAM_USEC;
+    flash_usec += PROGRAM_USEC;
+}
+
+uint32_t
+flash_get_status_flags(void)
+{
+    return (flash_sr);
+}
+
+void
+flash_clear_status_flags(void)
+{
+    flash_sr = 0;
+}
+
+usbd_device *
+usbd_init(const usbd_driver *driver,
+          const struct usb_device_descriptor *device,
+          const struct usb_config_descriptor *conf,
+          const char * const *strings, int num_strings,
+          uint8_t *control_buffer, uint16_t control_buffer_size)
+{
+    (void) driver;
+    (void) device;
+    (void) conf;
+    (void) strings;
+    (void) num_strings;
+    CHECK(control_buffer_size >= DFU_XFER_SIZE);
+    sim_usbd.ctrl_buf = control_buffer;
+    return (&sim_usbd);
+}
+
+int
+usbd_register_set_config_callback(usbd_device *usbd_dev,
+                                  usbd_set_config_callback callback)
+{
+    usbd_dev->set_config = callback;
+    return (0);
+}
+
+int
+usbd_register_control_callback(usbd_device *usbd_dev, uint8_t type,
+                               uint8_t type_mask,
+                               usbd_control_callback callback)
+{
+    (void) type;
+    (void) type_mask;
+    usbd_dev->control = callback;
+    return (0);
+}
+
+/*
+ * usbd_poll() takes the OUT data packets which reached the receive FIFO
+ * since the last poll, and hands a request to the class callback once
+ * all of its data is in. The status stage, and so the completion
+ * callback, follows at the next poll.
+ */
+void
+usbd_poll(usbd_device *usbd_dev)
+{
+    double   start = sim_usec;
+    uint8_t *buf;
+    uint16_t len;
+    uint     count;
+
+    if (booting) {
+        booting = 0;
+        longjmp(boot_jmp, 1);
+    }
+    switch (pipe.state) {
+        case PIPE_DATA:
+            if (pipe.next_pkt > sim_usec)
+                return;
+            count = (sim_usec - pipe.next_pkt) / PKT_USEC + 1;
+            if (count >= FIFO_PKTS) {
+                /* Host was NAKed while the FIFO was full */
+                count = FIFO_PKTS;
+                pipe.next_pkt = sim_usec + PKT_USEC;
+            } else {
+                pipe.next_pkt += count * PKT_USEC;
+            }
+            if (count > pipe.pkts - pipe.rx)
+                count = pipe.pkts - pipe.rx;
+            pipe.rx += count;
+            if (pipe.rx < pipe.pkts)
+                return;
+
+            buf = usbd_dev->ctrl_buf;
+            len = pipe.req.wLength;
+            if (pipe.data != NULL)
+                memcpy(buf, pipe.data, len);
+            pipe.complete = NULL;
+            if (usbd_dev->control(usbd_dev, &pipe.req, &buf, &len,
+                                  &pipe.complete) != USBD_REQ_HANDLED) {
+                pipe.rc = -1;
+                pipe.state = PIPE_DONE;
+                break;
+            }
+            if (pipe.in != NULL)
+                memcpy(pipe.in, buf, len);
+            pipe.state = PIPE_STATUS;
+            break;
+        case PIPE_STATUS:
+            if (pipe.complete != NULL)
+                pipe.complete(usbd_dev, &pipe.req);
+            pipe.state = PIPE_DONE;
+            break;
+        default:
+            return;
+    }
+    if (req_max_usec < sim_usec - start)
+        req_max_usec = sim_usec - start;
+    if (pipe.state == PIPE_DONE)
+        pipe.done = sim_usec + HOST_USEC;
+}
+
+/* sim_pass() runs one pass of the programmer's main loop */
+static void
+sim_pass(void)
+{
+    usbd_poll(&sim_usbd);
+    usbdfu_job_run();
+    sim_usec += LOOP_USEC;
+}
+
+/* sim_wait() runs the main loop for a time, skipping it while idle */
+static void
+sim_wait(double usec)
+{
+    double end = sim_usec + usec;
+
+    while (sim_usec < end) {
+        if (((pipe.state == PIPE_IDLE) || (pipe.state == PIPE_DONE)) &&
+            (dfu_job_count == 0) &&
+            (manifest_ready || ((usbdfu_state != STATE_DFU_MANIFEST_SYNC) &&
+                                (usbdfu_state != STATE_DFU_MANIFEST)))) {
+            sim_usec = end;
+            break;
+        }
+        sim_pass();
+    }
+}
+
+/*
+ * sim_boot() starts the programmer as after a reset: static state is
+ * set as it is loaded, main() runs up to its loop, and the host selects
+ * the configuration.
+ */
+static void
+sim_boot(void)
+{
+    usbdfu_state   = STATE_DFU_IDLE;
+    usbdfu_status  = DFU_STATUS_OK;
+    dfu_job_head   = 0;
+    dfu_job_count  = 0;
+    prog_addr      = 0;
+    manifest_ready = 0;
+    memset(&verify, 0, sizeof (verify));
+    memset(&pipe, 0, sizeof (pipe));
+    ocm3_regs[0] = USART_SR_TXE | USART_SR_TC;
+
+    booting = 1;
+    if (setjmp(boot_jmp) == 0)
+        usbdfu_main();
+    sim_usbd.set_config(&sim_usbd, 1);
+}
+
+/*
+ * host_xfer() sends a DFU class request and waits until the host sees
+ * it complete. Returns -1 if the device stalled it.
+ */
+static int
+host_xfer(uint8_t request, uint16_t value, const void *data, uint16_t len,
+          uint8_t *in)
+{
+    memset(&pipe, 0, sizeof (pipe));
+    pipe.req.bmRequestType = (in != NULL) ? 0xa1 : 0x21;
+    pipe.req.bRequest      = request;
+    pipe.req.wValue        = value;
+    pipe.req.wLength       = len;
+    pipe.data     = data;
+    pipe.in       = in;
+    pipe.pkts     = (in != NULL) ? 0 : (len + 63) / 64;
+    pipe.next_pkt = sim_usec + ((pipe.pkts != 0) ? PKT_USEC : 0);
+    pipe.state    = PIPE_DATA;
+
+    while (pipe.state != PIPE_DONE)
+        sim_pass();
+    sim_wait(pipe.done - sim_usec);
+    pipe.state = PIPE_IDLE;
+    return (pipe.rc);
+}
+
+/*
+ * host_status() reads status until the device is no longer busy, waiting
+ * for bwPollTimeout after each read. Returns the DFU status.
+ */
+static int
+host_status(uint8_t *state)
+{
+    uint8_t st[6];
+
+    do {
+        if (host_xfer(DFU_GETSTATUS, 0, NULL, sizeof (st), st) != 0)
+            return (-1);
+        sim_wait((st[1] | (st[2] << 8) | (st[3] << 16)) * 1000.0);
+    } while ((st[4] == STATE_DFU_DNBUSY) || (st[4] == STATE_DFU_MANIFEST));
+    *state = st[4];
+    return (st[0]);
+}
+
+/*
+ * host_dnload() sends a download request and then reads status, which
+ * also tells why the request was stalled, if it was.
+ */
+static int
+host_dnload(uint16_t block, const void *data, uint16_t len, uint8_t *state)
+{
+    (void) host_xfer(DFU_DNLOAD, block, data, len, NULL);
+    return (host_status(state));
+}
+
+/* host_command() sends a DfuSe command with an address */
+static int
+host_command(uint8_t cmd, uint32_t addr, uint8_t *state)
+{
+    uint8_t buf[5];
+
+    buf[0] = cmd;
+    memcpy(buf + 1, &addr, sizeof (addr));
+    return (host_dnload(0, buf, sizeof (buf), state));
+}
+
+/*
+ * host_update() downloads an image as dfu-util does to a DfuSe device.
+ * The pages each transfer covers are erased unless they already were,
+ * the address is set, and the data is sent as block 2. A zero-length
+ * download then manifests the image. If stop is non-zero, the host
+ * gives up before sending the transfer at that offset.
+ *
+ * Returns the DFU status of the last request.
+ */
+static int
+host_update(const uint8_t *image, uint len, uint stop)
+{
+    uint8_t erased[FLASH_SIZE / PAGE_SIZE];
+    uint8_t state = 0;
+    uint    page;
+    uint    pos;
+    uint    chunk;
+    int     rc;
+
+    memset(erased, 0, sizeof (erased));
+    for (pos = 0; pos < len; pos += chunk) {
+        if ((stop != 0) && (pos >= stop))
+            return (DFU_STATUS_OK);
+        chunk = len - pos;
+        if (chunk > DFU_XFER_SIZE)
+            chunk = DFU_XFER_SIZE;
+        for (page = pos / PAGE_SIZE; page * PAGE_SIZE < pos + chunk; page++) {
+            if (erased[page])
+                continue;
+            erased[page] = 1;
+            rc = host_command(CMD_ERASE, FLASH_BASE + page * PAGE_SIZE,
+                              &state);
+            if (rc != DFU_STATUS_OK)
+                return (rc);
+        }
+        rc = host_command(CMD_SETADDR, FLASH_BASE + pos, &state);
+        if (rc != DFU_STATUS_OK)
+            return (rc);
+        rc = host_dnload(2, image + pos, chunk, &state);
+        if (rc != DFU_STATUS_OK)
+            return (rc);
+        CHECK(state == STATE_DFU_DNLOAD_IDLE);
+    }
+    rc = host_dnload(0, NULL, 0, &state);
+    if (rc == DFU_STATUS_OK)
+        CHECK(state == STATE_DFU_MANIFEST_WAIT_RESET);
+    return (rc);
+}
+
+/*
+ * old_usec() is the time the previous programmer took for an image.
+ * Each erase, set address, and 2048-byte data request was answered
+ * with dfuDNBUSY and a 100 ms bwPollTimeout, and its flash work, which
+ * is shorter than that, done while the host waited. Manifest was then
+ * one more download and status read.
+ */
+static double
+old_usec(uint len)
+{
+    uint   chunks = (len + OLD_XFER_SIZE - 1) / OLD_XFER_SIZE;
+    double req    = 3 * HOST_USEC + OLD_POLL_USEC;  // DNLOAD, 2 GETSTATUS
+
+    return (chunks * (3 * req + OLD_XFER_SIZE / 64 * PKT_USEC) +
+            2 * HOST_USEC);
+}
+
+static void
+image_make(uint8_t *image, uint len)
+{
+    uint pos;
+
+    for (pos = 0; pos < len; pos++)
+        image[pos] = rand32();
+}
+
+/*
+ * sim_update() writes an image over the previous firmware. If stop is
+ * non-zero, the download is interrupted there, by DFU_ABORT or by the
+ * device resetting, and then started over. Reports the total time.
+ */
+static void
+sim_update(const char *name, const uint8_t *image, uint len, uint stop,
+           uint how)
+{
+    double  start;
+    double  old;
+    uint8_t state = 0;
+    int     rc;
+
+    image_make(flash, FLASH_SIZE);
+    sim_boot();
+    resets = 0;
+    flash_usec = 0;
+    start = sim_usec;
+    old = old_usec(len);
+
+    if (stop != 0) {
+        CHECK(host_update(image, len, stop) == DFU_STATUS_OK);
+        if (how == STOP_ABORT) {
+            /* Requests already acknowledged must still be carried out */
+            CHECK(dfu_job_count != 0);
+            CHECK(host_xfer(DFU_ABORT, 0, NULL, 0, NULL) == 0);
+            CHECK(host_status(&state) == DFU_STATUS_OK);
+            CHECK(state == STATE_DFU_IDLE);
+            sim_wait(1000000);
+            CHECK(memcmp(flash, image, stop) == 0);
+            old += old_usec(stop) + 2 * HOST_USEC;
+        } else {
+            /* Reset part way through programming a transfer */
+            while (dfu_job_count != 0) {
+                if ((dfu_job[dfu_job_head].type == JOB_PROGRAM) &&
+                    (dfu_job[dfu_job_head].pos >= DFU_XFER_SIZE / 2))
+                    break;
+                sim_pass();
+            }
+            sim_usec += RESET_USEC;
+            sim_boot();
+            old += old_usec(stop) + RESET_USEC;
+        }
+    }
+    rc = host_update(image, len, 0);
+    CHECK(rc == DFU_STATUS_OK);
+    CHECK(resets == 1);
+    CHECK(memcmp(flash, image, len) == 0);
+    if (stop == 0)
+        CHECK(sim_usec - start < old / 3);
+    printf("    %-24s %8.2f %9.2f %9.2f %8.1f\n", name,
+           (sim_usec - start) / 1e6, flash_usec / 1e6, old / 1e6,
+           len / 1024 / ((sim_usec - start) / 1e6));
+}
+
+/*
+ * sim_bad_flash() writes an image to flash with a bit stuck at zero.
+ * The programmer must report a verify error, not reset into the image,
+ * and return to dfuIDLE when the host clears the error.
+ */
+static void
+sim_bad_flash(const char *name, const uint8_t *image, uint len, uint at)
+{
+    double  start;
+    uint8_t state = 0;
+    int     rc;
+
+    image_make(flash, FLASH_SIZE);
+    sim_boot();
+    resets = 0;
+    start = sim_usec;
+    stuck_addr = FLASH_BASE + at;
+    stuck_mask = image[at] | (image[at + 1] << 8);
+    stuck_mask &= -stuck_mask;  // Lowest bit which the image sets
+    rc = host_update(image, len, 0);
+    CHECK(rc == DFU_STATUS_ERR_VERIFY);
+    CHECK(resets == 0);
+    CHECK(host_xfer(DFU_CLRSTATUS, 0, NULL, 0, NULL) == 0);
+    CHECK(host_status(&state) == DFU_STATUS_OK);
+    CHECK(state == STATE_DFU_IDLE);
+    printf("    %-24s verify error after %.2f s, no reset\n", name,
+           (sim_usec - start) / 1e6);
+    stuck_addr = 0;
+}
+
+int
+main(void)
+{
+    static uint8_t image[200 << 10];
+
+    flash = mmap((void *) FLASH_BASE, FLASH_SIZE, PROT_READ | PROT_WRITE,
+                 MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED_NOREPLACE, -1, 0);
+    if (flash != (void *) FLASH_BASE) {
+        printf("dfu: could not map flash at %lx\n",
+               (unsigned long) FLASH_BASE);
+        return (1);
+    }
+    image_make(image, sizeof (image));
+
+    printf("dfu:\n");
+    printf("    update                   time (s) flash (s)   old (s)"
+           "     KB/s\n");
+    sim_update("64 KB", image, 64 << 10, 0, 0);
+    sim_update("200 KB", image, sizeof (image), 0, 0);
+    sim_update("200 KB, abort at 100 KB", image, sizeof (image), 100 << 10,
+               STOP_ABORT);
+    sim_update("200 KB, reset at 100 KB", image, sizeof (image), 100 << 10,
+               STOP_RESET);
+    sim_bad_flash("200 KB, stuck bit", image, sizeof (image), 100 << 10);
+    CHECK(req_max_usec < 1000);
+    printf("    (%u-byte transfers; longest request %.0f us; old used "
+           "%u-byte transfers)\n", DFU_XFER_SIZE, req_max_usec,
+           OLD_XFER_SIZE);
+    return (test_result("dfu"));
+}
@@ -0,0 +1,319 @@
+/*
+ * This is free and unencumbered software released into the public domain.
+ * See the LICENSE file for additional details.
+ *
+ * Designed by Chris Hooper in 2025.
+ *
+ * ---------------------------------------------------------------------
+ *
+ * Host simulation of the fan control loop (fw/fan.c) against a fan
+ * plant model. The plant turns PWM percent into a steady state RPM which
+ * depends on fan aging and supply voltage, reaches it with a first order
+ * lag, needs more drive to start than to keep turning, and generates
+ * tach pulses which are fed through tim4_isr() as TIM4 captures. The
+ * previous open-loop drive (no fan_rpm_max) is compared with the RPM
+ * loop for steady state error, step response, and stall recovery.
+ */
+
+#include "../fw/fan.c"
+#include <math.h>
+#include "test.h"
+
+#define SIM_STEP_USEC   100
+#define APB1_HZ         30000000
+#define TACH_HZ         (APB1_HZ * 2 / TACH_DIV)  // TIM4 capture clock
+
+#define RPM_MAX         3000   // fan_rpm_max, as configured
+#define PLANT_TAU_MS    1500   // Rotor spin-up time constant
+#define PLANT_RUN_PCT   10     // PWM below which a turning fan stops
+#define PLANT_START_PCT 35     // PWM needed to start a stopped fan
+
+config_t config;
+uint8_t  power_state = POWER_STATE_ON;
+volatile uint32_t ocm3_regs[256];
+
+static uint64_t now_usec;     // Simulated time; timer ticks are usec
+static uint     pwm_out;      // PWM percent driven by fan.c
+static double   plant_gain;   // Aging and supply voltage (1.0 = nominal)
+static double   plant_rpm;
+static double   plant_phase;  // Tach pulses, fractional
+static int      plant_seized; // Rotor held stopped
+
+void
+fw_dprintf(uint32_t mask, const char *fmt, ...)
+{
+    (void) mask;
+    (void) fmt;
+}
+
+uint32_t
+clock_get_apb1(void)
+{
+    return (APB1_HZ);
+}
+
+uint
+sensor_get(const char *name, uint *value, const char **type)
+{
+    (void) name;
+    (void) value;
+    (void) type;
+    return (1);
+}
+
+uint64_t
+timer_tick_get(void)
+{
+    return (now_usec);
+}
+
+uint64_t
+timer_tick_to_usec(uint64_t value)
+{
+    return (value);
+}
+
+uint64_t
+timer_tick_plus_msec(uint msec)
+{
+    return (now_usec + msec * 1000ULL);
+}
+
+bool
+timer_tick_has_elapsed(uint64_t value)
+{
+    return (now_usec >= value);
+}
+
+void
+timer_set_oc_value(uint32_t timer, int oc, uint32_t value)
+{
+    if ((timer == TIM10) && (oc == TIM_OC1)) {
+        pwm_out = 100 - value;
+    }
+}
+
+/*
+ * plant_step() advances the fan by one simulation step, generating a
+ * TIM4 capture for each tach pulse at its exact time within the step.
+ */
+static void
+plant_step(void)
+{
+    double target = 0;
+    double pulses;
+
+    if (plant_seized) {
+        plant_rpm = 0;
+    } else {
+        if ((pwm_out >= PLANT_START_PCT) ||
+            ((plant_rpm > 100) && (pwm_out >= PLANT_RUN_PCT))) {
+            target = plant_gain * RPM_MAX * (pwm_out - PLANT_RUN_PCT) /
+                     (100 - PLANT_RUN_PCT);
+        }
+        plant_rpm += (target - plant_rpm) * SIM_STEP_USEC /
+                     (PLANT_TAU_MS * 1000.0);
+    }
+
+    pulses = plant_rpm * FAN_PULSES_PER_REVOLUTION * SIM_STEP_USEC / 60e6;
+    plant_phase += pulses;
+    now_usec += SIM_STEP_USEC;
+    while (plant_phase >= 1.0) {
+        double   back = (plant_phase - 1.0) / pulses * SIM_STEP_USEC;
+        uint64_t when = now_usec - (uint64_t) back;
+        uint64_t save = now_usec;
+
+        plant_phase -= 1.0;
+        TIM_CCR4(TIM4) = (uint16_t) (when * TACH_HZ / 1000000);
+        now_usec = when;
+        tim4_isr();
+        now_usec = save;
+    }
+}
+
+/*
+ * run() simulates msec of time, polling fan.c every millisecond as the
+ * main loop would. Returns the average RPM over the last quarter.
+ */
+static double
+run(uint msec)
+{
+    double sum = 0;
+    uint   count = 0;
+    uint   step;
+    uint   steps = msec * 1000 / SIM_STEP_USEC;
+
+    for (step = 0; step < steps; step++) {
+        if ((step % (1000 / SIM_STEP_USEC)) == 0)
+            fan_poll();
+        plant_step();
+        if (step >= steps * 3 / 4) {
+            sum += plant_rpm;
+            count++;
+        }
+    }
+    return (sum / count);
+}
+
+static void
+sim_reset(uint closed_loop, double gain, uint percent)
+{
+    memset(&config, 0, sizeof (config));
+    config.board_type    = BOARD_TYPE_AMIGAPCI;
+    config.flags         = CF_HAVE_FAN;
+    config.fan_speed     = percent;
+    config.fan_speed_min = 20;
+    config.fan_rpm_max   = closed_loop ? RPM_MAX : 0;
+
+    now_usec = 1000000;
+    plant_gain = gain;
+    plant_rpm = 0;
+    plant_phase = 0;
+    plant_seized = 0;
+    pwm_out = 0;
+    fan_pwm_percent = 0;
+    fan_ctrl_integral = 0;
+    fan_ctrl_next = 0;
+    fan_stall_time = 0;
+    fan_kick_end = 0;
+    last_update = 0;
+    memset((void *) tach_buckets, 0, sizeof (tach_buckets));
+    fan_init();
+    fan_percent_last = 0;
+}
+
+/* Steady state error at 60% for fans which run slow, nominal, and fast */
+static void
+test_steady(void)
+{
+    static const double gains[] = { 0.80, 1.00, 1.15 };
+    const double        target = RPM_MAX * 60 / 100;
+    uint                cur;
+
+    printf("  steady state at 60%% (target %.0f RPM):\n", target);
+    for (cur = 0; cur < ARRAY_SIZE(gains); cur++) {
+        double old_rpm;
+        double new_rpm;
+        double old_err;
+        double new_err;
+
+        sim_reset(0, gains[cur], 60);
+        old_rpm = run(20000);
+        sim_reset(1, gains[cur], 60);
+        new_rpm = run(20000);
+        old_err = 100 * (old_rpm - target) / target;
+        new_err = 100 * (new_rpm - target) / target;
+        printf("    fan gain %.2f: open loop %4.0f RPM (%+5.1f%%), "
+               "closed loop %4.0f RPM (%+5.1f%%)\n",
+               gains[cur], old_rpm, old_err, new_rpm, new_err);
+        CHECK(fabs(new_err) < 2.0);
+        CHECK(fabs(new_err) < fabs(old_err));
+    }
+}
+
+/* Step from 40% to 80%: time to settle within 3%, and overshoot */
+static void
+test_step(void)
+{
+    const double target = RPM_MAX * 80 / 100;
+    uint         loop;
+
+    for (loop = 0; loop < 2; loop++) {
+        double peak = 0;
+        uint   settled = 0;
+        uint   msec;
+
+        sim_reset(loop, 0.9, 40);
+        run(15000);
+        fan_percent = 80;
+        for (msec = 0; msec < 15000; msec++) {
+            run(1);
+            if (plant_rpm > peak)
+                peak = plant_rpm;
+            if (fabs(plant_rpm - target) > target * 0.03)
+                settled = msec + 1;
+        }
+        printf("  step 40%%->80%% %s: settles in %5u ms, overshoot %.1f%%%s\n",
+               loop ? "closed loop" : "open loop  ", settled,
+               (peak > target) ? 100 * (peak - target) / target : 0.0,
+               (settled >= 15000) ? " (never within 3%)" : "");
+        if (loop) {
+            CHECK(settled < 6000);
+            CHECK(peak < target * 1.10);
+        }
+    }
+}
+
+/*
+ * The fan is started, then turned down to a low speed setting. The rotor
+ * is held for three seconds, then released. At 30% the open loop drive
+ * keeps a turning fan running, but is too weak to restart it.
+ */
+static void
+test_stall(void)
+{
+    uint loop;
+
+    for (loop = 0; loop < 2; loop++) {
+        uint kicked = 0;
+        uint recovered = 0;
+        uint msec;
+
+        sim_reset(loop, 1.0, 60);
+        run(5000);
+        fan_percent = 30;
+        run(10000);
+        CHECK(plant_rpm > 500);
+        plant_seized = 1;
+        for (msec = 0; msec < 3000; msec++) {
+            run(1);
+            if (pwm_out == 100)
+                kicked = 1;
+        }
+        plant_seized = 0;
+        for (msec = 0; msec < 10000; msec++) {
+            run(1);
+            if (pwm_out == 100)
+                kicked = 1;
+            if ((recovered == 0) && (plant_rpm > RPM_MAX * 30 / 100 * 0.9))
+                recovered = msec + 1;
+        }
+        if (recovered == 0)
+            printf("  stall %s: fan stays stopped\n",
+                   loop ? "closed loop" : "open loop  ");
+        else
+            printf("  stall %s: %s, running %u ms after release\n",
+                   loop ? "closed loop" : "open loop  ",
+                   kicked ? "kicked" : "not kicked", recovered);
+        if (loop) {
+            CHECK(kicked);
+            CHECK(recovered != 0);
+            CHECK(recovered < 5000);
+        } else {
+            CHECK(recovered == 0);
+        }
+    }
+}
+
+/* Without fan_rpm_max, the PWM output follows the percent exactly */
+static void
+test_open_loop(void)
+{
+    sim_reset(0, 1.0, 45);
+    run(3000);
+    CHECK(pwm_out == 45);
+    fan_percent = 70;
+    run(1000);
+    CHECK(pwm_out == 70);
+}
+
+int
+main(void)
+{
+    printf("fan:\n");
+    test_open_loop();
+    test_steady();
+    test_step();
+    test_stall();
+    return (test_result("fan"));
+}
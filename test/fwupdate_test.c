@@ -0,0 +1,795 @@
+/*
+ * This is free and unencumbered software released into the public domain.
+ * See the LICENSE file for additional details.
+ *
+ * Designed by Chris Hooper in 2025.
+ *
+ * ---------------------------------------------------------------------
+ *
+ * Host simulation of dual-slot firmware update (fw/fwupdate.c and
+ * fw/fwslot.c, writing through fw/stm32flash.c). Flash is a NOR model
+ * mapped at FLASH_BASE with STM32F205 erase and program times, and the
+ * RTC backup registers survive resets and power loss. BEC is powered
+ * up through the slot choice of the boot loader (boot.c) and driven
+ * with BEC_CMD_FW_UPDATE requests as "bec update" sends them.
+ *
+ * Power is cut at random flash operations throughout an update, the
+ * restart into the new image, and its confirmation, tearing the erase
+ * or write in progress. After every cut, BEC must boot an intact image
+ * and a repeated update must succeed. A trial image which hangs must be
+ * rolled back. Update time and throughput are reported.
+ */
+
+#include <setjmp.h>
+#include <stdlib.h>
+#include <sys/mman.h>
+
+static int
+fw_printf(const char *fmt, ...)
+{
+    (void) fmt;
+    return (0);
+}
+
+#define printf fw_printf
+#include "../fw/crc32.c"
+#include "../fw/stm32flash.c"
+#include "../fw/fwslot.c"
+#include "../fw/fwupdate.c"
+#undef printf
+
+#include "test.h"
+
+#define ERASE16K_USEC  250000     // STM32F205 sector erase, x32
+#define ERASE128K_USEC 1000000
+#define PROGRAM_USEC   16         // Word program
+#define BYTE_USEC      3.8        // Mailbox byte, two RP5C01 accesses
+#define EXCHANGE_USEC  300        // BEC turnaround and reply polling
+#define MSG_OVERHEAD   (BEC_MSG_HDR_LEN + BEC_MSG_CRC_LEN)
+#define POLL_MSEC      5          // BEC main loop pass, as simulated
+#define IMAGE_SIZE     (100 << 10)
+#define IMAGE_SP       0x20020000
+#define IMAGE_MAGIC    0x494d4147  // "IMAG"
+#define POWER_IMAGE    (16 << 10)
+#define POWER_TRIALS   400
+#define POWER_TAIL     24         // Operations from commit to confirmed
+
+/* Simulation results of a BEC session; see sim_session() */
+#define SIM_DONE       0
+#define SIM_POWER_CUT  1
+#define SIM_RESET      2
+
+volatile uint32_t ocm3_regs[256];
+volatile uint32_t ocm3_rtc_regs[32];
+uintptr_t         ocm3_vector_base;
+
+static uint8_t  *flash;           // Mapped at FLASH_BASE
+static uint64_t  sim_usec;        // Simulated time since power up
+static uint      flash_ops;       // Erase and program operations so far
+static uint      cut_at;          // Power fails at this operation
+static uint      cut_erase;       // Power fails in this many more erases
+static jmp_buf   power_jmp;
+static uint      running;         // Slot running, or FWSLOT_NONE
+static uint      watchdog;        // Boot loader started the watchdog
+static uint      dfu_boots;       // Boots with no valid image
+static uint      bad_boots;       // Boots of an incomplete image
+static uint      lost_state;      // Boots which found no boot state
+static uint      have_state;      // Boot state has been written
+static uint      fw_block = 1024; // "bec update" FW_BLOCK_SIZE
+static uint32_t  rand_state = 1;
+
+/* Image sent by amiga_update() */
+static uint8_t   image[FWSLOT_SLOT_SIZE];
+static uint      image_len;
+static uint      image_version;
+static uint      image_hangs;
+static uint      update_rc;
+
+/* Update phase times of the last amiga_update() */
+static uint64_t  t_erase;
+static uint64_t  t_data;
+static uint64_t  t_total;
+
+void
+fw_dprintf(uint32_t mask, const char *fmt, ...)
+{
+    (void) mask;
+    (void) fmt;
+}
+
+uint64_t
+timer_tick_get(void)
+{
+    return (sim_usec);
+}
+
+uint64_t
+timer_tick_plus_msec(uint msec)
+{
+    return (sim_usec + msec * 1000ULL);
+}
+
+bool
+timer_tick_has_elapsed(uint64_t value)
+{
+    return (sim_usec >= value);
+}
+
+static uint
+rand_next(uint range)
+{
+    rand_state = rand_state * 1103515245 + 12345;
+    return ((rand_state >> 8) % range);
+}
+
+/* power_cut() abandons whatever BEC was doing, as a power failure does */
+static void __attribute__((noreturn))
+power_cut(void)
+{
+    cut_at    = 0;
+    cut_erase = 0;
+    longjmp(power_jmp, SIM_POWER_CUT);
+}
+
+void
+reset_cpu(void)
+{
+    longjmp(power_jmp, SIM_RESET);
+}
+
+/* flash_op() counts a flash operation, returning 1 if power fails in it */
+static uint
+flash_op(void)
+{
+    flash_ops++;
+    return ((cut_at != 0) && (flash_ops >= cut_at));
+}
+
+static uint32_t
+sector_base(uint sector)
+{
+    if (sector < 4)
+        return (sector * 0x4000);
+    return ((sector - 4) * 0x20000 + ((sector == 4) ? 0x10000 : 0));
+}
+
+/*
+ * flash_erase_sector() sets a sector to all ones. An erase cut short
+ * leaves each byte erased, as it was, or indeterminate.
+ */
+void
+flash_erase_sector(uint8_t sector, uint32_t program_size)
+{
+    uint32_t base = sector_base(sector >> 3);
+    uint32_t size = flash_sector_size(sector >> 3);
+    uint     cur;
+
+    (void) program_size;
+    if (flash_op() || ((cut_erase != 0) && (--cut_erase == 0))) {
+        for (cur = 0; cur < size; cur++) {
+            switch (rand_next(4)) {
+                case 0:
+                    flash[base + cur] = 0xff;
+                    break;
+                case 1:
+                    flash[base + cur] = rand_next(256);
+                    break;
+            }
+        }
+        power_cut();
+    }
+    memset(flash + base, 0xff, size);
+    sim_usec += (size == 0x4000) ? ERASE16K_USEC : ERASE128K_USEC;
+}
+
+/*
+ * flash_program() clears the bits of flash which are clear in data.
+ * A program cut short clears only some of them.
+ */
+static void
+flash_program(uint32_t address, uint32_t data, uint len)
+{
+    uint32_t off = address - FLASH_BASE;
+    uint     cur;
+
+    if (flash_op()) {
+        for (cur = 0; cur < len; cur++)
+            flash[off + cur] &= (data >> (cur * 8)) | rand_next(256);
+        power_cut();
+    }
+    for (cur = 0; cur < len; cur++)
+        flash[off + cur] &= data >> (cur * 8);
+    sim_usec += PROGRAM_USEC;
+}
+
+void
+flash_program_word(uint32_t address, uint32_t data)
+{
+    flash_program(address, data, 4);
+}
+
+void
+flash_program_half_word(uint32_t address, uint16_t data)
+{
+    flash_program(address, data, 2);
+}
+
+void
+flash_program_byte(uint32_t address, uint8_t data)
+{
+    flash_program(address, data, 1);
+}
+
+/*
+ * image_make() builds an image linked for a slot. The header after the
+ * vectors holds the version, whether the image hangs at startup, and
+ * the length and CRC of the whole image, so that a boot can tell
+ * whether it started a complete image.
+ */
+static void
+image_make(uint8_t *buf, uint slot, uint len, uint version, uint hangs)
+{
+    uint32_t hdr[7];
+    uint     cur;
+
+    for (cur = 0; cur < len; cur++)
+        buf[cur] = rand_next(256);
+    hdr[0] = IMAGE_SP;
+    hdr[1] = FLASH_BASE + FWSLOT_ADDR(slot) + 0x1c1;
+    hdr[2] = IMAGE_MAGIC;
+    hdr[3] = version;
+    hdr[4] = hangs;
+    hdr[5] = len;
+    hdr[6] = 0;
+    memcpy(buf, hdr, sizeof (hdr));
+    hdr[6] = crc32(0, buf, len);
+    memcpy(buf + 6 * 4, &hdr[6], 4);
+}
+
+/* image_intact() returns the version of a complete image in slot, or 0 */
+static uint
+image_intact(uint slot)
+{
+    uint8_t *base = flash + FWSLOT_ADDR(slot);
+    uint32_t hdr[7];
+    uint32_t crc;
+
+    memcpy(hdr, base, sizeof (hdr));
+    if ((hdr[2] != IMAGE_MAGIC) || (hdr[5] > FWSLOT_SLOT_SIZE))
+        return (0);
+    memset(base + 6 * 4, 0, 4);
+    crc = crc32(0, base, hdr[5]);
+    memcpy(base + 6 * 4, &hdr[6], 4);
+    return ((crc == hdr[6]) ? hdr[3] : 0);
+}
+
+/* boot_trial_count() counts a trial boot attempt, as boot.c does */
+static uint
+boot_trial_count(void)
+{
+    uint32_t val = RTC_BKPXR(FWSLOT_BKP_TRIES);
+
+    if ((val & 0xffff0000) != FWSLOT_BKP_MAGIC)
+        val = FWSLOT_BKP_MAGIC;
+    if ((val & FWSLOT_BKP_COUNT) >= FWSLOT_TRIAL_BOOTS) {
+        RTC_BKPXR(FWSLOT_BKP_TRIES) = val | FWSLOT_BKP_ROLLBACK;
+        return (1);
+    }
+    RTC_BKPXR(FWSLOT_BKP_TRIES) = val + 1;
+    return (0);
+}
+
+/*
+ * sim_boot() chooses the slot to start as the boot loader main() does,
+ * and starts the firmware in it up to fwupdate_init().
+ */
+static void
+sim_boot(void)
+{
+    const fwslot_state_t *state;
+    uint copy;
+    uint next;
+    uint slot = 0;
+
+    running  = FWSLOT_NONE;
+    watchdog = 0;
+    state = fwslot_state_find(&copy, &next);
+    if ((state == NULL) && have_state)
+        lost_state++;
+    if (state != NULL) {
+        slot = state->fbs_active;
+        if (state->fbs_state == FBS_STATE_TRIAL) {
+            if (boot_trial_count())
+                slot ^= 1;
+            else
+                watchdog = 1;
+        }
+    }
+    if (!fwslot_image_valid(slot, state)) {
+        slot ^= 1;
+        if (!fwslot_image_valid(slot, state)) {
+            dfu_boots++;
+            return;
+        }
+    }
+    if (image_intact(slot) == 0)
+        bad_boots++;
+
+    /* Firmware static state starts over */
+    fwupdate_running = FWSLOT_NONE;
+    fwupdate_phase   = BFU_PHASE_IDLE;
+    fwupdate_reboot  = 0;
+    fwupdate_timer   = 0;
+    fwupdate_got     = 0;
+    ocm3_vector_base = FLASH_BASE + FWSLOT_ADDR(slot);
+    running = slot;
+
+    if (ADDR32(flash + FWSLOT_ADDR(slot))[4] != 0) {
+        /* Image hangs; only the trial watchdog restarts BEC */
+        if (watchdog) {
+            sim_usec += FWSLOT_TRIAL_WDOG * 1000ULL;
+            longjmp(power_jmp, SIM_RESET);
+        }
+        return;
+    }
+    fwupdate_init();
+}
+
+/* sim_poll() is one pass of the BEC main loop */
+static void
+sim_poll(void)
+{
+    if (running != FWSLOT_NONE)
+        fwupdate_poll();
+}
+
+static void
+sim_run(uint msec)
+{
+    uint64_t end = sim_usec + msec * 1000ULL;
+
+    while (sim_usec < end) {
+        sim_usec += POLL_MSEC * 1000;
+        sim_poll();
+    }
+}
+
+/*
+ * sim_session() runs func on BEC until it returns, power fails, or BEC
+ * restarts. Returns SIM_DONE, SIM_POWER_CUT, or SIM_RESET.
+ */
+static int
+sim_session(void (*func)(void))
+{
+    int rc = setjmp(power_jmp);
+
+    if (rc == 0)
+        func();
+    return (rc);
+}
+
+static void
+boot_and_settle(void)
+{
+    sim_boot();
+    sim_run(FWUPDATE_CONFIRM_MSEC + 2000);
+}
+
+/*
+ * power_on() starts BEC and runs it until a trial image would have been
+ * confirmed, restarting it each time it resets or loses power. Returns
+ * the slot BEC ends up running.
+ */
+static uint
+power_on(void)
+{
+    uint boots;
+
+    for (boots = 0; boots < 2 * FWSLOT_TRIAL_BOOTS + 4; boots++)
+        if (sim_session(boot_and_settle) == SIM_DONE)
+            return (running);
+    return (FWSLOT_NONE);
+}
+
+/*
+ * bec_request() handles one BEC_CMD_FW_UPDATE request as msg_fw_update()
+ * does, then runs a pass of the main loop. The mailbox transfer of
+ * request and reply is added to the simulated time.
+ */
+static uint
+bec_request(bec_fw_update_t *req, const void *data, uint len,
+            bec_fw_update_t *reply)
+{
+    uint rc;
+
+    sim_usec += (MSG_OVERHEAD + sizeof (*req) + len + MSG_OVERHEAD +
+                 sizeof (*reply)) * BYTE_USEC + EXCHANGE_USEC;
+    switch (req->bfu_op) {
+        case BFU_OP_STATUS:
+            rc = BEC_STATUS_OK;
+            break;
+        case BFU_OP_START:
+            rc = fwupdate_start(req->bfu_offset, req->bfu_crc);
+            break;
+        case BFU_OP_DATA:
+            rc = fwupdate_data(req->bfu_offset, data, len, req->bfu_crc);
+            break;
+        case BFU_OP_COMMIT:
+            rc = fwupdate_commit(req->bfu_flags & BFU_FLAG_REBOOT);
+            break;
+        case BFU_OP_CONFIRM:
+            rc = (fwupdate_confirm() == RC_SUCCESS) ? BEC_STATUS_OK :
+                                                       BEC_STATUS_FAIL;
+            break;
+        default:
+            rc = BEC_STATUS_BADARG;
+            break;
+    }
+    memset(reply, 0, sizeof (*reply));
+    reply->bfu_op = req->bfu_op;
+    fwupdate_status(reply);
+    sim_poll();
+    return (rc);
+}
+
+static uint
+request(uint op, uint32_t offset, uint32_t crc, bec_fw_update_t *reply)
+{
+    bec_fw_update_t req;
+
+    memset(&req, 0, sizeof (req));
+    req.bfu_op     = op;
+    req.bfu_flags  = (op == BFU_OP_COMMIT) ? BFU_FLAG_REBOOT : 0;
+    req.bfu_offset = offset;
+    req.bfu_crc    = crc;
+    return (bec_request(&req, NULL, 0, reply));
+}
+
+/*
+ * amiga_update() writes a new image to BEC as cmd_fwupdate() does, then
+ * lets BEC run until it restarts into the new image. The result is left
+ * in update_rc.
+ */
+static void
+amiga_update(void)
+{
+    bec_fw_update_t reply;
+    bec_fw_update_t req;
+    uint64_t        start = sim_usec;
+    uint            pos;
+    uint            tries;
+
+    update_rc = request(BFU_OP_STATUS, 0, 0, &reply);
+    if ((update_rc != 0) || (reply.bfu_running == BFU_SLOT_NONE)) {
+        update_rc = BEC_STATUS_FAIL;
+        return;
+    }
+    image_make(image, reply.bfu_slot, image_len, image_version, image_hangs);
+    update_rc = request(BFU_OP_START, image_len, crc32(0, image, image_len),
+                        &reply);
+    if (update_rc != 0)
+        return;
+    for (tries = 0; tries < 10; tries++)
+        if (request(BFU_OP_STATUS, 0, 0, &reply) == 0 &&
+            (reply.bfu_phase != BFU_PHASE_ERASE))
+            break;
+    if (reply.bfu_phase != BFU_PHASE_WRITE) {
+        update_rc = BEC_STATUS_FAIL;
+        return;
+    }
+    t_erase = sim_usec - start;
+
+    start = sim_usec;
+    memset(&req, 0, sizeof (req));
+    req.bfu_op = BFU_OP_DATA;
+    for (pos = 0; pos < image_len; pos += fw_block) {
+        uint chunk = image_len - pos;
+        if (chunk > fw_block)
+            chunk = fw_block;
+        req.bfu_offset = pos;
+        req.bfu_crc    = crc32(0, image + pos, chunk);
+        update_rc = bec_request(&req, image + pos, chunk, &reply);
+        if (update_rc != 0)
+            return;
+    }
+    t_data = sim_usec - start;
+
+    update_rc = request(BFU_OP_COMMIT, 0, 0, &reply);
+    if (update_rc != 0)
+        return;
+    t_total = t_erase + t_data;
+    sim_run(1000);  // BEC restarts from here
+}
+
+/*
+ * update() runs amiga_update() and then powers BEC on again after it
+ * restarts or loses power. Returns the slot BEC ends up running.
+ */
+static uint
+update(uint version, uint hangs)
+{
+    int rc;
+
+    image_version = version;
+    image_hangs   = hangs;
+    update_rc     = BEC_STATUS_FAIL;
+    rc = sim_session(amiga_update);
+    if ((rc == SIM_DONE) && (update_rc != 0))
+        return (running);  // Update refused; BEC runs on
+    return (power_on());
+}
+
+/* current_state() returns the current boot state record, or NULL */
+static const fwslot_state_t *
+current_state(void)
+{
+    uint copy;
+    uint next;
+    return (fwslot_state_find(&copy, &next));
+}
+
+/*
+ * device_new() sets up BEC as installed by DFU: version 1 in slot 0, no
+ * boot state, and the backup domain reset.
+ */
+static void
+device_new(void)
+{
+    static uint8_t buf[IMAGE_SIZE];
+
+    memset(flash, 0xff, STM32FLASH_SIZE);
+    memset((void *) ocm3_rtc_regs, 0, sizeof (ocm3_rtc_regs));
+    image_make(buf, 0, sizeof (buf), 1, 0);
+    memcpy(flash + FWSLOT_ADDR(0), buf, sizeof (buf));
+    image_len = IMAGE_SIZE;
+    cut_at     = 0;
+    cut_erase  = 0;
+    sim_usec   = 0;
+    have_state = 0;
+    CHECK(power_on() == 0);
+    have_state = 1;
+}
+
+/*
+ * state_fill() appends copies of the current boot state record until
+ * only room records are left free in its sector.
+ */
+static void
+state_fill(uint room)
+{
+    const fwslot_state_t *cur;
+    fwslot_state_t        rec;
+    uint                  copy;
+    uint                  next;
+
+    cur = fwslot_state_find(&copy, &next);
+    if (cur == NULL)
+        return;
+    rec = *cur;
+    for (; next + room < FWSLOT_STATE_PER_COPY; next++) {
+        rec.fbs_seq++;
+        rec.fbs_rcrc = fwslot_state_crc(&rec);
+        memcpy(flash + FWSLOT_STATE_ADDR(copy) + next * sizeof (rec), &rec,
+               sizeof (rec));
+    }
+}
+
+/* Update, restart, and confirmation, as well as refused requests */
+static void
+test_update(void)
+{
+    const fwslot_state_t *state;
+    bec_fw_update_t       reply;
+    uint8_t               block[16];
+
+    dfu_boots  = 0;
+    bad_boots  = 0;
+    lost_state = 0;
+    device_new();
+    CHECK(current_state() != NULL);
+
+    CHECK(update(2, 0) == 1);
+    CHECK(image_intact(1) == 2);
+    state = current_state();
+    CHECK((state != NULL) && (state->fbs_active == 1) &&
+          (state->fbs_state == FBS_STATE_GOOD));
+    CHECK(update(3, 0) == 0);
+    CHECK(image_intact(0) == 3);
+    CHECK(image_intact(1) == 2);
+
+    /* Data before the erase completes, out of order, or corrupt */
+    CHECK(request(BFU_OP_DATA, 0, 0, &reply) == BEC_STATUS_FAIL);
+    image_make(image, 1, image_len, 4, 0);
+    CHECK(fwupdate_start(image_len, crc32(0, image, image_len)) ==
+          BEC_STATUS_OK);
+    CHECK(fwupdate_data(0, image, 16, crc32(0, image, 16)) ==
+          BEC_STATUS_LOCKED);
+    sim_poll();
+    CHECK(fwupdate_data(16, image + 16, 16, crc32(0, image + 16, 16)) ==
+          BEC_STATUS_BADARG);
+    CHECK(fwupdate_data(0, image, 16, 0) == BEC_STATUS_CRC);
+    CHECK(fwupdate_data(0, image, 16, crc32(0, image, 16)) == BEC_STATUS_OK);
+    CHECK(fwupdate_data(0, image, 16, crc32(0, image, 16)) == BEC_STATUS_OK);
+    memset(block, 0, sizeof (block));
+    CHECK(fwupdate_data(0, block, 16, crc32(0, block, 16)) ==
+          BEC_STATUS_BADARG);
+    CHECK(fwupdate_commit(0) == BEC_STATUS_FAIL);
+
+    /* An image linked for the running slot is refused */
+    image_make(image, 0, image_len, 4, 0);
+    CHECK(fwupdate_start(image_len, crc32(0, image, image_len)) ==
+          BEC_STATUS_OK);
+    sim_poll();
+    CHECK(fwupdate_data(0, image, 16, crc32(0, image, 16)) ==
+          BEC_STATUS_BADARG);
+    fwupdate_phase = BFU_PHASE_IDLE;
+
+    CHECK(dfu_boots == 0);
+    CHECK(bad_boots == 0);
+    CHECK(lost_state == 0);
+}
+
+/*
+ * A trial image which hangs is retried FWSLOT_TRIAL_BOOTS times and then
+ * abandoned; the previous image records the rollback and accepts a new
+ * update.
+ */
+static void
+test_rollback(void)
+{
+    const fwslot_state_t *state;
+    uint64_t              start;
+
+    dfu_boots  = 0;
+    bad_boots  = 0;
+    lost_state = 0;
+    device_new();
+    start = sim_usec;
+    CHECK(update(2, 1) == 0);
+    printf("  hung trial image rolled back after %.1f s\n",
+           (sim_usec - start) / 1e6);
+    CHECK(image_intact(1) == 2);
+    state = current_state();
+    CHECK((state != NULL) && (state->fbs_active == 0) &&
+          (state->fbs_state == FBS_STATE_GOOD));
+    CHECK(RTC_BKPXR(FWSLOT_BKP_TRIES) == FWSLOT_BKP_MAGIC);
+
+    CHECK(update(3, 0) == 1);
+    CHECK(image_intact(1) == 3);
+    CHECK(dfu_boots == 0);
+    CHECK(bad_boots == 0);
+    CHECK(lost_state == 0);
+}
+
+/*
+ * Power fails at a random flash operation of an update, the restart,
+ * or the confirmation. Most operations program image data, so other
+ * cuts are placed among the first operations, among the last (boot
+ * state records), or in one of the sector erases. Half of the time
+ * the boot state sector is nearly full first, so that some cuts land in
+ * the switch to the other state sector.
+ */
+static void
+test_power_loss(void)
+{
+    uint total;
+    uint trial;
+    uint old_runs = 0;
+    uint new_runs = 0;
+    uint retry_ok = 0;
+
+    /* Flash operations in one update through confirmation */
+    device_new();
+    image_len = POWER_IMAGE;
+    total = flash_ops;
+    CHECK(update(2, 0) == 1);
+    total = flash_ops - total;
+    CHECK(total > POWER_TAIL);
+
+    dfu_boots  = 0;
+    bad_boots  = 0;
+    lost_state = 0;
+    for (trial = 0; trial < POWER_TRIALS; trial++) {
+        uint prior = rand_next(3);
+        uint version = 2 + prior;
+        uint start;
+        uint slot;
+
+        device_new();
+        image_len = POWER_IMAGE;
+        while (prior-- > 0)
+            CHECK(update(version - 1 - prior, 0) != FWSLOT_NONE);
+        if (rand_next(2))
+            state_fill(rand_next(4));
+        start  = flash_ops;
+        switch (rand_next(4)) {
+            case 0:
+                cut_at = start + 1 + rand_next(total);
+                break;
+            case 1:
+                cut_at = start + 1 + rand_next(8);
+                break;
+            case 2:
+                cut_at = start + total - rand_next(POWER_TAIL);
+                break;
+            default:
+                cut_erase = 1 + rand_next(3);
+                break;
+        }
+        slot = update(version, 0);
+        cut_at    = 0;
+        cut_erase = 0;
+
+        CHECK(slot != FWSLOT_NONE);
+        if (slot == FWSLOT_NONE)
+            continue;
+        if (image_intact(slot) == version)
+            new_runs++;
+        else
+            old_runs++;
+
+        /* Whatever BEC runs, it must accept the update again */
+        if (update(version + 1, 0) == (slot ^ 1) &&
+            (image_intact(slot ^ 1) == version + 1)) {
+            retry_ok++;
+        }
+    }
+    printf("  %u power cuts in %u flash operations of a %u KB update: "
+           "%u left the old image, %u the new\n",
+           POWER_TRIALS, total, POWER_IMAGE >> 10, old_runs, new_runs);
+    CHECK(retry_ok == POWER_TRIALS);
+    CHECK(dfu_boots == 0);
+    CHECK(bad_boots == 0);
+    CHECK(lost_state == 0);
+    CHECK(old_runs > 0);
+    CHECK(new_runs > 0);
+}
+
+/* Update time of a full slot image, by request block size */
+static void
+test_throughput(void)
+{
+    static const uint blocks[] = { 256, 512, 1024 };
+    uint              cur;
+
+    printf("  %u KB image: %8s %8s %10s\n", IMAGE_SIZE >> 10,
+           "erase", "data", "rate");
+    for (cur = 0; cur < ARRAY_SIZE(blocks); cur++) {
+        uint64_t start;
+        uint64_t end;
+        double   rate;
+
+        device_new();
+        fw_block = blocks[cur];
+        start = sim_usec;
+        CHECK(update(2, 0) == 1);
+        end = sim_usec;
+        rate = IMAGE_SIZE / (t_data / 1e6) / 1024;
+        printf("    %4u byte blocks: %5.2f s %6.2f s %6.1f KB/s; "
+               "%.2f s to send, %.1f s until confirmed\n",
+               fw_block, t_erase / 1e6, t_data / 1e6, rate, t_total / 1e6,
+               (end - start) / 1e6);
+        if (fw_block == 1024)
+            CHECK(rate > 50);
+    }
+    fw_block = 1024;
+}
+
+int
+main(void)
+{
+    flash = mmap((void *) FLASH_BASE, STM32FLASH_SIZE,
+                 PROT_READ | PROT_WRITE,
+                 MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED_NOREPLACE, -1, 0);
+    if (flash != (void *) FLASH_BASE) {
+        printf("fwupdate: could not map flash at %lx\n",
+               (unsigned long) FLASH_BASE);
+        return (1);
+    }
+    printf("fwupdate:\n");
+    test_update();
+    test_rollback();
+    test_power_loss();
+    test_throughput();
+    return (test_result("fwupdate"));
+}
@@ -0,0 +1,699 @@
+/*
+ * This is free and unencumbered software released into the public domain.
+ * See the LICENSE file for additional details.
+ *
+ * Designed by Chris Hooper in 2025.
+ *
+ * ---------------------------------------------------------------------
+ *
+ * Host test of HID report decoding (USBH_HID_DecodeReport() in the USB
+ * Host Library HID class) with several devices reporting at once. Mice,
+ * absolute pointers, and gamepads stream reports at their own polling
+ * intervals, interleaved in random order. Pointer motion must add up
+ * per device, and the state decoded from each gamepad must match its
+ * latest report, whether or not that report was decoded. The number of
+ * reports decoded is counted.
+ *
+ * The previous decoder is reproduced by sharing motion state across
+ * devices, forgetting the last report, and passing only the first 16
+ * bytes of each report.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../fw/cubemx/Middlewares/ST/STM32_USB_Host_Library/Class/HID/Src/usbh_hid.c"
+
+#include "test.h"
+
+#define SIM_MS          4000     // Length of each stream
+#define SIM_DEVS        6
+#define OLD_REPORT_MAX  16       // Bytes of a report the old decoder read
+
+typedef struct sim_dev sim_dev_t;
+
+typedef struct {
+    const char      *name;
+    HID_TypeTypeDef  devtype;
+    uint             poll_ms;
+    uint             relative;  // Pointer motion, rather than state
+    void           (*setup)(sim_dev_t *dev);
+    uint           (*report)(sim_dev_t *dev, uint8_t *buf);
+} dev_type_t;
+
+struct sim_dev {
+    const dev_type_t      *type;
+    USBH_HandleTypeDef     host;
+    HID_HandleTypeDef      hid;
+    uint8_t                fifo_buf[HID_REPORT_MAX * 2];
+    uint8_t                report[HID_REPORT_MAX];  // Current device state
+    uint                   next_change;  // ms when the state changes
+    uint                   seq;          // Reports sent
+    int                    pos_x;        // Absolute pointer position
+    int                    pos_y;
+    int                    last_x;
+    int                    last_y;
+    int                    move_x;       // Expected motion, before divisor
+    int                    move_y;
+    int                    got_x;        // Motion decoded
+    int                    got_y;
+    HID_MISC_Info_TypeDef  state[4];     // Last decoded, by Report ID
+};
+
+typedef struct {
+    const char       *name;
+    const dev_type_t *dev[SIM_DEVS];
+} scenario_t;
+
+typedef struct {
+    uint reports;
+    uint decoded;
+    uint errors;
+} sim_result_t;
+
+config_t config;
+
+static sim_dev_t sim_dev[SIM_DEVS];
+static uint      sim_devs;
+static uint      now_ms;
+static int       old_accum_x;    // Motion state the old decoder shared
+static int       old_accum_y;
+static int16_t   old_abs_x_last;
+static int16_t   old_abs_y_last;
+static uint32_t  rand_state = 1;
+
+static uint
+rand32(void)
+{
+    rand_state = rand_state * 1103515245 + 12345;
+    return (rand_state >> 8);
+}
+
+void
+fw_dprintf(uint32_t mask, const char *fmt, ...)
+{
+    (void) mask;
+    (void) fmt;
+}
+
+uint
+get_port(USBH_HandleTypeDef *phost)
+{
+    (void) phost;
+    return (0);
+}
+
+/*
+ * The remaining class driver entry points use the core library and the
+ * host controller, which report decoding does not reach.
+ */
+USBH_StatusTypeDef
+USBH_HID_MouseInit(USBH_HandleTypeDef *phost, HID_HandleTypeDef *HID_Handle)
+{
+    (void) phost;
+    (void) HID_Handle;
+    return (USBH_FAIL);
+}
+
+USBH_StatusTypeDef
+USBH_HID_KeybdInit(USBH_HandleTypeDef *phost, HID_HandleTypeDef *HID_Handle)
+{
+    (void) phost;
+    (void) HID_Handle;
+    return (USBH_FAIL);
+}
+
+USBH_StatusTypeDef
+USBH_HID_GenericInit(USBH_HandleTypeDef *phost, HID_HandleTypeDef *HID_Handle)
+{
+    (void) phost;
+    (void) HID_Handle;
+    return (USBH_FAIL);
+}
+
+uint8_t
+USBH_AllocPipe(USBH_HandleTypeDef *phost, uint8_t ep_addr)
+{
+    (void) phost;
+    (void) ep_addr;
+    return (0xffU);
+}
+
+USBH_StatusTypeDef
+USBH_FreePipe(USBH_HandleTypeDef *phost, uint8_t idx)
+{
+    (void) phost;
+    (void) idx;
+    return (USBH_FAIL);
+}
+
+USBH_StatusTypeDef
+USBH_OpenPipe(USBH_HandleTypeDef *phost, uint8_t pipe_num, uint8_t epnum,
+              uint8_t dev_address, uint8_t speed, uint8_t ep_type,
+              uint16_t mps)
+{
+    (void) phost;
+    (void) pipe_num;
+    (void) epnum;
+    (void) dev_address;
+    (void) speed;
+    (void) ep_type;
+    (void) mps;
+    return (USBH_FAIL);
+}
+
+USBH_StatusTypeDef
+USBH_ClosePipe(USBH_HandleTypeDef *phost, uint8_t pipe_num)
+{
+    (void) phost;
+    (void) pipe_num;
+    return (USBH_FAIL);
+}
+
+USBH_StatusTypeDef
+USBH_SelectInterface(USBH_HandleTypeDef *phost, uint8_t interface)
+{
+    (void) phost;
+    (void) interface;
+    return (USBH_FAIL);
+}
+
+USBH_StatusTypeDef
+USBH_CtlReq(USBH_HandleTypeDef *phost, uint8_t *buff, uint16_t length)
+{
+    (void) phost;
+    (void) buff;
+    (void) length;
+    return (USBH_FAIL);
+}
+
+USBH_StatusTypeDef
+USBH_GetDescriptor(USBH_HandleTypeDef *phost, uint8_t req_type,
+                   uint16_t value_idx, uint16_t index, uint8_t *buff,
+                   uint16_t length)
+{
+    (void) phost;
+    (void) req_type;
+    (void) value_idx;
+    (void) index;
+    (void) buff;
+    (void) length;
+    return (USBH_FAIL);
+}
+
+USBH_StatusTypeDef
+USBH_ClrFeature(USBH_HandleTypeDef *phost, uint8_t ep_num)
+{
+    (void) phost;
+    (void) ep_num;
+    return (USBH_FAIL);
+}
+
+USBH_StatusTypeDef
+USBH_InterruptReceiveData(USBH_HandleTypeDef *phost, uint8_t *buff,
+                          uint8_t length, uint8_t pipe_num)
+{
+    (void) phost;
+    (void) buff;
+    (void) length;
+    (void) pipe_num;
+    return (USBH_FAIL);
+}
+
+USBH_URBStateTypeDef
+USBH_LL_GetURBState(USBH_HandleTypeDef *phost, uint8_t pipe)
+{
+    (void) phost;
+    (void) pipe;
+    return (USBH_URB_ERROR);
+}
+
+void
+USBH_LL_SetURBState(USBH_HandleTypeDef *phost, uint8_t pipe,
+                    USBH_URBStateTypeDef state)
+{
+    (void) phost;
+    (void) pipe;
+    (void) state;
+}
+
+uint32_t
+USBH_LL_GetLastXferSize(USBH_HandleTypeDef *phost, uint8_t pipe)
+{
+    (void) phost;
+    (void) pipe;
+    return (0);
+}
+
+USBH_StatusTypeDef
+USBH_LL_SetToggle(USBH_HandleTypeDef *phost, uint8_t pipe, uint8_t toggle)
+{
+    (void) phost;
+    (void) pipe;
+    (void) toggle;
+    return (USBH_FAIL);
+}
+
+USBH_StatusTypeDef
+USBH_LL_StopHC(USBH_HandleTypeDef *phost, uint8_t chnum)
+{
+    (void) phost;
+    (void) chnum;
+    return (USBH_FAIL);
+}
+
+/* pad_axis() picks a digital pad style axis position: low, center, high */
+static uint8_t
+pad_axis(void)
+{
+    static const uint8_t axis[] = { 0x00, 0x80, 0x80, 0xff };
+    return (axis[rand32() % ARRAY_SIZE(axis)]);
+}
+
+/* next_change() schedules the next change of a device's state */
+static void
+next_change(sim_dev_t *dev)
+{
+    dev->next_change = now_ms + 40 + rand32() % 300;
+}
+
+/* A 3-button relative mouse with wheel, which NAKs while still */
+static void
+mouse_setup(sim_dev_t *dev)
+{
+    HID_RDescTypeDef *rd = &dev->hid.HID_RDesc;
+    uint              cur;
+
+    rd->usage = HID_USAGE_MOUSE;
+    rd->num_buttons = 3;
+    for (cur = 0; cur < rd->num_buttons; cur++)
+        rd->pos_button[cur] = cur;
+    rd->pos_x = 8;
+    rd->bits_x = 8;
+    rd->pos_y = 16;
+    rd->bits_y = 8;
+    rd->pos_wheel = 24;
+    rd->bits_wheel = 8;
+    dev->hid.length = 4;
+}
+
+static uint
+mouse_report(sim_dev_t *dev, uint8_t *buf)
+{
+    int dx;
+    int dy;
+
+    if (now_ms >= dev->next_change) {
+        dev->report[0] = !dev->report[0];  // Moving or still
+        next_change(dev);
+    }
+    if (dev->report[0] == 0)
+        return (0);
+    dx = (int) (rand32() % 7) - 3;
+    dy = (int) (rand32() % 7) - 3;
+    dev->move_x += dx;
+    dev->move_y += dy;
+    buf[0] = 0;
+    buf[1] = dx;
+    buf[2] = dy;
+    buf[3] = 0;
+    return (4);
+}
+
+/* An absolute pointer (tablet), which is not a boot protocol mouse */
+static void
+tablet_setup(sim_dev_t *dev)
+{
+    HID_RDescTypeDef *rd = &dev->hid.HID_RDesc;
+
+    rd->usage = HID_USAGE_MOUSE;
+    rd->dev_flag = DEV_FLAG_ABSOLUTE;
+    rd->num_buttons = 1;
+    rd->pos_x = 8;
+    rd->bits_x = 16;
+    rd->pos_y = 24;
+    rd->bits_y = 16;
+    dev->hid.length = 5;
+    dev->pos_x = 200 + rand32() % 1600;
+    dev->pos_y = 200 + rand32() % 1600;
+}
+
+static uint
+tablet_report(sim_dev_t *dev, uint8_t *buf)
+{
+    dev->pos_x += (int) (rand32() % 81) - 40;
+    dev->pos_y += (int) (rand32() % 81) - 40;
+    if (dev->pos_x < 0)
+        dev->pos_x = 0;
+    if (dev->pos_y < 0)
+        dev->pos_y = 0;
+
+    /* Motion is quantized per report as the decoder does */
+    dev->move_x += (int16_t) (dev->pos_x - dev->last_x) / 4;
+    dev->move_y += (int16_t) (dev->pos_y - dev->last_y) / 8;
+    dev->last_x = dev->pos_x;
+    dev->last_y = dev->pos_y;
+
+    buf[0] = 0;
+    buf[1] = dev->pos_x;
+    buf[2] = dev->pos_x >> 8;
+    buf[3] = dev->pos_y;
+    buf[4] = dev->pos_y >> 8;
+    return (5);
+}
+
+/* A gamepad with a 27 byte report, which has its buttons near the end */
+static void
+pad_setup(sim_dev_t *dev)
+{
+    HID_RDescTypeDef *rd = &dev->hid.HID_RDesc;
+    uint              cur;
+
+    rd->usage = HID_USAGE_GAMEPAD;
+    rd->pos_x = 8;
+    rd->bits_x = 8;
+    rd->pos_y = 16;
+    rd->bits_y = 8;
+    rd->offset_xy = -127;
+    rd->num_buttons = 14;
+    for (cur = 0; cur < rd->num_buttons; cur++)
+        rd->pos_button[cur] = 160 + cur;
+    dev->hid.length = 27;
+    for (cur = 3; cur < 20; cur++)
+        dev->report[cur] = 0x80;  // Unused analog controls at rest
+}
+
+static uint
+pad_report(sim_dev_t *dev, uint8_t *buf)
+{
+    if (now_ms >= dev->next_change) {
+        dev->report[1] = pad_axis();
+        dev->report[2] = pad_axis();
+        dev->report[20] = BIT(rand32() % 8) & rand32();
+        dev->report[21] = BIT(rand32() % 6) & rand32();
+        next_change(dev);
+    }
+    memcpy(buf, dev->report, 27);
+    return (27);
+}
+
+/*
+ * A gamepad with Report IDs: the pad in report 1, and volume buttons in
+ * report 2. The reports alternate.
+ */
+static void
+pad_ids_setup(sim_dev_t *dev)
+{
+    HID_RDescTypeDef *rd = &dev->hid.HID_RDesc;
+    uint              cur;
+
+    rd->usage = HID_USAGE_GAMEPAD;
+    rd->pos_x = 8;
+    rd->bits_x = 8;
+    rd->pos_y = 16;
+    rd->bits_y = 8;
+    rd->offset_xy = -127;
+    rd->num_buttons = 8;
+    for (cur = 0; cur < rd->num_buttons; cur++)
+        rd->pos_button[cur] = 24 + cur;
+    rd->num_mmbuttons = 2;
+    for (cur = 0; cur < rd->num_mmbuttons; cur++) {
+        rd->pos_mmbutton[cur] = 8 + cur;
+        rd->val_mmbutton[cur] = 0xe9 + cur;  // Volume up, down
+        rd->id_mmbutton[cur] = 2;
+    }
+    dev->hid.length = 4;
+    dev->report[0] = 1;
+}
+
+static uint
+pad_ids_report(sim_dev_t *dev, uint8_t *buf)
+{
+    if (now_ms >= dev->next_change) {
+        dev->report[1] = pad_axis();
+        dev->report[2] = pad_axis();
+        dev->report[3] = BIT(rand32() % 8) & rand32();
+        dev->report[5] = rand32() % 4;
+        next_change(dev);
+    }
+    if (dev->seq++ & 1) {
+        buf[0] = 2;
+        buf[1] = dev->report[5];
+        return (2);
+    }
+    memcpy(buf, dev->report, 4);
+    return (4);
+}
+
+/* The EasySMX gamepad, which puts a timestamp in its reports */
+static void
+smx_setup(sim_dev_t *dev)
+{
+    HID_RDescTypeDef *rd = &dev->hid.HID_RDesc;
+    uint              cur;
+
+    rd->usage = HID_USAGE_GAMEPAD;
+    for (cur = 0; cur < 4; cur++)
+        rd->pos_jpad[cur] = 40 + cur;
+    rd->pos_x = 24;
+    rd->bits_x = 8;
+    rd->pos_y = 32;
+    rd->bits_y = 8;
+    rd->offset_xy = -127;
+    rd->num_buttons = 8;
+    for (cur = 0; cur < rd->num_buttons; cur++)
+        rd->pos_button[cur] = 48 + cur;
+    dev->hid.length = 8;
+    dev->host.device.DevDesc.idVendor = 0x057e;
+    dev->host.device.DevDesc.idProduct = 0x2009;
+}
+
+static uint
+smx_report(sim_dev_t *dev, uint8_t *buf)
+{
+    if (now_ms >= dev->next_change) {
+        dev->report[3] = pad_axis();
+        dev->report[4] = pad_axis();
+        dev->report[5] = BIT(rand32() % 4) & rand32();
+        dev->report[6] = BIT(rand32() % 8) & rand32();
+        next_change(dev);
+    }
+    dev->report[1] = dev->seq++;
+    memcpy(buf, dev->report, 8);
+    return (8);
+}
+
+static const dev_type_t dev_mouse =
+    { "mouse",   HID_MOUSE,   1, 1, mouse_setup,   mouse_report };
+static const dev_type_t dev_mouse8 =
+    { "mouse",   HID_MOUSE,   8, 1, mouse_setup,   mouse_report };
+static const dev_type_t dev_tablet =
+    { "tablet",  HID_UNKNOWN, 8, 1, tablet_setup,  tablet_report };
+static const dev_type_t dev_pad =
+    { "pad",     HID_UNKNOWN, 4, 0, pad_setup,     pad_report };
+static const dev_type_t dev_pad_ids =
+    { "pad ids", HID_UNKNOWN, 4, 0, pad_ids_setup, pad_ids_report };
+static const dev_type_t dev_smx =
+    { "EasySMX", HID_UNKNOWN, 2, 0, smx_setup,     smx_report };
+
+static const scenario_t scenarios[] = {
+    { "two mice",     { &dev_mouse, &dev_mouse8 } },
+    { "two tablets",  { &dev_tablet, &dev_tablet } },
+    { "mouse, pad",   { &dev_mouse8, &dev_pad } },
+    { "pad ids, smx", { &dev_pad_ids, &dev_smx } },
+    { "all six",      { &dev_mouse, &dev_mouse8, &dev_tablet, &dev_pad,
+                        &dev_pad_ids, &dev_smx } },
+};
+
+/* sim_decode() passes one report through the fifo to the decoder */
+static USBH_StatusTypeDef
+sim_decode(sim_dev_t *dev, HID_HandleTypeDef *hid, uint8_t *buf, uint len,
+           HID_MISC_Info_TypeDef *info)
+{
+    USBH_HID_FifoWrite(&hid->fifo, buf, len);
+    return (USBH_HID_DecodeReport(&dev->host, hid, dev->type->devtype, info));
+}
+
+/*
+ * ref_state() decodes a report on a fresh handle, giving the state it
+ * describes without reference to any earlier report.
+ */
+static void
+ref_state(sim_dev_t *dev, uint8_t *buf, uint len, HID_MISC_Info_TypeDef *info)
+{
+    static HID_HandleTypeDef hid;
+    uint8_t                  fifo_buf[HID_REPORT_MAX * 2];
+
+    memset(&hid, 0, sizeof (hid));
+    hid.HID_RDesc = dev->hid.HID_RDesc;
+    hid.length = dev->hid.length;
+    USBH_HID_FifoInit(&hid.fifo, fifo_buf, sizeof (fifo_buf));
+    memset(info, 0, sizeof (*info));
+    (void) sim_decode(dev, &hid, buf, len, info);
+}
+
+/*
+ * deliver() sends the next report of a device, if it has one, to the
+ * decoder. The old decoder is modeled around the same code.
+ */
+static void
+deliver(sim_dev_t *dev, uint old, sim_result_t *res)
+{
+    HID_HandleTypeDef     *hid = &dev->hid;
+    HID_MISC_Info_TypeDef  info;
+    HID_MISC_Info_TypeDef  ref;
+    USBH_StatusTypeDef     rc;
+    uint8_t                buf[HID_REPORT_MAX];
+    uint                   len = dev->type->report(dev, buf);
+    uint                   id;
+
+    if (len == 0)
+        return;  // NAK
+    res->reports++;
+
+    if (old) {
+        memset(hid->report_last, 0, sizeof (hid->report_last));
+        hid->accum_x = old_accum_x;
+        hid->accum_y = old_accum_y;
+        hid->abs_x_last = old_abs_x_last;
+        hid->abs_y_last = old_abs_y_last;
+        rc = sim_decode(dev, hid, buf,
+                        (len > OLD_REPORT_MAX) ? OLD_REPORT_MAX : len, &info);
+        old_accum_x = hid->accum_x;
+        old_accum_y = hid->accum_y;
+        old_abs_x_last = hid->abs_x_last;
+        old_abs_y_last = hid->abs_y_last;
+    } else {
+        rc = sim_decode(dev, hid, buf, len, &info);
+    }
+    CHECK((rc == USBH_OK) || ((rc == USBH_BUSY) && !dev->type->relative));
+    if (rc == USBH_OK)
+        res->decoded++;
+
+    if (dev->type->relative) {
+        if (rc == USBH_OK) {
+            dev->got_x += info.x;
+            dev->got_y += info.y;
+        }
+        return;
+    }
+
+    /* The state last decoded for this Report ID must be current */
+    id = (hid->HID_RDesc.num_mmbuttons != 0) ? (buf[0] & 3) : 0;
+    if (rc == USBH_OK)
+        dev->state[id] = info;
+    ref_state(dev, buf, len, &ref);
+    if (memcmp(&ref, &dev->state[id], sizeof (ref)) != 0)
+        res->errors++;
+}
+
+/*
+ * motion_error() is how far, in pointer counts, decoded motion is from
+ * the device's motion. The decoder divides by 2 for relative mice, and
+ * by 4 for absolute pointers.
+ */
+static uint
+motion_error(sim_dev_t *dev)
+{
+    int div = (dev->hid.HID_RDesc.dev_flag & DEV_FLAG_ABSOLUTE) ? 4 : 2;
+
+    return (abs(dev->move_x - dev->got_x * div) / div +
+            abs(dev->move_y - dev->got_y * div) / div);
+}
+
+static void
+sim_run(const scenario_t *sc, uint old, sim_result_t *res)
+{
+    uint cur;
+
+    memset(res, 0, sizeof (*res));
+    memset(sim_dev, 0, sizeof (sim_dev));
+    old_accum_x = 0;
+    old_accum_y = 0;
+    old_abs_x_last = 0;
+    old_abs_y_last = 0;
+    now_ms = 0;
+    rand_state = 1;
+
+    for (sim_devs = 0; (sim_devs < SIM_DEVS) && (sc->dev[sim_devs] != NULL);
+         sim_devs++) {
+        sim_dev_t *dev = &sim_dev[sim_devs];
+
+        dev->type = sc->dev[sim_devs];
+        dev->hid.interface = sim_devs;
+        USBH_HID_FifoInit(&dev->hid.fifo, dev->fifo_buf,
+                          sizeof (dev->fifo_buf));
+        dev->type->setup(dev);
+        next_change(dev);
+    }
+
+    for (now_ms = 0; now_ms < SIM_MS; now_ms++) {
+        uint order[SIM_DEVS];
+        uint due = 0;
+
+        /* Devices due at the same frame arrive in any order */
+        for (cur = 0; cur < sim_devs; cur++)
+            if ((now_ms % sim_dev[cur].type->poll_ms) == 0)
+                order[due++] = cur;
+        for (cur = due; cur > 1; cur--) {
+            uint pick = rand32() % cur;
+            uint temp = order[cur - 1];
+            order[cur - 1] = order[pick];
+            order[pick] = temp;
+        }
+        for (cur = 0; cur < due; cur++)
+            deliver(&sim_dev[order[cur]], old, res);
+    }
+
+    for (cur = 0; cur < sim_devs; cur++)
+        if (sim_dev[cur].type->relative)
+            res->errors += motion_error(&sim_dev[cur]);
+}
+
+static void
+test_streams(void)
+{
+    uint         cur;
+    uint         new_total = 0;
+    uint         old_total = 0;
+    sim_result_t res;
+    sim_result_t old;
+
+    printf("hid reports:\n");
+    printf("    devices        reports  decoded  old decoded  errors  "
+           "old errors\n");
+    for (cur = 0; cur < ARRAY_SIZE(scenarios); cur++) {
+        const scenario_t *sc = &scenarios[cur];
+        uint              pads = 0;
+        uint              dev;
+
+        sim_run(sc, 1, &old);
+        sim_run(sc, 0, &res);
+        for (dev = 0; dev < sim_devs; dev++)
+            pads += !sim_dev[dev].type->relative;
+
+        CHECK(res.reports == old.reports);
+        CHECK(res.errors == 0);
+        CHECK(old.errors >= res.errors);
+        if (pads != 0)
+            CHECK(res.decoded < old.decoded);
+        else
+            CHECK(res.decoded == old.decoded);
+        printf("    %-14s %7u %8u %12u %7u %11u\n", sc->name, res.reports,
+               res.decoded, old.decoded, res.errors, old.errors);
+        new_total += res.decoded;
+        old_total += old.decoded;
+    }
+    printf("    all: %u reports decoded, old %u\n", new_total, old_total);
+    printf("    (errors are pointer counts of motion lost or gained, and "
+           "reports after\n     which the decoded gamepad state was "
+           "wrong; %u ms streams)\n", SIM_MS);
+}
+
+int
+main(void)
+{
+    test_streams();
+    return (test_result("hid_report"));
+}
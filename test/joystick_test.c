@@ -0,0 +1,389 @@
+/*
+ * This is free and unencumbered software released into the public domain.
+ * See the LICENSE file for additional details.
+ *
+ * Designed by Chris Hooper in 2025.
+ *
+ * ---------------------------------------------------------------------
+ *
+ * Host simulation of joystick port output (fw/joystick.c). USB report
+ * sequences are fed to joystick_action() at their arrival times, and the
+ * timer alarm fires after a random interrupt latency. Every change of an
+ * Amiga port line is recorded, giving the output waveform. Autofire edge
+ * jitter and drift, minimum pulse width, coalescing of rapid changes,
+ * and taps seen by software which samples the port once per frame are
+ * measured. The previous output, where lines followed report arrival,
+ * is modeled for comparison.
+ */
+
+#include "../fw/joystick.c"
+#include <stdlib.h>
+#include "test.h"
+
+#define REPORT_USEC   8000    // USB interrupt endpoint polling interval
+#define FRAME_USEC    20000   // Amiga samples the port once per PAL frame
+#define IRQ_LAT_MAX   40      // Worst alarm interrupt latency (usec)
+#define MAX_EDGES     1024
+
+typedef struct {
+    uint64_t time;
+    uint8_t  level;     // 1 = asserted
+} edge_t;
+
+config_t config;
+uint     config_gen = 1;
+uint32_t mouse_buttons_add;
+
+static uint64_t now;                              // Ticks are usec
+static uint64_t alarm_when[TIMER_ALARM_COUNT];    // 0 = not armed
+static uint     alarm_lat[TIMER_ALARM_COUNT];
+static void   (*alarm_func[TIMER_ALARM_COUNT])(void);
+static uint8_t  line_level[32];                   // ASE_BUTTON_0 onward
+static edge_t   edges[32][MAX_EDGES];
+static uint     edge_count[32];
+static uint     key_events;
+static uint64_t key_time;
+static uint32_t rand_state = 1;
+
+static uint
+rand32(void)
+{
+    rand_state = rand_state * 1103515245 + 12345;
+    return (rand_state >> 8);
+}
+
+void
+fw_dprintf(uint32_t mask, const char *fmt, ...)
+{
+    (void) mask;
+    (void) fmt;
+}
+
+uint8_t
+capture_scancode(uint16_t keycode)
+{
+    (void) keycode;
+    return (0);
+}
+
+void
+hiden_set(unsigned int enable)
+{
+    (void) enable;
+}
+
+uint64_t
+timer_tick_get(void)
+{
+    return (now);
+}
+
+uint64_t
+timer_usec_to_tick(uint usec)
+{
+    return (usec);
+}
+
+void
+timer_alarm_set(uint alarm, uint64_t when, void (*func)(void))
+{
+    alarm_when[alarm] = when;
+    alarm_func[alarm] = func;
+    alarm_lat[alarm]  = rand32() % (IRQ_LAT_MAX + 1);
+}
+
+void
+timer_alarm_cancel(uint alarm)
+{
+    alarm_when[alarm] = 0;
+}
+
+/* mouse_put_macro() records port line changes and keystrokes */
+void
+mouse_put_macro(uint32_t macro, uint is_pressed, uint was_pressed)
+{
+    for (; macro != 0; macro >>= 8) {
+        uint8_t code = (uint8_t) macro;
+        uint    line = code & 0x1f;
+
+        if ((code & 0x80) == 0) {
+            if (was_pressed != is_pressed) {
+                key_events++;
+                key_time = now;
+            }
+            continue;
+        }
+        if (line_level[line] == is_pressed)
+            continue;
+        line_level[line] = is_pressed;
+        if (edge_count[line] < MAX_EDGES) {
+            edges[line][edge_count[line]].time  = now;
+            edges[line][edge_count[line]].level = is_pressed;
+            edge_count[line]++;
+        }
+    }
+}
+
+/* sim_run() advances time, firing the alarm after its interrupt latency */
+static void
+sim_run(uint64_t until)
+{
+    uint alarm = TIMER_ALARM_JOYSTICK;
+
+    while ((alarm_when[alarm] != 0) &&
+           (alarm_when[alarm] + alarm_lat[alarm] <= until)) {
+        if (now < alarm_when[alarm] + alarm_lat[alarm])
+            now = alarm_when[alarm] + alarm_lat[alarm];
+        alarm_when[alarm] = 0;
+        alarm_func[alarm]();
+    }
+    if (now < until)
+        now = until;
+}
+
+static void
+report(uint64_t when, uint32_t buttons)
+{
+    sim_run(when);
+    joystick_action(0, 0, 0, 0, buttons);
+}
+
+static void
+sim_reset(void)
+{
+    report(now, 0);
+    sim_run(now + 1000000);
+    memset(edges, 0, sizeof (edges));
+    memset(edge_count, 0, sizeof (edge_count));
+    memset(config.joy_autofire, 0, sizeof (config.joy_autofire));
+    memset(config.buttonmap, 0, sizeof (config.buttonmap));
+    config_gen++;
+    key_events = 0;
+    now = 0;
+}
+
+/*
+ * test_autofire() holds fire for two seconds at each autofire rate,
+ * while another button changes in USB reports. Each edge is compared
+ * with its ideal time from the press.
+ */
+static void
+test_autofire(void)
+{
+    static const uint rates[] = { 2, 5, 10, 15, 25, 40 };
+    uint cur;
+
+    printf("joystick:\n");
+    printf("    autofire  edges  half period  jitter max  drift  "
+           "min pulse\n");
+    for (cur = 0; cur < ARRAY_SIZE(rates); cur++) {
+        uint     rate = rates[cur];
+        uint     eff = (rate > JOYSTICK_AUTOFIRE_MAX) ?
+                       JOYSTICK_AUTOFIRE_MAX : rate;
+        uint     half = 500000 / eff;
+        uint64_t t;
+        uint64_t jitter = 0;
+        uint64_t min_pulse = UINT64_MAX;
+        int64_t  drift;
+        uint     pos;
+        edge_t  *e = edges[ASE_BUTTON_0 & 0x1f];
+        uint     count;
+
+        sim_reset();
+        config.joy_autofire[0] = rate;
+        config_gen++;
+
+        for (t = 0; t < 2000000; t += REPORT_USEC)
+            report(t, BIT(0) | (((t / 64000) & 1) ? BIT(5) : 0));
+        report(t, 0);
+        sim_run(t + 100000);
+
+        count = edge_count[ASE_BUTTON_0 & 0x1f];
+        for (pos = 0; pos < count; pos++) {
+            uint64_t ideal = (uint64_t) pos * half;
+            uint64_t err = (e[pos].time > ideal) ? e[pos].time - ideal :
+                                                   ideal - e[pos].time;
+            if ((pos + 1 < count) && (e[pos].time < t)) {
+                uint64_t width = e[pos + 1].time - e[pos].time;
+                if (min_pulse > width)
+                    min_pulse = width;
+            }
+            if (e[pos].time >= t)
+                break;  // Release
+            CHECK(e[pos].level == ((pos & 1) == 0));
+            if (jitter < err)
+                jitter = err;
+        }
+        drift = (int64_t) e[pos - 1].time - (int64_t) (pos - 1) * half;
+
+        /* Edges follow the schedule, regardless of report arrival */
+        CHECK(jitter <= IRQ_LAT_MAX);
+        CHECK((drift >= 0) && (drift <= IRQ_LAT_MAX));
+        CHECK(pos >= 2000000 / half);
+        CHECK(pos <= 2000000 / half + 1);
+        CHECK(min_pulse >= half - IRQ_LAT_MAX);
+        CHECK(line_level[ASE_BUTTON_0 & 0x1f] == 0);
+
+        printf("    %3u Hz %9u %9u us %8u us %4d us %7u us\n", rate, pos,
+               half, (uint) jitter, (int) drift, (uint) min_pulse);
+    }
+    printf("    (%u us alarm latency; rates above %u Hz are limited)\n",
+           IRQ_LAT_MAX, JOYSTICK_AUTOFIRE_MAX);
+}
+
+/* frame_seen() returns whether a frame sample finds the line asserted */
+static uint
+frame_seen(const edge_t *e, uint count, uint64_t start, uint64_t end,
+           uint64_t phase)
+{
+    uint64_t sample = start - (start % FRAME_USEC) + phase;
+    uint     pos;
+
+    for (; sample < end; sample += FRAME_USEC) {
+        uint level = 0;
+        if (sample < start)
+            continue;
+        for (pos = 0; (pos < count) && (e[pos].time <= sample); pos++)
+            level = e[pos].level;
+        if (level)
+            return (1);
+    }
+    return (0);
+}
+
+/*
+ * test_taps() sends short taps of one or two reports. Each tap is
+ * judged by whether software sampling the port once per frame sees it.
+ * Without the hold, the line follows report arrival.
+ */
+static void
+test_taps(void)
+{
+    uint     tap;
+    uint     taps = 200;
+    uint     seen = 0;
+    uint     old_seen = 0;
+    uint64_t min_pulse = UINT64_MAX;
+    uint64_t t = 0;
+    uint     line = ASE_BUTTON_0 & 0x1f;
+
+    sim_reset();
+    for (tap = 0; tap < taps; tap++) {
+        uint     len = REPORT_USEC * (1 + rand32() % 2);
+        uint64_t phase = rand32() % FRAME_USEC;
+        uint     first = edge_count[line];
+        edge_t   old[2];
+
+        report(t, BIT(0));
+        report(t + len, 0);
+        sim_run(t + 60000);
+
+        CHECK(edge_count[line] == first + 2);
+        if (edge_count[line] == first + 2) {
+            uint64_t width = edges[line][first + 1].time -
+                             edges[line][first].time;
+            if (min_pulse > width)
+                min_pulse = width;
+        }
+        seen += frame_seen(&edges[line][first], edge_count[line] - first,
+                           t, t + 60000, phase);
+
+        /* Previously, the line followed the reports */
+        old[0].time  = t;
+        old[0].level = 1;
+        old[1].time  = t + len;
+        old[1].level = 0;
+        old_seen += frame_seen(old, 2, t, t + 60000, phase);
+
+        t += 60000 + REPORT_USEC * (rand32() % 8);
+    }
+    CHECK(min_pulse >= JOYSTICK_HOLD_USEC);
+    CHECK(seen == taps);
+    printf("    taps of %u-%u ms: %u of %u seen by per-frame sampling "
+           "(old %u), min pulse %u us\n", REPORT_USEC / 1000,
+           REPORT_USEC * 2 / 1000, seen, taps, old_seen, (uint) min_pulse);
+}
+
+/*
+ * test_coalesce() sends a press, release, and press within one hold
+ * time, as from a bouncing switch on a fast-polled controller. The
+ * port sees a single continuous press.
+ */
+static void
+test_coalesce(void)
+{
+    uint line = ASE_BUTTON_0 & 0x1f;
+
+    sim_reset();
+    report(0, BIT(0));
+    report(2000, 0);
+    report(5000, BIT(0));
+    report(7000, 0);
+    report(9000, BIT(0));
+    report(45000, 0);
+    sim_run(100000);
+    CHECK(edge_count[line] == 2);
+    CHECK(edges[line][0].time == 0);
+    CHECK(edges[line][1].time == 45000);  // Held past the hold time
+
+    /* A release before the hold time ends completes on time */
+    sim_reset();
+    report(0, BIT(0));
+    report(3000, 0);
+    report(4000, BIT(0));
+    report(6000, 0);
+    sim_run(100000);
+    CHECK(edge_count[line] == 2);
+    CHECK(edges[line][1].time >= JOYSTICK_HOLD_USEC);
+    CHECK(edges[line][1].time <= JOYSTICK_HOLD_USEC + IRQ_LAT_MAX);
+    printf("    bounce within %u us: %u edges, released at %u us\n",
+           JOYSTICK_HOLD_USEC, edge_count[line],
+           (uint) edges[line][1].time);
+}
+
+/*
+ * test_remap() checks that a button mapped to a direction is timed like
+ * fire, that a keystroke mapping is sent at report arrival, and that a
+ * config change is picked up.
+ */
+static void
+test_remap(void)
+{
+    uint up = ASE_JOYSTICK_UP & 0x1f;
+
+    sim_reset();
+    config.buttonmap[32 + 2] = ASE_JOYSTICK_UP;
+    config.buttonmap[32 + 3] = 0x45;  // Esc key
+    config_gen++;
+    report(0, BIT(2));
+    report(REPORT_USEC, 0);
+    sim_run(100000);
+    CHECK(edge_count[up] == 2);
+    CHECK(edges[up][1].time >= JOYSTICK_HOLD_USEC);
+
+    report(200000, BIT(3));
+    CHECK(key_events == 1);
+    CHECK(key_time == 200000);
+    report(200000 + REPORT_USEC, 0);
+    CHECK(key_events == 2);
+    CHECK(key_time == 200000 + REPORT_USEC);  // Keys are not held
+
+    config.buttonmap[32 + 2] = 0;
+    config_gen++;
+    report(300000, BIT(2));
+    CHECK(edge_count[up] == 2);
+    CHECK(line_level[2] == 1);  // Back to fire button 3
+    report(300000 + REPORT_USEC, 0);
+    sim_run(400000);
+    CHECK(line_level[2] == 0);
+}
+
+int
+main(void)
+{
+    test_autofire();
+    test_taps();
+    test_coalesce();
+    test_remap();
+    return (test_result("joystick"));
+}
@@ -0,0 +1,340 @@
+/*
+ * This is free and unencumbered software released into the public domain.
+ * See the LICENSE file for additional details.
+ *
+ * Designed by Chris Hooper in 2025.
+ *
+ * ---------------------------------------------------------------------
+ *
+ * Host test and benchmark of BEC console output compression: the LZSS
+ * encoder (fw/lzss.c) and the Amiga side decoder (lzss_decompress() in
+ * amiga/becdecode.c). Synthesized console sessions of the kinds "bec term"
+ * shows are drained through BEC_CMD_CONS_LZ replies exactly as
+ * msg_cons_lz() builds them, and must expand to the original output.
+ * Mailbox bytes and estimated transfer time are compared with draining
+ * the same output through BEC_CMD_CONS_OUTPUT, as "bec term" did before.
+ */
+
+#include "../fw/lzss.c"
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <exec/types.h>
+#include "../amiga/becdecode.c"
+#include "test.h"
+
+#define SESSION_MAX    65536
+#define OLD_MAXLEN     62      // "bec term" BEC_CMD_CONS_OUTPUT request
+#define MSG_OVERHEAD   (BEC_MSG_HDR_LEN + BEC_MSG_CRC_LEN)
+#define BYTE_USEC      3.8     // Mailbox byte, two RP5C01 accesses
+#define EXCHANGE_USEC  300     // BEC turnaround and reply polling
+#define LZ_PAYLOAD     (BEC_MSG_MAX_PAYLOAD - sizeof (bec_cons_lz_t))
+
+static uint8_t  session[SESSION_MAX];
+static uint     session_len;
+static uint32_t rand_state = 1;
+
+void
+fw_dprintf(uint32_t mask, const char *fmt, ...)
+{
+    (void) mask;
+    (void) fmt;
+}
+
+static uint
+rand_next(uint range)
+{
+    rand_state = rand_state * 1103515245 + 12345;
+    return ((rand_state >> 8) % range);
+}
+
+static void
+out(const char *fmt, ...)
+{
+    va_list ap;
+    int     len;
+
+    va_start(ap, fmt);
+    len = vsnprintf((char *) session + session_len,
+                    sizeof (session) - session_len, fmt, ap);
+    va_end(ap);
+    if (len > 0)
+        session_len += len;
+    if (session_len > sizeof (session) - 1)
+        session_len = sizeof (session) - 1;
+}
+
+/* Memory dump, as from "d" */
+static void
+gen_dump(void)
+{
+    uint32_t addr = 0x08000000;
+    uint8_t  data[16];
+    uint     cur;
+
+    while (session_len < SESSION_MAX - 200) {
+        for (cur = 0; cur < 16; cur++)
+            data[cur] = (rand_next(3) == 0) ? rand_next(256) :
+                        (rand_next(2) ? 0x00 : 0xff);
+        out("%08x:", addr);
+        for (cur = 0; cur < 16; cur += 4)
+            out(" %02x%02x%02x%02x", data[cur], data[cur + 1],
+                data[cur + 2], data[cur + 3]);
+        out(" ");
+        for (cur = 0; cur < 16; cur++)
+            out("%c", ((data[cur] >= ' ') && (data[cur] < 0x7f)) ?
+                data[cur] : '.');
+        out("\r\n");
+        addr += 16;
+    }
+}
+
+/* Sensor table, as from repeated "sensor" */
+static void
+gen_sensors(void)
+{
+    static const char *const names[] = {
+        "V5", "V3P3", "V12", "VREF", "Temp", "Fan", "I5", "I3P3"
+    };
+    uint cur;
+
+    while (session_len < SESSION_MAX - 400) {
+        out("CMD> sensor\r\n");
+        for (cur = 0; cur < ARRAY_SIZE(names); cur++)
+            out("%-6s %6d.%03u %s\r\n", names[cur], 1 + rand_next(12),
+                rand_next(1000), (cur == 4) ? "C" : (cur == 5) ? "RPM" : "V");
+    }
+}
+
+/* Debug log, with timestamps and varying values */
+static void
+gen_log(void)
+{
+    static const char *const msgs[] = {
+        "USB port %u connect, speed %u",
+        "HID report len %u on interface %u",
+        "Amiga RTC read reg %x bank %u",
+        "Power state change %u -> %u",
+        "Keyboard reset request %u %u",
+    };
+    uint usec = 0;
+
+    while (session_len < SESSION_MAX - 200) {
+        usec += rand_next(20000);
+        out("[%6u.%06u] ", usec / 1000000, usec % 1000000);
+        out(msgs[rand_next(ARRAY_SIZE(msgs))], rand_next(8), rand_next(64));
+        out("\r\n");
+    }
+}
+
+/* Random bytes: the worst case */
+static void
+gen_random(void)
+{
+    while (session_len < SESSION_MAX)
+        session[session_len++] = rand_next(256);
+}
+
+static double
+nsec_now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (ts.tv_sec * 1e9 + ts.tv_nsec);
+}
+
+/*
+ * drain_lz() fetches the session through BEC_CMD_CONS_LZ replies, as
+ * msg_cons_lz() builds them and poll_bec_cons_lz() expands them.
+ * Returns mailbox bytes, with the number of exchanges in *msgs and
+ * the host time spent compressing in *enc_nsec.
+ */
+static uint
+drain_lz(uint *msgs, double *enc_nsec)
+{
+    static uint8_t reply[LZ_PAYLOAD];
+    static uint8_t expand[BCL_MAX_LEN];
+    uint           pos = 0;
+    uint           wire = 0;
+
+    *msgs = 0;
+    *enc_nsec = 0;
+    while (pos < session_len) {
+        uint max = session_len - pos;
+        uint   used;
+        uint   len;
+        double start;
+
+        if (max > BCL_MAX_LEN)
+            max = BCL_MAX_LEN;
+        start = nsec_now();
+        len = lzss_compress(session + pos, max, reply, sizeof (reply),
+                            &used);
+        *enc_nsec += nsec_now() - start;
+        CHECK(len <= sizeof (reply));
+        CHECK(used > 0);
+        CHECK(lzss_decompress(reply, len, expand, used) == used);
+        CHECK(memcmp(expand, session + pos, used) == 0);
+        pos += used;
+        wire += MSG_OVERHEAD + sizeof (bec_cons_lz_t) +
+                MSG_OVERHEAD + sizeof (bec_cons_lz_t) + len;
+        (*msgs)++;
+    }
+    return (wire);
+}
+
+/* drain_old() fetches the session through BEC_CMD_CONS_OUTPUT replies */
+static uint
+drain_old(uint *msgs)
+{
+    uint pos = 0;
+    uint wire = 0;
+
+    *msgs = 0;
+    while (pos < session_len) {
+        uint len = session_len - pos;
+        if (len > OLD_MAXLEN)
+            len = OLD_MAXLEN;
+        pos += len;
+        wire += MSG_OVERHEAD + 1 + MSG_OVERHEAD + len;
+        (*msgs)++;
+    }
+    return (wire);
+}
+
+static double
+xfer_msec(uint wire, uint msgs)
+{
+    return ((wire * BYTE_USEC + msgs * EXCHANGE_USEC) / 1000);
+}
+
+/* dec_nsec() measures decompression of the session in 1 KB replies */
+static double
+dec_nsec(void)
+{
+    static uint8_t reply[LZ_PAYLOAD];
+    static uint8_t expand[BCL_MAX_LEN];
+    static uint    lens[SESSION_MAX / 64];
+    static uint    useds[SESSION_MAX / 64];
+    static uint8_t stream[SESSION_MAX * 2];
+    const uint     iters = 20;
+    uint           count = 0;
+    uint           spos = 0;
+    uint           pos = 0;
+    uint           iter;
+    uint           cur;
+    double         start;
+
+    while (pos < session_len) {
+        uint max = session_len - pos;
+        if (max > BCL_MAX_LEN)
+            max = BCL_MAX_LEN;
+        lens[count] = lzss_compress(session + pos, max, reply,
+                                    sizeof (reply), &useds[count]);
+        memcpy(stream + spos, reply, lens[count]);
+        spos += lens[count];
+        pos += useds[count++];
+    }
+    start = nsec_now();
+    for (iter = 0; iter < iters; iter++) {
+        for (cur = 0, spos = 0; cur < count; spos += lens[cur++])
+            lzss_decompress(stream + spos, lens[cur], expand, useds[cur]);
+    }
+    return ((nsec_now() - start) / iters / session_len);
+}
+
+static void
+test_sessions(void)
+{
+    static const struct {
+        const char *name;
+        void      (*gen)(void);
+    } kinds[] = {
+        { "memory dump",  gen_dump },
+        { "sensor table", gen_sensors },
+        { "debug log",    gen_log },
+        { "random bytes", gen_random },
+    };
+    uint cur;
+
+    printf("  %-13s %8s %8s %7s %12s %12s %7s %7s\n", "", "old", "new",
+           "ratio", "old time", "new time", "enc", "dec");
+    for (cur = 0; cur < ARRAY_SIZE(kinds); cur++) {
+        uint   old_msgs;
+        uint   new_msgs;
+        uint   old_wire;
+        uint   new_wire;
+        double old_ms;
+        double new_ms;
+        double enc;
+
+        session_len = 0;
+        kinds[cur].gen();
+        old_wire = drain_old(&old_msgs);
+        new_wire = drain_lz(&new_msgs, &enc);
+        old_ms = xfer_msec(old_wire, old_msgs);
+        new_ms = xfer_msec(new_wire, new_msgs);
+        printf("  %-13s %8u %8u %6.2fx %9.0f ms %9.0f ms %4.1f ns %4.1f ns\n",
+               kinds[cur].name, old_wire, new_wire,
+               (double) session_len / (new_wire - new_msgs * 2 *
+                                       (MSG_OVERHEAD + sizeof (bec_cons_lz_t))),
+               old_ms, new_ms, enc / session_len, dec_nsec());
+        CHECK(new_ms < old_ms);
+        if (kinds[cur].gen != gen_random)
+            CHECK(new_ms * 2 < old_ms);
+    }
+    printf("  (mailbox bytes for %u bytes of output; time at %.1f us per "
+           "byte and %u us per exchange;\n   enc and dec are host ns per "
+           "output byte)\n", SESSION_MAX, BYTE_USEC, EXCHANGE_USEC);
+}
+
+/* Match distance and length limits, and output which does not fit */
+static void
+test_limits(void)
+{
+    static uint8_t src[BCL_WINDOW * 2];
+    static uint8_t dst[sizeof (src) * 2];
+    static uint8_t expand[sizeof (src)];
+    uint           used;
+    uint           len;
+    uint           cur;
+
+    /* A long run is a chain of maximum length matches at distance 1 */
+    memset(src, 'x', sizeof (src));
+    len = lzss_compress(src, sizeof (src), dst, BEC_MSG_MAX_PAYLOAD, &used);
+    CHECK(used == sizeof (src));
+    CHECK(len <= 2 + (sizeof (src) / BCL_MAX_MATCH + 1) * 17 / 8);
+    CHECK(lzss_decompress(dst, len, expand, used) == used);
+    CHECK(memcmp(expand, src, used) == 0);
+
+    /* Repeats farther back than the window are sent as literals */
+    for (cur = 0; cur < sizeof (src); cur++)
+        src[cur] = rand_next(256);
+    memcpy(src + BCL_WINDOW + 100, src, 100);
+    len = lzss_compress(src, sizeof (src), dst, sizeof (dst), &used);
+    CHECK(lzss_decompress(dst, len, expand, used) == used);
+    CHECK(memcmp(expand, src, used) == 0);
+
+    /* Incompressible input stops when no whole group fits */
+    for (cur = 0; cur < 2 * (1 + 8 * 2); cur++) {
+        len = lzss_compress(src, sizeof (src), dst, cur, &used);
+        CHECK(len <= cur);
+        CHECK(lzss_decompress(dst, len, expand, used) == used);
+    }
+
+    /* Truncated and corrupt streams stop short without overrun */
+    memset(src, 'x', 64);
+    len = lzss_compress(src, 64, dst, sizeof (dst), &used);
+    CHECK(lzss_decompress(dst, len - 1, expand, 64) < 64);
+    dst[2] = 0xff;  // First match distance beyond output
+    CHECK(lzss_decompress(dst, len, expand, 64) < 64);
+}
+
+int
+main(void)
+{
+    printf("lzss:\n");
+    test_sessions();
+    test_limits();
+    return (test_result("lzss"));
+}
@@ -0,0 +1,575 @@
+/*
+ * This is free and unencumbered software released into the public domain.
+ * See the LICENSE file for additional details.
+ *
+ * Designed by Chris Hooper in 2025.
+ *
+ * ---------------------------------------------------------------------
+ *
+ * Host simulation of BEC mailbox sharing between Amiga tasks. Tasks are
+ * coroutines which exec would schedule at equal priority: round robin
+ * with a time quantum, where a switch which falls due under Forbid()
+ * is deferred to Permit(), and a SignalSemaphore is handed to waiters
+ * in arrival order. Each task sends BEC_CMD_LOOPBACK messages with
+ * send_cmd_retry() from amiga/becmsg.c through a model of the RP5C01
+ * mailbox registers and the BEC message handler (fw/amigartc.c), and
+ * must get back its own message. Tasks sending without the mailbox
+ * semaphore, as before it existed, are compared. Throughput, latency,
+ * and fairness among tasks are reported.
+ */
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ucontext.h>
+
+volatile uint16_t *mock_rtc_reg(unsigned int reg);
+volatile uint8_t  *mock_reg8(uintptr_t addr);
+
+#define RTC_REG(x)   (*mock_rtc_reg(x))
+#define VADDR8(x)    mock_reg8((uintptr_t) (x))
+#define VADDR16(x)   ((volatile uint16_t *) ((uintptr_t) (x)))
+#define VADDR32(x)   ((volatile uint32_t *) ((uintptr_t) (x)))
+#include "bec_host.c"
+#include "test.h"
+
+#define RTC_ACCESS_NSEC 1900       // RP5C01 register access
+#define CIA_ACCESS_NSEC 1400       // CIA register access (E clock)
+#define CIA_HZ          715909
+#define BEC_REPLY_NSEC  40000      // BEC handling before the reply starts
+#define QUANTUM_NSEC    80000000   // exec default quantum: 4 ticks
+#define WORK_NSEC       1000000    // Most CPU time a task uses per message
+#define RUN_NSEC        10000000000ULL
+#define MSG_MIN         4
+#define MSG_MAX         64
+#define MAX_TASKS       8
+#define TASK_STACK      (64 << 10)
+#define RTC_READ        0x8000     // Register slot not written by caller
+
+typedef struct task {
+    ucontext_t   ctx;
+    struct task *next;          // Ready or semaphore wait queue
+    uint         id;
+    uint         forbid;        // Forbid() nesting while switched out
+    uint         msgs;          // Messages echoed intact
+    uint         fails;         // Messages which failed
+    uint         crossed;       // Replies holding another task's message
+    uint64_t     lat_sum;       // Latency of intact messages
+    uint64_t     lat_max;
+    uint64_t     wait_max;      // Longest wait for the mailbox semaphore
+    uint8_t      stack[TASK_STACK];
+} task_t;
+
+static task_t     tasks[MAX_TASKS];
+static task_t    *cur;
+static task_t    *ready_head;
+static task_t    *ready_tail;
+static ucontext_t main_ctx;
+static uint64_t   sim_nsec;
+static uint64_t   quantum_end;
+static uint64_t   run_end;
+static uint       forbid_cnt;
+static uint       use_sem;
+static uint32_t   rand_state = 1;
+
+/* The "bec.mailbox" semaphore */
+static struct SignalSemaphore *sem_public;
+static task_t    *sem_owner;
+static uint       sem_nest;
+static task_t    *sem_head;
+static task_t    *sem_tail;
+
+/* BEC side of the mailbox */
+static uint8_t    bec_in[BEC_MSG_MAX_LEN];
+static uint       bec_in_len;
+static uint       bec_in_hi;
+static uint8_t    bec_out[BEC_MSG_MAX_LEN];
+static uint       bec_out_len;
+static uint       bec_out_pos;
+static uint64_t   bec_out_at;       // Time the reply becomes visible
+static int        rtc_reg = -1;     // Register of the last access
+static uint       rtc_advance;      // Last access was a reply nibble read
+static uint       bec_errors;       // Corrupt messages and unread replies
+static volatile uint16_t rtc_slot;
+
+static uint
+rand_next(uint range)
+{
+    rand_state = rand_state * 1103515245 + 12345;
+    return ((rand_state >> 8) % range);
+}
+
+static void
+q_put(task_t **head, task_t **tail, task_t *t)
+{
+    t->next = NULL;
+    if (*head == NULL)
+        *head = t;
+    else
+        (*tail)->next = t;
+    *tail = t;
+}
+
+static task_t *
+q_get(task_t **head, task_t **tail)
+{
+    task_t *t = *head;
+
+    if (t != NULL) {
+        *head = t->next;
+        if (*head == NULL)
+            *tail = NULL;
+    }
+    return (t);
+}
+
+/*
+ * task_switch() runs the next ready task. The current task must already
+ * be queued somewhere if it is to run again. When no task is ready, all
+ * have finished, and the simulation returns to main().
+ */
+static void
+task_switch(void)
+{
+    task_t *prev = cur;
+
+    prev->forbid = forbid_cnt;
+    cur = q_get(&ready_head, &ready_tail);
+    if (cur == NULL) {
+        swapcontext(&prev->ctx, &main_ctx);
+        return;
+    }
+    forbid_cnt  = cur->forbid;
+    quantum_end = sim_nsec + QUANTUM_NSEC;
+    if (cur != prev)
+        swapcontext(&prev->ctx, &cur->ctx);
+}
+
+/* task_preempt() switches tasks if the quantum has expired */
+static void
+task_preempt(void)
+{
+    if ((forbid_cnt == 0) && (sim_nsec >= quantum_end) &&
+        (ready_head != NULL)) {
+        q_put(&ready_head, &ready_tail, cur);
+        task_switch();
+    }
+}
+
+/* task_work() uses CPU time outside of BEC message exchanges */
+static void
+task_work(uint64_t nsec)
+{
+    while (nsec > 0) {
+        uint64_t step = (nsec > 100000) ? 100000 : nsec;
+        sim_nsec += step;
+        nsec -= step;
+        task_preempt();
+    }
+}
+
+void
+Forbid(void)
+{
+    forbid_cnt++;
+}
+
+void
+Permit(void)
+{
+    forbid_cnt--;
+    task_preempt();
+}
+
+struct SignalSemaphore *
+FindSemaphore(const char *name)
+{
+    if ((sem_public != NULL) && (strcmp(sem_public->ss_Link.ln_Name, name) == 0))
+        return (sem_public);
+    return (NULL);
+}
+
+void
+AddSemaphore(struct SignalSemaphore *sem)
+{
+    sem_public = sem;
+}
+
+void
+ObtainSemaphore(struct SignalSemaphore *sem)
+{
+    uint64_t start = sim_nsec;
+
+    (void) sem;
+    if ((sem_owner == NULL) || (sem_owner == cur)) {
+        sem_owner = cur;
+        sem_nest++;
+        return;
+    }
+    q_put(&sem_head, &sem_tail, cur);
+    task_switch();  // Resumes as owner
+    if (cur->wait_max < sim_nsec - start)
+        cur->wait_max = sim_nsec - start;
+}
+
+/* ReleaseSemaphore() hands the semaphore to the first waiter, as exec does */
+void
+ReleaseSemaphore(struct SignalSemaphore *sem)
+{
+    (void) sem;
+    if (--sem_nest != 0)
+        return;
+    sem_owner = q_get(&sem_head, &sem_tail);
+    if (sem_owner != NULL) {
+        sem_nest = 1;
+        q_put(&ready_head, &ready_tail, sem_owner);
+    }
+}
+
+/* bec_crc() is the message CRC as becmsg.c computes it on this host */
+static uint32_t
+bec_crc(uint8_t first, uint16_t len, const uint8_t *data)
+{
+    uint32_t crc = crc32(0, &first, 1);
+    crc = crc32(crc, &len, 2);
+    return (crc32(crc, data, len));
+}
+
+/*
+ * bec_handle() answers a complete message as msg_process_fast() does:
+ * BEC_CMD_LOOPBACK is echoed, and a bad CRC is answered BEC_STATUS_CRC.
+ */
+static void
+bec_handle(void)
+{
+    uint16_t len = (bec_in[3] << 8) | bec_in[4];
+    uint8_t *data = bec_in + BEC_MSG_HDR_LEN;
+    uint32_t got = (data[len] << 24) | (data[len + 1] << 16) |
+                   (data[len + 2] << 8) | data[len + 3];
+    uint8_t  status = bec_in[2];
+    uint32_t crc;
+
+    if (bec_out_pos < bec_out_len)
+        bec_errors++;  // Previous reply was not read
+    if (got != bec_crc(bec_in[2], len, data)) {
+        bec_errors++;
+        status = BEC_STATUS_CRC;
+        len    = 0;
+    } else if (bec_in[2] != BEC_CMD_LOOPBACK) {
+        status = BEC_STATUS_UNKCMD;
+        len    = 0;
+    }
+    bec_out[0] = 0xcd;
+    bec_out[1] = 0x68;
+    bec_out[2] = status;
+    bec_out[3] = len >> 8;
+    bec_out[4] = len;
+    memmove(bec_out + BEC_MSG_HDR_LEN, data, len);
+    crc = bec_crc(status, len, data);
+    bec_out[BEC_MSG_HDR_LEN + len + 0] = crc >> 24;
+    bec_out[BEC_MSG_HDR_LEN + len + 1] = crc >> 16;
+    bec_out[BEC_MSG_HDR_LEN + len + 2] = crc >> 8;
+    bec_out[BEC_MSG_HDR_LEN + len + 3] = crc;
+    bec_out_len = BEC_MSG_HDR_LEN + len + BEC_MSG_CRC_LEN;
+    bec_out_pos = 0;
+    bec_out_at  = sim_nsec + BEC_REPLY_NSEC;
+    bec_in_len  = 0;
+}
+
+/* bec_write() takes a nibble written by the Amiga, high nibble first */
+static void
+bec_write(uint reg, uint8_t data)
+{
+    uint8_t byte;
+
+    if (reg == RP_MAGIC_HI) {
+        bec_in_hi = data & 0xf;
+        return;
+    }
+    if (reg != RP_MAGIC_LO)
+        return;  // Mode register
+    byte = (bec_in_hi << 4) | (data & 0xf);
+    if ((bec_in_len < 2) && (byte != ((bec_in_len == 0) ? 0xcd : 0x68))) {
+        bec_in_len = 0;  // Not at the start of a message
+        return;
+    }
+    bec_in[bec_in_len++] = byte;
+    if (bec_in_len >= BEC_MSG_HDR_LEN) {
+        uint len = BEC_MSG_HDR_LEN + ((bec_in[3] << 8) | bec_in[4]) +
+                   BEC_MSG_CRC_LEN;
+        if (len > sizeof (bec_in))
+            bec_in_len = 0;
+        else if (bec_in_len == len)
+            bec_handle();
+    }
+}
+
+/* bec_read() presents the reply one nibble at a time, then zero */
+static uint
+bec_read(uint reg)
+{
+    if ((sim_nsec < bec_out_at) || (bec_out_pos >= bec_out_len))
+        return (0);
+    if (reg == RP_MAGIC_HI)
+        return (bec_out[bec_out_pos] >> 4);
+    if (reg == RP_MAGIC_LO)
+        return (bec_out[bec_out_pos] & 0xf);
+    return (0);
+}
+
+/*
+ * mock_commit() completes the previous register access. A register is
+ * returned to the caller as a slot which is either read or written; a
+ * write stores a byte, so clears RTC_READ.
+ */
+static void
+mock_commit(void)
+{
+    if (rtc_reg < 0)
+        return;
+    if ((rtc_slot & RTC_READ) == 0)
+        bec_write(rtc_reg, rtc_slot);
+    else if (rtc_advance)
+        bec_out_pos++;
+    rtc_reg = -1;
+}
+
+static void
+mock_access(uint nsec)
+{
+    mock_commit();
+    sim_nsec += nsec;
+    task_preempt();
+}
+
+volatile uint16_t *
+mock_rtc_reg(unsigned int reg)
+{
+    mock_access(RTC_ACCESS_NSEC);
+    rtc_reg     = reg;
+    rtc_slot    = RTC_READ | bec_read(reg);
+    rtc_advance = (reg == RP_MAGIC_LO) && (sim_nsec >= bec_out_at) &&
+                  (bec_out_pos < bec_out_len);
+    return (&rtc_slot);
+}
+
+/* mock_reg8() provides the CIA-A timer B count, running down from 0xffff */
+volatile uint8_t *
+mock_reg8(uintptr_t addr)
+{
+    static volatile uint8_t slot;
+    uint ticks;
+
+    mock_access(CIA_ACCESS_NSEC);
+    ticks = 0xffff - ((sim_nsec * CIA_HZ / 1000000000) & 0xffff);
+    slot = (addr == 0xbfe701) ? (ticks >> 8) :
+           (addr == 0xbfe601) ? (ticks & 0xff) : 0;
+    return (&slot);
+}
+
+/*
+ * old_send_cmd_retry() is send_cmd_retry() as it was before the mailbox
+ * semaphore: each exchange goes straight to the mailbox.
+ */
+static uint
+old_send_cmd_retry(uint8_t cmd, void *arg, uint16_t arglen,
+                   void *reply, uint replymax, uint *replyalen)
+{
+    uint tries = 10;
+    uint rc;
+
+    do {
+        rc = send_cmd_locked(cmd, arg, arglen, reply, replymax, replyalen);
+        if ((rc != BEC_STATUS_CRC) &&
+            (rc != BEC_STATUS_REPLYLEN) &&
+            (rc != BEC_STATUS_REPLYCRC) &&
+            (rc != BEC_STATUS_BADMAGIC) &&
+            (rc != BEC_STATUS_TIMEOUT)) {
+            break;
+        }
+    } while (--tries > 0);
+    return (rc);
+}
+
+/*
+ * task_main() sends messages tagged with the task and a sequence number,
+ * and does a random amount of other work after each, until the end of
+ * the run.
+ */
+static void
+task_main(void)
+{
+    task_t  *t = cur;
+    uint8_t  msg[MSG_MAX];
+    uint8_t  reply[MSG_MAX];
+    uint     seq = 0;
+
+    while (sim_nsec < run_end) {
+        uint     len = MSG_MIN + rand_next(MSG_MAX - MSG_MIN + 1);
+        uint64_t start = sim_nsec;
+        uint     rlen = 0;
+        uint     rc;
+        uint     pos;
+
+        msg[0] = t->id;
+        msg[1] = seq >> 8;
+        msg[2] = seq++;
+        for (pos = 3; pos < len; pos++)
+            msg[pos] = rand_next(256);
+        if (use_sem) {
+            rc = send_cmd_retry(BEC_CMD_LOOPBACK, msg, len,
+                                reply, sizeof (reply), &rlen);
+        } else {
+            rc = old_send_cmd_retry(BEC_CMD_LOOPBACK, msg, len,
+                                    reply, sizeof (reply), &rlen);
+        }
+        if ((rc == BEC_CMD_LOOPBACK) && (rlen == len) &&
+            (memcmp(msg, reply, len) == 0)) {
+            uint64_t lat = sim_nsec - start;
+            t->msgs++;
+            t->lat_sum += lat;
+            if (t->lat_max < lat)
+                t->lat_max = lat;
+        } else if ((rc == BEC_CMD_LOOPBACK) && (rlen > 0) &&
+                   (reply[0] != t->id)) {
+            t->crossed++;
+        } else {
+            t->fails++;
+        }
+        task_work(rand_next(WORK_NSEC));
+    }
+    task_switch();  // Not queued, so never resumes
+}
+
+typedef struct {
+    double msgs_per_sec;
+    double lat_avg_ms;
+    double lat_max_ms;
+    double wait_max_ms;
+    double fairness;        // Jain's index of messages per task
+    uint   errors;          // Mailbox errors seen by BEC
+    uint   fails;
+    uint   crossed;
+} run_result_t;
+
+/* task_create() queues a task which will run task_main() */
+static void
+task_create(task_t *t, uint id)
+{
+    t->id = id;
+    getcontext(&t->ctx);
+    t->ctx.uc_stack.ss_sp   = t->stack;
+    t->ctx.uc_stack.ss_size = sizeof (t->stack);
+    t->ctx.uc_link          = NULL;
+    makecontext(&t->ctx, task_main, 0);
+    q_put(&ready_head, &ready_tail, t);
+}
+
+/* run_tasks() runs ntasks copies of task_main() to the end of the run */
+static void
+run_tasks(uint ntasks)
+{
+    uint cur_task;
+
+    memset(tasks, 0, sizeof (tasks));
+    ready_head = NULL;
+    ready_tail = NULL;
+    sem_owner  = NULL;
+    sem_nest   = 0;
+    sem_head   = NULL;
+    sem_tail   = NULL;
+    forbid_cnt = 0;
+    bec_in_len = 0;
+    bec_out_len = 0;
+    bec_errors = 0;
+    sim_nsec   = 0;
+    run_end    = RUN_NSEC;
+    for (cur_task = 0; cur_task < ntasks; cur_task++)
+        task_create(&tasks[cur_task], cur_task + 1);
+    cur = q_get(&ready_head, &ready_tail);
+    quantum_end = QUANTUM_NSEC;
+    swapcontext(&main_ctx, &cur->ctx);
+    mock_commit();
+}
+
+static void
+run(uint ntasks, uint sem, run_result_t *res)
+{
+    double   sum = 0;
+    double   sumsq = 0;
+    uint64_t lat_sum = 0;
+    uint     msgs = 0;
+    uint     cur_task;
+
+    use_sem = sem;
+    run_tasks(ntasks);
+    memset(res, 0, sizeof (*res));
+    res->errors = bec_errors;
+    for (cur_task = 0; cur_task < ntasks; cur_task++) {
+        task_t *t = &tasks[cur_task];
+        sum   += t->msgs;
+        sumsq += (double) t->msgs * t->msgs;
+        msgs  += t->msgs;
+        lat_sum += t->lat_sum;
+        res->fails   += t->fails;
+        res->crossed += t->crossed;
+        if (res->lat_max_ms < t->lat_max / 1e6)
+            res->lat_max_ms = t->lat_max / 1e6;
+        if (res->wait_max_ms < t->wait_max / 1e6)
+            res->wait_max_ms = t->wait_max / 1e6;
+    }
+    res->msgs_per_sec = msgs / (sim_nsec / 1e9);
+    res->lat_avg_ms   = (msgs == 0) ? 0 : lat_sum / 1e6 / msgs;
+    res->fairness     = (sumsq == 0) ? 0 : sum * sum / (ntasks * sumsq);
+}
+
+static void
+test_contention(void)
+{
+    static const uint counts[] = { 1, 2, 4, 8 };
+    run_result_t      base;
+    uint              cur_count;
+
+    memset(&base, 0, sizeof (base));
+
+    printf("  %-7s %-36s %s\n", "", "arbitrated:", "unarbitrated:");
+    printf("  %-7s %6s %15s %5s %8s %6s %6s %6s %6s\n", "", "msg/s",
+           "latency avg/max", "fair", "sem wait", "msg/s", "errors", "failed",
+           "wrong");
+    for (cur_count = 0; cur_count < ARRAY_SIZE(counts); cur_count++) {
+        uint         ntasks = counts[cur_count];
+        run_result_t res;
+        run_result_t old;
+
+        run(ntasks, 1, &res);
+        run(ntasks, 0, &old);
+        if (ntasks == 1)
+            base = res;
+        printf("  %u %-5s %6.0f %5.2f/%5.2f ms %5.3f %5.1f ms %6.0f %6u %6u "
+               "%6u\n", ntasks, (ntasks == 1) ? "task" : "tasks",
+               res.msgs_per_sec, res.lat_avg_ms, res.lat_max_ms,
+               res.fairness, res.wait_max_ms, old.msgs_per_sec, old.errors,
+               old.fails, old.crossed);
+        CHECK(res.errors == 0);
+        CHECK(res.fails == 0);
+        CHECK(res.crossed == 0);
+        CHECK(res.fairness > 0.98);
+        CHECK(res.msgs_per_sec > base.msgs_per_sec * 0.9);
+        if (ntasks > 1)
+            CHECK(old.errors > 0);
+    }
+    printf("  (%u s simulated; %u-%u byte loopback messages; up to %u ms "
+           "of other work per message;\n   errors are corrupt messages "
+           "and unread replies; wrong replies held another task's message)\n",
+           (uint) (RUN_NSEC / 1000000000), MSG_MIN, MSG_MAX,
+           WORK_NSEC / 1000000);
+}
+
+int
+main(void)
+{
+    bec_msg_interface = BEC_MSG_INTERFACE_RTC;
+    printf("mailbox:\n");
+    test_contention();
+    return (test_result("mailbox"));
+}
@@ -0,0 +1,361 @@
+/*
+ * This is free and unencumbered software released into the public domain.
+ * See the LICENSE file for additional details.
+ *
+ * Designed by Chris Hooper in 2025.
+ *
+ * ---------------------------------------------------------------------
+ *
+ * Host test of the USB Mass Storage block bridge (fw/msc.c).
+ *
+ * The USB Host Library MSC class is replaced by a fake SCSI target
+ * which serves READ(10) and WRITE(10) from an in-memory disk image per
+ * logical unit. The test checks unit numbering, read correctness,
+ * read-ahead cache hits, multi-block transfers, write-through cache
+ * coherency, and error handling. A model of Full Speed Bulk-Only
+ * transport cost then compares the number of SCSI commands and bus
+ * time of sequential reads with and without read-ahead.
+ */
+
+#include "../fw/msc.c"
+#include <stdio.h>
+#include <stdlib.h>
+#include "test.h"
+
+#define DISK_BLOCKS     200   // Blocks per fake logical unit
+#define FAKE_DEVS       2
+#define FAKE_LUNS       2
+
+/* Full Speed Bulk-Only transport cost model */
+#define BOT_CMD_USEC    1000  // CBW + CSW + device command latency
+#define BOT_BLOCK_USEC  430   // One 512-byte block at ~1.2 MB/s
+
+USBH_HandleTypeDef usb_handle[2][MAX_HUB_PORTS + 1];
+
+static struct {
+    USBH_HandleTypeDef *phost;
+    USBH_ClassTypeDef   class;
+    MSC_HandleTypeDef   msc;
+    uint16_t            block_size;
+    uint8_t             unit_ready;
+    uint8_t             fail_io;
+    uint8_t            *disk[FAKE_LUNS];
+} fake[FAKE_DEVS];
+
+static struct {
+    uint     cmds;    // SCSI READ(10) / WRITE(10) commands issued
+    uint     blocks;  // Blocks transferred on the bus
+    uint64_t usec;    // Modeled bus time
+} bus;
+
+void
+fw_dprintf(uint32_t mask, const char *fmt, ...)
+{
+    (void) mask;
+    (void) fmt;
+}
+
+HAL_StatusTypeDef
+USBH_switch_to_dev(USBH_HandleTypeDef *phost)
+{
+    (void) phost;
+    return (HAL_OK);
+}
+
+static int
+fake_find(USBH_HandleTypeDef *phost)
+{
+    int dev;
+    for (dev = 0; dev < FAKE_DEVS; dev++)
+        if (fake[dev].phost == phost)
+            return (dev);
+    return (-1);
+}
+
+uint8_t
+USBH_MSC_IsReady(USBH_HandleTypeDef *phost)
+{
+    return (fake_find(phost) >= 0);
+}
+
+uint8_t
+USBH_MSC_UnitIsReady(USBH_HandleTypeDef *phost, uint8_t lun)
+{
+    int dev = fake_find(phost);
+    return ((dev >= 0) && (lun < fake[dev].msc.max_lun) &&
+            fake[dev].unit_ready);
+}
+
+USBH_StatusTypeDef
+USBH_MSC_GetLUNInfo(USBH_HandleTypeDef *phost, uint8_t lun,
+                    MSC_LUNTypeDef *info)
+{
+    int dev = fake_find(phost);
+    if ((dev < 0) || (lun >= fake[dev].msc.max_lun))
+        return (USBH_FAIL);
+    memset(info, 0, sizeof (*info));
+    info->capacity.block_size = fake[dev].block_size;
+    info->capacity.block_nbr  = DISK_BLOCKS;
+    return (USBH_OK);
+}
+
+static USBH_StatusTypeDef
+fake_xfer(USBH_HandleTypeDef *phost, uint8_t lun, uint32_t lba,
+          uint8_t *buf, uint32_t count, int write)
+{
+    int dev = fake_find(phost);
+    uint8_t *disk;
+
+    CHECK(dev >= 0);
+    CHECK(lba + count <= DISK_BLOCKS);
+    bus.cmds++;
+    bus.blocks += count;
+    bus.usec += BOT_CMD_USEC + count * BOT_BLOCK_USEC;
+    if (fake[dev].fail_io)
+        return (USBH_FAIL);
+    disk = fake[dev].disk[lun] + lba * MSC_BLOCK_SIZE;
+    if (write)
+        memcpy(disk, buf, count * MSC_BLOCK_SIZE);
+    else
+        memcpy(buf, disk, count * MSC_BLOCK_SIZE);
+    return (USBH_OK);
+}
+
+USBH_StatusTypeDef
+USBH_MSC_Read(USBH_HandleTypeDef *phost, uint8_t lun, uint32_t address,
+              uint8_t *pbuf, uint32_t length)
+{
+    return (fake_xfer(phost, lun, address, pbuf, length, 0));
+}
+
+USBH_StatusTypeDef
+USBH_MSC_Write(USBH_HandleTypeDef *phost, uint8_t lun, uint32_t address,
+               uint8_t *pbuf, uint32_t length)
+{
+    return (fake_xfer(phost, lun, address, pbuf, length, 1));
+}
+
+/*
+ * fake_attach() connects a fake Mass Storage device at the specified
+ * root port and hub port. Each block of each LUN is filled with a
+ * pattern identifying its device, LUN, and block number.
+ */
+static void
+fake_attach(int dev, uint port, uint hubport, uint luns)
+{
+    USBH_HandleTypeDef *phost = &usb_handle[port][hubport];
+    uint lun;
+    uint blk;
+    uint pos;
+
+    memset(&fake[dev], 0, sizeof (fake[dev]));
+    fake[dev].phost = phost;
+    fake[dev].class.ClassCode = USB_MSC_CLASS;
+    fake[dev].class.pData = &fake[dev].msc;
+    fake[dev].msc.max_lun = luns;
+    fake[dev].block_size = MSC_BLOCK_SIZE;
+    fake[dev].unit_ready = 1;
+    for (lun = 0; lun < luns; lun++) {
+        fake[dev].disk[lun] = malloc(DISK_BLOCKS * MSC_BLOCK_SIZE);
+        for (blk = 0; blk < DISK_BLOCKS; blk++)
+            for (pos = 0; pos < MSC_BLOCK_SIZE; pos++)
+                fake[dev].disk[lun][blk * MSC_BLOCK_SIZE + pos] =
+                    dev * 64 + lun * 32 + blk + pos;
+    }
+
+    phost->valid = 1;
+    phost->device.is_connected = 1;
+    phost->pActiveClass = &fake[dev].class;
+    phost->gState = HOST_CLASS;
+}
+
+static void
+fake_detach(int dev)
+{
+    USBH_HandleTypeDef *phost = fake[dev].phost;
+    uint lun;
+
+    phost->valid = 0;
+    phost->device.is_connected = 0;
+    phost->pActiveClass = NULL;
+    for (lun = 0; lun < FAKE_LUNS; lun++)
+        free(fake[dev].disk[lun]);
+    memset(&fake[dev], 0, sizeof (fake[dev]));
+    msc_invalidate();
+}
+
+static int
+blocks_match(const uint8_t *buf, int dev, uint lun, uint32_t lba, uint count)
+{
+    return (memcmp(buf, fake[dev].disk[lun] + lba * MSC_BLOCK_SIZE,
+                   count * MSC_BLOCK_SIZE) == 0);
+}
+
+static void
+test_units(void)
+{
+    uint32_t blocks;
+
+    CHECK(msc_unit_count() == 0);
+    CHECK(msc_info(0, &blocks) == BEC_STATUS_BADARG);
+
+    /* Units are numbered by root port, then hub port, then LUN */
+    fake_attach(1, 1, 0, 1);
+    fake_attach(0, 0, 3, 2);
+    CHECK(msc_unit_count() == 3);
+    CHECK(msc_info(2, &blocks) == BEC_STATUS_OK);
+    CHECK(blocks == DISK_BLOCKS);
+    CHECK(msc_info(3, &blocks) == BEC_STATUS_BADARG);
+
+    fake[1].unit_ready = 0;
+    CHECK(msc_info(2, &blocks) == BEC_STATUS_NODATA);
+    fake[1].unit_ready = 1;
+
+    fake[1].block_size = 2048;
+    CHECK(msc_info(2, &blocks) == BEC_STATUS_BADLEN);
+    fake[1].block_size = MSC_BLOCK_SIZE;
+}
+
+static void
+test_read(void)
+{
+    static uint8_t buf[MSC_CACHE_BLOCKS * MSC_BLOCK_SIZE];
+    uint32_t lba;
+    uint     misses = msc_cache.misses;
+    uint     hits = msc_cache.hits;
+
+    /* Single-block sequential reads refill the cache once per 8 blocks */
+    bus.cmds = 0;
+    for (lba = 0; lba < 64; lba++) {
+        CHECK(msc_read(0, lba, 1, buf) == BEC_STATUS_OK);
+        CHECK(blocks_match(buf, 0, 0, lba, 1));
+    }
+    CHECK(bus.cmds == 64 / MSC_CACHE_BLOCKS);
+    CHECK(msc_cache.misses - misses == 64 / MSC_CACHE_BLOCKS);
+    CHECK(msc_cache.hits - hits == 64 - 64 / MSC_CACHE_BLOCKS);
+
+    /* Multi-block read crossing the end of the cache refills at lba */
+    CHECK(msc_read(0, 62, 4, buf) == BEC_STATUS_OK);
+    CHECK(blocks_match(buf, 0, 0, 62, 4));
+    CHECK(msc_cache.lba == 62);
+
+    /* Same block number on another LUN must not hit the cache */
+    bus.cmds = 0;
+    CHECK(msc_read(1, 61, 2, buf) == BEC_STATUS_OK);
+    CHECK(blocks_match(buf, 0, 1, 61, 2));
+    CHECK(bus.cmds == 1);
+
+    /* Read-ahead is truncated at the end of the unit */
+    CHECK(msc_read(2, DISK_BLOCKS - 3, 3, buf) == BEC_STATUS_OK);
+    CHECK(blocks_match(buf, 1, 0, DISK_BLOCKS - 3, 3));
+    CHECK(msc_cache.count == 3);
+
+    CHECK(msc_read(0, DISK_BLOCKS - 1, 2, buf) == BEC_STATUS_BADARG);
+    CHECK(msc_read(0, DISK_BLOCKS, 1, buf) == BEC_STATUS_BADARG);
+    CHECK(msc_read(0, 0, 0, buf) == BEC_STATUS_BADLEN);
+    CHECK(msc_read(0, 0, MSC_CACHE_BLOCKS + 1, buf) == BEC_STATUS_BADLEN);
+}
+
+static void
+test_write(void)
+{
+    static uint8_t buf[MSC_CACHE_BLOCKS * MSC_BLOCK_SIZE];
+    static uint8_t wbuf[3 * MSC_BLOCK_SIZE];
+    uint cmds;
+
+    /* Write through the middle and the end of a cached range */
+    CHECK(msc_read(0, 10, 1, buf) == BEC_STATUS_OK);
+    memset(wbuf, 0xa5, sizeof (wbuf));
+    CHECK(msc_write(0, 16, 3, wbuf) == BEC_STATUS_OK);
+    CHECK(blocks_match(wbuf, 0, 0, 16, 3));
+
+    cmds = bus.cmds;
+    CHECK(msc_read(0, 15, 3, buf) == BEC_STATUS_OK);
+    CHECK(bus.cmds == cmds);  // Cache hit
+    CHECK(blocks_match(buf, 0, 0, 15, 3));
+
+    /* Writing another LUN leaves this LUN's cached blocks alone */
+    memset(wbuf, 0x5a, sizeof (wbuf));
+    CHECK(msc_write(1, 12, 1, wbuf) == BEC_STATUS_OK);
+    CHECK(msc_read(0, 12, 1, buf) == BEC_STATUS_OK);
+    CHECK(bus.cmds == cmds + 1);
+    CHECK(blocks_match(buf, 0, 0, 12, 1));
+
+    /* A failed write discards the cache */
+    fake[0].fail_io = 1;
+    CHECK(msc_write(0, 11, 1, wbuf) == BEC_STATUS_FAIL);
+    fake[0].fail_io = 0;
+    CHECK(msc_cache.count == 0);
+    CHECK(msc_read(0, 11, 1, buf) == BEC_STATUS_OK);
+    CHECK(bus.cmds == cmds + 3);
+    CHECK(blocks_match(buf, 0, 0, 11, 1));
+
+    CHECK(msc_write(0, DISK_BLOCKS - 1, 2, wbuf) == BEC_STATUS_BADARG);
+    CHECK(msc_write(0, 0, 0, wbuf) == BEC_STATUS_BADLEN);
+}
+
+static void
+test_busy_detach(void)
+{
+    static uint8_t buf[MSC_BLOCK_SIZE];
+
+    /* Another device mid-transaction on the same root port locks access */
+    usb_handle[0][1].valid = 1;
+    usb_handle[0][1].busy = 1;
+    CHECK(msc_read(0, 0, 1, buf) == BEC_STATUS_LOCKED);
+    CHECK(msc_read(2, 0, 1, buf) == BEC_STATUS_OK);  // Other root port
+    usb_handle[0][1].busy = 0;
+    usb_handle[0][1].valid = 0;
+
+    /* Detach renumbers units and discards the cache */
+    CHECK(msc_read(0, 0, 1, buf) == BEC_STATUS_OK);
+    fake_detach(0);
+    CHECK(msc_cache.count == 0);
+    CHECK(msc_unit_count() == 1);
+    CHECK(msc_read(0, 0, 1, buf) == BEC_STATUS_OK);
+    CHECK(blocks_match(buf, 1, 0, 0, 1));
+    fake_attach(0, 0, 3, 2);
+}
+
+/*
+ * bench_sequential() reads the whole unit in requests of the specified
+ * size and reports SCSI command count and modeled bus time against one
+ * SCSI command per request (no read-ahead).
+ */
+static void
+bench_sequential(uint count)
+{
+    static uint8_t buf[MSC_CACHE_BLOCKS * MSC_BLOCK_SIZE];
+    uint     reqs = 0;
+    uint32_t lba;
+    uint64_t old_usec;
+
+    msc_invalidate();
+    memset(&bus, 0, sizeof (bus));
+    for (lba = 0; lba + count <= DISK_BLOCKS; lba += count) {
+        CHECK(msc_read(0, lba, count, buf) == BEC_STATUS_OK);
+        reqs++;
+    }
+    old_usec = (uint64_t) reqs * BOT_CMD_USEC +
+               (uint64_t) reqs * count * BOT_BLOCK_USEC;
+    printf("  %u-block reads: %4u reqs  SCSI cmds %4u -> %3u  "
+           "bus %6.1f -> %6.1f ms (%.2fx)\n",
+           count, reqs, reqs, bus.cmds, old_usec / 1000.0,
+           bus.usec / 1000.0, (double) old_usec / bus.usec);
+}
+
+int
+main(void)
+{
+    test_units();
+    test_read();
+    test_write();
+    test_busy_detach();
+
+    printf("msc: sequential read of %u blocks, read-ahead %u blocks\n",
+           DISK_BLOCKS, MSC_CACHE_BLOCKS);
+    bench_sequential(1);
+    bench_sequential(2);
+    bench_sequential(4);
+    return (test_result("msc"));
+}
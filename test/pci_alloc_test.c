@@ -0,0 +1,480 @@
+/*
+ * This is free and unencumbered software released into the public domain.
+ * See the LICENSE file for additional details.
+ *
+ * Designed by Chris Hooper in 2025.
+ *
+ * ---------------------------------------------------------------------
+ *
+ * Host test of the PCI enumeration and allocation core (amiga/pci_alloc.c)
+ * against a mock configuration space. Each topology is scanned, then the
+ * programmed bus numbers, BARs, bridge windows, and command registers
+ * are checked. The number of configuration cycles of each scan is
+ * reported, as these dominate boot time on the Amiga. Random trees are
+ * then allocated, and the address space lost to alignment is compared
+ * with that of the bump allocator which this allocator replaced.
+ */
+
+#include <stdio.h>
+#include <stdarg.h>
+#include <string.h>
+
+static int verbose;
+
+static int
+pci_alloc_printf(const char *fmt, ...)
+{
+    va_list ap;
+    int     rc = 0;
+
+    if (verbose) {
+        va_start(ap, fmt);
+        rc = vprintf(fmt, ap);
+        va_end(ap);
+    }
+    return (rc);
+}
+
+#define printf pci_alloc_printf
+#include "../amiga/pci_alloc.c"
+#undef printf
+
+#include "pci_mock.h"
+#include "test.h"
+
+#define VD(vendor, device) ((vendor) | ((uint32_t) (device) << 16))
+
+#define SYNTH_TREES 2000   // Random trees of each bridge type
+
+/* AmigaPCI root windows, as set up by pci_alloc_scan_cached() */
+#define MEM_LO  0x80000000
+#define MEM_HI  0x9fbfffff
+#define PRE_LO  0xa0000000
+#define PRE_HI  0xfeffffff
+#define IO_LO   0x00000000
+#define IO_HI   0x001fffff
+
+static uint
+check_alloc(uint firestorm, uint *unassigned)
+{
+    if (firestorm)
+        return (mock_check(0x00000000, 0x1fbfffff, 1, 0, IO_LO, IO_HI,
+                           unassigned));
+    return (mock_check(MEM_LO, MEM_HI, PRE_LO, PRE_HI, IO_LO, IO_HI,
+                       unassigned));
+}
+
+static uint
+cmd_enabled(int idx)
+{
+    return ((mock_cfg32(&mock_func[idx], PCI_OFF_CMD) & 0x7) == 0x7);
+}
+
+/* A single card with I/O, memory, prefetchable, and ROM BARs */
+static void
+test_single(void)
+{
+    uint unassigned;
+    int  nic;
+
+    mock_reset();
+    nic = mock_add(0, 2, 0, VD(0x10ec, 0x8139), 0x00);
+    mock_bar(nic, 0, 0x100, MOCK_BAR_IO);
+    mock_bar(nic, 1, 0x1000, MOCK_BAR_MEM);
+    mock_bar(nic, 2, 0x100000, MOCK_BAR_MEM | MOCK_BAR_PRE);
+    mock_bar(nic, 6, 0x10000, MOCK_BAR_ROM);
+
+    CHECK(pci_alloc_scan(0) == 1);
+    CHECK(pci_alloc_dev_count == 1);
+    CHECK(check_alloc(0, &unassigned) == 0);
+    CHECK(unassigned == 0);
+    CHECK(cmd_enabled(nic));
+    CHECK(mock_func[nic].mf_cfg[PCI_OFF_LATENCYTIMER] == 0x80);
+    CHECK((mock_cfg32(&mock_func[nic], PCI_OFF_BAR2) & ~0xf) >= PRE_LO);
+    CHECK(mock_cfg32(&mock_func[nic], PCI_OFF_ROM_BAR) & 1);  // ROM enabled
+    printf("  single card: %u config reads, %u writes\n",
+           mock_reads, mock_writes);
+}
+
+/* Nested bridges with devices, a multi-function card, and a 64-bit BAR */
+static void
+test_bridges(void)
+{
+    uint unassigned;
+    uint seg1;
+    uint seg2;
+    int  idx;
+    int  br1;
+    int  br2;
+    int  vga;
+
+    mock_reset();
+    seg1 = mock_add_bridge(0, 1, VD(0x3388, 0x0021));
+    br1 = mock_funcs - 1;
+    idx = mock_add(seg1, 0, 0, VD(0x1000, 0x0001), 0x80);  // Multi-function
+    mock_bar(idx, 0, 0x400, MOCK_BAR_IO);
+    mock_bar(idx, 1, 0x400, MOCK_BAR_MEM);
+    idx = mock_add(seg1, 0, 1, VD(0x1000, 0x0002), 0x00);
+    mock_bar(idx, 0, 0x2000, MOCK_BAR_MEM);
+    seg2 = mock_add_bridge(seg1, 4, VD(0x8086, 0xb154));
+    br2 = mock_funcs - 1;
+    vga = mock_add(seg2, 0, 0, VD(0x5333, 0x8a22), 0x00);
+    mock_bar(vga, 0, 0x4000000, MOCK_BAR_MEM64 | MOCK_BAR_PRE);
+    mock_bar(vga, 2, 0x10000, MOCK_BAR_MEM);
+    idx = mock_add(0, 3, 0, VD(0x1102, 0x0002), 0x00);
+    mock_bar(idx, 0, 0x20, MOCK_BAR_IO);
+
+    CHECK(pci_alloc_scan(0) == 6);
+    CHECK(check_alloc(0, &unassigned) == 0);
+    CHECK(unassigned == 0);
+
+    /* Bus numbers are assigned depth first */
+    CHECK(mock_func[br1].mf_cfg[PCI_OFF_BR_SEC_BUS] == 1);
+    CHECK(mock_func[br1].mf_cfg[PCI_OFF_BR_SUB_BUS] == 2);
+    CHECK(mock_func[br2].mf_cfg[PCI_OFF_BR_PRI_BUS] == 1);
+    CHECK(mock_func[br2].mf_cfg[PCI_OFF_BR_SEC_BUS] == 2);
+    CHECK(mock_func[br2].mf_cfg[PCI_OFF_BR_SUB_BUS] == 2);
+    CHECK(mock_find(2, 0, 0) == vga);
+
+    /* 64-bit BAR has its upper half cleared */
+    CHECK(mock_cfg32(&mock_func[vga], PCI_OFF_BAR1) == 0);
+    for (idx = 0; idx < (int) mock_funcs; idx++)
+        CHECK(cmd_enabled(idx));
+    CHECK(mock_cfg32(&mock_func[br1], PCI_OFF_BR_CONTROL & ~3) >> 16 != 0);
+    printf("  nested bridges: %u config reads, %u writes\n",
+           mock_reads, mock_writes);
+
+    /* The checker itself must notice a BAR outside its bridge window */
+    printf("  expect a checker complaint:\n");
+    memcpy(&mock_func[vga].mf_cfg[PCI_OFF_BAR2],
+           &mock_func[br1 + 1].mf_cfg[PCI_OFF_BAR1], 4);
+    CHECK(check_alloc(0, &unassigned) != 0);
+}
+
+/* Firestorm has no prefetchable window; prefetchable BARs go in memory */
+static void
+test_firestorm(void)
+{
+    uint unassigned;
+    uint seg;
+    int  idx;
+
+    mock_reset();
+    seg = mock_add_bridge(0, 0, VD(0x3388, 0x0021));
+    idx = mock_add(seg, 1, 0, VD(0x5333, 0x8a22), 0x00);
+    mock_bar(idx, 0, 0x800000, MOCK_BAR_MEM | MOCK_BAR_PRE);
+    idx = mock_add(0, 2, 0, VD(0x10ec, 0x8139), 0x00);
+    mock_bar(idx, 0, 0x100, MOCK_BAR_IO);
+
+    CHECK(pci_alloc_scan(1) == 3);
+    CHECK(check_alloc(1, &unassigned) == 0);
+    CHECK(unassigned == 0);
+}
+
+/* More functions than the device table holds, and a window overflow */
+static void
+test_limits(void)
+{
+    uint unassigned;
+    uint seg;
+    uint dev;
+    int  idx;
+
+    mock_reset();
+    seg = mock_add_bridge(0, 0, VD(0x3388, 0x0021));
+    for (dev = 0; dev < PCI_ALLOC_MAX_DEVS + 4; dev++) {
+        idx = mock_add(seg, dev, 0, VD(0x1234, dev), 0x00);
+        mock_bar(idx, 0, 0x1000, MOCK_BAR_MEM);
+    }
+    CHECK(pci_alloc_scan(0) == PCI_ALLOC_MAX_DEVS);
+    CHECK(check_alloc(0, &unassigned) == 0);
+    CHECK(unassigned == 5);  // Functions which did not fit in the table
+
+    /* Memory demand larger than the memory window */
+    mock_reset();
+    for (dev = 0; dev < 4; dev++) {
+        idx = mock_add(0, dev, 0, VD(0x1234, dev), 0x00);
+        mock_bar(idx, 0, 0x10000000, MOCK_BAR_MEM);
+    }
+    CHECK(pci_alloc_scan(0) == 4);
+    CHECK(check_alloc(0, &unassigned) == 0);
+    CHECK(unassigned == 3);  // Only one 256 MB BAR fits below 0x9fc00000
+    CHECK(pci_win_mem.pw_fail == 3);
+}
+
+/*
+ * Model of the allocator which this one replaced: one bump pointer per
+ * address space, with prefetchable BARs in the memory window, and only
+ * the base of a BAR checked against the end of the window. It walks the
+ * device tree of the last scan in the same largest-first order.
+ */
+typedef struct {
+    uint32_t mem_start;
+    uint32_t mem_base;
+    uint32_t mem_max;
+    uint32_t mem_used;
+    uint32_t io_base;
+    uint32_t io_max;
+    uint     fail;       // BARs which were not assigned
+    uint     overrun;    // BARs which were assigned past the window end
+    uint     pre_in_mem; // Prefetchable BARs in non-prefetchable space
+} old_alloc_t;
+
+static old_alloc_t old;
+static uint8_t     old_done[PCI_ALLOC_MAX_DEVS];
+
+static uint32_t
+old_next(uint32_t *base, uint32_t max, uint32_t size)
+{
+    uint32_t next = ALIGN_UP(*base, size);
+
+    if (next > max) {
+        old.fail++;
+        return (0xffffffff);
+    }
+    if (size > max - next)
+        old.overrun++;
+    *base = next + size;
+    return (next);
+}
+
+static void
+old_allocate(pci_dev_t *parent_dev)
+{
+    pci_dev_t *cur;
+    pci_dev_t *maxdev;
+
+    while (1) {
+        uint32_t maxsize = 0;
+        int      maxbar = -1;
+        uint8_t *done;
+
+        maxdev = NULL;
+        for (cur = parent_dev->pd_child; cur != NULL; cur = cur->pd_next) {
+            uint is_bridge = (cur->pd_htype & 0x7F) == 1;
+            uint max_bars = is_bridge ? 3 : 7;
+            uint bar;
+
+            done = &old_done[cur - pci_dev_table];
+            for (bar = 0; bar < max_bars; bar++) {
+                if (*done & BIT(bar))
+                    continue;
+                if (maxsize < cur->pd_bar_size[bar]) {
+                    maxsize = cur->pd_bar_size[bar];
+                    maxdev  = cur;
+                    maxbar  = bar;
+                }
+            }
+            if (is_bridge && ((*done & BIT(7)) == 0) &&
+                ((maxsize < cur->pd_size) || (maxdev == NULL))) {
+                maxsize = cur->pd_size;
+                maxdev  = cur;
+                maxbar  = -1;
+            }
+        }
+        if (maxdev == NULL)
+            break;
+        done = &old_done[maxdev - pci_dev_table];
+
+        if (maxbar == -1) {
+            old.mem_base = ALIGN_UP(old.mem_base, SIZE_1MB);
+            old.io_base  = ALIGN_UP(old.io_base, SIZE_4KB);
+            old_allocate(maxdev);
+            old.mem_base = ALIGN_UP(old.mem_base, SIZE_1MB);
+            old.io_base  = ALIGN_UP(old.io_base, SIZE_4KB);
+            *done |= BIT(7);
+        } else {
+            uint8_t  type = maxdev->pd_bar_type[maxbar];
+            uint32_t size = maxdev->pd_bar_size[maxbar];
+
+            if (type & BIT(0)) {
+                old_next(&old.io_base, old.io_max, size);
+            } else if (old_next(&old.mem_base, old.mem_max, size) !=
+                       0xffffffff) {
+                old.mem_used += size;
+                if ((type & BIT(3)) && !(type & BIT(7)))
+                    old.pre_in_mem++;
+                if ((type & (BIT(7) | BIT(2) | BIT(1))) == BIT(2))
+                    *done |= BIT(maxbar + 1);
+            }
+            *done |= BIT(maxbar);
+        }
+    }
+}
+
+static void
+old_alloc_run(uint firestorm)
+{
+    memset(&old, 0, sizeof (old));
+    memset(old_done, 0, sizeof (old_done));
+    old.mem_start = firestorm ? 0x00000000 : 0x80000000;
+    old.mem_max   = firestorm ? 0x1fc00000 : 0x9fc00000;
+    old.mem_base  = old.mem_start;
+    old.io_max    = 0x00200000;
+    old_allocate(&pci_root_dev);
+}
+
+static uint32_t
+rand32(void)
+{
+    static uint32_t rand_state = 1;
+
+    rand_state = rand_state * 1103515245 + 12345;
+    return (rand_state >> 8);
+}
+
+/* rand_size() returns a power of two between 1 << lo and 1 << hi */
+static uint32_t
+rand_size(uint lo, uint hi)
+{
+    return (1U << (lo + rand32() % (hi - lo + 1)));
+}
+
+/*
+ * synth_function() adds a function with BARs of a random mix: I/O
+ * registers, memory registers, a large prefetchable aperture (sometimes
+ * 64-bit), and an expansion ROM.
+ */
+static void
+synth_function(uint seg, uint dev, uint func, uint htype)
+{
+    int  idx = mock_add(seg, dev, func, VD(0x1234, rand32() & 0xffff), htype);
+    uint bar = 0;
+
+    if (rand32() % 2)
+        mock_bar(idx, bar++, rand_size(4, 8), MOCK_BAR_IO);
+    if (rand32() % 4 != 0)
+        mock_bar(idx, bar++, rand_size(8, 20), MOCK_BAR_MEM);
+    if (rand32() % 3 == 0) {
+        if (rand32() % 2) {
+            mock_bar(idx, bar, rand_size(20, 26),
+                     MOCK_BAR_MEM | MOCK_BAR_PRE | MOCK_BAR_MEM64);
+            bar += 2;
+        } else {
+            mock_bar(idx, bar++, rand_size(16, 25),
+                     MOCK_BAR_MEM | MOCK_BAR_PRE);
+        }
+    }
+    if (rand32() % 3 == 0)
+        mock_bar(idx, 6, rand_size(14, 17), MOCK_BAR_ROM);
+}
+
+/* synth_bus() fills a bus segment with cards and nested bridges */
+static void
+synth_bus(uint seg, uint depth, uint slots)
+{
+    uint count = 1 + rand32() % slots;
+    uint dev;
+    uint func;
+
+    for (dev = 0; dev < count; dev++) {
+        if (mock_funcs + 4 > PCI_ALLOC_MAX_DEVS)
+            return;
+        if ((depth < 3) && (rand32() % 4 == 0)) {
+            synth_bus(mock_add_bridge(seg, dev, VD(0x3388, 0x0021)),
+                      depth + 1, 4);
+        } else if (rand32() % 5 == 0) {
+            uint funcs = 2 + rand32() % 3;
+            for (func = 0; func < funcs; func++)
+                synth_function(seg, dev, func, (func == 0) ? 0x80 : 0x00);
+        } else {
+            synth_function(seg, dev, 0, 0x00);
+        }
+    }
+}
+
+static uint32_t
+win_lost(const pci_window_t *win)
+{
+    uint32_t end = (win->pw_base > win->pw_max) ? win->pw_max : win->pw_base;
+    return (end - win->pw_start - win->pw_used);
+}
+
+/*
+ * test_synthetic() allocates random trees of cards and bridges. Every
+ * allocation must be valid, and every tree which the old allocator could
+ * place must be placed. Space lost to alignment is compared.
+ */
+static void
+test_synthetic(uint firestorm)
+{
+    uint     tree;
+    uint     unassigned;
+    uint     bad = 0;
+    uint     new_fail = 0;
+    uint     new_pre = 0;
+    uint     worse = 0;
+    uint64_t new_lost = 0;
+    uint64_t old_lost = 0;
+    uint64_t used = 0;
+    uint     old_fail = 0;
+    uint     old_overrun = 0;
+    uint     old_pre = 0;
+
+    for (tree = 0; tree < SYNTH_TREES; tree++) {
+        uint     fail;
+        uint32_t lost;
+        uint32_t olost;
+
+        mock_reset();
+        synth_bus(0, 0, PCI_MAX_PHYS_SLOT);
+        pci_alloc_scan(firestorm);
+        if (check_alloc(firestorm, &unassigned) != 0)
+            bad++;
+        fail = pci_win_mem.pw_fail + pci_win_io.pw_fail +
+               ((pci_win_prefetch != &pci_win_mem) ? pci_win_pre.pw_fail : 0);
+        CHECK(unassigned == fail);
+        lost = win_lost(&pci_win_mem);
+        if (pci_win_prefetch != &pci_win_mem) {
+            lost += win_lost(&pci_win_pre);
+            new_pre += pci_win_pre.pw_used != 0;
+        }
+
+        old_alloc_run(firestorm);
+        olost = old.mem_base - old.mem_start - old.mem_used;
+        if ((old.fail == 0) && (old.overrun == 0))
+            CHECK(fail == 0);
+        if (firestorm && (old.fail == 0) && (old.overrun == 0) &&
+            (lost > olost)) {
+            worse++;
+        }
+        new_fail    += fail;
+        new_lost    += lost;
+        used        += pci_win_mem.pw_used;
+        old_lost    += olost;
+        old_fail    += old.fail;
+        old_overrun += old.overrun;
+        old_pre     += (old.pre_in_mem != 0);
+    }
+    CHECK(bad == 0);
+    CHECK(new_lost <= old_lost);
+    if (firestorm)
+        CHECK(worse == 0);  // Same windows: never loses more space
+    else
+        CHECK(new_pre > 0);
+
+    printf("  %u random %s trees: memory lost to alignment "
+           "%llu KB per tree (old %llu KB)\n", SYNTH_TREES,
+           firestorm ? "Firestorm" : "AmigaPCI",
+           (unsigned long long) (new_lost / SYNTH_TREES >> 10),
+           (unsigned long long) (old_lost / SYNTH_TREES >> 10));
+    printf("    %u invalid, %u BARs unassigned; old: %u unassigned, "
+           "%u past window end\n", bad, new_fail, old_fail, old_overrun);
+    if (!firestorm)
+        printf("    prefetchable window used in %u trees; old put "
+               "prefetchable BARs in memory space in %u\n", new_pre, old_pre);
+}
+
+int
+main(int argc, char *argv[])
+{
+    verbose = (argc > 1) && (strcmp(argv[1], "-v") == 0);
+    printf("pci_alloc:\n");
+    test_single();
+    test_bridges();
+    test_firestorm();
+    test_limits();
+    test_synthetic(0);
+    test_synthetic(1);
+    return (test_result("pci_alloc"));
+}
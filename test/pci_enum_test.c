@@ -0,0 +1,278 @@
+/*
+ * This is free and unencumbered software released into the public domain.
+ * See the LICENSE file for additional details.
+ *
+ * Designed by Chris Hooper in 2025.
+ *
+ * ---------------------------------------------------------------------
+ *
+ * Host test of PCI enumeration by the pci tool (amiga/pci.c). Trees of
+ * cards and bridges with programmed bus numbers are placed in the mock
+ * configuration space, which counts every access across the bridge.
+ * lspci must find every function while probing only the buses which a
+ * bridge forwards to. A model of the enumeration it replaced, which
+ * guessed how many buses to probe and verified every probe, is run on
+ * the same trees for comparison.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+
+#include "pci_host.c"
+#include "pci_mock.h"
+#include "test.h"
+
+#define VD(vendor, device) ((vendor) | ((uint32_t) (device) << 16))
+
+typedef struct {
+    const char *name;
+    void      (*build)(void);
+} tree_t;
+
+void
+Delay(long ticks)
+{
+    (void) ticks;
+}
+
+void
+cia_spin(unsigned int ticks)
+{
+    (void) ticks;
+}
+
+/*
+ * bridge() places a bridge which has been programmed to forward the
+ * specified buses. Returns the segment behind it.
+ */
+static uint
+bridge(uint seg, uint dev, uint pri, uint sec, uint sub)
+{
+    uint         sec_seg = mock_add_bridge(seg, dev, VD(0x104c, 0x8240));
+    mock_func_t *mf = &mock_func[mock_funcs - 1];
+
+    mf->mf_cfg[PCI_OFF_BR_PRI_BUS] = pri;
+    mf->mf_cfg[PCI_OFF_BR_SEC_BUS] = sec;
+    mf->mf_cfg[PCI_OFF_BR_SUB_BUS] = sub;
+    return (sec_seg);
+}
+
+static void
+card(uint seg, uint dev, uint funcs)
+{
+    uint func;
+
+    for (func = 0; func < funcs; func++) {
+        int idx = mock_add(seg, dev, func, VD(0x1033, 0x0035 + func),
+                           ((funcs > 1) && (func == 0)) ? 0x80 : 0x00);
+        mock_bar(idx, 0, 0x1000, MOCK_BAR_MEM);
+    }
+}
+
+static void
+build_cards(void)
+{
+    card(0, 0, 1);
+    card(0, 1, 3);
+    card(0, 3, 1);
+}
+
+static void
+build_bridge(void)
+{
+    uint seg;
+
+    card(0, 0, 1);
+    seg = bridge(0, 1, 0, 1, 1);
+    card(seg, 0, 1);
+    card(seg, 1, 2);
+}
+
+static void
+build_nested(void)
+{
+    uint seg = bridge(0, 0, 0, 1, 3);
+    uint seg2;
+
+    seg2 = bridge(seg, 0, 1, 2, 2);
+    card(seg2, 0, 1);
+    card(seg2, 4, 1);
+    card(seg, 2, 1);
+    seg2 = bridge(seg, 3, 1, 3, 3);
+    card(seg2, 0, 3);
+}
+
+static void
+build_siblings(void)
+{
+    card(0, 0, 1);
+    card(bridge(0, 1, 0, 1, 1), 0, 1);
+    card(bridge(0, 2, 0, 2, 2), 0, 1);
+    card(bridge(0, 4, 0, 3, 3), 1, 1);
+}
+
+/* Firmware which leaves gaps in the bus numbers it assigns */
+static void
+build_sparse(void)
+{
+    card(0, 0, 1);
+    card(bridge(0, 2, 0, 4, 4), 0, 1);
+    card(bridge(0, 3, 0, 9, 9), 0, 2);
+}
+
+static const tree_t trees[] = {
+    { "cards",    build_cards },
+    { "bridge",   build_bridge },
+    { "nested",   build_nested },
+    { "siblings", build_siblings },
+    { "sparse",   build_sparse },
+};
+
+/*
+ * old_enum() models the enumeration which lspci used before: every
+ * probe was verified, and after each bus where a device was found, the
+ * next two buses were probed. Returns the number of functions found.
+ */
+static uint
+old_enum(void)
+{
+    uint bus;
+    uint dev;
+    uint func;
+    uint maxbus = PCI_MAX_BUS;
+    uint found = 0;
+
+    for (bus = 0; bus <= maxbus; bus++) {
+        uint maxdev = (bus == 0) ? PCI_MAX_PHYS_SLOT : PCI_MAX_DEV;
+
+        for (dev = 0; dev < maxdev; dev++) {
+            for (func = 0; func < PCI_MAX_FUNC; func++) {
+                uint32_t vd = pci_read32v(bus, dev, func, PCI_OFF_VENDOR);
+
+                if ((vd == 0xffffffff) || (vd == 0x00000000)) {
+                    if (func == 0) {
+                        if ((bus > 0) && (dev == 0) && (maxbus == PCI_MAX_BUS))
+                            maxbus = bus + 1;
+                        break;
+                    }
+                    continue;
+                }
+                if (maxbus < bus + 2)
+                    maxbus = bus + 2;
+                (void) pci_read32(bus, dev, func, PCI_OFF_CMD);
+                (void) pci_read32(bus, dev, func, PCI_OFF_REVISION);
+                found++;
+                if ((func == 0) &&
+                    ((pci_read32(bus, dev, func, PCI_OFF_HEADERTYPE & ~3) &
+                      (BIT(7) << 16)) == 0)) {
+                    break;
+                }
+            }
+        }
+    }
+    return (found);
+}
+
+/* listed() counts the functions shown by an "ls" view */
+static uint
+listed(const char *out)
+{
+    const char *pos;
+    uint        count = 0;
+    uint        bdf[3];
+    uint        vendor;
+    uint        device;
+
+    for (pos = out; pos != NULL; pos = strchr(pos, '\n')) {
+        if (*pos == '\n')
+            pos++;
+        if (sscanf(pos, "%x.%x.%x %x.%x", &bdf[0], &bdf[1], &bdf[2],
+                   &vendor, &device) == 5) {
+            count++;
+        }
+    }
+    return (count);
+}
+
+static void
+test_trees(void)
+{
+    uint cur;
+    uint new_total = 0;
+    uint old_total = 0;
+
+    printf("pci enum:\n");
+    printf("    tree      funcs  listed  reads  old reads  old found\n");
+    for (cur = 0; cur < ARRAY_SIZE(trees); cur++) {
+        uint new_reads;
+        uint old_reads;
+        uint old_found;
+        uint shown;
+
+        mock_reset();
+        trees[cur].build();
+
+        /* Every function is listed */
+        flags = FLAG_PCI_LS;
+        pci_host_outlen = 0;
+        pci_host_out[0] = '\0';
+        lspci(PCI_ANY_ID, PCI_ANY_ID, PCI_ANY_ID, PCI_ANY_ID, PCI_ANY_ID,
+              PCI_ANY_ID);
+        shown = listed(pci_host_out);
+        CHECK(shown == mock_funcs);
+
+        /* Enumeration alone: no display options */
+        flags = 0;
+        mock_reads = 0;
+        mock_writes = 0;
+        lspci(PCI_ANY_ID, PCI_ANY_ID, PCI_ANY_ID, PCI_ANY_ID, PCI_ANY_ID,
+              PCI_ANY_ID);
+        new_reads = mock_reads;
+
+        mock_reads = 0;
+        old_found = old_enum();
+        old_reads = mock_reads;
+
+        CHECK(mock_writes == 0);
+        CHECK(old_found <= mock_funcs);
+        if (old_found == mock_funcs)
+            CHECK(new_reads < old_reads);
+        else
+            CHECK(trees[cur].build == build_sparse);  // Old missed buses
+        printf("    %-9s %5u %7u %6u %10u %10u\n", trees[cur].name,
+               mock_funcs, shown, new_reads, old_reads, old_found);
+        new_total += new_reads;
+        old_total += old_reads;
+    }
+    printf("    all trees: %u config reads, old %u\n", new_total, old_total);
+    printf("    (reads include the command and class registers of each "
+           "function found;\n     old probing stops short of buses "
+           "numbered with gaps)\n");
+}
+
+/*
+ * test_filtered() checks that a device filter, which may hide the
+ * bridges, still reaches a function behind a bridge.
+ */
+static void
+test_filtered(void)
+{
+    mock_reset();
+    build_nested();
+    flags = FLAG_PCI_LS;
+    pci_host_outlen = 0;
+    pci_host_out[0] = '\0';
+    lspci(PCI_ANY_ID, 4, PCI_ANY_ID, PCI_ANY_ID, PCI_ANY_ID, PCI_ANY_ID);
+    CHECK(strstr(pci_host_out, "\n2.4.0 ") != NULL);
+    CHECK(listed(pci_host_out) == 1);
+}
+
+int
+main(void)
+{
+    test_trees();
+    test_filtered();
+    return (test_result("pci_enum"));
+}
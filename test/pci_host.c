@@ -0,0 +1,68 @@
+/*
+ * This is free and unencumbered software released into the public domain.
+ * See the LICENSE file for additional details.
+ *
+ * Designed by Chris Hooper in 2025.
+ *
+ * ---------------------------------------------------------------------
+ *
+ * Host build of the Amiga pci tool (amiga/pci.c), for tests of its
+ * decoders. Configuration space is that of the pci_mock.c functions.
+ * Output is collected in pci_host_out[], so that views may be compared.
+ * cpu_control.h only declares its 68k routines when built with _DCC;
+ * the byte swaps are provided here, and a test which reaches the CIA
+ * timer or Delay() provides those.
+ */
+
+#include <stdio.h>
+#include <stdarg.h>
+#include <stdint.h>
+#include <string.h>
+#include <amiga_host.h>
+
+#define PCI_HOST_OUT_MAX (256 << 10)
+
+static char pci_host_out[PCI_HOST_OUT_MAX];
+static uint pci_host_outlen;
+
+struct ExecBase *SysBase;
+struct ExecBase *DOSBase;
+
+void Delay(long ticks);
+
+static int
+pci_host_printf(const char *fmt, ...)
+{
+    va_list ap;
+    int     len;
+
+    va_start(ap, fmt);
+    len = vsnprintf(pci_host_out + pci_host_outlen,
+                    sizeof (pci_host_out) - pci_host_outlen, fmt, ap);
+    va_end(ap);
+    if (len > 0)
+        pci_host_outlen += len;
+    if (pci_host_outlen > sizeof (pci_host_out) - 1)
+        pci_host_outlen = sizeof (pci_host_out) - 1;
+    return (len);
+}
+
+#define main   pci_main
+#define printf pci_host_printf
+#include "../amiga/pci.c"
+#include "../amiga/pci_ids.c"
+#undef printf
+#undef main
+#include "../amiga/strtox.c"
+
+uint16_t
+swap16(uint16_t value)
+{
+    return (__builtin_bswap16(value));
+}
+
+uint32_t
+swap32(uint32_t value)
+{
+    return (__builtin_bswap32(value));
+}
@@ -0,0 +1,537 @@
+/*
+ * This is free and unencumbered software released into the public domain.
+ * See the LICENSE file for additional details.
+ *
+ * Designed by Chris Hooper in 2025.
+ *
+ * ---------------------------------------------------------------------
+ *
+ * Host test and benchmark of PCI vendor and device name lookup in the
+ * pci tool (amiga/pci_ids.c), with the built-in tables as generated by
+ * amiga/pci_idgen.c from amiga/pci_builtin.ids. Every built-in name must
+ * be found as listed. A synthesized pci.ids file of full size, with
+ * comments, subsystem lines, and a class section, is then used for names
+ * which are not built in. Lookup cost is compared with the linear scans
+ * of the tables, and of the file, which these replace.
+ */
+
+#include <stdio.h>
+#include <stdarg.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <time.h>
+#include <unistd.h>
+
+static unsigned int file_lines;  // Lines read from the external file
+
+static char *
+count_fgets(char *str, int size, FILE *fp)
+{
+    file_lines++;
+    return (fgets(str, size, fp));
+}
+
+static int
+pci_ids_printf(const char *fmt, ...)
+{
+    (void) fmt;
+    return (0);
+}
+
+#define fgets  count_fgets
+#define printf pci_ids_printf
+#include "../amiga/pci_ids.c"
+#undef printf
+#undef fgets
+#include "../amiga/strtox.c"
+
+#include "test.h"
+
+#define BUILTIN_IDS  "../amiga/pci_builtin.ids"
+#define MAX_REF      8192
+#define FILE_VENDORS 2400      // pci.ids of 2025 has about 2500 vendors
+#define FILE_DEVICES 120       // Device count of a large vendor
+#define BUS_FUNCS    24        // Functions on a fully populated bus
+#define M68K_PTR     4         // Pointer size on the Amiga
+
+#define ARRAY_SIZE(x) ((sizeof (x) / sizeof ((x)[0])))
+
+typedef struct {
+    uint32_t id;               // Vendor, or vendor << 16 | device
+    char     name[80];
+} ref_ent_t;
+
+/* Built-in names in list order, which the old tables were scanned in */
+static ref_ent_t ref_vendors[MAX_REF];
+static ref_ent_t ref_devices[MAX_REF];
+static uint      ref_vendor_count;
+static uint      ref_device_count;
+
+/* Names written to the synthesized pci.ids file */
+static ref_ent_t file_vendors[FILE_VENDORS];
+static ref_ent_t file_devices[FILE_VENDORS * 16];
+static uint      file_vendor_count;
+static uint      file_device_count;
+static char      file_name[] = "/tmp/pci_ids_test.XXXXXX";
+
+static uint32_t  rand_state = 1;
+
+static uint
+rand_next(uint range)
+{
+    rand_state = rand_state * 1103515245 + 12345;
+    return ((rand_state >> 8) % range);
+}
+
+static double
+nsec_now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (ts.tv_sec * 1e9 + ts.tv_nsec);
+}
+
+/* load_ref() reads pci_builtin.ids independently of the generator */
+static void
+load_ref(void)
+{
+    FILE *fp = fopen(BUILTIN_IDS, "r");
+    char  line[256];
+    uint  vendor = 0;
+    uint  id;
+    int   len;
+
+    CHECK(fp != NULL);
+    if (fp == NULL)
+        return;
+    while (fgets(line, sizeof (line), fp) != NULL) {
+        ref_ent_t *ent;
+        if (isxdigit((unsigned char) line[0]) &&
+            (sscanf(line, "%4x %n", &id, &len) == 1)) {
+            ent = &ref_vendors[ref_vendor_count++];
+            vendor = ent->id = id;
+        } else if ((line[0] == '\t') && (line[1] != '\t') &&
+                   (sscanf(line + 1, "%4x %n", &id, &len) == 1)) {
+            ent = &ref_devices[ref_device_count++];
+            ent->id = (vendor << 16) | id;
+            len++;
+        } else {
+            continue;
+        }
+        line[strcspn(line, "\r\n")] = '\0';
+        snprintf(ent->name, sizeof (ent->name), "%s", line + len);
+    }
+    fclose(fp);
+}
+
+/* old_vendor_name() is the lookup as it was: a scan of the list */
+static const char *
+old_vendor_name(uint16_t vendor, uint *probes)
+{
+    uint cur;
+
+    for (cur = 0; cur < ref_vendor_count; cur++) {
+        (*probes)++;
+        if (ref_vendors[cur].id == vendor)
+            return (ref_vendors[cur].name);
+    }
+    return (NULL);
+}
+
+static const char *
+old_device_name(uint16_t vendor, uint16_t device, uint *probes)
+{
+    uint32_t key = ((uint32_t) vendor << 16) | device;
+    uint     cur;
+
+    for (cur = 0; cur < ref_device_count; cur++) {
+        (*probes)++;
+        if (ref_devices[cur].id == key)
+            return (ref_devices[cur].name);
+    }
+    return (NULL);
+}
+
+/* ids_close() forgets the external file and everything cached from it */
+static void
+ids_close(void)
+{
+    pci_ids_device_t *pd;
+    uint              cur;
+
+    if (pci_ids_fp != NULL)
+        fclose(pci_ids_fp);
+    for (cur = 0; cur < pci_ids_count; cur++)
+        free(pci_ids_index[cur].pi_name);
+    free(pci_ids_index);
+    while ((pd = pci_ids_devices) != NULL) {
+        pci_ids_devices = pd->pd_next;
+        free(pd->pd_name);
+        free(pd);
+    }
+    pci_ids_fp       = NULL;
+    pci_ids_index    = NULL;
+    pci_ids_count    = 0;
+    pci_ids_filename = NULL;
+}
+
+/* The generated tables must be sorted, and each name in range */
+static void
+test_tables(void)
+{
+    uint cur;
+
+    CHECK(PCI_ID_VENDORS == ref_vendor_count);
+    CHECK(PCI_ID_DEVICES == ref_device_count);
+    for (cur = 1; cur < PCI_ID_VENDORS; cur++)
+        CHECK(pci_id_vendor[cur - 1] < pci_id_vendor[cur]);
+    for (cur = 1; cur < PCI_ID_DEVICES; cur++)
+        CHECK(pci_id_device[cur - 1] < pci_id_device[cur]);
+    for (cur = 0; cur < PCI_ID_VENDORS; cur++)
+        CHECK(pci_id_vendor_name[cur] < sizeof (pci_id_names));
+    for (cur = 0; cur < PCI_ID_DEVICES; cur++)
+        CHECK(pci_id_device_name[cur] < sizeof (pci_id_names));
+}
+
+/* Every built-in name is found without a file, and nothing else is */
+static void
+test_builtin(void)
+{
+    uint cur;
+
+    for (cur = 0; cur < ref_vendor_count; cur++) {
+        const char *name = pci_vendor_name(ref_vendors[cur].id);
+        CHECK((name != NULL) && (strcmp(name, ref_vendors[cur].name) == 0));
+    }
+    for (cur = 0; cur < ref_device_count; cur++) {
+        uint32_t    id   = ref_devices[cur].id;
+        const char *name = pci_device_name(id >> 16, id & 0xffff);
+        CHECK((name != NULL) && (strcmp(name, ref_devices[cur].name) == 0));
+    }
+    for (cur = 0; cur < 0x10000; cur += 7) {
+        uint probes = 0;
+        CHECK((pci_vendor_name(cur) == NULL) ==
+              (old_vendor_name(cur, &probes) == NULL));
+        CHECK((pci_device_name(0x121a, cur) == NULL) ==
+              (old_device_name(0x121a, cur, &probes) == NULL));
+    }
+    CHECK(pci_device_name(0x121a, 0x0004) == NULL);
+    CHECK(pci_device_name(0x5333, 0xffff) == NULL);
+    CHECK(file_lines == 0);
+}
+
+/*
+ * gen_file() writes a pci.ids file of realistic size and shape. It holds
+ * every built-in vendor, some of those vendors' devices which are not
+ * built in, and unrelated lines a lookup must step over.
+ */
+static void
+gen_file(void)
+{
+    FILE    *fp;
+    int      fd = mkstemp(file_name);
+    uint32_t vendor = 0;
+    uint     ref = 0;
+    uint     cur;
+
+    CHECK(fd >= 0);
+    fp = fdopen(fd, "w");
+    if (fp == NULL)
+        return;
+    fprintf(fp, "#\n#\tList of PCI ID's\n#\n# Version: 2025.06.01\n#\n\n"
+                "# Vendors, devices and subsystems. Please keep sorted.\n\n"
+                "# Syntax:\n# vendor  vendor_name\n"
+                "#\tdevice  device_name\t\t\t\t<-- single tab\n"
+                "#\t\tsubvendor subdevice  subsystem_name\t<-- two tabs\n\n");
+    while (file_vendor_count < FILE_VENDORS) {
+        ref_ent_t *ve = &file_vendors[file_vendor_count++];
+        uint       devs;
+        uint       dev = 0;
+
+        /* Built-in vendors are in the file too */
+        vendor += 1 + rand_next(20);
+        if ((ref < ref_vendor_count) && (ref_vendors[ref].id <= vendor))
+            vendor = ref_vendors[ref++].id;
+        if (vendor > 0xfffe)
+            break;
+        ve->id = vendor;
+        snprintf(ve->name, sizeof (ve->name), "Vendor %04x %s", vendor,
+                 rand_next(2) ? "Corporation" : "Inc.");
+        fprintf(fp, "%04x  %s\n", vendor, ve->name);
+        if (rand_next(40) == 0)
+            fprintf(fp, "# Acquired by another vendor\n");
+
+        devs = rand_next(8) ? rand_next(12) : rand_next(FILE_DEVICES);
+        if (file_device_count + devs > ARRAY_SIZE(file_devices))
+            devs = ARRAY_SIZE(file_devices) - file_device_count;
+        for (cur = 0; cur < devs; cur++) {
+            ref_ent_t *de;
+            uint       subs = rand_next(4) ? 0 : rand_next(6);
+
+            dev += 1 + rand_next(30);
+            if (dev > 0xffff)
+                break;
+            de = &file_devices[file_device_count++];
+            de->id = (vendor << 16) | dev;
+            snprintf(de->name, sizeof (de->name), "Device %04x [%s %u]", dev,
+                     rand_next(2) ? "Controller" : "Adapter", rand_next(100));
+            fprintf(fp, "\t%04x  %s\n", dev, de->name);
+            /* Subsystem IDs look like device IDs, and must not match */
+            while (subs-- > 0)
+                fprintf(fp, "\t\t%04x %04x  Subsystem %u\n",
+                        dev + 1, dev + 1, subs);
+        }
+    }
+    fprintf(fp, "\n# List of known device classes, subclasses and "
+                "programming interfaces\n\nC 00  Unclassified device\n"
+                "\t00  Non-VGA unclassified device\nC 01  Mass storage "
+                "controller\n\t00  SCSI storage controller\n");
+    fclose(fp);
+}
+
+static const ref_ent_t *
+file_device_find(uint32_t id)
+{
+    uint cur;
+
+    for (cur = 0; cur < file_device_count; cur++)
+        if (file_devices[cur].id == id)
+            return (&file_devices[cur]);
+    return (NULL);
+}
+
+/* Names which are not built in come from the file, and are cached */
+static void
+test_file(void)
+{
+    const char *name;
+    const char *again;
+    uint        cur;
+    uint        lines;
+
+    /* A missing file is reported once, and lookups still work */
+    pci_ids_filename = "/nonexistent/pci.ids";
+    CHECK(pci_vendor_name(0x0001) == NULL);
+    CHECK(pci_ids_filename == NULL);
+    CHECK(strcmp(pci_vendor_name(0x8086), "Intel") == 0);
+
+    pci_ids_filename = file_name;
+    for (cur = 0; cur < file_vendor_count; cur += 1 + rand_next(40)) {
+        const ref_ent_t *ve = &file_vendors[cur];
+        uint             probes = 0;
+
+        name = pci_vendor_name(ve->id);
+        if (old_vendor_name(ve->id, &probes) != NULL)
+            CHECK(strcmp(name, old_vendor_name(ve->id, &probes)) == 0);
+        else
+            CHECK((name != NULL) && (strcmp(name, ve->name) == 0));
+    }
+    /* First vendor in the file, found from the start of the file */
+    name = pci_vendor_name(file_vendors[0].id);
+    CHECK((name != NULL) && (strcmp(name, file_vendors[0].name) == 0));
+
+    for (cur = 0; cur < file_device_count; cur += 1 + rand_next(60)) {
+        uint32_t id = file_devices[cur].id;
+        name = pci_device_name(id >> 16, id & 0xffff);
+        if ((id >> 16) == 0x121a || (id >> 16) == 0x5333)
+            continue;  // May be built in under a different name
+        CHECK((name != NULL) && (strcmp(name, file_devices[cur].name) == 0));
+
+        /* The subsystem ID following this device is not a device */
+        if (file_device_find(id + 1) == NULL)
+            CHECK(pci_device_name(id >> 16, (id + 1) & 0xffff) == NULL);
+    }
+
+    /* Misses are cached too: nothing more is read */
+    name  = pci_device_name(file_devices[5].id >> 16, 0xfffe);
+    lines = file_lines;
+    again = pci_device_name(file_devices[5].id >> 16, 0xfffe);
+    CHECK((name == NULL) && (again == NULL) && (file_lines == lines));
+    name  = pci_device_name(file_devices[9].id >> 16,
+                            file_devices[9].id & 0xffff);
+    lines = file_lines;
+    again = pci_device_name(file_devices[9].id >> 16,
+                            file_devices[9].id & 0xffff);
+    CHECK((name == again) && (file_lines == lines));
+
+    /* A vendor which is not in the file at all */
+    CHECK(pci_vendor_name(0xffff) == NULL);
+    CHECK(pci_device_name(0xffff, 0x0001) == NULL);
+    ids_close();
+}
+
+/*
+ * old_file_lookup() is a scan of the file from its start for each name,
+ * as a simple lookup of names which are not built in would do. Returns
+ * non-zero if the name was found.
+ */
+static uint
+old_file_lookup(FILE *fp, uint16_t vendor, uint device)
+{
+    char line[256];
+    char *name;
+    int  in_vendor = 0;
+
+    rewind(fp);
+    while (fgets(line, sizeof (line), fp) != NULL) {
+        file_lines++;
+        if ((line[0] == '#') || (line[0] == '\n'))
+            continue;
+        if (line[0] == 'C')
+            break;
+        if (line[0] != '\t') {
+            if (in_vendor)
+                return (0);
+            in_vendor = (pci_ids_parse(line, &name) == vendor);
+            if (in_vendor && (device == PCI_ANY_ID))
+                return (1);
+        } else if (in_vendor && (line[1] != '\t') &&
+                   (pci_ids_parse(line + 1, &name) == (int) device)) {
+            return (1);
+        }
+    }
+    return (0);
+}
+
+/*
+ * test_bench() compares lookup of the names shown for a fully populated
+ * bus, first the built-in names, then names in the file. lspci -v looks
+ * up each function's vendor and device, then its subsystem vendor and
+ * device.
+ */
+static void
+test_bench(void)
+{
+    static uint32_t bus[BUS_FUNCS * 2];
+    const uint      iters = 200;
+    uint            old_probes = 0;
+    uint            new_probes;
+    uint            old_size;
+    uint            new_size;
+    uint            old_lines;
+    uint            new_lines;
+    uint            found = 0;
+    uint            iter;
+    uint            cur;
+    double          start;
+    double          old_ns;
+    double          new_ns;
+    double          old_ms;
+    double          new_ms;
+    FILE           *fp;
+
+    /* Built-in tables: half found, half not (as subsystem IDs often are) */
+    for (cur = 0; cur < ARRAY_SIZE(bus); cur++) {
+        if ((cur & 1) == 0) {
+            ref_ent_t *ve = &ref_vendors[rand_next(ref_vendor_count)];
+            bus[cur] = (ve->id << 16) | rand_next(0x10000);
+        } else {
+            bus[cur] = ref_devices[rand_next(ref_device_count)].id;
+        }
+    }
+    start = nsec_now();
+    for (iter = 0; iter < iters; iter++) {
+        for (cur = 0; cur < ARRAY_SIZE(bus); cur++) {
+            found += old_vendor_name(bus[cur] >> 16, &old_probes) != NULL;
+            found += old_device_name(bus[cur] >> 16, bus[cur] & 0xffff,
+                                     &old_probes) != NULL;
+        }
+    }
+    old_ns = (nsec_now() - start) / iters / ARRAY_SIZE(bus) / 2;
+    start = nsec_now();
+    for (iter = 0; iter < iters; iter++) {
+        for (cur = 0; cur < ARRAY_SIZE(bus); cur++) {
+            found -= pci_vendor_name(bus[cur] >> 16) != NULL;
+            found -= pci_device_name(bus[cur] >> 16,
+                                     bus[cur] & 0xffff) != NULL;
+        }
+    }
+    new_ns = (nsec_now() - start) / iters / ARRAY_SIZE(bus) / 2;
+    CHECK(found == 0);
+    old_probes /= iters * ARRAY_SIZE(bus);
+    for (new_probes = 0; (1U << new_probes) <= ref_vendor_count; new_probes++)
+        ;
+    for (cur = 0; (1U << cur) <= ref_device_count; cur++)
+        ;
+    new_probes += cur;
+
+    /* Amiga size: entries of ID and name pointer, plus each name */
+    old_size = ref_vendor_count * (2 + M68K_PTR) +
+               ref_device_count * (4 + M68K_PTR);
+    for (cur = 0; cur < ref_vendor_count; cur++)
+        old_size += strlen(ref_vendors[cur].name) + 1;
+    for (cur = 0; cur < ref_device_count; cur++)
+        old_size += strlen(ref_devices[cur].name) + 1;
+    new_size = sizeof (pci_id_vendor) + sizeof (pci_id_vendor_name) +
+               sizeof (pci_id_device) + sizeof (pci_id_device_name) +
+               sizeof (pci_id_names);
+    CHECK(new_probes * 2 < old_probes);
+    CHECK(new_size < old_size);
+
+    printf("  %-22s %14s %14s\n", "", "linear scan", "sorted");
+    printf("  %-22s %8u bytes %8u bytes\n", "built-in table size",
+           old_size, new_size);
+    printf("  %-22s %8u       %8u\n", "built-in probes/name",
+           old_probes / 2, new_probes / 2);
+    printf("  %-22s %8.1f ns    %8.1f ns\n", "built-in host time", old_ns,
+           new_ns);
+
+    /* External file: functions whose names are only in the file */
+    for (cur = 0; cur < ARRAY_SIZE(bus); cur++) {
+        const ref_ent_t *de;
+        do {
+            de = &file_devices[rand_next(file_device_count)];
+        } while (old_vendor_name(de->id >> 16, &old_probes) != NULL);
+        bus[cur] = de->id;
+    }
+    fp = fopen(file_name, "r");
+    CHECK(fp != NULL);
+    if (fp == NULL)
+        return;
+    file_lines = 0;
+    start = nsec_now();
+    for (cur = 0; cur < ARRAY_SIZE(bus); cur++) {
+        CHECK(old_file_lookup(fp, bus[cur] >> 16, PCI_ANY_ID));
+        CHECK(old_file_lookup(fp, bus[cur] >> 16, bus[cur] & 0xffff));
+    }
+    old_ms = (nsec_now() - start) / 1e6;
+    old_lines = file_lines;
+    fclose(fp);
+
+    pci_ids_filename = file_name;
+    file_lines = 0;
+    start = nsec_now();
+    for (cur = 0; cur < ARRAY_SIZE(bus); cur++) {
+        CHECK(pci_vendor_name(bus[cur] >> 16) != NULL);
+        CHECK(pci_device_name(bus[cur] >> 16, bus[cur] & 0xffff) != NULL);
+    }
+    new_ms = (nsec_now() - start) / 1e6;
+    new_lines = file_lines;
+    ids_close();
+    CHECK(new_lines * 4 < old_lines);
+
+    printf("  %-22s %8u       %8u\n", "file lines read", old_lines,
+           new_lines);
+    printf("  %-22s %8.2f ms    %8.2f ms\n", "file host time", old_ms,
+           new_ms);
+    printf("  (%u built-in vendors and %u devices, where sorted probes are "
+           "the most taken;\n   %u functions and their subsystem IDs; file "
+           "of %u vendors and %u devices)\n",
+           ref_vendor_count, ref_device_count, BUS_FUNCS, file_vendor_count,
+           file_device_count);
+}
+
+int
+main(void)
+{
+    printf("pci_ids:\n");
+    load_ref();
+    test_tables();
+    test_builtin();
+    gen_file();
+    test_file();
+    test_bench();
+    unlink(file_name);
+    return (test_result("pci_ids"));
+}
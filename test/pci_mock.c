@@ -0,0 +1,707 @@
+/*
+ * This is free and unencumbered software released into the public domain.
+ * See the LICENSE file for additional details.
+ *
+ * Designed by Chris Hooper in 2025.
+ *
+ * ---------------------------------------------------------------------
+ *
+ * Mock PCI configuration space for host tests of the Amiga PCI code.
+ *
+ * Functions are placed on bus segments rather than bus numbers. The root
+ * bus is segment 0, and each bridge leads to its own segment. A bus number
+ * is routed to a segment only once software has programmed the secondary
+ * bus number of the bridge in front of it, as on real hardware. BARs
+ * behave as sized registers: the low address bits read back as zero and
+ * the type bits are fixed. Vendor, device, and header type are read-only.
+ * This file provides the pci_read*() and pci_write*() interface which
+ * pci_access.c provides on the Amiga, with a Firestorm root bridge.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <exec/types.h>
+#include <clib/expansion_protos.h>
+#include "pci_access.h"
+#include "pci_mock.h"
+
+static struct ConfigDev mock_cdev = {
+    .cd_BoardAddr = (APTR) 0x40000000,
+    .cd_BoardSize = 0x20000000,
+};
+
+struct ConfigDev *pci_zorro_cdev = &mock_cdev;
+uint8_t  bridge_type = BRIDGE_TYPE_FIRESTORM;
+uint16_t bridge_zorro_mfg = 0x0e3b;
+uint16_t bridge_zorro_prod = 0x00c8;
+uint8_t *bridge_pci0_base;
+uint8_t *bridge_pci1_base;
+void    *bridge_io_base;
+void    *bridge_mem_base;
+uint32_t bridge_map_base;
+
+mock_func_t mock_func[MOCK_MAX_FUNCS];
+uint        mock_funcs;
+uint        mock_segs;
+uint        mock_reads;
+uint        mock_writes;
+uint        mock_block_fail;
+mock_hook_t mock_hook;
+
+static uint
+mock_is_bridge(const mock_func_t *mf)
+{
+    return ((mf->mf_cfg[PCI_OFF_HEADERTYPE] & 0x7f) == 1);
+}
+
+uint32_t
+mock_cfg32(const mock_func_t *mf, uint off)
+{
+    return (mf->mf_cfg[off] | (mf->mf_cfg[off + 1] << 8) |
+            (mf->mf_cfg[off + 2] << 16) |
+            ((uint32_t) mf->mf_cfg[off + 3] << 24));
+}
+
+static uint
+mock_cfg16(const mock_func_t *mf, uint off)
+{
+    return (mf->mf_cfg[off] | (mf->mf_cfg[off + 1] << 8));
+}
+
+void
+mock_reset(void)
+{
+    memset(mock_func, 0, sizeof (mock_func));
+    mock_funcs  = 0;
+    mock_segs   = 1;
+    mock_reads  = 0;
+    mock_writes = 0;
+    mock_hook   = NULL;
+    mock_block_fail = 0;
+}
+
+/*
+ * mock_add() places a function with the specified device / vendor ID
+ * and header type on a bus segment. Returns the function index.
+ */
+int
+mock_add(uint seg, uint dev, uint func, uint32_t vd, uint htype)
+{
+    mock_func_t *mf;
+
+    if (mock_funcs >= MOCK_MAX_FUNCS)
+        return (-1);
+    mf = &mock_func[mock_funcs];
+    mf->mf_seg  = seg;
+    mf->mf_dev  = dev;
+    mf->mf_func = func;
+    mf->mf_cfg[0] = vd;
+    mf->mf_cfg[1] = vd >> 8;
+    mf->mf_cfg[2] = vd >> 16;
+    mf->mf_cfg[3] = vd >> 24;
+    mf->mf_cfg[PCI_OFF_HEADERTYPE] = htype;
+    return (mock_funcs++);
+}
+
+/*
+ * mock_remove() takes a function out of the system. Indexes of the
+ * functions which follow it shift down by one.
+ */
+void
+mock_remove(int idx)
+{
+    memmove(&mock_func[idx], &mock_func[idx + 1],
+            (mock_funcs - idx - 1) * sizeof (mock_func[0]));
+    mock_funcs--;
+}
+
+/*
+ * mock_add_bridge() places a PCI-to-PCI bridge on a bus segment.
+ * Returns the segment number behind the bridge.
+ */
+uint
+mock_add_bridge(uint seg, uint dev, uint32_t vd)
+{
+    int idx = mock_add(seg, dev, 0, vd, 0x01);
+
+    mock_func[idx].mf_sec_seg = mock_segs;
+    mock_func[idx].mf_cfg[PCI_OFF_CLASS] = PCI_CLASS_PCI_BRIDGE >> 8;
+    mock_func[idx].mf_cfg[PCI_OFF_SUBCLASS] = PCI_CLASS_PCI_BRIDGE & 0xff;
+    return (mock_segs++);
+}
+
+/*
+ * mock_bar() gives a function a BAR of the specified size and type.
+ * BAR 6 (BAR 2 of a bridge) is the expansion ROM.
+ */
+void
+mock_bar(int idx, uint bar, uint32_t size, uint type)
+{
+    mock_func_t *mf = &mock_func[idx];
+    uint         off = PCI_OFF_BAR0 + bar * 4;
+
+    mf->mf_bar_size[bar] = size;
+    if (type & MOCK_BAR_ROM)
+        return;
+    mf->mf_cfg[off] = type;
+    if (type & MOCK_BAR_MEM64)
+        mf->mf_bar_size[bar + 1] = 0;  // Upper half is a plain register
+}
+
+/*
+ * mock_seg_bus() returns the bus number by which a segment is currently
+ * reached, or -1 if the bridges in front of it are not yet programmed.
+ */
+static int
+mock_seg_bus(uint seg)
+{
+    uint idx;
+
+    if (seg == 0)
+        return (0);
+    for (idx = 0; idx < mock_funcs; idx++) {
+        mock_func_t *mf = &mock_func[idx];
+        uint sec;
+        uint sub;
+
+        if (!mock_is_bridge(mf) || (mf->mf_sec_seg != seg))
+            continue;
+        sec = mf->mf_cfg[PCI_OFF_BR_SEC_BUS];
+        sub = mf->mf_cfg[PCI_OFF_BR_SUB_BUS];
+        if ((sec == 0) || (sub < sec) || (mock_seg_bus(mf->mf_seg) < 0))
+            return (-1);
+        return (sec);
+    }
+    return (-1);
+}
+
+/*
+ * mock_find() locates the function which responds to a configuration
+ * cycle. Returns -1 if nothing responds (master abort).
+ */
+int
+mock_find(uint bus, uint dev, uint func)
+{
+    uint idx;
+
+    for (idx = 0; idx < mock_funcs; idx++) {
+        mock_func_t *mf = &mock_func[idx];
+        if ((mf->mf_dev == dev) && (mf->mf_func == func) &&
+            (mock_seg_bus(mf->mf_seg) == (int) bus)) {
+            return (idx);
+        }
+    }
+    return (-1);
+}
+
+/*
+ * mock_bar_index() returns the BAR number of a BAR register offset,
+ * or -1 if the offset is not a BAR.
+ */
+static int
+mock_bar_index(const mock_func_t *mf, uint off)
+{
+    uint nbars = mock_is_bridge(mf) ? 2 : 6;
+
+    off &= ~3;
+    if ((off >= PCI_OFF_BAR0) && (off < PCI_OFF_BAR0 + nbars * 4))
+        return ((off - PCI_OFF_BAR0) / 4);
+    if (off == (mock_is_bridge(mf) ? PCI_OFF_BR_ROM_BAR : PCI_OFF_ROM_BAR))
+        return (nbars);
+    return (-1);
+}
+
+/*
+ * mock_power_cycle() returns every function to its reset state: bus
+ * numbers, BARs, windows, and command registers are cleared, while the
+ * installed functions remain. Access counters are also cleared.
+ */
+void
+mock_power_cycle(void)
+{
+    uint idx;
+    uint off;
+
+    for (idx = 0; idx < mock_funcs; idx++) {
+        mock_func_t *mf = &mock_func[idx];
+        uint         rom = mock_is_bridge(mf) ? 2 : 6;
+
+        for (off = PCI_OFF_CMD; off < sizeof (mf->mf_cfg); off++) {
+            int bar = mock_bar_index(mf, off);
+            if ((off == PCI_OFF_HEADERTYPE) ||
+                ((off >= PCI_OFF_REVISION) && (off <= PCI_OFF_CLASS)))
+                continue;
+            if ((bar >= 0) && (bar != (int) rom) && ((off & 3) == 0))
+                mf->mf_cfg[off] &= 0xf;  // BAR type bits are fixed
+            else
+                mf->mf_cfg[off] = 0;
+        }
+        mf->mf_bar_sizing = 0;
+        mf->mf_bar_prog = 0;
+    }
+    mock_reads  = 0;
+    mock_writes = 0;
+}
+
+static uint32_t
+mock_read(uint bus, uint dev, uint func, uint off, uint bytes)
+{
+    int          idx = mock_find(bus, dev, func);
+    mock_func_t *mf;
+    uint32_t     value = 0;
+    uint         pos;
+
+    mock_reads++;
+    if ((idx < 0) || (off + bytes > sizeof (mf->mf_cfg)))
+        return ((bytes == 4) ? 0xffffffff : (1U << (bytes * 8)) - 1);
+    mf = &mock_func[idx];
+    if ((mock_hook != NULL) && mock_hook(mf, off, bytes, &value, 0))
+        return (value);
+    for (pos = 0; pos < bytes; pos++)
+        value |= mf->mf_cfg[off + pos] << (pos * 8);
+    return (value);
+}
+
+static void
+mock_write(uint bus, uint dev, uint func, uint off, uint bytes,
+           uint32_t value)
+{
+    int          idx = mock_find(bus, dev, func);
+    mock_func_t *mf;
+    uint         pos;
+    int          bar;
+
+    mock_writes++;
+    if ((idx < 0) || (off + bytes > sizeof (mf->mf_cfg)))
+        return;
+    mf = &mock_func[idx];
+    if ((mock_hook != NULL) && mock_hook(mf, off, bytes, &value, 1))
+        return;
+    if ((off < 4) || (off == PCI_OFF_HEADERTYPE) ||
+        ((off >= PCI_OFF_REVISION) && (off <= PCI_OFF_CLASS))) {
+        return;  // Read-only
+    }
+
+    bar = mock_bar_index(mf, off);
+    if (bar >= 0) {
+        uint     boff = PCI_OFF_BAR0 + bar * 4;
+        uint32_t size = mf->mf_bar_size[bar];
+        uint     rom = (bar == (mock_is_bridge(mf) ? 2 : 6));
+        uint32_t old;
+        uint32_t val;
+
+        if (rom)
+            boff = mock_is_bridge(mf) ? PCI_OFF_BR_ROM_BAR : PCI_OFF_ROM_BAR;
+        old = mock_cfg32(mf, boff);
+        val = old;
+        for (pos = 0; pos < bytes; pos++) {
+            uint shift = ((off & 3) + pos) * 8;
+            val = (val & ~(0xffU << shift)) |
+                  (((value >> (pos * 8)) & 0xff) << shift);
+        }
+        if (!rom && (bar > 0) && (size == 0) &&
+            (mf->mf_cfg[boff - 4] & MOCK_BAR_MEM64)) {
+            /* Upper half of 64-bit BAR is fully writable */
+        } else if (size == 0) {
+            val = 0;  // Unimplemented BAR
+        } else if (rom) {
+            val = (val & ~(size - 1)) | (val & 1);  // ROM enable bit
+        } else {
+            val = (val & ~(size - 1)) | (old & 0xf);
+        }
+        for (pos = 0; pos < 4; pos++)
+            mf->mf_cfg[boff + pos] = val >> (pos * 8);
+
+        /* The write which follows BAR sizing restores the old value */
+        if ((bytes == 4) && (value == 0xffffffff))
+            mf->mf_bar_sizing |= 1 << bar;
+        else if (mf->mf_bar_sizing & (1 << bar))
+            mf->mf_bar_sizing &= ~(1 << bar);
+        else
+            mf->mf_bar_prog |= 1 << bar;
+        return;
+    }
+    for (pos = 0; pos < bytes; pos++) {
+        if (off + pos != PCI_OFF_HEADERTYPE)
+            mf->mf_cfg[off + pos] = value >> (pos * 8);
+    }
+}
+
+uint8_t
+pci_read8(uint bus, uint dev, uint func, uint off)
+{
+    return (mock_read(bus, dev, func, off, 1));
+}
+
+uint16_t
+pci_read16(uint bus, uint dev, uint func, uint off)
+{
+    return (mock_read(bus, dev, func, off, 2));
+}
+
+uint32_t
+pci_read32(uint bus, uint dev, uint func, uint off)
+{
+    return (mock_read(bus, dev, func, off, 4));
+}
+
+/* pci_read32v() reads again to verify, as on the Amiga */
+uint32_t
+pci_read32v(uint bus, uint dev, uint func, uint off)
+{
+    (void) mock_read(bus, dev, func, off, 4);
+    return (mock_read(bus, dev, func, off, 4));
+}
+
+void
+pci_write8(uint bus, uint dev, uint func, uint off, uint8_t value)
+{
+    mock_write(bus, dev, func, off, 1, value);
+}
+
+void
+pci_write16(uint bus, uint dev, uint func, uint off, uint16_t value)
+{
+    mock_write(bus, dev, func, off, 2, value);
+}
+
+void
+pci_write32(uint bus, uint dev, uint func, uint off, uint32_t value)
+{
+    mock_write(bus, dev, func, off, 4, value);
+}
+
+void
+pci_write32v(uint bus, uint dev, uint func, uint off, uint32_t value)
+{
+    mock_write(bus, dev, func, off, 4, value);
+}
+
+/* pci_probe() verifies only the read after a master abort, as on the Amiga */
+uint32_t
+pci_probe(uint bus, uint dev, uint func)
+{
+    static uint aborted = 1;
+    uint32_t    vd;
+
+    if (aborted)
+        vd = pci_read32v(bus, dev, func, PCI_OFF_VENDOR);
+    else
+        vd = pci_read32(bus, dev, func, PCI_OFF_VENDOR);
+    aborted = (vd == 0xffffffff);
+    return (vd);
+}
+
+uint32_t
+pci_read(uint bus, uint dev, uint func, uint off, uint bytes)
+{
+    return (mock_read(bus, dev, func, off, (bytes < 4) ? bytes : 4));
+}
+
+void
+pci_write(uint bus, uint dev, uint func, uint off, uint bytes, uint32_t value)
+{
+    mock_write(bus, dev, func, off, (bytes < 4) ? bytes : 4, value);
+}
+
+/* pci_read_block() is one configuration read per dword, as on the Amiga */
+rc_t
+pci_read_block(uint bus, uint dev, uint func, uint off, uint count,
+               uint32_t *buf)
+{
+    if (mock_block_fail) {
+        memset(buf, 0xff, count * 4);
+        return (RC_NO_DATA);
+    }
+    while (count-- > 0) {
+        *(buf++) = mock_read(bus, dev, func, off, 4);
+        off += 4;
+    }
+    return (RC_SUCCESS);
+}
+
+/* pci_read_buf() and pci_write_buf() split as pci_access.c does */
+static uint
+mock_buf_len(uint offset, uint width)
+{
+    if (offset & 1)
+        return (1);
+    if (width == 3)
+        return (2);
+    return ((width > 4) ? 4 : width);
+}
+
+rc_t
+pci_read_buf(uint bus, uint dev, uint func, uint offset, uint width,
+             void *bufp)
+{
+    uint8_t *buf = bufp;
+
+    while (width > 0) {
+        uint     len   = mock_buf_len(offset, width);
+        uint32_t value = mock_read(bus, dev, func, offset, len);
+
+        if (len == 1)
+            *buf = value;
+        else if (len == 2)
+            *(uint16_t *) buf = value;
+        else
+            *(uint32_t *) buf = value;
+        width  -= len;
+        offset += len;
+        buf    += len;
+    }
+    return (RC_SUCCESS);
+}
+
+rc_t
+pci_write_buf(uint bus, uint dev, uint func, uint offset, uint width,
+              void *bufp)
+{
+    uint8_t *buf = bufp;
+
+    while (width > 0) {
+        uint     len   = mock_buf_len(offset, width);
+        uint32_t value = (len == 1) ? *buf :
+                         (len == 2) ? *(uint16_t *) buf : *(uint32_t *) buf;
+
+        mock_write(bus, dev, func, offset, len, value);
+        width  -= len;
+        offset += len;
+        buf    += len;
+    }
+    return (RC_SUCCESS);
+}
+
+/* pci_cfg_base() returns where the Firestorm maps the register */
+void *
+pci_cfg_base(uint bus, uint dev, uint func, uint off)
+{
+    uintptr_t base = (bus == 0) ? 0x1fc00000 + (0x10000 << dev) :
+                                  0x1fd00000 + (bus << 16) + (dev << 11);
+    return ((void *) (base + (func << 8) + off));
+}
+
+int
+pci_bridge_is_present(void)
+{
+    return (1);
+}
+
+void
+pci_bridge_control(int pci_bridge, int bus, int dev, int func, uint flags)
+{
+    (void) pci_bridge;
+    (void) bus;
+    (void) dev;
+    (void) func;
+    (void) flags;
+}
+
+uint32_t
+pci_bridge_buses(uint bus, uint dev, uint func)
+{
+    uint32_t val;
+    uint     sec;
+    uint     sub;
+
+    val = pci_read32(bus, dev, func, PCI_OFF_HEADERTYPE & ~3);
+    if ((val == 0xffffffff) || (((val >> 16) & 0x7f) != 1))
+        return (0);  // Not a bridge
+
+    val = pci_read32(bus, dev, func, PCI_OFF_BR_PRI_BUS);
+    sec = (uint8_t) (val >> 8);
+    sub = (uint8_t) (val >> 16);
+    if ((sec <= bus) || (sec > PCI_MAX_BUS) || (sub < sec))
+        return (0);  // Not programmed
+    if (sub > PCI_MAX_BUS)
+        sub = PCI_MAX_BUS;
+
+    return ((uint32_t) ((1U << (sub + 1)) - 1) & ~(uint32_t) ((1U << sec) - 1));
+}
+
+/*
+ * Address ranges, for allocation checks.
+ */
+#define SPACE_MEM 0
+#define SPACE_IO  1
+
+typedef struct {
+    uint32_t lo;
+    uint32_t hi;   // Inclusive; lo > hi when disabled
+} range_t;
+
+static void
+mock_bridge_windows(const mock_func_t *mf, range_t *mem, range_t *pre,
+                    range_t *io)
+{
+    mem->lo = mock_cfg16(mf, PCI_OFF_BR_W32_BASE) << 16;
+    mem->hi = (mock_cfg16(mf, PCI_OFF_BR_W32_LIMIT) << 16) | 0xfffff;
+    pre->lo = mock_cfg16(mf, PCI_OFF_BR_W64_BASE) << 16;
+    pre->hi = (mock_cfg16(mf, PCI_OFF_BR_W64_LIMIT) << 16) | 0xfffff;
+    if (mock_cfg32(mf, PCI_OFF_BR_W64_BASE_U) != 0)
+        pre->lo = 0xffffffff, pre->hi = 0;  // Above 4 GB: disabled
+    io->lo = ((mf->mf_cfg[PCI_OFF_BR_IO_BASE] & 0xf0) << 8) |
+             (mock_cfg16(mf, PCI_OFF_BR_IO_BASE_U) << 16);
+    io->hi = ((mf->mf_cfg[PCI_OFF_BR_IO_LIMIT] & 0xf0) << 8) | 0xfff |
+             (mock_cfg16(mf, PCI_OFF_BR_IO_LIMIT_U) << 16);
+}
+
+static uint
+in_range(const range_t *r, uint32_t lo, uint32_t hi)
+{
+    return ((r->lo <= r->hi) && (lo >= r->lo) && (hi <= r->hi));
+}
+
+static uint
+overlaps(const range_t *r, uint32_t lo, uint32_t hi)
+{
+    return ((r->lo <= r->hi) && (lo <= r->hi) && (hi >= r->lo));
+}
+
+/*
+ * mock_behind() returns non-zero if function idx is located behind the
+ * specified bridge.
+ */
+static uint
+mock_behind(uint idx, const mock_func_t *bridge)
+{
+    uint seg = mock_func[idx].mf_seg;
+
+    while (seg != 0) {
+        uint cur;
+        if (seg == bridge->mf_sec_seg)
+            return (1);
+        for (cur = 0; cur < mock_funcs; cur++)
+            if (mock_is_bridge(&mock_func[cur]) &&
+                (mock_func[cur].mf_sec_seg == seg))
+                break;
+        if (cur == mock_funcs)
+            break;
+        seg = mock_func[cur].mf_seg;
+    }
+    return (0);
+}
+
+/*
+ * mock_check
+ * ----------
+ * Verifies the BAR and bridge window assignments which software has
+ * programmed. Every assigned BAR must be naturally aligned, lie within
+ * the root window of its type, not overlap any other BAR, and be claimed
+ * by exactly the bridges it is behind. Prefetchable BARs must be in the
+ * prefetchable window where one exists (pre_lo <= pre_hi). BARs which
+ * were not written after being sized are counted as unassigned. Returns
+ * the number of errors found.
+ */
+uint
+mock_check(uint32_t mem_lo, uint32_t mem_hi, uint32_t pre_lo,
+           uint32_t pre_hi, uint32_t io_lo, uint32_t io_hi, uint *unassigned)
+{
+    struct {
+        uint32_t lo;
+        uint32_t hi;
+        uint     space;
+        uint     idx;
+    } bars[MOCK_MAX_FUNCS * 7];
+    range_t  root_mem = { mem_lo, mem_hi };
+    range_t  root_pre = { pre_lo, pre_hi };
+    range_t  root_io  = { io_lo, io_hi };
+    uint     nbars = 0;
+    uint     errs = 0;
+    uint     idx;
+    uint     cur;
+    uint     bar;
+
+    *unassigned = 0;
+    for (idx = 0; idx < mock_funcs; idx++) {
+        mock_func_t *mf = &mock_func[idx];
+        uint         maxbar = mock_is_bridge(mf) ? 2 : 6;
+
+        for (bar = 0; bar <= maxbar; bar++) {
+            uint32_t size = mf->mf_bar_size[bar];
+            uint     rom = (bar == maxbar);
+            uint     off = rom ? (mock_is_bridge(mf) ? PCI_OFF_BR_ROM_BAR :
+                                                       PCI_OFF_ROM_BAR) :
+                                 PCI_OFF_BAR0 + bar * 4;
+            uint32_t val = mock_cfg32(mf, off);
+            uint     type = rom ? 0 : (val & 0xf);
+            uint32_t lo = val & ((type & MOCK_BAR_IO) ? ~3U : ~0xfU);
+            uint32_t hi;
+            uint     space = (type & MOCK_BAR_IO) ? SPACE_IO : SPACE_MEM;
+            const range_t *root;
+
+            if (size == 0)
+                continue;
+            if (rom)
+                lo &= ~1U;
+            if ((mf->mf_bar_prog & (1 << bar)) == 0) {
+                (*unassigned)++;
+                continue;
+            }
+            if ((type & MOCK_BAR_MEM64) && !rom)
+                bar++;
+            hi = lo + size - 1;
+            if (lo & (size - 1)) {
+                printf("  %x.%x BAR%u %08x not aligned to %x\n",
+                       mf->mf_dev, mf->mf_func, bar, lo, size);
+                errs++;
+            }
+            if (space == SPACE_IO)
+                root = &root_io;
+            else if ((type & MOCK_BAR_PRE) && (pre_lo <= pre_hi))
+                root = &root_pre;
+            else
+                root = &root_mem;
+            if (!in_range(root, lo, hi)) {
+                printf("  %x.%x BAR%u %08x-%08x outside root window\n",
+                       mf->mf_dev, mf->mf_func, bar, lo, hi);
+                errs++;
+            }
+
+            /* Bridges must claim exactly the BARs behind them */
+            for (cur = 0; cur < mock_funcs; cur++) {
+                range_t wmem;
+                range_t wpre;
+                range_t wio;
+                uint    claimed;
+
+                if (!mock_is_bridge(&mock_func[cur]))
+                    continue;
+                mock_bridge_windows(&mock_func[cur], &wmem, &wpre, &wio);
+                if (space == SPACE_IO)
+                    claimed = in_range(&wio, lo, hi);
+                else if (root == &root_pre)
+                    claimed = in_range(&wpre, lo, hi);
+                else
+                    claimed = in_range(&wmem, lo, hi);
+                if (claimed != mock_behind(idx, &mock_func[cur])) {
+                    printf("  %x.%x BAR%u %08x-%08x %s by bridge %x\n",
+                           mf->mf_dev, mf->mf_func, bar, lo, hi,
+                           claimed ? "wrongly claimed" : "not forwarded",
+                           mock_func[cur].mf_dev);
+                    errs++;
+                }
+            }
+            bars[nbars].lo    = lo;
+            bars[nbars].hi    = hi;
+            bars[nbars].space = space;
+            bars[nbars].idx   = idx;
+            nbars++;
+        }
+    }
+
+    for (idx = 0; idx < nbars; idx++) {
+        for (cur = idx + 1; cur < nbars; cur++) {
+            range_t r = { bars[idx].lo, bars[idx].hi };
+            if ((bars[idx].space == bars[cur].space) &&
+                overlaps(&r, bars[cur].lo, bars[cur].hi)) {
+                printf("  BAR %08x-%08x overlaps %08x-%08x\n",
+                       bars[idx].lo, bars[idx].hi,
+                       bars[cur].lo, bars[cur].hi);
+                errs++;
+            }
+        }
+    }
+    return (errs);
+}
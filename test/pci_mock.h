@@ -0,0 +1,67 @@
+/*
+ * This is free and unencumbered software released into the public domain.
+ * See the LICENSE file for additional details.
+ *
+ * Designed by Chris Hooper in 2025.
+ *
+ * ---------------------------------------------------------------------
+ *
+ * Mock PCI configuration space for host tests of the Amiga PCI code.
+ */
+
+#ifndef _PCI_MOCK_H
+#define _PCI_MOCK_H
+
+#include <stdint.h>
+#include <exec/types.h>
+
+#define MOCK_MAX_FUNCS  48
+#define MOCK_MAX_SEGS   16  // Bus segments, including the root bus
+
+/* BAR types, as read from the low bits of a BAR */
+#define MOCK_BAR_MEM    0x0
+#define MOCK_BAR_IO     0x1
+#define MOCK_BAR_MEM64  0x4
+#define MOCK_BAR_PRE    0x8
+#define MOCK_BAR_ROM    0x80  // Expansion ROM (last BAR slot)
+
+typedef struct {
+    uint8_t  mf_cfg[256];      // Configuration space contents
+    uint32_t mf_bar_size[7];   // BAR sizes (6 or 2 = expansion ROM)
+    uint8_t  mf_bar_sizing;    // BARs which were just written with ~0
+    uint8_t  mf_bar_prog;      // BARs which were programmed after sizing
+    uint8_t  mf_seg;           // Bus segment where function is located
+    uint8_t  mf_sec_seg;       // Bridge: bus segment behind the bridge
+    uint8_t  mf_dev;
+    uint8_t  mf_func;
+} mock_func_t;
+
+extern mock_func_t mock_func[MOCK_MAX_FUNCS];
+extern uint        mock_funcs;
+extern uint        mock_segs;
+extern uint        mock_reads;    // Configuration reads
+extern uint        mock_writes;   // Configuration writes
+extern uint        mock_block_fail;  // pci_read_block() reports no data
+
+/*
+ * A hook may intercept accesses to a function's configuration space,
+ * for registers with side effects. It returns non-zero if it handled
+ * the access.
+ */
+typedef int (*mock_hook_t)(mock_func_t *mf, uint off, uint bytes,
+                           uint32_t *value, int write);
+extern mock_hook_t mock_hook;
+
+void     mock_reset(void);
+void     mock_power_cycle(void);
+int      mock_add(uint seg, uint dev, uint func, uint32_t vd, uint htype);
+uint     mock_add_bridge(uint seg, uint dev, uint32_t vd);
+void     mock_remove(int idx);
+void     mock_bar(int idx, uint bar, uint32_t size, uint type);
+int      mock_find(uint bus, uint dev, uint func);
+uint32_t mock_cfg32(const mock_func_t *mf, uint off);
+uint     mock_check(uint32_t mem_lo, uint32_t mem_hi, uint32_t pre_lo,
+                    uint32_t pre_hi, uint32_t io_lo, uint32_t io_hi,
+                    uint *unassigned);
+
+#endif /* _PCI_MOCK_H */
@@ -0,0 +1,329 @@
+/*
+ * This is free and unencumbered software released into the public domain.
+ * See the LICENSE file for additional details.
+ *
+ * Designed by Chris Hooper in 2025.
+ *
+ * ---------------------------------------------------------------------
+ *
+ * Host test of the pci tool's lspci views (amiga/pci.c) against captured
+ * configuration space dumps. Each view is displayed twice: decoded from
+ * the snapshot of a function's configuration space which is fetched as
+ * a block, and with block reads failing, so that every register is read
+ * individually across the bridge as before. Output must be identical,
+ * and the raw dump must reproduce the capture. Configuration accesses
+ * of both are reported.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+
+#include "pci_host.c"
+#include "pci_mock.h"
+#include "test.h"
+
+#define DUMP_FILE "pci_dumps.txt"
+#define MAX_DUMPS 16
+
+typedef struct {
+    uint    bus;
+    uint    dev;
+    uint    func;
+    uint8_t cfg[256];
+} dump_t;
+
+typedef struct {
+    const char *name;
+    uint        flags;
+    uint        cap;
+} view_t;
+
+static dump_t dumps[MAX_DUMPS];
+static uint   dump_count;
+
+static const view_t views[] = {
+    { "-l",       FLAG_PCI_LS,                        PCI_ANY_ID },
+    { "-v",       FLAG_VERBOSE,                       PCI_ANY_ID },
+    { "-vv",      FLAG_VERBOSE | FLAG_VERBOSE_IO,     PCI_ANY_ID },
+    { "-d",       FLAG_DUMP,                          PCI_ANY_ID },
+    { "-dd",      FLAG_DUMP | FLAG_DDUMP,             PCI_ANY_ID },
+    { "-v -dd",   FLAG_VERBOSE | FLAG_DUMP | FLAG_DDUMP, PCI_ANY_ID },
+    { "-k 01",    FLAG_PCI_CAP,                       0x01 },
+    { "-k 10",    FLAG_PCI_CAP,                       0x10 },
+    { "-s",       FLAG_PCI_STATUS,                    PCI_ANY_ID },
+};
+
+void
+Delay(long ticks)
+{
+    (void) ticks;
+}
+
+void
+cia_spin(unsigned int ticks)
+{
+    (void) ticks;
+}
+
+/* load_dumps() reads the captured dumps, in "lspci -xxx" form */
+static uint
+load_dumps(const char *filename)
+{
+    FILE   *fp = fopen(filename, "r");
+    char    line[256];
+    dump_t *cur = NULL;
+
+    if (fp == NULL) {
+        fprintf(stderr, "Failed to open %s\n", filename);
+        return (0);
+    }
+    while (fgets(line, sizeof (line), fp) != NULL) {
+        uint off;
+        uint pos;
+        int  len;
+
+        if ((line[0] == '#') || (line[0] == '\n'))
+            continue;
+        if ((line[2] == ':') && (line[5] == '.')) {
+            if (dump_count >= MAX_DUMPS)
+                break;
+            cur = &dumps[dump_count++];
+            sscanf(line, "%x:%x.%x", &cur->bus, &cur->dev, &cur->func);
+            continue;
+        }
+        if ((cur == NULL) || (sscanf(line, "%x:%n", &off, &len) != 1))
+            continue;
+        for (pos = 0; (pos < 16) && (off + pos < 256); pos++) {
+            uint value;
+            int  vlen;
+            if (sscanf(line + len, " %x%n", &value, &vlen) != 1)
+                break;
+            cur->cfg[off + pos] = value;
+            len += vlen;
+        }
+    }
+    fclose(fp);
+    return (dump_count);
+}
+
+static uint32_t
+dump32(const dump_t *d, uint off)
+{
+    return (d->cfg[off] | (d->cfg[off + 1] << 8) |
+            (d->cfg[off + 2] << 16) | ((uint32_t) d->cfg[off + 3] << 24));
+}
+
+/*
+ * mock_load() installs the dumped functions in the mock. A function on
+ * a bus other than 0 is placed behind the bridge which forwards to it.
+ * Each BAR is given the size of its address alignment.
+ */
+static void
+mock_load(void)
+{
+    uint cur;
+
+    mock_reset();
+    for (cur = 0; cur < dump_count; cur++) {
+        const dump_t *d = &dumps[cur];
+        uint  htype = d->cfg[PCI_OFF_HEADERTYPE];
+        uint  nbars = ((htype & 0x7f) == 1) ? 2 : 6;
+        uint  rom = (nbars == 2) ? PCI_OFF_BR_ROM_BAR : PCI_OFF_ROM_BAR;
+        uint  seg = 0;
+        uint  bar;
+        int   idx;
+
+        if (d->bus != 0) {
+            for (idx = 0; idx < (int) mock_funcs; idx++) {
+                if (((mock_func[idx].mf_cfg[PCI_OFF_HEADERTYPE] & 0x7f) == 1) &&
+                    (mock_func[idx].mf_cfg[PCI_OFF_BR_SEC_BUS] == d->bus)) {
+                    seg = mock_func[idx].mf_sec_seg;
+                    break;
+                }
+            }
+        }
+        idx = mock_add(seg, d->dev, d->func, dump32(d, 0), htype);
+        if ((htype & 0x7f) == 1)
+            mock_func[idx].mf_sec_seg = mock_segs++;
+        for (bar = 0; bar < nbars; bar++) {
+            uint32_t val = dump32(d, PCI_OFF_BAR0 + bar * 4);
+            uint32_t addr = val & ((val & 1) ? ~3U : ~0xfU);
+
+            if (addr != 0)
+                mock_bar(idx, bar, addr & -addr, val & ((val & 1) ? 1 : 0xf));
+            if ((val & MOCK_BAR_MEM64) && !(val & 1))
+                bar++;
+        }
+        if (dump32(d, rom) & ~0x7ffU) {
+            uint32_t addr = dump32(d, rom) & ~0x7ffU;
+            mock_bar(idx, nbars, addr & -addr, MOCK_BAR_ROM);
+        }
+        memcpy(mock_func[idx].mf_cfg, d->cfg, sizeof (d->cfg));
+    }
+    mock_reads = 0;
+    mock_writes = 0;
+}
+
+/*
+ * run_view() displays a view of every function, decoding from the
+ * snapshot or not. Returns the output, which the caller frees.
+ */
+static char *
+run_view(const view_t *view, uint snapshot, uint *reads, uint *writes)
+{
+    char *out;
+
+    mock_load();
+    mock_block_fail = !snapshot;
+    flags = view->flags;
+    pci_host_outlen = 0;
+    pci_host_out[0] = '\0';
+    lspci(PCI_ANY_ID, PCI_ANY_ID, PCI_ANY_ID, PCI_ANY_ID, PCI_ANY_ID,
+          view->cap);
+    *reads = mock_reads;
+    *writes = mock_writes;
+    out = strdup(pci_host_out);
+    return (out);
+}
+
+/* dump_found() checks that the raw dump output reproduces a capture */
+static uint
+dump_found(const char *out, const dump_t *d)
+{
+    char        line[80];
+    char        hdr[16];
+    const char *pos;
+    uint        off;
+    uint        col;
+
+    snprintf(hdr, sizeof (hdr), "%x.%x.%x ", d->bus, d->dev, d->func);
+    for (pos = out; (pos = strstr(pos, hdr)) != NULL; pos++)
+        if ((pos == out) || (pos[-1] == '\n'))
+            break;
+    if (pos == NULL)
+        return (0);
+
+    for (off = 0; off < 256; off += 16) {
+        int len = snprintf(line, sizeof (line), "%02x:", off);
+        for (col = 0; col < 16; col++)
+            len += snprintf(line + len, sizeof (line) - len, " %02x",
+                            d->cfg[off + col]);
+        pos = strstr(pos, line);
+        if (pos == NULL)
+            return (0);
+    }
+    return (1);
+}
+
+static void
+test_views(void)
+{
+    uint cur;
+    uint snap_total = 0;
+    uint reg_total = 0;
+
+    printf("pci config snapshot (%u functions from %s):\n",
+           dump_count, DUMP_FILE);
+    printf("    view      output  reg reads  snap reads  writes\n");
+    for (cur = 0; cur < ARRAY_SIZE(views); cur++) {
+        const view_t *view = &views[cur];
+        uint  snap_reads;
+        uint  snap_writes;
+        uint  reg_reads;
+        uint  reg_writes;
+        char *snap = run_view(view, 1, &snap_reads, &snap_writes);
+        char *reg  = run_view(view, 0, &reg_reads, &reg_writes);
+        uint  same = (strcmp(snap, reg) == 0);
+
+        CHECK(same);
+        CHECK(snap_writes == reg_writes);
+        CHECK((strlen(snap) > 0) || (view->flags == FLAG_PCI_STATUS));
+        if (!same) {
+            fprintf(stderr, "view %s differs\n--- snapshot\n%s--- registers\n%s",
+                    view->name, snap, reg);
+        }
+        if (view->flags & FLAG_VERBOSE) {
+            /* 64-bit MSI of the bridge: data follows the upper address */
+            CHECK(strstr(snap, "08: Message Addr=fee00000  0c: Data=4021") !=
+                  NULL);
+        }
+        if (view->flags & FLAG_DDUMP) {
+            uint d;
+            for (d = 0; d < dump_count; d++)
+                CHECK(dump_found(snap, &dumps[d]));
+        }
+        if (view->flags & (FLAG_VERBOSE | FLAG_DUMP))
+            CHECK(snap_reads < reg_reads);
+        else
+            CHECK(snap_reads == reg_reads);  // Each register read once
+        printf("    %-8s %7u %10u %11u %7u\n", view->name,
+               (uint) strlen(snap), reg_reads, snap_reads, snap_writes);
+        snap_total += snap_reads;
+        reg_total  += reg_reads;
+        free(snap);
+        free(reg);
+    }
+    printf("    all views: %u reads per register, %u from snapshots "
+           "(%u%% fewer)\n", reg_total, snap_total,
+           (reg_total - snap_total) * 100 / reg_total);
+    printf("    (each read is one bridge access; a snapshot reads each "
+           "dword at most once)\n");
+}
+
+static uint status_reads;
+
+/*
+ * status_hook() counts live reads of the status register, and has each
+ * function report a master abort while it is being decoded, just after
+ * its subsystem ID is read.
+ */
+static int
+status_hook(mock_func_t *mf, uint off, uint bytes, uint32_t *value, int write)
+{
+    (void) value;
+    if (write)
+        return (0);
+    if ((off == PCI_OFF_STATUS) && (bytes == 2))
+        status_reads++;
+    if (off == PCI_OFF_SUBSYSTEM_VID)
+        mf->mf_cfg[PCI_OFF_STATUS + 1] |= 0x20;  // Received Master Abort
+    return (0);
+}
+
+/* test_status() checks that the status register is still read live */
+static void
+test_status(void)
+{
+    const char *pos;
+    uint        aborts = 0;
+
+    mock_load();
+    mock_hook = status_hook;
+    status_reads = 0;
+    flags = FLAG_VERBOSE;
+    pci_host_outlen = 0;
+    lspci(PCI_ANY_ID, PCI_ANY_ID, PCI_ANY_ID, PCI_ANY_ID, PCI_ANY_ID,
+          PCI_ANY_ID);
+    for (pos = pci_host_out; (pos = strstr(pos, "Received Master Abort"));
+         pos++) {
+        aborts++;
+    }
+    CHECK(status_reads == dump_count);
+    CHECK(aborts == dump_count);
+    printf("    status read live: %u reads, %u of %u changes shown\n",
+           status_reads, aborts, dump_count);
+}
+
+int
+main(void)
+{
+    if (load_dumps(DUMP_FILE) == 0) {
+        CHECK(0);
+        return (test_result("pci_snap"));
+    }
+    test_views();
+    test_status();
+    return (test_result("pci_snap"));
+}
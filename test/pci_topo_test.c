@@ -0,0 +1,209 @@
+/*
+ * This is free and unencumbered software released into the public domain.
+ * See the LICENSE file for additional details.
+ *
+ * Designed by Chris Hooper in 2025.
+ *
+ * ---------------------------------------------------------------------
+ *
+ * Host test of the saved PCI topology (amiga/pci_alloc.c). A topology is
+ * scanned cold and saved, the mock hardware is power cycled, and the
+ * warm scan from the saved topology must produce exactly the same bus
+ * numbers, BARs, and bridge windows with fewer configuration cycles.
+ * Hardware changes and damaged topology files must fall back to a full
+ * scan which still produces a valid allocation.
+ */
+
+#include <stdio.h>
+#include <stdarg.h>
+#include <string.h>
+
+static int verbose;
+
+static int
+pci_alloc_printf(const char *fmt, ...)
+{
+    va_list ap;
+    int     rc = 0;
+
+    if (verbose) {
+        va_start(ap, fmt);
+        rc = vprintf(fmt, ap);
+        va_end(ap);
+    }
+    return (rc);
+}
+
+#define printf pci_alloc_printf
+#include "../amiga/pci_alloc.c"
+#undef printf
+
+#include "pci_mock.h"
+#include "test.h"
+
+#define VD(vendor, device) ((vendor) | ((uint32_t) (device) << 16))
+
+static uint8_t     topo[PCI_TOPO_MAX_SIZE];
+static uint        topolen;
+static mock_func_t cold_cfg[MOCK_MAX_FUNCS];
+
+/*
+ * build_system() creates a typical system: a graphics card, a network
+ * card, and a bridge card with a USB controller and a sound card behind
+ * it. Returns the mock index of the sound card.
+ */
+static int
+build_system(void)
+{
+    uint seg;
+    int  idx;
+    int  snd;
+
+    mock_reset();
+    idx = mock_add(0, 0, 0, VD(0x5333, 0x8a22), 0x00);
+    mock_bar(idx, 0, 0x4000000, MOCK_BAR_MEM | MOCK_BAR_PRE);
+    mock_bar(idx, 1, 0x10000, MOCK_BAR_MEM);
+    mock_bar(idx, 6, 0x10000, MOCK_BAR_ROM);
+    idx = mock_add(0, 2, 0, VD(0x10ec, 0x8139), 0x00);
+    mock_bar(idx, 0, 0x100, MOCK_BAR_IO);
+    mock_bar(idx, 1, 0x100, MOCK_BAR_MEM);
+    seg = mock_add_bridge(0, 3, VD(0x3388, 0x0021));
+    idx = mock_add(seg, 0, 0, VD(0x1033, 0x0035), 0x80);
+    mock_bar(idx, 0, 0x1000, MOCK_BAR_MEM);
+    idx = mock_add(seg, 0, 1, VD(0x1033, 0x00e0), 0x00);
+    mock_bar(idx, 0, 0x100, MOCK_BAR_MEM);
+    snd = mock_add(seg, 1, 0, VD(0x1102, 0x0002), 0x00);
+    mock_bar(snd, 0, 0x20, MOCK_BAR_IO);
+    return (snd);
+}
+
+static uint
+check_alloc(void)
+{
+    uint unassigned;
+    uint errs = mock_check(0x80000000, 0x9fbfffff, 0xa0000000, 0xfeffffff,
+                           0x00000000, 0x001fffff, &unassigned);
+    return (errs + unassigned);
+}
+
+/*
+ * same_config() compares everything software programs, other than the
+ * bookkeeping of the mock itself, against the cold scan.
+ */
+static uint
+same_config(void)
+{
+    uint idx;
+
+    for (idx = 0; idx < mock_funcs; idx++)
+        if (memcmp(mock_func[idx].mf_cfg, cold_cfg[idx].mf_cfg,
+                   sizeof (cold_cfg[idx].mf_cfg)) != 0)
+            return (0);
+    return (1);
+}
+
+static void
+test_warm_boot(void)
+{
+    uint cold_cycles;
+    uint warm_cycles;
+    uint count;
+
+    build_system();
+    count = pci_alloc_scan_cached(0, NULL, 0);
+    CHECK(count == 6);
+    CHECK(pci_alloc_cache_hit == 0);
+    CHECK(check_alloc() == 0);
+    cold_cycles = mock_reads + mock_writes;
+    memcpy(cold_cfg, mock_func, sizeof (cold_cfg));
+    topolen = pci_alloc_topo_save(topo, sizeof (topo));
+    CHECK(topolen == sizeof (pci_topo_hdr_t) + 6 * sizeof (pci_topo_ent_t));
+    CHECK(pci_alloc_topo_save(topo, topolen - 1) == 0);
+
+    mock_power_cycle();
+    CHECK(pci_alloc_scan_cached(0, topo, topolen) == count);
+    CHECK(pci_alloc_cache_hit == 1);
+    CHECK(check_alloc() == 0);
+    CHECK(same_config());
+    warm_cycles = mock_reads + mock_writes;
+    CHECK(warm_cycles < cold_cycles);
+    printf("  config cycles: cold %u, warm %u (%.0f%% fewer)\n",
+           cold_cycles, warm_cycles,
+           100.0 * (cold_cycles - warm_cycles) / cold_cycles);
+}
+
+/*
+ * expect_miss() power cycles and scans with the saved topology, which
+ * must be rejected in favor of a full scan with a valid allocation.
+ */
+static void
+expect_miss(const char *what, uint expect_count)
+{
+    mock_power_cycle();
+    CHECK(pci_alloc_scan_cached(0, topo, topolen) == expect_count);
+    CHECK(pci_alloc_cache_hit == 0);
+    CHECK(check_alloc() == 0);
+    printf("  %-26s miss, %u config cycles\n", what,
+           mock_reads + mock_writes);
+}
+
+static void
+test_changes(void)
+{
+    pci_topo_hdr_t *hdr = (pci_topo_hdr_t *) topo;
+    pci_topo_ent_t *ent = (pci_topo_ent_t *) (hdr + 1);
+    int             idx;
+    int             snd;
+
+    /* Card swapped in a slot */
+    build_system();
+    mock_func[1].mf_cfg[2] ^= 1;
+    expect_miss("card swapped:", 6);
+
+    /* Card added to an empty slot */
+    build_system();
+    idx = mock_add(0, 4, 0, VD(0x1234, 0x5678), 0x00);
+    mock_bar(idx, 0, 0x1000, MOCK_BAR_MEM);
+    expect_miss("card added:", 7);
+
+    /* Card removed */
+    build_system();
+    mock_remove(1);
+    expect_miss("card removed:", 5);
+
+    /* Device behind the bridge replaced, found after partial restore */
+    snd = build_system();
+    mock_func[snd].mf_cfg[2] ^= 1;
+    expect_miss("device behind bridge:", 6);
+
+    /* Damaged topology files */
+    build_system();
+    hdr->pt_magic ^= 1;
+    expect_miss("bad magic:", 6);
+    hdr->pt_magic ^= 1;
+    hdr->pt_version++;
+    expect_miss("bad version:", 6);
+    hdr->pt_version--;
+    topolen--;
+    expect_miss("truncated:", 6);
+    topolen++;
+    ent[1].pte_parent = 5;
+    expect_miss("child before parent:", 6);
+    ent[1].pte_parent = PCI_TOPO_ROOT;
+
+    /* Undamaged topology is accepted again */
+    mock_power_cycle();
+    CHECK(pci_alloc_scan_cached(0, topo, topolen) == 6);
+    CHECK(pci_alloc_cache_hit == 1);
+    CHECK(same_config());
+}
+
+int
+main(int argc, char *argv[])
+{
+    verbose = (argc > 1) && (strcmp(argv[1], "-v") == 0);
+    printf("pci_topo:\n");
+    test_warm_boot();
+    test_changes();
+    return (test_result("pci_topo"));
+}
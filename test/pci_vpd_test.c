@@ -0,0 +1,299 @@
+/*
+ * This is free and unencumbered software released into the public domain.
+ * See the LICENSE file for additional details.
+ *
+ * Designed by Chris Hooper in 2025.
+ *
+ * ---------------------------------------------------------------------
+ *
+ * Host test of Vital Product Data reads by the pci tool (amiga/pci.c),
+ * against a mock VPD device of configurable latency. The CIA timer and
+ * Delay() advance a simulated clock, so that the time to fetch VPD, the
+ * CPU time spent spinning, and the number of Delay() calls can be
+ * measured for devices which answer in microseconds to tens of
+ * milliseconds, or never.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+
+#include "pci_host.c"
+#include "pci_mock.h"
+#include "test.h"
+
+#define VPD_CAP       0x50
+#define VPD_NEVER     0xffffffff   // Device never completes a read
+#define ACCESS_TICKS  1            // Configuration access across the bridge
+#define TICKS_US(x)   ((uint64_t) (x) * 1000000 / 715909)
+
+typedef struct {
+    uint     latency;     // CIA ticks for the device to fetch a dword
+    uint     addr;        // VPD address of current request
+    uint64_t ready;       // Time when the request completes
+    uint8_t  image[512];
+    uint     len;
+} vpd_dev_t;
+
+typedef struct {
+    uint64_t now;          // Simulated time (CIA ticks)
+    uint64_t spin;         // Total ticks spent in cia_spin()
+    uint     spin_max;     // Longest single cia_spin()
+    uint     delays;       // Delay() calls
+    uint     fetches;      // VPD dwords requested
+    uint     polls;        // Reads of the VPD address register
+    uint     latency_max;  // Largest vpd_latency seen at a request
+} vpd_sim_t;
+
+static vpd_dev_t vpd_dev;
+static vpd_sim_t sim;
+static uint32_t  rand_state = 1;
+
+static uint
+rand32(void)
+{
+    rand_state = rand_state * 1103515245 + 12345;
+    return (rand_state >> 8);
+}
+
+void
+Delay(long ticks)
+{
+    sim.now += ticks * VPD_DELAY_TICKS;
+    sim.delays++;
+}
+
+void
+cia_spin(unsigned int ticks)
+{
+    sim.now  += ticks;
+    sim.spin += ticks;
+    if (sim.spin_max < ticks)
+        sim.spin_max = ticks;
+}
+
+/*
+ * vpd_hook() models the VPD capability. Writing the address starts a
+ * fetch, which completes after the device latency with +-25% jitter.
+ */
+static int
+vpd_hook(mock_func_t *mf, uint off, uint bytes, uint32_t *value, int write)
+{
+    (void) mf;
+    (void) bytes;
+    if ((off < VPD_CAP + PCI_VPD_ADDR) || (off >= VPD_CAP + PCI_VPD_DATA + 4))
+        return (0);
+
+    sim.now += ACCESS_TICKS;
+    if (off == VPD_CAP + PCI_VPD_ADDR) {
+        if (write) {
+            uint lat = vpd_dev.latency;
+            vpd_dev.addr = *value & PCI_VPD_ADDR_MASK;
+            if (lat == VPD_NEVER)
+                vpd_dev.ready = UINT64_MAX;
+            else
+                vpd_dev.ready = sim.now + lat * 3 / 4 + rand32() % (lat / 2 + 1);
+            sim.fetches++;
+            if (sim.latency_max < vpd_latency)
+                sim.latency_max = vpd_latency;
+        } else {
+            *value = vpd_dev.addr;
+            if (sim.now >= vpd_dev.ready)
+                *value |= PCI_VPD_ADDR_F;
+            sim.polls++;
+        }
+        return (1);
+    }
+    if (!write && (off == VPD_CAP + PCI_VPD_DATA)) {
+        uint pos = vpd_dev.addr & ~3;
+        *value = 0xffffffff;
+        if (pos + 4 <= sizeof (vpd_dev.image))
+            memcpy(value, vpd_dev.image + pos, 4);  // VPD is little endian
+        return (1);
+    }
+    return (1);
+}
+
+static uint
+vpd_put(uint pos, const char *kw, const char *data)
+{
+    uint len = strlen(data);
+
+    vpd_dev.image[pos++] = kw[0];
+    vpd_dev.image[pos++] = kw[1];
+    vpd_dev.image[pos++] = len;
+    memcpy(vpd_dev.image + pos, data, len);
+    return (pos + len);
+}
+
+/*
+ * vpd_build() lays out an identifier string, a VPD-R keyword list with
+ * checksum, and a VPD-W area, which the reader should skip.
+ */
+static void
+vpd_build(void)
+{
+    static const char id[] = "Mock 10GbE Server Adapter";
+    uint    pos = 0;
+    uint    ro_len;
+    uint    ro;
+    uint    cur;
+    uint8_t sum = 0;
+
+    memset(vpd_dev.image, 0, sizeof (vpd_dev.image));
+    vpd_dev.image[pos++] = VPD_TAG_ID;
+    vpd_dev.image[pos++] = strlen(id);
+    vpd_dev.image[pos++] = 0;
+    memcpy(vpd_dev.image + pos, id, strlen(id));
+    pos += strlen(id);
+
+    vpd_dev.image[pos] = VPD_TAG_RO;
+    ro = pos + 3;
+    pos = vpd_put(ro, "PN", "MK-10G-2P");
+    pos = vpd_put(pos, "EC", "A-2025-07");
+    pos = vpd_put(pos, "SN", "MK25300117");
+    pos = vpd_put(pos, "MN", "1a2b");
+    vpd_dev.image[pos++] = 'R';
+    vpd_dev.image[pos++] = 'V';
+    vpd_dev.image[pos++] = 8;  // Checksum and reserved space
+    ro_len = pos + 8 - ro;
+    vpd_dev.image[ro - 2] = ro_len;
+    vpd_dev.image[ro - 1] = ro_len >> 8;
+    for (cur = 0; cur < pos; cur++)
+        sum += vpd_dev.image[cur];
+    vpd_dev.image[pos] = -sum;
+    pos += 8;
+
+    vpd_dev.image[pos++] = VPD_TAG_RW;
+    vpd_dev.image[pos++] = 200;
+    vpd_dev.image[pos++] = 0;
+    pos += 200;
+    vpd_dev.image[pos++] = VPD_TAG_END;
+    vpd_dev.len = pos;
+}
+
+/* vpd_run() reads and shows the VPD of the device, from a clean cache */
+static void
+vpd_run(uint latency)
+{
+    mock_reset();
+    mock_add(0, 3, 0, 0x10001234, 0);
+    mock_hook = vpd_hook;
+    pci_vpd_list = NULL;
+    vpd_dev.latency = latency;
+    pci_host_outlen = 0;
+    pci_host_out[0] = '\0';
+    pci_vpd_show(0, 3, 0, VPD_CAP);
+}
+
+static void
+sim_reset(void)
+{
+    memset(&sim, 0, sizeof (sim));
+}
+
+static uint
+vpd_output_ok(void)
+{
+    return ((strstr(pci_host_out, "VPD ID  Mock 10GbE Server Adapter\n") !=
+             NULL) &&
+            (strstr(pci_host_out, "VPD SN  MK25300117\n") != NULL) &&
+            (strstr(pci_host_out, "VPD RV  checksum ok\n") != NULL) &&
+            (strstr(pci_host_out, "incomplete") == NULL));
+}
+
+static void
+test_latency(void)
+{
+    static const uint lat_us[] = { 0, 5, 50, 300, 900, 3000, 8000, 30000 };
+    uint cur;
+
+    printf("pci vpd:\n");
+    printf("    device    dwords  per dword  polls  CPU spin  max spin  "
+           "Delay()\n");
+    for (cur = 0; cur < ARRAY_SIZE(lat_us); cur++) {
+        uint     lat = CIA_USEC_LONG(lat_us[cur]);
+        uint     run;
+        uint64_t per_dword;
+        uint64_t spin_per;
+
+        /* A second read of the same device starts from its latency */
+        vpd_latency = 0;
+        for (run = 0; run < 2; run++) {
+            sim_reset();
+            vpd_run(lat);
+        }
+        CHECK(vpd_output_ok());
+        CHECK(sim.fetches > 0);
+        per_dword = sim.now / sim.fetches;
+        spin_per  = sim.spin / sim.fetches;
+
+        /* Never spin longer than the yield point before a Delay() */
+        CHECK(sim.spin_max <= VPD_SPIN_MAX);
+        CHECK(spin_per <= VPD_YIELD_TICKS + VPD_SPIN_MAX);
+        CHECK(sim.latency_max <= VPD_DELAY_TICKS);
+
+        /* Fast devices are polled promptly; slow ones cost one Delay() */
+        if (lat * 5 / 4 < VPD_YIELD_TICKS)
+            CHECK(per_dword <= lat * 5 / 2 + VPD_SPIN_MIN + 10 * ACCESS_TICKS);
+        else
+            CHECK(per_dword <= lat * 5 / 4 + VPD_DELAY_TICKS +
+                               10 * ACCESS_TICKS);
+        printf("    %5u us %7u %7u us %6.1f %6u us %6u us %6.1f\n",
+               lat_us[cur], sim.fetches, (uint) TICKS_US(per_dword),
+               (double) sim.polls / sim.fetches, (uint) TICKS_US(spin_per),
+               (uint) TICKS_US(sim.spin_max),
+               (double) sim.delays / sim.fetches);
+    }
+    printf("    (device latency +-25%%; per-dword values are averages of a "
+           "second read, after adapting to the device)\n");
+}
+
+/*
+ * test_switch() reads a fast device right after a slow one. The slow
+ * device's latency must not leave the reader in Delay() for long.
+ */
+static void
+test_switch(void)
+{
+    vpd_latency = 0;
+    sim_reset();
+    vpd_run(CIA_USEC_LONG(30000));
+    CHECK(vpd_latency >= VPD_YIELD_TICKS);
+
+    sim_reset();
+    vpd_run(CIA_USEC(20));
+    CHECK(vpd_output_ok());
+    CHECK(sim.delays <= 1);
+    printf("    fast device after slow: %u dwords in %u us, %u Delay()\n",
+           sim.fetches, (uint) TICKS_US(sim.now), sim.delays);
+}
+
+/* test_timeout() checks that a device which never answers is given up */
+static void
+test_timeout(void)
+{
+    vpd_latency = 0;
+    sim_reset();
+    vpd_run(VPD_NEVER);
+    CHECK(strstr(pci_host_out, "Timeout reading VPD") != NULL);
+    CHECK(strstr(pci_host_out, "VPD incomplete") != NULL);
+    CHECK(sim.fetches == 1);
+    CHECK(sim.now >= VPD_TIMEOUT_TICKS);
+    CHECK(sim.now <= VPD_TIMEOUT_TICKS + VPD_DELAY_TICKS + 10 * ACCESS_TICKS);
+    CHECK(sim.spin <= VPD_YIELD_TICKS + VPD_SPIN_MAX);
+    printf("    dead device: timeout after %u ms, %u us spinning, %u Delay()\n",
+           (uint) (TICKS_US(sim.now) / 1000), (uint) TICKS_US(sim.spin),
+           sim.delays);
+}
+
+int
+main(void)
+{
+    vpd_build();
+    test_latency();
+    test_switch();
+    test_timeout();
+    return (test_result("pci_vpd"));
+}
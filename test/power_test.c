@@ -0,0 +1,358 @@
+/*
+ * This is free and unencumbered software released into the public domain.
+ * See the LICENSE file for additional details.
+ *
+ * Designed by Chris Hooper in 2025.
+ *
+ * ---------------------------------------------------------------------
+ *
+ * Host simulation of supply rail fault response. The 5V rail collapses
+ * at a random time while the power supply is on. The ADC DMA interrupts
+ * run through fw/adc.c, and the rail window events they raise are
+ * delivered to fw/power.c as the EXTI software interrupt would. The time
+ * until PSON is released is compared with the previous design, in which
+ * the main loop saw rail readings only when it ran sensor_poll(), under
+ * a main loop load with occasional long busy periods.
+ */
+
+#include <stdio.h>
+#include <stdarg.h>
+#include <stdlib.h>
+
+static int
+power_printf(const char *fmt, ...)
+{
+    (void) fmt;
+    return (0);
+}
+
+#define printf power_printf
+#include "../fw/adc.c"
+#include "../fw/power.c"
+#undef printf
+
+#include <math.h>
+#include "test.h"
+
+#define HALF_USEC     2500   // ADC_DECIMATE halves per 10 msec sample
+#define LOOP_USEC     200    // Typical main loop pass
+#define BUSY_CHANCE   2000   // One pass in this many is a long busy one
+#define BUSY_MIN_USEC 20000  // USB enumeration, flash writes, console, ...
+#define BUSY_MAX_USEC 250000
+#define TRIALS        1000
+
+#define CH_VREF  0
+#define CH_V5    1
+#define CH_V3P3  2
+#define CH_V12   3
+
+volatile uint32_t ocm3_regs[256];
+config_t          config;
+uint8_t           cold_poweron;
+
+static uint64_t now_usec;
+static uint64_t pson_off_usec;      // When PSON was released (0 = on)
+static double   level[4];           // True input of each channel
+static uint32_t rand_state = 1;
+
+void
+fw_dprintf(uint32_t mask, const char *fmt, ...)
+{
+    (void) mask;
+    (void) fmt;
+}
+
+uint32_t
+gpio_num_to_gpio(uint num)
+{
+    return (num);
+}
+
+void
+gpio_setmode(uint32_t GPIOx, uint16_t GPIO_Pins, uint value)
+{
+    (void) GPIOx;
+    (void) GPIO_Pins;
+    (void) value;
+}
+
+void
+gpio_setv(uint32_t GPIOx, uint16_t GPIO_Pins, int value)
+{
+    if ((GPIOx == PSON_PORT) && (GPIO_Pins == PSON_PIN) && value &&
+        (pson_off_usec == 0))
+        pson_off_usec = now_usec;
+}
+
+uint16_t
+gpio_get(uint32_t gpioport, uint16_t gpios)
+{
+    (void) gpioport;
+    return (gpios);  // Power button not pressed
+}
+
+void
+sensor_check_readings(void)
+{
+}
+
+uint
+sensor_get_power_state(void)
+{
+    return (POWER_STATE_ON);
+}
+
+uint64_t
+timer_tick_get(void)
+{
+    return (now_usec);
+}
+
+uint64_t
+timer_tick_to_usec(uint64_t value)
+{
+    return (value);
+}
+
+uint64_t
+timer_tick_plus_msec(uint msec)
+{
+    return (now_usec + msec * 1000ULL);
+}
+
+bool
+timer_tick_has_elapsed(uint64_t value)
+{
+    return (now_usec >= value);
+}
+
+void
+timer_alarm_set(uint alarm, uint64_t when, void (*func)(void))
+{
+    (void) alarm;
+    (void) when;
+    (void) func;
+}
+
+void
+timer_alarm_cancel(uint alarm)
+{
+    (void) alarm;
+}
+
+static double
+rand_uniform(void)
+{
+    rand_state = rand_state * 1103515245 + 12345;
+    return (((rand_state >> 8) + 0.5) / (double) (1 << 24));
+}
+
+/*
+ * adc_half() fills one DMA half-buffer with noisy conversions, runs the
+ * DMA interrupt, then delivers the EXTI interrupt if it was pended.
+ */
+static void
+adc_half(uint half)
+{
+    volatile uint16_t *buf = &adc_buffer[half * channel_count *
+                                         ADC_SETS_PER_HALF];
+    uint set;
+    uint ch;
+
+    for (set = 0; set < ADC_SETS_PER_HALF; set++)
+        for (ch = 0; ch < channel_count; ch++)
+            *(buf++) = (uint16_t) (level[ch] + 8 * (rand_uniform() - 0.5));
+    adc_dma_half(&adc_buffer[half * channel_count * ADC_SETS_PER_HALF]);
+    if (EXTI_SWIER & PWRSW_EXTI) {
+        EXTI_SWIER = 0;
+        exti15_10_isr();
+    }
+}
+
+static void
+setup(void)
+{
+    uint ch;
+    uint half;
+
+    adc_setup_sensor(CH_VREF, 0, ADC_CHANNEL_VREF);
+    adc_setup_sensor(CH_V5, GPP(PA, 0), 0);
+    adc_setup_sensor(CH_V3P3, GPP(PA, 2), 2);
+    adc_setup_sensor(CH_V12, GPP(PC, 4), 14);
+    config.board_type = BOARD_TYPE_AMIGAPCI;
+    config.flags = CF_POWER_FAULT_OFF;
+
+    level[CH_VREF] = 1502;  // 1.21V with 3.3V reference
+    level[CH_V5]   = 3103;  // 5V / 2
+    level[CH_V3P3] = 2048;  // 3.3V / 2
+    level[CH_V12]  = 2441;  // 12V * 10 / 61
+    for (half = 0; half < 64; half++)
+        adc_half(half & 1);
+
+    /* sensor.c sets each rail window to its limits: here +/- 8% */
+    adc_get_reading(CH_VREF);
+    for (ch = CH_V5; ch <= CH_V12; ch++) {
+        int calc = adc_get_reading(ch);
+        adc_set_window(ch, calc * 92 / 100, calc * 108 / 100);
+    }
+}
+
+static int
+cmp_double(const void *a, const void *b)
+{
+    double da = *(const double *) a;
+    double db = *(const double *) b;
+    return ((da > db) - (da < db));
+}
+
+static void
+report(const char *name, double *ms, uint count)
+{
+    qsort(ms, count, sizeof (*ms), cmp_double);
+    printf("  %-22s median %6.1f ms, 99%% %6.1f ms, max %6.1f ms\n",
+           name, ms[count / 2], ms[count * 99 / 100], ms[count - 1]);
+}
+
+/*
+ * trial() runs until both designs have turned the power supply off.
+ * The old design is modelled as the main loop checking each new ADC
+ * sample it sees, and releasing PSON after three bad samples in a row.
+ */
+static void
+trial(double *old_ms, double *new_ms)
+{
+    static uint half;
+    uint64_t    fault_usec;
+    uint64_t    next_half;
+    uint64_t    next_loop;
+    uint64_t    old_off = 0;
+    uint        seen_seq = adc_get_seq();
+    uint        old_bad = 0;
+    int         v5_min;
+
+    /* Power is on and rails are good */
+    power_state = POWER_STATE_ON;
+    power_state_desired = POWER_STATE_ON;
+    pson_off_usec = 0;
+    level[CH_V5] = 3103;
+    next_half = now_usec + HALF_USEC;
+    for (; now_usec < next_half + 60 * HALF_USEC; now_usec += HALF_USEC)
+        adc_half(half++ & 1);
+    CHECK(power_rail_faults == 0);
+    adc_get_reading(CH_VREF);
+    v5_min = adc_get_reading(CH_V5) * 92 / 100;
+
+    fault_usec = now_usec + (uint64_t) (rand_uniform() * 4 * HALF_USEC);
+    next_half = now_usec + HALF_USEC;
+    next_loop = now_usec + LOOP_USEC;
+    while ((pson_off_usec == 0) || (old_off == 0)) {
+        if (now_usec > fault_usec + 2000000) {
+            CHECK(0);  // Neither design may take seconds
+            return;
+        }
+        now_usec = (next_half < next_loop) ? next_half : next_loop;
+        if (now_usec >= fault_usec)
+            level[CH_V5] = 3103 * 0.7;  // 5V rail collapses to 3.5V
+
+        if (now_usec == next_half) {
+            adc_half(half++ & 1);
+            next_half += HALF_USEC;
+        } else {
+            /* Main loop pass ends: the old sensor_poll() */
+            if (adc_get_seq() != seen_seq) {
+                seen_seq = adc_get_seq();
+                adc_get_reading(CH_VREF);
+                if (adc_get_reading(CH_V5) < v5_min) {
+                    if ((++old_bad >= POWER_FAULT_SAMPLES) && (old_off == 0))
+                        old_off = now_usec;
+                } else {
+                    old_bad = 0;
+                }
+            }
+            next_loop += LOOP_USEC;
+            if (rand_uniform() * BUSY_CHANCE < 1.0)
+                next_loop += BUSY_MIN_USEC + (uint64_t) (rand_uniform() *
+                                          (BUSY_MAX_USEC - BUSY_MIN_USEC));
+        }
+    }
+    *old_ms = (old_off - fault_usec) / 1000.0;
+    *new_ms = (pson_off_usec - fault_usec) / 1000.0;
+    CHECK(power_state == POWER_STATE_FAULT);
+    CHECK(power_fault_usec <= pson_off_usec - fault_usec);
+}
+
+static void
+test_latency(void)
+{
+    static double old_ms[TRIALS];
+    static double new_ms[TRIALS];
+    uint          cur;
+
+    for (cur = 0; cur < TRIALS; cur++)
+        trial(&old_ms[cur], &new_ms[cur]);
+    report("main loop (old):", old_ms, TRIALS);
+    report("ADC interrupt (new):", new_ms, TRIALS);
+    CHECK(new_ms[TRIALS - 1] < 8 * HALF_USEC * ADC_DECIMATE / 1000.0);
+    CHECK(new_ms[TRIALS - 1] < old_ms[TRIALS * 99 / 100]);
+}
+
+/* A single bad sample, or any with PowerFaultOff clear, is not a fault */
+static void
+test_no_fault(void)
+{
+    uint half;
+
+    power_state = POWER_STATE_ON;
+    power_state_desired = POWER_STATE_ON;
+    pson_off_usec = 0;
+    level[CH_V5] = 3103;
+    for (half = 0; half < 40; half++, now_usec += HALF_USEC)
+        adc_half(half & 1);
+    level[CH_V5] = 3103 * 0.6;  // Filtered sample dips 10% once
+    for (half = 0; half < ADC_DECIMATE; half++, now_usec += HALF_USEC)
+        adc_half(half & 1);
+    level[CH_V5] = 3103;
+    for (half = 0; half < 40; half++, now_usec += HALF_USEC)
+        adc_half(half & 1);
+    CHECK(pson_off_usec == 0);
+    CHECK(power_state == POWER_STATE_ON);
+
+    config.flags = 0;
+    level[CH_V5] = 3103 * 0.7;
+    for (half = 0; half < 40; half++, now_usec += HALF_USEC)
+        adc_half(half & 1);
+    CHECK(pson_off_usec == 0);
+    CHECK(power_state == POWER_STATE_ON);
+    config.flags = CF_POWER_FAULT_OFF;
+}
+
+/*
+ * The ADC windows cover the 4 supply rails and sensor_get_power_state()
+ * also counts the fan tach and PWM; both must agree on the same readings.
+ */
+static void
+test_classify(void)
+{
+    CHECK(power_rail_classify(4, 0) == POWER_STATE_ON);
+    CHECK(power_rail_classify(6, 0) == POWER_STATE_ON);
+    CHECK(power_rail_classify(0, 4) == POWER_STATE_OFF);
+    CHECK(power_rail_classify(1, 3) == POWER_STATE_OFF);
+    CHECK(power_rail_classify(1, 5) == POWER_STATE_OFF);  // Fan % still good
+    CHECK(power_rail_classify(2, 4) == POWER_STATE_OFF);
+    CHECK(power_rail_classify(2, 2) == POWER_STATE_FAULT);
+    CHECK(power_rail_classify(3, 3) == POWER_STATE_FAULT);
+    CHECK(power_rail_classify(3, 1) == POWER_STATE_FAULT);
+    CHECK(power_rail_classify(2, 0) == POWER_STATE_FAULT);
+}
+
+int
+main(void)
+{
+    printf("power:\n");
+    now_usec = 1000000;
+    setup();
+    test_latency();
+    test_no_fault();
+    test_classify();
+    return (test_result("power"));
+}
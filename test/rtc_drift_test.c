@@ -0,0 +1,332 @@
+/*
+ * This is free and unencumbered software released into the public domain.
+ * See the LICENSE file for additional details.
+ *
+ * Designed by Chris Hooper in 2025.
+ *
+ * ---------------------------------------------------------------------
+ *
+ * Host simulation of the RTC drift trim (fw/rtc.c). The STM32 RTC is
+ * modelled as a clock which runs at the crystal error plus the coarse
+ * calibration programmed in RTC_CALIBR, read and set in whole seconds
+ * through the RTC time and date registers. The Amiga, which keeps
+ * accurate time, sets the clock at irregular intervals as
+ * amigartc_copy_time_rp5c01_to_stm32() does, at an arbitrary point
+ * within the second. For a range of crystal errors, the test reports
+ * how long the trim takes to converge and the drift left after a day
+ * without clock sets, against the previous untrimmed clock.
+ */
+
+#include <stdio.h>
+#include <stdarg.h>
+#include <stdlib.h>
+
+static int
+rtc_printf(const char *fmt, ...)
+{
+    (void) fmt;
+    return (0);
+}
+
+#define printf rtc_printf
+#include "../fw/rtc.c"
+#undef printf
+
+#include <math.h>
+#include "test.h"
+
+#define DAY_SECS       86400
+#define SIM_DAYS       30
+#define SET_MIN_SECS   (2 * 3600)    // Amiga clock sets, while in use
+#define SET_MAX_SECS   (12 * 3600)
+#define CONVERGED_PPM  4.0           // One positive CALIBR step
+
+volatile uint32_t ocm3_regs[256];
+volatile uint32_t ocm3_rtc_regs[32];
+config_t          config;
+
+static double   true_secs;      // Accurate time, as kept by the Amiga
+static double   rtc_secs;       // STM32 RTC, including partial second
+static double   xtal_ppm;       // Crystal frequency error
+static uint     config_writes;
+static uint32_t rand_state = 1;
+
+void
+fw_dprintf(uint32_t mask, const char *fmt, ...)
+{
+    (void) mask;
+    (void) fmt;
+}
+
+void
+gpio_setmode(uint32_t GPIOx, uint16_t GPIO_Pins, uint value)
+{
+    (void) GPIOx;
+    (void) GPIO_Pins;
+    (void) value;
+}
+
+uint16_t
+gpio_get(uint32_t gpioport, uint16_t gpios)
+{
+    (void) gpioport;
+    (void) gpios;
+    return (0);
+}
+
+void
+config_updated(void)
+{
+    config_writes++;
+}
+
+int
+input_break_pending(void)
+{
+    return (1);
+}
+
+uint64_t
+timer_tick_get(void)
+{
+    return ((uint64_t) (true_secs * 1e6));
+}
+
+uint64_t
+timer_tick_to_usec(uint64_t value)
+{
+    return (value);
+}
+
+uint64_t
+timer_tick_plus_msec(uint msec)
+{
+    return (timer_tick_get() + msec * 1000ULL);
+}
+
+bool
+timer_tick_has_elapsed(uint64_t value)
+{
+    return (timer_tick_get() >= value);
+}
+
+static double
+rand_uniform(void)
+{
+    rand_state = rand_state * 1103515245 + 12345;
+    return (((rand_state >> 8) + 0.5) / (double) (1 << 24));
+}
+
+/* rtc_ppm() is the rate error of the RTC, after calibration */
+static double
+rtc_ppm(void)
+{
+    return (xtal_ppm + rtc_calibr_get_ppm());
+}
+
+static void
+advance(double secs)
+{
+    rtc_secs += secs * (1 + rtc_ppm() / 1e6);
+    true_secs += secs;
+}
+
+/* rtc_latch() presents the current RTC count in the shadow registers */
+static void
+rtc_latch(void)
+{
+    uint year;
+    uint mon;
+    uint day;
+    uint hour;
+    uint min;
+    uint sec;
+
+    utc_to_rtc((uint32_t) rtc_secs, &year, &mon, &day, &hour, &min, &sec);
+    RTC_TR = (rtc_binary_to_bcd(hour) << 16) | (rtc_binary_to_bcd(min) << 8) |
+             rtc_binary_to_bcd(sec);
+    RTC_DR = (rtc_binary_to_bcd(year % 100) << 16) |
+             (rtc_binary_to_bcd(mon) << 8) | rtc_binary_to_bcd(day);
+    RTC_ISR |= RTC_ISR_RSF;
+}
+
+/*
+ * amiga_set() writes the Amiga time to the STM32 RTC in whole seconds,
+ * as the RP5C01 emulation does. Setting the time restarts the RTC
+ * prescaler, so the partial second is lost.
+ */
+static void
+amiga_set(double secs)
+{
+    uint year;
+    uint mon;
+    uint day;
+    uint hour;
+    uint min;
+    uint sec;
+    uint dummy;
+
+    utc_to_rtc((uint32_t) secs, &year, &mon, &day, &hour, &min, &sec);
+    rtc_latch();
+    rtc_trim_reference(year, mon, day, hour, min, sec);
+    rtc_allow_writes(TRUE);
+    rtc_set_date(year % 100, mon, day, 1);
+    rtc_set_time(hour, min, sec, 1, 0);
+    rtc_allow_writes(FALSE);
+
+    RTC_ISR |= RTC_ISR_RSF;
+    rtc_get_time(&year, &mon, &day, &hour, &min, &sec, &dummy);
+    rtc_secs = rtc_to_utc(year, mon, day, hour, min, sec);
+}
+
+/* Power loss: the RTC and backup registers run on, config is reloaded */
+static void
+reboot(void)
+{
+    RTC_CALIBR = 0;
+    rtc_trim_apply();
+}
+
+static void
+sim_reset(double ppm, int trim)
+{
+    memset((void *) ocm3_rtc_regs, 0, sizeof (ocm3_rtc_regs));
+    memset(&config, 0, sizeof (config));
+    config.rtc_trim = trim;
+    rtc_trim_apply();
+    xtal_ppm = ppm;
+    true_secs = rtc_to_utc(2025, 3, 1, 0, 0, 0) + 0.5;
+    rtc_secs = true_secs;
+    config_writes = 0;
+}
+
+/*
+ * run() simulates the Amiga setting the clock at random intervals for
+ * the given time. Without learning, the drift measurement is discarded
+ * before each set, as if the trim did not exist. Returns the time in
+ * seconds at which the RTC rate error first came within CONVERGED_PPM,
+ * or -1 if it never did, and the worst rate error from then on.
+ */
+static double
+run(double secs, uint learn, double *worst)
+{
+    double end = true_secs + secs;
+    double start = true_secs;
+    double converged = (fabs(rtc_ppm()) <= CONVERGED_PPM) ? 0 : -1;
+
+    *worst = 0;
+    while (1) {
+        double next = SET_MIN_SECS +
+                      rand_uniform() * (SET_MAX_SECS - SET_MIN_SECS);
+        if (true_secs + next > end)
+            break;
+        advance(next);
+        if (rand_uniform() < 0.2)
+            reboot();
+        if (learn == 0)
+            rtc_trim_forget();
+        amiga_set(true_secs);
+        if ((converged < 0) && (fabs(rtc_ppm()) <= CONVERGED_PPM))
+            converged = true_secs - start;
+        if ((converged >= 0) && (fabs(rtc_ppm()) > *worst))
+            *worst = fabs(rtc_ppm());
+    }
+    advance(end - true_secs);
+    return (converged);
+}
+
+/* free_run() returns the RTC error in seconds after a day without sets */
+static double
+free_run(void)
+{
+    double t0 = true_secs;
+    double r0 = rtc_secs;
+    advance(DAY_SECS);
+    return ((rtc_secs - r0) - (true_secs - t0));
+}
+
+static void
+test_convergence(void)
+{
+    static const double ppms[] = { -100, -40, -12, 0, 7, 25, 55 };
+    uint                cur;
+
+    printf("  %d days of Amiga clock sets every %u-%u h, then a day "
+           "without:\n", SIM_DAYS, SET_MIN_SECS / 3600, SET_MAX_SECS / 3600);
+    for (cur = 0; cur < ARRAY_SIZE(ppms); cur++) {
+        double old_res;
+        double new_res;
+        double conv;
+        double worst;
+
+        sim_reset(ppms[cur], 0);
+        run(SIM_DAYS * DAY_SECS, 0, &worst);
+        old_res = free_run();
+
+        sim_reset(ppms[cur], 0);
+        conv = run(SIM_DAYS * DAY_SECS, 1, &worst);
+        new_res = free_run();
+
+        printf("    crystal %+4.0f ppm: untrimmed %+5.2f s, trimmed %+5.2f s; "
+               "within %.0f ppm after %4.1f days, then worst %.0f ppm\n",
+               ppms[cur], old_res, new_res, CONVERGED_PPM,
+               (conv < 0) ? 99.9 : conv / DAY_SECS, worst);
+        CHECK(conv >= 0);
+        CHECK(conv < 14 * DAY_SECS);
+        CHECK(worst <= 2 * CONVERGED_PPM);
+        CHECK(fabs(new_res) <= 0.5);
+        CHECK(config_writes < 20);
+    }
+}
+
+/* A user time change and a manual clock set must not disturb the trim */
+static void
+test_time_change(void)
+{
+    double worst;
+    int    trim;
+
+    sim_reset(20, 0);
+    run(15 * DAY_SECS, 1, &worst);
+    trim = config.rtc_trim;
+    CHECK(fabs(rtc_ppm()) <= CONVERGED_PPM);
+
+    /* Amiga clock moved by an hour (time zone change) */
+    advance(13 * 3600);
+    amiga_set(true_secs + 3600);
+    CHECK(config.rtc_trim == trim);
+    advance(13 * 3600);
+    amiga_set(true_secs + 3600);
+    CHECK(config.rtc_trim == trim);
+
+    /* The clock set by hand from the command line is not a reference */
+    advance(13 * 3600);
+    rtc_secs += 30;
+    rtc_trim_forget();
+    advance(13 * 3600);
+    amiga_set(true_secs);
+    CHECK(config.rtc_trim == trim);
+
+    /* The trim is applied again at boot */
+    RTC_CALIBR = 0;
+    rtc_trim_apply();
+    CHECK(fabs(rtc_ppm()) <= CONVERGED_PPM);
+
+    /* A config from before the trim keeps the calibration in the RTC */
+    (void) rtc_calibr_set_ppm(-10);
+    config.rtc_trim = RTC_TRIM_UNKNOWN;
+    rtc_trim_apply();
+    CHECK(rtc_calibr_get_ppm() == -10);
+    CHECK(config.rtc_trim == -10 * RTC_TRIM_FRAC);
+    rtc_trim_apply();
+    CHECK(rtc_calibr_get_ppm() == -10);
+}
+
+int
+main(void)
+{
+    printf("rtc_drift:\n");
+    test_convergence();
+    test_time_change();
+    return (test_result("rtc_drift"));
+}
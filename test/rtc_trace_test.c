@@ -0,0 +1,431 @@
+/*
+ * This is free and unencumbered software released into the public domain.
+ * See the LICENSE file for additional details.
+ *
+ * Designed by Chris Hooper in 2025.
+ *
+ * ---------------------------------------------------------------------
+ *
+ * Host test of the RP5C01 bus trace decoder (bec_trace_decode() in
+ * amiga/becdecode.c). The RTC bus accesses of BEC mailbox exchanges, as
+ * made by send_rtc_cmd(), are synthesized with known timing and packed
+ * into BEC_CMD_RTC_TRACE entries as the BEC capture interrupt does. The
+ * entries are then fetched in reply-sized pieces and decoded, and each
+ * message and register access must be found at its true time. Capture
+ * which drops the ticks below delta resolution, as it used to, is
+ * compared, and decode throughput is reported.
+ */
+
+#include <stdint.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include <exec/types.h>
+#include "../fw/bec_cmd.h"
+#include "../fw/crc32.c"
+#include "../amiga/becdecode.c"
+#include "test.h"
+
+#define TICK_HZ      60000000    // TIM2 capture clock
+#define TRACE_SHIFT  4           // AMIGARTC_TRACE_SHIFT
+#define ACCESS_USEC  1.9         // Amiga RTC access cycle, on average
+#define POLL_USEC    100         // send_rtc_cmd() reply poll interval
+#define REPLY_ENTS   ((BEC_MSG_MAX_PAYLOAD - sizeof (bec_rtc_trace_t)) / 4)
+#define MAX_ENTS     400000
+#define MAX_MSGS     512
+#define RATE_MIN_LEN 256         // Payload for message rate comparison
+
+#define RP_MODE      0xd         // RP5C01 MODE register
+
+/* Trace as captured, and the true time of each entry */
+static uint8_t  trace[MAX_ENTS * 4];
+static double   trace_usec[MAX_ENTS];
+static uint     trace_count;
+static uint64_t cap_ticks;       // TIM2, at the latest access
+static uint64_t cap_last;        // TIM2 at last capture
+static uint     cap_drop;        // Capture drops ticks below resolution
+static uint32_t rand_state = 1;
+
+/* Messages sent, and what was decoded */
+typedef struct {
+    double   start;              // True time of first byte
+    double   end;                // True time of last byte
+    uint     len;                // Payload length
+    uint8_t  code;               // Command or status
+    uint8_t  is_reply;
+} msg_t;
+
+static msg_t    sent[MAX_MSGS];
+static uint     sent_count;
+static msg_t    got[MAX_MSGS];
+static uint     got_count;
+static uint     ent_pos;
+static double   ent_err_max;
+static uint     ent_gaps;
+
+static double
+rand_uniform(void)
+{
+    rand_state = rand_state * 1103515245 + 12345;
+    return (((rand_state >> 8) + 0.5) / (double) (1 << 24));
+}
+
+/*
+ * bus() makes one RTC access usec after the previous one, and captures
+ * it as the BEC exti0_isr() does.
+ */
+static void
+bus(double usec, uint bank, uint rd, uint addr, uint data)
+{
+    uint64_t delta;
+    uint32_t ent;
+
+    cap_ticks += (uint64_t) (usec * (TICK_HZ / 1000000));
+    delta = (cap_ticks - cap_last) >> TRACE_SHIFT;
+    if (delta > BRT_DELTA_MAX) {
+        delta = BRT_DELTA_MAX;
+        cap_last = cap_ticks;
+    } else if (cap_drop) {
+        cap_last = cap_ticks;
+    } else {
+        cap_last += delta << TRACE_SHIFT;
+    }
+    ent = ((uint32_t) delta << BRT_DELTA_SHIFT) | (bank << 9) |
+          (rd ? BRT_READ : 0) | (addr << 4) | (data & 0xf);
+    if (trace_count < MAX_ENTS) {
+        uint8_t *ptr = &trace[trace_count * 4];
+        ptr[0] = ent >> 24;
+        ptr[1] = ent >> 16;
+        ptr[2] = ent >> 8;
+        ptr[3] = ent;
+        trace_usec[trace_count] = (double) cap_ticks / (TICK_HZ / 1000000);
+        trace_count++;
+    }
+}
+
+static double
+now_usec(void)
+{
+    return ((double) cap_ticks / (TICK_HZ / 1000000));
+}
+
+static double
+access_usec(void)
+{
+    return (ACCESS_USEC * (0.8 + 0.4 * rand_uniform()));
+}
+
+/* mbox_byte() sends or receives a byte through the mailbox registers */
+static void
+mbox_byte(uint rd, uint8_t byte)
+{
+    bus(access_usec(), 1, rd, 0, byte >> 4);
+    bus(access_usec(), 1, rd, 1, byte & 0xf);
+}
+
+/*
+ * mbox_msg() transfers a BEC message (cmd or status) in one direction,
+ * with a random payload, recording its true start and end times.
+ */
+static void
+mbox_msg(uint rd, uint8_t code, uint len)
+{
+    uint8_t  hdr[5] = { 0xcd, 0x68, code, len >> 8, len };
+    uint8_t  payload[BEC_MSG_MAX_PAYLOAD];
+    uint32_t crc;
+    msg_t   *msg = &sent[sent_count++];
+    uint     pos;
+
+    for (pos = 0; pos < len; pos++)
+        payload[pos] = rand_uniform() * 256;
+    crc = crc32(0, &hdr[2], 3);
+    crc = crc32(crc, payload, len);
+
+    msg->code = code;
+    msg->len = len;
+    msg->is_reply = rd;
+    mbox_byte(rd, hdr[0]);
+    msg->start = now_usec();
+    for (pos = 1; pos < sizeof (hdr); pos++)
+        mbox_byte(rd, hdr[pos]);
+    for (pos = 0; pos < len; pos++)
+        mbox_byte(rd, payload[pos]);
+    for (pos = 0; pos < 4; pos++)
+        mbox_byte(rd, crc >> (24 - pos * 8));
+    msg->end = now_usec();
+}
+
+/*
+ * exchange() is one send_rtc_cmd(): select MODE 1, send the command,
+ * poll the high nibble until the BEC has a reply, then read the reply.
+ */
+static void
+exchange(uint8_t cmd, uint arglen, uint replylen, double bec_usec)
+{
+    double ready;
+
+    bus(access_usec(), 1, 0, RP_MODE, 0x9);
+    mbox_msg(0, cmd, arglen);
+    ready = now_usec() + bec_usec;
+    while (now_usec() < ready)
+        bus(POLL_USEC, 1, 1, 0, 0x0);
+    mbox_msg(1, BEC_STATUS_OK, replylen);
+}
+
+/* An Amiga program reads the clock */
+static void
+read_clock(void)
+{
+    uint reg;
+
+    bus(access_usec() + 50, 0, 0, RP_MODE, 0x8);
+    for (reg = 0; reg < 13; reg++)
+        bus(access_usec(), 0, 1, reg, rand_uniform() * 10);
+}
+
+static void
+ent_func(uint32_t usec, uint32_t ent, uint is_mailbox)
+{
+    double err = usec - trace_usec[ent_pos];
+
+    (void) is_mailbox;
+    if (BRT_DELTA(ent) == BRT_DELTA_MAX) {
+        ent_gaps++;
+    } else if (ent_gaps == 0) {
+        if (err < 0)
+            err = -err;
+        if (err > ent_err_max)
+            ent_err_max = err;
+    }
+    ent_pos++;
+}
+
+static void
+msg_func(const bec_trace_msg_t *msg, uint is_reply, uint32_t usec)
+{
+    msg_t *g = &got[got_count++ % MAX_MSGS];
+
+    g->start = msg->btm_start;
+    g->end = usec;
+    g->code = msg->btm_hdr[2];
+    g->len = msg->btm_expected - BEC_MSG_HDR_LEN - BEC_MSG_CRC_LEN;
+    g->is_reply = is_reply;
+}
+
+static void
+trace_reset(uint drop)
+{
+    trace_count = 0;
+    cap_ticks = 0;
+    cap_last = 0;
+    cap_drop = drop;
+    sent_count = 0;
+    got_count = 0;
+    ent_pos = 0;
+    ent_err_max = 0;
+    ent_gaps = 0;
+    rand_state = 1;
+}
+
+/* decode() fetches the trace in reply-sized pieces, as "bec rtctrace" */
+static void
+decode(void)
+{
+    bec_trace_state_t state;
+    uint              pos;
+
+    memset(&state, 0, sizeof (state));
+    for (pos = 0; pos < trace_count; pos += REPLY_ENTS) {
+        uint count = trace_count - pos;
+        if (count > REPLY_ENTS)
+            count = REPLY_ENTS;
+        bec_trace_decode(&state, &trace[pos * 4], count, TICK_HZ,
+                         TRACE_SHIFT, ent_func, msg_func);
+    }
+}
+
+/* build() synthesizes a session of mixed mailbox and clock traffic */
+static void
+build(uint exchanges)
+{
+    static const uint8_t cmds[] = { BEC_CMD_ID, BEC_CMD_SENSOR_HIST,
+                                    BEC_CMD_RTC_TRACE, BEC_CMD_BLK_WRITE };
+    uint cur;
+
+    for (cur = 0; cur < exchanges; cur++) {
+        uint8_t cmd = cmds[cur % sizeof (cmds)];
+        uint    arglen = (cmd == BEC_CMD_BLK_WRITE) ? 512 + 8 :
+                         rand_uniform() * 16;
+        uint    replylen = (cmd == BEC_CMD_BLK_WRITE) ? 0 :
+                           rand_uniform() * BEC_MSG_MAX_PAYLOAD;
+
+        exchange(cmd, arglen, replylen, 200 + rand_uniform() * 2000);
+        if ((cur % 5) == 0)
+            read_clock();
+    }
+}
+
+/*
+ * check_msgs() compares decoded messages with what was sent, returning
+ * the number which differ, the worst start time error in microseconds,
+ * and the worst transfer rate error of long messages in percent.
+ */
+static uint
+check_msgs(double *start_err, double *rate_err)
+{
+    uint bad = (got_count != sent_count);
+    uint cur;
+
+    *start_err = 0;
+    *rate_err = 0;
+    for (cur = 0; (cur < got_count) && (cur < sent_count); cur++) {
+        msg_t *s = &sent[cur];
+        msg_t *g = &got[cur];
+        uint   bytes = s->len + BEC_MSG_HDR_LEN + BEC_MSG_CRC_LEN;
+        double err = fabs(g->start - s->start);
+
+        if ((g->code != s->code) || (g->len != s->len) ||
+            (g->is_reply != s->is_reply))
+            bad++;
+        if (err > *start_err)
+            *start_err = err;
+        if (s->len >= RATE_MIN_LEN) {
+            double true_rate = bytes / (s->end - s->start);
+            double got_rate = bytes / (g->end - g->start);
+            err = 100 * fabs(got_rate - true_rate) / true_rate;
+            if (err > *rate_err)
+                *rate_err = err;
+        }
+    }
+    return (bad);
+}
+
+static void
+test_decode(void)
+{
+    double rate_err[2];
+    double start_err[2];
+    double ent_err[2];
+    uint   drop;
+
+    for (drop = 0; drop < 2; drop++) {
+        trace_reset(drop);
+        build(100);
+        decode();
+        CHECK(ent_pos == trace_count);
+        CHECK(check_msgs(&start_err[drop], &rate_err[drop]) == 0);
+        ent_err[drop] = ent_err_max;
+    }
+    printf("  %u entries, %u messages in %u replies over %.2f s\n",
+           trace_count, sent_count, (trace_count + REPLY_ENTS - 1) / REPLY_ENTS,
+           trace_usec[trace_count - 1] / 1e6);
+    printf("  access time error %.1f us, message start error %.1f us, "
+           "long message rate error %.2f%%\n",
+           ent_err[0], start_err[0], rate_err[0]);
+    printf("  dropping sub-delta ticks (old capture): %.0f us, %.0f us, "
+           "%.2f%%\n", ent_err[1], start_err[1], rate_err[1]);
+    CHECK(ent_err[0] <= 1.5);
+    CHECK(start_err[0] <= 1.5);
+    CHECK(rate_err[0] < 0.2);
+    CHECK(ent_err[1] > 100 * ent_err[0]);
+}
+
+/* A long pause is marked as a gap, and decode continues after it */
+static void
+test_gap(void)
+{
+    double start_err;
+    double rate_err;
+
+    trace_reset(0);
+    build(3);
+    cap_ticks += (uint64_t) TICK_HZ * 30;
+    build(3);
+    decode();
+    CHECK(ent_gaps == 1);
+    CHECK(check_msgs(&start_err, &rate_err) == 0);
+}
+
+/*
+ * Noise before a message, a magic byte which is not followed by the
+ * rest of the magic, and a message split across two replies must all
+ * still decode.
+ */
+static void
+test_resync(void)
+{
+    bec_trace_state_t state;
+    double            start_err;
+    double            rate_err;
+
+    trace_reset(0);
+    mbox_byte(0, 0x12);
+    mbox_byte(0, 0xcd);
+    mbox_byte(0, 0x00);
+    mbox_byte(0, 0xcd);
+    mbox_msg(0, BEC_CMD_ID, 3);
+    memset(&state, 0, sizeof (state));
+    bec_trace_decode(&state, trace, 13, TICK_HZ, TRACE_SHIFT,
+                     ent_func, msg_func);
+    bec_trace_decode(&state, &trace[13 * 4], trace_count - 13, TICK_HZ,
+                     TRACE_SHIFT, ent_func, msg_func);
+    CHECK(check_msgs(&start_err, &rate_err) == 0);
+    CHECK(got_count == 1);
+    CHECK(start_err <= 1.5);
+}
+
+static void
+msg_null(const bec_trace_msg_t *msg, uint is_reply, uint32_t usec)
+{
+    (void) msg;
+    (void) is_reply;
+    (void) usec;
+}
+
+static void
+ent_null(uint32_t usec, uint32_t ent, uint is_mailbox)
+{
+    (void) usec;
+    (void) ent;
+    (void) is_mailbox;
+}
+
+static double
+nsec_now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (ts.tv_sec * 1e9 + ts.tv_nsec);
+}
+
+static void
+bench(void)
+{
+    bec_trace_state_t state;
+    const uint        iters = 50;
+    double            start;
+    double            nsec;
+    uint              cur;
+
+    trace_reset(0);
+    build(200);
+    memset(&state, 0, sizeof (state));
+    start = nsec_now();
+    for (cur = 0; cur < iters; cur++)
+        bec_trace_decode(&state, trace, trace_count, TICK_HZ, TRACE_SHIFT,
+                         ent_null, msg_null);
+    nsec = (nsec_now() - start) / iters / trace_count;
+    printf("  host: decode %.1f ns per entry (%.0f M entries/sec)\n",
+           nsec, 1e3 / nsec);
+}
+
+int
+main(void)
+{
+    printf("rtc_trace:\n");
+    test_decode();
+    test_gap();
+    test_resync();
+    bench();
+    return (test_result("rtc_trace"));
+}
@@ -0,0 +1,378 @@
+/*
+ * This is free and unencumbered software released into the public domain.
+ * See the LICENSE file for additional details.
+ *
+ * Designed by Chris Hooper in 2025.
+ *
+ * ---------------------------------------------------------------------
+ *
+ * Host test of the sensor history ring encoder (fw/sensor.c) and the
+ * Amiga side decoder (bec_hist_decode() in amiga/becdecode.c). Synthetic
+ * readings, with slow drift, noise, and occasional large steps, are
+ * recorded at irregular intervals. Everything still held in the ring is
+ * then fetched in reply-sized chunks and decoded, and each sample must
+ * match what was recorded. The encoded size and the encode and decode
+ * throughput are reported.
+ */
+
+#include "../fw/sensor.c"
+#include "../amiga/becdecode.c"
+#include <time.h>
+#include "test.h"
+
+#define TEST_SAMPLES  4096
+#define REPLY_MAX     (BEC_MSG_MAX_PAYLOAD - sizeof (bec_sensor_hist_t))
+
+config_t config;
+uint8_t  power_state = POWER_STATE_ON;
+
+static uint64_t now_msec;               // Simulated BEC time
+static int      adc_value[16];          // Simulated ADC readings
+static uint     fan_rpm;
+static uint     fan_percent;
+static uint32_t rand_state = 1;
+
+/* Samples as recorded, and the index of the next one to be decoded */
+static struct {
+    uint32_t msec;
+    int32_t  value[SENSOR_COUNT_MAX];
+} expect[TEST_SAMPLES];
+static uint expect_count;
+static uint decode_pos;
+static uint decode_bad;
+
+void
+fw_dprintf(uint32_t mask, const char *fmt, ...)
+{
+    (void) mask;
+    (void) fmt;
+}
+
+int
+adc_get_reading(uint which)
+{
+    return (adc_value[which]);
+}
+
+void
+adc_set_window(uint which, int calc_min, int calc_max)
+{
+    (void) which;
+    (void) calc_min;
+    (void) calc_max;
+}
+
+uint
+adc_get_seq(void)
+{
+    return (0);
+}
+
+void
+adc_setup_sensor(uint which, uint gpio_pack, uint adc_channel)
+{
+    (void) which;
+    (void) gpio_pack;
+    (void) adc_channel;
+}
+
+void
+adc_init(void)
+{
+}
+
+uint
+fan_get_rpm(void)
+{
+    return (fan_rpm);
+}
+
+uint
+fan_get_percent(void)
+{
+    return (fan_percent);
+}
+
+void
+fan_get_limits(int *limit_min, int *limit_max)
+{
+    *limit_min = 100000;
+    *limit_max = 4000000;
+}
+
+void
+power_init(void)
+{
+}
+
+uint
+power_rail_classify(uint good, uint bad)
+{
+    (void) good;
+    (void) bad;
+    return (POWER_STATE_FAULT);
+}
+
+/* BEC ticks are simulated in microseconds */
+uint64_t
+timer_tick_get(void)
+{
+    return (now_msec * 1000);
+}
+
+uint64_t
+timer_tick_to_usec(uint64_t value)
+{
+    return (value);
+}
+
+uint64_t
+timer_tick_plus_msec(uint msec)
+{
+    return ((now_msec + msec) * 1000);
+}
+
+bool
+timer_tick_has_elapsed(uint64_t value)
+{
+    return (now_msec * 1000 >= value);
+}
+
+static uint
+rand_next(uint range)
+{
+    rand_state = rand_state * 1103515245 + 12345;
+    return ((rand_state >> 8) % range);
+}
+
+/*
+ * advance() moves simulated time forward by about a second, with jitter
+ * as sensor_poll() runs when the ADC has a new sample, then changes the
+ * simulated readings. Most change by a few LSB; a few step by a lot.
+ */
+static void
+advance(void)
+{
+    uint cur;
+
+    now_msec += HIST_INTERVAL + rand_next(40);
+    for (cur = 0; cur < ARRAY_SIZE(adc_value); cur++) {
+        adc_value[cur] += (int) rand_next(9) - 4;
+        if (rand_next(200) == 0)
+            adc_value[cur] += (int) rand_next(2000) - 1000;
+    }
+    if (rand_next(30) == 0)
+        fan_rpm = 1000 + rand_next(2000);
+    fan_percent = 30 + (now_msec / 10000) % 40;
+}
+
+static void
+record(void)
+{
+    uint cur;
+
+    sensor_check_readings();
+    if (expect_count < TEST_SAMPLES) {
+        expect[expect_count].msec = now_msec;
+        for (cur = 0; cur < sensor_count; cur++)
+            expect[expect_count].value[cur] =
+                sensor_states[cur].ss_reading / 100;
+    }
+    expect_count++;
+}
+
+static void
+check_sample(uint32_t msec, const int32_t *value, uint sensors)
+{
+    if ((decode_pos >= expect_count) || (expect[decode_pos].msec != msec) ||
+        (sensors != sensor_count) ||
+        (memcmp(expect[decode_pos].value, value,
+                sensors * sizeof (*value)) != 0)) {
+        if (decode_bad++ == 0)
+            printf("  sample %u at %u msec does not match\n",
+                   decode_pos, msec);
+    }
+    decode_pos++;
+}
+
+static void
+null_sample(uint32_t msec, const int32_t *value, uint sensors)
+{
+    (void) msec;
+    (void) value;
+    (void) sensors;
+    decode_pos++;
+}
+
+static void
+setup(void)
+{
+    uint cur;
+
+    for (cur = 0; cur < ARRAY_SIZE(adc_value); cur++)
+        adc_value[cur] = 1000 + cur * 150;
+    fan_rpm = 2200;
+    adc_startup_time = 0;
+    now_msec = 5000;
+    hist_next = 0;
+}
+
+/*
+ * fetch_all() walks the ring as "bec history" does, starting from block
+ * seq. Returns the number of replies needed.
+ */
+static uint
+fetch_all(uint32_t seq, uint32_t time, bec_hist_func_t func)
+{
+    static uint8_t buf[REPLY_MAX];
+    uint32_t       last;
+    uint           replies = 0;
+    uint           count;
+    uint           len;
+
+    while (1) {
+        count = 0xff;
+        len = sensor_hist_get(&seq, &last, time, buf, sizeof (buf), &count);
+        if (count == 0)
+            break;
+        replies++;
+        CHECK(len <= sizeof (buf));
+        CHECK(bec_hist_decode(buf, len, count, sensor_count, func) == count);
+        seq += count;
+        if (seq > last)
+            break;
+    }
+    return (replies);
+}
+
+static void
+test_empty(void)
+{
+    uint8_t  buf[64];
+    uint32_t seq = 0;
+    uint32_t last;
+    uint     count = 4;
+
+    CHECK(sensor_hist_get(&seq, &last, 0, buf, sizeof (buf), &count) == 0);
+    CHECK(count == 0);
+}
+
+static void
+test_round_trip(void)
+{
+    uint32_t first_msec;
+    uint     samples;
+    uint     replies;
+    uint     first;
+    uint     cur;
+
+    for (cur = 0; cur < 600; cur++) {
+        record();
+        advance();
+    }
+
+    /* Everything still in the ring decodes to exactly what was recorded */
+    first = hist_blocks - HIST_BLOCKS;
+    first_msec = SWAP32(((bec_hist_blk_t *) hist_buf[first % HIST_BLOCKS])->
+                        bhb_time);
+    for (decode_pos = 0; expect[decode_pos].msec != first_msec; decode_pos++)
+        ;
+    samples = expect_count - decode_pos;
+    replies = fetch_all(0, 0, check_sample);
+    CHECK(decode_bad == 0);
+    CHECK(decode_pos == expect_count);
+    printf("  %u samples of %u sensors in %u blocks, fetched in %u replies\n",
+           samples, sensor_count, HIST_BLOCKS, replies);
+    printf("  %.1f bytes per sample in ring (%u raw), %.1f samples per reply\n",
+           (double) HIST_BLOCKS * BSH_BLOCK_SIZE / samples,
+           (sensor_count + 1) * 4, (double) samples / replies);
+    CHECK(replies <= HIST_BLOCKS / 4);
+
+    /* A time near the end of the ring skips the older blocks */
+    decode_pos = 0;
+    fetch_all(0, expect[expect_count - 60].msec, null_sample);
+    CHECK(decode_pos >= 60);
+    CHECK(decode_pos < 60 + BSH_BLOCK_SIZE / 8);
+}
+
+static void
+test_corrupt(void)
+{
+    static uint8_t  buf[REPLY_MAX];
+    bec_hist_blk_t *hdr = (bec_hist_blk_t *) buf;
+    uint32_t        seq = hist_blocks - 2;
+    uint32_t        last;
+    uint            count = 2;
+    uint            len;
+
+    len = sensor_hist_get(&seq, &last, 0, buf, sizeof (buf), &count);
+    CHECK(count == 2);
+
+    /* Truncated reply: only the first block is complete */
+    decode_pos = 0;
+    CHECK(bec_hist_decode(buf, len - 1, 2, sensor_count, null_sample) == 1);
+
+    /* Sensor count does not match the names the tool fetched */
+    CHECK(bec_hist_decode(buf, len, 2, sensor_count - 1, null_sample) == 0);
+
+    /* Block claims more samples than its data holds */
+    hdr->bhb_samples++;
+    CHECK(bec_hist_decode(buf, len, 2, sensor_count, null_sample) == 0);
+    hdr->bhb_samples--;
+
+    /* Old blocks which were overwritten are skipped */
+    seq = 0;
+    count = 1;
+    sensor_hist_get(&seq, &last, 0, buf, sizeof (buf), &count);
+    CHECK(seq == hist_blocks - HIST_BLOCKS);
+    CHECK(last == hist_blocks - 1);
+}
+
+static double
+nsec_now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (ts.tv_sec * 1e9 + ts.tv_nsec);
+}
+
+static void
+bench(void)
+{
+    const uint iters = 200000;
+    double     start;
+    double     t_enc;
+    double     t_dec;
+    uint       samples = 0;
+    uint       cur;
+
+    start = nsec_now();
+    for (cur = 0; cur < iters; cur++) {
+        now_msec += HIST_INTERVAL;
+        sensor_hist_record();
+    }
+    t_enc = (nsec_now() - start) / iters;
+
+    start = nsec_now();
+    for (cur = 0; cur < iters / 256; cur++) {
+        decode_pos = 0;
+        fetch_all(0, 0, null_sample);
+        samples += decode_pos;
+    }
+    t_dec = (nsec_now() - start) / samples;
+    printf("  host: encode %.0f ns, fetch and decode %.0f ns per sample "
+           "(%.1f M readings/sec)\n", t_enc, t_dec,
+           sensor_count / t_dec * 1e3);
+}
+
+int
+main(void)
+{
+    printf("sensor_hist:\n");
+    setup();
+    test_empty();
+    test_round_trip();
+    test_corrupt();
+    bench();
+    return (test_result("sensor_hist"));
+}
@@ -0,0 +1,486 @@
+/*
+ * This is free and unencumbered software released into the public domain.
+ * See the LICENSE file for additional details.
+ *
+ * Designed by Chris Hooper in 2025.
+ *
+ * ---------------------------------------------------------------------
+ *
+ * Host test of the GPIO bus sampler (fw/snoop.c) and the Amiga side
+ * replay decoder (bec_snoop_decode() in amiga/becdecode.c). Synthesized
+ * RTC bus traffic drives GPIOB, which the modelled TIM1 triggered DMA
+ * samples into the capture buffer while snoop_capture() polls for the
+ * trigger with realistic loop timing and occasional interrupt stalls.
+ * Each capture must place the trigger on the first sample which meets
+ * the condition, and must survive export as run-length BEC replies and
+ * replay on the Amiga side unchanged. Compression and decode throughput
+ * are reported.
+ */
+
+#include <stdio.h>
+#include <stdarg.h>
+#include <stdlib.h>
+
+static int
+snoop_printf(const char *fmt, ...)
+{
+    (void) fmt;
+    return (0);
+}
+
+#define printf snoop_printf
+#include "../fw/snoop.c"
+#undef printf
+
+#include <time.h>
+#include <exec/types.h>
+#include "../amiga/becdecode.c"
+#include "test.h"
+
+#define APB2_HZ      60000000
+#define TIMCLK_HZ    (APB2_HZ * 2)   // TIM1 counter clock, also sim ticks
+#define NSEC(x)      ((uint64_t) (x) * TIMCLK_HZ / 1000000000)
+#define POLL_TICKS   NSEC(90)        // One pass of the trigger poll loop
+#define STALL_CHANCE 200             // One poll in this many is interrupted
+#define STALL_TICKS  NSEC(3000)      // Interrupt service time
+#define MAX_EDGES    200000
+#define REPLY_RUNS   ((BEC_MSG_MAX_PAYLOAD - sizeof (bec_snoop_t)) / \
+                      sizeof (bec_snoop_run_t))
+
+#define BUS_IDLE     (RTCEN_PIN | R_WA_PIN)
+
+volatile uint32_t ocm3_regs[256];
+
+/* Modelled bus: value of GPIOB from each edge on */
+static struct {
+    uint64_t tick;
+    uint16_t value;
+} edges[MAX_EDGES];
+static uint     edge_count;
+
+static uint64_t now_tick;            // Simulated time, in TIM1 clocks
+static uint32_t gpio_value;          // GPIOB IDR as the CPU last read it
+static uint     dma_running;
+static uint     dma_pos;             // Next buffer position DMA writes
+static uint64_t dma_next;            // Time of next TIM1 update
+static uint32_t dma_period;
+static uint64_t sample_tick[SNOOP_SAMPLES];  // Time each sample was taken
+static uint64_t cpu_seen;            // When the poll loop saw the trigger
+static uint16_t cpu_mask;
+static uint16_t cpu_value;
+static uint32_t rand_state = 1;
+
+/* Replayed capture */
+static uint16_t replay[SNOOP_SAMPLES];
+static uint     replay_pos;
+static uint     replay_trigger;
+static int64_t  replay_nsec;
+
+uint32_t
+clock_get_apb2(void)
+{
+    return (APB2_HZ);
+}
+
+int
+input_break_pending(void)
+{
+    return (0);
+}
+
+void
+fw_dprintf(uint32_t mask, const char *fmt, ...)
+{
+    (void) mask;
+    (void) fmt;
+}
+
+static uint
+rand_next(uint range)
+{
+    rand_state = rand_state * 1103515245 + 12345;
+    return ((rand_state >> 8) % range);
+}
+
+/* wave() returns the value of the modelled bus at the specified time */
+static uint16_t
+wave(uint64_t tick)
+{
+    uint lo = 0;
+    uint hi = edge_count;
+
+    if ((edge_count == 0) || (tick < edges[0].tick))
+        return (BUS_IDLE);
+    while (hi - lo > 1) {
+        uint mid = (lo + hi) / 2;
+        if (edges[mid].tick <= tick)
+            lo = mid;
+        else
+            hi = mid;
+    }
+    return (edges[lo].value);
+}
+
+/*
+ * dma_sync() performs the DMA transfers which TIM1 update events have
+ * requested up to the current time.
+ */
+static void
+dma_sync(void)
+{
+    if ((TIM_DIER(TIM1) & TIM_DIER_UDE) == 0) {
+        dma_running = 0;
+        return;
+    }
+    if (dma_running == 0) {
+        dma_running = 1;
+        dma_pos = 0;
+        dma_next = now_tick + dma_period;
+    }
+    while (dma_next <= now_tick) {
+        snoop_buf[dma_pos] = wave(dma_next);
+        sample_tick[dma_pos] = dma_next;
+        dma_pos = (dma_pos + 1) % SNOOP_SAMPLES;
+        dma_next += dma_period;
+    }
+}
+
+volatile uint32_t *
+ocm3_gpio_idr(uint32_t port)
+{
+    (void) port;
+    now_tick += POLL_TICKS;
+    if (rand_next(STALL_CHANCE) == 0)
+        now_tick += STALL_TICKS;
+    dma_sync();
+    gpio_value = wave(now_tick);
+    if ((cpu_seen == 0) && ((gpio_value & cpu_mask) == cpu_value))
+        cpu_seen = now_tick;
+    return (&gpio_value);
+}
+
+uint32_t
+ocm3_dma_sndtr(uint32_t dma, uint32_t stream)
+{
+    (void) dma;
+    (void) stream;
+    now_tick += NSEC(20);
+    dma_sync();
+    return (SNOOP_SAMPLES - dma_pos);
+}
+
+void
+timer_delay_usec(uint usec)
+{
+    dma_sync();
+    now_tick += (uint64_t) usec * (TIMCLK_HZ / 1000000);
+    dma_sync();
+}
+
+static void
+edge(uint64_t tick, uint16_t value)
+{
+    if (edge_count < MAX_EDGES) {
+        edges[edge_count].tick = tick;
+        edges[edge_count].value = value;
+        edge_count++;
+    }
+}
+
+/*
+ * rtc_access() adds one Amiga RTC register access to the modelled bus:
+ * address and direction first, then _RTCEN, then data (the RP5C01
+ * drives read data later than the CPU drives write data).
+ */
+static uint64_t
+rtc_access(uint64_t tick, uint rd, uint addr, uint data)
+{
+    uint16_t bus = (addr << 10) | (rd ? R_WA_PIN : 0) | RTCEN_PIN;
+
+    edge(tick, bus);
+    edge(tick + NSEC(60), bus & ~RTCEN_PIN);
+    edge(tick + NSEC(rd ? 240 : 80), (bus & ~RTCEN_PIN) | (data << 4));
+    edge(tick + NSEC(500), bus | (data << 4));
+    edge(tick + NSEC(560), BUS_IDLE);
+    return (tick + NSEC(1500 + rand_next(1000)));
+}
+
+/*
+ * build_bus() replaces the modelled bus with bursts of RTC accesses,
+ * the first starting at tick. Returns the time of the first _RTCEN.
+ */
+static uint64_t
+build_bus(uint64_t tick)
+{
+    uint64_t first = tick + NSEC(60);
+    uint     burst;
+
+    edge_count = 0;
+    for (burst = 0; burst < 200; burst++) {
+        uint count = 10 + rand_next(30);
+        while (count-- > 0)
+            tick = rtc_access(tick, rand_next(2), rand_next(16),
+                              rand_next(16));
+        tick += NSEC(50000 + rand_next(450000));
+    }
+    return (first);
+}
+
+static void
+sim_reset(uint32_t rate)
+{
+    memset((void *) ocm3_regs, 0, sizeof (ocm3_regs));
+    now_tick = NSEC(1000000);
+    dma_running = 0;
+    dma_period = TIMCLK_HZ / rate;
+    cpu_seen = 0;
+}
+
+/* rotate() reorders the sample times as snoop_capture() did the buffer */
+static void
+rotate(void)
+{
+    static uint64_t temp[SNOOP_SAMPLES];
+    uint            cur;
+
+    for (cur = 0; cur < SNOOP_SAMPLES; cur++)
+        temp[cur] = sample_tick[(dma_pos + cur) % SNOOP_SAMPLES];
+    memcpy(sample_tick, temp, sizeof (sample_tick));
+}
+
+static void
+replay_run(uint pos, int64_t nsec, uint16_t value, uint count,
+           uint is_trigger)
+{
+    CHECK(pos == replay_pos);
+    while ((count-- > 0) && (replay_pos < SNOOP_SAMPLES))
+        replay[replay_pos++] = value;
+    if (is_trigger) {
+        replay_trigger++;
+        replay_nsec = nsec;
+    }
+}
+
+/*
+ * export() fetches the capture as "bec snoop" does, through
+ * BEC_CMD_SNOOP replies, and replays it. Returns the bytes sent.
+ */
+static uint
+export(uint *replies)
+{
+    static bec_snoop_run_t runs[REPLY_RUNS];
+    bec_snoop_t            info;
+    uint                   pos = 0;
+    uint                   bytes = 0;
+    uint                   count;
+
+    CHECK(snoop_get_info(&info) == SNOOP_SAMPLES);
+    replay_pos = 0;
+    replay_trigger = 0;
+    *replies = 0;
+    while (pos < snoop_cap.samples) {
+        uint start = pos;
+        count = snoop_get_runs(&pos, runs, REPLY_RUNS);
+        bytes += sizeof (info) + count * sizeof (*runs);
+        (*replies)++;
+        CHECK(bec_snoop_decode((const uint8_t *) runs, count, start,
+                               __builtin_bswap16(info.bsn_trigger),
+                               __builtin_bswap32(info.bsn_rate),
+                               replay_run) == pos);
+    }
+    CHECK(replay_pos == SNOOP_SAMPLES);
+    CHECK(memcmp(replay, snoop_buf, sizeof (replay)) == 0);
+    return (bytes);
+}
+
+/*
+ * first_met() returns the first captured sample taken at or after tick
+ * which meets the trigger condition, as the capture should report.
+ */
+static uint
+first_met(uint64_t tick, uint16_t mask, uint16_t value, uint change)
+{
+    uint cur;
+
+    for (cur = 0; cur < SNOOP_SAMPLES; cur++) {
+        uint16_t sample = snoop_buf[cur] & mask;
+        if ((sample_tick[cur] >= tick) &&
+            (change ? (sample != value) : (sample == value)))
+            break;
+    }
+    return (cur);
+}
+
+/*
+ * test_trigger() captures until RTC bus access for a range of sample
+ * rates and pre-trigger percentages, then replays each capture. At
+ * 1 MHz, _RTCEN pulses are shorter than the sample period, so the first
+ * accesses may fall between samples.
+ */
+static void
+test_trigger(void)
+{
+    static const uint32_t rates[] = { 1000000, SNOOP_RATE_DEFAULT,
+                                      SNOOP_RATE_MAX };
+    static const uint     pres[] = { 10, 50, 90 };
+    uint                  rcur;
+    uint                  pcur;
+
+    for (rcur = 0; rcur < ARRAY_SIZE(rates); rcur++) {
+        double err_max = 0;
+        uint   lag_max = 0;
+        uint   bytes_max = 0;
+        uint   replies_max = 0;
+
+        for (pcur = 0; pcur < ARRAY_SIZE(pres); pcur++) {
+            uint64_t first;
+            uint64_t fill;
+            double   err;
+            uint     trig;
+            uint     lag;
+            uint     replies;
+            uint     bytes;
+            uint     trial;
+
+            for (trial = 0; trial < 40; trial++) {
+                sim_reset(rates[rcur]);
+                fill = (uint64_t) SNOOP_SAMPLES * dma_period;
+                first = build_bus(now_tick + fill + NSEC(10000) +
+                                  rand_next(NSEC(200000)));
+                cpu_mask = RTCEN_PIN;
+                cpu_value = 0;
+                CHECK(snoop_capture('B', rates[rcur], RTCEN_PIN, 0, 0,
+                                    pres[pcur]) == RC_SUCCESS);
+                rotate();
+                trig = snoop_cap.trigger;
+
+                /* Trigger is the first sample to see an access */
+                CHECK(snoop_cap.triggered);
+                CHECK(snoop_cap.rate == rates[rcur]);
+                CHECK(trig == first_met(first, RTCEN_PIN, 0, 0));
+                CHECK(trig > 0);
+                CHECK((snoop_buf[trig] & RTCEN_PIN) == 0);
+                CHECK((snoop_buf[trig - 1] & RTCEN_PIN) != 0);
+                lag = 0;
+                if (cpu_seen > sample_tick[trig])
+                    lag = (cpu_seen - sample_tick[trig]) / dma_period;
+                CHECK(trig <= SNOOP_SAMPLES * pres[pcur] / 100 + 16);
+                CHECK(trig + 16 + lag >= SNOOP_SAMPLES * pres[pcur] / 100);
+                if (lag > lag_max)
+                    lag_max = lag;
+                err = (sample_tick[trig] - first) * 1e9 / TIMCLK_HZ;
+                if (err > err_max)
+                    err_max = err;
+
+                bytes = export(&replies);
+                CHECK(replay_trigger == 1);
+                CHECK(replay_nsec == 0);
+                if (bytes > bytes_max)
+                    bytes_max = bytes;
+                if (replies > replies_max)
+                    replies_max = replies;
+            }
+        }
+        printf("  %5.2f MHz: trigger %4.0f ns after _RTCEN, CPU up to %2u "
+               "samples later; export %4u bytes in %u replies (raw %u)\n",
+               rates[rcur] / 1e6, err_max, lag_max, bytes_max, replies_max,
+               SNOOP_SAMPLES * 2);
+    }
+}
+
+/* Trigger on change of the RTC address lines */
+static void
+test_change(void)
+{
+    uint64_t first;
+    uint     trig;
+    uint16_t mask = 0xf << 10;
+
+    sim_reset(SNOOP_RATE_DEFAULT);
+    first = build_bus(now_tick + NSEC(2000000));
+    cpu_mask = 0;
+    CHECK(snoop_capture('B', SNOOP_RATE_DEFAULT, mask, 0, SNOOP_TRIG_CHANGE,
+                        50) == RC_SUCCESS);
+    rotate();
+    trig = snoop_cap.trigger;
+    CHECK(snoop_cap.triggered);
+    CHECK(trig == first_met(first, mask, 0, 1));
+    CHECK((snoop_buf[trig] & mask) != 0);
+    CHECK((snoop_buf[trig - 1] & mask) == 0);
+}
+
+/* A mask of 0 captures immediately, and bad arguments are refused */
+static void
+test_now(void)
+{
+    uint replies;
+
+    sim_reset(SNOOP_RATE_DEFAULT);
+    build_bus(now_tick);
+    CHECK(snoop_capture('B', SNOOP_RATE_DEFAULT, 0, 0, 0, 50) == RC_SUCCESS);
+    CHECK(snoop_cap.triggered == 0);
+    CHECK(snoop_cap.samples == SNOOP_SAMPLES);
+    export(&replies);
+    CHECK(snoop_capture('F', SNOOP_RATE_DEFAULT, 0, 0, 0, 50) ==
+          RC_BAD_PARAM);
+    CHECK(snoop_capture('B', 0, 0, 0, 0, 50) == RC_BAD_PARAM);
+    CHECK(snoop_capture('B', SNOOP_RATE_DEFAULT, 0, 0, 0, 101) ==
+          RC_BAD_PARAM);
+}
+
+static void
+null_run(uint pos, int64_t nsec, uint16_t value, uint count, uint is_trigger)
+{
+    (void) pos;
+    (void) nsec;
+    (void) value;
+    (void) count;
+    (void) is_trigger;
+}
+
+static double
+nsec_now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (ts.tv_sec * 1e9 + ts.tv_nsec);
+}
+
+static void
+bench(void)
+{
+    static bec_snoop_run_t runs[SNOOP_SAMPLES];
+    const uint             iters = 2000;
+    double                 start;
+    double                 t_enc;
+    double                 t_dec;
+    uint                   count = 0;
+    uint                   pos;
+    uint                   cur;
+
+    start = nsec_now();
+    for (cur = 0; cur < iters; cur++) {
+        pos = 0;
+        count = snoop_get_runs(&pos, runs, ARRAY_SIZE(runs));
+    }
+    t_enc = (nsec_now() - start) / iters / SNOOP_SAMPLES;
+
+    start = nsec_now();
+    for (cur = 0; cur < iters; cur++)
+        bec_snoop_decode((const uint8_t *) runs, count, 0, 0,
+                         SNOOP_RATE_DEFAULT, null_run);
+    t_dec = (nsec_now() - start) / iters / count;
+    printf("  host: encode %.1f ns per sample, decode %.1f ns per run\n",
+           t_enc, t_dec);
+}
+
+int
+main(void)
+{
+    printf("snoop:\n");
+    test_trigger();
+    test_change();
+    test_now();
+    bench();
+    return (test_result("snoop"));
+}
@@ -0,0 +1,315 @@
+/*
+ * This is free and unencumbered software released into the public domain.
+ * See the LICENSE file for additional details.
+ *
+ * Designed by Chris Hooper in 2025.
+ *
+ * ---------------------------------------------------------------------
+ *
+ * Host simulation of gamepad stick pointer motion (fw/mouse.c). Stick
+ * traces are delivered as USB reports at a chosen interval, mouse_poll()
+ * runs from the main loop, and the quadrature lines are decoded back to
+ * an Amiga pointer position. Pointer speed against deflection, report
+ * rate independence, diagonal accuracy, dead zone behaviour at rest, and
+ * the slowest controllable motion are measured. The previous per-report
+ * delta of the stick's high byte / 32 is modeled for comparison.
+ */
+
+#include "../fw/mouse.c"
+#include <stdlib.h>
+#include "test.h"
+
+#define LOOP_USEC     50      // Main loop period (mouse_poll() calls)
+#define SETTLE_USEC   100000  // Ignored at the start of each trace
+#define TRACE_USEC    2000000
+
+config_t config;
+uint     config_gen = 1;
+
+static uint64_t now;          // Ticks are usec
+static uint32_t gpio[4];      // Port 0 U, R, D, L
+static int      pos_x;        // Decoded pointer position (counts)
+static int      pos_y;
+static uint32_t rand_state = 1;
+
+static uint
+rand32(void)
+{
+    rand_state = rand_state * 1103515245 + 12345;
+    return (rand_state >> 8);
+}
+
+void
+fw_dprintf(uint32_t mask, const char *fmt, ...)
+{
+    (void) mask;
+    (void) fmt;
+}
+
+uint8_t
+capture_scancode(uint16_t keycode)
+{
+    (void) keycode;
+    return (0);
+}
+
+void
+keyboard_put_macro(uint32_t macro, uint is_pressed)
+{
+    (void) macro;
+    (void) is_pressed;
+}
+
+void
+hiden_set(unsigned int enable)
+{
+    (void) enable;
+}
+
+uint64_t
+timer_tick_get(void)
+{
+    return (now);
+}
+
+uint64_t
+timer_usec_to_tick(uint usec)
+{
+    return (usec);
+}
+
+uint64_t
+timer_tick_plus_usec(uint usec)
+{
+    return (now + usec);
+}
+
+bool
+timer_tick_has_elapsed(uint64_t value)
+{
+    return (now >= value);
+}
+
+/* poll() runs mouse_poll() and decodes the quadrature state it drives */
+static void
+poll(void)
+{
+    uint8_t lastx = xquad;
+    uint8_t lasty = yquad;
+
+    mouse_poll();
+    pos_x += (((lastx - xquad) & 3) == 1) - (((xquad - lastx) & 3) == 1);
+    pos_y += (((lasty - yquad) & 3) == 1) - (((yquad - lasty) & 3) == 1);
+}
+
+/* old_delta() is the previous per-report motion from a stick axis */
+static int
+old_delta(int axis)
+{
+    return ((axis >> 8) / 32);
+}
+
+/*
+ * trace() holds the stick at a position, with +-noise of sensor jitter,
+ * reporting every report_usec. Returns pointer speeds in counts/sec,
+ * measured after the motion has settled.
+ */
+static void
+trace(int sx, int sy, uint noise, uint report_usec, uint old,
+      int *speed_x, int *speed_y)
+{
+    uint64_t start = now;
+    uint64_t next_report = now;
+    int      x0 = 0;
+    int      y0 = 0;
+
+    for (; now < start + TRACE_USEC; now += LOOP_USEC) {
+        if (now >= next_report) {
+            int x = sx;
+            int y = sy;
+            if (noise != 0) {
+                x += (int) (rand32() % (2 * noise + 1)) - (int) noise;
+                y += (int) (rand32() % (2 * noise + 1)) - (int) noise;
+            }
+            if (old)
+                mouse_action(old_delta(x), old_delta(y), 0, 0);
+            else
+                mouse_stick(x, y);
+            next_report += report_usec;
+        }
+        if (now == start + SETTLE_USEC) {
+            x0 = pos_x;
+            y0 = pos_y;
+        }
+        poll();
+    }
+    *speed_x = (int64_t) (pos_x - x0) * 1000000 /
+               (TRACE_USEC - SETTLE_USEC);
+    *speed_y = (int64_t) (pos_y - y0) * 1000000 /
+               (TRACE_USEC - SETTLE_USEC);
+
+    /* Release and let the output drain */
+    mouse_stick(0, 0);
+    for (start = now; now < start + 20000; now += LOOP_USEC)
+        poll();
+}
+
+static void
+stick_config(uint deadzone, uint expo, uint speed)
+{
+    config.stick_deadzone = deadzone;
+    config.stick_expo = expo;
+    config.stick_speed = speed;
+    config_gen++;
+}
+
+static int
+pct(uint percent)
+{
+    return (STICK_MAX * (int) percent / 100);
+}
+
+static void
+sim_init(void)
+{
+    p0_u_gpio = &gpio[0];
+    p0_r_gpio = &gpio[1];
+    p0_d_gpio = &gpio[2];
+    p0_l_gpio = &gpio[3];
+    mouse_set_defaults();
+}
+
+/*
+ * test_curve() measures speed against deflection for linear, blended,
+ * and cubic curves. Speed must rise with deflection, except where a
+ * curved response is still below one count per second, and reach the
+ * configured top speed.
+ */
+static void
+test_curve(void)
+{
+    static const uint defl[] = { 12, 15, 25, 50, 75, 100 };
+    static const uint expos[] = { 0, 50, 100 };
+    uint e;
+    uint d;
+    int  sx;
+    int  sy;
+
+    printf("stick:\n");
+    printf("    deflection %%  ");
+    for (d = 0; d < ARRAY_SIZE(defl); d++)
+        printf("%6u", defl[d]);
+    printf("   (counts/sec)\n");
+    for (e = 0; e < ARRAY_SIZE(expos); e++) {
+        int last = -1;
+
+        stick_config(STICK_DEF_DEADZONE, expos[e], 0);
+        printf("    expo %3u     ", expos[e]);
+        for (d = 0; d < ARRAY_SIZE(defl); d++) {
+            trace(pct(defl[d]), 0, 0, 8000, 0, &sx, &sy);
+            CHECK((sx > last) || ((sx == 0) && (expos[e] != 0)));
+            CHECK(sy == 0);
+            last = sx;
+            printf("%6d", sx);
+        }
+        printf("\n");
+        CHECK(abs(last - STICK_DEF_SPEED) <= STICK_DEF_SPEED / 50);
+    }
+    printf("    old (8 ms)   ");
+    for (d = 0; d < ARRAY_SIZE(defl); d++) {
+        trace(pct(defl[d]), 0, 0, 8000, 1, &sx, &sy);
+        printf("%6d", sx);
+    }
+    printf("\n");
+}
+
+/*
+ * test_rate() checks that full deflection gives the configured speed
+ * whatever the USB report interval. The old delta scaled with it.
+ */
+static void
+test_rate(void)
+{
+    static const uint report_us[] = { 1000, 4000, 8000, 16000 };
+    static const uint speeds[] = { 400, STICK_DEF_SPEED, 2000,
+                                   STICK_SPEED_MAX };
+    uint r;
+    uint s;
+    int  sx;
+    int  sy;
+
+    printf("    full deflection, report interval  ");
+    for (r = 0; r < ARRAY_SIZE(report_us); r++)
+        printf("%5u ms", report_us[r] / 1000);
+    printf("\n");
+    for (s = 0; s < ARRAY_SIZE(speeds); s++) {
+        stick_config(STICK_DEF_DEADZONE, 0, speeds[s]);
+        printf("      speed %4u %20s", speeds[s], "");
+        for (r = 0; r < ARRAY_SIZE(report_us); r++) {
+            trace(0, pct(100), 0, report_us[r], 0, &sx, &sy);
+            CHECK(sx == 0);
+            CHECK(abs(sy - (int) speeds[s]) <= (int) speeds[s] / 50);
+            printf("%8d", sy);
+        }
+        printf("\n");
+    }
+    printf("      old %27s", "");
+    for (r = 0; r < ARRAY_SIZE(report_us); r++) {
+        trace(0, pct(100), 0, report_us[r], 1, &sx, &sy);
+        printf("%8d", sy);
+    }
+    printf("\n");
+}
+
+/*
+ * test_precision() checks diagonal motion, rest with a worn stick, and
+ * the slowest motion available just past the dead zone.
+ */
+static void
+test_precision(void)
+{
+    int sx;
+    int sy;
+    int slow;
+    int old_slow = 0;
+    uint d;
+
+    /* Diagonal: equal components, total limited to the top speed */
+    stick_config(STICK_DEF_DEADZONE, 0, 0);
+    trace(pct(100), -pct(100), 0, 8000, 0, &sx, &sy);
+    CHECK(abs(sx + sy) <= sx / 100 + 1);
+    CHECK(abs(sx * 1414 / 1000 - STICK_DEF_SPEED) <= STICK_DEF_SPEED / 50);
+    printf("    diagonal: %d, %d counts/sec\n", sx, sy);
+
+    /* A stick resting 6% off center, with sensor jitter */
+    trace(pct(6), pct(-3), pct(2), 8000, 0, &sx, &sy);
+    CHECK((sx == 0) && (sy == 0));
+    stick_config(0, 0, 0);
+    trace(pct(6), pct(-3), pct(2), 8000, 0, &sx, &sy);
+    CHECK(sx > 0);  // A dead zone of 0 is no dead zone
+    printf("    stick at rest 6%% off center: still with %u%% dead zone, "
+           "%d counts/sec with none\n", STICK_DEF_DEADZONE, sx);
+
+    /* Slowest steady motion */
+    stick_config(STICK_DEF_DEADZONE, 0, 0);
+    trace(pct(STICK_DEF_DEADZONE + 1), 0, 0, 8000, 0, &slow, &sy);
+    CHECK(slow > 0);
+    CHECK(slow <= STICK_DEF_SPEED / 50);
+    for (d = 1; (d <= 100) && (old_slow == 0); d++)
+        trace(pct(d), 0, 0, 8000, 1, &old_slow, &sy);
+    CHECK(old_slow > slow);
+    printf("    slowest motion: %d counts/sec (old %d counts/sec from "
+           "%u%% deflection)\n", slow, old_slow, d - 1);
+    printf("    (%u ms integration period; %u us main loop)\n",
+           STICK_TICK_USEC / 1000, LOOP_USEC);
+}
+
+int
+main(void)
+{
+    sim_init();
+    test_curve();
+    test_rate();
+    test_precision();
+    return (test_result("stick"));
+}
@@ -0,0 +1,100 @@
+/*
+ * This is free and unencumbered software released into the public domain.
+ * See the LICENSE file for additional details.
+ *
+ * Designed by Chris Hooper in 2025.
+ *
+ * ---------------------------------------------------------------------
+ *
+ * Host replacements for the AmigaOS library calls used by the Amiga tool
+ * sources under test. There is a single task on the host, so locking
+ * and interrupt control calls do nothing, unless a test which models
+ * several tasks defines AMIGA_HOST_TASKS and provides them.
+ */
+
+#ifndef _AMIGA_HOST_H
+#define _AMIGA_HOST_H
+
+#include <stdlib.h>
+#include <exec/types.h>
+
+#define MEMF_PUBLIC  (1 << 0)
+#define MEMF_CLEAR   (1 << 16)
+
+struct ExecBase;
+struct iob;
+
+struct Node {
+    struct Node *ln_Succ;
+    struct Node *ln_Pred;
+    char        *ln_Name;
+};
+
+struct SignalSemaphore {
+    struct Node ss_Link;
+    int         ss_NestCount;
+};
+
+/*
+ * The NDK provides these CIA registers before becmsg.c defines them.
+ * They are only ever read by the message transport, not by host tests.
+ */
+#define CIAA_TBLO     VADDR8(0x00bfe601)
+#define CIAA_TBHI     VADDR8(0x00bfe701)
+
+#define Disable()
+#define Enable()
+
+static inline void *
+AllocMem(ULONG size, ULONG flags)
+{
+    (void) flags;
+    return (calloc(1, size));
+}
+
+static inline void
+FreeMem(void *ptr, ULONG size)
+{
+    (void) size;
+    free(ptr);
+}
+
+#ifdef AMIGA_HOST_TASKS
+/* A test which models several tasks defines scheduling and semaphores */
+void Forbid(void);
+void Permit(void);
+struct SignalSemaphore *FindSemaphore(const char *name);
+void AddSemaphore(struct SignalSemaphore *sem);
+void ObtainSemaphore(struct SignalSemaphore *sem);
+void ReleaseSemaphore(struct SignalSemaphore *sem);
+#else
+#define Forbid()
+#define Permit()
+
+static inline struct SignalSemaphore *
+FindSemaphore(const char *name)
+{
+    (void) name;
+    return (NULL);
+}
+
+static inline void
+AddSemaphore(struct SignalSemaphore *sem)
+{
+    (void) sem;
+}
+
+static inline void
+ObtainSemaphore(struct SignalSemaphore *sem)
+{
+    sem->ss_NestCount++;
+}
+
+static inline void
+ReleaseSemaphore(struct SignalSemaphore *sem)
+{
+    sem->ss_NestCount--;
+}
+#endif
+
+#endif /* _AMIGA_HOST_H */
@@ -0,0 +1,36 @@
+/*
+ * This is free and unencumbered software released into the public domain.
+ * See the LICENSE file for additional details.
+ *
+ * Designed by Chris Hooper in 2025.
+ *
+ * ---------------------------------------------------------------------
+ *
+ * Host replacement for the expansion.library definitions used by the
+ * Amiga PCI tools: only the Zorro board description is needed.
+ */
+
+#ifndef CLIB_EXPANSION_PROTOS_H
+#define CLIB_EXPANSION_PROTOS_H
+
+#include <exec/types.h>
+
+struct ExpansionRom {
+    UBYTE er_Type;
+    UBYTE er_Product;
+    UBYTE er_Flags;
+    UBYTE er_Reserved03;
+    UWORD er_Manufacturer;
+    ULONG er_SerialNumber;
+    UWORD er_InitDiagVec;
+};
+
+struct ConfigDev {
+    UBYTE               cd_Flags;
+    UBYTE               cd_Pad;
+    struct ExpansionRom cd_Rom;
+    APTR                cd_BoardAddr;
+    ULONG               cd_BoardSize;
+};
+
+#endif /* CLIB_EXPANSION_PROTOS_H */
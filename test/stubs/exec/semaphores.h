@@ -0,0 +1 @@
+#include <amiga_host.h>
@@ -0,0 +1,34 @@
+/*
+ * This is free and unencumbered software released into the public domain.
+ * See the LICENSE file for additional details.
+ *
+ * Designed by Chris Hooper in 2025.
+ *
+ * ---------------------------------------------------------------------
+ *
+ * Host replacement for the AmigaOS exec/types.h.
+ */
+
+#ifndef EXEC_TYPES_H
+#define EXEC_TYPES_H
+
+#include <stdint.h>
+
+typedef unsigned int uint;
+
+typedef void          *APTR;
+typedef int32_t        LONG;
+typedef uint32_t       ULONG;
+typedef int16_t        WORD;
+typedef uint16_t       UWORD;
+typedef int8_t         BYTE;
+typedef uint8_t        UBYTE;
+typedef char          *STRPTR;
+typedef int16_t        BOOL;
+
+#ifndef TRUE
+#define TRUE  1
+#define FALSE 0
+#endif
+
+#endif /* EXEC_TYPES_H */
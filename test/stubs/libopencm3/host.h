@@ -0,0 +1,374 @@
+/*
+ * This is free and unencumbered software released into the public domain.
+ * See the LICENSE file for additional details.
+ *
+ * Designed by Chris Hooper in 2025.
+ *
+ * ---------------------------------------------------------------------
+ *
+ * Host replacement for the parts of libopencm3 used by firmware sources
+ * under test. Peripheral setup calls do nothing, and registers are
+ * backed by a scratch array, so that the code which drives the
+ * peripheral compiles unchanged while a test calls the logic above it.
+ */
+
+#ifndef _LIBOPENCM3_HOST_H
+#define _LIBOPENCM3_HOST_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+/* Calls which configure hardware; arguments are evaluated and ignored */
+static inline void
+ocm3_nop(int unused, ...)
+{
+    (void) unused;
+}
+
+static inline uint32_t
+ocm3_zero(int unused, ...)
+{
+    (void) unused;
+    return (0);
+}
+
+/* Registers read as what was last written, by address */
+extern volatile uint32_t ocm3_regs[256];
+#define OCM3_REG(x) (ocm3_regs[((uintptr_t) (x)) & 0xff])
+
+#define cm_disable_interrupts()     ocm3_nop(0)
+#define cm_enable_interrupts()      ocm3_nop(0)
+
+#define nvic_set_priority(...)      ocm3_nop(0, __VA_ARGS__)
+#define nvic_enable_irq(...)        ocm3_nop(0, __VA_ARGS__)
+#define nvic_disable_irq(...)       ocm3_nop(0, __VA_ARGS__)
+#define NVIC_DMA2_STREAM4_IRQ       60
+#define NVIC_TIM4_IRQ               30
+#define NVIC_EXTI15_10_IRQ          40
+
+#define rcc_periph_clock_enable(...) ocm3_nop(0, __VA_ARGS__)
+#define RCC_ADC1                    1
+#define RCC_DMA2                    2
+#define RCC_AFIO                    3
+#define RCC_USART1                  4
+#define RCC_GPIOA                   5
+#define RCC_GPIOB                   6
+#define RCC_OTGFS                   7
+
+/* DMA */
+#define DMA2                        0x40026400
+#define DMA_STREAM4                 4
+#define DMA_HTIF                    0x10
+#define DMA_TCIF                    0x20
+#define DMA_SxCR_DIR_PERIPHERAL_TO_MEM 0
+#define DMA_SxCR_PSIZE_16BIT        1
+#define DMA_SxCR_PL_HIGH            2
+#define DMA_SxCR_PL_VERY_HIGH       3
+#define DMA_SxCR_MSIZE_16BIT        1
+#define DMA_SxCR_CHSEL_6            6
+#define DMA_SxCR_EN                 (1 << 0)
+#define DMA_TEIF                    0x08
+#define DMA_DMEIF                   0x04
+#define DMA_FEIF                    0x01
+#define DMA_SCR(port, n)            OCM3_REG((port) + 0x10 + 0x18 * (n))
+#define DMA_SxCR_MBURST_SINGLE      0
+#define DMA_SxCR_PBURST_SINGLE      0
+#define DMA_SxFCR_FTH_2_4_FULL      1
+#define dma_disable_stream(...)     ocm3_nop(0, __VA_ARGS__)
+#define dma_enable_stream(...)      ocm3_nop(0, __VA_ARGS__)
+#define dma_set_peripheral_address(...) ocm3_nop(0, __VA_ARGS__)
+#define dma_set_memory_address(...) ocm3_nop(0, __VA_ARGS__)
+#define dma_set_transfer_mode(...)  ocm3_nop(0, __VA_ARGS__)
+#define dma_set_number_of_data(...) ocm3_nop(0, __VA_ARGS__)
+#define dma_channel_select(...)     ocm3_nop(0, __VA_ARGS__)
+#define dma_disable_peripheral_increment_mode(...) ocm3_nop(0, __VA_ARGS__)
+#define dma_enable_memory_increment_mode(...) ocm3_nop(0, __VA_ARGS__)
+#define dma_set_peripheral_size(...) ocm3_nop(0, __VA_ARGS__)
+#define dma_set_memory_size(...)    ocm3_nop(0, __VA_ARGS__)
+#define dma_enable_circular_mode(...) ocm3_nop(0, __VA_ARGS__)
+#define dma_set_priority(...)       ocm3_nop(0, __VA_ARGS__)
+#define dma_enable_direct_mode(...) ocm3_nop(0, __VA_ARGS__)
+#define dma_set_fifo_threshold(...) ocm3_nop(0, __VA_ARGS__)
+#define dma_set_memory_burst(...)   ocm3_nop(0, __VA_ARGS__)
+#define dma_set_peripheral_burst(...) ocm3_nop(0, __VA_ARGS__)
+#define dma_enable_half_transfer_interrupt(...) ocm3_nop(0, __VA_ARGS__)
+#define dma_enable_transfer_complete_interrupt(...) ocm3_nop(0, __VA_ARGS__)
+#define dma_get_interrupt_flag(...) ocm3_zero(0, __VA_ARGS__)
+#define dma_clear_interrupt_flags(...) ocm3_nop(0, __VA_ARGS__)
+
+/* ADC */
+#define ADC1                        0x40012000
+#define ADC_DR(x)                   OCM3_REG((x) + 0x4c)
+#define ADC_CHANNEL_TEMP            16
+#define ADC_CHANNEL_VREF            17
+#define ADC_CHANNEL_VBAT            18
+#define ADC_CCR_ADCPRE_BY8          3
+#define ADC_CCR_MULTI_INDEPENDENT   0
+#define ADC_SMPR_SMP_480CYC         7
+#define ADC_CR1_RES_12BIT           0
+#define adc_power_off(...)          ocm3_nop(0, __VA_ARGS__)
+#define adc_power_on(...)           ocm3_nop(0, __VA_ARGS__)
+#define adc_disable_dma(...)        ocm3_nop(0, __VA_ARGS__)
+#define adc_enable_dma(...)         ocm3_nop(0, __VA_ARGS__)
+#define adc_set_clk_prescale(...)   ocm3_nop(0, __VA_ARGS__)
+#define adc_set_multi_mode(...)     ocm3_nop(0, __VA_ARGS__)
+#define adc_enable_scan_mode(...)   ocm3_nop(0, __VA_ARGS__)
+#define adc_set_continuous_conversion_mode(...) ocm3_nop(0, __VA_ARGS__)
+#define adc_disable_external_trigger_regular(...) ocm3_nop(0, __VA_ARGS__)
+#define adc_disable_external_trigger_injected(...) ocm3_nop(0, __VA_ARGS__)
+#define adc_set_right_aligned(...)  ocm3_nop(0, __VA_ARGS__)
+#define adc_enable_temperature_sensor() ocm3_nop(0)
+#define adc_enable_vbat_sensor()    ocm3_nop(0)
+#define adc_disable_vbat_sensor()   ocm3_nop(0)
+#define adc_set_dma_continue(...)   ocm3_nop(0, __VA_ARGS__)
+#define adc_set_regular_sequence(...) ocm3_nop(0, __VA_ARGS__)
+#define adc_set_sample_time_on_all_channels(...) ocm3_nop(0, __VA_ARGS__)
+#define adc_set_resolution(...)     ocm3_nop(0, __VA_ARGS__)
+#define adc_start_conversion_regular(...) ocm3_nop(0, __VA_ARGS__)
+
+/* GPIO */
+#define GPIOA                       0x40020000
+#define GPIOB                       0x40020400
+#define GPIOC                       0x40020800
+#define GPIOD                       0x40020c00
+#define GPIOE                       0x40021000
+#define GPIO0                       (1 << 0)
+#define GPIO1                       (1 << 1)
+#define GPIO2                       (1 << 2)
+#define GPIO3                       (1 << 3)
+#define GPIO4                       (1 << 4)
+#define GPIO5                       (1 << 5)
+#define GPIO6                       (1 << 6)
+#define GPIO7                       (1 << 7)
+#define GPIO8                       (1 << 8)
+#define GPIO9                       (1 << 9)
+#define GPIO10                      (1 << 10)
+#define GPIO11                      (1 << 11)
+#define GPIO12                      (1 << 12)
+#define GPIO13                      (1 << 13)
+#define GPIO14                      (1 << 14)
+#define GPIO15                      (1 << 15)
+#define GPIO_ALL                    0xffff
+uint16_t gpio_get(uint32_t gpioport, uint16_t gpios);  // Defined by a test
+#define gpio_set(...)               ocm3_nop(0, __VA_ARGS__)
+#define gpio_clear(...)             ocm3_nop(0, __VA_ARGS__)
+
+/* STM32F1 GPIO, AFIO, and USART, as used by the DFU programmer */
+#define GPIO_MODE_INPUT             0
+#define GPIO_MODE_OUTPUT_50_MHZ     3
+#define GPIO_CNF_INPUT_FLOAT        1
+#define GPIO_CNF_INPUT_PULL_UPDOWN  2
+#define GPIO_CNF_OUTPUT_PUSHPULL    0
+#define GPIO_CNF_OUTPUT_ALTFN_PUSHPULL 2
+#define gpio_set_mode(...)          ocm3_nop(0, __VA_ARGS__)
+#define AFIO_MAPR                   OCM3_REG(0x40010004)
+#define AFIO_MAPR_USART1_REMAP      (1 << 2)
+#define USART1                      0x40013800
+#define USART_SR(x)                 OCM3_REG((x) + 0x00)
+#define USART_DR(x)                 OCM3_REG((x) + 0x04)
+#define USART_SR_TXE                (1 << 7)
+#define USART_SR_TC                 (1 << 6)
+#define USART_DR_MASK               0x1ff
+#define USART_STOPBITS_1            0
+#define USART_MODE_TX_RX            0x0c
+#define USART_PARITY_NONE           0
+#define USART_FLOWCONTROL_NONE      0
+#define usart_set_baudrate(...)     ocm3_nop(0, __VA_ARGS__)
+#define usart_set_databits(...)     ocm3_nop(0, __VA_ARGS__)
+#define usart_set_stopbits(...)     ocm3_nop(0, __VA_ARGS__)
+#define usart_set_mode(...)         ocm3_nop(0, __VA_ARGS__)
+#define usart_set_parity(...)       ocm3_nop(0, __VA_ARGS__)
+#define usart_set_flow_control(...) ocm3_nop(0, __VA_ARGS__)
+#define usart_enable(...)           ocm3_nop(0, __VA_ARGS__)
+
+/* Device ID, which a test defines */
+extern uint8_t ocm3_unique_id[12];
+#define DESIG_UNIQUE_ID_BASE        ((uintptr_t) ocm3_unique_id)
+
+/*
+ * GPIO input and DMA stream progress are read through functions which a
+ * test defines, so that it can model a sampled bus as time passes.
+ */
+volatile uint32_t *ocm3_gpio_idr(uint32_t port);
+uint32_t ocm3_dma_sndtr(uint32_t dma, uint32_t stream);
+#define GPIO_IDR(port)              (*ocm3_gpio_idr(port))
+#define DMA_SNDTR(dma, stream)      ocm3_dma_sndtr(dma, stream)
+
+/* EXTI; a test delivers the interrupt when it sees a pending request */
+#define EXTI_BASE                   0x40013c00
+#define EXTI_SWIER                  OCM3_REG(EXTI_BASE + 0x10)
+#define EXTI_PR                     OCM3_REG(EXTI_BASE + 0x14)
+#define EXTI12                      (1 << 12)
+#define EXTI_TRIGGER_BOTH           2
+#define exti_select_source(...)     ocm3_nop(0, __VA_ARGS__)
+#define exti_set_trigger(...)       ocm3_nop(0, __VA_ARGS__)
+#define exti_enable_request(...)    ocm3_nop(0, __VA_ARGS__)
+#define exti_reset_request(...)     ocm3_nop(0, __VA_ARGS__)
+
+/* RCC registers */
+#define RCC_BASE                    0x40023800
+#define RCC_APB1RSTR                OCM3_REG(RCC_BASE + 0x20)
+#define RCC_APB2RSTR                OCM3_REG(RCC_BASE + 0x24)
+#define RCC_APB1ENR                 OCM3_REG(RCC_BASE + 0x40)
+#define RCC_APB2ENR                 OCM3_REG(RCC_BASE + 0x44)
+#define RCC_APB1ENR_TIM4EN          (1 << 2)
+#define RCC_APB1RSTR_TIM4RST        (1 << 2)
+#define RCC_APB2ENR_TIM10EN         (1 << 17)
+#define RCC_APB2RSTR_TIM10RST       (1 << 17)
+#define RCC_APB2ENR_TIM1EN          (1 << 0)
+#define RCC_APB2RSTR_TIM1RST        (1 << 0)
+
+/*
+ * RTC, PWR, and backup domain RCC. The RTC block has its own backing
+ * array, defined by a test which includes fw/rtc.c, so that the backup
+ * registers do not alias registers of other peripherals.
+ */
+extern volatile uint32_t ocm3_rtc_regs[32];
+#define RTC_BASE                    0x40002800
+#define OCM3_RTC_REG(off)           (ocm3_rtc_regs[(off) / 4])
+#define RTC_TR                      OCM3_RTC_REG(0x00)
+#define RTC_DR                      OCM3_RTC_REG(0x04)
+#define RTC_CR                      OCM3_RTC_REG(0x08)
+#define RTC_ISR                     OCM3_RTC_REG(0x0c)
+#define RTC_PRER                    OCM3_RTC_REG(0x10)
+#define RTC_WUTR                    OCM3_RTC_REG(0x14)
+#define RTC_CALIBR                  OCM3_RTC_REG(0x18)
+#define RTC_ALRMAR                  OCM3_RTC_REG(0x1c)
+#define RTC_ALRMBR                  OCM3_RTC_REG(0x20)
+#define RTC_WPR                     OCM3_RTC_REG(0x24)
+#define RTC_SSR                     OCM3_RTC_REG(0x28)
+#define RTC_BKPXR(x)                OCM3_RTC_REG(0x50 + (x) * 4)
+#define RTC_TR_PM                   (1 << 22)
+#define RTC_CR_COE                  (1 << 23)
+#define RTC_CR_TSIE                 (1 << 15)
+#define RTC_CR_WUTIE                (1 << 14)
+#define RTC_CR_ALRBIE               (1 << 13)
+#define RTC_CR_ALRAIE               (1 << 12)
+#define RTC_CR_TSE                  (1 << 11)
+#define RTC_CR_WUTE                 (1 << 10)
+#define RTC_CR_ALRBE                (1 << 9)
+#define RTC_CR_ALRAE                (1 << 8)
+#define RTC_CR_FMT                  (1 << 6)
+#define RTC_ISR_TSOVF               (1 << 12)
+#define RTC_ISR_TSF                 (1 << 11)
+#define RTC_ISR_WUTF                (1 << 10)
+#define RTC_ISR_ALRBF               (1 << 9)
+#define RTC_ISR_ALRAF               (1 << 8)
+#define RTC_ISR_INIT                (1 << 7)
+#define RTC_ISR_INITF               (1 << 6)
+#define RTC_ISR_RSF                 (1 << 5)
+#define RTC_PRER_PREDIV_A_MASK      0x7f
+#define RTC_PRER_PREDIV_S_MASK      0x1fff
+#define RTC_CALIBR_DCS              (1 << 7)
+#define RTC_CALIBR_DC_MASK          0x1f
+#define RTC_ALRMXR_MSK1             (1 << 7)
+#define RTC_ALRMXR_MSK2             (1 << 15)
+#define RTC_ALRMXR_MSK3             (1 << 23)
+#define RTC_ALRMXR_MSK4             (1U << 31)
+#define NVIC_RTC_WKUP_IRQ           3
+#define NVIC_RTC_ALARM_IRQ          41
+
+#define PWR_BASE                    0x40007000
+#define PWR_CR                      OCM3_REG(PWR_BASE + 0x00)
+#define PWR_CSR                     OCM3_REG(PWR_BASE + 0x04)
+#define PWR_CR_DBP                  (1 << 8)
+#define PWR_CSR_BRE                 (1 << 9)
+
+#define RCC_CR                      OCM3_REG(RCC_BASE + 0x00)
+#define RCC_BDCR                    OCM3_REG(RCC_BASE + 0x70)
+#define RCC_CR_HSEON                (1 << 16)
+#define RCC_CR_HSERDY               (1 << 17)
+#define RCC_BDCR_LSEON              (1 << 0)
+#define RCC_BDCR_LSERDY             (1 << 1)
+#define RCC_BDCR_LSEBYP             (1 << 2)
+#define RCC_BDCR_RTCEN              (1 << 15)
+#define RCC_APB1ENR_PWREN           (1 << 28)
+enum rcc_osc { RCC_HSE, RCC_LSE, RCC_LSI };
+#define rcc_is_osc_ready(...)       (ocm3_zero(0, __VA_ARGS__) == 0)
+#define rcc_osc_on(...)             ocm3_nop(0, __VA_ARGS__)
+#define rcc_wait_for_osc_ready(...) ocm3_nop(0, __VA_ARGS__)
+#define rcc_set_rtcpre(...)         ocm3_nop(0, __VA_ARGS__)
+#define rcc_backupdomain_reset()    ocm3_nop(0)
+#define rcc_peripheral_enable_clock(...) ocm3_nop(0, __VA_ARGS__)
+
+/* Timers; a test which drives PWM output defines timer_set_oc_value() */
+#define TIM1                        0x40010000
+#define TIM4                        0x40000800
+#define TIM10                       0x40014400
+#define TIM_SR(x)                   OCM3_REG((x) + 0x10)
+#define TIM_DIER(x)                 OCM3_REG((x) + 0x0c)
+#define TIM_CCR4(x)                 OCM3_REG((x) + 0x40)
+#define TIM4_CCMR2                  OCM3_REG(TIM4 + 0x1c)
+#define TIM4_CCER                   OCM3_REG(TIM4 + 0x20)
+#define TIM_OC1                     0
+#define TIM_OC4                     6
+#define TIM_DIER_CC4IE              (1 << 4)
+#define TIM_DIER_UDE                (1 << 8)
+#define TIM_CCMR2_IC4PSC_MASK       (3 << 10)
+#define TIM_CCMR2_IC4PSC_OFF        (0 << 10)
+#define TIM_CCMR2_CC4S_MASK         (3 << 8)
+#define TIM_CCMR2_CC4S_IN_TI4       (1 << 8)
+#define TIM_CCMR2_IC4F_MASK         (15 << 12)
+#define TIM_CCMR2_IC4F_OFF          (0 << 12)
+#define TIM_CCER_CC4P               (1 << 13)
+#define TIM_CCER_CC4NP              (1 << 15)
+#define TIM_CR1_CKD_CK_INT          0
+#define TIM_CR1_CMS_EDGE            0
+#define TIM_CR1_DIR_UP              0
+#define TIM_OCM_PWM1                6
+#define TIM_EGR_UG                  1
+#define timer_clear_flag(...)       ocm3_nop(0, __VA_ARGS__)
+#define timer_disable_oc_output(...) ocm3_nop(0, __VA_ARGS__)
+#define timer_enable_oc_output(...) ocm3_nop(0, __VA_ARGS__)
+#define timer_set_mode(...)         ocm3_nop(0, __VA_ARGS__)
+#define timer_set_prescaler(...)    ocm3_nop(0, __VA_ARGS__)
+#define timer_set_repetition_counter(...) ocm3_nop(0, __VA_ARGS__)
+#define timer_enable_preload(...)   ocm3_nop(0, __VA_ARGS__)
+#define timer_continuous_mode(...)  ocm3_nop(0, __VA_ARGS__)
+#define timer_set_period(...)       ocm3_nop(0, __VA_ARGS__)
+#define timer_set_oc_mode(...)      ocm3_nop(0, __VA_ARGS__)
+#define timer_generate_event(...)   ocm3_nop(0, __VA_ARGS__)
+#define timer_enable_counter(...)   ocm3_nop(0, __VA_ARGS__)
+#define timer_disable_counter(...)  ocm3_nop(0, __VA_ARGS__)
+#define timer_enable_irq(...)       ocm3_nop(0, __VA_ARGS__)
+void timer_set_oc_value(uint32_t timer, int oc, uint32_t value);
+
+/*
+ * Flash; a test which programs flash maps memory at FLASH_BASE and
+ * defines the erase and program operations.
+ */
+#define FLASH_BASE                  ((uintptr_t) 0x08000000)
+#define FLASH_MEM_INTERFACE_BASE    0x40023c00
+#define FLASH_CR                    OCM3_REG(FLASH_MEM_INTERFACE_BASE + 0x10)
+#define FLASH_CR_LOCK               (1U << 31)
+#define FLASH_CR_PROGRAM_X32        2
+#define flash_unlock()              ocm3_nop(0)
+#define flash_lock()                ocm3_nop(0)
+#define flash_dcache_disable()      ocm3_nop(0)
+#define flash_dcache_reset()        ocm3_nop(0)
+#define flash_dcache_enable()       ocm3_nop(0)
+void flash_erase_sector(uint8_t sector, uint32_t program_size);
+void flash_program_word(uint32_t address, uint32_t data);
+void flash_program_half_word(uint32_t address, uint16_t data);
+void flash_program_byte(uint32_t address, uint8_t data);
+
+/* STM32F1 page erase and status, defined by a test */
+#define FLASH_SR_PGERR              (1 << 2)
+#define FLASH_SR_WRPRTERR           (1 << 4)
+void flash_erase_page(uint32_t page_address);
+uint32_t flash_get_status_flags(void);
+void flash_clear_status_flags(void);
+
+/* System reset; a test defines what a reset does */
+void scb_reset_system(void);
+
+/* Independent watchdog */
+#define iwdg_reset()                ocm3_nop(0)
+#define iwdg_start()                ocm3_nop(0)
+#define iwdg_set_period_ms(...)     ocm3_nop(0, __VA_ARGS__)
+
+/* The vector table address tells firmware which slot it runs from */
+extern uintptr_t ocm3_vector_base;
+#define vector_table                (*(uint8_t *) ocm3_vector_base)
+
+#endif /* _LIBOPENCM3_HOST_H */
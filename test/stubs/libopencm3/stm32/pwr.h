@@ -0,0 +1 @@
+#include <libopencm3/host.h>
@@ -0,0 +1,77 @@
+/*
+ * This is free and unencumbered software released into the public domain.
+ * See the LICENSE file for additional details.
+ *
+ * Designed by Chris Hooper in 2025.
+ *
+ * ---------------------------------------------------------------------
+ *
+ * Host replacement for the libopencm3 USB DFU class definitions, as in
+ * the DFU 1.1 specification.
+ */
+
+#ifndef _LIBOPENCM3_DFU_H
+#define _LIBOPENCM3_DFU_H
+
+#include <stdint.h>
+
+enum dfu_req {
+    DFU_DETACH,
+    DFU_DNLOAD,
+    DFU_UPLOAD,
+    DFU_GETSTATUS,
+    DFU_CLRSTATUS,
+    DFU_GETSTATE,
+    DFU_ABORT,
+};
+
+enum dfu_status {
+    DFU_STATUS_OK,
+    DFU_STATUS_ERR_TARGET,
+    DFU_STATUS_ERR_FILE,
+    DFU_STATUS_ERR_WRITE,
+    DFU_STATUS_ERR_ERASE,
+    DFU_STATUS_ERR_CHECK_ERASED,
+    DFU_STATUS_ERR_PROG,
+    DFU_STATUS_ERR_VERIFY,
+    DFU_STATUS_ERR_ADDRESS,
+    DFU_STATUS_ERR_NOTDONE,
+    DFU_STATUS_ERR_FIRMWARE,
+    DFU_STATUS_ERR_VENDOR,
+    DFU_STATUS_ERR_USBR,
+    DFU_STATUS_ERR_POR,
+    DFU_STATUS_ERR_UNKNOWN,
+    DFU_STATUS_ERR_STALLEDPKT,
+};
+
+enum dfu_state {
+    STATE_APP_IDLE,
+    STATE_APP_DETACH,
+    STATE_DFU_IDLE,
+    STATE_DFU_DNLOAD_SYNC,
+    STATE_DFU_DNBUSY,
+    STATE_DFU_DNLOAD_IDLE,
+    STATE_DFU_MANIFEST_SYNC,
+    STATE_DFU_MANIFEST,
+    STATE_DFU_MANIFEST_WAIT_RESET,
+    STATE_DFU_UPLOAD_IDLE,
+    STATE_DFU_ERROR,
+};
+
+#define DFU_FUNCTIONAL              0x21
+
+#define USB_DFU_CAN_DOWNLOAD        0x01
+#define USB_DFU_CAN_UPLOAD          0x02
+#define USB_DFU_MANIFEST_TOLERANT   0x04
+#define USB_DFU_WILL_DETACH         0x08
+
+struct usb_dfu_descriptor {
+    uint8_t  bLength;
+    uint8_t  bDescriptorType;
+    uint8_t  bmAttributes;
+    uint16_t wDetachTimeout;
+    uint16_t wTransferSize;
+    uint16_t bcdDFUVersion;
+} __attribute__((packed));
+
+#endif /* _LIBOPENCM3_DFU_H */
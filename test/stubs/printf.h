@@ -0,0 +1,24 @@
+/*
+ * This is free and unencumbered software released into the public domain.
+ * See the LICENSE file for additional details.
+ *
+ * Designed by Chris Hooper in 2025.
+ *
+ * ---------------------------------------------------------------------
+ *
+ * Host replacement for the firmware printf.h, mapping output to stdio.
+ */
+
+#ifndef _PRINTF_H
+#define _PRINTF_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdarg.h>
+#include <stdio.h>
+
+/* glibc dprintf() writes to a file descriptor; firmware takes a mask */
+#define dprintf fw_dprintf
+void dprintf(uint32_t mask, const char *fmt, ...);
+
+#endif /* _PRINTF_H */
@@ -0,0 +1,63 @@
+/*
+ * This is free and unencumbered software released into the public domain.
+ * See the LICENSE file for additional details.
+ *
+ * Designed by Chris Hooper in 2025.
+ *
+ * ---------------------------------------------------------------------
+ *
+ * Host replacement for the USB Host Library usbh_conf.h. The limits
+ * match cubemx/USB_HOST/Target/usbh_conf.h, without the STM32 HAL.
+ */
+
+#ifndef __USBH_CONF__H__
+#define __USBH_CONF__H__
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include "main.h"
+#include "printf.h"
+
+#define __IO volatile
+
+typedef enum {
+    HAL_OK      = 0x00U,
+    HAL_ERROR   = 0x01U,
+    HAL_BUSY    = 0x02U,
+    HAL_TIMEOUT = 0x03U
+} HAL_StatusTypeDef;
+
+/* Host controller handle, which a host HCD model fills in */
+typedef struct {
+    void *pData;
+} HCD_HandleTypeDef;
+
+uint32_t HAL_HCD_GetCurrentFrame(HCD_HandleTypeDef *hhcd);
+
+#define USBH_MAX_NUM_ENDPOINTS        5U
+#define USBH_MAX_NUM_INTERFACES       10U
+#define USBH_MAX_NUM_CONFIGURATION    1U
+#define USBH_KEEP_CFG_DESCRIPTOR      1U
+#define USBH_MAX_NUM_SUPPORTED_CLASS  5U
+#define USBH_MAX_SIZE_CONFIGURATION   256U
+#define USBH_MAX_DATA_BUFFER          512U
+#define USBH_DEBUG_LEVEL              0U
+#define USBH_USE_OS                   0U
+
+#define HOST_FS  0
+#define HOST_HS  1
+
+#define UNUSED(X) (void)X  // From the STM32 HAL
+
+#define USBH_malloc  malloc
+#define USBH_free    free
+#define USBH_memset  memset
+#define USBH_memcpy  memcpy
+
+/* Not shown, but arguments are still evaluated for type and use */
+#define USBH_UsrLog(...) do { if (0) printf(__VA_ARGS__); } while (0)
+#define USBH_ErrLog(...) do { if (0) printf(__VA_ARGS__); } while (0)
+#define USBH_DbgLog(...) do { if (0) printf(__VA_ARGS__); } while (0)
+
+#endif /* __USBH_CONF__H__ */
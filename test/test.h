@@ -0,0 +1,40 @@
+/*
+ * This is free and unencumbered software released into the public domain.
+ * See the LICENSE file for additional details.
+ *
+ * Designed by Chris Hooper in 2025.
+ *
+ * ---------------------------------------------------------------------
+ *
+ * Common check and result reporting for host tests.
+ */
+
+#ifndef _TEST_H
+#define _TEST_H
+
+#include <stdio.h>
+
+static unsigned int test_checks;
+static unsigned int test_fails;
+
+#define CHECK(x) do {                                                   \
+            test_checks++;                                              \
+            if (!(x)) {                                                 \
+                test_fails++;                                           \
+                fprintf(stderr, "%s:%d: check failed: %s\n",            \
+                        __FILE__, __LINE__, #x);                        \
+            }                                                           \
+        } while (0)
+
+/*
+ * test_result() reports the number of failed checks and returns the
+ * process exit code.
+ */
+static inline int
+test_result(const char *name)
+{
+    printf("%s: %u checks, %u failed\n", name, test_checks, test_fails);
+    return (test_fails != 0);
+}
+
+#endif /* _TEST_H */
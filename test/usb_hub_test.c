@@ -0,0 +1,836 @@
+/*
+ * This is free and unencumbered software released into the public domain.
+ * See the LICENSE file for additional details.
+ *
+ * Designed by Chris Hooper in 2025.
+ *
+ * ---------------------------------------------------------------------
+ *
+ * Host simulation of device enumeration behind a USB hub. The USB Host
+ * Library core and hub class run unmodified against a fake host
+ * controller, which models a 4-port hub and the devices plugged into
+ * it (descriptors, address assignment, port power and reset, and the
+ * hub status change endpoint) on a simulated clock. The per-port
+ * round-robin of fw/cubeusb.c drives the handles. The time until every
+ * device has finished class setup is measured, along with the longest
+ * gap in polling of a device which is already running.
+ *
+ * The previous scheme is reproduced in the round-robin: hub delays
+ * block the main loop, the hub waits for each device to finish
+ * enumerating before handling the next port, and a new device holds
+ * its port busy until its class setup is done.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* Progress messages of the library are not shown */
+static int
+lib_printf(const char *fmt, ...)
+{
+    (void) fmt;
+    return (0);
+}
+#define printf lib_printf
+
+#include "../fw/cubemx/Middlewares/ST/STM32_USB_Host_Library/Core/Src/usbh_core.c"
+#include "../fw/cubemx/Middlewares/ST/STM32_USB_Host_Library/Core/Src/usbh_ctlreq.c"
+#include "../fw/cubemx/Middlewares/ST/STM32_USB_Host_Library/Core/Src/usbh_ioreq.c"
+#include "../fw/cubemx/Middlewares/ST/STM32_USB_Host_Library/Core/Src/usbh_pipes.c"
+#include "../fw/cubemx/Middlewares/ST/STM32_USB_Host_Library/Class/HUB/usbh_hub.c"
+
+#undef printf
+
+#include "test.h"
+
+#define SIM_PORTS      4        // Downstream ports of the hub
+#define SIM_DEVS       (SIM_PORTS + 1)  // Hub, then one device per port
+#define SIM_LIMIT_MS   20000
+#define POLL_USEC      5        // One step of the port round-robin, +-2
+#define STAGE_USEC     250      // Full speed control transfer stage
+#define STAGE_LS_USEC  1000     // Low speed control transfer stage
+#define NAK_USEC       125      // Interrupt IN answered with NAK
+#define RESET_USEC     10000    // Hub port reset signalling
+#define BUSY_POLLS     500      // Polls before a busy device is left
+
+#define ARRAY_SIZE(x) ((sizeof (x) / sizeof ((x)[0])))
+
+#define SIM_CLASS      0xff     // Interface class of downstream devices
+#define SIM_HUB_ADDR   USBH_DEVICE_ADDRESS
+
+/* Hub port status and change bits */
+#define PORT_CONNECTION  BIT(0)
+#define PORT_ENABLE      BIT(1)
+#define PORT_RESET       BIT(4)
+#define PORT_POWER       BIT(8)
+#define PORT_LOW_SPEED   BIT(9)
+#define C_PORT_RESET     BIT(4)
+
+typedef struct {
+    const char *name;
+    uint8_t     lowspeed;
+    uint8_t     mps;         // EP0 max packet size
+    uint8_t     strings;     // String descriptors read at enumeration
+    uint8_t     class_reqs;  // Class requests during class setup
+    uint16_t    class_ms;    // Device settling time after each of them
+} dev_type_t;
+
+typedef struct {
+    const dev_type_t *type;
+    uint8_t  address;       // Current USB address
+    uint8_t  setup[8];      // Last SETUP packet
+    uint16_t status;        // Hub port status
+    uint16_t change;        // Hub port change
+    uint64_t plug_at;       // usec when plugged into the hub
+    uint64_t reset_end;     // usec when port reset completes
+    uint64_t ready_at;      // usec when class setup completed
+    uint64_t last_poll;     // usec of the last USBH_Process() once ready
+} sim_dev_t;
+
+typedef struct {
+    uint8_t  dev_addr;
+    uint8_t  ep_type;
+    uint8_t  result;        // URB state once the transfer completes
+    uint64_t done;          // usec when the transfer completes
+} sim_hc_t;
+
+typedef struct {
+    const char       *name;
+    const dev_type_t *dev[SIM_PORTS];
+    uint              plug_ms[SIM_PORTS];  // Plugged after hub connection
+} scenario_t;
+
+typedef struct {
+    uint reqs;
+    uint wait_start;
+} sim_class_t;
+
+USBH_HandleTypeDef usb_handle[2][MAX_HUB_PORTS + 1];
+HCD_HandleTypeDef  _hHCD[2];
+
+static uint64_t  now;               // Simulated time (usec)
+static uint      sim_old;           // Run the previous scheme
+static sim_dev_t sim_dev[SIM_DEVS];
+static sim_hc_t  sim_hc[USBH_MAX_PIPES_NBR];
+static uint      hp_cur;
+static uint      collisions;        // Default address answered twice
+static uint64_t  stall_max;         // Longest poll gap of a ready device
+static uint32_t  rand_state = 1;
+
+static const dev_type_t hub_type = { "hub",      0, 64, 0, 0, 0 };
+static const dev_type_t keyboard = { "keyboard", 1,  8, 2, 3, 0 };
+static const dev_type_t mouse    = { "mouse",    1,  8, 2, 2, 0 };
+static const dev_type_t gamepad  = { "gamepad",  0, 64, 3, 2, 0 };
+static const dev_type_t disk     = { "disk",     0, 64, 3, 8, 100 };
+
+static const scenario_t scenarios[] = {
+    { "keyboard",         { &keyboard }, { 0 } },
+    { "keyboard, mouse",  { &keyboard, &mouse }, { 0 } },
+    { "4 HID",            { &keyboard, &mouse, &gamepad, &gamepad }, { 0 } },
+    { "disk first",       { &disk, &keyboard, &mouse, &gamepad }, { 0 } },
+    { "hot plug",         { &keyboard, &mouse, &gamepad, &gamepad },
+                          { 0, 0, 0, 3000 } },
+};
+
+static uint
+rand32(void)
+{
+    rand_state = rand_state * 1103515245 + 12345;
+    return (rand_state >> 8);
+}
+
+void
+fw_dprintf(uint32_t mask, const char *fmt, ...)
+{
+    (void) mask;
+    (void) fmt;
+}
+
+/*
+ * sim_advance() moves the clock forward, delivering a SOF to the
+ * handle attached to the host controller at each frame.
+ */
+static void
+sim_advance(uint usec)
+{
+    uint64_t end = now + usec;
+
+    while (now / 1000 != end / 1000) {
+        now = (now / 1000 + 1) * 1000;
+        if (_hHCD[0].pData != NULL)
+            USBH_LL_IncTimer(_hHCD[0].pData);
+    }
+    now = end;
+}
+
+void
+USBH_Delay(uint32_t Delay)
+{
+    sim_advance(Delay * 1000);
+}
+
+uint32_t
+USBH_GetMsec(void)
+{
+    return ((uint32_t) (now / 1000));
+}
+
+uint32_t
+HAL_HCD_GetCurrentFrame(HCD_HandleTypeDef *hhcd)
+{
+    (void) hhcd;
+    return ((uint32_t) (now / 1000));
+}
+
+uint
+get_port(USBH_HandleTypeDef *phost)
+{
+    uint devnum;
+    return (get_portdev(phost, &devnum));
+}
+
+uint
+get_portdev(USBH_HandleTypeDef *phost, uint *portdev)
+{
+    uint cur;
+    uint port;
+    for (cur = 0; cur < MAX_HUB_PORTS + 1; cur++)
+        for (port = 0; port < 2; port++)
+            if (phost == &usb_handle[port][cur]) {
+                *portdev = cur;
+                return (port);
+            }
+    *portdev = 0;
+    return (0);
+}
+
+USBH_HandleTypeDef *
+USBH_get_root_device(USBH_HandleTypeDef *phost)
+{
+    return (&usb_handle[get_port(phost)][0]);
+}
+
+void
+USBH_remove_subdevices(USBH_HandleTypeDef *phost)
+{
+    (void) phost;
+}
+
+USBH_StatusTypeDef
+USBH_register_class(USBH_HandleTypeDef *handle, USBH_ClassTypeDef *class,
+                    uint size)
+{
+    USBH_ClassTypeDef *nclass = USBH_malloc(size);
+    memcpy(nclass, class, size);
+    nclass->pData = NULL;
+    return (USBH_RegisterClass(handle, nclass));
+}
+
+/* sim_port_update() completes port resets and plugs in new devices */
+static void
+sim_port_update(sim_dev_t *dev)
+{
+    if ((dev->status & PORT_RESET) && (now >= dev->reset_end)) {
+        dev->status &= ~PORT_RESET;
+        dev->status |= PORT_ENABLE;
+        dev->change |= C_PORT_RESET;
+        dev->address = 0;
+    }
+    if ((dev->type != NULL) && (dev->status & PORT_POWER) &&
+        !(dev->status & PORT_CONNECTION) && (now >= dev->plug_at)) {
+        dev->status |= PORT_CONNECTION;
+        if (dev->type->lowspeed)
+            dev->status |= PORT_LOW_SPEED;
+        dev->change |= PORT_CONNECTION;
+    }
+}
+
+/*
+ * sim_find() returns the device which answers at an address. The hub
+ * forwards only to enabled ports; more than one device answering at
+ * the default address is a collision.
+ */
+static sim_dev_t *
+sim_find(uint addr)
+{
+    sim_dev_t *found = NULL;
+    uint       cur;
+
+    if (sim_dev[0].address == addr)
+        found = &sim_dev[0];
+    for (cur = 1; cur < SIM_DEVS; cur++) {
+        sim_dev_t *dev = &sim_dev[cur];
+        sim_port_update(dev);
+        if ((dev->type == NULL) || !(dev->status & PORT_ENABLE) ||
+            (dev->address != addr)) {
+            continue;
+        }
+        if (found != NULL)
+            collisions++;
+        found = dev;
+    }
+    return (found);
+}
+
+static uint
+put_string(uint8_t *buf, const char *str)
+{
+    uint len = 2;
+
+    for (; *str != '\0'; str++) {
+        buf[len++] = *str;
+        buf[len++] = 0;
+    }
+    buf[0] = len;
+    buf[1] = USB_DESC_TYPE_STRING;
+    return (len);
+}
+
+/*
+ * sim_descriptor() builds a standard descriptor of a device. Returns
+ * its length, or 0 if the device has no such descriptor.
+ */
+static uint
+sim_descriptor(sim_dev_t *dev, uint type, uint index, uint8_t *buf)
+{
+    const dev_type_t *t = dev->type;
+    uint hub = (dev == &sim_dev[0]);
+
+    switch (type) {
+        case USB_DESC_TYPE_DEVICE: {
+            const uint8_t desc[] = {
+                18, USB_DESC_TYPE_DEVICE, 0x00, 0x02,
+                hub ? USB_HUB_CLASS : 0, 0, 0, t->mps,
+                0x09, 0x12, dev - sim_dev, 0x70, 0x00, 0x01,
+                (t->strings > 0) ? 1 : 0, (t->strings > 1) ? 2 : 0,
+                (t->strings > 2) ? 3 : 0, 1
+            };
+            memcpy(buf, desc, sizeof (desc));
+            return (sizeof (desc));
+        }
+        case USB_DESC_TYPE_CONFIGURATION: {
+            const uint8_t desc[] = {
+                9, USB_DESC_TYPE_CONFIGURATION, 25, 0, 1, 1, 0, 0x80, 50,
+                9, USB_DESC_TYPE_INTERFACE, 0, 0, 1,
+                hub ? USB_HUB_CLASS : SIM_CLASS, 0, 0, 0,
+                7, USB_DESC_TYPE_ENDPOINT, 0x81, USB_EP_TYPE_INTR,
+                hub ? 1 : 8, 0, hub ? 255 : 10
+            };
+            memcpy(buf, desc, sizeof (desc));
+            return (sizeof (desc));
+        }
+        case USB_DESC_TYPE_STRING:
+            if (index == 0) {
+                const uint8_t desc[] = { 4, USB_DESC_TYPE_STRING, 0x09, 0x04 };
+                memcpy(buf, desc, sizeof (desc));
+                return (sizeof (desc));
+            }
+            return (put_string(buf, t->name));
+        case USB_DESCRIPTOR_HUB:
+            if (hub) {
+                const uint8_t desc[] = {
+                    9, USB_DESCRIPTOR_HUB, SIM_PORTS, 0, 0, 50, 100, 0, 0xff
+                };
+                memcpy(buf, desc, sizeof (desc));
+                return (sizeof (desc));
+            }
+            break;
+    }
+    return (0);
+}
+
+/*
+ * sim_data_in() answers the data stage of a control read. Returns the
+ * length, or -1 to stall.
+ */
+static int
+sim_data_in(sim_dev_t *dev, uint8_t *buf)
+{
+    uint8_t *s = dev->setup;
+
+    if ((s[0] == (USB_D2H | USB_REQ_RECIPIENT_OTHER | USB_REQ_TYPE_CLASS)) &&
+        (s[1] == USB_REQUEST_GET_STATUS) && (dev == &sim_dev[0]) &&
+        (s[4] >= 1) && (s[4] <= SIM_PORTS)) {
+        sim_dev_t *port = &sim_dev[s[4]];
+        sim_port_update(port);
+        buf[0] = port->status;
+        buf[1] = port->status >> 8;
+        buf[2] = port->change;
+        buf[3] = port->change >> 8;
+        return (4);
+    }
+    if (s[1] == USB_REQ_GET_DESCRIPTOR) {
+        int len = sim_descriptor(dev, s[3], s[2], buf);
+        return ((len > 0) ? len : -1);
+    }
+    return (-1);
+}
+
+/* sim_request_done() applies a request at its status stage */
+static void
+sim_request_done(sim_dev_t *dev)
+{
+    uint8_t *s = dev->setup;
+    uint     port = s[4];
+
+    if ((s[0] == USB_H2D) && (s[1] == USB_REQ_SET_ADDRESS)) {
+        dev->address = s[2];
+        return;
+    }
+    if ((dev != &sim_dev[0]) || (port < 1) || (port > SIM_PORTS) ||
+        (s[0] != (USB_H2D | USB_REQ_RECIPIENT_OTHER | USB_REQ_TYPE_CLASS)))
+        return;
+
+    dev = &sim_dev[port];
+    if (s[1] == USB_REQUEST_SET_FEATURE) {
+        if (s[2] == HUB_FEAT_SEL_PORT_POWER) {
+            dev->status |= PORT_POWER;
+        } else if ((s[2] == HUB_FEAT_SEL_PORT_RESET) &&
+                   (dev->status & PORT_CONNECTION)) {
+            dev->status |= PORT_RESET;
+            dev->status &= ~PORT_ENABLE;
+            dev->reset_end = now + RESET_USEC;
+        }
+    } else if ((s[1] == USB_REQUEST_CLEAR_FEATURE) &&
+               (s[2] >= HUB_FEAT_SEL_C_PORT_CONNECTION)) {
+        dev->change &= ~BIT(s[2] - HUB_FEAT_SEL_C_PORT_CONNECTION);
+    }
+    sim_port_update(dev);
+}
+
+USBH_StatusTypeDef
+USBH_LL_SubmitURB(USBH_HandleTypeDef *phost, uint8_t pipe, uint8_t direction,
+                  uint8_t ep_type, uint8_t token, uint8_t *pbuff,
+                  uint16_t length, uint8_t do_ping)
+{
+    sim_hc_t  *hc = &sim_hc[pipe];
+    sim_dev_t *dev = sim_find(hc->dev_addr);
+    uint8_t    buf[USBH_MAX_DATA_BUFFER];
+    int        len;
+
+    (void) phost;
+    (void) ep_type;
+    (void) do_ping;
+    hc->result = USBH_URB_DONE;
+    hc->done = now + STAGE_USEC;
+    if (dev == NULL) {
+        hc->result = USBH_URB_ERROR;  // No answer
+        hc->done = now + 3 * STAGE_USEC;
+        return (USBH_OK);
+    }
+    if (dev->type->lowspeed)
+        hc->done = now + STAGE_LS_USEC;
+
+    if (hc->ep_type == USB_EP_TYPE_INTR) {
+        /* Hub status change endpoint: bit n is set for a change on port n */
+        uint8_t map = 0;
+        uint    port;
+        for (port = 1; port <= SIM_PORTS; port++) {
+            sim_port_update(&sim_dev[port]);
+            if (sim_dev[port].change != 0)
+                map |= BIT(port);
+        }
+        if (map == 0) {
+            hc->result = USBH_URB_NOTREADY;
+            hc->done = now + NAK_USEC;
+        } else if (length > 0) {
+            pbuff[0] = map;
+        }
+    } else if (token == USBH_PID_SETUP) {
+        memcpy(dev->setup, pbuff, sizeof (dev->setup));
+    } else if (length == 0) {
+        sim_request_done(dev);
+    } else if (direction == 1) {
+        len = sim_data_in(dev, buf);
+        if (len < 0)
+            hc->result = USBH_URB_STALL;
+        else
+            memcpy(pbuff, buf, (len < length) ? len : length);
+    }
+    return (USBH_OK);
+}
+
+USBH_URBStateTypeDef
+USBH_LL_GetURBState(USBH_HandleTypeDef *phost, uint8_t pipe)
+{
+    (void) phost;
+    if (now < sim_hc[pipe].done)
+        return (USBH_URB_IDLE);
+    return ((USBH_URBStateTypeDef) sim_hc[pipe].result);
+}
+
+USBH_StatusTypeDef
+USBH_LL_OpenPipe(USBH_HandleTypeDef *phost, uint8_t pipe_num, uint8_t epnum,
+                 uint8_t dev_address, uint8_t speed, uint8_t ep_type,
+                 uint16_t mps)
+{
+    (void) phost;
+    (void) epnum;
+    (void) speed;
+    (void) mps;
+    sim_hc[pipe_num].dev_addr = dev_address;
+    sim_hc[pipe_num].ep_type = ep_type;
+    return (USBH_OK);
+}
+
+USBH_StatusTypeDef
+USBH_LL_ClosePipe(USBH_HandleTypeDef *phost, uint8_t pipe)
+{
+    (void) phost;
+    (void) pipe;
+    return (USBH_OK);
+}
+
+USBH_StatusTypeDef
+USBH_LL_Init(USBH_HandleTypeDef *phost)
+{
+    _hHCD[phost->id].pData = phost;
+    phost->pData = &_hHCD[phost->id];
+    USBH_LL_SetTimer(phost, HAL_HCD_GetCurrentFrame(phost->pData));
+    return (USBH_OK);
+}
+
+USBH_StatusTypeDef
+USBH_LL_DriverVBUS(USBH_HandleTypeDef *phost, uint8_t state)
+{
+    (void) phost;
+    (void) state;
+    return (USBH_OK);
+}
+
+USBH_StatusTypeDef
+USBH_LL_SetToggle(USBH_HandleTypeDef *phost, uint8_t pipe, uint8_t toggle)
+{
+    (void) phost;
+    (void) pipe;
+    (void) toggle;
+    return (USBH_OK);
+}
+
+USBH_StatusTypeDef
+USBH_LL_Start(USBH_HandleTypeDef *phost)
+{
+    (void) phost;
+    return (USBH_OK);
+}
+
+USBH_StatusTypeDef
+USBH_LL_Stop(USBH_HandleTypeDef *phost)
+{
+    (void) phost;
+    return (USBH_OK);
+}
+
+USBH_SpeedTypeDef
+USBH_LL_GetSpeed(USBH_HandleTypeDef *phost)
+{
+    (void) phost;
+    return (USBH_SPEED_FULL);
+}
+
+/* The hub is reset on the root port, and is then at address 0 */
+USBH_StatusTypeDef
+USBH_LL_ResetPort(USBH_HandleTypeDef *phost)
+{
+    sim_dev[0].address = 0;
+    USBH_LL_PortEnabled(phost);
+    return (USBH_OK);
+}
+
+/* USBH_switch_to_dev() points the shared control channels at a device */
+HAL_StatusTypeDef
+USBH_switch_to_dev(USBH_HandleTypeDef *phost)
+{
+    sim_hc[phost->Control.pipe_out].dev_addr = phost->device.address;
+    sim_hc[phost->Control.pipe_in].dev_addr = phost->device.address;
+    _hHCD[phost->id].pData = phost;
+    phost->pData = &_hHCD[phost->id];
+    return (HAL_OK);
+}
+
+static void
+user_process(USBH_HandleTypeDef *phost, uint8_t id)
+{
+    (void) phost;
+    (void) id;
+}
+
+/*
+ * Class driver of the downstream devices. Class setup issues a number
+ * of class requests, waiting for the device to settle after each.
+ */
+static USBH_StatusTypeDef
+sim_class_init(USBH_HandleTypeDef *phost)
+{
+    phost->USBH_ClassTypeDef_pData[0] = calloc(1, sizeof (sim_class_t));
+    phost->interfaces = 1;
+    return (USBH_OK);
+}
+
+static USBH_StatusTypeDef
+sim_class_deinit(USBH_HandleTypeDef *phost)
+{
+    free(phost->USBH_ClassTypeDef_pData[0]);
+    phost->USBH_ClassTypeDef_pData[0] = NULL;
+    return (USBH_OK);
+}
+
+static USBH_StatusTypeDef
+sim_class_requests(USBH_HandleTypeDef *phost)
+{
+    sim_class_t      *sc = phost->USBH_ClassTypeDef_pData[0];
+    const dev_type_t *type = sim_dev[phost->address].type;
+    static uint8_t    dummy[8];
+
+    if ((sc->reqs > 0) && (USBH_GetMsec() - sc->wait_start < type->class_ms))
+        return (USBH_BUSY);
+    if (sc->reqs == type->class_reqs)
+        return (USBH_OK);
+
+    if (phost->RequestState == CMD_SEND) {
+        phost->Control.setup.b.bmRequestType =
+                    USB_H2D | USB_REQ_RECIPIENT_INTERFACE | USB_REQ_TYPE_CLASS;
+        phost->Control.setup.b.bRequest = 0x0a;  // SET_IDLE
+        phost->Control.setup.b.wValue.w = 0;
+        phost->Control.setup.b.wIndex.w = 0;
+        phost->Control.setup.b.wLength.w = 0;
+    }
+    if (USBH_CtlReq(phost, dummy, 0) == USBH_OK) {
+        sc->reqs++;
+        sc->wait_start = USBH_GetMsec();
+    }
+    return (USBH_BUSY);
+}
+
+static USBH_StatusTypeDef
+sim_class_none(USBH_HandleTypeDef *phost)
+{
+    (void) phost;
+    return (USBH_OK);
+}
+
+static USBH_ClassTypeDef sim_class = {
+    "SIM",
+    SIM_CLASS,
+    NULL,
+    sim_class_init,
+    sim_class_deinit,
+    sim_class_requests,
+    sim_class_none,
+    sim_class_none,
+    NULL,
+};
+
+/*
+ * old_hub_blocked() reports whether the previous hub driver would
+ * still be inside USBH_Delay() (power good, port reset, and between
+ * ports), which kept the main loop from polling anything else.
+ */
+static uint
+old_hub_blocked(USBH_HandleTypeDef *phost)
+{
+    HUB_HandleTypeDef *hub;
+
+    if ((phost != &usb_handle[0][0]) || !phost->hub)
+        return (0);
+    hub = phost->USBH_ClassTypeDef_pData[0];
+    return ((hub->state == HUB_WAIT) ||
+            ((phost->gState == HOST_CLASS_REQUEST) &&
+             (hub->ctl_state == HUB_WAIT_PWRGOOD)));
+}
+
+/*
+ * old_hub_waits() reports whether the previous hub driver would still
+ * be waiting for the device on the current port to finish enumerating.
+ */
+static uint
+old_hub_waits(USBH_HandleTypeDef *phost)
+{
+    HUB_HandleTypeDef *hub;
+
+    if ((phost != &usb_handle[0][0]) || !phost->hub ||
+        (phost->gState != HOST_CLASS))
+        return (0);
+    hub = phost->USBH_ClassTypeDef_pData[0];
+    return ((hub->state == HUB_LOOP_PORT_ENUM) &&
+            (usb_handle[0][HUB_CurPort[0]].EnumState != ENUM_DONE));
+}
+
+/* old_busy() adds the previous hold of busy from attach to class setup */
+static uint
+old_busy(USBH_HandleTypeDef *phost)
+{
+    return ((phost->gState >= HOST_ENUMERATION) &&
+            (phost->gState < HOST_CLASS));
+}
+
+/*
+ * process_usb_port() is one step of the round-robin of process_usb_ports()
+ * in fw/cubeusb.c, which stays with a busy device for a while.
+ */
+static void
+process_usb_port(void)
+{
+    USBH_HandleTypeDef *phost = &usb_handle[0][hp_cur];
+    sim_dev_t          *dev = &sim_dev[hp_cur];
+
+    sim_advance(POLL_USEC - 2 + rand32() % 5);
+    switch (phost->valid) {
+        case 1:
+            if (sim_old && old_hub_waits(phost))
+                break;
+            USBH_switch_to_dev(phost);
+            USBH_Process(phost);
+
+            if ((hp_cur > 0) && (phost->gState == HOST_CLASS)) {
+                if (dev->ready_at == 0)
+                    dev->ready_at = now;
+                else if (stall_max < now - dev->last_poll)
+                    stall_max = now - dev->last_poll;
+                dev->last_poll = now;
+            }
+            if (sim_old && old_hub_blocked(phost))
+                return;
+            if (phost->busy || (sim_old && old_busy(phost))) {
+                if (++phost->poll_no_progress < BUSY_POLLS)
+                    return;
+            } else {
+                phost->poll_no_progress = 0;
+            }
+            break;
+        case 3:
+            phost->valid = 1;
+            break;
+    }
+    if (++hp_cur >= ARRAY_SIZE(usb_handle[0]))
+        hp_cur = 0;
+}
+
+static void
+sim_cleanup(void)
+{
+    uint cur;
+    uint class;
+
+    for (cur = 0; cur < ARRAY_SIZE(usb_handle[0]); cur++) {
+        USBH_HandleTypeDef *phost = &usb_handle[0][cur];
+        if (phost->valid == 0)
+            continue;
+        if (phost->pActiveClass != NULL)
+            phost->pActiveClass->DeInit(phost);
+        for (class = 0; class < phost->ClassNumber; class++)
+            free(phost->pClass[class]);
+    }
+    free(usb_handle[0][0].Pipes);
+}
+
+/*
+ * sim_run() connects the hub with the scenario's devices behind it and
+ * runs until each device has completed class setup. Returns the time
+ * for the last device to become ready, from its connection (msec).
+ */
+static uint
+sim_run(const scenario_t *sc, uint old)
+{
+    USBH_HandleTypeDef *root = &usb_handle[0][0];
+    uint64_t start;
+    uint     cur;
+    uint     ready = 0;
+    uint     last = 0;
+
+    memset(usb_handle, 0, sizeof (usb_handle));
+    memset(sim_dev, 0, sizeof (sim_dev));
+    memset(sim_hc, 0, sizeof (sim_hc));
+    memset(_hHCD, 0, sizeof (_hHCD));
+    now = 0;
+    hp_cur = 0;
+    collisions = 0;
+    stall_max = 0;
+    sim_old = old;
+
+    sim_dev[0].type = &hub_type;
+    sim_dev[0].address = 0;
+    for (cur = 0; cur < SIM_PORTS; cur++) {
+        sim_dev[cur + 1].type = sc->dev[cur];
+        sim_dev[cur + 1].plug_at = sc->plug_ms[cur] * 1000;
+    }
+
+    /* As cubeusb_init_port() */
+    root->valid = 1;
+    root->address = SIM_HUB_ADDR;
+    root->Pipes = USBH_malloc(sizeof (uint32_t) * USBH_MAX_PIPES_NBR);
+    USBH_Init(root, user_process, HOST_FS);
+    USBH_register_class(root, USBH_HUB_CLASS, sizeof (*USBH_HUB_CLASS));
+    USBH_register_class(root, &sim_class, sizeof (sim_class));
+    USBH_Start(root);
+    USBH_LL_Connect(root);
+
+    start = now;
+    while ((now - start < SIM_LIMIT_MS * 1000ULL) && (ready == 0)) {
+        process_usb_port();
+        ready = 1;
+        for (cur = 1; cur < SIM_DEVS; cur++)
+            if ((sim_dev[cur].type != NULL) && (sim_dev[cur].ready_at == 0))
+                ready = 0;
+    }
+    for (cur = 1; cur < SIM_DEVS; cur++) {
+        sim_dev_t *dev = &sim_dev[cur];
+        uint ms;
+        if ((dev->type == NULL) || (dev->ready_at == 0))
+            continue;
+        ms = (dev->ready_at - dev->plug_at) / 1000;
+        if (last < ms)
+            last = ms;
+    }
+    CHECK(ready);
+    CHECK(collisions == 0);
+    sim_cleanup();
+    return (last);
+}
+
+static void
+test_scenarios(void)
+{
+    uint cur;
+
+    printf("usb hub:\n");
+    printf("    devices          all ready  old  (ms)   longest poll gap  "
+           "old  (ms)\n");
+    for (cur = 0; cur < ARRAY_SIZE(scenarios); cur++) {
+        const scenario_t *sc = &scenarios[cur];
+        uint new_ms;
+        uint old_ms;
+        uint new_stall;
+        uint old_stall;
+        uint devs;
+        uint late = 0;
+
+        for (devs = 0; (devs < SIM_PORTS) && (sc->dev[devs] != NULL); devs++)
+            late |= sc->plug_ms[devs];
+        new_ms = sim_run(sc, 0);
+        new_stall = stall_max / 1000;
+        old_ms = sim_run(sc, 1);
+        old_stall = stall_max / 1000;
+
+        /* A late device waits mostly for the hub's status change poll */
+        if (devs == 1)
+            CHECK(new_ms <= old_ms + 1);
+        else if (!late)
+            CHECK(new_ms < old_ms);
+        if (devs > 1)
+            CHECK(new_stall < old_stall);
+        printf("    %-16s %9u %9u %14u %14u\n", sc->name, new_ms, old_ms,
+               new_stall, old_stall);
+    }
+    printf("    (ready is the end of class setup, from connection of the "
+           "hub or, for hot plug,\n     of the device; the poll gap is of "
+           "a device already ready)\n");
+}
+
+int
+main(void)
+{
+    test_scenarios();
+    return (test_result("usb_hub"));
+}